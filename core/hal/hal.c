@@ -39,6 +39,31 @@
 #define DRM_IOCTL_GEM_CLOSE 0xc0106401
 #endif
 
+#ifndef DRM_IOCTL_AMDGPU_GEM_USERPTR
+#define DRM_IOCTL_AMDGPU_GEM_USERPTR 0xc0186451 // DRM_IOWR(0x40 + 0x11, 24 bytes)
+#endif
+
+#ifndef DRM_IOCTL_PRIME_HANDLE_TO_FD
+#define DRM_IOCTL_PRIME_HANDLE_TO_FD 0xc00c642d
+#endif
+
+#ifndef DRM_IOCTL_PRIME_FD_TO_HANDLE
+#define DRM_IOCTL_PRIME_FD_TO_HANDLE 0xc00c642e
+#endif
+
+// Timeline syncobjs (same numbers as drm.h)
+#ifndef DRM_IOCTL_SYNCOBJ_CREATE
+#define DRM_IOCTL_SYNCOBJ_CREATE 0xc00864bf
+#define DRM_IOCTL_SYNCOBJ_DESTROY 0xc00864c0
+#define DRM_IOCTL_SYNCOBJ_HANDLE_TO_FD 0xc01064c1
+#define DRM_IOCTL_SYNCOBJ_TRANSFER 0xc02064cc
+#define DRM_IOCTL_SYNCOBJ_TIMELINE_SIGNAL 0xc01864cd
+#endif
+
+#ifndef DRM_SYNCOBJ_HANDLE_TO_FD_FLAGS_EXPORT_SYNC_FILE
+#define DRM_SYNCOBJ_HANDLE_TO_FD_FLAGS_EXPORT_SYNC_FILE (1 << 0)
+#endif
+
 // DRM structures (agnostic) - only define if not available
 #ifndef DRM_GEM_CLOSE
 union hal_drm_gem_create {
@@ -62,10 +87,60 @@ struct hal_drm_gem_close {
 };
 #endif
 
+// Same layout as the kernel's struct drm_amdgpu_gem_userptr
+struct hal_drm_gem_userptr {
+    uint64_t addr;
+    uint64_t size;
+    uint32_t flags;
+    uint32_t handle;
+};
+
+// Same layout as the kernel's struct drm_prime_handle
+struct hal_drm_prime_handle {
+    uint32_t handle;
+    uint32_t flags;
+    int32_t fd;
+};
+
+// Same layouts as the kernel's drm_syncobj_{create,destroy,handle,transfer,timeline_array}
+struct hal_drm_syncobj_create {
+    uint32_t handle;
+    uint32_t flags;
+};
+
+struct hal_drm_syncobj_destroy {
+    uint32_t handle;
+    uint32_t pad;
+};
+
+struct hal_drm_syncobj_handle {
+    uint32_t handle;
+    uint32_t flags;
+    int32_t fd;
+    uint32_t pad;
+};
+
+struct hal_drm_syncobj_transfer {
+    uint32_t src_handle;
+    uint32_t dst_handle;
+    uint64_t src_point;
+    uint64_t dst_point;
+    uint32_t flags;
+    uint32_t pad;
+};
+
+struct hal_drm_syncobj_timeline_array {
+    uint64_t handles;
+    uint64_t points;
+    uint32_t count_handles;
+    uint32_t flags;
+};
+
 // Macros for OS calls
 #define os_prim_log os_get_interface()->log
 #define os_prim_alloc os_get_interface()->alloc
 #define os_prim_free os_get_interface()->free
+#define os_prim_alloc_ex os_get_interface()->alloc_ex
 #define os_prim_delay_us os_get_interface()->delay_us
 
 // Hardware access state
@@ -87,6 +162,43 @@ static int drm_is_real_available(void) __attribute__((unused));
 static int mmio_direct_open(uint16_t vendor_id, uint16_t device_id);
 static void mmio_direct_close(void);
 
+// Which of our blocks drive which IP, for chips with a discovery table
+static const struct hal_ip_binding {
+    struct ip_block_ops *block;
+    enum amdgpu_hwip hwip;
+    uint8_t min_major, max_major; // IP versions it knows how to drive
+} hal_ip_bindings[] = {
+    {&gmc_v10_ip_block, AMDGPU_HWIP_GC, 10, 10}, // GMC goes with the GC version
+    {&r600_ip_block, AMDGPU_HWIP_GC, 0, 0xFF},
+    {&dcn_v1_ip_block, AMDGPU_HWIP_DCE, 1, 0xFF}, // The only DCN block we have
+    // dce_v10: DCE chips predate discovery tables, never bound from one
+};
+
+// Only what the chip has. No table (simulation, pre-Navi chips): the fixed
+// list, like before.
+static int hal_register_ip_blocks(struct OBJGPU *adev, struct amd_gpu_handler *handler) {
+    if (amdgpu_discovery_load(adev) != 0) {
+        if (handler->register_ip_block(handler, &gmc_v10_ip_block) != 0 ||
+            handler->register_ip_block(handler, &r600_ip_block) != 0 ||
+            handler->register_ip_block(handler, &dce_v10_ip_block) != 0 ||
+            handler->register_ip_block(handler, &dcn_v1_ip_block) != 0)
+            return -1;
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(hal_ip_bindings) / sizeof(hal_ip_bindings[0]); i++) {
+        const struct hal_ip_binding *b = &hal_ip_bindings[i];
+        const struct amdgpu_ip_info *ip = amdgpu_discovery_ip(adev, b->hwip, 0);
+        if (!ip || ip->major < b->min_major || ip->major > b->max_major) {
+            os_prim_log("HAL: Skipping %s, its IP isn't on this chip\n", b->block->name);
+            continue;
+        }
+        if (handler->register_ip_block(handler, b->block) != 0)
+            return -1;
+    }
+    return 0;
+}
+
 // IP Block registration
 int ip_block_register(struct OBJGPU *adev, struct ip_block_ops *block) {
     if (!adev || !block || adev->num_ip_blocks >= AMDGPU_MAX_IP_BLOCKS) {
@@ -101,6 +213,16 @@ int ip_block_register(struct OBJGPU *adev, struct ip_block_ops *block) {
     return 0;
 }
 
+// Register writes from here on belong to IP block index (-1: none), so a
+// snapshot knows which block's init they came from
+static void amd_gpu_handler_shadow_owner(struct amd_gpu_handler *handler, int index) {
+    if (!handler->gpu)
+        return;
+    pthread_rwlock_wrlock(&handler->gpu->mmio_lock);
+    handler->gpu->shadow.owner = (uint8_t)(index + 1);
+    pthread_rwlock_unlock(&handler->gpu->mmio_lock);
+}
+
 // AMD GPU Handler implementation
 static int amd_gpu_handler_init_hardware(struct amd_gpu_handler *handler) {
     // Call IP block initialization sequence - delegate to real IP blocks
@@ -122,7 +244,10 @@ static int amd_gpu_handler_init_hardware(struct amd_gpu_handler *handler) {
 
     for (int i = 0; i < handler->num_ip_blocks; i++) {
         struct ip_block_ops *block = handler->ip_blocks[i];
-        if (block->hw_init && block->hw_init(handler->gpu) != 0) {
+        amd_gpu_handler_shadow_owner(handler, i);
+        int ret = block->hw_init ? block->hw_init(handler->gpu) : 0;
+        amd_gpu_handler_shadow_owner(handler, -1);
+        if (ret != 0) {
             os_prim_log("Handler: HW init failed for %s\n", block->name);
             return -1;
         }
@@ -130,7 +255,10 @@ static int amd_gpu_handler_init_hardware(struct amd_gpu_handler *handler) {
 
     for (int i = 0; i < handler->num_ip_blocks; i++) {
         struct ip_block_ops *block = handler->ip_blocks[i];
-        if (block->late_init && block->late_init(handler->gpu) != 0) {
+        amd_gpu_handler_shadow_owner(handler, i);
+        int ret = block->late_init ? block->late_init(handler->gpu) : 0;
+        amd_gpu_handler_shadow_owner(handler, -1);
+        if (ret != 0) {
             os_prim_log("Handler: Late init failed for %s\n", block->name);
             return -1;
         }
@@ -352,20 +480,28 @@ int amdgpu_device_init_hal(struct OBJGPU *adev) {
     // Initialize state
     adev->state = AMD_GPU_STATE_RUNNING;
     adev->hang_detected = 0;
-    adev->heartbeat_running = 0;
     memset(&adev->ras, 0, sizeof(adev->ras));
     memset(&adev->shadow, 0, sizeof(adev->shadow));
+    memset(&adev->suspend_state, 0, sizeof(adev->suspend_state));
+    adev->discovery = NULL;
+    adev->atomfw = NULL;
 
     // Try hardware access in order of preference: DRM → Direct MMIO → Simulation
     os_prim_log("HAL: 🔍 Attempting GPU hardware access...\n");
 
+    // AMDGPU_HAL_MODE=sim|drm|mmio skips the others (replaying a capture on
+    // a chosen backend, say). If that one can't open we still end up in sim.
+    const char *want = getenv("AMDGPU_HAL_MODE");
+    bool try_drm = !want || strcmp(want, "drm") == 0;
+    bool try_mmio = !want || strcmp(want, "mmio") == 0;
+
     // First try: Real DRM kernel access (Linux with permissions)
-    if (drm_open_device("/dev/dri/card0") == 0) {
+    if (try_drm && drm_open_device("/dev/dri/card0") == 0) {
         os_prim_log("HAL: ✅ DRM KERNEL MODE: Real GPU acceleration via kernel!\n");
         os_prim_log("HAL: 🎯 Hardware access: DRM ioctl + GEM buffers\n");
 
     // Second try: Direct MMIO access (Haiku/systems without kernel DRM)
-    } else if (mmio_direct_open(0x1002, 0x7290) == 0) {  // AMD Wrestler device ID
+    } else if (try_mmio && mmio_direct_open(0x1002, 0x7290) == 0) {  // AMD Wrestler device ID
         os_prim_log("HAL: ✅ DIRECT MMIO MODE: Real GPU acceleration via hardware!\n");
         os_prim_log("HAL: 🎯 Hardware access: Direct PCI MMIO registers + VRAM\n");
 
@@ -393,16 +529,21 @@ int amdgpu_device_init_hal(struct OBJGPU *adev) {
         // Still continue - MMIO is optional for basic operation
     }
 
+    // Board clocks and connectors; without a VBIOS everything keeps its defaults
+    amdgpu_atomfw_load(adev);
+
     // Register IP blocks with handler
-    if (handler->register_ip_block(handler, &gmc_v10_ip_block) != 0 ||
-        handler->register_ip_block(handler, &r600_ip_block) != 0 ||
-        handler->register_ip_block(handler, &dce_v10_ip_block) != 0 ||
-        handler->register_ip_block(handler, &dcn_v1_ip_block) != 0) {
+    if (hal_register_ip_blocks(adev, handler) != 0) {
         os_prim_log("HAL: Failed to register IP blocks\n");
+        amdgpu_discovery_fini(adev);
+        amdgpu_atomfw_fini(adev);
         drm_close_device();
         return -1;
     }
 
+    // Register lock domains, from the discovery table when there is one
+    amdgpu_regs_init(adev);
+
     // Initialize hardware through handler
     if (handler->init_hardware(handler) != 0) {
         os_prim_log("HAL: Hardware initialization failed\n");
@@ -423,12 +564,8 @@ int amdgpu_device_init_hal(struct OBJGPU *adev) {
 void amdgpu_device_fini_hal(struct OBJGPU *adev) {
     if (!adev) return;
     
-    // Stop heartbeat thread
-    adev->heartbeat_running = 0;
-    if (adev->heartbeat_thread) {
-        pthread_join(adev->heartbeat_thread, NULL);
-    }
-    
+    amdgpu_sdma_fini_sim();
+
     // Close hardware access in reverse order
     mmio_direct_close();
     drm_close_device();
@@ -444,6 +581,12 @@ void amdgpu_device_fini_hal(struct OBJGPU *adev) {
         adev->mmio_size = 0;
     }
     
+    amdgpu_regs_log_stats(adev);
+    amdgpu_snapshot_free(&adev->suspend_state);
+    amdgpu_hal_shadow_fini(adev);
+    amdgpu_discovery_fini(adev);
+    amdgpu_atomfw_fini(adev);
+
     // Destroy synchronization primitives
     pthread_mutex_destroy(&adev->lock);
     pthread_rwlock_destroy(&adev->mmio_lock);
@@ -474,12 +617,13 @@ int amdgpu_buffer_alloc_hal(struct OBJGPU *adev, size_t size, struct amdgpu_buff
     if (!adev || !buf) {
         return -1;
     }
+    os_trace_scope(OS_TRACE_HAL, "amdgpu_buffer_alloc_hal");
 
     buf->size = size;
 
     if (drm_real_mode == 1 && drm_fd >= 0) {
         // MODE 1: REAL DRM KERNEL - Use GEM buffer allocation
-        os_prim_log("HAL: 📡 DRM kernel buffer allocation (size: %zu)\n", size);
+        os_log_debug(OS_LOG_HAL, "HAL: 📡 DRM kernel buffer allocation (size: %zu)\n", size);
 
         union hal_drm_gem_create create_args = {.in.size = size, .in.flags = 0};
 
@@ -493,24 +637,24 @@ int amdgpu_buffer_alloc_hal(struct OBJGPU *adev, size_t size, struct amdgpu_buff
                                    drm_fd, mmap_args.in.offset);
                 if (buf->cpu_addr != MAP_FAILED) {
                     buf->gpu_addr = 0;
-                    os_prim_log("HAL: ✅ DRM kernel buffer allocated (handle: %u, addr: %p)\n",
-                               buf->handle, buf->cpu_addr);
+                    os_log_debug(OS_LOG_HAL, "HAL: ✅ DRM kernel buffer allocated (handle: %u, addr: %p)\n",
+                                buf->handle, buf->cpu_addr);
                     return 0;
                 } else {
-                    os_prim_log("HAL: ❌ DRM mmap failed\n");
+                    os_log_error(OS_LOG_HAL, "HAL: ❌ DRM mmap failed\n");
                     struct hal_drm_gem_close close_args = {.handle = buf->handle};
                     ioctl(drm_fd, DRM_IOCTL_GEM_CLOSE, &close_args);
                 }
             } else {
-                os_prim_log("HAL: ❌ DRM mmap ioctl failed\n");
+                os_log_error(OS_LOG_HAL, "HAL: ❌ DRM mmap ioctl failed\n");
             }
         } else {
-            os_prim_log("HAL: ❌ DRM GEM create failed (errno: %d)\n", errno);
+            os_log_error(OS_LOG_HAL, "HAL: ❌ DRM GEM create failed (errno: %d)\n", errno);
         }
 
     } else if (drm_real_mode == 2 && mmio_base) {
         // MODE 2: DIRECT MMIO - Use mapped GPU memory directly
-        os_prim_log("HAL: 🎯 Direct MMIO GPU buffer allocation (size: %zu)\n", size);
+        os_log_debug(OS_LOG_HAL, "HAL: 🎯 Direct MMIO GPU buffer allocation (size: %zu)\n", size);
 
         // For direct MMIO, we use the mapped MMIO region as GPU memory
         // This provides TRUE GPU acceleration by accessing hardware directly
@@ -524,40 +668,56 @@ int amdgpu_buffer_alloc_hal(struct OBJGPU *adev, size_t size, struct amdgpu_buff
 
             mmio_offset += (size + 4095) & ~4095; // Page align next allocation
 
-            os_prim_log("HAL: ✅ Direct MMIO GPU buffer allocated (gpu_addr: 0x%lx, cpu_addr: %p)\n",
-                       buf->gpu_addr, buf->cpu_addr);
+            os_log_debug(OS_LOG_HAL, "HAL: ✅ Direct MMIO GPU buffer allocated (gpu_addr: 0x%lx, cpu_addr: %p)\n",
+                        buf->gpu_addr, buf->cpu_addr);
             return 0;
         } else {
-            os_prim_log("HAL: ❌ Direct MMIO out of memory (offset: 0x%lx, size: %zu, max: %zu)\n",
-                       mmio_offset, size, mmio_size);
+            os_log_error(OS_LOG_HAL, "HAL: ❌ Direct MMIO out of memory (offset: 0x%lx, size: %zu, max: %zu)\n",
+                        mmio_offset, size, mmio_size);
         }
     }
 
     // MODE 0: SIMULATION FALLBACK - Use CPU memory when hardware access fails
-    os_prim_log("HAL: 🎭 Using simulation buffer allocation (size: %zu)\n", size);
+    os_log_debug(OS_LOG_HAL, "HAL: 🎭 Using simulation buffer allocation (size: %zu)\n", size);
 
-    buf->cpu_addr = os_prim_alloc(size);
+    buf->cpu_addr = os_prim_alloc_ex(size, 0, OS_ALLOC_USAGE_VRAM, 0);
     if (!buf->cpu_addr) {
-        os_prim_log("HAL: ❌ Simulation allocation failed\n");
+        os_log_error(OS_LOG_HAL, "HAL: ❌ Simulation allocation failed\n");
         return -1;
     }
 
     buf->gpu_addr = (uint64_t)buf->cpu_addr; // Fake GPU address for simulation
     buf->handle = (uint32_t)(uintptr_t)buf->cpu_addr; // Fake handle
 
-    os_prim_log("HAL: ✅ Simulation buffer allocated (addr: %p)\n", buf->cpu_addr);
+    // VRAM full? The residency manager makes room or puts it in GTT, never fails
+    uint32_t domain = amdgpu_residency_track(adev, buf);
+
+    os_log_debug(OS_LOG_HAL, "HAL: ✅ Simulation buffer allocated (addr: %p, %s)\n", buf->cpu_addr,
+                domain == AMDGPU_DOMAIN_VRAM ? "VRAM" : "GTT");
     return 0;
 }
 
 // Buffer free with DRM support
 void amdgpu_buffer_free_hal(struct OBJGPU *adev, struct amdgpu_buffer *buf) {
     if (!buf) return;
+    os_trace_scope(OS_TRACE_HAL, "amdgpu_buffer_free_hal");
 
     amdgpu_lock_gpu(adev);
     
-    if (drm_real_mode && drm_fd >= 0 && buf->handle > 0) {
+    if (buf->flags & AMDGPU_BUFFER_FLAG_USERPTR) {
+        // USERPTR: The pages belong to the client, only drop our pin
+        if (drm_real_mode == 1 && drm_fd >= 0 && buf->handle > 0) {
+            struct hal_drm_gem_close close_args = {.handle = buf->handle};
+            ioctl(drm_fd, DRM_IOCTL_GEM_CLOSE, &close_args);
+        } else if (buf->cpu_addr) {
+            uintptr_t start = (uintptr_t)buf->cpu_addr & ~(uintptr_t)4095;
+            uintptr_t end = ((uintptr_t)buf->cpu_addr + buf->size + 4095) & ~(uintptr_t)4095;
+            munlock((void *)start, end - start);
+        }
+        os_log_debug(OS_LOG_HAL, "HAL: ✅ Userptr buffer released\n");
+    } else if (drm_real_mode && drm_fd >= 0 && buf->handle > 0) {
         // REAL DRM: Clean up GEM buffer
-        os_prim_log("HAL: 📡 Freeing real GEM buffer (handle: %u)\n", buf->handle);
+        os_log_debug(OS_LOG_HAL, "HAL: 📡 Freeing real GEM buffer (handle: %u)\n", buf->handle);
 
         // Unmap first if mapped
         if (buf->cpu_addr && buf->cpu_addr != MAP_FAILED) {
@@ -567,14 +727,15 @@ void amdgpu_buffer_free_hal(struct OBJGPU *adev, struct amdgpu_buffer *buf) {
         // Close GEM handle
         struct hal_drm_gem_close close_args = {.handle = buf->handle};
         if (ioctl(drm_fd, DRM_IOCTL_GEM_CLOSE, &close_args) != 0) {
-            os_prim_log("HAL: ⚠️  GEM close failed\n");
+            os_log_warn(OS_LOG_HAL, "HAL: ⚠️  GEM close failed\n");
             amdgpu_ras_record_error(adev, 0); // Record error
         }
 
-        os_prim_log("HAL: ✅ Real GEM buffer freed\n");
+        os_log_debug(OS_LOG_HAL, "HAL: ✅ Real GEM buffer freed\n");
     } else if (buf->cpu_addr) {
         // SIMULATION: Free allocated memory
-        os_prim_log("HAL: 🎭 Freeing simulation buffer\n");
+        os_log_debug(OS_LOG_HAL, "HAL: 🎭 Freeing simulation buffer\n");
+        amdgpu_residency_untrack(adev, buf);
         os_prim_free(buf->cpu_addr);
     }
 
@@ -584,15 +745,196 @@ void amdgpu_buffer_free_hal(struct OBJGPU *adev, struct amdgpu_buffer *buf) {
     memset(buf, 0, sizeof(*buf));
 }
 
+// Userptr import: turn pages the caller already owns into a GPU buffer
+int amdgpu_buffer_import_userptr_hal(struct OBJGPU *adev, void *cpu_addr,
+                                     size_t size, uint32_t flags,
+                                     struct amdgpu_buffer *buf) {
+    if (!adev || !cpu_addr || size == 0 || !buf) {
+        return -1;
+    }
+
+    // The kernel (and mlock) work in whole pages
+    if (((uintptr_t)cpu_addr & 4095) != 0 || (size & 4095) != 0) {
+        os_log_error(OS_LOG_HAL, "HAL: ❌ Userptr range must be page aligned (addr: %p, size: %zu)\n",
+                    cpu_addr, size);
+        return -1;
+    }
+
+    memset(buf, 0, sizeof(*buf));
+    buf->size = size;
+    buf->flags = AMDGPU_BUFFER_FLAG_USERPTR;
+
+    if (drm_real_mode == 1 && drm_fd >= 0) {
+        // MODE 1: REAL DRM KERNEL - The kernel pins the pages and tracks invalidation (MMU notifier)
+        struct hal_drm_gem_userptr args = {
+            .addr = (uint64_t)(uintptr_t)cpu_addr,
+            .size = size,
+            .flags = flags | AMDGPU_USERPTR_FLAG_REGISTER,
+        };
+
+        if (ioctl(drm_fd, DRM_IOCTL_AMDGPU_GEM_USERPTR, &args) != 0) {
+            os_log_error(OS_LOG_HAL, "HAL: ❌ DRM userptr import failed (errno: %d)\n", errno);
+            return -1;
+        }
+
+        buf->handle = args.handle;
+        buf->cpu_addr = cpu_addr;
+        buf->gpu_addr = 0; // Assigned when the client maps it into its VM
+        return 0;
+    }
+
+    // MODE 0/2: SIMULATION and DIRECT MMIO - Pin the pages so they stay resident while the GPU uses them
+    if (mlock(cpu_addr, size) != 0) {
+        // Not fatal: RLIMIT_MEMLOCK is small by default, the pages just aren't guaranteed resident
+        os_log_warn(OS_LOG_HAL, "HAL: ⚠️  Userptr mlock failed (errno: %d), continuing unpinned\n", errno);
+    }
+
+    buf->cpu_addr = cpu_addr;
+    buf->gpu_addr = (uint64_t)(uintptr_t)cpu_addr; // GTT-style: GPU sees host pages at the CPU address
+    buf->handle = (uint32_t)((uintptr_t)cpu_addr >> 12);
+
+    os_log_debug(OS_LOG_HAL, "HAL: ✅ Userptr buffer imported (addr: %p, size: %zu, flags: 0x%x)\n",
+                cpu_addr, size, flags);
+    return 0;
+}
+
+// Which backend are we running on? (AMDGPU_HAL_MODE_*)
+int amdgpu_hal_get_mode(void) {
+    return drm_real_mode;
+}
+
+// PRIME export: hand out a kernel dma-buf for this buffer (real DRM only)
+int amdgpu_buffer_export_dmabuf_hal(struct OBJGPU *adev, struct amdgpu_buffer *buf, int *fd) {
+    if (!adev || !buf || !fd || drm_real_mode != 1 || drm_fd < 0) {
+        return -1;
+    }
+
+    struct hal_drm_prime_handle args = {.handle = buf->handle, .flags = O_CLOEXEC | O_RDWR, .fd = -1};
+    if (ioctl(drm_fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &args) != 0) {
+        os_prim_log("HAL: ❌ PRIME export failed (handle: %u, errno: %d)\n", buf->handle, errno);
+        return -1;
+    }
+
+    *fd = args.fd;
+    return 0;
+}
+
+// PRIME import: turn someone else's dma-buf into one of our GEM buffers (real DRM only)
+int amdgpu_buffer_import_dmabuf_hal(struct OBJGPU *adev, int fd, size_t size, struct amdgpu_buffer *buf) {
+    if (!adev || fd < 0 || !buf || drm_real_mode != 1 || drm_fd < 0) {
+        return -1;
+    }
+
+    struct hal_drm_prime_handle args = {.fd = fd};
+    if (ioctl(drm_fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &args) != 0) {
+        os_prim_log("HAL: ❌ PRIME import failed (fd: %d, errno: %d)\n", fd, errno);
+        return -1;
+    }
+
+    memset(buf, 0, sizeof(*buf));
+    buf->handle = args.handle;
+    buf->size = size;
+
+    // CPU view is optional, some exporters don't allow it
+    union hal_drm_gem_mmap mmap_args = {.in.handle = buf->handle};
+    if (ioctl(drm_fd, DRM_IOCTL_GEM_MMAP, &mmap_args) == 0) {
+        void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, drm_fd, mmap_args.in.offset);
+        buf->cpu_addr = map == MAP_FAILED ? NULL : map;
+    }
+
+    os_prim_log("HAL: ✅ PRIME buffer imported (handle: %u, size: %zu)\n", buf->handle, size);
+    return 0;
+}
+
+// Syncobjs: a kernel timeline syncobj mirrors each RMAPI one (real DRM only),
+// so a point that signaled can leave the process as a real sync_file
+int amdgpu_syncobj_create_hal(struct OBJGPU *adev, uint32_t *handle) {
+    if (!adev || !handle || drm_real_mode != 1 || drm_fd < 0) {
+        return -1;
+    }
+
+    struct hal_drm_syncobj_create args = {0};
+    if (ioctl(drm_fd, DRM_IOCTL_SYNCOBJ_CREATE, &args) != 0) {
+        os_prim_log("HAL: ❌ Syncobj create failed (errno: %d)\n", errno);
+        return -1;
+    }
+    *handle = args.handle;
+    return 0;
+}
+
+void amdgpu_syncobj_destroy_hal(struct OBJGPU *adev, uint32_t handle) {
+    if (!adev || drm_real_mode != 1 || drm_fd < 0 || handle == 0) {
+        return;
+    }
+    struct hal_drm_syncobj_destroy args = {.handle = handle};
+    ioctl(drm_fd, DRM_IOCTL_SYNCOBJ_DESTROY, &args);
+}
+
+int amdgpu_syncobj_signal_hal(struct OBJGPU *adev, uint32_t handle, uint64_t point) {
+    if (!adev || drm_real_mode != 1 || drm_fd < 0 || handle == 0) {
+        return -1;
+    }
+
+    struct hal_drm_syncobj_timeline_array args = {
+        .handles = (uint64_t)(uintptr_t)&handle,
+        .points = (uint64_t)(uintptr_t)&point,
+        .count_handles = 1,
+    };
+    if (ioctl(drm_fd, DRM_IOCTL_SYNCOBJ_TIMELINE_SIGNAL, &args) != 0) {
+        os_prim_log("HAL: ❌ Syncobj signal failed (handle: %u, errno: %d)\n", handle, errno);
+        return -1;
+    }
+    return 0;
+}
+
+int amdgpu_syncobj_export_sync_file_hal(struct OBJGPU *adev, uint32_t handle,
+                                        uint64_t point, int *fd) {
+    if (!adev || !fd || drm_real_mode != 1 || drm_fd < 0 || handle == 0) {
+        return -1;
+    }
+
+    // sync_files hold one fence, not a timeline: copy the point into a
+    // throwaway binary syncobj and export that
+    struct hal_drm_syncobj_create tmp = {0};
+    if (ioctl(drm_fd, DRM_IOCTL_SYNCOBJ_CREATE, &tmp) != 0) {
+        return -1;
+    }
+
+    int ret = -1;
+    struct hal_drm_syncobj_transfer xfer = {
+        .src_handle = handle, .dst_handle = tmp.handle, .src_point = point};
+    struct hal_drm_syncobj_handle args = {
+        .handle = tmp.handle, .flags = DRM_SYNCOBJ_HANDLE_TO_FD_FLAGS_EXPORT_SYNC_FILE, .fd = -1};
+    if (ioctl(drm_fd, DRM_IOCTL_SYNCOBJ_TRANSFER, &xfer) == 0 &&
+        ioctl(drm_fd, DRM_IOCTL_SYNCOBJ_HANDLE_TO_FD, &args) == 0) {
+        *fd = args.fd;
+        ret = 0;
+    } else {
+        os_prim_log("HAL: ❌ sync_file export failed (handle: %u, point: %llu, errno: %d)\n",
+                    handle, (unsigned long long)point, errno);
+    }
+
+    struct hal_drm_syncobj_destroy done = {.handle = tmp.handle};
+    ioctl(drm_fd, DRM_IOCTL_SYNCOBJ_DESTROY, &done);
+    return ret;
+}
+
 // Command submission
 int amdgpu_command_submit_hal(struct OBJGPU *adev, struct amdgpu_command_buffer *cb) {
     if (!adev || !cb) {
         return -1;
     }
+    os_trace_scope(OS_TRACE_HAL, "amdgpu_command_submit_hal");
+
+    // Everything this work touches has to be in VRAM (or at least reachable)
+    uint64_t fence = amdgpu_residency_validate(adev, cb->bo_list, cb->bo_count);
 
     // For now, just log - real implementation would submit to ring
-    os_prim_log("HAL: Command buffer submitted (%zu bytes)\n", cb->size);
+    os_log_debug(OS_LOG_HAL, "HAL: Command buffer submitted (%zu bytes, %u buffers)\n",
+                 cb->size, cb->bo_count);
 
+    // Submission is synchronous for now, so it's done as soon as we return
+    amdgpu_residency_fence_signal(adev, fence);
     return 0;
 }
 
@@ -604,44 +946,6 @@ int amdgpu_hal_reset(struct OBJGPU *adev) {
     return 0;
 }
 
-// Heartbeat with error detection
-void *amdgpu_hal_heartbeat(void *arg) {
-    struct OBJGPU *adev = (struct OBJGPU *)arg;
-    if (!adev) return NULL;
-    
-    os_prim_log("HAL: Heartbeat thread started\n");
-    adev->heartbeat_running = 1;
-
-    while (adev->heartbeat_running) {
-        // Check GPU health every 100ms
-        os_prim_delay_us(100000);
-        
-        if (!adev || adev->state == AMD_GPU_STATE_RESETTING) {
-            continue;
-        }
-        
-        // Check if GPU is idle (simple health check)
-        if (adev->handler && adev->handler->is_hardware_idle) {
-            if (!adev->handler->is_hardware_idle(adev->handler)) {
-                // GPU is working, continue
-                continue;
-            }
-        }
-        
-        // Check for errors periodically
-        if (adev->ras.ue_count > 0 || adev->ras.poison_count > 0) {
-            os_prim_log("HAL: ⚠️  Error detected! UE=%lu, Poison=%lu\n", 
-                       adev->ras.ue_count, adev->ras.poison_count);
-            adev->hang_detected = 1;
-            adev->state = AMD_GPU_STATE_RESETTING;
-            amdgpu_gpu_recover(adev);
-        }
-    }
-
-    os_prim_log("HAL: Heartbeat thread stopped\n");
-    return NULL;
-}
-
 // Error tracking implementation
 void amdgpu_ras_record_error(struct OBJGPU *adev, int error_type) {
     if (!adev) return;
@@ -659,8 +963,16 @@ void amdgpu_ras_record_error(struct OBJGPU *adev, int error_type) {
         adev->ras.poison_count++;
         os_prim_log("HAL: 🟠 Poison Error recorded (total: %lu)\n", adev->ras.poison_count);
     }
-    
+    bool fatal = error_type != 1 && adev->state == AMD_GPU_STATE_RUNNING;
+    if (fatal)
+        adev->hang_detected = 1;
+
     amdgpu_unlock_gpu(adev);
+
+    // Nobody polls the counters anymore: the error that needs a reset asks
+    // for it right here (hung rings come from the ring watchdog)
+    if (fatal)
+        amdgpu_gpu_recover(adev);
 }
 
 int amdgpu_ras_get_error_count(struct OBJGPU *adev, int error_type) {
@@ -702,25 +1014,7 @@ int amdgpu_unlock_gpu(struct OBJGPU *adev) {
     return pthread_mutex_unlock(&adev->lock);
 }
 
-int amdgpu_read_reg_locked(struct OBJGPU *adev, uint32_t offset) {
-    if (!adev || !adev->mmio_base) return 0;
-    
-    pthread_rwlock_rdlock(&adev->mmio_lock);
-    uint32_t value = *(volatile uint32_t *)((uintptr_t)adev->mmio_base + offset);
-    pthread_rwlock_unlock(&adev->mmio_lock);
-    
-    return value;
-}
-
-void amdgpu_write_reg_locked(struct OBJGPU *adev, uint32_t offset, uint32_t value) {
-    if (!adev || !adev->mmio_base) return;
-    
-    pthread_rwlock_wrlock(&adev->mmio_lock);
-    *(volatile uint32_t *)((uintptr_t)adev->mmio_base + offset) = value;
-    adev->shadow.regs[offset / 4] = value;
-    adev->shadow.valid[offset / 4] = true;
-    pthread_rwlock_unlock(&adev->mmio_lock);
-}
+// amdgpu_read_reg_locked / amdgpu_write_reg_locked: hal_regs.c
 
 // GPU Recovery Implementation
 int amdgpu_gpu_recover(struct OBJGPU *adev) {
@@ -731,13 +1025,11 @@ int amdgpu_gpu_recover(struct OBJGPU *adev) {
     
     amdgpu_lock_gpu(adev);
     
-    // Step 1: Save current state
+    // Step 1: Save current state (init will overwrite the shadow)
     os_prim_log("HAL: [Recovery] Saving GPU state...\n");
-    for (int i = 0; i < 256; i++) {
-        if (adev->shadow.valid[i]) {
-            // State already in shadow
-        }
-    }
+    struct amdgpu_snapshot saved = {0};
+    if (amdgpu_snapshot_capture(adev, &saved, -1) != 0)
+        os_prim_log("HAL: [Recovery] No snapshot, registers come back from init only\n");
     
     // Step 2: Stop command submission
     os_prim_log("HAL: [Recovery] Stopping GPU...\n");
@@ -750,6 +1042,7 @@ int amdgpu_gpu_recover(struct OBJGPU *adev) {
     int ret = amdgpu_hal_reset(adev);
     if (ret != 0) {
         os_prim_log("HAL: ❌ Hardware reset failed\n");
+        amdgpu_snapshot_free(&saved);
         amdgpu_unlock_gpu(adev);
         return -1;
     }
@@ -760,21 +1053,22 @@ int amdgpu_gpu_recover(struct OBJGPU *adev) {
         ret = adev->handler->init_hardware(adev->handler);
         if (ret != 0) {
             os_prim_log("HAL: ❌ IP block reinitialization failed\n");
+            amdgpu_snapshot_free(&saved);
             amdgpu_unlock_gpu(adev);
             return -1;
         }
     }
     
-    // Step 5: Restore shadow state if available
+    // Step 5: Restore shadow state; what init just wrote the same is skipped
     os_prim_log("HAL: [Recovery] Restoring state...\n");
-    if (adev->mmio_base) {
-        for (int i = 0; i < 256; i++) {
-            if (adev->shadow.valid[i]) {
-                volatile uint32_t *reg = (volatile uint32_t *)((uintptr_t)adev->mmio_base + i * 4);
-                *reg = adev->shadow.regs[i];
-            }
-        }
-    }
+    uint32_t skipped = 0;
+    int restored = amdgpu_snapshot_restore(adev, &saved, &skipped);
+    if (restored < 0)
+        os_prim_log("HAL: [Recovery] Snapshot corrupt, registers not restored\n");
+    else if (restored || skipped)
+        os_prim_log("HAL: [Recovery] %d registers restored, %u already right\n",
+                    restored, skipped);
+    amdgpu_snapshot_free(&saved);
     
     adev->hang_detected = 0;
     adev->state = AMD_GPU_STATE_RUNNING;
@@ -783,4 +1077,39 @@ int amdgpu_gpu_recover(struct OBJGPU *adev) {
     
     os_prim_log("HAL: ✅ GPU recovery complete\n");
     return 0;
+}
+
+// Reset one IP block (by name) and leave the rest of the chip alone: the
+// step between a queue reset and amdgpu_gpu_recover. -1 if there's no such
+// block or it didn't come back.
+int amdgpu_ip_block_reset(struct OBJGPU *adev, const char *name) {
+    if (!adev || !name || !adev->handler || !adev->handler->find_ip_block)
+        return -1;
+    struct ip_block_ops *block = adev->handler->find_ip_block(adev->handler, name);
+    if (!block || !block->hw_init)
+        return -1;
+    int index = -1;
+    for (int i = 0; i < adev->handler->num_ip_blocks; i++)
+        if (adev->handler->ip_blocks[i] == block)
+            index = i;
+
+    os_prim_log("HAL: [Recovery] Resetting IP block %s...\n", block->name);
+    amdgpu_lock_gpu(adev);
+    struct amdgpu_snapshot saved = {0};
+    if (index >= 0)
+        amdgpu_snapshot_capture(adev, &saved, index);
+    int ret = 0;
+    if (block->hw_fini)
+        ret = block->hw_fini(adev);
+    if (ret == 0)
+        ret = block->hw_init(adev);
+    if (ret == 0 && amdgpu_snapshot_restore(adev, &saved, NULL) < 0)
+        ret = -1;
+    amdgpu_snapshot_free(&saved);
+    amdgpu_unlock_gpu(adev);
+    if (ret != 0) {
+        os_prim_log("HAL: ❌ IP block %s didn't come back\n", block->name);
+        return -1;
+    }
+    return 0;
 }
\ No newline at end of file
@@ -82,6 +82,9 @@ struct amd_gpu_handler {
     struct ip_block_ops *(*find_ip_block)(struct amd_gpu_handler *handler, const char *name);
 };
 
+struct amd_gpu_handler *amd_gpu_handler_create(struct OBJGPU *gpu);
+void amd_gpu_handler_destroy(struct amd_gpu_handler *handler);
+
 // Register an IP block
 int ip_block_register(struct OBJGPU *adev, struct ip_block_ops *block);
 
@@ -163,17 +166,54 @@ struct RsResource *rs_resource_lookup(uint32_t handle);
 void rs_resource_destroy(struct RsResource *res);
 
 // GPU Memory Buffers and Command Lists
+#define AMDGPU_BUFFER_FLAG_USERPTR (1u << 0) // Pages belong to someone else, never free them
+
 struct amdgpu_buffer {
   void *cpu_addr;    // Where the CPU sees it
   uint64_t gpu_addr; // Where the GPU sees it
   size_t size;       // How big is it?
   uint32_t handle;   // GEM handle for real DRM
+  uint32_t flags;    // AMDGPU_BUFFER_FLAG_* bits
+  uint32_t generation; // Bumped whenever the buffer moves (domain or address)
 };
 
+// Userptr flags (same values as the kernel's AMDGPU_GEM_USERPTR_*)
+#define AMDGPU_USERPTR_FLAG_READONLY (1u << 0)
+#define AMDGPU_USERPTR_FLAG_ANONONLY (1u << 1)
+#define AMDGPU_USERPTR_FLAG_VALIDATE (1u << 2)
+#define AMDGPU_USERPTR_FLAG_REGISTER (1u << 3)
+
 struct amdgpu_command_buffer {
   struct OBJGPU *gpu;
   void *cmds; // The list of things to do
   size_t size;
+  struct amdgpu_buffer **bo_list; // Buffers this work touches (optional)
+  uint32_t bo_count;
+};
+
+// Memory domains (same values as AMDGPU_GEM_DOMAIN_*)
+#define AMDGPU_DOMAIN_GTT 0x2
+#define AMDGPU_DOMAIN_VRAM 0x4
+
+// What the residency manager has been up to
+struct amdgpu_residency_stats {
+  uint64_t vram_budget;    // How much VRAM we let buffers use
+  uint64_t vram_used;
+  uint64_t gtt_used;       // Buffers that got pushed out (or never fit)
+  uint64_t evictions;      // VRAM -> GTT moves
+  uint64_t restores;       // GTT -> VRAM moves
+  uint64_t bytes_evicted;
+  uint64_t bytes_restored;
+};
+
+// What the simulated SDMA engine has been up to
+struct amdgpu_sdma_stats {
+  uint64_t packets;
+  uint64_t bytes_copied;
+  uint64_t bytes_filled;
+  uint64_t split;          // Copies / fills spread over the worker threads
+  uint64_t errors;         // Streams stopped at a packet we can't run
+  uint64_t faults;         // ...because it pointed outside the job's buffers
 };
 
 // Basic info about your cool GPU
@@ -199,10 +239,187 @@ enum amd_asic_type {
 };
 
 // --- The Belter "Shadow State" ---
-// Mirrors critical registers in RAM for "Self-Healing"
+// Mirrors every register we wrote in RAM for "Self-Healing" (hal_snapshot.c)
+#define AMDGPU_SHADOW_NO_BLOCK 0 // Written outside any IP block's init
+#define AMDGPU_SHADOW_INIT 0x1   // Still the value hw_init/late_init wrote
+
+struct amd_shadow_reg {
+  uint32_t reg;   // Dword offset
+  uint32_t value;
+  uint8_t block;  // IP block index + 1 (AMDGPU_SHADOW_NO_BLOCK: none)
+  uint8_t flags;  // AMDGPU_SHADOW_*
+};
+
 struct amd_shadow_state {
-  uint32_t regs[1024]; // Simple shadow of first 1K MMIO registers
-  bool valid[1024];    // Did we write to this register?
+  struct amd_shadow_reg *regs; // Sorted by offset, only what was written
+  uint32_t count, cap;
+  uint8_t owner; // Block whose init is running right now (index + 1)
+};
+
+// A packed copy of the shadow (plus MQDs and such) to put back later
+struct amdgpu_snapshot {
+  uint8_t *data;
+  size_t size, cap;
+  uint32_t regs;  // Registers in it
+  uint32_t runs;  // Runs of consecutive registers they were packed into
+};
+
+// --- IP discovery (hal_discovery.c) ---
+// What the chip says it has, indexed like the kernel's [HWIP][instance]
+enum amdgpu_hwip {
+  AMDGPU_HWIP_GC,
+  AMDGPU_HWIP_HDP,
+  AMDGPU_HWIP_SDMA0,
+  AMDGPU_HWIP_SDMA1,
+  AMDGPU_HWIP_SDMA2,
+  AMDGPU_HWIP_SDMA3,
+  AMDGPU_HWIP_MMHUB,
+  AMDGPU_HWIP_ATHUB,
+  AMDGPU_HWIP_NBIO,
+  AMDGPU_HWIP_MP0,
+  AMDGPU_HWIP_MP1,
+  AMDGPU_HWIP_VCN,
+  AMDGPU_HWIP_VCE,
+  AMDGPU_HWIP_DF,
+  AMDGPU_HWIP_DCE,
+  AMDGPU_HWIP_OSSSYS,
+  AMDGPU_HWIP_SMUIO,
+  AMDGPU_HWIP_PWR,
+  AMDGPU_HWIP_THM,
+  AMDGPU_HWIP_CLK,
+  AMDGPU_HWIP_UMC,
+  AMDGPU_HWIP_MAX,
+};
+
+#define AMDGPU_DISCOVERY_MAX_INST 8
+#define AMDGPU_DISCOVERY_MAX_BASE 6 // Register segments per instance
+
+struct amdgpu_ip_info {
+  bool present;     // On the die and not harvested
+  bool harvested;   // On the die but fused off
+  uint8_t major, minor, revision;
+  uint8_t variant, sub_revision; // v3+ tables only
+  uint8_t num_base;
+  uint32_t base[AMDGPU_DISCOVERY_MAX_BASE]; // Segment bases, in dwords
+};
+
+struct amdgpu_ip_discovery {
+  struct amdgpu_ip_info ip[AMDGPU_HWIP_MAX][AMDGPU_DISCOVERY_MAX_INST];
+  uint16_t version;   // Table version
+  uint16_t num_dies;
+  uint32_t entries;   // IPs listed, ours or not
+  uint32_t harvested;
+};
+
+// --- VBIOS data tables (hal_atomfw.c) ---
+// What we take from the AtomFirmware tables. Plain data, no pointers: the
+// on-disk cache is this struct as-is, mapped straight back on warm starts.
+#define AMDGPU_ATOMFW_MAX_PATHS 8
+
+#define AMDGPU_ATOMFW_FIRMWARE 0x01 // Which tables were there and parsed
+#define AMDGPU_ATOMFW_SMU 0x02
+#define AMDGPU_ATOMFW_DCE 0x04
+#define AMDGPU_ATOMFW_DISPLAY 0x08
+#define AMDGPU_ATOMFW_VRAM 0x10
+
+struct amdgpu_atomfw_path {
+  uint16_t connector_id;   // Object IDs, as in ObjectID.h
+  uint16_t encoder_id;
+  uint16_t ext_encoder_id; // 0: none
+  uint16_t device_tag;     // ATOM_DISPLAY_*_SUPPORT
+};
+
+struct amdgpu_atomfw_info {
+  uint32_t magic, version, size; // Cache header: which layout this is
+  uint32_t crc;                  // Over everything after it
+  uint64_t vbios_key;            // Hash of the image it came from
+  uint64_t cold_parse_ns;        // What parsing it took, for the warm log
+  uint32_t tables;               // AMDGPU_ATOMFW_*
+
+  // firmwareinfo
+  uint32_t firmware_revision;
+  uint32_t bootup_sclk_10khz, bootup_mclk_10khz;
+  uint32_t firmware_capability;
+  uint16_t bootup_vddc_mv, bootup_vddci_mv;
+
+  // smu_info, dce_info
+  uint32_t core_refclk_10khz;
+  uint32_t dce_refclk_10khz;     // What the display PLLs run from
+  uint32_t bootup_dispclk_10khz;
+
+  // displayobjectinfo
+  uint16_t supported_devices;
+  uint16_t num_paths;
+  struct amdgpu_atomfw_path paths[AMDGPU_ATOMFW_MAX_PATHS];
+
+  // vram_info (module 0)
+  uint32_t vram_size_mb;
+  uint32_t vram_max_clk_10khz;
+  uint8_t vram_modules, vram_type, vram_channels, vram_channel_width;
+};
+
+struct amdgpu_atomfw {
+  const struct amdgpu_atomfw_info *info; // The mapped cache, or &parsed
+  struct amdgpu_atomfw_info parsed;
+  void *map;
+  size_t map_size;
+  bool warm;         // Came from the cache
+  uint64_t load_ns;  // This start: map + check, or read + parse
+};
+
+// --- Register access (hal_regs.c) ---
+// Writes take the lock of the register's domain, so display programming
+// doesn't wait behind GFX writes. Reads don't take one at all.
+enum amdgpu_reg_domain {
+  AMDGPU_REG_DOMAIN_MISC,    // NBIO, HDP, DF, UMC, and anything unmapped
+  AMDGPU_REG_DOMAIN_GFX,     // GC, and the SDMA engines that live in it
+  AMDGPU_REG_DOMAIN_DISPLAY,
+  AMDGPU_REG_DOMAIN_VM,      // MMHUB, ATHUB
+  AMDGPU_REG_DOMAIN_IH,      // OSSSYS
+  AMDGPU_REG_DOMAIN_SMU,     // MP0/MP1, SMUIO, THM, PWR, CLK
+  AMDGPU_REG_DOMAIN_MM,      // VCN, VCE
+  AMDGPU_REG_DOMAIN_COUNT,
+};
+
+enum amdgpu_reg_class {
+  AMDGPU_REG_CONTROL, // Locked writes and RMW, lock-free reads, shadowed
+  AMDGPU_REG_STATUS,  // Hardware-owned: lock-free reads, never shadowed
+  AMDGPU_REG_INDEXED, // Index/data pairs: reads take the lock too
+};
+
+#define AMDGPU_REG_MAX_RANGES 64
+#define AMDGPU_REG_MAX_NOTES 32
+
+struct amdgpu_reg_range {
+  uint32_t start;  // First dword of the range; it runs to the next one
+  uint8_t domain;
+};
+
+struct amdgpu_reg_note {
+  uint32_t reg;    // Dword offset
+  uint8_t cls;
+};
+
+// Built at init from the discovery table (or Navi10's layout without one).
+// Empty on a GPU that never ran init: everything is MISC / CONTROL.
+struct amdgpu_reg_map {
+  struct amdgpu_reg_range ranges[AMDGPU_REG_MAX_RANGES]; // Sorted by start
+  uint32_t num_ranges;
+  struct amdgpu_reg_note notes[AMDGPU_REG_MAX_NOTES];    // Sorted by reg
+  uint32_t num_notes;
+};
+
+struct amdgpu_reg_lock_stats {
+  uint64_t acquires;
+  uint64_t contended; // Had to wait for it
+  uint64_t spins;     // Polls of the lock word while waiting
+};
+
+// One per domain, a cache line each so they don't bounce together
+struct amdgpu_reg_lock {
+  uint32_t held;
+  struct amdgpu_reg_lock_stats stats; // Updated with the lock held
+  uint8_t pad[64 - sizeof(uint64_t) - sizeof(struct amdgpu_reg_lock_stats)];
 };
 
 // GPU State Flags for "Heartbeat"
@@ -243,7 +460,9 @@ struct OBJGPU {
 
   // Synchronization - REAL locking for thread safety
   pthread_mutex_t lock;
-  pthread_rwlock_t mmio_lock;
+  pthread_rwlock_t mmio_lock;  // Guards the shadow; MMIO goes through reg_locks
+  struct amdgpu_reg_lock reg_locks[AMDGPU_REG_DOMAIN_COUNT];
+  struct amdgpu_reg_map reg_map;
   
   // Error handling and RAS
   struct amd_ras_counters ras;
@@ -251,20 +470,135 @@ struct OBJGPU {
   
   // Belter Strategy: Resilience Layer
   struct amd_shadow_state shadow;
+  struct amdgpu_snapshot suspend_state; // Taken by ip_blocks_suspend
+  struct amdgpu_ip_discovery *discovery; // NULL: no table, fixed block list
+  struct amdgpu_atomfw *atomfw;          // NULL: no VBIOS tables
   enum amd_gpu_state state;
-  pthread_t heartbeat_thread;
-  int heartbeat_running;
 };
 
+// Backend the HAL picked at init time
+#define AMDGPU_HAL_MODE_SIM 0  // Plain CPU memory, no hardware
+#define AMDGPU_HAL_MODE_DRM 1  // Real kernel driver underneath
+#define AMDGPU_HAL_MODE_MMIO 2 // We poke the hardware ourselves
+
 // The HAL API: The main commands you will use!
+int amdgpu_hal_get_mode(void);
 int amdgpu_device_init_hal(struct OBJGPU *adev);
 void amdgpu_device_fini_hal(struct OBJGPU *adev);
 int amdgpu_gpu_get_info_hal(struct OBJGPU *adev, amdgpu_gpu_info_t *info);
 int amdgpu_buffer_alloc_hal(struct OBJGPU *adev, size_t size,
                             struct amdgpu_buffer *buf);
 void amdgpu_buffer_free_hal(struct OBJGPU *adev, struct amdgpu_buffer *buf);
+int amdgpu_buffer_import_userptr_hal(struct OBJGPU *adev, void *cpu_addr,
+                                     size_t size, uint32_t flags,
+                                     struct amdgpu_buffer *buf);
+int amdgpu_buffer_export_dmabuf_hal(struct OBJGPU *adev,
+                                    struct amdgpu_buffer *buf, int *fd);
+int amdgpu_buffer_import_dmabuf_hal(struct OBJGPU *adev, int fd, size_t size,
+                                    struct amdgpu_buffer *buf);
 int amdgpu_command_submit_hal(struct OBJGPU *adev,
                               struct amdgpu_command_buffer *cb);
+int amdgpu_syncobj_create_hal(struct OBJGPU *adev, uint32_t *handle);
+void amdgpu_syncobj_destroy_hal(struct OBJGPU *adev, uint32_t handle);
+int amdgpu_syncobj_signal_hal(struct OBJGPU *adev, uint32_t handle,
+                              uint64_t point);
+int amdgpu_syncobj_export_sync_file_hal(struct OBJGPU *adev, uint32_t handle,
+                                        uint64_t point, int *fd);
+
+// VRAM residency (hal_residency.c): LRU eviction to GTT instead of failing
+uint32_t amdgpu_residency_track(struct OBJGPU *adev, struct amdgpu_buffer *buf);
+uint32_t amdgpu_residency_track_cb(struct OBJGPU *adev, struct amdgpu_buffer *buf,
+                                   void (*moved)(void *priv, uint32_t domain),
+                                   void *priv);
+void amdgpu_residency_untrack(struct OBJGPU *adev, struct amdgpu_buffer *buf);
+void amdgpu_residency_set_priority(struct amdgpu_buffer *buf, int priority);
+uint64_t amdgpu_residency_validate(struct OBJGPU *adev,
+                                   struct amdgpu_buffer **bo_list,
+                                   uint32_t bo_count);
+void amdgpu_residency_fence_signal(struct OBJGPU *adev, uint64_t fence);
+void amdgpu_residency_set_budget(struct OBJGPU *adev, uint64_t bytes);
+void amdgpu_residency_get_stats(struct OBJGPU *adev,
+                                struct amdgpu_residency_stats *out);
+
+// SDMA (hal_sdma.c): in simulation the CPU runs the copy engine's packets
+int amdgpu_sdma_submit_hal(struct OBJGPU *adev,
+                           struct amdgpu_command_buffer *cb);
+int amdgpu_sdma_submit_bounded_hal(struct OBJGPU *adev,
+                                   struct amdgpu_command_buffer *cb);
+int amdgpu_sdma_execute_sim(const uint32_t *dw, uint32_t ndw);
+int amdgpu_sdma_execute_bounded_sim(const uint32_t *dw, uint32_t ndw,
+                                    struct amdgpu_buffer **bos,
+                                    uint32_t bo_count);
+void amdgpu_sdma_fini_sim(void);
+void amdgpu_sdma_get_stats(struct amdgpu_sdma_stats *out);
+
+// Interrupt handler ring (hal_ih.c): IVs in, handlers per client / source out
+#define AMDGPU_IH_IV_DW 8          // One interrupt vector (Vega10 and later)
+#define AMDGPU_IH_MAX_CLIENTS 32   // SOC15_IH_CLIENTID_MAX
+#define AMDGPU_IH_MAX_SOURCES 256
+
+#define AMDGPU_IH_WAKE_NONE 0    // Nobody wakes us: call amdgpu_ih_process
+#define AMDGPU_IH_WAKE_SIM 1     // The simulated device (amdgpu_ih_sim_raise)
+#define AMDGPU_IH_WAKE_EVENTFD 2 // VFIO: an eventfd the interrupt signals
+#define AMDGPU_IH_WAKE_UIO 3     // UIO: read the count, write 1 to re-arm
+
+// One decoded IV (same fields as the kernel's amdgpu_iv_entry)
+struct amdgpu_iv_entry {
+  uint32_t client_id;  // SOC15_IH_CLIENTID_*
+  uint32_t src_id;     // Per client, see src/amd/include/ivsrcid
+  uint32_t ring_id;
+  uint32_t vmid;
+  uint32_t vmid_src;
+  uint64_t timestamp;  // 48 bits
+  uint32_t timestamp_src;
+  uint32_t pasid;
+  uint32_t node_id;
+  uint32_t src_data[4];
+};
+
+typedef void (*amdgpu_ih_handler)(void *priv, const struct amdgpu_iv_entry *iv);
+
+// What the IH has been up to
+struct amdgpu_ih_stats {
+  uint64_t entries;    // IVs taken off the ring
+  uint64_t batches;    // Runs of them taken at once
+  uint64_t wakeups;    // Interrupts (or sim kicks) that woke the worker
+  uint64_t unhandled;  // Nobody registered for the client / source
+  uint64_t overflows;  // Ring was full, the IV got lost
+};
+
+int amdgpu_ih_init(uint32_t ring_bytes, int wake, int fd);
+void amdgpu_ih_fini(void);
+bool amdgpu_ih_active(void);
+int amdgpu_ih_register(uint32_t client, uint32_t src_id, amdgpu_ih_handler fn,
+                       void *priv);
+void amdgpu_ih_unregister(uint32_t client, uint32_t src_id);
+uint32_t amdgpu_ih_process(void);
+int amdgpu_ih_sim_raise(const struct amdgpu_iv_entry *iv);
+int amdgpu_ih_get_ring(uint32_t **ring, uint32_t *bytes, uint32_t **wptr);
+void amdgpu_ih_get_stats(struct amdgpu_ih_stats *out);
+
+// Ring watchdog (hal_watchdog.c): armed by submissions, fed by fences
+#define AMDGPU_WATCHDOG_MAX_RINGS 8
+
+// Ring stopped moving: stuck_seq is the first job that didn't finish,
+// last_seq the last one on the ring
+typedef void (*amdgpu_watchdog_fn)(void *priv, uint32_t ring,
+                                   uint64_t stuck_seq, uint64_t last_seq);
+
+struct amdgpu_watchdog_stats {
+  uint64_t arms;     // Jobs put on watched rings
+  uint64_t signals;  // Times a fence moved
+  uint64_t wakeups;  // Times the timer thread woke up
+  uint64_t hangs;    // Deadlines that passed without progress
+};
+
+int amdgpu_watchdog_init(amdgpu_watchdog_fn on_hang, void *priv);
+void amdgpu_watchdog_fini(void);
+int amdgpu_watchdog_set_timeout(uint32_t ring, uint32_t timeout_ms);
+void amdgpu_watchdog_arm(uint32_t ring, uint64_t seq);
+void amdgpu_watchdog_signal(uint32_t ring, uint64_t seq);
+void amdgpu_watchdog_get_stats(struct amdgpu_watchdog_stats *out);
 
 // Display Mode Setting - disabled for now due to header compatibility issues
 // int amdgpu_set_display_mode_hal(struct OBJGPU *adev, const struct display_mode *mode);
@@ -286,7 +620,41 @@ void amdgpu_hal_shadow_write(struct OBJGPU *adev, uint32_t offset,
                              uint32_t value);
 int amdgpu_hal_reset(struct OBJGPU *adev);
 int amdgpu_gpu_recover(struct OBJGPU *adev);
-void *amdgpu_hal_heartbeat(void *arg);
+int amdgpu_ip_block_reset(struct OBJGPU *adev, const char *name);
+void amdgpu_hal_shadow_fini(struct OBJGPU *adev);
+
+// Register snapshots (hal_snapshot.c)
+int amdgpu_snapshot_capture(struct OBJGPU *adev, struct amdgpu_snapshot *snap,
+                            int block);
+int amdgpu_snapshot_add_blob(struct amdgpu_snapshot *snap, uint32_t tag,
+                             const void *data, uint32_t size);
+const void *amdgpu_snapshot_find_blob(const struct amdgpu_snapshot *snap,
+                                      uint32_t tag, uint32_t *size);
+int amdgpu_snapshot_restore(struct OBJGPU *adev,
+                            const struct amdgpu_snapshot *snap,
+                            uint32_t *skipped);
+void amdgpu_snapshot_free(struct amdgpu_snapshot *snap);
+
+// IP discovery (hal_discovery.c)
+int amdgpu_discovery_parse(const void *bin, size_t size,
+                           struct amdgpu_ip_discovery *out);
+int amdgpu_discovery_read_vram(const volatile void *vram, uint64_t vram_size,
+                               struct amdgpu_ip_discovery *out);
+int amdgpu_discovery_load(struct OBJGPU *adev);
+void amdgpu_discovery_fini(struct OBJGPU *adev);
+const struct amdgpu_ip_info *amdgpu_discovery_ip(const struct OBJGPU *adev,
+                                                 enum amdgpu_hwip hwip,
+                                                 uint32_t inst);
+int amdgpu_discovery_reg_offset(const struct OBJGPU *adev, enum amdgpu_hwip hwip,
+                                uint32_t inst, uint32_t seg, uint32_t reg,
+                                uint32_t *dw);
+
+// VBIOS data tables (hal_atomfw.c)
+int amdgpu_atomfw_parse(const void *rom, size_t size,
+                        struct amdgpu_atomfw_info *out);
+int amdgpu_atomfw_load(struct OBJGPU *adev);
+void amdgpu_atomfw_fini(struct OBJGPU *adev);
+const struct amdgpu_atomfw_info *amdgpu_atomfw_get(const struct OBJGPU *adev);
 
 // Error tracking
 void amdgpu_ras_record_error(struct OBJGPU *adev, int error_type);
@@ -298,5 +666,22 @@ int amdgpu_lock_gpu(struct OBJGPU *adev);
 int amdgpu_unlock_gpu(struct OBJGPU *adev);
 int amdgpu_read_reg_locked(struct OBJGPU *adev, uint32_t offset);
 void amdgpu_write_reg_locked(struct OBJGPU *adev, uint32_t offset, uint32_t value);
+uint32_t amdgpu_rmw_reg_locked(struct OBJGPU *adev, uint32_t offset,
+                               uint32_t clear, uint32_t set);
+uint32_t amdgpu_read_reg_indexed(struct OBJGPU *adev, uint32_t index_offset,
+                                 uint32_t data_offset, uint32_t reg);
+void amdgpu_write_reg_indexed(struct OBJGPU *adev, uint32_t index_offset,
+                              uint32_t data_offset, uint32_t reg,
+                              uint32_t value);
+
+// Register map and lock stats (hal_regs.c)
+void amdgpu_regs_init(struct OBJGPU *adev);
+enum amdgpu_reg_domain amdgpu_reg_domain(const struct OBJGPU *adev, uint32_t offset);
+enum amdgpu_reg_class amdgpu_reg_class(const struct OBJGPU *adev, uint32_t offset);
+int amdgpu_reg_get_stats(const struct OBJGPU *adev, enum amdgpu_reg_domain domain,
+                         struct amdgpu_reg_lock_stats *out);
+void amdgpu_regs_log_stats(const struct OBJGPU *adev);
+void amdgpu_reg_lock_domains(struct OBJGPU *adev, uint32_t mask);
+void amdgpu_reg_unlock_domains(struct OBJGPU *adev, uint32_t mask);
 
 #endif /* AMD_HAL_H */
\ No newline at end of file
@@ -0,0 +1,411 @@
+#include "hal.h"
+#include "../../os/os_interface.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../src/amd/include/atomfirmware.h"
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the VBIOS data table reader - the board tells us its clocks.
+ * The display and clock code guessed: a 100 MHz PLL reference in
+ * clock_v10.c, 1 GB of VRAM and 1500 MHz in rmapi_get_gpu_info. The
+ * VBIOS has the real numbers in its AtomFirmware data tables
+ * (atomfirmware.h), the same ones amdgpu_atomfirmware.c reads:
+ *   - firmwareinfo: firmware revision, boot clocks and voltages
+ *   - smu_info / dce_info: core and display reference clocks
+ *   - displayobjectinfo: connector -> encoder paths
+ *   - vram_info: memory type, size, channels
+ *
+ * Getting there: 0x55AA at the start, the ROM header pointer at 0x48,
+ * "ATOM" in the header, then the master data table with an offset per
+ * table. Every table starts with a common header whose structuresize we
+ * check against the image before copying anything out of it.
+ *
+ * Parsing isn't expensive, but it's still work on every start for numbers
+ * that only change with a VBIOS flash. So the result is a flat struct,
+ * written to a cache file named after a hash of the image. Warm starts
+ * mmap it and check the header, the CRC and the key instead of parsing.
+ * A cache from another VBIOS, another layout version or a torn write fails
+ * one of those and we parse again (and rewrite it).
+ *
+ * The image comes from (first one that works):
+ *   - AMDGPU_VBIOS=<file>: a dump, for bring-up and tests
+ *   - debugfs amdgpu_vbios, or the PCI ROM in sysfs
+ * The cache lives in AMDGPU_VBIOS_CACHE=<dir>, or the system cache dir.
+ *
+ * Pre-SoC15 boards have AtomBIOS (atombios.h) tables instead; those are
+ * refused here and everything keeps its defaults.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define ATOMFW_CACHE_MAGIC 0x57464D41u // "AMFW"
+#define ATOMFW_CACHE_VERSION 1         // Bump when amdgpu_atomfw_info changes
+#define ATOMFW_MAX_ROM (1u << 20)
+#define ATOMFW_ROM_HEADER_PTR 0x48     // OFFSET_TO_POINTER_TO_ATOM_ROM_HEADER
+#define ATOMFW_DEBUGFS "/sys/kernel/debug/dri/0/amdgpu_vbios"
+#define ATOMFW_SYSFS_ROM "/sys/class/drm/card0/device/rom"
+#ifdef __HAIKU__
+#define ATOMFW_CACHE_DIR "/boot/system/cache/amdgpu"
+#else
+#define ATOMFW_CACHE_DIR "/var/cache/amdgpu"
+#endif
+
+static uint64_t atomfw_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint16_t atomfw_le16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// FNV-1a: the cache key for the image, and the CRC of the cache itself
+static uint64_t atomfw_hash(const void *data, size_t size) {
+  const uint8_t *p = data;
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; i++)
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  return h;
+}
+
+static uint32_t atomfw_crc(const struct amdgpu_atomfw_info *info) {
+  const size_t from = offsetof(struct amdgpu_atomfw_info, crc) + sizeof(info->crc);
+  uint64_t h = atomfw_hash((const uint8_t *)info + from, sizeof(*info) - from);
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+// Copy a data table out of the image: at most dst_size bytes, zeroes past
+// what the table has. 0 if it's there with at least min_size bytes.
+static int atomfw_table(const uint8_t *rom, size_t size, uint16_t off,
+                        uint8_t frev, void *dst, size_t dst_size,
+                        size_t min_size, uint8_t *crev) {
+  memset(dst, 0, dst_size);
+  if (!off || (size_t)off + sizeof(struct atom_common_table_header) > size)
+    return -1;
+  struct atom_common_table_header hdr;
+  memcpy(&hdr, rom + off, sizeof(hdr));
+  if (hdr.format_revision != frev || hdr.structuresize < min_size ||
+      (size_t)off + hdr.structuresize > size)
+    return -1;
+  memcpy(dst, rom + off, hdr.structuresize < dst_size ? hdr.structuresize : dst_size);
+  if (crev)
+    *crev = hdr.content_revision;
+  return 0;
+}
+
+#define ATOMFW_END(type, field) (offsetof(type, field) + sizeof(((type *)0)->field))
+
+static void atomfw_parse_display(const uint8_t *rom, size_t size, uint16_t off,
+                                 struct amdgpu_atomfw_info *out) {
+  // v1.4 and v1.5 paths are the same size, and the fields we want are at
+  // the same places in both
+  struct display_object_info_table_v1_4 t;
+  uint8_t crev = 0;
+  const size_t head = offsetof(struct display_object_info_table_v1_4, display_path);
+  if (atomfw_table(rom, size, off, 1, &t, sizeof(t), head, &crev) != 0 ||
+      (crev != 4 && crev != 5))
+    return;
+  uint16_t fits = (uint16_t)((t.table_header.structuresize - head) /
+                             sizeof(struct atom_display_object_path_v2));
+  uint16_t n = t.number_of_path;
+  if (n > fits)
+    n = fits;
+  if (n > AMDGPU_ATOMFW_MAX_PATHS)
+    n = AMDGPU_ATOMFW_MAX_PATHS;
+  out->supported_devices = t.supporteddevices;
+  out->num_paths = n;
+  for (uint16_t i = 0; i < n; i++) {
+    const struct atom_display_object_path_v2 *p = &t.display_path[i];
+    out->paths[i].connector_id = p->display_objid;
+    out->paths[i].encoder_id = p->encoderobjid;
+    out->paths[i].ext_encoder_id = crev == 4 ? p->extencoderobjid : 0;
+    out->paths[i].device_tag = p->device_tag;
+  }
+  out->tables |= AMDGPU_ATOMFW_DISPLAY;
+}
+
+static void atomfw_parse_vram(const uint8_t *rom, size_t size, uint16_t off,
+                              struct amdgpu_atomfw_info *out) {
+  // v2.3 lists atom_vram_module_v9, v2.4 atom_vram_module_v10; the two
+  // agree up to the part number, which is all we read
+  struct atom_vram_info_header_v2_4 t;
+  uint8_t crev = 0;
+  const size_t need = offsetof(struct atom_vram_info_header_v2_4, vram_module) +
+                      ATOMFW_END(struct atom_vram_module_v9, channel_width);
+  if (atomfw_table(rom, size, off, 2, &t, sizeof(t), need, &crev) != 0 ||
+      (crev != 3 && crev != 4) || t.vram_module_num == 0)
+    return;
+  const struct atom_vram_module_v10 *m = &t.vram_module[0];
+  out->vram_modules = t.vram_module_num;
+  out->vram_size_mb = m->memory_size;
+  out->vram_max_clk_10khz = m->max_mem_clk;
+  out->vram_type = m->memory_type;
+  out->vram_channels = m->channel_num;
+  out->vram_channel_width = m->channel_width;
+  out->tables |= AMDGPU_ATOMFW_VRAM;
+}
+
+// Parse a VBIOS image. -1 if it isn't an AtomFirmware one; tables it
+// doesn't have (or has in a revision we don't know) are left out of
+// out->tables and their fields stay 0.
+int amdgpu_atomfw_parse(const void *image, size_t size,
+                        struct amdgpu_atomfw_info *out) {
+  const uint8_t *rom = image;
+  if (!rom || !out || size < ATOMFW_ROM_HEADER_PTR + 2 || size > ATOMFW_MAX_ROM ||
+      rom[0] != 0x55 || rom[1] != 0xAA)
+    return -1;
+  memset(out, 0, sizeof(*out));
+
+  struct atom_rom_header_v2_2 hdr;
+  uint16_t hdr_off = atomfw_le16(rom + ATOMFW_ROM_HEADER_PTR);
+  if (atomfw_table(rom, size, hdr_off, 2, &hdr, sizeof(hdr),
+                   ATOMFW_END(struct atom_rom_header_v2_2, masterdatatable_offset),
+                   NULL) != 0 ||
+      memcmp(hdr.atom_bios_string, "ATOM", 4) != 0)
+    return -1;
+
+  struct atom_master_data_table_v2_1 master;
+  if (atomfw_table(rom, size, hdr.masterdatatable_offset, 2, &master,
+                   sizeof(master), sizeof(master), NULL) != 0)
+    return -1;
+  const struct atom_master_list_of_data_tables_v2_1 *list = &master.listOfdatatables;
+
+  struct atom_firmware_info_v3_1 fw;
+  if (atomfw_table(rom, size, list->firmwareinfo, 3, &fw, sizeof(fw),
+                   ATOMFW_END(struct atom_firmware_info_v3_1, bootup_vddci_mv),
+                   NULL) == 0) {
+    out->firmware_revision = fw.firmware_revision;
+    out->bootup_sclk_10khz = fw.bootup_sclk_in10khz;
+    out->bootup_mclk_10khz = fw.bootup_mclk_in10khz;
+    out->firmware_capability = fw.firmware_capability;
+    out->bootup_vddc_mv = fw.bootup_vddc_mv;
+    out->bootup_vddci_mv = fw.bootup_vddci_mv;
+    out->tables |= AMDGPU_ATOMFW_FIRMWARE;
+  }
+
+  // Every v3 smu_info has the reference where v3.1 does
+  struct atom_smu_info_v3_1 smu;
+  if (atomfw_table(rom, size, list->smu_info, 3, &smu, sizeof(smu),
+                   ATOMFW_END(struct atom_smu_info_v3_1, core_refclk_10khz),
+                   NULL) == 0) {
+    out->core_refclk_10khz = smu.core_refclk_10khz;
+    out->tables |= AMDGPU_ATOMFW_SMU;
+  }
+
+  // Same for v4.1 through v4.5 dce_info
+  struct atom_display_controller_info_v4_1 dce;
+  if (atomfw_table(rom, size, list->dce_info, 4, &dce, sizeof(dce),
+                   ATOMFW_END(struct atom_display_controller_info_v4_1,
+                              dce_refclk_10khz),
+                   NULL) == 0) {
+    out->dce_refclk_10khz = dce.dce_refclk_10khz;
+    out->bootup_dispclk_10khz = dce.bootup_dispclk_10khz;
+    out->tables |= AMDGPU_ATOMFW_DCE;
+  }
+
+  atomfw_parse_display(rom, size, list->displayobjectinfo, out);
+  atomfw_parse_vram(rom, size, list->vram_info, out);
+
+  out->magic = ATOMFW_CACHE_MAGIC;
+  out->version = ATOMFW_CACHE_VERSION;
+  out->size = sizeof(*out);
+  out->vbios_key = atomfw_hash(rom, size);
+  out->crc = atomfw_crc(out);
+  return 0;
+}
+
+// --- Reading the image ---
+
+static uint8_t *atomfw_read_file(const char *path, size_t *size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  uint8_t *buf = os_prim_alloc(ATOMFW_MAX_ROM);
+  if (!buf) {
+    close(fd);
+    return NULL;
+  }
+  size_t got = 0;
+  ssize_t n;
+  while (got < ATOMFW_MAX_ROM && (n = read(fd, buf + got, ATOMFW_MAX_ROM - got)) > 0)
+    got += (size_t)n;
+  close(fd);
+  if (got == 0) {
+    os_prim_free(buf);
+    return NULL;
+  }
+  *size = got;
+  return buf;
+}
+
+// sysfs only hands out the ROM after a "1" is written to it
+static uint8_t *atomfw_read_pci_rom(size_t *size) {
+  int fd = open(ATOMFW_SYSFS_ROM, O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  uint8_t *rom = NULL;
+  if (write(fd, "1", 1) == 1) {
+    rom = atomfw_read_file(ATOMFW_SYSFS_ROM, size);
+    if (write(fd, "0", 1) != 1)
+      os_prim_log("HAL AtomFW: couldn't turn the ROM back off\n");
+  }
+  close(fd);
+  return rom;
+}
+
+static uint8_t *atomfw_read_vbios(size_t *size, const char **from) {
+  const char *path = getenv("AMDGPU_VBIOS");
+  if (path && *path) {
+    *from = path;
+    return atomfw_read_file(path, size);
+  }
+  if (amdgpu_hal_get_mode() != AMDGPU_HAL_MODE_DRM)
+    return NULL;
+  *from = ATOMFW_DEBUGFS;
+  uint8_t *rom = atomfw_read_file(ATOMFW_DEBUGFS, size);
+  if (!rom) {
+    *from = ATOMFW_SYSFS_ROM;
+    rom = atomfw_read_pci_rom(size);
+  }
+  return rom;
+}
+
+// --- The cache ---
+
+static void atomfw_cache_path(char *buf, size_t len, uint64_t key) {
+  const char *dir = getenv("AMDGPU_VBIOS_CACHE");
+  snprintf(buf, len, "%s/vbios-%016llx.bin", dir && *dir ? dir : ATOMFW_CACHE_DIR,
+           (unsigned long long)key);
+}
+
+static bool atomfw_cache_valid(const struct amdgpu_atomfw_info *info, uint64_t key) {
+  return info->magic == ATOMFW_CACHE_MAGIC && info->version == ATOMFW_CACHE_VERSION &&
+         info->size == sizeof(*info) && info->vbios_key == key &&
+         info->crc == atomfw_crc(info);
+}
+
+static int atomfw_cache_map(struct amdgpu_atomfw *fw, const char *path, uint64_t key) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size == sizeof(struct amdgpu_atomfw_info))
+    map = mmap(NULL, sizeof(struct amdgpu_atomfw_info), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+  if (!atomfw_cache_valid(map, key)) {
+    os_prim_log("HAL AtomFW: stale cache %s, parsing again\n", path);
+    munmap(map, sizeof(struct amdgpu_atomfw_info));
+    return -1;
+  }
+  fw->map = map;
+  fw->map_size = sizeof(struct amdgpu_atomfw_info);
+  fw->info = map;
+  return 0;
+}
+
+// Write-then-rename, so a reader never maps half a file
+static void atomfw_cache_store(const struct amdgpu_atomfw_info *info, const char *path) {
+  const char *dir = getenv("AMDGPU_VBIOS_CACHE");
+  if (mkdir(dir && *dir ? dir : ATOMFW_CACHE_DIR, 0755) != 0 && errno != EEXIST)
+    return; // No cache dir we can make: cold every time, still works
+  char tmp[512];
+  if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp))
+    return;
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return;
+  bool ok = write(fd, info, sizeof(*info)) == (ssize_t)sizeof(*info);
+  close(fd);
+  if (!ok || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return;
+  }
+  os_prim_log("HAL AtomFW: cached to %s\n", path);
+}
+
+// Find and read the VBIOS tables for adev. 0 = adev->atomfw is set; -1 =
+// none, and everything keeps using its defaults.
+int amdgpu_atomfw_load(struct OBJGPU *adev) {
+  if (!adev)
+    return -1;
+  amdgpu_atomfw_fini(adev);
+
+  size_t size = 0;
+  const char *from = NULL;
+  uint8_t *rom = atomfw_read_vbios(&size, &from);
+  if (!rom)
+    return -1;
+  struct amdgpu_atomfw *fw = os_prim_alloc(sizeof(*fw));
+  if (!fw) {
+    os_prim_free(rom);
+    return -1;
+  }
+  memset(fw, 0, sizeof(*fw));
+
+  uint64_t start = atomfw_now_ns();
+  uint64_t key = atomfw_hash(rom, size);
+  char path[512];
+  atomfw_cache_path(path, sizeof(path), key);
+  if (atomfw_cache_map(fw, path, key) == 0) {
+    fw->warm = true;
+  } else if (amdgpu_atomfw_parse(rom, size, &fw->parsed) == 0) {
+    fw->parsed.cold_parse_ns = atomfw_now_ns() - start;
+    fw->parsed.crc = atomfw_crc(&fw->parsed);
+    fw->info = &fw->parsed;
+  } else {
+    os_prim_log("HAL AtomFW: %s isn't an AtomFirmware VBIOS\n", from);
+    os_prim_free(rom);
+    os_prim_free(fw);
+    return -1;
+  }
+  fw->load_ns = atomfw_now_ns() - start;
+  os_prim_free(rom);
+
+  if (fw->warm) {
+    os_prim_log("HAL AtomFW: warm start, cache mapped in %llu us "
+                "(cold parse took %llu us)\n",
+                (unsigned long long)(fw->load_ns / 1000),
+                (unsigned long long)(fw->info->cold_parse_ns / 1000));
+  } else {
+    os_prim_log("HAL AtomFW: cold start, %s parsed in %llu us\n", from,
+                (unsigned long long)(fw->load_ns / 1000));
+    atomfw_cache_store(fw->info, path);
+  }
+  os_prim_log("HAL AtomFW: tables 0x%x, refclk %u kHz, %u display path(s), "
+              "%u MB VRAM\n",
+              fw->info->tables, fw->info->dce_refclk_10khz * 10,
+              fw->info->num_paths, fw->info->vram_size_mb);
+  adev->atomfw = fw;
+  return 0;
+}
+
+void amdgpu_atomfw_fini(struct OBJGPU *adev) {
+  if (!adev || !adev->atomfw)
+    return;
+  if (adev->atomfw->map)
+    munmap(adev->atomfw->map, adev->atomfw->map_size);
+  os_prim_free(adev->atomfw);
+  adev->atomfw = NULL;
+}
+
+// NULL if there's no VBIOS to go by
+const struct amdgpu_atomfw_info *amdgpu_atomfw_get(const struct OBJGPU *adev) {
+  return adev && adev->atomfw ? adev->atomfw->info : NULL;
+}
@@ -0,0 +1,335 @@
+#include "hal.h"
+#include "../../os/os_interface.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// discovery.h is the kernel's; these two are all it needs from kernel headers
+#ifndef DECLARE_FLEX_ARRAY
+#define DECLARE_FLEX_ARRAY(type, name) \
+  struct {                             \
+    struct {                           \
+    } __empty_##name;                  \
+    type name[];                       \
+  }
+#endif
+#ifndef __packed
+#define __packed __attribute__((packed))
+#endif
+#include "../../src/amd/include/discovery.h"
+#include "../../src/amd/include/soc15_hw_ip.h"
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the IP Discovery parser - asking the chip what's inside.
+ * We used to register GMC v10, GFX, DCE v10 and DCN v1 on every device and
+ * let them poke registers at offsets from navi10_ip_offset.h. On anything
+ * that isn't a Navi10, that's initializing blocks that aren't there and
+ * polling registers that never answer.
+ *
+ * Since Navi the VBIOS leaves a table at the top of VRAM (the last 64 KB)
+ * listing every IP on the die: which one (hw_id), which instance, its
+ * version and where its register segments start. Same parser as
+ * amdgpu_discovery.c, minus the kernel:
+ *   - Binary header: signature and byte-sum checksum over the whole thing.
+ *   - IP discovery table: its own signature and checksum, then per die a
+ *     list of IPs, each followed by its base addresses (64-bit ones on v4
+ *     tables, which we cut to 32 like the kernel does).
+ *   - Harvested IPs (the per-IP bit on old tables, the harvest table on
+ *     new ones) are fused off: they don't show up as present.
+ *
+ * What comes out is a [hwip][instance] array: version and bases are one
+ * index away, which is what block selection and register offsets need.
+ *
+ * The table comes from (first one that works):
+ *   - AMDGPU_IP_DISCOVERY=<file>: a dump, for bring-up and tests
+ *   - debugfs amdgpu_discovery, or the firmware file the kernel would load
+ *   - VRAM, for a backend that has the aperture mapped
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define DISCOVERY_TMR_SIZE (10 << 10)   // What the VBIOS reserves for it
+#define DISCOVERY_TMR_OFFSET (64 << 10) // From the end of VRAM
+#define DISCOVERY_DEBUGFS "/sys/kernel/debug/dri/0/amdgpu_discovery"
+#define DISCOVERY_FIRMWARE "/lib/firmware/amdgpu/ip_discovery.bin"
+
+static uint16_t disc_le16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t disc_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static bool disc_checksum_ok(const uint8_t *p, size_t size, uint16_t expected) {
+  uint16_t sum = 0;
+  for (size_t i = 0; i < size; i++)
+    sum = (uint16_t)(sum + p[i]);
+  return sum == expected;
+}
+
+// hw_id -> our index, like the kernel's hw_id_map the other way around
+static int disc_hwip(uint16_t hw_id) {
+  switch (hw_id) {
+  case GC_HWID: return AMDGPU_HWIP_GC;
+  case HDP_HWID: return AMDGPU_HWIP_HDP;
+  case SDMA0_HWID: return AMDGPU_HWIP_SDMA0;
+  case SDMA1_HWID: return AMDGPU_HWIP_SDMA1;
+  case SDMA2_HWID: return AMDGPU_HWIP_SDMA2;
+  case SDMA3_HWID: return AMDGPU_HWIP_SDMA3;
+  case MMHUB_HWID: return AMDGPU_HWIP_MMHUB;
+  case ATHUB_HWID: return AMDGPU_HWIP_ATHUB;
+  case NBIF_HWID: return AMDGPU_HWIP_NBIO;
+  case MP0_HWID: return AMDGPU_HWIP_MP0;
+  case MP1_HWID: return AMDGPU_HWIP_MP1;
+  case UVD_HWID: return AMDGPU_HWIP_VCN;
+  case VCE_HWID: return AMDGPU_HWIP_VCE;
+  case DF_HWID: return AMDGPU_HWIP_DF;
+  case DMU_HWID: return AMDGPU_HWIP_DCE;
+  case OSSSYS_HWID: return AMDGPU_HWIP_OSSSYS;
+  case SMUIO_HWID: return AMDGPU_HWIP_SMUIO;
+  case PWR_HWID: return AMDGPU_HWIP_PWR;
+  case THM_HWID: return AMDGPU_HWIP_THM;
+  case CLKA_HWID: return AMDGPU_HWIP_CLK;
+  case UMC_HWID: return AMDGPU_HWIP_UMC;
+  default: return -1; // Nothing of ours talks to it
+  }
+}
+
+static void disc_harvest(struct amdgpu_ip_discovery *d, uint16_t hw_id,
+                         uint8_t inst) {
+  int hwip = disc_hwip(hw_id);
+  if (hwip < 0 || inst >= AMDGPU_DISCOVERY_MAX_INST)
+    return;
+  struct amdgpu_ip_info *ip = &d->ip[hwip][inst];
+  if (ip->present)
+    d->harvested++;
+  ip->present = false;
+  ip->harvested = true;
+}
+
+// The harvest table (newer chips): hw_id/instance pairs, 0 ends the list
+static int disc_parse_harvest(const uint8_t *b, size_t size,
+                              struct amdgpu_ip_discovery *d) {
+  const uint8_t *info = b + offsetof(binary_header, table_list) +
+                        HARVEST_INFO * sizeof(table_info);
+  uint16_t off = disc_le16(info + offsetof(table_info, offset));
+  if (!off)
+    return 0;
+  if ((size_t)off + sizeof(harvest_table) > size ||
+      disc_le32(b + off) != HARVEST_TABLE_SIGNATURE)
+    return -1;
+  const uint8_t *list = b + off + offsetof(harvest_table, list);
+  for (int i = 0; i < 32; i++) {
+    const uint8_t *h = list + i * sizeof(harvest_info);
+    uint16_t hw_id = disc_le16(h + offsetof(harvest_info, hw_id));
+    if (!hw_id)
+      break;
+    disc_harvest(d, hw_id, h[offsetof(harvest_info, number_instance)]);
+  }
+  return 0;
+}
+
+int amdgpu_discovery_parse(const void *bin, size_t size,
+                           struct amdgpu_ip_discovery *out) {
+  const uint8_t *b = bin;
+  if (!b || !out || size < sizeof(binary_header))
+    return -1;
+  memset(out, 0, sizeof(*out));
+
+  if (disc_le32(b + offsetof(binary_header, binary_signature)) !=
+      BINARY_SIGNATURE) {
+    os_prim_log("HAL Discovery: Not an IP discovery binary\n");
+    return -1;
+  }
+  size_t sum_from = offsetof(binary_header, binary_checksum) + sizeof(uint16_t);
+  uint16_t bin_size = disc_le16(b + offsetof(binary_header, binary_size));
+  if (bin_size > size || bin_size < sizeof(binary_header) ||
+      !disc_checksum_ok(b + sum_from, bin_size - sum_from,
+                        disc_le16(b + offsetof(binary_header, binary_checksum)))) {
+    os_prim_log("HAL Discovery: Binary checksum mismatch\n");
+    return -1;
+  }
+  size = bin_size; // Nothing past the end of the binary counts
+
+  const uint8_t *info = b + offsetof(binary_header, table_list) +
+                        IP_DISCOVERY * sizeof(table_info);
+  uint16_t ihdr_off = disc_le16(info + offsetof(table_info, offset));
+  if (!ihdr_off || (size_t)ihdr_off + sizeof(ip_discovery_header) > size)
+    return -1;
+  const uint8_t *ihdr = b + ihdr_off;
+  uint16_t table_size = disc_le16(ihdr + offsetof(ip_discovery_header, size));
+  if (disc_le32(ihdr) != DISCOVERY_TABLE_SIGNATURE ||
+      (size_t)ihdr_off + table_size > size ||
+      !disc_checksum_ok(ihdr, table_size,
+                        disc_le16(info + offsetof(table_info, checksum)))) {
+    os_prim_log("HAL Discovery: IP table signature or checksum is bad\n");
+    return -1;
+  }
+
+  out->version = disc_le16(ihdr + offsetof(ip_discovery_header, version));
+  // The v4 flag byte sits right after die_info[]
+  bool base64 = out->version >= 4 &&
+                (ihdr[offsetof(ip_discovery_header, padding)] & 0x1);
+  uint16_t num_dies = disc_le16(ihdr + offsetof(ip_discovery_header, num_dies));
+  if (num_dies > 16)
+    return -1;
+  out->num_dies = num_dies;
+
+  for (uint16_t die = 0; die < num_dies; die++) {
+    const uint8_t *di = ihdr + offsetof(ip_discovery_header, die_info) +
+                        die * sizeof(die_info);
+    size_t pos = disc_le16(di + offsetof(die_info, die_offset));
+    if (pos + sizeof(die_header) > size ||
+        disc_le16(b + pos + offsetof(die_header, die_id)) != die)
+      return -1;
+    uint16_t num_ips = disc_le16(b + pos + offsetof(die_header, num_ips));
+    pos += sizeof(die_header);
+
+    for (uint16_t n = 0; n < num_ips; n++) {
+      if (pos + sizeof(ip) > size)
+        return -1;
+      const uint8_t *p = b + pos;
+      uint16_t hw_id = disc_le16(p + offsetof(ip, hw_id));
+      uint8_t inst = p[offsetof(ip, number_instance)];
+      uint8_t nbase = p[offsetof(ip, num_base_address)];
+      size_t base_size = base64 ? 8 : 4;
+      if (pos + sizeof(ip) + nbase * base_size > size)
+        return -1;
+      pos += sizeof(ip) + nbase * base_size;
+      out->entries++;
+
+      int hwip = disc_hwip(hw_id);
+      if (hwip < 0 || inst >= AMDGPU_DISCOVERY_MAX_INST)
+        continue;
+      struct amdgpu_ip_info *e = &out->ip[hwip][inst];
+      uint8_t nibbles = p[sizeof(ip) - 1]; // harvest, or subrev/variant on v3+
+      e->major = p[offsetof(ip, major)];
+      e->minor = p[offsetof(ip, minor)];
+      e->revision = p[offsetof(ip, revision)];
+      if (hw_id == UVD_HWID)
+        e->revision &= 0x3F; // Bits 7:6 are encode/decode disable
+      if (out->version >= 3) {
+        e->sub_revision = nibbles & 0xF;
+        e->variant = nibbles >> 4;
+      }
+      e->num_base = nbase < AMDGPU_DISCOVERY_MAX_BASE ? nbase
+                                                      : AMDGPU_DISCOVERY_MAX_BASE;
+      for (uint8_t k = 0; k < e->num_base; k++) {
+        const uint8_t *a = p + sizeof(ip) + k * base_size;
+        // 64-bit bases are dwords too; the top bits are chip specific
+        e->base[k] = base64 ? disc_le32(a) & 0x3FFFFFFF : disc_le32(a);
+      }
+      e->present = true;
+      if (out->version < 3 && (nibbles & 0xF) == 1)
+        disc_harvest(out, hw_id, inst);
+    }
+  }
+  return disc_parse_harvest(b, size, out);
+}
+
+// The copy the VBIOS left at the top of VRAM (vram: CPU mapping of all of it)
+int amdgpu_discovery_read_vram(const volatile void *vram, uint64_t vram_size,
+                               struct amdgpu_ip_discovery *out) {
+  if (!vram || vram_size < DISCOVERY_TMR_OFFSET)
+    return -1;
+  uint8_t *copy = os_prim_alloc(DISCOVERY_TMR_SIZE);
+  if (!copy)
+    return -1;
+  const volatile uint8_t *src =
+      (const volatile uint8_t *)vram + (vram_size - DISCOVERY_TMR_OFFSET);
+  for (size_t i = 0; i < DISCOVERY_TMR_SIZE; i++) // No memcpy on an aperture
+    copy[i] = src[i];
+  int ret = amdgpu_discovery_parse(copy, DISCOVERY_TMR_SIZE, out);
+  os_prim_free(copy);
+  return ret;
+}
+
+static int disc_read_file(const char *path, struct amdgpu_ip_discovery *out) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  uint8_t *buf = os_prim_alloc(DISCOVERY_TMR_SIZE);
+  if (!buf) {
+    close(fd);
+    return -1;
+  }
+  size_t got = 0;
+  ssize_t n;
+  while (got < DISCOVERY_TMR_SIZE &&
+         (n = read(fd, buf + got, DISCOVERY_TMR_SIZE - got)) > 0)
+    got += (size_t)n;
+  close(fd);
+  int ret = amdgpu_discovery_parse(buf, got, out);
+  os_prim_free(buf);
+  if (ret == 0)
+    os_prim_log("HAL Discovery: IP table from %s\n", path);
+  return ret;
+}
+
+// Find the table for adev. 0 = adev->discovery is set; -1 = no table, the
+// caller falls back to the fixed block list.
+int amdgpu_discovery_load(struct OBJGPU *adev) {
+  if (!adev)
+    return -1;
+  amdgpu_discovery_fini(adev);
+  struct amdgpu_ip_discovery *d = os_prim_alloc(sizeof(*d));
+  if (!d)
+    return -1;
+
+  const char *path = getenv("AMDGPU_IP_DISCOVERY");
+  int ret = -1;
+  if (path && *path) {
+    ret = disc_read_file(path, d);
+  } else if (amdgpu_hal_get_mode() == AMDGPU_HAL_MODE_DRM) {
+    ret = disc_read_file(DISCOVERY_DEBUGFS, d);
+    if (ret != 0)
+      ret = disc_read_file(DISCOVERY_FIRMWARE, d);
+  }
+  if (ret != 0) {
+    os_prim_free(d);
+    return -1;
+  }
+
+  adev->discovery = d;
+  os_prim_log("HAL Discovery: %u IPs on %u die(s), %u harvested\n",
+              d->entries, d->num_dies, d->harvested);
+  return 0;
+}
+
+void amdgpu_discovery_fini(struct OBJGPU *adev) {
+  if (adev && adev->discovery) {
+    os_prim_free(adev->discovery);
+    adev->discovery = NULL;
+  }
+}
+
+// NULL if the table doesn't have it (or there's no table)
+const struct amdgpu_ip_info *amdgpu_discovery_ip(const struct OBJGPU *adev,
+                                                 enum amdgpu_hwip hwip,
+                                                 uint32_t inst) {
+  if (!adev || !adev->discovery || (unsigned)hwip >= AMDGPU_HWIP_MAX ||
+      inst >= AMDGPU_DISCOVERY_MAX_INST)
+    return NULL;
+  const struct amdgpu_ip_info *ip = &adev->discovery->ip[hwip][inst];
+  return ip->present ? ip : NULL;
+}
+
+// SOC15_REG_OFFSET: segment base + register, in dwords
+int amdgpu_discovery_reg_offset(const struct OBJGPU *adev, enum amdgpu_hwip hwip,
+                                uint32_t inst, uint32_t seg, uint32_t reg,
+                                uint32_t *dw) {
+  const struct amdgpu_ip_info *ip = amdgpu_discovery_ip(adev, hwip, inst);
+  if (!ip || seg >= ip->num_base || !dw)
+    return -1;
+  *dw = ip->base[seg] + reg;
+  return 0;
+}
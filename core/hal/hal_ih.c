@@ -0,0 +1,390 @@
+#include "hal.h"
+#include "../../os/os_interface.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the IH - the Interrupt Handler ring, from our side of it.
+ * The GPU doesn't tap you on the shoulder once per event. It writes a
+ * 32-byte interrupt vector (IV) into a ring in memory - who it is (client
+ * ID), what happened (source ID), which ring / VMID / PASID, a timestamp
+ * and four words of source data - bumps its write pointer and raises one
+ * interrupt for however many IVs piled up.
+ *
+ * So the IH here:
+ *   - Sleeps until something wakes it. That's pluggable: an eventfd a VFIO
+ *     interrupt signals, a UIO device (read the count, write 1 to re-arm),
+ *     the simulated device (amdgpu_ih_sim_raise), or nobody at all and the
+ *     caller runs amdgpu_ih_process itself.
+ *   - Takes IVs off the ring in batches, decodes them the way
+ *     amdgpu_ih_decode_iv_helper does (Vega10 and later) and hands the
+ *     space back right away, before running anything.
+ *   - Finds the handler in a [client][src_id] table: one array index, no
+ *     list to walk. Per-client tables are only made for clients somebody
+ *     registered for.
+ * rptr / wptr are in bytes, like the hardware's, and the ring is a power
+ * of two so wrapping is a mask.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define IH_IV_BYTES (AMDGPU_IH_IV_DW * 4)
+#define IH_DEFAULT_RING (64u << 10)  // 2048 IVs, what navi10_ih asks for
+#define IH_MIN_RING (IH_IV_BYTES * 8)
+#define IH_MAX_RING (1u << 22)
+#define IH_BATCH 32                  // IVs per trip through the lock
+
+struct ih_source {
+  amdgpu_ih_handler fn;
+  void *priv;
+};
+
+static uint32_t *ih_ring;       // Where the IVs land
+static uint32_t ih_ptr_mask;    // Ring bytes - 1
+static uint32_t ih_wptr_wb;     // Writeback: the device puts its wptr here
+static uint32_t ih_rptr;        // How far we got
+static struct ih_source *ih_clients[AMDGPU_IH_MAX_CLIENTS]; // [src_id] each
+static struct amdgpu_ih_stats ih_stats;
+static int ih_wake = AMDGPU_IH_WAKE_NONE;
+static int ih_wake_fd = -1;     // The device's (VFIO eventfd / UIO)
+static int ih_kick[2] = {-1, -1}; // Ours: sim IVs and shutdown wake the worker
+static pthread_t ih_thread;
+static bool ih_threaded = false, ih_stopping = false;
+static pthread_t ih_dispatcher; // Thread running handlers right now
+static bool ih_dispatching = false;
+static pthread_mutex_t ih_lock = PTHREAD_MUTEX_INITIALIZER;   // Ring + table
+static pthread_mutex_t ih_process_lock = PTHREAD_MUTEX_INITIALIZER; // One consumer
+
+static int ih_kick_open(void) {
+#ifdef __linux__
+  ih_kick[0] = ih_kick[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  return ih_kick[0] >= 0 ? 0 : -1;
+#else
+  if (pipe(ih_kick) != 0)
+    return -1;
+  fcntl(ih_kick[0], F_SETFL, O_NONBLOCK);
+  fcntl(ih_kick[1], F_SETFL, O_NONBLOCK);
+  return 0;
+#endif
+}
+
+static void ih_kick_close(void) {
+  if (ih_kick[1] >= 0 && ih_kick[1] != ih_kick[0])
+    close(ih_kick[1]);
+  if (ih_kick[0] >= 0)
+    close(ih_kick[0]);
+  ih_kick[0] = ih_kick[1] = -1;
+}
+
+static void ih_kick_worker(void) {
+  uint64_t one = 1;
+  if (ih_kick[1] >= 0 && write(ih_kick[1], &one, 8) < 0 && errno != EAGAIN)
+    os_prim_log("HAL IH: Kick failed (errno: %d)\n", errno);
+}
+
+static void ih_kick_drain(void) {
+  uint64_t buf[8];
+  while (read(ih_kick[0], buf, sizeof(buf)) > 0)
+    ;
+}
+
+// The device's interrupt fired: consume it so the next one wakes us again
+static void ih_wake_ack(void) {
+  if (ih_wake == AMDGPU_IH_WAKE_EVENTFD) {
+    uint64_t count;
+    if (read(ih_wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+      os_prim_log("HAL IH: eventfd read failed (errno: %d)\n", errno);
+  } else if (ih_wake == AMDGPU_IH_WAKE_UIO) {
+    uint32_t count, enable = 1;
+    if (read(ih_wake_fd, &count, sizeof(count)) < 0 ||
+        write(ih_wake_fd, &enable, sizeof(enable)) < 0)
+      os_prim_log("HAL IH: UIO re-arm failed (errno: %d)\n", errno);
+  }
+}
+
+static void ih_decode(uint32_t rptr, struct amdgpu_iv_entry *iv) {
+  const uint32_t *dw = &ih_ring[rptr >> 2];
+  iv->client_id = dw[0] & 0xff;
+  iv->src_id = (dw[0] >> 8) & 0xff;
+  iv->ring_id = (dw[0] >> 16) & 0xff;
+  iv->vmid = (dw[0] >> 24) & 0xf;
+  iv->vmid_src = dw[0] >> 31;
+  iv->timestamp = dw[1] | ((uint64_t)(dw[2] & 0xffff) << 32);
+  iv->timestamp_src = dw[2] >> 31;
+  iv->pasid = dw[3] & 0xffff;
+  iv->node_id = (dw[3] >> 16) & 0xff;
+  memcpy(iv->src_data, &dw[4], sizeof(iv->src_data));
+}
+
+static void ih_encode(uint32_t wptr, const struct amdgpu_iv_entry *iv) {
+  uint32_t *dw = &ih_ring[wptr >> 2];
+  dw[0] = (iv->client_id & 0xff) | (iv->src_id & 0xff) << 8 |
+          (iv->ring_id & 0xff) << 16 | (iv->vmid & 0xf) << 24 |
+          (iv->vmid_src & 1) << 31;
+  dw[1] = (uint32_t)iv->timestamp;
+  dw[2] = (uint32_t)(iv->timestamp >> 32) & 0xffff;
+  dw[2] |= (iv->timestamp_src & 1) << 31;
+  dw[3] = (iv->pasid & 0xffff) | (iv->node_id & 0xff) << 16;
+  memcpy(&dw[4], iv->src_data, sizeof(iv->src_data));
+}
+
+static void *ih_main(void *arg) {
+  (void)arg;
+  struct pollfd pfd[2] = {{ih_kick[0], POLLIN, 0}, {ih_wake_fd, POLLIN, 0}};
+  nfds_t nfds = ih_wake_fd >= 0 ? 2 : 1;
+  for (;;) {
+    if (poll(pfd, nfds, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      os_prim_log("HAL IH: poll failed (errno: %d), worker stops\n", errno);
+      break;
+    }
+    if (pfd[0].revents & POLLIN)
+      ih_kick_drain();
+    if (nfds > 1 && (pfd[1].revents & POLLIN))
+      ih_wake_ack();
+    pthread_mutex_lock(&ih_lock);
+    bool stop = ih_stopping;
+    ih_stats.wakeups++;
+    pthread_mutex_unlock(&ih_lock);
+    if (stop)
+      break;
+    amdgpu_ih_process();
+  }
+  return NULL;
+}
+
+// Ring of ring_bytes (0 = default, rounded up to a power of two) and a way
+// to be woken up. fd is the device's for AMDGPU_IH_WAKE_EVENTFD / _UIO.
+int amdgpu_ih_init(uint32_t ring_bytes, int wake, int fd) {
+  if (!ring_bytes)
+    ring_bytes = IH_DEFAULT_RING;
+  if (ring_bytes > IH_MAX_RING || wake < AMDGPU_IH_WAKE_NONE ||
+      wake > AMDGPU_IH_WAKE_UIO ||
+      ((wake == AMDGPU_IH_WAKE_EVENTFD || wake == AMDGPU_IH_WAKE_UIO) && fd < 0))
+    return -1;
+  uint32_t size = IH_MIN_RING;
+  while (size < ring_bytes)
+    size <<= 1;
+
+  pthread_mutex_lock(&ih_lock);
+  if (ih_ring) {
+    pthread_mutex_unlock(&ih_lock);
+    return -1; // One IH ring
+  }
+  ih_ring = os_prim_alloc(size);
+  if (!ih_ring) {
+    pthread_mutex_unlock(&ih_lock);
+    return -1;
+  }
+  memset(ih_ring, 0, size);
+  memset(&ih_stats, 0, sizeof(ih_stats));
+  ih_ptr_mask = size - 1;
+  ih_rptr = 0;
+  __atomic_store_n(&ih_wptr_wb, 0, __ATOMIC_RELEASE);
+  ih_wake = wake;
+  ih_wake_fd = wake == AMDGPU_IH_WAKE_SIM || wake == AMDGPU_IH_WAKE_NONE ? -1
+                                                                       : fd;
+  ih_stopping = false;
+  ih_threaded = false;
+  if (wake != AMDGPU_IH_WAKE_NONE) {
+    if (ih_kick_open() != 0 ||
+        pthread_create(&ih_thread, NULL, ih_main, NULL) != 0) {
+      ih_kick_close();
+      os_prim_free(ih_ring);
+      ih_ring = NULL;
+      pthread_mutex_unlock(&ih_lock);
+      return -1;
+    }
+    ih_threaded = true;
+  }
+  pthread_mutex_unlock(&ih_lock);
+  os_prim_log("HAL IH: %u byte ring (%u IVs) is up\n", size,
+              size / IH_IV_BYTES);
+  return 0;
+}
+
+bool amdgpu_ih_active(void) {
+  pthread_mutex_lock(&ih_lock);
+  bool up = ih_ring != NULL;
+  pthread_mutex_unlock(&ih_lock);
+  return up;
+}
+
+// Stop the worker, drop whatever is left on the ring and every handler
+void amdgpu_ih_fini(void) {
+  pthread_mutex_lock(&ih_lock);
+  if (!ih_ring) {
+    pthread_mutex_unlock(&ih_lock);
+    return;
+  }
+  bool threaded = ih_threaded;
+  ih_stopping = true;
+  ih_kick_worker();
+  pthread_mutex_unlock(&ih_lock);
+  if (threaded)
+    pthread_join(ih_thread, NULL);
+
+  pthread_mutex_lock(&ih_process_lock); // Nobody is dispatching after this
+  pthread_mutex_lock(&ih_lock);
+  ih_kick_close();
+  os_prim_free(ih_ring);
+  ih_ring = NULL;
+  ih_threaded = false;
+  ih_wake_fd = -1;
+  for (uint32_t c = 0; c < AMDGPU_IH_MAX_CLIENTS; c++) {
+    os_prim_free(ih_clients[c]);
+    ih_clients[c] = NULL;
+  }
+  pthread_mutex_unlock(&ih_lock);
+  pthread_mutex_unlock(&ih_process_lock);
+}
+
+int amdgpu_ih_register(uint32_t client, uint32_t src_id, amdgpu_ih_handler fn,
+                       void *priv) {
+  if (client >= AMDGPU_IH_MAX_CLIENTS || src_id >= AMDGPU_IH_MAX_SOURCES || !fn)
+    return -1;
+  pthread_mutex_lock(&ih_lock);
+  if (!ih_clients[client]) {
+    size_t bytes = AMDGPU_IH_MAX_SOURCES * sizeof(struct ih_source);
+    ih_clients[client] = os_prim_alloc(bytes);
+    if (ih_clients[client])
+      memset(ih_clients[client], 0, bytes);
+  }
+  struct ih_source *s = ih_clients[client] ? &ih_clients[client][src_id] : NULL;
+  int ret = s && !s->fn ? 0 : -1; // One handler per source
+  if (ret == 0) {
+    s->fn = fn;
+    s->priv = priv;
+  }
+  pthread_mutex_unlock(&ih_lock);
+  return ret;
+}
+
+// Once this returns the handler isn't running anywhere (unless it's the
+// caller: handlers may unregister themselves)
+void amdgpu_ih_unregister(uint32_t client, uint32_t src_id) {
+  if (client >= AMDGPU_IH_MAX_CLIENTS || src_id >= AMDGPU_IH_MAX_SOURCES)
+    return;
+  pthread_mutex_lock(&ih_lock);
+  if (ih_clients[client])
+    ih_clients[client][src_id].fn = NULL;
+  bool self = ih_dispatching && pthread_equal(ih_dispatcher, pthread_self());
+  pthread_mutex_unlock(&ih_lock);
+  if (!self) {
+    pthread_mutex_lock(&ih_process_lock); // Wait out the batch in flight
+    pthread_mutex_unlock(&ih_process_lock);
+  }
+}
+
+// Everything on the ring, to its handlers. Returns how many IVs that was.
+uint32_t amdgpu_ih_process(void) {
+  uint32_t total = 0;
+  pthread_mutex_lock(&ih_process_lock);
+  for (;;) {
+    struct amdgpu_iv_entry iv[IH_BATCH];
+    struct ih_source src[IH_BATCH];
+    uint32_t n = 0;
+
+    pthread_mutex_lock(&ih_lock);
+    if (!ih_ring) {
+      pthread_mutex_unlock(&ih_lock);
+      break;
+    }
+    // Anything the device wrote after this shows up on the next pass
+    uint32_t wptr = __atomic_load_n(&ih_wptr_wb, __ATOMIC_ACQUIRE) & ih_ptr_mask;
+    uint32_t rptr = ih_rptr;
+    for (; rptr != wptr && n < IH_BATCH; n++) {
+      ih_decode(rptr, &iv[n]);
+      const struct ih_source *table = iv[n].client_id < AMDGPU_IH_MAX_CLIENTS
+                                          ? ih_clients[iv[n].client_id]
+                                          : NULL;
+      src[n] = table ? table[iv[n].src_id] : (struct ih_source){NULL, NULL};
+      if (!src[n].fn)
+        ih_stats.unhandled++;
+      rptr = (rptr + IH_IV_BYTES) & ih_ptr_mask;
+    }
+    __atomic_store_n(&ih_rptr, rptr, __ATOMIC_RELEASE); // Space is the device's again
+    if (n) {
+      ih_stats.entries += n;
+      ih_stats.batches++;
+      ih_dispatcher = pthread_self();
+      ih_dispatching = true;
+    }
+    pthread_mutex_unlock(&ih_lock);
+    if (!n)
+      break;
+
+    for (uint32_t i = 0; i < n; i++)
+      if (src[i].fn)
+        src[i].fn(src[i].priv, &iv[i]);
+    total += n;
+    pthread_mutex_lock(&ih_lock);
+    ih_dispatching = false;
+    pthread_mutex_unlock(&ih_lock);
+  }
+  pthread_mutex_unlock(&ih_process_lock);
+  return total;
+}
+
+// The simulated device's end: write one IV at wptr and interrupt. A full
+// ring loses the IV, like the hardware's RB_OVERFLOW.
+int amdgpu_ih_sim_raise(const struct amdgpu_iv_entry *iv) {
+  if (!iv)
+    return -1;
+  pthread_mutex_lock(&ih_lock);
+  if (!ih_ring) {
+    pthread_mutex_unlock(&ih_lock);
+    return -1;
+  }
+  uint32_t wptr = ih_wptr_wb & ih_ptr_mask;
+  uint32_t next = (wptr + IH_IV_BYTES) & ih_ptr_mask;
+  if (next == __atomic_load_n(&ih_rptr, __ATOMIC_ACQUIRE)) {
+    ih_stats.overflows++;
+    pthread_mutex_unlock(&ih_lock);
+    return -1;
+  }
+  ih_encode(wptr, iv);
+  __atomic_store_n(&ih_wptr_wb, next, __ATOMIC_RELEASE);
+  if (ih_threaded)
+    ih_kick_worker();
+  pthread_mutex_unlock(&ih_lock);
+  return 0;
+}
+
+// For a backend programming IH_RB_BASE / IH_RB_WPTR_ADDR: the ring, its
+// size and where the device writes back its wptr
+int amdgpu_ih_get_ring(uint32_t **ring, uint32_t *bytes, uint32_t **wptr) {
+  pthread_mutex_lock(&ih_lock);
+  int ret = ih_ring ? 0 : -1;
+  if (ih_ring) {
+    if (ring)
+      *ring = ih_ring;
+    if (bytes)
+      *bytes = ih_ptr_mask + 1;
+    if (wptr)
+      *wptr = &ih_wptr_wb;
+  }
+  pthread_mutex_unlock(&ih_lock);
+  return ret;
+}
+
+void amdgpu_ih_get_stats(struct amdgpu_ih_stats *out) {
+  if (!out)
+    return;
+  pthread_mutex_lock(&ih_lock);
+  *out = ih_stats;
+  pthread_mutex_unlock(&ih_lock);
+}
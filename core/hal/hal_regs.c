@@ -0,0 +1,352 @@
+#include "hal.h"
+#include "../../os/os_interface.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+
+/*
+ * Yo! This is register access without the one big lock.
+ * Every read used to take mmio_lock for reading and every write for
+ * writing. With a few server threads polling status registers, that one
+ * rwlock's cache line bounced between every core, and a GFX write held up
+ * display programming even though the two never touch the same register.
+ *
+ * Now:
+ *   - Reads are a plain volatile load. An aligned 32-bit MMIO read can't
+ *     tear, so the lock never protected anything there. The exception is
+ *     the index/data pairs (MM_INDEX/MM_DATA, PCIE_INDEX2/DATA2): reading
+ *     DATA means nobody may move INDEX in between, so those take the lock,
+ *     and amdgpu_read/write_reg_indexed hold it across INDEX and DATA.
+ *   - Writes and read-modify-writes take a spinlock for the register's
+ *     domain (GFX, display, VM, IH, SMU, multimedia, misc). Critical
+ *     sections are one or two MMIO accesses, too short to sleep on.
+ *   - Status registers (the hardware writes them, we only look) are never
+ *     put in the shadow: putting back an old GRBM_STATUS after a reset
+ *     means nothing.
+ *
+ * Domains come from where each IP's register segments start, from the
+ * discovery table when there is one and Navi10's layout otherwise. The
+ * annotated registers are listed per IP segment for the same reason. Each
+ * domain counts acquisitions and how often (and how long) it had to spin.
+ *
+ * The shadow itself is still one sorted array under mmio_lock; only its
+ * bookkeeping is in there, not the MMIO access.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+// Which domain each IP's registers are in
+static const uint8_t hal_reg_hwip_domain[AMDGPU_HWIP_MAX] = {
+    [AMDGPU_HWIP_GC] = AMDGPU_REG_DOMAIN_GFX,
+    [AMDGPU_HWIP_SDMA0] = AMDGPU_REG_DOMAIN_GFX,
+    [AMDGPU_HWIP_SDMA1] = AMDGPU_REG_DOMAIN_GFX,
+    [AMDGPU_HWIP_SDMA2] = AMDGPU_REG_DOMAIN_GFX,
+    [AMDGPU_HWIP_SDMA3] = AMDGPU_REG_DOMAIN_GFX,
+    [AMDGPU_HWIP_DCE] = AMDGPU_REG_DOMAIN_DISPLAY,
+    [AMDGPU_HWIP_MMHUB] = AMDGPU_REG_DOMAIN_VM,
+    [AMDGPU_HWIP_ATHUB] = AMDGPU_REG_DOMAIN_VM,
+    [AMDGPU_HWIP_OSSSYS] = AMDGPU_REG_DOMAIN_IH,
+    [AMDGPU_HWIP_MP0] = AMDGPU_REG_DOMAIN_SMU,
+    [AMDGPU_HWIP_MP1] = AMDGPU_REG_DOMAIN_SMU,
+    [AMDGPU_HWIP_SMUIO] = AMDGPU_REG_DOMAIN_SMU,
+    [AMDGPU_HWIP_THM] = AMDGPU_REG_DOMAIN_SMU,
+    [AMDGPU_HWIP_PWR] = AMDGPU_REG_DOMAIN_SMU,
+    [AMDGPU_HWIP_CLK] = AMDGPU_REG_DOMAIN_SMU,
+    [AMDGPU_HWIP_VCN] = AMDGPU_REG_DOMAIN_MM,
+    [AMDGPU_HWIP_VCE] = AMDGPU_REG_DOMAIN_MM,
+    // The rest are 0: AMDGPU_REG_DOMAIN_MISC
+};
+
+static const char *const hal_reg_domain_names[AMDGPU_REG_DOMAIN_COUNT] = {
+    "misc", "gfx", "display", "vm", "ih", "smu", "mm",
+};
+
+// Segment bases (dwords) from navi10_ip_offset.h, for chips without a table
+static const uint32_t hal_reg_navi10_base[AMDGPU_HWIP_MAX][AMDGPU_DISCOVERY_MAX_BASE] = {
+    [AMDGPU_HWIP_GC] = {0x1260, 0xA000},
+    [AMDGPU_HWIP_HDP] = {0x0F20},
+    [AMDGPU_HWIP_MMHUB] = {0x1A000},
+    [AMDGPU_HWIP_ATHUB] = {0x0C00},
+    [AMDGPU_HWIP_NBIO] = {0x0000, 0x0014, 0x0D20, 0x10400},
+    [AMDGPU_HWIP_MP0] = {0x16000},
+    [AMDGPU_HWIP_MP1] = {0x16000},
+    [AMDGPU_HWIP_VCN] = {0x7800, 0x7E00},
+    [AMDGPU_HWIP_DF] = {0x7000},
+    [AMDGPU_HWIP_DCE] = {0x0012, 0x00C0, 0x34C0, 0x9000},
+    [AMDGPU_HWIP_OSSSYS] = {0x10A0},
+    [AMDGPU_HWIP_SMUIO] = {0x16800, 0x16A00},
+    [AMDGPU_HWIP_THM] = {0x16600},
+    [AMDGPU_HWIP_CLK] = {0x16C00, 0x16E00, 0x17000, 0x17200, 0x17E00, 0x1B000},
+    [AMDGPU_HWIP_UMC] = {0x14000},
+};
+
+// The registers that aren't plain control registers, as IP + segment +
+// offset (the asic_reg headers' mmFOO / mmFOO_BASE_IDX)
+static const struct hal_reg_annotation {
+  enum amdgpu_hwip hwip;
+  uint8_t seg;
+  uint32_t reg;
+  uint8_t cls;
+} hal_reg_annotations[] = {
+    {AMDGPU_HWIP_GC, 0, 0x0da2, AMDGPU_REG_STATUS},   // GRBM_STATUS2
+    {AMDGPU_HWIP_GC, 0, 0x0da4, AMDGPU_REG_STATUS},   // GRBM_STATUS
+    {AMDGPU_HWIP_GC, 0, 0x0f40, AMDGPU_REG_STATUS},   // CP_STAT
+    {AMDGPU_HWIP_GC, 0, 0x0f60, AMDGPU_REG_STATUS},   // CP_RB0_RPTR
+    {AMDGPU_HWIP_GC, 0, 0x0025, AMDGPU_REG_STATUS},   // SDMA0_STATUS_REG
+    {AMDGPU_HWIP_GC, 0, 0x0625, AMDGPU_REG_STATUS},   // SDMA1_STATUS_REG
+    {AMDGPU_HWIP_GC, 1, 0x4c04, AMDGPU_REG_STATUS},   // RLC_STAT
+    {AMDGPU_HWIP_OSSSYS, 0, 0x0084, AMDGPU_REG_STATUS}, // IH_RB_WPTR
+    {AMDGPU_HWIP_DCE, 2, 0x1b49, AMDGPU_REG_STATUS},  // OTG0_OTG_STATUS
+    {AMDGPU_HWIP_DCE, 2, 0x1b4a, AMDGPU_REG_STATUS},  // OTG0_OTG_STATUS_POSITION
+    {AMDGPU_HWIP_DCE, 2, 0x1b4c, AMDGPU_REG_STATUS},  // OTG0_OTG_STATUS_FRAME_COUNT
+    {AMDGPU_HWIP_NBIO, 0, 0x0000, AMDGPU_REG_INDEXED}, // MM_INDEX
+    {AMDGPU_HWIP_NBIO, 0, 0x0001, AMDGPU_REG_INDEXED}, // MM_DATA
+    {AMDGPU_HWIP_NBIO, 0, 0x0006, AMDGPU_REG_INDEXED}, // MM_INDEX_HI
+    {AMDGPU_HWIP_NBIO, 0, 0x000e, AMDGPU_REG_INDEXED}, // PCIE_INDEX2
+    {AMDGPU_HWIP_NBIO, 0, 0x000f, AMDGPU_REG_INDEXED}, // PCIE_DATA2
+};
+
+// A segment base: from the table, or Navi10's. 0 = none (NBIO's first
+// segment really is at 0, hence the flag).
+static bool hal_reg_base(const struct OBJGPU *adev, enum amdgpu_hwip hwip,
+                         uint32_t seg, uint32_t *base) {
+  if (adev->discovery) {
+    const struct amdgpu_ip_info *ip = amdgpu_discovery_ip(adev, hwip, 0);
+    if (!ip || seg >= ip->num_base)
+      return false;
+    *base = ip->base[seg];
+    return true;
+  }
+  *base = hal_reg_navi10_base[hwip][seg];
+  return *base != 0 || (hwip == AMDGPU_HWIP_NBIO && seg == 0);
+}
+
+static int hal_reg_range_cmp(const void *a, const void *b) {
+  const struct amdgpu_reg_range *x = a, *y = b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int hal_reg_note_cmp(const void *a, const void *b) {
+  const struct amdgpu_reg_note *x = a, *y = b;
+  return x->reg < y->reg ? -1 : x->reg > y->reg;
+}
+
+// Build the domain ranges and the annotated registers for adev. Run after
+// discovery, before anything programs registers.
+void amdgpu_regs_init(struct OBJGPU *adev) {
+  if (!adev)
+    return;
+  struct amdgpu_reg_map *map = &adev->reg_map;
+  memset(map, 0, sizeof(*map));
+  memset(adev->reg_locks, 0, sizeof(adev->reg_locks));
+
+  for (int hwip = 0; hwip < AMDGPU_HWIP_MAX; hwip++) {
+    for (uint32_t seg = 0; seg < AMDGPU_DISCOVERY_MAX_BASE; seg++) {
+      uint32_t base;
+      if (!hal_reg_base(adev, (enum amdgpu_hwip)hwip, seg, &base))
+        continue;
+      // IPs sharing a base (SDMA0 sits at GC's on Navi): the first one
+      // listed keeps it
+      bool dup = false;
+      for (uint32_t i = 0; i < map->num_ranges && !dup; i++)
+        dup = map->ranges[i].start == base;
+      if (dup || map->num_ranges == AMDGPU_REG_MAX_RANGES)
+        continue;
+      map->ranges[map->num_ranges].start = base;
+      map->ranges[map->num_ranges].domain = hal_reg_hwip_domain[hwip];
+      map->num_ranges++;
+    }
+  }
+  qsort(map->ranges, map->num_ranges, sizeof(map->ranges[0]), hal_reg_range_cmp);
+
+  for (size_t i = 0; i < sizeof(hal_reg_annotations) / sizeof(hal_reg_annotations[0]); i++) {
+    const struct hal_reg_annotation *a = &hal_reg_annotations[i];
+    uint32_t base;
+    if (map->num_notes == AMDGPU_REG_MAX_NOTES || !hal_reg_base(adev, a->hwip, a->seg, &base))
+      continue;
+    map->notes[map->num_notes].reg = base + a->reg;
+    map->notes[map->num_notes].cls = a->cls;
+    map->num_notes++;
+  }
+  qsort(map->notes, map->num_notes, sizeof(map->notes[0]), hal_reg_note_cmp);
+
+  os_prim_log("HAL Regs: %u register ranges in %d lock domains, %u annotated registers\n",
+              map->num_ranges, AMDGPU_REG_DOMAIN_COUNT, map->num_notes);
+}
+
+// offset in bytes, like the rest of the locked API
+enum amdgpu_reg_domain amdgpu_reg_domain(const struct OBJGPU *adev, uint32_t offset) {
+  const struct amdgpu_reg_map *map = &adev->reg_map;
+  uint32_t reg = offset / 4, lo = 0, hi = map->num_ranges;
+  while (lo < hi) { // Last range starting at or before reg
+    uint32_t mid = (lo + hi) / 2;
+    if (map->ranges[mid].start <= reg)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo ? (enum amdgpu_reg_domain)map->ranges[lo - 1].domain : AMDGPU_REG_DOMAIN_MISC;
+}
+
+enum amdgpu_reg_class amdgpu_reg_class(const struct OBJGPU *adev, uint32_t offset) {
+  const struct amdgpu_reg_map *map = &adev->reg_map;
+  uint32_t reg = offset / 4, lo = 0, hi = map->num_notes;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (map->notes[mid].reg < reg)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < map->num_notes && map->notes[lo].reg == reg
+             ? (enum amdgpu_reg_class)map->notes[lo].cls
+             : AMDGPU_REG_CONTROL;
+}
+
+// --- Domain locks ---
+
+static inline void hal_reg_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static void hal_reg_lock(struct amdgpu_reg_lock *l) {
+  uint64_t spins = 0;
+  while (__atomic_exchange_n(&l->held, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&l->held, __ATOMIC_RELAXED)) {
+      hal_reg_cpu_relax();
+      if ((++spins & 1023) == 0) // Holder got preempted: let it run
+        sched_yield();
+    }
+  }
+  l->stats.acquires++;
+  if (spins) {
+    l->stats.contended++;
+    l->stats.spins += spins;
+  }
+}
+
+static void hal_reg_unlock(struct amdgpu_reg_lock *l) {
+  __atomic_store_n(&l->held, 0, __ATOMIC_RELEASE);
+}
+
+static inline volatile uint32_t *hal_reg_ptr(struct OBJGPU *adev, uint32_t offset) {
+  return (volatile uint32_t *)((uintptr_t)adev->mmio_base + offset);
+}
+
+int amdgpu_read_reg_locked(struct OBJGPU *adev, uint32_t offset) {
+  if (!adev || !adev->mmio_base)
+    return 0;
+  if (amdgpu_reg_class(adev, offset) != AMDGPU_REG_INDEXED)
+    return (int)*hal_reg_ptr(adev, offset);
+
+  struct amdgpu_reg_lock *l = &adev->reg_locks[amdgpu_reg_domain(adev, offset)];
+  hal_reg_lock(l);
+  uint32_t value = *hal_reg_ptr(adev, offset);
+  hal_reg_unlock(l);
+  return (int)value;
+}
+
+void amdgpu_write_reg_locked(struct OBJGPU *adev, uint32_t offset, uint32_t value) {
+  if (!adev || !adev->mmio_base)
+    return;
+  enum amdgpu_reg_class cls = amdgpu_reg_class(adev, offset);
+  struct amdgpu_reg_lock *l = &adev->reg_locks[amdgpu_reg_domain(adev, offset)];
+  hal_reg_lock(l);
+  *hal_reg_ptr(adev, offset) = value;
+  // Shadow under the domain lock too, so two writers of one register
+  // can't leave the shadow holding the value that lost
+  if (cls != AMDGPU_REG_STATUS)
+    amdgpu_hal_shadow_write(adev, offset, value);
+  hal_reg_unlock(l);
+}
+
+// A register behind an index/data pair: INDEX and DATA under one hold of
+// the domain lock, so nobody points INDEX elsewhere in between. Not
+// shadowed: DATA means nothing without the INDEX it was written through.
+uint32_t amdgpu_read_reg_indexed(struct OBJGPU *adev, uint32_t index_offset,
+                                 uint32_t data_offset, uint32_t reg) {
+  if (!adev || !adev->mmio_base)
+    return 0;
+  struct amdgpu_reg_lock *l = &adev->reg_locks[amdgpu_reg_domain(adev, index_offset)];
+  hal_reg_lock(l);
+  *hal_reg_ptr(adev, index_offset) = reg;
+  (void)*hal_reg_ptr(adev, index_offset); // Posts the INDEX write
+  uint32_t value = *hal_reg_ptr(adev, data_offset);
+  hal_reg_unlock(l);
+  return value;
+}
+
+void amdgpu_write_reg_indexed(struct OBJGPU *adev, uint32_t index_offset,
+                              uint32_t data_offset, uint32_t reg,
+                              uint32_t value) {
+  if (!adev || !adev->mmio_base)
+    return;
+  struct amdgpu_reg_lock *l = &adev->reg_locks[amdgpu_reg_domain(adev, index_offset)];
+  hal_reg_lock(l);
+  *hal_reg_ptr(adev, index_offset) = reg;
+  (void)*hal_reg_ptr(adev, index_offset);
+  *hal_reg_ptr(adev, data_offset) = value;
+  (void)*hal_reg_ptr(adev, data_offset);
+  hal_reg_unlock(l);
+}
+
+// Every domain in mask, lowest first (the only order two holders may take
+// them in). For writers that cross domains, like a snapshot restore.
+void amdgpu_reg_lock_domains(struct OBJGPU *adev, uint32_t mask) {
+  for (int d = 0; adev && d < AMDGPU_REG_DOMAIN_COUNT; d++)
+    if (mask & (1u << d))
+      hal_reg_lock(&adev->reg_locks[d]);
+}
+
+void amdgpu_reg_unlock_domains(struct OBJGPU *adev, uint32_t mask) {
+  for (int d = AMDGPU_REG_DOMAIN_COUNT - 1; adev && d >= 0; d--)
+    if (mask & (1u << d))
+      hal_reg_unlock(&adev->reg_locks[d]);
+}
+
+// (old & ~clear) | set, as one step against other writers in the domain.
+// Returns the value written.
+uint32_t amdgpu_rmw_reg_locked(struct OBJGPU *adev, uint32_t offset,
+                               uint32_t clear, uint32_t set) {
+  if (!adev || !adev->mmio_base)
+    return 0;
+  enum amdgpu_reg_class cls = amdgpu_reg_class(adev, offset);
+  struct amdgpu_reg_lock *l = &adev->reg_locks[amdgpu_reg_domain(adev, offset)];
+  hal_reg_lock(l);
+  volatile uint32_t *reg = hal_reg_ptr(adev, offset);
+  uint32_t value = (*reg & ~clear) | set;
+  *reg = value;
+  if (cls != AMDGPU_REG_STATUS)
+    amdgpu_hal_shadow_write(adev, offset, value);
+  hal_reg_unlock(l);
+  return value;
+}
+
+// A snapshot; the counters may be mid-update, which is fine for stats
+int amdgpu_reg_get_stats(const struct OBJGPU *adev, enum amdgpu_reg_domain domain,
+                         struct amdgpu_reg_lock_stats *out) {
+  if (!adev || !out || (unsigned)domain >= AMDGPU_REG_DOMAIN_COUNT)
+    return -1;
+  const struct amdgpu_reg_lock_stats *s = &adev->reg_locks[domain].stats;
+  out->acquires = __atomic_load_n(&s->acquires, __ATOMIC_RELAXED);
+  out->contended = __atomic_load_n(&s->contended, __ATOMIC_RELAXED);
+  out->spins = __atomic_load_n(&s->spins, __ATOMIC_RELAXED);
+  return 0;
+}
+
+// Log the domains that ever had to wait, for the shutdown report
+void amdgpu_regs_log_stats(const struct OBJGPU *adev) {
+  for (int d = 0; adev && d < AMDGPU_REG_DOMAIN_COUNT; d++) {
+    struct amdgpu_reg_lock_stats st;
+    amdgpu_reg_get_stats(adev, (enum amdgpu_reg_domain)d, &st);
+    if (st.contended)
+      os_prim_log("HAL Regs: %s lock contended %llu of %llu times (%llu spins)\n",
+                  hal_reg_domain_names[d], (unsigned long long)st.contended,
+                  (unsigned long long)st.acquires, (unsigned long long)st.spins);
+  }
+}
@@ -0,0 +1,287 @@
+#include "hal.h"
+#include "../../os/os_interface.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the Residency Manager - the bouncer at the VRAM club.
+ * VRAM is small and everybody wants in. When it's full we don't turn new
+ * buffers away (that used to crash whole jobs), we kick out whoever has
+ * been sitting around the longest and send them to GTT (system memory).
+ * When a submission needs them again, they get back in.
+ *
+ * Rules of the door:
+ *   - Buffers still in use by an unfinished submission never get kicked out.
+ *   - Higher priority buffers get kicked out last.
+ *   - Among equals, the one used longest ago goes first (LRU).
+ *
+ * Like the kernel, a move never changes where anybody sees the buffer:
+ * clients have it mapped and queued jobs carry its address. The kernel
+ * swaps the pages under a stable VA; in simulation VRAM and GTT are the
+ * same host memory, so a move is bookkeeping only (plus a generation bump,
+ * so BO lists look at the buffer again). Every non-kernel buffer checks in
+ * here: amdgpu_buffer_alloc_hal ones and RMAPI's shareable (PRIME) ones.
+ * Whoever wants to hear about moves (RMAPI, to keep each client's per-heap
+ * tab honest) checks in with amdgpu_residency_track_cb.
+ * Real DRM does all of this in the kernel, so we stay out of the way there.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define RESIDENCY_HASH_SIZE 256
+#define RESIDENCY_DEFAULT_BUDGET_MB 1024 // Same as what rmapi_get_gpu_info reports
+
+struct residency_node {
+  struct amdgpu_buffer *buf;
+  uint32_t domain;      // AMDGPU_DOMAIN_VRAM or AMDGPU_DOMAIN_GTT
+  int priority;         // Higher = stays in VRAM longer
+  uint64_t last_fence;  // Last submission that used it
+  uint64_t validate_gen; // Needed by the submission being validated right now
+  void (*moved)(void *priv, uint32_t domain); // Told where it lands, every time
+  void *moved_priv;
+  struct residency_node *hash_next;
+  struct residency_node *prev, *next; // LRU list: head is the coldest
+};
+
+static pthread_mutex_t residency_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct residency_node *residency_hash[RESIDENCY_HASH_SIZE];
+static struct residency_node *lru_head = NULL, *lru_tail = NULL;
+static uint64_t fence_emitted = 0, fence_done = 0, validate_gen = 0;
+static struct amdgpu_residency_stats stats;
+static int budget_set = 0;
+
+static unsigned residency_hash_of(struct amdgpu_buffer *buf) {
+  return (unsigned)(((uintptr_t)buf >> 4) % RESIDENCY_HASH_SIZE);
+}
+
+static struct residency_node *residency_find(struct amdgpu_buffer *buf) {
+  struct residency_node *n = residency_hash[residency_hash_of(buf)];
+  while (n && n->buf != buf)
+    n = n->hash_next;
+  return n;
+}
+
+static void lru_unlink(struct residency_node *n) {
+  if (n->prev)
+    n->prev->next = n->next;
+  else
+    lru_head = n->next;
+  if (n->next)
+    n->next->prev = n->prev;
+  else
+    lru_tail = n->prev;
+  n->prev = n->next = NULL;
+}
+
+static void lru_append(struct residency_node *n) {
+  n->prev = lru_tail;
+  n->next = NULL;
+  if (lru_tail)
+    lru_tail->next = n;
+  else
+    lru_head = n;
+  lru_tail = n;
+}
+
+static void residency_budget_init(void) {
+  if (budget_set)
+    return;
+  uint64_t mb = RESIDENCY_DEFAULT_BUDGET_MB;
+  const char *env = getenv("AMDGPU_VRAM_BUDGET_MB");
+  if (env && atoi(env) > 0)
+    mb = (uint64_t)atoi(env);
+  stats.vram_budget = mb << 20;
+  budget_set = 1;
+}
+
+// VRAM/GTT usage counters for a trace. residency_lock held.
+static void residency_trace_usage(void) {
+  os_trace_counter(OS_TRACE_HAL, "vram_used", stats.vram_used);
+  os_trace_counter(OS_TRACE_HAL, "gtt_used", stats.gtt_used);
+}
+
+// Send a buffer to the other side of the door. cpu_addr and gpu_addr stay.
+static int residency_move(struct residency_node *n, uint32_t domain) {
+  struct amdgpu_buffer *buf = n->buf;
+  buf->generation++; // BO lists re-apply their priority to it
+
+  if (domain == AMDGPU_DOMAIN_GTT) {
+    stats.vram_used -= buf->size;
+    stats.gtt_used += buf->size;
+    stats.evictions++;
+    stats.bytes_evicted += buf->size;
+  } else {
+    stats.gtt_used -= buf->size;
+    stats.vram_used += buf->size;
+    stats.restores++;
+    stats.bytes_restored += buf->size;
+  }
+  n->domain = domain;
+  if (n->moved)
+    n->moved(n->moved_priv, domain);
+  residency_trace_usage();
+  return 0;
+}
+
+// Kick out cold buffers until "size" more bytes fit in VRAM
+static int residency_make_room(uint64_t size) {
+  while (stats.vram_used + size > stats.vram_budget) {
+    struct residency_node *victim = NULL;
+    for (struct residency_node *n = lru_head; n; n = n->next) {
+      if (n->domain != AMDGPU_DOMAIN_VRAM || n->last_fence > fence_done ||
+          n->validate_gen == validate_gen)
+        continue; // Busy, or the current submission needs it
+      if (!victim || n->priority < victim->priority)
+        victim = n; // LRU order already breaks ties
+    }
+    if (!victim || residency_move(victim, AMDGPU_DOMAIN_GTT) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+// A new buffer shows up at the door. Returns where it ended up.
+// moved(priv, domain) hears about that and every later move, with the
+// residency lock held: it may take its own locks, but must not call back in.
+uint32_t amdgpu_residency_track_cb(struct OBJGPU *adev, struct amdgpu_buffer *buf,
+                                   void (*moved)(void *priv, uint32_t domain),
+                                   void *priv) {
+  (void)adev;
+  if (!buf || !buf->cpu_addr)
+    return 0;
+
+  struct residency_node *n = os_prim_alloc(sizeof(*n));
+  if (!n)
+    return 0;
+  memset(n, 0, sizeof(*n));
+  n->buf = buf;
+  n->moved = moved;
+  n->moved_priv = priv;
+
+  pthread_mutex_lock(&residency_lock);
+  residency_budget_init();
+  validate_gen++; // Nobody is protected while we place a new buffer
+  if (amdgpu_hal_get_mode() == AMDGPU_HAL_MODE_SIM &&
+      residency_make_room(buf->size) == 0) {
+    n->domain = AMDGPU_DOMAIN_VRAM;
+    stats.vram_used += buf->size;
+  } else {
+    // VRAM is full of busy buffers (or the MMIO aperture ran out): slower, not dead
+    n->domain = AMDGPU_DOMAIN_GTT;
+    stats.gtt_used += buf->size;
+  }
+  unsigned h = residency_hash_of(buf);
+  n->hash_next = residency_hash[h];
+  residency_hash[h] = n;
+  lru_append(n);
+  if (moved)
+    moved(priv, n->domain);
+  residency_trace_usage();
+  pthread_mutex_unlock(&residency_lock);
+
+  return n->domain;
+}
+
+uint32_t amdgpu_residency_track(struct OBJGPU *adev, struct amdgpu_buffer *buf) {
+  return amdgpu_residency_track_cb(adev, buf, NULL, NULL);
+}
+
+void amdgpu_residency_untrack(struct OBJGPU *adev, struct amdgpu_buffer *buf) {
+  (void)adev;
+  pthread_mutex_lock(&residency_lock);
+  struct residency_node **pp = &residency_hash[residency_hash_of(buf)];
+  while (*pp && (*pp)->buf != buf)
+    pp = &(*pp)->hash_next;
+  struct residency_node *n = *pp;
+  if (n) {
+    *pp = n->hash_next;
+    lru_unlink(n);
+    if (n->domain == AMDGPU_DOMAIN_VRAM)
+      stats.vram_used -= buf->size;
+    else
+      stats.gtt_used -= buf->size;
+    residency_trace_usage();
+  }
+  pthread_mutex_unlock(&residency_lock);
+  if (n)
+    os_prim_free(n);
+}
+
+void amdgpu_residency_set_priority(struct amdgpu_buffer *buf, int priority) {
+  pthread_mutex_lock(&residency_lock);
+  struct residency_node *n = residency_find(buf);
+  if (n)
+    n->priority = priority;
+  pthread_mutex_unlock(&residency_lock);
+}
+
+// A submission is about to use these buffers: bring them back in, mark them
+// hot and busy. Returns the fence to signal once the submission is done.
+uint64_t amdgpu_residency_validate(struct OBJGPU *adev,
+                                   struct amdgpu_buffer **bo_list,
+                                   uint32_t bo_count) {
+  (void)adev;
+  os_trace_scope(OS_TRACE_HAL, "amdgpu_residency_validate");
+  pthread_mutex_lock(&residency_lock);
+  residency_budget_init();
+  uint64_t fence = ++fence_emitted;
+  validate_gen++;
+
+  // Protect the whole list first, so restoring one never evicts another
+  for (uint32_t i = 0; i < bo_count; i++) {
+    struct residency_node *n = bo_list[i] ? residency_find(bo_list[i]) : NULL;
+    if (n)
+      n->validate_gen = validate_gen;
+  }
+
+  for (uint32_t i = 0; i < bo_count; i++) {
+    struct residency_node *n = bo_list[i] ? residency_find(bo_list[i]) : NULL;
+    if (!n)
+      continue; // Not ours (userptr, shared, kernel BO...)
+    if (n->domain == AMDGPU_DOMAIN_GTT &&
+        amdgpu_hal_get_mode() == AMDGPU_HAL_MODE_SIM &&
+        residency_make_room(n->buf->size) == 0) {
+      if (residency_move(n, AMDGPU_DOMAIN_VRAM) != 0)
+        os_prim_log("HAL: ⚠️  Couldn't restore buffer to VRAM, GPU reads it from GTT\n");
+    }
+    n->last_fence = fence;
+    lru_unlink(n);
+    lru_append(n);
+  }
+  pthread_mutex_unlock(&residency_lock);
+  return fence;
+}
+
+// Submission finished: its buffers may be evicted again
+void amdgpu_residency_fence_signal(struct OBJGPU *adev, uint64_t fence) {
+  (void)adev;
+  pthread_mutex_lock(&residency_lock);
+  if (fence > fence_done)
+    fence_done = fence;
+  pthread_mutex_unlock(&residency_lock);
+}
+
+void amdgpu_residency_set_budget(struct OBJGPU *adev, uint64_t bytes) {
+  (void)adev;
+  pthread_mutex_lock(&residency_lock);
+  stats.vram_budget = bytes;
+  budget_set = 1;
+  validate_gen++;
+  residency_make_room(0); // Shrinking? Kick out what no longer fits.
+  pthread_mutex_unlock(&residency_lock);
+}
+
+void amdgpu_residency_get_stats(struct OBJGPU *adev,
+                                struct amdgpu_residency_stats *out) {
+  (void)adev;
+  pthread_mutex_lock(&residency_lock);
+  residency_budget_init();
+  *out = stats;
+  pthread_mutex_unlock(&residency_lock);
+}
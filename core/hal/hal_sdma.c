@@ -0,0 +1,609 @@
+#include "hal.h"
+#include "../../os/os_interface.h"
+#include "../../src/amd/amdgpu/navi10_sdma_pkt_open.h"
+#include "../../src/amd/include/ivsrcid/sdma0/irqsrcs_sdma0_5_0.h"
+#include "../../src/amd/include/soc15_ih_clientid.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+#define os_prim_alloc_ex os_get_interface()->alloc_ex
+
+/*
+ * Yo! This is the Simulated SDMA - the copy engine when there's no GPU.
+ * With real hardware the SDMA engine moves memory while the CPU does other
+ * things. In simulation there's nobody to do that, so we run its packets
+ * ourselves: copies, fills, fences, polls, the lot. GPU addresses are CPU
+ * pointers here (that's how simulation allocates). There's no VM to fault
+ * on, so a client's job only gets at the buffers it came with: every
+ * address a packet reads or writes has to be inside one of them, or the
+ * stream stops right there. The validator checked first, this is the MMU.
+ *
+ * Making it not suck:
+ *   - Big copies and fills get cut into pieces and handed to a few worker
+ *     threads (started the first time they're needed, AMDGPU_SDMA_THREADS
+ *     to pick how many, 0 = none). The submitting thread does a piece too.
+ *   - Copies bigger than the cache use non-temporal stores, so moving a
+ *     64 MB texture doesn't throw out everything else the CPU was using.
+ *   - Small stuff just runs right here, waking threads costs more.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define SDMA_MAX_WORKERS 4
+#define SDMA_SPLIT_BYTES (1u << 20)      // Below this, one thread is faster
+#define SDMA_STREAM_BYTES (256u << 10)   // Above this, don't pollute the cache
+#define SDMA_MAX_IB_DEPTH 4
+#define SDMA_POLL_TIMEOUT_NS 2000000000ull
+#define SDMA_POLL_MAX_NAP_NS 1000000ull
+
+#define SDMA_OP(h) ((h) & 0xFF)
+#define SDMA_SUB_OP(h) (((h) >> 8) & 0xFF)
+
+// One copy or fill, cut into pieces that can run anywhere
+struct sdma_task {
+  void (*run)(const struct sdma_task *t, uint64_t begin, uint64_t end);
+  uint8_t *dst;
+  const uint8_t *src;
+  uint32_t value;
+  bool stream;                  // Use non-temporal stores
+  // Sub-window copies: items are rows, all sizes in bytes
+  uint64_t row_bytes, rows;     // Per row, rows per slice
+  uint64_t src_pitch, src_slice, dst_pitch, dst_slice;
+  uint64_t items;               // Bytes (linear) or rows (sub-window)
+  uint64_t per_piece;
+  uint32_t pieces;
+};
+
+// The buffers a client job may touch, sorted by GPU address
+struct sdma_range {
+  uint64_t start, end;
+  uint8_t *cpu;
+};
+
+struct sdma_bounds {
+  struct sdma_range *r;
+  uint32_t count;
+};
+
+static pthread_mutex_t sdma_lock = PTHREAD_MUTEX_INITIALIZER; // Pool + stats
+static pthread_mutex_t sdma_busy = PTHREAD_MUTEX_INITIALIZER; // One split task at a time
+static pthread_cond_t sdma_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sdma_idle = PTHREAD_COND_INITIALIZER;
+static pthread_t sdma_threads[SDMA_MAX_WORKERS];
+static uint32_t sdma_nthreads;
+static bool sdma_started, sdma_stopping;
+static const struct sdma_task *sdma_task_cur;
+static uint32_t sdma_next_piece, sdma_pieces_done;
+static struct amdgpu_sdma_stats sdma_stats;
+
+static uint64_t sdma_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Where [addr, addr + bytes) is for the CPU. b NULL = our own stream, any
+// address goes. NULL if it isn't all inside one of the job's buffers.
+static void *sdma_ptr(const struct sdma_bounds *b, uint64_t addr,
+                      uint64_t bytes) {
+  if (!b)
+    return (void *)(uintptr_t)addr;
+  uint32_t lo = 0, hi = b->count;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (b->r[mid].end <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < b->count && b->r[lo].start <= addr &&
+      bytes <= b->r[lo].end - addr)
+    return b->r[lo].cpu + (addr - b->r[lo].start);
+
+  os_prim_log("HAL SDMA: 0x%llx (+%llu) isn't in any of the job's buffers\n",
+              (unsigned long long)addr, (unsigned long long)bytes);
+  pthread_mutex_lock(&sdma_lock);
+  sdma_stats.faults++;
+  pthread_mutex_unlock(&sdma_lock);
+  return NULL;
+}
+
+static uint64_t sdma_addr(const uint32_t *lo) {
+  return ((uint64_t)lo[1] << 32) | lo[0];
+}
+
+/* --- The actual moving of bytes --- */
+
+// Non-temporal stores go around the cache; make them visible before a
+// fence packet (or anyone else) looks at the memory
+static void sdma_store_fence(void) {
+#ifdef __SSE2__
+  _mm_sfence();
+#endif
+}
+
+static void sdma_copy_bytes(uint8_t *dst, const uint8_t *src, size_t n,
+                            bool stream) {
+#ifdef __SSE2__
+  if (stream) {
+    size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+    if (head > n)
+      head = n;
+    memcpy(dst, src, head);
+    dst += head, src += head, n -= head;
+    for (; n >= 64; n -= 64, dst += 64, src += 64) {
+      __m128i a = _mm_loadu_si128((const __m128i *)src);
+      __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+      __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+      __m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+      _mm_stream_si128((__m128i *)dst, a);
+      _mm_stream_si128((__m128i *)(dst + 16), b);
+      _mm_stream_si128((__m128i *)(dst + 32), c);
+      _mm_stream_si128((__m128i *)(dst + 48), d);
+    }
+  }
+#endif
+  (void)stream;
+  memcpy(dst, src, n);
+}
+
+// Repeat a 32-bit pattern. A piece may start mid-pattern (phase bytes in).
+static void sdma_fill_bytes(uint8_t *dst, uint32_t value, size_t n,
+                            size_t phase, bool stream) {
+  uint8_t pat[4];
+  memcpy(pat, &value, 4);
+  if (pat[0] == pat[1] && pat[0] == pat[2] && pat[0] == pat[3] && !stream) {
+    memset(dst, pat[0], n);
+    return;
+  }
+  // Get to a 16 byte boundary with the pattern lined up
+  while (n && (((uintptr_t)dst & 15) || (phase & 3))) {
+    *dst++ = pat[phase++ & 3];
+    n--;
+  }
+#ifdef __SSE2__
+  __m128i v = _mm_set1_epi32((int)value);
+  if (stream) {
+    for (; n >= 64; n -= 64, dst += 64) {
+      _mm_stream_si128((__m128i *)dst, v);
+      _mm_stream_si128((__m128i *)(dst + 16), v);
+      _mm_stream_si128((__m128i *)(dst + 32), v);
+      _mm_stream_si128((__m128i *)(dst + 48), v);
+    }
+  } else {
+    for (; n >= 16; n -= 16, dst += 16)
+      _mm_store_si128((__m128i *)dst, v);
+  }
+#else
+  for (; n >= 4; n -= 4, dst += 4)
+    memcpy(dst, &value, 4);
+#endif
+  for (size_t i = 0; i < n; i++)
+    dst[i] = pat[i & 3];
+}
+
+static void sdma_run_copy(const struct sdma_task *t, uint64_t b, uint64_t e) {
+  sdma_copy_bytes(t->dst + b, t->src + b, (size_t)(e - b), t->stream);
+}
+
+static void sdma_run_fill(const struct sdma_task *t, uint64_t b, uint64_t e) {
+  sdma_fill_bytes(t->dst + b, t->value, (size_t)(e - b), (size_t)b, t->stream);
+}
+
+static void sdma_run_rows(const struct sdma_task *t, uint64_t b, uint64_t e) {
+  for (uint64_t r = b; r < e; r++) {
+    uint64_t z = r / t->rows, y = r % t->rows;
+    sdma_copy_bytes(t->dst + y * t->dst_pitch + z * t->dst_slice,
+                    t->src + y * t->src_pitch + z * t->src_slice,
+                    (size_t)t->row_bytes, t->stream);
+  }
+}
+
+/* --- Worker pool --- */
+
+// Run the next piece of the current task, if there is one. Called with
+// sdma_lock held, dropped while the piece runs.
+static bool sdma_run_piece_locked(void) {
+  const struct sdma_task *t = sdma_task_cur;
+  if (!t || sdma_next_piece >= t->pieces)
+    return false;
+  uint64_t begin = sdma_next_piece++ * t->per_piece;
+  uint64_t end = begin + t->per_piece < t->items ? begin + t->per_piece : t->items;
+  pthread_mutex_unlock(&sdma_lock);
+
+  t->run(t, begin, end);
+  sdma_store_fence();
+
+  pthread_mutex_lock(&sdma_lock);
+  if (++sdma_pieces_done == t->pieces)
+    pthread_cond_broadcast(&sdma_idle);
+  return true;
+}
+
+static void *sdma_worker(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&sdma_lock);
+  while (!sdma_stopping) {
+    if (!sdma_run_piece_locked())
+      pthread_cond_wait(&sdma_work, &sdma_lock);
+  }
+  pthread_mutex_unlock(&sdma_lock);
+  return NULL;
+}
+
+// How many helpers we have, starting them the first time
+static uint32_t sdma_pool_start(void) {
+  pthread_mutex_lock(&sdma_lock);
+  if (!sdma_started) {
+    sdma_started = true;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long want = cpus > 1 ? cpus - 1 : 0;
+    const char *env = getenv("AMDGPU_SDMA_THREADS");
+    if (env)
+      want = atol(env);
+    if (want > SDMA_MAX_WORKERS)
+      want = SDMA_MAX_WORKERS;
+    for (long i = 0; i < want; i++) {
+      if (pthread_create(&sdma_threads[sdma_nthreads], NULL, sdma_worker, NULL) != 0)
+        break;
+      sdma_nthreads++;
+    }
+    os_prim_log("HAL SDMA: %u copy worker threads\n", sdma_nthreads);
+  }
+  uint32_t n = sdma_stopping ? 0 : sdma_nthreads;
+  pthread_mutex_unlock(&sdma_lock);
+  return n;
+}
+
+void amdgpu_sdma_fini_sim(void) {
+  pthread_mutex_lock(&sdma_lock);
+  sdma_stopping = true;
+  pthread_cond_broadcast(&sdma_work);
+  pthread_mutex_unlock(&sdma_lock);
+  for (uint32_t i = 0; i < sdma_nthreads; i++)
+    pthread_join(sdma_threads[i], NULL);
+
+  pthread_mutex_lock(&sdma_lock);
+  sdma_nthreads = 0;
+  sdma_started = false;
+  sdma_stopping = false;
+  pthread_mutex_unlock(&sdma_lock);
+}
+
+// Run a task, across the pool if it's big enough and nobody else has it.
+// granule: pieces start on multiples of this (keeps fills lined up).
+static void sdma_run(struct sdma_task *t, uint64_t bytes, uint64_t granule) {
+  uint32_t helpers = bytes >= SDMA_SPLIT_BYTES ? sdma_pool_start() : 0;
+  if (helpers && pthread_mutex_trylock(&sdma_busy) == 0) {
+    // A couple of pieces per thread, so one slow core doesn't hold us up
+    uint64_t per = (t->items + (helpers + 1) * 2 - 1) / ((helpers + 1) * 2);
+    t->per_piece = (per + granule - 1) / granule * granule;
+    t->pieces = (uint32_t)((t->items + t->per_piece - 1) / t->per_piece);
+
+    pthread_mutex_lock(&sdma_lock);
+    sdma_task_cur = t;
+    sdma_next_piece = 0;
+    sdma_pieces_done = 0;
+    pthread_cond_broadcast(&sdma_work);
+    while (sdma_run_piece_locked())
+      ;
+    while (sdma_pieces_done < t->pieces)
+      pthread_cond_wait(&sdma_idle, &sdma_lock);
+    sdma_task_cur = NULL;
+    sdma_stats.split++;
+    pthread_mutex_unlock(&sdma_lock);
+    pthread_mutex_unlock(&sdma_busy);
+    return;
+  }
+  t->run(t, 0, t->items);
+  sdma_store_fence();
+}
+
+/* --- Packets --- */
+
+static int sdma_exec_copy(const struct sdma_bounds *bd, const uint32_t *p) {
+  if (SDMA_SUB_OP(p[0]) == SDMA_SUBOP_COPY_LINEAR) {
+    uint64_t bytes = (uint64_t)(p[1] & SDMA_PKT_COPY_LINEAR_COUNT_count_mask) + 1;
+    uint8_t *dst = sdma_ptr(bd, sdma_addr(&p[5]), bytes);
+    const uint8_t *src = sdma_ptr(bd, sdma_addr(&p[3]), bytes);
+    if (!dst || !src)
+      return -1;
+    if (dst < src + bytes && src < dst + bytes) {
+      memmove(dst, src, (size_t)bytes); // Overlap: no splitting, no streaming
+    } else {
+      struct sdma_task t = {.run = sdma_run_copy, .dst = dst, .src = src,
+                           .stream = bytes >= SDMA_STREAM_BYTES, .items = bytes};
+      sdma_run(&t, bytes, 64);
+    }
+    pthread_mutex_lock(&sdma_lock);
+    sdma_stats.bytes_copied += bytes;
+    pthread_mutex_unlock(&sdma_lock);
+    return 7;
+  }
+
+  // Sub-window: a box between two linear surfaces, one row at a time
+  uint64_t bpp = 1ull << ((p[0] >> SDMA_PKT_COPY_LINEAR_SUBWIN_HEADER_elementsize_shift) &
+                          SDMA_PKT_COPY_LINEAR_SUBWIN_HEADER_elementsize_mask);
+  uint64_t sx = p[3] & 0x3FFF, sy = (p[3] >> 16) & 0x3FFF, sz = p[4] & 0x1FFF;
+  uint64_t dx = p[8] & 0x3FFF, dy = (p[8] >> 16) & 0x3FFF, dz = p[9] & 0x1FFF;
+  uint64_t w = (p[11] & 0x3FFF) + 1, h = ((p[11] >> 16) & 0x3FFF) + 1;
+  uint64_t d = (p[12] & 0x1FFF) + 1;
+  struct sdma_task t = {.run = sdma_run_rows};
+  t.src_pitch = (((p[4] >> 13) & 0x7FFFF) + 1) * bpp;
+  t.src_slice = ((uint64_t)(p[5] & 0xFFFFFFF) + 1) * bpp;
+  t.dst_pitch = (((p[9] >> 13) & 0x7FFFF) + 1) * bpp;
+  t.dst_slice = ((uint64_t)(p[10] & 0xFFFFFFF) + 1) * bpp;
+  t.row_bytes = w * bpp;
+  // First texel of the box to one past its last, on both sides
+  t.src = sdma_ptr(bd, sdma_addr(&p[1]) + sx * bpp + sy * t.src_pitch +
+                           sz * t.src_slice,
+                   (d - 1) * t.src_slice + (h - 1) * t.src_pitch + t.row_bytes);
+  t.dst = sdma_ptr(bd, sdma_addr(&p[6]) + dx * bpp + dy * t.dst_pitch +
+                           dz * t.dst_slice,
+                   (d - 1) * t.dst_slice + (h - 1) * t.dst_pitch + t.row_bytes);
+  if (!t.src || !t.dst)
+    return -1;
+  t.rows = h;
+  t.items = h * d;
+  t.stream = t.row_bytes * t.items >= SDMA_STREAM_BYTES;
+  sdma_run(&t, t.row_bytes * t.items, 1);
+  pthread_mutex_lock(&sdma_lock);
+  sdma_stats.bytes_copied += t.row_bytes * t.items;
+  pthread_mutex_unlock(&sdma_lock);
+  return 13;
+}
+
+static int sdma_exec_fill(const struct sdma_bounds *bd, const uint32_t *p) {
+  uint64_t bytes = (uint64_t)(p[4] & SDMA_PKT_CONSTANT_FILL_COUNT_count_mask) + 1;
+  uint32_t value = p[3];
+  if (!(p[0] >> SDMA_PKT_CONSTANT_FILL_HEADER_fillsize_shift))
+    value = (value & 0xFF) * 0x01010101u; // Byte fill
+  struct sdma_task t = {.run = sdma_run_fill,
+                        .dst = sdma_ptr(bd, sdma_addr(&p[1]), bytes),
+                        .value = value, .stream = bytes >= SDMA_STREAM_BYTES,
+                        .items = bytes};
+  if (!t.dst)
+    return -1;
+  sdma_run(&t, bytes, 64);
+  pthread_mutex_lock(&sdma_lock);
+  sdma_stats.bytes_filled += bytes;
+  pthread_mutex_unlock(&sdma_lock);
+  return 5;
+}
+
+static bool sdma_compare(uint32_t func, uint32_t v, uint32_t ref) {
+  switch (func) {
+  case 0: return true;
+  case 1: return v < ref;
+  case 2: return v <= ref;
+  case 3: return v == ref;
+  case 4: return v != ref;
+  case 5: return v >= ref;
+  case 6: return v > ref;
+  default: return false;
+  }
+}
+
+// A poll the client wrote: the scheduler holds jobs until their dependencies
+// are done instead of sending us its own. Whatever this waits for is the
+// client's business, so nap (growing to 1ms) rather than spin, and give up
+// eventually instead of hanging.
+static int sdma_exec_poll(const struct sdma_bounds *bd, const uint32_t *p) {
+  if (!(p[0] >> SDMA_PKT_POLL_REGMEM_HEADER_mem_poll_shift))
+    return -1; // No registers in simulation
+  uint32_t func = (p[0] >> SDMA_PKT_POLL_REGMEM_HEADER_func_shift) &
+                  SDMA_PKT_POLL_REGMEM_HEADER_func_mask;
+  const volatile uint32_t *mem = sdma_ptr(bd, sdma_addr(&p[1]), 4);
+  if (!mem)
+    return -1;
+  uint64_t deadline = 0, nap_ns = 1000;
+  for (uint32_t spins = 0;; spins++) {
+    if (sdma_compare(func, __atomic_load_n(mem, __ATOMIC_ACQUIRE) & p[4], p[3]))
+      return 6;
+    if (spins < 64)
+      continue;
+    uint64_t now = sdma_now_ns();
+    if (!deadline)
+      deadline = now + SDMA_POLL_TIMEOUT_NS;
+    else if (now > deadline)
+      return -1;
+    struct timespec ts = {0, (long)nap_ns};
+    nanosleep(&ts, NULL);
+    if (nap_ns < SDMA_POLL_MAX_NAP_NS)
+      nap_ns *= 2;
+  }
+}
+
+static int sdma_exec(const struct sdma_bounds *bd, const uint32_t *dw,
+                     uint32_t ndw, uint32_t depth);
+
+// Execute one packet. Returns its size in dwords, -1 to stop the stream.
+static int sdma_exec_packet(const struct sdma_bounds *bd, const uint32_t *p,
+                            uint32_t avail, uint32_t depth) {
+  static const uint8_t min_dw[256] = {
+      [SDMA_OP_NOP] = 1,   [SDMA_OP_COPY] = 7,         [SDMA_OP_WRITE] = 4,
+      [SDMA_OP_INDIRECT] = 6, [SDMA_OP_FENCE] = 4,     [SDMA_OP_TRAP] = 2,
+      [SDMA_OP_POLL_REGMEM] = 6, [SDMA_OP_CONST_FILL] = 5, [SDMA_OP_TIMESTAMP] = 3,
+  };
+  uint32_t op = SDMA_OP(p[0]);
+  if (!min_dw[op] || min_dw[op] > avail)
+    return -1;
+
+  switch (op) {
+  case SDMA_OP_NOP:
+    return 1 + (int)((p[0] >> SDMA_PKT_NOP_HEADER_count_shift) &
+                     SDMA_PKT_NOP_HEADER_count_mask);
+  case SDMA_OP_COPY:
+    if (SDMA_SUB_OP(p[0]) == SDMA_SUBOP_COPY_LINEAR_SUB_WIND && avail >= 13)
+      return sdma_exec_copy(bd, p);
+    return SDMA_SUB_OP(p[0]) == SDMA_SUBOP_COPY_LINEAR ? sdma_exec_copy(bd, p) : -1;
+  case SDMA_OP_WRITE: {
+    uint32_t n = (p[3] & SDMA_PKT_WRITE_UNTILED_DW_3_count_mask) + 1;
+    void *dst = n <= avail - 4 ? sdma_ptr(bd, sdma_addr(&p[1]), (uint64_t)n * 4)
+                               : NULL;
+    if (!dst)
+      return -1;
+    memcpy(dst, &p[4], (size_t)n * 4);
+    return (int)(4 + n);
+  }
+  case SDMA_OP_INDIRECT: {
+    uint32_t n = p[3] & 0xFFFFF;
+    const uint32_t *ib = sdma_ptr(bd, sdma_addr(&p[1]), (uint64_t)n * 4);
+    if (!ib || depth + 1 >= SDMA_MAX_IB_DEPTH ||
+        sdma_exec(bd, ib, n, depth + 1) != 0)
+      return -1;
+    return 6;
+  }
+  case SDMA_OP_FENCE: {
+    uint32_t *fence = sdma_ptr(bd, sdma_addr(&p[1]), 4);
+    if (!fence)
+      return -1;
+    __atomic_store_n(fence, p[3], __ATOMIC_RELEASE);
+    return 4;
+  }
+  case SDMA_OP_TRAP:
+    // Completion is still reported by our caller; whoever listens on the IH
+    // hears about it too
+    if (amdgpu_ih_active()) {
+      struct amdgpu_iv_entry iv = {0};
+      iv.client_id = SOC15_IH_CLIENTID_SDMA0;
+      iv.src_id = SDMA0_5_0__SRCID__SDMA_TRAP;
+      iv.timestamp = sdma_now_ns() & 0xFFFFFFFFFFFFull;
+      iv.src_data[0] = p[1] & SDMA_PKT_TRAP_INT_CONTEXT_int_context_mask;
+      amdgpu_ih_sim_raise(&iv);
+    }
+    return 2;
+  case SDMA_OP_POLL_REGMEM:
+    return sdma_exec_poll(bd, p);
+  case SDMA_OP_CONST_FILL:
+    return sdma_exec_fill(bd, p);
+  case SDMA_OP_TIMESTAMP: {
+    if (SDMA_SUB_OP(p[0]) == SDMA_SUBOP_TIMESTAMP_SET)
+      return 3;
+    void *dst = sdma_ptr(bd, sdma_addr(&p[1]), 8);
+    if (!dst)
+      return -1;
+    uint64_t now = sdma_now_ns();
+    memcpy(dst, &now, 8);
+    return 3;
+  }
+  default:
+    return -1;
+  }
+}
+
+static int sdma_exec(const struct sdma_bounds *bd, const uint32_t *dw,
+                     uint32_t ndw, uint32_t depth) {
+  uint64_t packets = 0;
+  int ret = 0;
+  for (uint32_t i = 0; i < ndw; packets++) {
+    int n = sdma_exec_packet(bd, &dw[i], ndw - i, depth);
+    if (n < 0 || (uint32_t)n > ndw - i) {
+      os_prim_log("HAL SDMA: Bad packet 0x%08x at dword %u (IB depth %u), stream stopped\n",
+                  dw[i], i, depth);
+      ret = -1;
+      break;
+    }
+    i += (uint32_t)n;
+  }
+  pthread_mutex_lock(&sdma_lock);
+  sdma_stats.packets += packets;
+  pthread_mutex_unlock(&sdma_lock);
+  return ret;
+}
+
+static int sdma_execute(const struct sdma_bounds *bd, const uint32_t *dw,
+                        uint32_t ndw) {
+  if (!dw)
+    return -1;
+  int ret = sdma_exec(bd, dw, ndw, 0);
+  if (ret != 0) {
+    pthread_mutex_lock(&sdma_lock);
+    sdma_stats.errors++;
+    pthread_mutex_unlock(&sdma_lock);
+  }
+  return ret;
+}
+
+static int sdma_range_cmp(const void *a, const void *b) {
+  const struct sdma_range *x = a, *y = b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// Our own streams (copy manager, tests): trusted with any address
+int amdgpu_sdma_execute_sim(const uint32_t *dw, uint32_t ndw) {
+  return sdma_execute(NULL, dw, ndw);
+}
+
+// A client's: only bos[] may be read or written, IBs included
+int amdgpu_sdma_execute_bounded_sim(const uint32_t *dw, uint32_t ndw,
+                                    struct amdgpu_buffer **bos,
+                                    uint32_t bo_count) {
+  struct sdma_bounds bd = {NULL, 0};
+  if (bo_count && !bos)
+    return -1;
+  if (bo_count) {
+    bd.r = os_prim_alloc(bo_count * sizeof(*bd.r));
+    if (!bd.r)
+      return -1;
+  }
+  for (uint32_t i = 0; i < bo_count; i++) {
+    if (!bos[i] || !bos[i]->size || !bos[i]->cpu_addr)
+      continue;
+    struct sdma_range *r = &bd.r[bd.count++];
+    r->start = bos[i]->gpu_addr;
+    r->end = bos[i]->gpu_addr + bos[i]->size;
+    r->cpu = bos[i]->cpu_addr;
+  }
+  if (bd.count)
+    qsort(bd.r, bd.count, sizeof(*bd.r), sdma_range_cmp);
+  int ret = sdma_execute(&bd, dw, ndw);
+  os_prim_free(bd.r);
+  return ret;
+}
+
+static int sdma_submit(struct OBJGPU *adev, struct amdgpu_command_buffer *cb,
+                       bool bounded) {
+  if (!adev || !cb)
+    return -1;
+  if (amdgpu_hal_get_mode() != AMDGPU_HAL_MODE_SIM)
+    return amdgpu_command_submit_hal(adev, cb); // The real one has a VM
+
+  uint64_t fence = amdgpu_residency_validate(adev, cb->bo_list, cb->bo_count);
+  int ret = bounded ? amdgpu_sdma_execute_bounded_sim(cb->cmds,
+                                                      (uint32_t)(cb->size / 4),
+                                                      cb->bo_list, cb->bo_count)
+                    : amdgpu_sdma_execute_sim(cb->cmds, (uint32_t)(cb->size / 4));
+  amdgpu_residency_fence_signal(adev, fence);
+  return ret;
+}
+
+// DMA-engine work: in simulation we are the engine, otherwise the ring is
+int amdgpu_sdma_submit_hal(struct OBJGPU *adev, struct amdgpu_command_buffer *cb) {
+  return sdma_submit(adev, cb, false);
+}
+
+// Same for a client's job: cb->bo_list is everything it may touch
+int amdgpu_sdma_submit_bounded_hal(struct OBJGPU *adev,
+                                   struct amdgpu_command_buffer *cb) {
+  return sdma_submit(adev, cb, true);
+}
+
+void amdgpu_sdma_get_stats(struct amdgpu_sdma_stats *out) {
+  if (!out)
+    return;
+  pthread_mutex_lock(&sdma_lock);
+  *out = sdma_stats;
+  pthread_mutex_unlock(&sdma_lock);
+}
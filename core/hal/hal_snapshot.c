@@ -0,0 +1,464 @@
+#include "hal.h"
+#include "../../os/os_interface.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the Register Snapshot - how the GPU gets its memory back.
+ * The old shadow was 1024 dense slots for the first 4 KB of MMIO, and
+ * recovery copied back 256 of them. Anything we wrote above that was
+ * forgotten (or scribbled past the end of the array), and getting the rest
+ * back meant running the whole init again.
+ *
+ * Now:
+ *   - The shadow is sparse: only registers we actually wrote, sorted by
+ *     offset, each tagged with the IP block whose hw_init/late_init was
+ *     running at the time. Those are the init-time (golden / firmware
+ *     setup) values; a later write drops the tag.
+ *   - A snapshot packs the shadow per IP block into runs of consecutive
+ *     registers: the gap from the previous run and the run length as
+ *     varints, then the values (varints too, most of them are small). A
+ *     few hundred scattered registers end up a couple of KB.
+ *   - Blobs (MQDs, ring rptr/wptr, anything that isn't a register) ride
+ *     along under a tag.
+ *   - Restoring takes the MMIO lock once per run, not once per register,
+ *     and skips init-time registers that still read back right: golden
+ *     settings and firmware state that survived don't get reprogrammed.
+ *
+ * Format: sections, one after the other, until the end.
+ *   REGS: u8 kind, u8 block, varint runs,
+ *         runs x {varint gap, varint count, u8 flags, count x varint value}
+ *   BLOB: u8 kind, varint tag, varint size, size bytes
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define SNAP_KIND_REGS 1
+#define SNAP_KIND_BLOB 2
+#define SNAP_MAX_RUN 256 // Registers written per lock hold
+
+// --- Shadow ---
+
+static uint32_t shadow_find(const struct amd_shadow_state *s, uint32_t reg) {
+  uint32_t lo = 0, hi = s->count;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (s->regs[mid].reg < reg)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Caller holds mmio_lock for writing
+static int shadow_set_locked(struct OBJGPU *adev, uint32_t reg, uint32_t value) {
+  struct amd_shadow_state *s = &adev->shadow;
+  uint32_t i = shadow_find(s, reg);
+  if (i < s->count && s->regs[i].reg == reg) {
+    struct amd_shadow_reg *r = &s->regs[i];
+    r->value = value;
+    if (s->owner) {
+      r->block = s->owner;
+      r->flags |= AMDGPU_SHADOW_INIT;
+    } else {
+      r->flags &= (uint8_t)~AMDGPU_SHADOW_INIT; // Changed at runtime
+    }
+    return 0;
+  }
+
+  if (s->count == s->cap) {
+    uint32_t cap = s->cap ? s->cap * 2 : 64;
+    struct amd_shadow_reg *regs = os_prim_alloc(cap * sizeof(*regs));
+    if (!regs)
+      return -1;
+    if (s->count)
+      memcpy(regs, s->regs, s->count * sizeof(*regs));
+    if (s->regs)
+      os_prim_free(s->regs);
+    s->regs = regs;
+    s->cap = cap;
+  }
+  memmove(&s->regs[i + 1], &s->regs[i], (s->count - i) * sizeof(*s->regs));
+  s->regs[i].reg = reg;
+  s->regs[i].value = value;
+  s->regs[i].block = s->owner;
+  s->regs[i].flags = s->owner ? AMDGPU_SHADOW_INIT : 0;
+  s->count++;
+  return 0;
+}
+
+// Remember a register write (offset in bytes)
+void amdgpu_hal_shadow_write(struct OBJGPU *adev, uint32_t offset,
+                             uint32_t value) {
+  if (!adev || (offset & 3))
+    return;
+  pthread_rwlock_wrlock(&adev->mmio_lock);
+  if (shadow_set_locked(adev, offset / 4, value) != 0)
+    os_prim_log("HAL Snapshot: Out of memory, 0x%x won't survive a reset\n",
+                offset);
+  pthread_rwlock_unlock(&adev->mmio_lock);
+}
+
+void amdgpu_hal_shadow_fini(struct OBJGPU *adev) {
+  if (!adev)
+    return;
+  pthread_rwlock_wrlock(&adev->mmio_lock);
+  if (adev->shadow.regs)
+    os_prim_free(adev->shadow.regs);
+  adev->shadow.regs = NULL;
+  adev->shadow.count = adev->shadow.cap = 0;
+  pthread_rwlock_unlock(&adev->mmio_lock);
+}
+
+// --- Encoding ---
+
+static int snap_reserve(struct amdgpu_snapshot *snap, size_t more) {
+  if (snap->size + more <= snap->cap)
+    return 0;
+  size_t cap = snap->cap ? snap->cap : 256;
+  while (cap < snap->size + more)
+    cap *= 2;
+  uint8_t *data = os_prim_alloc(cap);
+  if (!data)
+    return -1;
+  if (snap->size)
+    memcpy(data, snap->data, snap->size);
+  if (snap->data)
+    os_prim_free(snap->data);
+  snap->data = data;
+  snap->cap = cap;
+  return 0;
+}
+
+static int snap_put_u8(struct amdgpu_snapshot *snap, uint8_t v) {
+  if (snap_reserve(snap, 1) != 0)
+    return -1;
+  snap->data[snap->size++] = v;
+  return 0;
+}
+
+static int snap_put_varint(struct amdgpu_snapshot *snap, uint32_t v) {
+  if (snap_reserve(snap, 5) != 0)
+    return -1;
+  while (v >= 0x80) {
+    snap->data[snap->size++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  snap->data[snap->size++] = (uint8_t)v;
+  return 0;
+}
+
+struct snap_reader {
+  const uint8_t *p, *end;
+};
+
+static int snap_get_u8(struct snap_reader *r, uint8_t *v) {
+  if (r->p >= r->end)
+    return -1;
+  *v = *r->p++;
+  return 0;
+}
+
+static int snap_get_varint(struct snap_reader *r, uint32_t *v) {
+  uint32_t out = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (r->p >= r->end)
+      return -1;
+    uint8_t b = *r->p++;
+    out |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      *v = out;
+      return 0;
+    }
+  }
+  return -1; // Longer than a u32 can be
+}
+
+// A register belongs to the same run as the previous one if it's the next
+// offset and has the same flags
+static int snap_put_block_locked(struct amdgpu_snapshot *snap,
+                                 const struct amd_shadow_state *s,
+                                 uint8_t block) {
+  uint32_t runs = 0;
+  for (uint32_t i = 0; i < s->count; i++) {
+    const struct amd_shadow_reg *r = &s->regs[i];
+    if (r->block != block)
+      continue;
+    uint32_t j = i + 1;
+    while (j < s->count && s->regs[j].block == block &&
+           s->regs[j].reg == r->reg + (j - i) && s->regs[j].flags == r->flags)
+      j++;
+    runs++;
+    i = j - 1;
+  }
+  if (!runs)
+    return 0;
+
+  if (snap_put_u8(snap, SNAP_KIND_REGS) || snap_put_u8(snap, block) ||
+      snap_put_varint(snap, runs))
+    return -1;
+  uint32_t next = 0; // First register after the previous run
+  for (uint32_t i = 0; i < s->count; i++) {
+    const struct amd_shadow_reg *r = &s->regs[i];
+    if (r->block != block)
+      continue;
+    uint32_t j = i + 1;
+    while (j < s->count && s->regs[j].block == block &&
+           s->regs[j].reg == r->reg + (j - i) && s->regs[j].flags == r->flags)
+      j++;
+    if (snap_put_varint(snap, r->reg - next) ||
+        snap_put_varint(snap, j - i) || snap_put_u8(snap, r->flags))
+      return -1;
+    for (uint32_t k = i; k < j; k++)
+      if (snap_put_varint(snap, s->regs[k].value))
+        return -1;
+    snap->regs += j - i;
+    snap->runs++;
+    next = s->regs[j - 1].reg + 1;
+    i = j - 1;
+  }
+  return 0;
+}
+
+// Pack the shadow into snap (appending). block: an index into the handler's
+// IP blocks, or -1 for everything, IP blocks first in init order.
+int amdgpu_snapshot_capture(struct OBJGPU *adev, struct amdgpu_snapshot *snap,
+                            int block) {
+  if (!adev || !snap || block >= AMDGPU_MAX_IP_BLOCKS)
+    return -1;
+  int ret = 0;
+  pthread_rwlock_rdlock(&adev->mmio_lock);
+  if (block >= 0) {
+    ret = snap_put_block_locked(snap, &adev->shadow, (uint8_t)(block + 1));
+  } else {
+    for (int b = 1; ret == 0 && b <= AMDGPU_MAX_IP_BLOCKS; b++)
+      ret = snap_put_block_locked(snap, &adev->shadow, (uint8_t)b);
+    if (ret == 0) // Runtime writes outside any block's init go last
+      ret = snap_put_block_locked(snap, &adev->shadow, AMDGPU_SHADOW_NO_BLOCK);
+  }
+  pthread_rwlock_unlock(&adev->mmio_lock);
+  return ret;
+}
+
+int amdgpu_snapshot_add_blob(struct amdgpu_snapshot *snap, uint32_t tag,
+                             const void *data, uint32_t size) {
+  if (!snap || (size && !data))
+    return -1;
+  if (snap_put_u8(snap, SNAP_KIND_BLOB) || snap_put_varint(snap, tag) ||
+      snap_put_varint(snap, size) || snap_reserve(snap, size))
+    return -1;
+  if (size)
+    memcpy(snap->data + snap->size, data, size);
+  snap->size += size;
+  return 0;
+}
+
+// Skip a REGS section body (after kind and block)
+static int snap_skip_regs(struct snap_reader *r) {
+  uint32_t runs, gap, count, v;
+  uint8_t flags;
+  if (snap_get_varint(r, &runs))
+    return -1;
+  for (uint32_t i = 0; i < runs; i++) {
+    if (snap_get_varint(r, &gap) || snap_get_varint(r, &count) ||
+        snap_get_u8(r, &flags))
+      return -1;
+    for (uint32_t k = 0; k < count; k++)
+      if (snap_get_varint(r, &v))
+        return -1;
+  }
+  return 0;
+}
+
+// Last blob with that tag, NULL if there's none
+const void *amdgpu_snapshot_find_blob(const struct amdgpu_snapshot *snap,
+                                      uint32_t tag, uint32_t *size) {
+  if (!snap || !snap->data)
+    return NULL;
+  struct snap_reader r = {snap->data, snap->data + snap->size};
+  const void *found = NULL;
+  uint8_t kind, block;
+  while (r.p < r.end) {
+    if (snap_get_u8(&r, &kind))
+      return NULL;
+    if (kind == SNAP_KIND_REGS) {
+      if (snap_get_u8(&r, &block) || snap_skip_regs(&r))
+        return NULL;
+    } else if (kind == SNAP_KIND_BLOB) {
+      uint32_t t, len;
+      if (snap_get_varint(&r, &t) || snap_get_varint(&r, &len) ||
+          (size_t)(r.end - r.p) < len)
+        return NULL;
+      if (t == tag) {
+        found = r.p;
+        if (size)
+          *size = len;
+      }
+      r.p += len;
+    } else {
+      return NULL;
+    }
+  }
+  return found;
+}
+
+// Write the registers back. Returns how many were written (-1: the snapshot
+// is corrupt, nothing past the bad spot was touched); skipped counts the
+// init-time ones that didn't need it.
+int amdgpu_snapshot_restore(struct OBJGPU *adev,
+                            const struct amdgpu_snapshot *snap,
+                            uint32_t *skipped) {
+  if (!adev || !snap)
+    return -1;
+  if (skipped)
+    *skipped = 0;
+  if (!snap->data)
+    return 0;
+
+  struct snap_reader r = {snap->data, snap->data + snap->size};
+  uint32_t vals[SNAP_MAX_RUN];
+  int written = 0;
+  uint8_t kind, block, flags;
+  while (r.p < r.end) {
+    if (snap_get_u8(&r, &kind))
+      return -1;
+    if (kind == SNAP_KIND_BLOB) {
+      uint32_t tag, len;
+      if (snap_get_varint(&r, &tag) || snap_get_varint(&r, &len) ||
+          (size_t)(r.end - r.p) < len)
+        return -1;
+      r.p += len;
+      continue;
+    }
+    uint32_t runs, next = 0;
+    if (kind != SNAP_KIND_REGS || snap_get_u8(&r, &block) ||
+        snap_get_varint(&r, &runs))
+      return -1;
+    for (uint32_t i = 0; i < runs; i++) {
+      uint32_t gap, count;
+      if (snap_get_varint(&r, &gap) || snap_get_varint(&r, &count) ||
+          snap_get_u8(&r, &flags))
+        return -1;
+      uint32_t reg = next + gap;
+      next = reg + count;
+      while (count) {
+        uint32_t n = count < SNAP_MAX_RUN ? count : SNAP_MAX_RUN;
+        for (uint32_t k = 0; k < n; k++)
+          if (snap_get_varint(&r, &vals[k]))
+            return -1;
+        if (adev->mmio_size && (size_t)(reg + n) * 4 > adev->mmio_size)
+          return -1;
+
+        // One hold for the whole batch: the domain locks keep the other
+        // writers off the registers (same order as theirs, domains first),
+        // mmio_lock the shadow
+        uint32_t domains = 0;
+        for (uint32_t k = 0; k < n; k++)
+          domains |= 1u << amdgpu_reg_domain(adev, (reg + k) * 4);
+        amdgpu_reg_lock_domains(adev, domains);
+        pthread_rwlock_wrlock(&adev->mmio_lock);
+        uint8_t owner = adev->shadow.owner;
+        adev->shadow.owner = (flags & AMDGPU_SHADOW_INIT) ? block : 0;
+        for (uint32_t k = 0; k < n; k++) {
+          volatile uint32_t *mmio =
+              adev->mmio_base
+                  ? (volatile uint32_t *)(adev->mmio_base + (reg + k) * 4)
+                  : NULL;
+          if ((flags & AMDGPU_SHADOW_INIT) && mmio && *mmio == vals[k]) {
+            if (skipped)
+              (*skipped)++;
+            continue; // Golden / firmware value survived
+          }
+          if (mmio)
+            *mmio = vals[k];
+          shadow_set_locked(adev, reg + k, vals[k]);
+          written++;
+        }
+        adev->shadow.owner = owner;
+        pthread_rwlock_unlock(&adev->mmio_lock);
+        amdgpu_reg_unlock_domains(adev, domains);
+        reg += n;
+        count -= n;
+      }
+    }
+  }
+  return written;
+}
+
+void amdgpu_snapshot_free(struct amdgpu_snapshot *snap) {
+  if (!snap)
+    return;
+  if (snap->data)
+    os_prim_free(snap->data);
+  memset(snap, 0, sizeof(*snap));
+}
+
+// --- Suspend / resume ---
+
+static uint64_t snap_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Quiesce, snapshot, then let the blocks that have a suspend hook do their
+// part. Blocks without one aren't torn down: resume puts their registers
+// back instead of running hw_init again.
+int ip_blocks_suspend(struct OBJGPU *adev) {
+  if (!adev || !adev->handler)
+    return -1;
+  struct amd_gpu_handler *h = adev->handler;
+  if (h->wait_for_idle && h->wait_for_idle(h) != 0) {
+    os_prim_log("HAL Snapshot: GPU won't go idle, not suspending\n");
+    return -1;
+  }
+
+  amdgpu_snapshot_free(&adev->suspend_state);
+  if (amdgpu_snapshot_capture(adev, &adev->suspend_state, -1) != 0) {
+    amdgpu_snapshot_free(&adev->suspend_state);
+    return -1;
+  }
+  for (int i = h->num_ip_blocks - 1; i >= 0; i--) {
+    struct ip_block_ops *block = h->ip_blocks[i];
+    if (block->suspend && block->suspend(adev) != 0) {
+      os_prim_log("HAL Snapshot: Suspend failed for %s\n", block->name);
+      return -1;
+    }
+  }
+  os_prim_log("HAL Snapshot: Suspended, %u registers in %zu bytes\n",
+              adev->suspend_state.regs, adev->suspend_state.size);
+  return 0;
+}
+
+int ip_blocks_resume(struct OBJGPU *adev) {
+  if (!adev || !adev->handler)
+    return -1;
+  struct amd_gpu_handler *h = adev->handler;
+  uint64_t start = snap_now_ns();
+  uint32_t skipped = 0;
+  int written = amdgpu_snapshot_restore(adev, &adev->suspend_state, &skipped);
+  if (written < 0) {
+    os_prim_log("HAL Snapshot: Snapshot is corrupt, doing a full init\n");
+    amdgpu_snapshot_free(&adev->suspend_state);
+    return h->init_hardware ? h->init_hardware(h) : -1;
+  }
+  for (int i = 0; i < h->num_ip_blocks; i++) {
+    struct ip_block_ops *block = h->ip_blocks[i];
+    if (block->resume && block->resume(adev) != 0) {
+      os_prim_log("HAL Snapshot: Resume failed for %s\n", block->name);
+      return -1;
+    }
+  }
+  amdgpu_snapshot_free(&adev->suspend_state);
+  os_prim_log("HAL Snapshot: Resumed in %llu us (%d written, %u still valid)\n",
+              (unsigned long long)((snap_now_ns() - start) / 1000), written,
+              skipped);
+  return 0;
+}
@@ -0,0 +1,207 @@
+#include "hal.h"
+#include "../../os/os_interface.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+
+/*
+ * Yo! This is the Ring Watchdog - the thing that notices a stuck ring.
+ * The old heartbeat woke up ten times a second forever, looked at the RAS
+ * counters and skipped everything else if the GPU was busy. Which is when
+ * GPUs hang. It never caught one.
+ *
+ * Now the rings themselves tell us what's going on:
+ *   - Work goes on a ring: amdgpu_watchdog_arm(ring, seq). An idle ring
+ *     gets a deadline, now + its timeout.
+ *   - Its fence moves: amdgpu_watchdog_signal(ring, seq). All done: the
+ *     ring is off the clock. Still busy: it made progress, so the clock
+ *     starts over. A long queue of short jobs is fine, one job that never
+ *     finishes isn't.
+ *   - A deadline passes with the fence where it was: that ring is hung.
+ *
+ * One thread keeps the time for every ring and sleeps until the earliest
+ * deadline, or until somebody arms an idle ring. Nothing armed, nothing
+ * wakes up: an idle server is really idle.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+struct wd_ring {
+  uint32_t timeout_ms;   // 0 = not watched
+  uint64_t armed;        // Highest seq put on the ring
+  uint64_t signaled;     // Highest seq its fence reached
+  uint64_t deadline_ns;  // 0 = off the clock
+};
+
+static struct wd_ring wd_rings[AMDGPU_WATCHDOG_MAX_RINGS];
+static struct amdgpu_watchdog_stats wd_stats;
+static amdgpu_watchdog_fn wd_on_hang;
+static void *wd_priv;
+static uint64_t wd_next_ns;  // What the thread is sleeping towards (0 = nothing)
+static bool wd_running = false;
+static pthread_t wd_thread;
+static pthread_mutex_t wd_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wd_cond;
+
+static uint64_t wd_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// New deadline: only worth waking the thread if it's sooner than its own
+static void wd_set_deadline_locked(struct wd_ring *r, uint64_t now) {
+  r->deadline_ns = now + (uint64_t)r->timeout_ms * 1000000ull;
+  if (!wd_next_ns || r->deadline_ns < wd_next_ns)
+    pthread_cond_signal(&wd_cond);
+}
+
+static void *wd_main(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&wd_lock);
+  while (wd_running) {
+    uint64_t now = wd_now_ns(), next = 0;
+    uint32_t ring = AMDGPU_WATCHDOG_MAX_RINGS;
+    for (uint32_t i = 0; i < AMDGPU_WATCHDOG_MAX_RINGS; i++) {
+      struct wd_ring *r = &wd_rings[i];
+      if (!r->deadline_ns)
+        continue;
+      if (r->deadline_ns <= now && ring == AMDGPU_WATCHDOG_MAX_RINGS)
+        ring = i;
+      else if (!next || r->deadline_ns < next)
+        next = r->deadline_ns;
+    }
+
+    if (ring < AMDGPU_WATCHDOG_MAX_RINGS) {
+      // Off the clock until the fence moves or new work shows up
+      struct wd_ring *r = &wd_rings[ring];
+      uint64_t stuck = r->signaled + 1, last = r->armed;
+      r->deadline_ns = 0;
+      wd_stats.hangs++;
+      amdgpu_watchdog_fn fn = wd_on_hang;
+      void *priv = wd_priv;
+      pthread_mutex_unlock(&wd_lock);
+      os_prim_log("HAL Watchdog: Ring %u stuck at seq %llu (%llu on it)\n",
+                  ring, (unsigned long long)stuck, (unsigned long long)last);
+      if (fn)
+        fn(priv, ring, stuck, last);
+      pthread_mutex_lock(&wd_lock);
+      continue;
+    }
+
+    wd_next_ns = next;
+    if (!next) {
+      pthread_cond_wait(&wd_cond, &wd_lock);
+    } else {
+      struct timespec ts = {(time_t)(next / 1000000000ull),
+                            (long)(next % 1000000000ull)};
+      pthread_cond_timedwait(&wd_cond, &wd_lock, &ts);
+    }
+    wd_next_ns = 0;
+    wd_stats.wakeups++;
+  }
+  pthread_mutex_unlock(&wd_lock);
+  return NULL;
+}
+
+// on_hang runs on the watchdog thread with (ring, first stuck seq, last seq
+// on the ring). Rings start unwatched until they get a timeout.
+int amdgpu_watchdog_init(amdgpu_watchdog_fn on_hang, void *priv) {
+  pthread_mutex_lock(&wd_lock);
+  if (wd_running) {
+    pthread_mutex_unlock(&wd_lock);
+    return -1;
+  }
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&wd_cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  memset(wd_rings, 0, sizeof(wd_rings));
+  memset(&wd_stats, 0, sizeof(wd_stats));
+  wd_on_hang = on_hang;
+  wd_priv = priv;
+  wd_next_ns = 0;
+  wd_running = true;
+  if (pthread_create(&wd_thread, NULL, wd_main, NULL) != 0) {
+    wd_running = false;
+    pthread_cond_destroy(&wd_cond);
+    pthread_mutex_unlock(&wd_lock);
+    return -1;
+  }
+  pthread_mutex_unlock(&wd_lock);
+  return 0;
+}
+
+void amdgpu_watchdog_fini(void) {
+  pthread_mutex_lock(&wd_lock);
+  if (!wd_running) {
+    pthread_mutex_unlock(&wd_lock);
+    return;
+  }
+  wd_running = false;
+  pthread_cond_signal(&wd_cond);
+  pthread_mutex_unlock(&wd_lock);
+  pthread_join(wd_thread, NULL);
+  pthread_cond_destroy(&wd_cond);
+}
+
+// 0 stops watching the ring
+int amdgpu_watchdog_set_timeout(uint32_t ring, uint32_t timeout_ms) {
+  if (ring >= AMDGPU_WATCHDOG_MAX_RINGS)
+    return -1;
+  pthread_mutex_lock(&wd_lock);
+  struct wd_ring *r = &wd_rings[ring];
+  r->timeout_ms = timeout_ms;
+  r->deadline_ns = 0;
+  if (wd_running && timeout_ms && r->armed > r->signaled)
+    wd_set_deadline_locked(r, wd_now_ns());
+  pthread_mutex_unlock(&wd_lock);
+  return 0;
+}
+
+// seq was put on the ring
+void amdgpu_watchdog_arm(uint32_t ring, uint64_t seq) {
+  if (ring >= AMDGPU_WATCHDOG_MAX_RINGS)
+    return;
+  pthread_mutex_lock(&wd_lock);
+  struct wd_ring *r = &wd_rings[ring];
+  if (seq > r->armed) {
+    bool idle = r->armed <= r->signaled;
+    r->armed = seq;
+    wd_stats.arms++;
+    // Busy rings already have a deadline; one that hung gets a new one
+    if (wd_running && r->timeout_ms && (idle || !r->deadline_ns))
+      wd_set_deadline_locked(r, wd_now_ns());
+  }
+  pthread_mutex_unlock(&wd_lock);
+}
+
+// The ring's fence reached seq
+void amdgpu_watchdog_signal(uint32_t ring, uint64_t seq) {
+  if (ring >= AMDGPU_WATCHDOG_MAX_RINGS)
+    return;
+  pthread_mutex_lock(&wd_lock);
+  struct wd_ring *r = &wd_rings[ring];
+  if (seq > r->signaled) {
+    r->signaled = seq;
+    wd_stats.signals++;
+    if (r->signaled >= r->armed)
+      r->deadline_ns = 0; // Idle
+    else if (wd_running && r->timeout_ms)
+      r->deadline_ns = wd_now_ns() + (uint64_t)r->timeout_ms * 1000000ull;
+  }
+  pthread_mutex_unlock(&wd_lock);
+}
+
+void amdgpu_watchdog_get_stats(struct amdgpu_watchdog_stats *out) {
+  if (!out)
+    return;
+  pthread_mutex_lock(&wd_lock);
+  *out = wd_stats;
+  pthread_mutex_unlock(&wd_lock);
+}
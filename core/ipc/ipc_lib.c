@@ -3,6 +3,8 @@
 #define _GNU_SOURCE
 #endif
 #include "ipc_lib.h"
+#include "ipc_protocol.h"
+#include "../../os/interface/os_trace.h"
 #include <fcntl.h>
 #include <pthread.h>
 #include <stdio.h>
@@ -12,6 +14,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -20,6 +23,17 @@
  */
 
 static pthread_mutex_t ipc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t ipc_next_id = 0; // Process-wide: pid + id names a request
+static __thread const char *ipc_call_open = NULL; // Traced call waiting for its reply
+
+static const char *const ipc_req_names[] = {
+    "ALLOC_MEMORY", "GET_GPU_INFO", "FREE_MEMORY", "SUBMIT_COMMAND",
+    "SET_DISPLAY_MODE", "ACQUIRE_ENGINE", "RELEASE_ENGINE", "2D_BLIT",
+    "2D_FILL", "WAIT_FENCE", "IMPORT_USERPTR", "RELEASE_USERPTR",
+    "INVALIDATE_USERPTR", "PRIME_EXPORT", "PRIME_IMPORT", "PRIME_FENCE",
+    "GET_RESIDENCY_STATS", "GET_CLIENT_STATS", "SET_CLIENT_QUOTA", "SYNCOBJ",
+    "SYNCOBJ_WAIT", "SUBMIT_COMMAND_DEPS", "USERQ", "BO_LIST",
+};
 
 #define HIT_SHM_SIZE (1024 * 1024) // 1MB fast-track
 #define HIT_SHM_NAME "/hit_subway_shm"
@@ -87,6 +101,7 @@ int ipc_client_connect(const char *socket_path, ipc_connection_t *conn) {
     close(conn->sock_fd);
     return -1;
   }
+  conn->client = 1;
 
   // Map the Fast-Path
   int shm_fd = shm_open(HIT_SHM_NAME, O_RDWR, 0666);
@@ -100,11 +115,17 @@ int ipc_client_connect(const char *socket_path, ipc_connection_t *conn) {
   return 0;
 }
 
-// Sending a message through the tunnel
-int ipc_send_message(ipc_connection_t *conn, ipc_message_t *msg) {
-  if (!conn || !msg)
-    return -1;
+const char *ipc_message_name(uint32_t type) {
+  if (type >= IPC_REQ_ALLOC_MEMORY &&
+      type - IPC_REQ_ALLOC_MEMORY < sizeof(ipc_req_names) / sizeof(ipc_req_names[0]))
+    return ipc_req_names[type - IPC_REQ_ALLOC_MEMORY];
+  if (type >= IPC_REQ_VK_CREATE_INSTANCE && type < 300)
+    return "VK"; // Too many to list, the span carries the type
+  return "IPC";
+}
 
+// The header, then the payload unless it's already in SHM
+static int ipc_send_raw(ipc_connection_t *conn, ipc_message_t *msg) {
   pthread_mutex_lock(&ipc_mutex);
 
   // If data is already in SHM (pointer in range), don't send it via socket!
@@ -138,11 +159,31 @@ int ipc_send_message(ipc_connection_t *conn, ipc_message_t *msg) {
   return 0;
 }
 
-// Receiving a message from the tunnel
-int ipc_recv_message(ipc_connection_t *conn, ipc_message_t *msg) {
+// Sending a message through the tunnel
+int ipc_send_message(ipc_connection_t *conn, ipc_message_t *msg) {
   if (!conn || !msg)
     return -1;
 
+  if (conn->client) {
+    // Numbered here, the server answers with the same id: with the pid that
+    // is what ties the two halves of a call together in a trace
+    msg->id = __atomic_add_fetch(&ipc_next_id, 1, __ATOMIC_RELAXED);
+    if (os_trace_enabled()) {
+      ipc_call_open = ipc_message_name(msg->type);
+      os_trace_begin(OS_TRACE_IPC, ipc_call_open, "type", msg->type);
+      os_trace_flow_start(OS_TRACE_FLOW_REQUEST(getpid(), msg->id));
+    }
+  }
+
+  int ret = ipc_send_raw(conn, msg);
+  if (ret < 0 && ipc_call_open) {
+    os_trace_end(OS_TRACE_IPC, ipc_call_open); // No reply is coming
+    ipc_call_open = NULL;
+  }
+  return ret;
+}
+
+static int ipc_recv_raw(ipc_connection_t *conn, ipc_message_t *msg) {
   ssize_t recvd = recv(conn->sock_fd, msg, sizeof(ipc_message_t), 0);
   if (recvd <= 0)
     return recvd;
@@ -171,6 +212,79 @@ int ipc_recv_message(ipc_connection_t *conn, ipc_message_t *msg) {
   return 1;
 }
 
+// Receiving a message from the tunnel
+int ipc_recv_message(ipc_connection_t *conn, ipc_message_t *msg) {
+  if (!conn || !msg)
+    return -1;
+
+  int ret = ipc_recv_raw(conn, msg);
+  if (conn->client && ipc_call_open) {
+    if (ret > 0)
+      os_trace_flow_end(OS_TRACE_FLOW_REPLY(getpid(), msg->id));
+    os_trace_end(OS_TRACE_IPC, ipc_call_open);
+    ipc_call_open = NULL;
+  }
+  return ret;
+}
+
+// Handing a file descriptor through the tunnel (SCM_RIGHTS)
+int ipc_send_fd(ipc_connection_t *conn, int fd) {
+  if (!conn || fd < 0)
+    return -1;
+
+  char byte = 'F';
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  memset(cbuf, 0, sizeof(cbuf));
+
+  struct msghdr mh;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = cbuf;
+  mh.msg_controllen = sizeof(cbuf);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  pthread_mutex_lock(&ipc_mutex);
+  ssize_t sent = sendmsg(conn->sock_fd, &mh, 0);
+  pthread_mutex_unlock(&ipc_mutex);
+
+  return sent == 1 ? 0 : -1;
+}
+
+// Picking up a file descriptor from the tunnel
+int ipc_recv_fd(ipc_connection_t *conn) {
+  if (!conn)
+    return -1;
+
+  char byte;
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+  char cbuf[CMSG_SPACE(sizeof(int))];
+
+  struct msghdr mh;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = cbuf;
+  mh.msg_controllen = sizeof(cbuf);
+
+  if (recvmsg(conn->sock_fd, &mh, MSG_WAITALL) != 1)
+    return -1;
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    return -1;
+
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  return fd;
+}
+
 // Closing the connection
 void ipc_close(ipc_connection_t *conn) {
   if (!conn)
@@ -12,12 +12,13 @@ typedef struct {
     void* shm_addr;  // Shared memory for zero-copy
     size_t shm_size;
     int epoll_fd;  // For async (optional)
+    int client;  // Set by ipc_client_connect: requests get ids, calls get traced
 } ipc_connection_t;
 
 // Messages
 typedef struct {
     uint32_t type;  // e.g., IPC_ALLOC_BUFFER
-    uint32_t id;    // Request ID
+    uint32_t id;    // Request ID (clients: filled in by ipc_send_message)
     size_t data_size;
     void* data;     // Zero-copy via shm
 } ipc_message_t;
@@ -34,6 +35,15 @@ int ipc_send_message(ipc_connection_t* conn, ipc_message_t* msg);
 // Receive message (async)
 int ipc_recv_message(ipc_connection_t* conn, ipc_message_t* msg);
 
+// Pass a file descriptor to the other side (memfd, dma-buf, eventfd...)
+int ipc_send_fd(ipc_connection_t* conn, int fd);
+
+// Receive a file descriptor sent with ipc_send_fd (returns the new fd or -1)
+int ipc_recv_fd(ipc_connection_t* conn);
+
+// Short name of an IPC_REQ_* type, for traces (never NULL)
+const char* ipc_message_name(uint32_t type);
+
 // Cleanup
 void ipc_close(ipc_connection_t* conn);
 
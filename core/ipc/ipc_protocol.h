@@ -20,6 +20,22 @@
 #define IPC_REQ_2D_BLIT 108
 #define IPC_REQ_2D_FILL 109
 #define IPC_REQ_WAIT_FENCE 110
+// Zero-copy Memory Requests
+#define IPC_REQ_IMPORT_USERPTR 111
+#define IPC_REQ_RELEASE_USERPTR 112
+#define IPC_REQ_INVALIDATE_USERPTR 113
+#define IPC_REQ_PRIME_EXPORT 114
+#define IPC_REQ_PRIME_IMPORT 115
+#define IPC_REQ_PRIME_FENCE 116
+#define IPC_REQ_GET_RESIDENCY_STATS 117 // Reply: struct amdgpu_residency_stats
+#define IPC_REQ_GET_CLIENT_STATS 118    // Reply: struct rmapi_client_stats[]
+#define IPC_REQ_SET_CLIENT_QUOTA 119
+// Explicit sync
+#define IPC_REQ_SYNCOBJ 120
+#define IPC_REQ_SYNCOBJ_WAIT 121
+#define IPC_REQ_SUBMIT_COMMAND_DEPS 122
+#define IPC_REQ_USERQ 123
+#define IPC_REQ_BO_LIST 124
 // Vulkan Requests (starting at 201 to avoid conflicts)
 #define IPC_REQ_VK_CREATE_INSTANCE 201
 #define IPC_REQ_VK_ENUMERATE_PHYSICAL_DEVICES 202
@@ -130,6 +146,21 @@
 #define IPC_REP_2D_BLIT 308
 #define IPC_REP_2D_FILL 309
 #define IPC_REP_WAIT_FENCE 310
+// Zero-copy Memory Replies
+#define IPC_REP_IMPORT_USERPTR 311
+#define IPC_REP_RELEASE_USERPTR 312
+#define IPC_REP_INVALIDATE_USERPTR 313
+#define IPC_REP_PRIME_EXPORT 314
+#define IPC_REP_PRIME_IMPORT 315
+#define IPC_REP_PRIME_FENCE 316
+#define IPC_REP_GET_RESIDENCY_STATS 317
+#define IPC_REP_GET_CLIENT_STATS 318
+#define IPC_REP_SET_CLIENT_QUOTA 319
+#define IPC_REP_SYNCOBJ 320
+#define IPC_REP_SYNCOBJ_WAIT 321
+#define IPC_REP_SUBMIT_COMMAND_DEPS 322
+#define IPC_REP_USERQ 323
+#define IPC_REP_BO_LIST 324
 // Vulkan Replies (starting at 401)
 #define IPC_REP_VK_CREATE_INSTANCE 401
 #define IPC_REP_VK_ENUMERATE_PHYSICAL_DEVICES 402
@@ -231,4 +262,195 @@
 // Standard Socket Path
 #define HIT_SOCKET_PATH "/tmp/amdgpu_hit.sock"
 
+// --- Payloads (what rides along with the message) ---
+#include <stdint.h>
+
+// IPC_REQ_IMPORT_USERPTR: "Here are some pages I already own, let the GPU use them"
+#define IPC_USERPTR_FLAG_MEMFD (1u << 31) // A memfd follows the message (ipc_send_fd)
+
+struct ipc_userptr_request {
+  uint64_t addr;      // Start of the range in the client's address space (page aligned)
+  uint64_t size;      // Length in bytes (page aligned)
+  uint64_t fd_offset; // Offset of addr inside the memfd (MEMFD only, F_SEAL_SHRINK'd)
+  uint32_t flags;     // AMDGPU_USERPTR_FLAG_* | IPC_USERPTR_FLAG_MEMFD
+  int32_t pid;        // Owner of the range (checked against the socket peer)
+};
+
+struct ipc_userptr_reply {
+  int32_t result;     // 0 on success
+  uint32_t handle;    // Buffer handle for later submissions / release
+  uint64_t gpu_addr;  // Where the GPU sees it
+};
+
+// IPC_REQ_INVALIDATE_USERPTR: "I'm about to munmap this, stop using it"
+struct ipc_userptr_invalidate {
+  uint64_t addr;
+  uint64_t size;
+};
+
+// IPC_REQ_ALLOC_MEMORY: payload is the size_t size. The reply starts with the
+// address (0 on failure), so clients that only read a uint64_t keep working;
+// the handle after it is what PRIME_EXPORT and BO lists want.
+struct ipc_alloc_reply {
+  uint64_t gpu_addr;
+  uint32_t handle;
+  uint32_t pad;
+};
+
+// IPC_REQ_PRIME_EXPORT: payload is the uint32_t handle, which the caller must
+// hold. Reply is an int32_t result; on success the fd follows the reply
+// (ipc_recv_fd).
+// IPC_REQ_PRIME_IMPORT: no payload, the fd follows the message (ipc_send_fd).
+// Buffers are released with IPC_REQ_FREE_MEMORY like any other buffer.
+struct ipc_prime_import_reply {
+  int32_t result;
+  uint32_t handle;
+  uint64_t gpu_addr;
+  uint64_t size;
+};
+
+// IPC_REQ_PRIME_FENCE: implicit sync on a shared buffer
+#define IPC_PRIME_FENCE_ATTACH 0 // Writer starts, reply carries the new seq
+#define IPC_PRIME_FENCE_SIGNAL 1 // Writer is done with seq
+#define IPC_PRIME_FENCE_WAIT 2   // Reader waits for the last write (result 1 = timeout)
+
+struct ipc_prime_fence {
+  uint32_t handle;
+  uint32_t op;         // IPC_PRIME_FENCE_*
+  uint64_t seq;
+  uint64_t timeout_ns; // WAIT only
+};
+
+struct ipc_prime_fence_reply {
+  int32_t result;
+  uint32_t pad;
+  uint64_t seq;
+};
+
+// IPC_REQ_GET_CLIENT_STATS: payload is an int32_t pid (0 = me, -1 = everybody).
+// Reply is one struct rmapi_client_stats per client (empty if pid is unknown).
+// Anybody but yourself is for the server's own user (or root), like quotas.
+#define IPC_CLIENT_STATS_ALL (-1)
+
+// IPC_REQ_SET_CLIENT_QUOTA: only the server's own user (or root) may do this.
+// Reply is an int32_t result.
+struct ipc_client_quota {
+  int32_t pid;     // 0 = me
+  uint32_t heap;   // RMAPI_CLIENT_HEAP_*
+  uint64_t bytes;  // 0 = unlimited
+};
+
+// IPC_REQ_SYNCOBJ: one operation on a timeline syncobj. Everything but
+// CREATE needs the syncobj to be yours, or shared with you by its owner
+// (waits and submits that name syncobjs too).
+#define IPC_SYNCOBJ_CREATE 0           // point = initial value, reply carries the handle
+#define IPC_SYNCOBJ_DESTROY 1          // Owner only
+#define IPC_SYNCOBJ_SIGNAL 2
+#define IPC_SYNCOBJ_RESET 3            // Back to 0 (binary fences)
+#define IPC_SYNCOBJ_QUERY 4            // Reply point = last signaled point
+#define IPC_SYNCOBJ_EXPORT_EVENTFD 5   // On success the fd follows the reply
+#define IPC_SYNCOBJ_EXPORT_SYNC_FILE 6 // Same, DRM mode only
+#define IPC_SYNCOBJ_SHARE 7            // Owner only: point = pid that may use it too
+
+struct ipc_syncobj {
+  uint32_t handle;
+  uint32_t op;    // IPC_SYNCOBJ_*
+  uint64_t point;
+};
+
+struct ipc_syncobj_reply {
+  int32_t result;
+  uint32_t handle; // CREATE: new handle. Waits: index of a point that is done
+  uint64_t point;
+};
+
+// IPC_REQ_SYNCOBJ_WAIT (and IPC_REQ_VK_WAIT_FOR_FENCES, where every point is 1):
+// this header, then count struct rmapi_syncobj_point. Reply is a
+// struct ipc_syncobj_reply, result 1 = timed out.
+struct ipc_syncobj_wait {
+  uint32_t count;
+  uint32_t flags;      // RMAPI_SYNCOBJ_WAIT_ALL
+  uint64_t timeout_ns;
+};
+
+// IPC_REQ_SUBMIT_COMMAND: the GFX commands, nothing else. The reply (int32_t)
+// comes once they're validated and queued, not run: 0 only means accepted.
+// Use IPC_REQ_SUBMIT_COMMAND_DEPS to get a fence to wait on. -1 also when the
+// client has RMAPI_SCHED_MAX_CLIENT_JOBS jobs out already (try again later).
+//
+// IPC_REQ_SUBMIT_COMMAND_DEPS: this header, dep_count struct rmapi_sched_dep,
+// signal_count struct rmapi_syncobj_point, then the commands. The job waits in
+// the server until its dependencies are done; the reply comes right away.
+struct ipc_submit_deps {
+  uint32_t engine;      // RMAPI_CLIENT_ENGINE_*
+  uint32_t dep_count;
+  uint32_t signal_count;
+  uint32_t bo_list;     // IPC_REQ_BO_LIST handle (0 = none)
+};
+
+struct ipc_submit_reply {
+  int32_t result;
+  uint32_t engine;
+  uint64_t seq;         // The job's fence, for IPC_REQ_WAIT_FENCE or other deps
+};
+
+// IPC_REQ_WAIT_FENCE: reply is an int32_t (0 = done, 1 = timed out)
+struct ipc_fence_wait {
+  uint32_t engine;
+  uint32_t pad;
+  uint64_t seq;
+  uint64_t timeout_ns;
+};
+
+// IPC_REQ_USERQ: create or destroy a user-mode queue. CREATE replies with
+// the queue's layout and the fd to map follows the reply. What the queue's
+// packets may touch is the BO list named at CREATE; patch the list with
+// IPC_BO_LIST_UPDATE as the working set changes.
+#define IPC_USERQ_CREATE 0
+#define IPC_USERQ_DESTROY 1
+
+struct ipc_userq {
+  uint32_t op;         // IPC_USERQ_*
+  uint32_t engine;     // CREATE: RMAPI_CLIENT_ENGINE_*
+  uint32_t ring_bytes; // CREATE: rounded up to a power of two
+  uint32_t id;         // DESTROY
+  uint32_t bo_list;    // CREATE: IPC_REQ_BO_LIST handle (0 = none)
+  uint32_t pad;
+};
+
+struct ipc_userq_reply {
+  int32_t result;
+  uint32_t id;
+  uint32_t syncobj;         // Wait on it (point = submit's wptr) to sleep
+  uint32_t ring_dw;
+  uint32_t doorbell_offset;
+  uint32_t pad;
+  uint64_t size;            // Bytes to mmap from the fd
+};
+
+// IPC_REQ_BO_LIST: this header, count struct rmapi_bo_list_entry, then
+// remove_count uint32_t buffer handles (UPDATE only). Reply is a
+// struct ipc_bo_list_reply. Submits name the list in ipc_submit_deps.
+#define IPC_BO_LIST_CREATE 0
+#define IPC_BO_LIST_UPDATE 1 // Entries are added or changed, removes leave
+#define IPC_BO_LIST_DESTROY 2
+
+struct ipc_bo_list {
+  uint32_t op;           // IPC_BO_LIST_*
+  uint32_t handle;       // UPDATE / DESTROY
+  uint32_t count;
+  uint32_t remove_count;
+};
+
+struct ipc_bo_list_reply {
+  int32_t result;
+  uint32_t handle;       // CREATE: the new list
+};
+
+// Vulkan fences and semaphores are syncobjs too:
+// VK_CREATE_FENCE: uint32_t flags (bit 0 = start signaled), VK_CREATE_SEMAPHORE:
+// optional uint64_t initial value. Both reply with a struct ipc_syncobj_reply.
+// VK_DESTROY_*: uint32_t handle. VK_RESET_FENCES: uint32_t handles[].
+// VK_GET_FENCE_STATUS: uint32_t handle, reply 0 = signaled, 1 = not yet.
+
 #endif
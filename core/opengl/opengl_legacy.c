@@ -8,6 +8,7 @@
 #include "opengl_interface.h"
 #include "../gpu/objgpu.h"
 #include "../hal/hal.h"
+#include "../../os/os_interface.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -103,8 +104,9 @@ rmapi_gl_drawable *rmapi_gl_create_drawable(uint32_t width, uint32_t height) {
     rmapi_gl_drawable *drawable = (rmapi_gl_drawable *)malloc(sizeof(rmapi_gl_drawable));
     if (!drawable) return NULL;
     
-    /* Allocate framebuffer (simplified) */
-    void *fb = malloc(width * height * 4); /* RGBA */
+    /* Allocate framebuffer (huge pages + NUMA local, scanned out every frame) */
+    void *fb = os_get_interface()->alloc_ex((size_t)width * height * 4, 0,
+                                            OS_ALLOC_USAGE_FRAMEBUFFER, 0); /* RGBA */
     if (!fb) {
         free(drawable);
         return NULL;
@@ -121,7 +123,7 @@ rmapi_gl_drawable *rmapi_gl_create_drawable(uint32_t width, uint32_t height) {
 void rmapi_gl_destroy_drawable(rmapi_gl_drawable *drawable) {
     if (!drawable) return;
     if (drawable->handle) {
-        free(drawable->handle);
+        os_get_interface()->free(drawable->handle);
     }
     free(drawable);
 }
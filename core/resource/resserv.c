@@ -4,26 +4,28 @@
 
 #include "../../os/interface/os_primitives.h"
 #include "../hal/hal.h"
+#include <pthread.h>
 #include <string.h>
 
 // RESSERV: Resource hierarchy management
-// Thread-safety: Use os_prim_lock/unlock for multi-threaded access if needed
+// Thread-safety: the hash table is shared by every server thread, so it has its own lock
 
 #define RS_HASH_SIZE 128
 static struct RsResource *rs_hash_table[RS_HASH_SIZE];
+static pthread_mutex_t rs_hash_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int rs_hash(uint32_t handle) { return handle % RS_HASH_SIZE; }
 
 static void rs_hash_add(struct RsResource *res) {
-  /* Lock needed if concurrent access: os_prim_lock(); */
+  pthread_mutex_lock(&rs_hash_lock);
   int idx = rs_hash(res->handle);
   res->hash_next = rs_hash_table[idx];
   rs_hash_table[idx] = res;
-  /* Unlock: os_prim_unlock(); */
+  pthread_mutex_unlock(&rs_hash_lock);
 }
 
 static void rs_hash_remove(struct RsResource *res) {
-  /* Lock needed if concurrent access: os_prim_lock(); */
+  pthread_mutex_lock(&rs_hash_lock);
   int idx = rs_hash(res->handle);
   struct RsResource **curr = &rs_hash_table[idx];
   while (*curr) {
@@ -33,21 +35,21 @@ static void rs_hash_remove(struct RsResource *res) {
     }
     curr = &((*curr)->hash_next);
   }
-  /* Unlock: os_prim_unlock(); */
+  pthread_mutex_unlock(&rs_hash_lock);
 }
 
 struct RsResource *rs_resource_lookup(uint32_t handle) {
-  /* Lock needed if concurrent access: os_prim_lock(); */
+  pthread_mutex_lock(&rs_hash_lock);
   int idx = rs_hash(handle);
   struct RsResource *curr = rs_hash_table[idx];
   while (curr) {
     if (curr->handle == handle) {
-      /* Unlock: os_prim_unlock(); */
+      pthread_mutex_unlock(&rs_hash_lock);
       return curr;
     }
     curr = curr->hash_next;
   }
-  /* Unlock: os_prim_unlock(); */
+  pthread_mutex_unlock(&rs_hash_lock);
   return NULL;
 }
 
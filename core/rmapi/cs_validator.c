@@ -0,0 +1,871 @@
+#include "rmapi.h"
+#include "../../drivers/amdgpu/pm4_builder.h"
+#include "../../src/amd/amdgpu/navi10_sdma_pkt_open.h"
+#include "../../os/os_interface.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the CS Validator - the metal detector in front of the CP.
+ * In shared-server mode one client's garbage would hang the GPU for
+ * everybody, so every stream gets walked before it's submitted:
+ *
+ *   - Each opcode has a row in a table: allowed or not, how long its packet
+ *     may be, and (if it touches memory or registers) a small checker.
+ *   - Register writes must land in the allow-list below.
+ *   - Every address (fences, copies, index buffers, IBs...) must sit inside
+ *     a BO of this submission. No BO list, no memory access.
+ *   - IBs are followed: chains as a jump, nested IBs one level deep.
+ *
+ * IBs live in the client's BOs, and the client can still write those after
+ * we looked. So for the server (rmapi_cs_validate_shadow) every IB is copied
+ * out first, the copy is what gets checked, and the packet that called it is
+ * pointed at the copy. The CP runs exactly what we saw; the copies stay with
+ * the job until its fence retires.
+ *
+ * Each IB is checked on its own, starting from "nothing known" (no SET_BASE,
+ * 32-bit indices), so a verdict doesn't depend on who jumped into it.
+ * That's what lets us cache it: IBs that passed are remembered by a hash of
+ * their dwords + the BO list, and replaying the same command buffer skips
+ * straight past them. The hash is seeded at random and only picks the slot;
+ * a hit also needs the dwords to match the copy kept in the cache. IBs that
+ * jump into other IBs aren't cached (their children could have changed), but
+ * those are tiny anyway.
+ *
+ * AMDGPU_CS_VALIDATE=0 turns it off (single trusted client).
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define CS_CACHE_SIZE 1024 // Power of two
+#define CS_MAX_IB_DEPTH 2  // Submitted stream -> IB, no deeper
+#define CS_MAX_CHAINS 256  // Chained IBs per stream (stops loops)
+#define CS_MAX_DWORDS (1u << 22)
+#define CS_INDEX_SIZE_UNKNOWN 4
+#define CS_NO_CHAIN 0xFFFFFFFFu
+#define CS_CACHE_MAX_DW 16384 // Bigger IBs are walked every time
+
+struct cs_range {
+  uint64_t start, end; // GPU VA [start, end)
+  const uint8_t *cpu;  // To read IBs that live there
+};
+
+struct cs_state {
+  uint64_t indirect_base; // From SET_BASE (0 = not set)
+  uint32_t index_size;    // From INDEX_TYPE
+  const uint32_t *chain;  // Chain packet seen: jump here...
+  uint32_t chain_ndw;     // ...for this many dwords
+};
+
+// One IB copied out of client memory; the stream points at dw now
+struct cs_shadow_ib {
+  struct cs_shadow_ib *next;
+  struct amdgpu_buffer buf; // The copy, as the job's buffer list sees it
+  uint64_t ndw;
+  uint32_t dw[];
+};
+
+struct rmapi_cs_shadow {
+  struct cs_shadow_ib *ibs;
+  struct amdgpu_buffer **bufs; // Every ibs->buf, for rmapi_cs_shadow_hold
+  uint32_t nbufs;
+};
+
+struct cs_ctx {
+  uint32_t engine;
+  struct rmapi_cs_shadow *shadow; // Copying IBs (NULL: checked in place)
+  struct cs_range *ranges; // Sorted by start
+  uint32_t nranges;
+  uint64_t bo_key;
+  uint32_t total_dw;
+  uint32_t chains;
+  const char *error;
+  uint32_t error_dw, error_op, error_depth;
+};
+
+struct cs_cache_entry {
+  uint64_t key;
+  uint32_t ndw;
+  uint32_t chain_at; // Dword of the trailing chain packet, or CS_NO_CHAIN
+  uint32_t *dw;      // What passed, compared on every hit
+};
+
+static struct cs_cache_entry cs_cache[CS_CACHE_SIZE];
+static struct rmapi_cs_stats cs_stats;
+static pthread_mutex_t cs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t cs_seed_once = PTHREAD_ONCE_INIT;
+static uint64_t cs_seed;
+static int cs_enabled = -1;
+
+static uint64_t cs_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Per-process hash seed: nobody outside can aim two IBs at the same slot
+static void cs_seed_init(void) {
+  int fd = open("/dev/urandom", O_RDONLY);
+  if (fd < 0 || read(fd, &cs_seed, sizeof(cs_seed)) != (ssize_t)sizeof(cs_seed))
+    cs_seed = cs_now_ns() ^ ((uint64_t)getpid() << 32) ^ (uint64_t)(uintptr_t)&cs_seed;
+  if (fd >= 0)
+    close(fd);
+}
+
+/* --- Register allow-list (dword offsets) --- */
+
+struct cs_reg_range {
+  uint32_t start, end; // [start, end)
+};
+
+static const struct cs_reg_range cs_allowed_regs[] = {
+    {PACKET3_SET_SH_REG_START, PACKET3_SET_SH_REG_END},           // Shader state
+    {PACKET3_SET_CONTEXT_REG_START, PACKET3_SET_CONTEXT_REG_END}, // Pipeline state
+    {0xC240, 0xC280}, // UCONFIG: VGT/GE draw state (prim type, index type, instances)
+};
+
+static int cs_regs_allowed(uint32_t reg, uint32_t n) {
+  for (size_t i = 0; i < sizeof(cs_allowed_regs) / sizeof(cs_allowed_regs[0]); i++)
+    if (reg >= cs_allowed_regs[i].start && reg + n <= cs_allowed_regs[i].end)
+      return 1;
+  return 0;
+}
+
+/* --- Address checks --- */
+
+static int cs_fail(struct cs_ctx *ctx, const char *why) {
+  if (!ctx->error)
+    ctx->error = why;
+  return -1;
+}
+
+// The BO holding [va, va + bytes), or NULL
+static const struct cs_range *cs_find(struct cs_ctx *ctx, uint64_t va,
+                                      uint64_t bytes) {
+  uint32_t lo = 0, hi = ctx->nranges;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (ctx->ranges[mid].end <= va)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < ctx->nranges && ctx->ranges[lo].start <= va &&
+      bytes <= ctx->ranges[lo].end - va)
+    return &ctx->ranges[lo];
+  return NULL;
+}
+
+static int cs_check_va(struct cs_ctx *ctx, uint32_t lo, uint32_t hi,
+                       uint64_t bytes) {
+  uint64_t va = ((uint64_t)hi << 32) | lo;
+  if (bytes && !cs_find(ctx, va, bytes))
+    return cs_fail(ctx, "address outside the submission's BOs");
+  return 0;
+}
+
+/* --- PM4 --- */
+
+// body[] is everything after the header, n dwords of it
+typedef int (*cs_pm4_check_fn)(struct cs_ctx *ctx, struct cs_state *st,
+                               const uint32_t *body, uint32_t n,
+                               uint32_t depth);
+
+struct cs_pm4_desc {
+  uint8_t allowed;
+  uint16_t min_body, max_body; // max 0 = no limit
+  cs_pm4_check_fn check;
+};
+
+static int cs_check_ib(struct cs_ctx *ctx, const uint32_t *dw, uint32_t ndw,
+                       uint32_t depth);
+
+static int cs_pm4_set_reg(struct cs_ctx *ctx, uint32_t base, const uint32_t *body,
+                          uint32_t n) {
+  if (!cs_regs_allowed(base + (body[0] & 0xFFFF), n - 1))
+    return cs_fail(ctx, "register write outside the allow-list");
+  return 0;
+}
+
+static int cs_pm4_set_sh_reg(struct cs_ctx *ctx, struct cs_state *st,
+                             const uint32_t *body, uint32_t n, uint32_t depth) {
+  (void)st, (void)depth;
+  return cs_pm4_set_reg(ctx, PACKET3_SET_SH_REG_START, body, n);
+}
+
+static int cs_pm4_set_context_reg(struct cs_ctx *ctx, struct cs_state *st,
+                                  const uint32_t *body, uint32_t n,
+                                  uint32_t depth) {
+  (void)st, (void)depth;
+  return cs_pm4_set_reg(ctx, PACKET3_SET_CONTEXT_REG_START, body, n);
+}
+
+static int cs_pm4_set_uconfig_reg(struct cs_ctx *ctx, struct cs_state *st,
+                                  const uint32_t *body, uint32_t n,
+                                  uint32_t depth) {
+  (void)st, (void)depth;
+  return cs_pm4_set_reg(ctx, PACKET3_SET_UCONFIG_REG_START, body, n);
+}
+
+static int cs_pm4_set_base(struct cs_ctx *ctx, struct cs_state *st,
+                           const uint32_t *body, uint32_t n, uint32_t depth) {
+  (void)n, (void)depth;
+  if (body[0] != 1) // Only the draw/dispatch indirect base
+    return cs_fail(ctx, "SET_BASE of an unsupported base");
+  st->indirect_base = ((uint64_t)body[2] << 32) | body[1];
+  if (!cs_find(ctx, st->indirect_base, 4))
+    return cs_fail(ctx, "indirect base outside the submission's BOs");
+  return 0;
+}
+
+// DISPATCH_INDIRECT / DRAW_INDIRECT / DRAW_INDEX_INDIRECT read args at base + offset
+static int cs_pm4_indirect_args(struct cs_ctx *ctx, struct cs_state *st,
+                                uint32_t offset, uint64_t bytes) {
+  if (!st->indirect_base)
+    return cs_fail(ctx, "indirect draw/dispatch without SET_BASE in this IB");
+  uint64_t va = st->indirect_base + offset;
+  return cs_check_va(ctx, (uint32_t)va, (uint32_t)(va >> 32), bytes);
+}
+
+static int cs_pm4_dispatch_indirect(struct cs_ctx *ctx, struct cs_state *st,
+                                    const uint32_t *body, uint32_t n,
+                                    uint32_t depth) {
+  (void)n, (void)depth;
+  return cs_pm4_indirect_args(ctx, st, body[0], 12);
+}
+
+static int cs_pm4_draw_indirect(struct cs_ctx *ctx, struct cs_state *st,
+                                const uint32_t *body, uint32_t n,
+                                uint32_t depth) {
+  (void)n, (void)depth;
+  return cs_pm4_indirect_args(ctx, st, body[0], 16);
+}
+
+static int cs_pm4_draw_index_indirect(struct cs_ctx *ctx, struct cs_state *st,
+                                      const uint32_t *body, uint32_t n,
+                                      uint32_t depth) {
+  (void)n, (void)depth;
+  return cs_pm4_indirect_args(ctx, st, body[0], 20);
+}
+
+static int cs_pm4_index_type(struct cs_ctx *ctx, struct cs_state *st,
+                             const uint32_t *body, uint32_t n, uint32_t depth) {
+  (void)ctx, (void)n, (void)depth;
+  static const uint32_t sizes[4] = {2, 4, 1, CS_INDEX_SIZE_UNKNOWN};
+  st->index_size = sizes[body[0] & 3];
+  return 0;
+}
+
+static int cs_pm4_index_base(struct cs_ctx *ctx, struct cs_state *st,
+                             const uint32_t *body, uint32_t n, uint32_t depth) {
+  (void)n, (void)depth;
+  return cs_check_va(ctx, body[0], body[1], st->index_size);
+}
+
+static int cs_pm4_draw_index_2(struct cs_ctx *ctx, struct cs_state *st,
+                               const uint32_t *body, uint32_t n, uint32_t depth) {
+  (void)n, (void)depth;
+  return cs_check_va(ctx, body[1], body[2], (uint64_t)body[0] * st->index_size);
+}
+
+static int cs_pm4_write_data(struct cs_ctx *ctx, struct cs_state *st,
+                             const uint32_t *body, uint32_t n, uint32_t depth) {
+  (void)st, (void)depth;
+  if (((body[0] >> 8) & 0xF) != PM4_DST_MEM)
+    return cs_fail(ctx, "WRITE_DATA to something other than memory");
+  return cs_check_va(ctx, body[1], body[2], (uint64_t)(n - 3) * 4);
+}
+
+static int cs_pm4_wait_reg_mem(struct cs_ctx *ctx, struct cs_state *st,
+                               const uint32_t *body, uint32_t n, uint32_t depth) {
+  (void)st, (void)n, (void)depth;
+  if (!(body[0] & WAIT_REG_MEM_MEM_SPACE(PM4_SPACE_MEM)))
+    return cs_fail(ctx, "WAIT_REG_MEM on a register");
+  return cs_check_va(ctx, body[1], body[2], 4);
+}
+
+static int cs_pm4_event_write(struct cs_ctx *ctx, struct cs_state *st,
+                              const uint32_t *body, uint32_t n, uint32_t depth) {
+  (void)st, (void)depth;
+  return n >= 3 ? cs_check_va(ctx, body[1], body[2], 8) : 0;
+}
+
+static int cs_pm4_release_mem(struct cs_ctx *ctx, struct cs_state *st,
+                              const uint32_t *body, uint32_t n, uint32_t depth) {
+  (void)st, (void)n, (void)depth;
+  static const uint64_t bytes[8] = {0, 4, 8, 8, 0, 0, 0, 0};
+  uint32_t data_sel = (body[1] >> 29) & 7;
+  if (data_sel > PM4_DATA_SEL_TIMESTAMP)
+    return cs_fail(ctx, "RELEASE_MEM data source not allowed");
+  return cs_check_va(ctx, body[2], body[3], bytes[data_sel]);
+}
+
+static int cs_pm4_dma_data(struct cs_ctx *ctx, struct cs_state *st,
+                           const uint32_t *body, uint32_t n, uint32_t depth) {
+  (void)st, (void)n, (void)depth;
+  uint32_t src_sel = (body[0] >> 29) & 3, dst_sel = (body[0] >> 20) & 3;
+  uint64_t bytes = body[5] & 0x3FFFFFF;
+  if (body[5] & (PACKET3_DMA_DATA_CMD_SAS | PACKET3_DMA_DATA_CMD_DAS))
+    return cs_fail(ctx, "DMA_DATA to/from registers");
+  if (dst_sel != PM4_DMA_DATA_SEL_L2 ||
+      (src_sel != PM4_DMA_DATA_SEL_L2 && src_sel != PM4_DMA_DATA_SRC_DATA))
+    return cs_fail(ctx, "DMA_DATA through GDS or raw addresses");
+  if (src_sel == PM4_DMA_DATA_SEL_L2 && cs_check_va(ctx, body[1], body[2], bytes))
+    return -1;
+  return cs_check_va(ctx, body[3], body[4], bytes);
+}
+
+// Where an IB lives, as something we can read. NULL (and an error) if not ours.
+// When copying, that's our own copy of it.
+static const uint32_t *cs_ib_target(struct cs_ctx *ctx, uint64_t va,
+                                    uint32_t ndw) {
+  const struct cs_range *r = cs_find(ctx, va, (uint64_t)ndw * 4);
+  if (va & 3)
+    cs_fail(ctx, "misaligned IB");
+  else if (!r)
+    cs_fail(ctx, "IB outside the submission's BOs");
+  else if (!r->cpu)
+    cs_fail(ctx, "IB in a BO we can't inspect");
+  if (ctx->error)
+    return NULL;
+  const uint32_t *ib = (const uint32_t *)(r->cpu + (va - r->start));
+  if (!ctx->shadow)
+    return ib;
+
+  struct cs_shadow_ib *copy = os_prim_alloc(sizeof(*copy) + (size_t)ndw * 4);
+  if (!copy) {
+    cs_fail(ctx, "out of memory");
+    return NULL;
+  }
+  memset(&copy->buf, 0, sizeof(copy->buf));
+  copy->buf.cpu_addr = copy->dw;
+  copy->buf.gpu_addr = (uint64_t)(uintptr_t)copy->dw; // What cs_ib_repoint writes
+  copy->buf.size = (size_t)ndw * 4;
+  copy->ndw = ndw;
+  memcpy(copy->dw, ib, (size_t)ndw * 4);
+  copy->next = ctx->shadow->ibs;
+  ctx->shadow->ibs = copy;
+  pthread_mutex_lock(&cs_lock);
+  cs_stats.dwords_copied += ndw;
+  pthread_mutex_unlock(&cs_lock);
+  return copy->dw;
+}
+
+// Point the calling packet at our copy. Only while copying: then every dword
+// we walk is ours (the server's stream or an IB copy) and may be written.
+static int cs_ib_repoint(struct cs_ctx *ctx, const uint32_t *addr,
+                         const uint32_t *ib, uint32_t hi_mask) {
+  uint64_t va = (uint64_t)(uintptr_t)ib; // In userland the CP sees our pages here
+  uint32_t *out = (uint32_t *)addr;
+  if ((uint32_t)(va >> 32) & ~hi_mask)
+    return cs_fail(ctx, "IB copy out of the CP's reach");
+  out[0] = (uint32_t)va;
+  out[1] = (out[1] & ~hi_mask) | (uint32_t)(va >> 32);
+  return 0;
+}
+
+static int cs_pm4_indirect_buffer(struct cs_ctx *ctx, struct cs_state *st,
+                                  const uint32_t *body, uint32_t n,
+                                  uint32_t depth) {
+  (void)n;
+  uint64_t va = ((uint64_t)(body[1] & 0xFFFF) << 32) | body[0];
+  uint32_t ndw = body[2] & PM4_IB_SIZE_MASK;
+  const uint32_t *ib = cs_ib_target(ctx, va, ndw);
+  if (!ib || (ctx->shadow && cs_ib_repoint(ctx, body, ib, 0xFFFF) != 0))
+    return -1;
+
+  if (body[2] & PM4_IB_CHAIN) { // A jump: the caller carries on over there
+    st->chain = ib;
+    st->chain_ndw = ndw;
+    return 0;
+  }
+  if (depth + 1 >= CS_MAX_IB_DEPTH)
+    return cs_fail(ctx, "IBs nested too deep");
+  if (cs_check_ib(ctx, ib, ndw, depth + 1) != 0)
+    return -1;
+  // What the IB left behind is anyone's guess
+  st->indirect_base = 0;
+  st->index_size = CS_INDEX_SIZE_UNKNOWN;
+  return 0;
+}
+
+static const struct cs_pm4_desc cs_pm4_table[256] = {
+    [PACKET3_NOP] = {1, 1, 0, NULL},
+    [PACKET3_SET_BASE] = {1, 3, 3, cs_pm4_set_base},
+    [PACKET3_CLEAR_STATE] = {1, 1, 1, NULL},
+    [PACKET3_INDEX_BUFFER_SIZE] = {1, 1, 1, NULL},
+    [PACKET3_DISPATCH_DIRECT] = {1, 4, 4, NULL},
+    [PACKET3_DISPATCH_INDIRECT] = {1, 2, 2, cs_pm4_dispatch_indirect},
+    [PACKET3_DRAW_INDIRECT] = {1, 4, 4, cs_pm4_draw_indirect},
+    [PACKET3_DRAW_INDEX_INDIRECT] = {1, 4, 4, cs_pm4_draw_index_indirect},
+    [PACKET3_INDEX_BASE] = {1, 2, 2, cs_pm4_index_base},
+    [PACKET3_DRAW_INDEX_2] = {1, 5, 5, cs_pm4_draw_index_2},
+    [PACKET3_CONTEXT_CONTROL] = {1, 2, 2, NULL},
+    [PACKET3_INDEX_TYPE] = {1, 1, 1, cs_pm4_index_type},
+    [PACKET3_DRAW_INDEX_AUTO] = {1, 2, 2, NULL},
+    [PACKET3_NUM_INSTANCES] = {1, 1, 1, NULL},
+    [PACKET3_WRITE_DATA] = {1, 4, 0, cs_pm4_write_data},
+    [PACKET3_WAIT_REG_MEM] = {1, 6, 6, cs_pm4_wait_reg_mem},
+    [PACKET3_INDIRECT_BUFFER] = {1, 3, 3, cs_pm4_indirect_buffer},
+    [PACKET3_PFP_SYNC_ME] = {1, 1, 1, NULL},
+    [PACKET3_EVENT_WRITE] = {1, 1, 3, cs_pm4_event_write},
+    [PACKET3_RELEASE_MEM] = {1, 7, 7, cs_pm4_release_mem},
+    [PACKET3_PREAMBLE_CNTL] = {1, 1, 1, NULL},
+    [PACKET3_DMA_DATA] = {1, 6, 6, cs_pm4_dma_data},
+    [PACKET3_ACQUIRE_MEM] = {1, 6, 7, NULL}, // Cache flush by range, writes nothing
+    [PACKET3_SET_CONTEXT_REG] = {1, 2, 0, cs_pm4_set_context_reg},
+    [PACKET3_SET_SH_REG] = {1, 2, 0, cs_pm4_set_sh_reg},
+    [PACKET3_SET_UCONFIG_REG] = {1, 2, 0, cs_pm4_set_uconfig_reg},
+};
+
+static int cs_parse_pm4(struct cs_ctx *ctx, const uint32_t *dw, uint32_t ndw,
+                        uint32_t depth, uint32_t *chain_at,
+                        struct cs_state *st) {
+  for (uint32_t i = 0; i < ndw;) {
+    uint32_t h = dw[i];
+    ctx->error_dw = i;
+    ctx->error_op = 0xFFFFFFFFu;
+
+    if (CP_PACKET_GET_TYPE(h) == PACKET_TYPE2) { // Filler
+      i++;
+      continue;
+    }
+    if (CP_PACKET_GET_TYPE(h) != PACKET_TYPE3)
+      return cs_fail(ctx, "type-0/1 packet (raw register write)");
+
+    uint32_t op = CP_PACKET3_GET_OPCODE(h);
+    ctx->error_op = op;
+    if ((h & ~2u) == (uint32_t)PM4_NOP_DWORD) { // Single-dword NOP
+      i++;
+      continue;
+    }
+
+    const struct cs_pm4_desc *d = &cs_pm4_table[op];
+    uint32_t n = CP_PACKET_GET_COUNT(h) + 1;
+    if (!d->allowed)
+      return cs_fail(ctx, "opcode not allowed");
+    if (n > ndw - i - 1)
+      return cs_fail(ctx, "packet runs past the end of the IB");
+    if (n < d->min_body || (d->max_body && n > d->max_body))
+      return cs_fail(ctx, "bad packet length");
+    if (d->check && d->check(ctx, st, &dw[i + 1], n, depth) != 0)
+      return -1;
+    if (st->chain) { // Whatever follows a chain never runs
+      *chain_at = i;
+      return 0;
+    }
+    i += 1 + n;
+  }
+  return 0;
+}
+
+/* --- SDMA --- */
+
+#define CS_SDMA_OP(h) ((h) & 0xFF)
+#define CS_SDMA_SUB_OP(h) (((h) >> 8) & 0xFF)
+
+// Returns the packet size in dwords, or -1 after flagging the error
+typedef int (*cs_sdma_check_fn)(struct cs_ctx *ctx, const uint32_t *pkt,
+                                     uint32_t avail, uint32_t depth);
+
+struct cs_sdma_desc {
+  uint8_t allowed;
+  uint8_t size_dw; // Whole packet, or what the checker needs to see first
+  cs_sdma_check_fn check;
+};
+
+static int cs_sdma_nop(struct cs_ctx *ctx, const uint32_t *pkt,
+                       uint32_t avail, uint32_t depth) {
+  (void)ctx, (void)avail, (void)depth;
+  return 1 + (int)((pkt[0] >> SDMA_PKT_NOP_HEADER_count_shift) &
+                   SDMA_PKT_NOP_HEADER_count_mask);
+}
+
+// One side of a sub-window copy: from the box's first byte to its last
+static int cs_sdma_window(struct cs_ctx *ctx, const uint32_t *addr,
+                          uint64_t x, uint64_t y, uint64_t z, uint64_t pitch,
+                          uint64_t slice, const uint32_t *pkt, uint32_t bpp) {
+  uint64_t w = (pkt[11] & SDMA_PKT_COPY_LINEAR_SUBWIN_DW_11_rect_x_mask) + 1;
+  uint64_t h = ((pkt[11] >> SDMA_PKT_COPY_LINEAR_SUBWIN_DW_11_rect_y_shift) &
+                SDMA_PKT_COPY_LINEAR_SUBWIN_DW_11_rect_y_mask) + 1;
+  uint64_t d = (pkt[12] & SDMA_PKT_COPY_LINEAR_SUBWIN_DW_12_rect_z_mask) + 1;
+  uint64_t first = (x + y * pitch + z * slice) * bpp;
+  uint64_t last = (x + w - 1 + (y + h - 1) * pitch + (z + d - 1) * slice + 1) * bpp;
+  uint64_t va = (((uint64_t)addr[1] << 32) | addr[0]) + first;
+  return cs_check_va(ctx, (uint32_t)va, (uint32_t)(va >> 32), last - first);
+}
+
+static int cs_sdma_copy_sub_window(struct cs_ctx *ctx, const uint32_t *pkt) {
+  uint32_t bpp = 1u << ((pkt[0] >> SDMA_PKT_COPY_LINEAR_SUBWIN_HEADER_elementsize_shift) &
+                        SDMA_PKT_COPY_LINEAR_SUBWIN_HEADER_elementsize_mask);
+  if (bpp > 16)
+    return cs_fail(ctx, "bad SDMA element size");
+  if (cs_sdma_window(ctx, &pkt[1], pkt[3] & 0x3FFF, (pkt[3] >> 16) & 0x3FFF,
+                     pkt[4] & 0x1FFF, ((pkt[4] >> 13) & 0x7FFFF) + 1,
+                     (pkt[5] & 0xFFFFFFF) + 1, pkt, bpp) ||
+      cs_sdma_window(ctx, &pkt[6], pkt[8] & 0x3FFF, (pkt[8] >> 16) & 0x3FFF,
+                     pkt[9] & 0x1FFF, ((pkt[9] >> 13) & 0x7FFFF) + 1,
+                     (pkt[10] & 0xFFFFFFF) + 1, pkt, bpp))
+    return -1;
+  return 13;
+}
+
+static int cs_sdma_copy(struct cs_ctx *ctx, const uint32_t *pkt,
+                        uint32_t avail, uint32_t depth) {
+  (void)depth;
+  if (CS_SDMA_SUB_OP(pkt[0]) == SDMA_SUBOP_COPY_LINEAR_SUB_WIND)
+    return avail < 13 ? cs_fail(ctx, "packet runs past the end of the IB")
+                      : cs_sdma_copy_sub_window(ctx, pkt);
+  if (CS_SDMA_SUB_OP(pkt[0]) != SDMA_SUBOP_COPY_LINEAR)
+    return cs_fail(ctx, "only linear SDMA copies are allowed");
+  uint64_t bytes = (uint64_t)(pkt[1] & SDMA_PKT_COPY_LINEAR_COUNT_count_mask) + 1;
+  if (cs_check_va(ctx, pkt[3], pkt[4], bytes) || cs_check_va(ctx, pkt[5], pkt[6], bytes))
+    return -1;
+  return 7;
+}
+
+static int cs_sdma_write(struct cs_ctx *ctx, const uint32_t *pkt,
+                         uint32_t avail, uint32_t depth) {
+  if (CS_SDMA_SUB_OP(pkt[0]) != SDMA_SUBOP_WRITE_LINEAR)
+    return cs_fail(ctx, "only linear SDMA writes are allowed");
+  (void)avail, (void)depth;
+  uint32_t ndw = (pkt[3] & SDMA_PKT_WRITE_UNTILED_DW_3_count_mask) + 1;
+  if (cs_check_va(ctx, pkt[1], pkt[2], (uint64_t)ndw * 4))
+    return -1;
+  return (int)(4 + ndw);
+}
+
+static int cs_sdma_indirect(struct cs_ctx *ctx, const uint32_t *pkt,
+                            uint32_t avail, uint32_t depth) {
+  (void)avail;
+  uint64_t va = ((uint64_t)pkt[2] << 32) | pkt[1];
+  uint32_t ndw = pkt[3] & 0xFFFFF;
+  const uint32_t *ib = cs_ib_target(ctx, va, ndw);
+  if (!ib || (ctx->shadow && cs_ib_repoint(ctx, &pkt[1], ib, 0xFFFFFFFF) != 0))
+    return -1;
+  if (depth + 1 >= CS_MAX_IB_DEPTH)
+    return cs_fail(ctx, "IBs nested too deep");
+  return cs_check_ib(ctx, ib, ndw, depth + 1) == 0 ? 6 : -1;
+}
+
+static int cs_sdma_fence(struct cs_ctx *ctx, const uint32_t *pkt,
+                         uint32_t avail, uint32_t depth) {
+  (void)avail, (void)depth;
+  return cs_check_va(ctx, pkt[1], pkt[2], 4) ? -1 : 4;
+}
+
+static int cs_sdma_poll_regmem(struct cs_ctx *ctx, const uint32_t *pkt,
+                               uint32_t avail, uint32_t depth) {
+  (void)avail, (void)depth;
+  if (!(pkt[0] >> SDMA_PKT_POLL_REGMEM_HEADER_mem_poll_shift))
+    return cs_fail(ctx, "SDMA poll on a register");
+  return cs_check_va(ctx, pkt[1], pkt[2], 4) ? -1 : 6;
+}
+
+static int cs_sdma_const_fill(struct cs_ctx *ctx, const uint32_t *pkt,
+                              uint32_t avail, uint32_t depth) {
+  (void)avail, (void)depth;
+  uint64_t bytes = (uint64_t)(pkt[4] & SDMA_PKT_CONSTANT_FILL_COUNT_count_mask) + 1;
+  return cs_check_va(ctx, pkt[1], pkt[2], bytes) ? -1 : 5;
+}
+
+static int cs_sdma_timestamp(struct cs_ctx *ctx, const uint32_t *pkt,
+                             uint32_t avail, uint32_t depth) {
+  (void)avail, (void)depth;
+  if (CS_SDMA_SUB_OP(pkt[0]) == SDMA_SUBOP_TIMESTAMP_SET)
+    return cs_fail(ctx, "SDMA timestamp set");
+  return cs_check_va(ctx, pkt[1], pkt[2], 8) ? -1 : 3;
+}
+
+static const struct cs_sdma_desc cs_sdma_table[256] = {
+    [SDMA_OP_NOP] = {1, 1, cs_sdma_nop},
+    [SDMA_OP_COPY] = {1, 7, cs_sdma_copy},
+    [SDMA_OP_WRITE] = {1, 4, cs_sdma_write},
+    [SDMA_OP_INDIRECT] = {1, 6, cs_sdma_indirect},
+    [SDMA_OP_FENCE] = {1, 4, cs_sdma_fence},
+    [SDMA_OP_TRAP] = {1, 2, NULL},
+    [SDMA_OP_POLL_REGMEM] = {1, 6, cs_sdma_poll_regmem},
+    [SDMA_OP_CONST_FILL] = {1, 5, cs_sdma_const_fill},
+    [SDMA_OP_TIMESTAMP] = {1, 3, cs_sdma_timestamp},
+};
+
+static int cs_parse_sdma(struct cs_ctx *ctx, const uint32_t *dw, uint32_t ndw,
+                         uint32_t depth) {
+  for (uint32_t i = 0; i < ndw;) {
+    uint32_t op = CS_SDMA_OP(dw[i]);
+    const struct cs_sdma_desc *d = &cs_sdma_table[op];
+    ctx->error_dw = i;
+    ctx->error_op = op;
+    if (!d->allowed)
+      return cs_fail(ctx, "opcode not allowed");
+    if (d->size_dw > ndw - i)
+      return cs_fail(ctx, "packet runs past the end of the IB");
+    int size = d->check ? d->check(ctx, &dw[i], ndw - i, depth) : d->size_dw;
+    if (size < 0)
+      return -1;
+    if ((uint32_t)size > ndw - i)
+      return cs_fail(ctx, "packet runs past the end of the IB");
+    i += size;
+  }
+  return 0;
+}
+
+/* --- IB walking and the cache --- */
+
+static uint64_t cs_hash(uint64_t h, const uint32_t *dw, uint32_t ndw) {
+  for (uint32_t i = 0; i < ndw; i++) {
+    h = (h ^ dw[i]) * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+static int cs_cache_lookup(uint64_t key, const uint32_t *dw, uint32_t ndw,
+                           uint32_t *chain_at) {
+  pthread_mutex_lock(&cs_lock);
+  struct cs_cache_entry *e = &cs_cache[key & (CS_CACHE_SIZE - 1)];
+  int hit = e->dw && e->key == key && e->ndw == ndw &&
+            memcmp(e->dw, dw, (size_t)ndw * 4) == 0;
+  if (hit) {
+    *chain_at = e->chain_at;
+    cs_stats.cache_hits++;
+  }
+  pthread_mutex_unlock(&cs_lock);
+  return hit;
+}
+
+// Takes dw (the IB as it was before we walked it)
+static void cs_cache_insert(uint64_t key, uint32_t *dw, uint32_t ndw,
+                            uint32_t chain_at) {
+  pthread_mutex_lock(&cs_lock);
+  struct cs_cache_entry *e = &cs_cache[key & (CS_CACHE_SIZE - 1)];
+  uint32_t *old = e->dw;
+  e->key = key;
+  e->ndw = ndw;
+  e->chain_at = chain_at;
+  e->dw = dw;
+  pthread_mutex_unlock(&cs_lock);
+  os_prim_free(old);
+}
+
+// Check one IB, then follow its chain (if any) as a loop, not a recursion
+static int cs_check_ib(struct cs_ctx *ctx, const uint32_t *dw, uint32_t ndw,
+                       uint32_t depth) {
+  while (dw) {
+    ctx->error_depth = depth;
+    if (ndw > CS_MAX_DWORDS - ctx->total_dw)
+      return cs_fail(ctx, "command stream too long");
+    ctx->total_dw += ndw;
+
+    uint64_t key = cs_hash(cs_seed ^ ctx->bo_key ^ ((uint64_t)ctx->engine << 56),
+                           dw, ndw);
+    uint32_t chain_at = CS_NO_CHAIN;
+    struct cs_state st = {0, CS_INDEX_SIZE_UNKNOWN, NULL, 0};
+
+    if (!cs_cache_lookup(key, dw, ndw, &chain_at)) {
+      uint32_t before = ctx->total_dw;
+      // Keep it as it is now: walking it may repoint its IB packets
+      uint32_t *orig = ndw <= CS_CACHE_MAX_DW ? os_prim_alloc((size_t)ndw * 4) : NULL;
+      if (orig)
+        memcpy(orig, dw, (size_t)ndw * 4);
+      int ret = ctx->engine == RMAPI_CLIENT_ENGINE_DMA
+                    ? cs_parse_sdma(ctx, dw, ndw, depth)
+                    : cs_parse_pm4(ctx, dw, ndw, depth, &chain_at, &st);
+      if (ret == 0 && orig && ctx->total_dw == before)
+        cs_cache_insert(key, orig, ndw, chain_at); // No IBs walked: safe to remember
+      else
+        os_prim_free(orig);
+      if (ret != 0)
+        return -1;
+      pthread_mutex_lock(&cs_lock);
+      cs_stats.dwords_parsed += ndw;
+      pthread_mutex_unlock(&cs_lock);
+    } else if (chain_at != CS_NO_CHAIN) {
+      // Known good, but where it jumps to still has to be looked at
+      if (cs_pm4_indirect_buffer(ctx, &st, &dw[chain_at + 1], 3, depth) != 0)
+        return -1;
+    }
+
+    if (!st.chain)
+      return 0;
+    if (++ctx->chains > CS_MAX_CHAINS)
+      return cs_fail(ctx, "too many chained IBs");
+    dw = st.chain;
+    ndw = st.chain_ndw;
+  }
+  return 0;
+}
+
+static int cs_range_cmp(const void *a, const void *b) {
+  const struct cs_range *x = a, *y = b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int cs_validate(int32_t pid, uint32_t engine, const void *cmds,
+                       size_t size, struct amdgpu_buffer **bo_list,
+                       uint32_t bo_count, struct rmapi_cs_shadow **shadow) {
+  if (shadow)
+    *shadow = NULL;
+  if (cs_enabled < 0) {
+    const char *env = getenv("AMDGPU_CS_VALIDATE");
+    cs_enabled = !(env && env[0] == '0');
+  }
+  if (!cs_enabled)
+    return 0;
+  os_trace_scope(OS_TRACE_RMAPI, "rmapi_cs_validate");
+  engine = RMAPI_ENGINE_CLASS(engine); // GFX_HIGH is GFX with better manners
+  if (engine >= RMAPI_CLIENT_ENGINE_COUNT)
+    return -1;
+  pthread_once(&cs_seed_once, cs_seed_init);
+
+  uint64_t start = cs_now_ns();
+  struct cs_ctx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.engine = engine;
+  if (shadow) {
+    ctx.shadow = os_prim_alloc(sizeof(*ctx.shadow));
+    if (!ctx.shadow) {
+      ctx.error = "out of memory";
+      goto done;
+    }
+    ctx.shadow->ibs = NULL;
+    ctx.shadow->bufs = NULL;
+    ctx.shadow->nbufs = 0;
+  }
+  if (!cmds || size == 0 || size % 4 || size / 4 > CS_MAX_DWORDS) {
+    ctx.error = "stream is empty or not whole dwords";
+    goto done;
+  }
+
+  // Sorted VA ranges of this submission's BOs, for binary search
+  if (bo_count) {
+    ctx.ranges = os_prim_alloc(bo_count * sizeof(*ctx.ranges));
+    if (!ctx.ranges) {
+      ctx.error = "out of memory";
+      goto done;
+    }
+    for (uint32_t i = 0; i < bo_count; i++) {
+      if (!bo_list[i] || !bo_list[i]->size)
+        continue;
+      struct cs_range *r = &ctx.ranges[ctx.nranges++];
+      r->start = bo_list[i]->gpu_addr;
+      r->end = bo_list[i]->gpu_addr + bo_list[i]->size;
+      r->cpu = bo_list[i]->cpu_addr;
+    }
+    qsort(ctx.ranges, ctx.nranges, sizeof(*ctx.ranges), cs_range_cmp);
+    ctx.bo_key = 0xCBF29CE484222325ull;
+    for (uint32_t i = 0; i < ctx.nranges; i++) {
+      uint32_t r[4] = {(uint32_t)ctx.ranges[i].start,
+                       (uint32_t)(ctx.ranges[i].start >> 32),
+                       (uint32_t)ctx.ranges[i].end,
+                       (uint32_t)(ctx.ranges[i].end >> 32)};
+      ctx.bo_key = cs_hash(ctx.bo_key, r, 4);
+    }
+  }
+
+  cs_check_ib(&ctx, cmds, (uint32_t)(size / 4), 0);
+
+  // The copies go into the job's buffer list: the engine may read them
+  if (!ctx.error && ctx.shadow && ctx.shadow->ibs) {
+    uint32_t n = 0;
+    for (struct cs_shadow_ib *ib = ctx.shadow->ibs; ib; ib = ib->next)
+      n++;
+    ctx.shadow->bufs = os_prim_alloc(n * sizeof(*ctx.shadow->bufs));
+    if (!ctx.shadow->bufs)
+      ctx.error = "out of memory";
+    for (struct cs_shadow_ib *ib = ctx.shadow->ibs; ctx.shadow->bufs && ib;
+         ib = ib->next)
+      ctx.shadow->bufs[ctx.shadow->nbufs++] = &ib->buf;
+  }
+
+done:
+  os_prim_free(ctx.ranges);
+  pthread_mutex_lock(&cs_lock);
+  cs_stats.streams++;
+  cs_stats.validate_ns += cs_now_ns() - start;
+  if (ctx.error)
+    cs_stats.rejected++;
+  pthread_mutex_unlock(&cs_lock);
+
+  if (ctx.error) {
+    os_prim_log("RMAPI: Rejected pid %d's command stream: %s "
+                "(IB depth %u, dword %u, opcode 0x%x)\n",
+                pid, ctx.error, ctx.error_depth, ctx.error_dw, ctx.error_op);
+    rmapi_cs_shadow_release(ctx.shadow);
+    return -1;
+  }
+  if (ctx.shadow && !ctx.shadow->ibs) {
+    rmapi_cs_shadow_release(ctx.shadow); // Nothing was called
+    ctx.shadow = NULL;
+  }
+  if (shadow)
+    *shadow = ctx.shadow;
+  return 0;
+}
+
+// Checks the stream where it is: for callers whose IBs can't change under
+// them (replay, tests). Anything a client can still write goes through
+// rmapi_cs_validate_shadow.
+int rmapi_cs_validate(int32_t pid, uint32_t engine, const void *cmds,
+                      size_t size, struct amdgpu_buffer **bo_list,
+                      uint32_t bo_count) {
+  return cs_validate(pid, engine, cmds, size, bo_list, bo_count, NULL);
+}
+
+// cmds must be the caller's own copy: the IB packets in it get pointed at
+// private copies of their IBs. Those are in *shadow (NULL if none) and have
+// to outlive the job, so hand it to rmapi_sched_submit_held.
+int rmapi_cs_validate_shadow(int32_t pid, uint32_t engine, void *cmds,
+                             size_t size, struct amdgpu_buffer **bo_list,
+                             uint32_t bo_count, struct rmapi_cs_shadow **shadow) {
+  if (!shadow)
+    return -1;
+  return cs_validate(pid, engine, cmds, size, bo_list, bo_count, shadow);
+}
+
+void rmapi_cs_shadow_release(void *shadow) {
+  struct rmapi_cs_shadow *s = shadow;
+  if (!s)
+    return;
+  while (s->ibs) {
+    struct cs_shadow_ib *ib = s->ibs;
+    s->ibs = ib->next;
+    os_prim_free(ib);
+  }
+  os_prim_free(s->bufs);
+  os_prim_free(s);
+}
+
+// What a job running from shadow needs to keep it (and to read the copies)
+struct rmapi_sched_hold rmapi_cs_shadow_hold(struct rmapi_cs_shadow *shadow) {
+  struct rmapi_sched_hold hold = {rmapi_cs_shadow_release, shadow,
+                                  shadow ? shadow->bufs : NULL,
+                                  shadow ? shadow->nbufs : 0};
+  return hold;
+}
+
+void rmapi_cs_get_stats(struct rmapi_cs_stats *out) {
+  if (!out)
+    return;
+  pthread_mutex_lock(&cs_lock);
+  *out = cs_stats;
+  pthread_mutex_unlock(&cs_lock);
+}
+
+// Forget every verdict (tests, or when BOs move under the same VAs)
+void rmapi_cs_cache_flush(void) {
+  pthread_mutex_lock(&cs_lock);
+  for (int i = 0; i < CS_CACHE_SIZE; i++)
+    os_prim_free(cs_cache[i].dw);
+  memset(cs_cache, 0, sizeof(cs_cache));
+  pthread_mutex_unlock(&cs_lock);
+}
@@ -3,6 +3,8 @@
 #include "../ipc/ipc_lib.h"
 #include "../ipc/ipc_protocol.h"
 #include "../hal/hal.h"
+#include "../../src/amd/include/ivsrcid/vmc/irqsrcs_vmc_1_0.h"
+#include "../../src/amd/include/soc15_ih_clientid.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -29,6 +31,102 @@
 // We keep one main GPU object in memory for everything to share
 struct OBJGPU *global_gpu = NULL;
 
+// Ring mux backend: one piece of a GFX / GFX_HIGH job on the GFX ring. The
+// job was counted when the scheduler handed it over, only the time goes here.
+static int rmapi_mux_run_hal(void *priv, int32_t pid, const uint32_t *dw,
+                             uint32_t ndw) {
+  struct amdgpu_command_buffer cb = {NULL, (void *)dw, (size_t)ndw * 4, NULL, 0};
+  uint64_t start = rmapi_client_now_ns();
+  int ret = amdgpu_command_submit_hal(priv, &cb);
+  if (ret == 0)
+    rmapi_client_account_busy(pid, RMAPI_CLIENT_ENGINE_GFX,
+                              rmapi_client_now_ns() - start);
+  return ret;
+}
+
+// Scheduler backend: the HAL runs a stream before it returns, so the job's
+// fence is done right away. DMA jobs go to the copy engine path, GFX and
+// GFX_HIGH to the ring mux, which reports their fences from its own thread.
+static int rmapi_sched_run_hal(void *priv, int32_t pid, uint32_t engine,
+                               struct amdgpu_command_buffer *cb, uint64_t seq) {
+  int ret;
+  if (engine == RMAPI_CLIENT_ENGINE_DMA) {
+    uint64_t start = rmapi_client_now_ns();
+    // A client's job gets at its own buffers only, ours at anything
+    ret = pid ? amdgpu_sdma_submit_bounded_hal(priv, cb)
+              : amdgpu_sdma_submit_hal(priv, cb);
+    if (ret == 0)
+      rmapi_client_account_submit(pid, engine, rmapi_client_now_ns() - start);
+  } else if (RMAPI_ENGINE_CLASS(engine) == RMAPI_CLIENT_ENGINE_GFX &&
+             rmapi_ring_mux_active()) {
+    if (rmapi_ring_mux_submit(pid, engine, cb, seq) != 0)
+      return -1;
+    rmapi_client_account_submit(pid, RMAPI_CLIENT_ENGINE_GFX, 0);
+    return 0;
+  } else {
+    ret = rmapi_submit_command_pid(priv, pid, cb);
+  }
+  rmapi_sched_fence_done(engine, seq, ret);
+  return 0;
+}
+
+// Ring reset: only the mux still has jobs once run_job returned
+static int rmapi_sched_cancel_hal(void *priv, uint32_t engine,
+                                  uint64_t from_seq) {
+  (void)priv;
+  if (RMAPI_ENGINE_CLASS(engine) != RMAPI_CLIENT_ENGINE_GFX ||
+      !rmapi_ring_mux_active())
+    return 0;
+  return rmapi_ring_mux_cancel(engine, from_seq);
+}
+
+// VM fault off the IH: a shader or DMA touched an address its VM doesn't
+// map. Decoded like gmc_v10's handler does it.
+static void rmapi_vm_fault_irq(void *priv, const struct amdgpu_iv_entry *iv) {
+  uint64_t addr = (uint64_t)iv->src_data[0] << 12 |
+                  (uint64_t)(iv->src_data[1] & 0xf) << 44;
+  os_prim_log("RMAPI: VM fault from %s (vmid %u, pasid %u) at 0x%llx\n",
+              iv->client_id == SOC15_IH_CLIENTID_VMC ? "MMHUB" : "GFXHUB",
+              iv->vmid, iv->pasid, (unsigned long long)addr);
+  amdgpu_ras_record_error(priv, 1);
+}
+
+// Default job timeouts per queue class, in ms
+#define RMAPI_LOCKUP_GFX_MS 2000
+#define RMAPI_LOCKUP_COMPUTE_MS 10000 // Long kernels are a thing
+#define RMAPI_LOCKUP_SDMA_MS 2000
+
+// Ring watchdog: the ring's fence sat still for its whole timeout. The
+// smallest reset that gets it going again, see rmapi_recovery.c.
+static void rmapi_ring_hang(void *priv, uint32_t ring, uint64_t stuck_seq,
+                            uint64_t last_seq) {
+  rmapi_recovery_ring_hang(priv, ring, stuck_seq, last_seq);
+}
+
+// Timeouts per queue class. AMDGPU_LOCKUP_TIMEOUT works like the kernel's
+// lockup_timeout: "gfx,compute,sdma" in ms; classes left out take the last
+// value given. 0 leaves that class unwatched.
+static void rmapi_watchdog_setup(void) {
+  uint32_t ms[3] = {RMAPI_LOCKUP_GFX_MS, RMAPI_LOCKUP_COMPUTE_MS,
+                    RMAPI_LOCKUP_SDMA_MS};
+  const char *env = getenv("AMDGPU_LOCKUP_TIMEOUT");
+  for (int i = 0; env && *env && i < 3; i++) {
+    char *end;
+    unsigned long v = strtoul(env, &end, 10);
+    if (end == env)
+      break;
+    for (int j = i; j < 3; j++)
+      ms[j] = (uint32_t)v;
+    env = *end == ',' ? end + 1 : end;
+  }
+  amdgpu_watchdog_set_timeout(RMAPI_CLIENT_ENGINE_GFX, ms[0]);
+  amdgpu_watchdog_set_timeout(RMAPI_CLIENT_ENGINE_GFX_HIGH, ms[0]);
+  amdgpu_watchdog_set_timeout(RMAPI_CLIENT_ENGINE_COMPUTE, ms[1]);
+  amdgpu_watchdog_set_timeout(RMAPI_CLIENT_ENGINE_DMA, ms[2]);
+  os_prim_log("RMAPI: Job timeouts gfx %u ms, compute %u ms, sdma %u ms\n",
+              ms[0], ms[1], ms[2]);
+}
+
 // Turning everything on for the first time
 int rmapi_init(void) {
   if (global_gpu)
@@ -58,13 +156,52 @@ int rmapi_init(void) {
 
   amdgpu_device_init_hal(global_gpu); // Starting the especialistas (Specialists)
 
+  // Interrupts: the simulated device raises its own, hardware backends wire
+  // their eventfd / UIO up through amdgpu_ih_get_ring
+  if (amdgpu_ih_init(0, amdgpu_hal_get_mode() == AMDGPU_HAL_MODE_SIM
+                            ? AMDGPU_IH_WAKE_SIM
+                            : AMDGPU_IH_WAKE_NONE,
+                     -1) == 0) {
+    amdgpu_ih_register(SOC15_IH_CLIENTID_VMC, VMC_1_0__SRCID__VM_FAULT,
+                       rmapi_vm_fault_irq, global_gpu);
+    amdgpu_ih_register(SOC15_IH_CLIENTID_UTCL2, UTCL2_1_0__SRCID__FAULT,
+                       rmapi_vm_fault_irq, global_gpu);
+  }
+
+  rmapi_recovery_reset();
+  if (amdgpu_watchdog_init(rmapi_ring_hang, global_gpu) == 0)
+    rmapi_watchdog_setup();
+  else
+    os_prim_log("RMAPI: No ring watchdog, hung rings go unnoticed\n");
+
+  // Jobs with dependencies go through the scheduler, which ends up here
+  // Simulated DMA runs on the submitting thread: waits happen in the scheduler
+  struct rmapi_sched_ops ops = {rmapi_sched_run_hal, global_gpu,
+                                amdgpu_hal_get_mode() == AMDGPU_HAL_MODE_SIM
+                                    ? 1u << RMAPI_CLIENT_ENGINE_DMA
+                                    : 0,
+                                rmapi_sched_cancel_hal};
+  rmapi_sched_set_ops(&ops);
+  // Only the simulated CP stops between our chunks; real rings get whole jobs
+  struct rmapi_ring_mux_ops mux = {rmapi_mux_run_hal, global_gpu,
+                                   amdgpu_hal_get_mode() == AMDGPU_HAL_MODE_SIM};
+  if (rmapi_ring_mux_init(&mux) != 0)
+    os_prim_log("RMAPI: No ring mux, GFX_HIGH runs in line with GFX\n");
+
   os_prim_log("RMAPI: All systems go! Global GPU is live.\n");
   return 0;
 }
 
 // Shutting down the whole thing
 void rmapi_fini(void) {
+  rmapi_capture_stop(); // Flush the trace before anything goes away
   if (global_gpu) {
+    rmapi_userq_fini();
+    rmapi_ring_mux_fini(); // Drains: its fences still go to the scheduler
+    amdgpu_watchdog_fini();
+    rmapi_sched_set_ops(NULL);
+    rmapi_sched_fini();
+    amdgpu_ih_fini();
     amdgpu_device_fini_hal(global_gpu);
     os_prim_free(global_gpu);
     global_gpu = NULL;
@@ -110,8 +247,25 @@ int rmapi_submit_command(struct OBJGPU *gpu, struct amdgpu_command_buffer *cb) {
   if (!gpu)
     return -1;
 
-  os_prim_log("RMAPI: Sending a list of jobs to the GPU engine.\n");
-  return amdgpu_command_submit_hal(gpu, cb);
+  return rmapi_submit_command_pid(gpu, 0, cb);
+}
+
+// Same thing, but the time goes on pid's tab (the server submits for its clients)
+int rmapi_submit_command_pid(struct OBJGPU *gpu, int32_t pid,
+                             struct amdgpu_command_buffer *cb) {
+  if (!gpu)
+    gpu = global_gpu;
+  if (!gpu)
+    return -1;
+
+  os_log_trace(OS_LOG_RMAPI, "RMAPI: Sending a list of jobs to the GPU engine.\n");
+  uint64_t start = rmapi_client_now_ns();
+  int ret = amdgpu_command_submit_hal(gpu, cb);
+  // Submission is synchronous, so wall time here is the engine's busy time
+  if (ret == 0)
+    rmapi_client_account_submit(pid, RMAPI_CLIENT_ENGINE_GFX,
+                                rmapi_client_now_ns() - start);
+  return ret;
 }
 
 // 4. "Wait, who ARE you exactly?" (Get GPU info with caching for quality performance)
@@ -132,6 +286,11 @@ int rmapi_get_gpu_info(struct OBJGPU *gpu, struct amdgpu_gpu_info *info) {
     cached_gpu_info.asic_type = gpu->asic_type;
     cached_gpu_info.vram_size_mb = 1024; // Placeholder
     cached_gpu_info.gpu_clock_mhz = 1500; // Placeholder
+    const struct amdgpu_atomfw_info *vbios = amdgpu_atomfw_get(gpu);
+    if (vbios && (vbios->tables & AMDGPU_ATOMFW_VRAM) && vbios->vram_size_mb)
+      cached_gpu_info.vram_size_mb = vbios->vram_size_mb;
+    if (vbios && (vbios->tables & AMDGPU_ATOMFW_FIRMWARE) && vbios->bootup_sclk_10khz)
+      cached_gpu_info.gpu_clock_mhz = vbios->bootup_sclk_10khz / 100;
     strcpy(cached_gpu_info.gpu_name, "AMD GPU"); // Placeholder
     cached_gpu_info.vram_base = 0; // Placeholder
     gpu_info_cached = 1;
@@ -201,6 +360,28 @@ int rmapi_destroy_command_buffer(struct OBJGPU *gpu, struct amdgpu_command_buffe
   return 0;
 }
 
+// 9. "Keep this one in VRAM if you can" (higher = evicted last)
+int rmapi_set_buffer_priority(struct OBJGPU *gpu, struct amdgpu_buffer *buffer, int priority) {
+  if (!gpu)
+    gpu = global_gpu;
+  if (!gpu || !buffer)
+    return -1;
+
+  amdgpu_residency_set_priority(buffer, priority);
+  return 0;
+}
+
+// 10. "How crowded is VRAM?" (evictions, bytes moved, usage)
+int rmapi_get_residency_stats(struct OBJGPU *gpu, struct amdgpu_residency_stats *stats) {
+  if (!gpu)
+    gpu = global_gpu;
+  if (!gpu || !stats)
+    return -1;
+
+  amdgpu_residency_get_stats(gpu, stats);
+  return 0;
+}
+
 // Vulkan stubs (for future RADV integration)
 int rmapi_vk_create_instance(void* create_info, void** instance) {
     (void)create_info;
@@ -362,4 +543,9 @@ void rmapi_gl_fini(void) {
 // Get current GPU instance
 struct OBJGPU *rmapi_get_gpu(void) {
   return global_gpu;
-}
\ No newline at end of file
+}
+// Hand out a fresh RESSERV handle (never 0, never reused while we're running)
+uint32_t rmapi_handle_alloc(void) {
+  static uint32_t next_handle = 0x1000;
+  return __sync_fetch_and_add(&next_handle, 1);
+}
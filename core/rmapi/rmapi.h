@@ -13,6 +13,8 @@ int rmapi_alloc_memory(struct OBJGPU* gpu, size_t size, uint64_t* addr);
 int rmapi_free_memory(struct OBJGPU* gpu, uint64_t addr);
 int rmapi_submit_command(struct OBJGPU* gpu, struct amdgpu_command_buffer* cb);
 int rmapi_get_gpu_info(struct OBJGPU* gpu, struct amdgpu_gpu_info* info);
+int rmapi_set_buffer_priority(struct OBJGPU *gpu, struct amdgpu_buffer *buffer, int priority);
+int rmapi_get_residency_stats(struct OBJGPU *gpu, struct amdgpu_residency_stats *stats);
 
 // Display & Mode Setting - disabled due to header issues
 // #ifdef __HAIKU__
@@ -48,5 +50,424 @@ void rmapi_gl_fini(void);
 
 // Get current GPU instance
 struct OBJGPU *rmapi_get_gpu(void);
+uint32_t rmapi_handle_alloc(void);
 
-#endif
\ No newline at end of file
+// Userptr import (rmapi_userptr.c): let the GPU use pages the client already owns.
+// pid 0 (or our own pid) means "same address space"; memfd >= 0 maps the fd instead.
+int rmapi_import_userptr(struct OBJGPU *gpu, int32_t pid, uint64_t addr,
+                         uint64_t size, uint32_t flags, int memfd,
+                         uint64_t fd_offset, uint32_t *handle,
+                         uint64_t *gpu_addr);
+int rmapi_release_userptr(struct OBJGPU *gpu, int32_t pid, uint32_t handle);
+int rmapi_invalidate_userptr(struct OBJGPU *gpu, int32_t pid, uint64_t addr,
+                             uint64_t size);
+void rmapi_release_userptr_pid(struct OBJGPU *gpu, int32_t pid);
+int rmapi_userptr_get(uint32_t handle, struct amdgpu_buffer *buf);
+int rmapi_userptr_read(uint32_t handle, uint64_t offset, void *dst, size_t len);
+uint32_t rmapi_userptr_generation(void);
+
+// PRIME sharing (rmapi_prime.c): dma-bufs in DRM mode, refcounted memfds otherwise.
+int rmapi_prime_create(struct OBJGPU *gpu, int32_t pid, uint64_t size,
+                       uint32_t *handle, uint64_t *gpu_addr);
+int rmapi_prime_export(struct OBJGPU *gpu, int32_t pid, uint32_t handle,
+                       int *fd);
+int rmapi_prime_find_addr(int32_t pid, uint64_t gpu_addr, uint32_t *handle);
+int rmapi_prime_import(struct OBJGPU *gpu, int32_t pid, int fd,
+                       uint32_t *handle, uint64_t *gpu_addr, uint64_t *size);
+int rmapi_prime_unref(struct OBJGPU *gpu, int32_t pid, uint32_t handle);
+void rmapi_prime_release_pid(struct OBJGPU *gpu, int32_t pid);
+int rmapi_prime_get(uint32_t handle, struct amdgpu_buffer *buf);
+int rmapi_prime_fence_attach(int32_t pid, uint32_t handle, uint64_t *seq);
+int rmapi_prime_fence_signal(int32_t pid, uint32_t handle, uint64_t seq);
+int rmapi_prime_fence_wait(int32_t pid, uint32_t handle, uint64_t timeout_ns);
+uint64_t rmapi_prime_shared_bytes(int32_t pid, uint32_t heap);
+uint32_t rmapi_prime_list_pid(int32_t pid, uint32_t *handles, uint32_t max);
+struct amdgpu_buffer *rmapi_prime_hold(int32_t pid, uint32_t handle);
+
+// Per-client accounting (rmapi_client.c): fdinfo-style usage per pid, plus quotas.
+// pid 0 means "this process".
+#define RMAPI_CLIENT_HEAP_VRAM 0
+#define RMAPI_CLIENT_HEAP_GTT 1
+#define RMAPI_CLIENT_HEAP_CPU 2 // Client-owned pages (userptr)
+#define RMAPI_CLIENT_HEAP_COUNT 3
+
+#define RMAPI_CLIENT_ENGINE_GFX 0
+#define RMAPI_CLIENT_ENGINE_COMPUTE 1
+#define RMAPI_CLIENT_ENGINE_DMA 2
+#define RMAPI_CLIENT_ENGINE_COUNT 3
+
+// Scheduler rings: the engines above plus GFX_HIGH, a high-priority software
+// ring muxed onto the GFX engine (rmapi_ring_mux.c) with its own fences.
+// Accounting and validation see it as GFX.
+#define RMAPI_CLIENT_ENGINE_GFX_HIGH 3
+#define RMAPI_SCHED_RING_COUNT 4
+#define RMAPI_ENGINE_CLASS(e) \
+  ((e) == RMAPI_CLIENT_ENGINE_GFX_HIGH ? RMAPI_CLIENT_ENGINE_GFX : (e))
+
+struct rmapi_client_stats {
+  int32_t pid;
+  uint32_t connections;                        // Open IPC connections
+  uint64_t memory[RMAPI_CLIENT_HEAP_COUNT];    // Bytes held, where they live right now
+  uint64_t peak[RMAPI_CLIENT_HEAP_COUNT];      // Most it ever held
+  uint64_t shared[RMAPI_CLIENT_HEAP_COUNT];    // Part of memory[] other clients hold too
+  uint64_t quota[RMAPI_CLIENT_HEAP_COUNT];     // 0 = unlimited
+  uint32_t bo_count;
+  uint32_t quota_hits;                         // Allocations refused by the quota
+  uint64_t submissions;
+  uint64_t engine_ns[RMAPI_CLIENT_ENGINE_COUNT]; // Busy time per engine class
+};
+
+void rmapi_client_open(int32_t pid);
+void rmapi_client_close(int32_t pid);
+int rmapi_client_charge(int32_t pid, uint32_t heap, uint64_t bytes);
+void rmapi_client_uncharge(int32_t pid, uint32_t heap, uint64_t bytes);
+void rmapi_client_move(int32_t pid, uint32_t from, uint32_t to, uint64_t bytes);
+void rmapi_client_account_submit(int32_t pid, uint32_t engine, uint64_t busy_ns);
+void rmapi_client_account_busy(int32_t pid, uint32_t engine, uint64_t busy_ns);
+int rmapi_client_set_quota(int32_t pid, uint32_t heap, uint64_t bytes);
+int rmapi_client_get_stats(int32_t pid, struct rmapi_client_stats *out);
+int rmapi_client_list(struct rmapi_client_stats *out, uint32_t max);
+int rmapi_client_format_fdinfo(const struct rmapi_client_stats *s, char *buf,
+                               size_t len);
+uint64_t rmapi_client_now_ns(void);
+int rmapi_submit_command_pid(struct OBJGPU *gpu, int32_t pid,
+                             struct amdgpu_command_buffer *cb);
+
+// Command stream validation (cs_validator.c): PM4 (GFX/COMPUTE engines) or
+// SDMA (DMA engine) checked against an opcode table, a register allow-list
+// and the VA ranges of bo_list before it goes anywhere near the GPU.
+struct rmapi_cs_stats {
+  uint64_t streams;       // Streams validated
+  uint64_t rejected;      // ...and refused
+  uint64_t cache_hits;    // IBs skipped because they passed before
+  uint64_t dwords_parsed; // Dwords actually walked
+  uint64_t dwords_copied; // IB dwords copied out of client memory
+  uint64_t validate_ns;   // CPU time spent on all of it
+};
+
+// The IB copies a validated stream runs from (the client can't touch those)
+struct rmapi_cs_shadow;
+
+int rmapi_cs_validate(int32_t pid, uint32_t engine, const void *cmds,
+                      size_t size, struct amdgpu_buffer **bo_list,
+                      uint32_t bo_count);
+int rmapi_cs_validate_shadow(int32_t pid, uint32_t engine, void *cmds,
+                             size_t size, struct amdgpu_buffer **bo_list,
+                             uint32_t bo_count, struct rmapi_cs_shadow **shadow);
+void rmapi_cs_shadow_release(void *shadow);
+struct rmapi_sched_hold rmapi_cs_shadow_hold(struct rmapi_cs_shadow *shadow);
+void rmapi_cs_get_stats(struct rmapi_cs_stats *out);
+void rmapi_cs_cache_flush(void);
+
+// BO lists (rmapi_bo_list.c): the buffers a client's submissions touch, made
+// once and named by handle on every submit. The list holds a reference on
+// each buffer and only looks at entries again when they changed.
+#define RMAPI_BO_LIST_READ (1u << 0)
+#define RMAPI_BO_LIST_WRITE (1u << 1)  // Neither = both
+#define RMAPI_BO_LIST_MAX_PRIORITY 32  // Same as AMDGPU_BO_LIST_MAX_PRIORITY
+
+struct rmapi_bo_list_entry {
+  uint32_t bo_handle; // PRIME / ALLOC_MEMORY buffer or userptr
+  uint32_t priority;  // 0..RMAPI_BO_LIST_MAX_PRIORITY, higher stays in VRAM longer
+  uint32_t flags;     // RMAPI_BO_LIST_READ | RMAPI_BO_LIST_WRITE
+  uint32_t pad;
+};
+
+struct rmapi_bo_list_stats {
+  uint64_t lists;       // Alive right now
+  uint64_t acquires;    // Submissions that used a list
+  uint64_t cached;      // ...and found nothing to look at again
+  uint64_t revalidated; // Entries looked at again (new, moved, userptrs)
+};
+
+struct rmapi_bo_list;
+struct rmapi_sched_hold;
+
+int rmapi_bo_list_create(int32_t pid, const struct rmapi_bo_list_entry *entries,
+                         uint32_t count, uint32_t *handle);
+int rmapi_bo_list_update(int32_t pid, uint32_t handle,
+                         const struct rmapi_bo_list_entry *set,
+                         uint32_t set_count, const uint32_t *remove,
+                         uint32_t remove_count);
+int rmapi_bo_list_destroy(int32_t pid, uint32_t handle);
+void rmapi_bo_list_release_pid(int32_t pid);
+struct rmapi_bo_list *rmapi_bo_list_acquire(int32_t pid, uint32_t handle,
+                                            struct amdgpu_command_buffer *cb);
+int rmapi_bo_list_hold(struct rmapi_bo_list *list,
+                       struct amdgpu_command_buffer *cb,
+                       struct rmapi_sched_hold *hold);
+void rmapi_bo_list_put(struct rmapi_bo_list *list);
+void rmapi_bo_list_get_stats(struct rmapi_bo_list_stats *out);
+
+// Timeline syncobjs (rmapi_syncobj.c): 64-bit points that only go up. Waits
+// and dependencies may name points nobody signaled yet (wait-before-signal).
+#define RMAPI_SYNCOBJ_WAIT_ALL (1u << 0) // Otherwise any one point will do
+#define RMAPI_SYNCOBJ_WAIT_FOREVER UINT64_MAX
+
+struct rmapi_syncobj_point {
+  uint32_t handle;
+  uint32_t pad;
+  uint64_t point;
+};
+
+// status is -1 if a syncobj the work waited on got destroyed first
+typedef void (*rmapi_syncobj_cb)(void *data, int status);
+
+int rmapi_syncobj_create(struct OBJGPU *gpu, int32_t pid, uint64_t initial,
+                         uint32_t *handle);
+// pid: who's asking. Only the owner and whoever it shared with get through;
+// pid 0 is the server itself and always does.
+int rmapi_syncobj_destroy(int32_t pid, uint32_t handle);
+int rmapi_syncobj_share(int32_t pid, uint32_t handle, int32_t with);
+void rmapi_syncobj_release_pid(int32_t pid);
+int rmapi_syncobj_signal(int32_t pid, uint32_t handle, uint64_t point);
+int rmapi_syncobj_reset(int32_t pid, uint32_t handle);
+int rmapi_syncobj_query(int32_t pid, uint32_t handle, uint64_t *payload);
+int rmapi_syncobj_wait(const struct rmapi_syncobj_point *pts, uint32_t count,
+                       uint32_t flags, uint64_t timeout_ns, uint32_t *first);
+int rmapi_syncobj_when(const struct rmapi_syncobj_point *pts, uint32_t count,
+                       rmapi_syncobj_cb fn, void *data);
+int rmapi_syncobj_export_eventfd(int32_t pid, uint32_t handle, uint64_t point,
+                                 int *fd);
+int rmapi_syncobj_export_sync_file(int32_t pid, uint32_t handle,
+                                   uint64_t point, int *fd);
+
+// Dependency-aware scheduling (rmapi_sched.c): jobs wait in a per-engine FIFO
+// until their fences / syncobj points / shared BOs are ready. Waits on work
+// already on another ring become WAIT_REG_MEM (POLL_REGMEM) packets instead.
+#define RMAPI_SCHED_DEP_FENCE 0   // id = ring (< RMAPI_SCHED_RING_COUNT), value = seq
+#define RMAPI_SCHED_DEP_SYNCOBJ 1 // id = syncobj handle, value = point
+#define RMAPI_SCHED_MAX_CLIENT_JOBS 256 // Unretired jobs per client (pid 0: no cap)
+
+struct rmapi_sched_dep {
+  uint32_t type;
+  uint32_t id;
+  uint64_t value;
+};
+
+// Something a job keeps alive until its fence retires (IB copies, BO list
+// references). release(data) runs once the job is done, failed or dropped.
+// bos: buffers in there the job may touch too (IB copies), NULL if none.
+struct rmapi_sched_hold {
+  void (*release)(void *data);
+  void *data;
+  struct amdgpu_buffer **bos;
+  uint32_t bo_count;
+};
+
+struct rmapi_sched_ops {
+  // Put the stream (already ending with its fence write) on the engine's
+  // ring. Report completion with rmapi_sched_fence_done. Non-zero = failed.
+  // cb->bo_list is all the job may touch: its own buffers, IB copies and
+  // the fence slots.
+  int (*run_job)(void *priv, int32_t pid, uint32_t engine,
+                 struct amdgpu_command_buffer *cb, uint64_t seq);
+  void *priv;
+  // Engines whose run_job is done with the stream before it returns. Their
+  // jobs wait for other engines here: a poll would only stall the caller.
+  uint32_t sync_engines;
+  // Ring reset: forget engine's jobs from from_seq on, their fences are the
+  // scheduler's again. -1 = one is still running, only a bigger reset stops
+  // it. Called with the scheduler locked. NULL: run_job keeps nothing queued.
+  int (*cancel_jobs)(void *priv, uint32_t engine, uint64_t from_seq);
+};
+
+struct rmapi_sched_stats {
+  uint64_t jobs;      // Submitted
+  uint64_t cpu_held;  // Jobs that had to wait in the pending queue
+  uint64_t hw_waits;  // Dependencies the CP waited for instead of us
+  uint64_t implicit;  // Dependencies found through shared BOs
+  uint64_t cancelled; // Ran as a bare fence (owner left, syncobj destroyed)
+  uint64_t refused;   // Client had RMAPI_SCHED_MAX_CLIENT_JOBS out already
+  uint32_t pending;   // In the queue right now
+};
+
+// What resetting a ring did to its jobs
+struct rmapi_sched_reset {
+  int32_t guilty_pid;    // Owner of the job that hung (-1: none found)
+  uint32_t resubmitted;  // Innocent jobs that went out again
+  uint32_t cancelled;    // Guilty client's jobs that were still queued
+};
+
+void rmapi_sched_set_ops(const struct rmapi_sched_ops *ops);
+int rmapi_sched_submit(int32_t pid, uint32_t engine,
+                       const struct amdgpu_command_buffer *cb,
+                       const struct rmapi_sched_dep *deps, uint32_t dep_count,
+                       const struct rmapi_syncobj_point *signals,
+                       uint32_t signal_count, uint64_t *seq);
+int rmapi_sched_submit_held(int32_t pid, uint32_t engine,
+                            const struct amdgpu_command_buffer *cb,
+                            const struct rmapi_sched_dep *deps,
+                            uint32_t dep_count,
+                            const struct rmapi_syncobj_point *signals,
+                            uint32_t signal_count,
+                            const struct rmapi_sched_hold *holds,
+                            uint32_t hold_count, uint64_t *seq);
+int rmapi_sched_fence_done(uint32_t engine, uint64_t seq, int error);
+int rmapi_sched_fence_wait(uint32_t engine, uint64_t seq, uint64_t timeout_ns);
+void rmapi_sched_kick(void);
+void rmapi_sched_release_pid(int32_t pid);
+int rmapi_sched_reset_ring(uint32_t engine, uint64_t stuck_seq,
+                           struct rmapi_sched_reset *out);
+void rmapi_sched_get_stats(struct rmapi_sched_stats *out);
+void rmapi_sched_fini(void);
+
+// Ring recovery (rmapi_recovery.c): a hung ring gets a queue reset first,
+// then its IP block, then the whole GPU, climbing only when the ring hangs
+// again on the jobs the last reset resubmitted.
+#define RMAPI_RECOVERY_TIER_QUEUE 0
+#define RMAPI_RECOVERY_TIER_IP 1
+#define RMAPI_RECOVERY_TIER_FULL 2
+#define RMAPI_RECOVERY_TIER_COUNT 3
+
+struct rmapi_recovery_tier_stats {
+  uint64_t count;
+  uint64_t downtime_ns;     // Hang reported -> ring has its work back
+  uint64_t downtime_max_ns;
+};
+
+struct rmapi_recovery_stats {
+  struct rmapi_recovery_tier_stats tiers[RMAPI_RECOVERY_TIER_COUNT];
+  uint64_t guilty_jobs;  // Jobs failed for hanging a ring
+  uint64_t resubmitted;  // Innocent jobs that went out again
+  uint64_t cancelled;    // Queued jobs of guilty clients
+};
+
+int rmapi_recovery_ring_hang(struct OBJGPU *gpu, uint32_t ring,
+                             uint64_t stuck_seq, uint64_t last_seq);
+void rmapi_recovery_get_stats(struct rmapi_recovery_stats *out);
+void rmapi_recovery_reset(void);
+
+// Ring muxing (rmapi_ring_mux.c): GFX and GFX_HIGH jobs share the one GFX
+// ring. High jobs jump the queue; with chunked set, normal jobs are also cut
+// at IB boundaries so a high job can get in between (preemption).
+struct rmapi_ring_mux_ops {
+  // Put dwords on the hardware ring and return when they ran. Non-zero = failed.
+  int (*run)(void *priv, int32_t pid, const uint32_t *dw, uint32_t ndw);
+  void *priv;
+  bool chunked;
+};
+
+struct rmapi_ring_mux_stats {
+  uint64_t jobs[2];          // Finished: [0] GFX, [1] GFX_HIGH
+  uint64_t chunks;           // Pieces that went to the ring
+  uint64_t preemptions;      // Normal jobs stopped for high ones
+  uint64_t resubmitted_dw;   // Dwords of preempted jobs sent after resuming
+  uint64_t preamble_dw;      // State replayed in front of them
+  uint64_t high_wait_max_ns; // Longest a high job waited for the ring
+  uint64_t cancelled;        // Jobs a ring reset took back
+};
+
+int rmapi_ring_mux_init(const struct rmapi_ring_mux_ops *ops);
+bool rmapi_ring_mux_active(void);
+int rmapi_ring_mux_submit(int32_t pid, uint32_t engine,
+                          const struct amdgpu_command_buffer *cb, uint64_t seq);
+int rmapi_ring_mux_cancel(uint32_t engine, uint64_t from_seq);
+void rmapi_ring_mux_get_stats(struct rmapi_ring_mux_stats *out);
+void rmapi_ring_mux_fini(void);
+
+// User-mode queues (rmapi_userq.c): a ring, rptr/wptr writeback and a
+// doorbell mapped into the app, described to MES (or our software CP) by an
+// MQD. Submitting is memory writes only; see drivers/amdgpu/amdgpu_userq.h.
+struct rmapi_userq_info {
+  uint32_t id;
+  uint32_t syncobj;         // Signaled with the wptr of every retired submit
+  uint32_t ring_dw;
+  uint32_t doorbell_offset; // Doorbell index, as programmed into the MQD
+  uint64_t size;            // Bytes to map from the fd
+};
+
+int rmapi_userq_create(struct OBJGPU *gpu, int32_t pid, uint32_t engine,
+                       uint32_t ring_bytes, uint32_t bo_list,
+                       struct rmapi_userq_info *info, int *fd);
+int rmapi_userq_destroy(int32_t pid, uint32_t id);
+void rmapi_userq_release_pid(int32_t pid);
+void rmapi_userq_fini(void);
+
+// Copy manager (rmapi_copy.c): copies and fills recorded into one SDMA
+// stream and sent to the DMA engine in one go, off the GFX queue. Copies
+// that continue the previous one just grow its packet. BOs must stay alive
+// until the batch is flushed.
+struct rmapi_copy_batch;
+
+// A 2D box between two linear surfaces, sizes in elements of bpp bytes
+struct rmapi_copy_rect {
+  uint64_t dst_offset, src_offset; // Where each surface starts in its BO
+  uint32_t dst_pitch, src_pitch;   // Elements per row
+  uint32_t dst_x, dst_y;
+  uint32_t src_x, src_y;
+  uint32_t width, height;
+  uint32_t bpp;                    // 1, 2, 4, 8 or 16
+};
+
+struct rmapi_copy_stats {
+  uint64_t batches;  // Flushed to the scheduler
+  uint64_t ops;      // Copies / fills recorded
+  uint64_t merged;   // ...that only grew the packet before them
+  uint64_t bytes;
+};
+
+struct rmapi_copy_batch *rmapi_copy_begin(struct OBJGPU *gpu, int32_t pid);
+int rmapi_copy_buffer(struct rmapi_copy_batch *b, struct amdgpu_buffer *dst,
+                      uint64_t dst_offset, struct amdgpu_buffer *src,
+                      uint64_t src_offset, uint64_t size);
+int rmapi_copy_rect(struct rmapi_copy_batch *b, struct amdgpu_buffer *dst,
+                    struct amdgpu_buffer *src, const struct rmapi_copy_rect *r);
+int rmapi_copy_fill(struct rmapi_copy_batch *b, struct amdgpu_buffer *dst,
+                    uint64_t dst_offset, uint32_t value, uint64_t size);
+int rmapi_copy_flush(struct rmapi_copy_batch *b,
+                     const struct rmapi_syncobj_point *signals,
+                     uint32_t signal_count, uint64_t *seq);
+void rmapi_copy_end(struct rmapi_copy_batch *b);
+void rmapi_copy_get_stats(struct rmapi_copy_stats *out);
+
+// Capture (rmapi_capture.c): every IPC request and reply the server sees, plus
+// each BO's contents the first time a submit could read it, in one binary
+// trace that tools/amd_replay.c plays back. The server turns it on when
+// AMDGPU_CAPTURE=<file> is set. Little-endian, native struct layout.
+#define RMAPI_CAPTURE_MAGIC 0x50414354u // "TCAP"
+#define RMAPI_CAPTURE_VERSION 1
+
+#define RMAPI_CAPTURE_REQUEST 1 // Payload = the request, as the client sent it
+#define RMAPI_CAPTURE_REPLY 2   // Payload = what the server answered
+#define RMAPI_CAPTURE_BO 3      // struct rmapi_capture_bo + contents
+#define RMAPI_CAPTURE_CLIENT 4  // A client came (type 1) or left (type 0)
+
+struct rmapi_capture_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t start_ns;  // CLOCK_MONOTONIC when the capture started
+  uint32_t hal_mode;  // AMDGPU_HAL_MODE_* it was captured on
+  uint32_t pad;
+};
+
+struct rmapi_capture_record {
+  uint32_t kind;      // RMAPI_CAPTURE_*
+  uint32_t size;      // Payload bytes after this header
+  uint64_t time_ns;   // Since start_ns
+  int32_t pid;
+  uint32_t type;      // IPC_REQ_* / IPC_REP_*
+  uint32_t id;        // IPC message id, pairs a reply with its request
+  uint32_t pad;
+};
+
+// Records start 8-byte aligned: the payload is padded up to a multiple of 8
+#define RMAPI_CAPTURE_RECORD_BYTES(rec) \
+  (sizeof(struct rmapi_capture_record) + (((uint64_t)(rec)->size + 7) & ~7ull))
+
+// Trailing zeros are not stored: contents may be shorter than size
+struct rmapi_capture_bo {
+  uint32_t handle;
+  uint32_t pad;
+  uint64_t gpu_addr;
+  uint64_t size;
+};
+
+int rmapi_capture_start(const char *path);
+void rmapi_capture_stop(void);
+bool rmapi_capture_active(void);
+void rmapi_capture_message(uint32_t kind, int32_t pid, uint32_t type,
+                           uint32_t id, const void *data, uint32_t size);
+void rmapi_capture_bos(int32_t pid);
+
+#endif
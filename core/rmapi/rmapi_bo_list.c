@@ -0,0 +1,435 @@
+#include "rmapi.h"
+#include "../../os/os_interface.h"
+#include <pthread.h>
+#include <string.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! These are the BO Lists - the guest list for a submission.
+ * A game touches the same 2,000 buffers every frame. Telling us which ones
+ * on every submit means 2,000 handle lookups, a sort and a pile of
+ * residency checks per frame, for an answer that didn't change.
+ *
+ * So, like amdgpu_bo_list in the kernel, the client makes the list once
+ * (each entry with a priority and whether the GPU reads or writes it),
+ * patches it when its working set changes and names it by handle on every
+ * submit. The list keeps a reference on each buffer, so they can't vanish
+ * under it, and the pointers it hands out stay good.
+ *
+ * What a submit pays:
+ *   - Nothing changed: compare each buffer's generation with the one we saw.
+ *   - A buffer moved (eviction): only that entry gets looked at again.
+ *   - Entries added/removed: the order (priority, userptrs last) is rebuilt.
+ *   - Userptrs can be invalidated behind our back: when any userptr changed,
+ *     the list's userptr entries get resolved again.
+ *
+ * A queued job can outlive all that: the app may patch or destroy the list
+ * (and drop its buffers) before the job runs. rmapi_bo_list_hold gives the
+ * job its own references and its own copy of the pointers, released when
+ * its fence retires.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+struct bo_list_entry {
+  struct rmapi_bo_list_entry info;
+  struct amdgpu_buffer *held; // Our reference (NULL for userptrs)
+  struct amdgpu_buffer buf;   // Userptrs: what it resolved to last time
+  uint32_t generation;        // held->generation when we last looked
+  bool seen;                  // generation is meaningful
+};
+
+struct rmapi_bo_list {
+  uint32_t handle;
+  int32_t pid;
+  struct bo_list_entry *entries;
+  uint32_t count, max;
+  struct amdgpu_buffer **bufs; // What submissions get, priority order
+  uint32_t nbufs;
+  bool dirty;                  // Entries changed: rebuild bufs
+  bool has_userptr;
+  uint32_t userptr_gen;        // rmapi_userptr_generation() bufs were built at
+  int refs;                    // Lookup + everybody in acquire/put
+  bool destroyed;
+  pthread_mutex_t lock;        // Held between acquire and put
+  struct rmapi_bo_list *next;
+};
+
+// A job's share of a list (rmapi_bo_list_hold). One allocation: this, then
+// bufs, userptrs and handles.
+struct bo_list_hold {
+  int32_t pid;
+  uint32_t nhandles;
+  uint32_t *handles;              // Buffers we took a reference on
+  struct amdgpu_buffer **bufs;    // What the job sees, the list's order
+  struct amdgpu_buffer *userptrs; // Copies: the list's change under us
+};
+
+static struct rmapi_bo_list *bo_list_head = NULL;
+static uint32_t bo_list_next_handle = 1;
+static struct rmapi_bo_list_stats bo_list_stats;
+static pthread_mutex_t bo_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct rmapi_bo_list *bo_list_find_locked(int32_t pid, uint32_t handle) {
+  for (struct rmapi_bo_list *l = bo_list_head; l; l = l->next)
+    if (l->handle == handle && l->pid == pid && !l->destroyed)
+      return l;
+  return NULL;
+}
+
+static int bo_list_entry_ok(const struct rmapi_bo_list_entry *e) {
+  return e->priority <= RMAPI_BO_LIST_MAX_PRIORITY &&
+         !(e->flags & ~(RMAPI_BO_LIST_READ | RMAPI_BO_LIST_WRITE));
+}
+
+// Take our reference on the buffer behind e. Buffers the client doesn't hold
+// (or made up) don't get in.
+static int bo_list_entry_init(struct bo_list_entry *e, int32_t pid,
+                              const struct rmapi_bo_list_entry *info) {
+  memset(e, 0, sizeof(*e));
+  e->info = *info;
+  if (!e->info.flags)
+    e->info.flags = RMAPI_BO_LIST_READ | RMAPI_BO_LIST_WRITE;
+  e->held = rmapi_prime_hold(pid, info->bo_handle);
+  if (e->held)
+    return 0;
+  return rmapi_userptr_get(info->bo_handle, &e->buf); // Userptr, or nothing
+}
+
+static void bo_list_entry_fini(struct bo_list_entry *e, int32_t pid) {
+  if (e->held)
+    rmapi_prime_unref(NULL, pid, e->info.bo_handle);
+  e->held = NULL;
+}
+
+static void bo_list_free(struct rmapi_bo_list *l) {
+  for (uint32_t i = 0; i < l->count; i++)
+    bo_list_entry_fini(&l->entries[i], l->pid);
+  pthread_mutex_destroy(&l->lock);
+  os_prim_free(l->entries);
+  os_prim_free(l->bufs);
+  os_prim_free(l);
+}
+
+static void bo_list_unref(struct rmapi_bo_list *l) {
+  pthread_mutex_lock(&bo_list_lock);
+  bool last = --l->refs == 0;
+  if (last)
+    for (struct rmapi_bo_list **pp = &bo_list_head; *pp; pp = &(*pp)->next)
+      if (*pp == l) {
+        *pp = l->next;
+        break;
+      }
+  pthread_mutex_unlock(&bo_list_lock);
+  if (last)
+    bo_list_free(l);
+}
+
+static int bo_list_reserve(struct rmapi_bo_list *l, uint32_t count) {
+  if (count <= l->max)
+    return 0;
+  uint32_t max = l->max ? l->max : 16;
+  while (max < count)
+    max *= 2;
+  struct bo_list_entry *entries = os_prim_alloc(max * sizeof(*entries));
+  if (!entries)
+    return -1;
+  if (l->count)
+    memcpy(entries, l->entries, l->count * sizeof(*entries));
+  os_prim_free(l->entries);
+  l->entries = entries;
+  l->max = max;
+  return 0;
+}
+
+static struct bo_list_entry *bo_list_entry_find(struct rmapi_bo_list *l,
+                                                uint32_t bo_handle) {
+  for (uint32_t i = 0; i < l->count; i++)
+    if (l->entries[i].info.bo_handle == bo_handle)
+      return &l->entries[i];
+  return NULL;
+}
+
+// Apply set (add or change) and remove to the entries. l->lock held. On
+// failure nothing changed.
+static int bo_list_apply(struct rmapi_bo_list *l,
+                         const struct rmapi_bo_list_entry *set,
+                         uint32_t set_count, const uint32_t *remove,
+                         uint32_t remove_count) {
+  for (uint32_t i = 0; i < set_count; i++)
+    if (!bo_list_entry_ok(&set[i]))
+      return -1;
+  if (bo_list_reserve(l, l->count + set_count) != 0)
+    return -1;
+
+  // New buffers first, so a bad handle leaves the list as it was. Later
+  // duplicates in set find the new entry and just update it.
+  uint32_t base = l->count;
+  for (uint32_t i = 0; i < set_count; i++) {
+    if (bo_list_entry_find(l, set[i].bo_handle))
+      continue;
+    if (bo_list_entry_init(&l->entries[l->count], l->pid, &set[i]) != 0) {
+      os_prim_log("RMAPI BO List: pid %d has no buffer 0x%x\n", l->pid,
+                  set[i].bo_handle);
+      while (l->count > base)
+        bo_list_entry_fini(&l->entries[--l->count], l->pid);
+      return -1;
+    }
+    l->count++;
+  }
+  for (uint32_t i = 0; i < set_count; i++) {
+    struct bo_list_entry *e = bo_list_entry_find(l, set[i].bo_handle);
+    e->info.priority = set[i].priority;
+    e->info.flags = set[i].flags ? set[i].flags
+                                 : RMAPI_BO_LIST_READ | RMAPI_BO_LIST_WRITE;
+  }
+  for (uint32_t i = 0; i < remove_count; i++) {
+    struct bo_list_entry *e = bo_list_entry_find(l, remove[i]);
+    if (!e)
+      continue;
+    bo_list_entry_fini(e, l->pid);
+    *e = l->entries[--l->count];
+  }
+  l->dirty = true;
+  return 0;
+}
+
+// Priority order (highest first, like the kernel's buckets), userptrs last.
+// l->lock held.
+static int bo_list_rebuild(struct rmapi_bo_list *l) {
+  os_prim_free(l->bufs);
+  l->bufs = os_prim_alloc((l->count ? l->count : 1) * sizeof(*l->bufs));
+  l->nbufs = 0;
+  if (!l->bufs)
+    return -1;
+  l->has_userptr = false;
+  for (int userptr = 0; userptr < 2; userptr++)
+    for (int prio = RMAPI_BO_LIST_MAX_PRIORITY; prio >= 0; prio--)
+      for (uint32_t i = 0; i < l->count; i++) {
+        struct bo_list_entry *e = &l->entries[i];
+        if ((e->held == NULL) != userptr || e->info.priority != (uint32_t)prio)
+          continue;
+        l->bufs[l->nbufs++] = e->held ? e->held : &e->buf;
+        e->seen = false;
+        l->has_userptr |= userptr;
+      }
+  l->userptr_gen = rmapi_userptr_generation() - 1; // Resolve them now
+  l->dirty = false;
+  return 0;
+}
+
+int rmapi_bo_list_create(int32_t pid, const struct rmapi_bo_list_entry *entries,
+                         uint32_t count, uint32_t *handle) {
+  if (!handle || (count && !entries))
+    return -1;
+  struct rmapi_bo_list *l = os_prim_alloc(sizeof(*l));
+  if (!l)
+    return -1;
+  memset(l, 0, sizeof(*l));
+  l->pid = pid;
+  l->refs = 1;
+  pthread_mutex_init(&l->lock, NULL);
+  if (bo_list_apply(l, entries, count, NULL, 0) != 0) {
+    bo_list_free(l);
+    return -1;
+  }
+
+  pthread_mutex_lock(&bo_list_lock);
+  l->handle = bo_list_next_handle++;
+  l->next = bo_list_head;
+  bo_list_head = l;
+  bo_list_stats.lists++;
+  *handle = l->handle;
+  pthread_mutex_unlock(&bo_list_lock);
+  return 0;
+}
+
+// Patch a list: entries in set are added (or get their priority / flags
+// changed), buffers in remove leave. All or nothing.
+int rmapi_bo_list_update(int32_t pid, uint32_t handle,
+                         const struct rmapi_bo_list_entry *set,
+                         uint32_t set_count, const uint32_t *remove,
+                         uint32_t remove_count) {
+  if ((set_count && !set) || (remove_count && !remove))
+    return -1;
+  pthread_mutex_lock(&bo_list_lock);
+  struct rmapi_bo_list *l = bo_list_find_locked(pid, handle);
+  if (l)
+    l->refs++;
+  pthread_mutex_unlock(&bo_list_lock);
+  if (!l)
+    return -1;
+
+  pthread_mutex_lock(&l->lock);
+  int ret = bo_list_apply(l, set, set_count, remove, remove_count);
+  pthread_mutex_unlock(&l->lock);
+  bo_list_unref(l);
+  return ret;
+}
+
+// Submissions already using it keep it until they're done with it
+int rmapi_bo_list_destroy(int32_t pid, uint32_t handle) {
+  pthread_mutex_lock(&bo_list_lock);
+  struct rmapi_bo_list *l = bo_list_find_locked(pid, handle);
+  if (l) {
+    l->destroyed = true;
+    bo_list_stats.lists--;
+  }
+  pthread_mutex_unlock(&bo_list_lock);
+  if (!l)
+    return -1;
+  bo_list_unref(l);
+  return 0;
+}
+
+// Client hung up. Before rmapi_prime_release_pid: our references are its too.
+void rmapi_bo_list_release_pid(int32_t pid) {
+  for (;;) {
+    uint32_t handle = 0;
+    pthread_mutex_lock(&bo_list_lock);
+    for (struct rmapi_bo_list *l = bo_list_head; l && !handle; l = l->next)
+      if (l->pid == pid && !l->destroyed)
+        handle = l->handle;
+    pthread_mutex_unlock(&bo_list_lock);
+    if (!handle || rmapi_bo_list_destroy(pid, handle) != 0)
+      return;
+  }
+}
+
+// The list's buffers for one submission: fills cb->bo_list / bo_count. The
+// list stays locked (and its buffers put) until rmapi_bo_list_put.
+struct rmapi_bo_list *rmapi_bo_list_acquire(int32_t pid, uint32_t handle,
+                                            struct amdgpu_command_buffer *cb) {
+  if (!cb)
+    return NULL;
+  pthread_mutex_lock(&bo_list_lock);
+  struct rmapi_bo_list *l = bo_list_find_locked(pid, handle);
+  if (l)
+    l->refs++;
+  pthread_mutex_unlock(&bo_list_lock);
+  if (!l)
+    return NULL;
+
+  pthread_mutex_lock(&l->lock);
+  uint64_t revalidated = 0;
+  int ret = l->dirty ? bo_list_rebuild(l) : 0;
+
+  // Userptrs can't be held: look them all up again if any of them changed
+  uint32_t ugen = rmapi_userptr_generation();
+  if (ret == 0 && l->has_userptr && l->userptr_gen != ugen) {
+    for (uint32_t i = 0; i < l->count && ret == 0; i++) {
+      struct bo_list_entry *e = &l->entries[i];
+      if (e->held)
+        continue;
+      if (rmapi_userptr_get(e->info.bo_handle, &e->buf) != 0) {
+        os_prim_log("RMAPI BO List: Userptr 0x%x in list %u is gone\n",
+                    e->info.bo_handle, l->handle);
+        ret = -1;
+      }
+      revalidated++;
+    }
+    if (ret == 0)
+      l->userptr_gen = ugen;
+  }
+
+  // Everything else: only buffers that moved since we last looked
+  for (uint32_t i = 0; i < l->count && ret == 0; i++) {
+    struct bo_list_entry *e = &l->entries[i];
+    if (!e->held || (e->seen && e->generation == e->held->generation))
+      continue;
+    amdgpu_residency_set_priority(e->held, (int)e->info.priority);
+    e->generation = e->held->generation;
+    e->seen = true;
+    revalidated++;
+  }
+
+  pthread_mutex_lock(&bo_list_lock);
+  bo_list_stats.acquires++;
+  bo_list_stats.revalidated += revalidated;
+  if (!revalidated)
+    bo_list_stats.cached++;
+  pthread_mutex_unlock(&bo_list_lock);
+
+  if (ret != 0) {
+    rmapi_bo_list_put(l);
+    return NULL;
+  }
+  cb->bo_list = l->bufs;
+  cb->bo_count = l->nbufs;
+  return l;
+}
+
+static void bo_list_hold_release(void *data) {
+  struct bo_list_hold *h = data;
+  for (uint32_t i = 0; i < h->nhandles; i++)
+    rmapi_prime_unref(NULL, h->pid, h->handles[i]);
+  os_prim_free(h);
+}
+
+// Keep the list's buffers for a job until its fence retires, so the put can
+// come right after the submit. Between acquire and put: cb->bo_list then
+// points at the hold's copy, and the hold goes to rmapi_sched_submit_held
+// (release it yourself if that fails).
+int rmapi_bo_list_hold(struct rmapi_bo_list *l,
+                       struct amdgpu_command_buffer *cb,
+                       struct rmapi_sched_hold *hold) {
+  if (!l || !cb || !hold)
+    return -1;
+  uint32_t nheld = 0;
+  for (uint32_t i = 0; i < l->count; i++)
+    nheld += l->entries[i].held != NULL;
+  uint32_t nuser = l->nbufs - nheld; // Userptrs are last in bufs
+  struct bo_list_hold *h = os_prim_alloc(
+      sizeof(*h) + l->nbufs * sizeof(*h->bufs) +
+      nuser * sizeof(*h->userptrs) + nheld * sizeof(*h->handles));
+  if (!h)
+    return -1;
+  h->pid = l->pid;
+  h->nhandles = 0;
+  h->bufs = (struct amdgpu_buffer **)(h + 1);
+  h->userptrs = (struct amdgpu_buffer *)(h->bufs + l->nbufs);
+  h->handles = (uint32_t *)(h->userptrs + nuser);
+
+  for (uint32_t i = 0; i < l->count; i++) {
+    struct bo_list_entry *e = &l->entries[i];
+    if (!e->held)
+      continue;
+    if (rmapi_prime_hold(l->pid, e->info.bo_handle) != e->held) {
+      bo_list_hold_release(h); // Can't happen while the list holds it
+      return -1;
+    }
+    h->handles[h->nhandles++] = e->info.bo_handle;
+  }
+  for (uint32_t i = 0; i < l->nbufs; i++) {
+    h->bufs[i] = l->bufs[i];
+    if (i >= nheld) {
+      h->userptrs[i - nheld] = *l->bufs[i];
+      h->bufs[i] = &h->userptrs[i - nheld];
+    }
+  }
+
+  cb->bo_list = h->bufs;
+  cb->bo_count = l->nbufs;
+  struct rmapi_sched_hold held = {bo_list_hold_release, h, NULL, 0};
+  *hold = held; // The job's buffers are cb's already
+  return 0;
+}
+
+void rmapi_bo_list_put(struct rmapi_bo_list *l) {
+  if (!l)
+    return;
+  pthread_mutex_unlock(&l->lock);
+  bo_list_unref(l);
+}
+
+void rmapi_bo_list_get_stats(struct rmapi_bo_list_stats *out) {
+  if (!out)
+    return;
+  pthread_mutex_lock(&bo_list_lock);
+  *out = bo_list_stats;
+  pthread_mutex_unlock(&bo_list_lock);
+}
@@ -0,0 +1,212 @@
+#include "rmapi.h"
+#include "../../os/os_interface.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the Flight Recorder.
+ * "It only stutters on that one game, on that one machine" - now you can
+ * bring the machine home. With AMDGPU_CAPTURE=<file> the server writes down
+ * every request its clients make and what it answered, with timestamps.
+ * Right before a submit it also dumps the BOs the client holds that it
+ * hasn't dumped yet, so the trace carries the vertex data, shaders and
+ * descriptors the commands point at.
+ *
+ * amd_replay reads it back against whatever backend you like (sim, DRM,
+ * MMIO), as fast as it can or with the original pacing, and tells you how
+ * long each frame took.
+ *
+ * Records go through one big stdio buffer under a lock; clients only pay
+ * for a memcpy most of the time. BOs are stored without their trailing
+ * zeros, fresh allocations are mostly zeros.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define CAPTURE_BUFFER (4u << 20)
+#define CAPTURE_SEEN_BUCKETS 256
+
+// A BO whose contents are already in the trace
+struct capture_seen {
+  uint32_t handle;
+  uint64_t gpu_addr;
+  struct capture_seen *next;
+};
+
+static FILE *capture_file = NULL;
+static char *capture_buf = NULL;
+static uint64_t capture_start_ns;
+static uint64_t capture_records, capture_bytes;
+static struct capture_seen *capture_seen[CAPTURE_SEEN_BUCKETS];
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t capture_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int rmapi_capture_start(const char *path) {
+  if (!path || !*path)
+    return -1;
+  pthread_mutex_lock(&capture_lock);
+  if (capture_file) {
+    pthread_mutex_unlock(&capture_lock);
+    return -1;
+  }
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    pthread_mutex_unlock(&capture_lock);
+    os_prim_log("RMAPI Capture: Can't open %s\n", path);
+    return -1;
+  }
+  capture_buf = os_prim_alloc(CAPTURE_BUFFER);
+  if (capture_buf)
+    setvbuf(f, capture_buf, _IOFBF, CAPTURE_BUFFER);
+
+  capture_start_ns = capture_now_ns();
+  struct rmapi_capture_header hdr = {RMAPI_CAPTURE_MAGIC, RMAPI_CAPTURE_VERSION,
+                                     capture_start_ns,
+                                     (uint32_t)amdgpu_hal_get_mode(), 0};
+  if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+    fclose(f);
+    os_prim_free(capture_buf);
+    capture_buf = NULL;
+    pthread_mutex_unlock(&capture_lock);
+    return -1;
+  }
+  capture_file = f;
+  capture_records = 0;
+  capture_bytes = sizeof(hdr);
+  pthread_mutex_unlock(&capture_lock);
+  os_prim_log("RMAPI Capture: Recording to %s\n", path);
+  return 0;
+}
+
+void rmapi_capture_stop(void) {
+  pthread_mutex_lock(&capture_lock);
+  if (capture_file) {
+    fclose(capture_file);
+    os_prim_log("RMAPI Capture: %llu records, %llu bytes\n",
+                (unsigned long long)capture_records,
+                (unsigned long long)capture_bytes);
+  }
+  capture_file = NULL;
+  os_prim_free(capture_buf); // Only after fclose, stdio still owned it
+  capture_buf = NULL;
+  for (int i = 0; i < CAPTURE_SEEN_BUCKETS; i++) {
+    while (capture_seen[i]) {
+      struct capture_seen *s = capture_seen[i];
+      capture_seen[i] = s->next;
+      os_prim_free(s);
+    }
+  }
+  pthread_mutex_unlock(&capture_lock);
+}
+
+bool rmapi_capture_active(void) {
+  return __atomic_load_n(&capture_file, __ATOMIC_RELAXED) != NULL;
+}
+
+// Header plus up to two payload pieces. capture_lock held.
+static void capture_write_locked(const struct rmapi_capture_record *rec,
+                                 const void *a, uint32_t a_size, const void *b,
+                                 uint32_t b_size) {
+  static const uint8_t zeros[8];
+  uint32_t pad = (uint32_t)(RMAPI_CAPTURE_RECORD_BYTES(rec) - sizeof(*rec)) -
+                 a_size - b_size;
+  if (fwrite(rec, sizeof(*rec), 1, capture_file) != 1 ||
+      (a_size && fwrite(a, a_size, 1, capture_file) != 1) ||
+      (b_size && fwrite(b, b_size, 1, capture_file) != 1) ||
+      (pad && fwrite(zeros, pad, 1, capture_file) != 1)) {
+    // Disk full or gone: a truncated trace still replays up to here
+    os_prim_log("RMAPI Capture: Write failed, stopping\n");
+    fclose(capture_file);
+    capture_file = NULL;
+    return;
+  }
+  capture_records++;
+  capture_bytes += RMAPI_CAPTURE_RECORD_BYTES(rec);
+}
+
+void rmapi_capture_message(uint32_t kind, int32_t pid, uint32_t type,
+                           uint32_t id, const void *data, uint32_t size) {
+  if (!rmapi_capture_active())
+    return;
+  if (!data)
+    size = 0;
+  pthread_mutex_lock(&capture_lock);
+  if (capture_file) {
+    struct rmapi_capture_record rec = {kind, size,
+                                       capture_now_ns() - capture_start_ns,
+                                       pid, type, id, 0};
+    capture_write_locked(&rec, data, size, NULL, 0);
+  }
+  pthread_mutex_unlock(&capture_lock);
+}
+
+// Remember (handle, addr). False if it was already there. capture_lock held.
+static bool capture_mark_locked(uint32_t handle, uint64_t gpu_addr) {
+  uint32_t b = (handle ^ (uint32_t)(gpu_addr >> 12)) % CAPTURE_SEEN_BUCKETS;
+  for (struct capture_seen *s = capture_seen[b]; s; s = s->next)
+    if (s->handle == handle && s->gpu_addr == gpu_addr)
+      return false;
+  struct capture_seen *s = os_prim_alloc(sizeof(*s));
+  if (!s)
+    return false; // Rather miss a BO than dump it on every submit
+  s->handle = handle;
+  s->gpu_addr = gpu_addr;
+  s->next = capture_seen[b];
+  capture_seen[b] = s;
+  return true;
+}
+
+static uint64_t capture_trim_zeros(const uint8_t *p, uint64_t size) {
+  // Whole words first while the size allows it (BO sizes are page multiples)
+  while (size >= 8 && size % 8 == 0 &&
+         ((const uint64_t *)(const void *)p)[size / 8 - 1] == 0)
+    size -= 8;
+  while (size && p[size - 1] == 0)
+    size--;
+  return size;
+}
+
+// Dump every BO pid holds that isn't in the trace yet. Called right before
+// its submits, so replay has the data before the commands that read it.
+void rmapi_capture_bos(int32_t pid) {
+  if (!rmapi_capture_active())
+    return;
+  uint32_t count = rmapi_prime_list_pid(pid, NULL, 0);
+  if (!count)
+    return;
+  uint32_t *handles = os_prim_alloc(count * sizeof(*handles));
+  if (!handles)
+    return;
+  count = rmapi_prime_list_pid(pid, handles, count);
+
+  pthread_mutex_lock(&capture_lock);
+  for (uint32_t i = 0; i < count && capture_file; i++) {
+    struct amdgpu_buffer buf;
+    if (rmapi_prime_get(handles[i], &buf) != 0 ||
+        !capture_mark_locked(handles[i], buf.gpu_addr))
+      continue;
+    // Kernel BOs nobody mapped have no CPU view: record the size only
+    uint64_t len = buf.cpu_addr ? capture_trim_zeros(buf.cpu_addr, buf.size) : 0;
+    if (len > UINT32_MAX - 8 - sizeof(struct rmapi_capture_bo))
+      len = UINT32_MAX - 8 - sizeof(struct rmapi_capture_bo); // 4G BOs, sorry
+    struct rmapi_capture_bo bo = {handles[i], 0, buf.gpu_addr, buf.size};
+    struct rmapi_capture_record rec = {
+        RMAPI_CAPTURE_BO, (uint32_t)(sizeof(bo) + len),
+        capture_now_ns() - capture_start_ns, pid, 0, 0, 0};
+    capture_write_locked(&rec, &bo, sizeof(bo), buf.cpu_addr, (uint32_t)len);
+  }
+  pthread_mutex_unlock(&capture_lock);
+  os_prim_free(handles);
+}
@@ -0,0 +1,302 @@
+#include "rmapi.h"
+#include "../../os/os_interface.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the Client Ledger - who is using how much of the GPU.
+ * Every buffer and every submission gets written down next to the pid that
+ * asked for it, same numbers the kernel shows in /proc/<pid>/fdinfo:
+ * bytes per heap (and the peak), how many BOs, how many submissions and
+ * how long each engine class was busy for them.
+ *
+ * Quotas: set a byte limit per heap (or AMDGPU_CLIENT_VRAM_QUOTA_MB for
+ * everybody's VRAM) and allocations past it fail for that client only,
+ * instead of one greedy tenant starving the whole box.
+ *
+ * pid 0 always means "this process" (in-process shims don't have a socket).
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+struct rmapi_client {
+  struct rmapi_client_stats stats;
+  struct rmapi_client *next;
+};
+
+static struct rmapi_client *client_list = NULL;
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t default_vram_quota = 0;
+static int default_quota_read = 0;
+
+static const char *client_heap_name[RMAPI_CLIENT_HEAP_COUNT] = {
+    [RMAPI_CLIENT_HEAP_VRAM] = "vram",
+    [RMAPI_CLIENT_HEAP_GTT] = "gtt",
+    [RMAPI_CLIENT_HEAP_CPU] = "cpu",
+};
+
+static const char *client_engine_name[RMAPI_CLIENT_ENGINE_COUNT] = {
+    [RMAPI_CLIENT_ENGINE_GFX] = "gfx",
+    [RMAPI_CLIENT_ENGINE_COMPUTE] = "compute",
+    [RMAPI_CLIENT_ENGINE_DMA] = "dma",
+};
+
+static int32_t client_pid(int32_t pid) { return pid ? pid : (int32_t)getpid(); }
+
+// Find the ledger page for pid, opening a new one if asked to
+static struct rmapi_client *client_find_locked(int32_t pid, int create) {
+  for (struct rmapi_client *c = client_list; c; c = c->next)
+    if (c->stats.pid == pid)
+      return c;
+  if (!create)
+    return NULL;
+
+  struct rmapi_client *c = os_prim_alloc(sizeof(*c));
+  if (!c)
+    return NULL;
+  memset(c, 0, sizeof(*c));
+  c->stats.pid = pid;
+
+  if (!default_quota_read) {
+    const char *env = getenv("AMDGPU_CLIENT_VRAM_QUOTA_MB");
+    if (env && atoi(env) > 0)
+      default_vram_quota = (uint64_t)atoi(env) << 20;
+    default_quota_read = 1;
+  }
+  c->stats.quota[RMAPI_CLIENT_HEAP_VRAM] = default_vram_quota;
+
+  c->next = client_list;
+  client_list = c;
+  return c;
+}
+
+// Nobody connected and nothing left on the books: tear the page out
+static void client_drop_if_idle_locked(struct rmapi_client *c) {
+  if (c->stats.connections || c->stats.bo_count)
+    return;
+  for (struct rmapi_client **pp = &client_list; *pp; pp = &(*pp)->next) {
+    if (*pp == c) {
+      *pp = c->next;
+      os_prim_free(c);
+      return;
+    }
+  }
+}
+
+void rmapi_client_open(int32_t pid) {
+  pthread_mutex_lock(&client_lock);
+  struct rmapi_client *c = client_find_locked(client_pid(pid), 1);
+  if (c)
+    c->stats.connections++;
+  pthread_mutex_unlock(&client_lock);
+}
+
+void rmapi_client_close(int32_t pid) {
+  pthread_mutex_lock(&client_lock);
+  struct rmapi_client *c = client_find_locked(client_pid(pid), 0);
+  if (c) {
+    if (c->stats.connections)
+      c->stats.connections--;
+    client_drop_if_idle_locked(c);
+  }
+  pthread_mutex_unlock(&client_lock);
+}
+
+// A new BO for pid. Fails (and changes nothing) if it would break the quota.
+int rmapi_client_charge(int32_t pid, uint32_t heap, uint64_t bytes) {
+  if (heap >= RMAPI_CLIENT_HEAP_COUNT)
+    return -1;
+
+  int ret = 0;
+  uint64_t used = 0, quota = 0;
+  pthread_mutex_lock(&client_lock);
+  struct rmapi_client *c = client_find_locked(client_pid(pid), 1);
+  if (!c) {
+    ret = -1;
+  } else if (c->stats.quota[heap] &&
+             c->stats.memory[heap] + bytes > c->stats.quota[heap]) {
+    c->stats.quota_hits++;
+    used = c->stats.memory[heap];
+    quota = c->stats.quota[heap];
+    ret = -2;
+  } else {
+    c->stats.memory[heap] += bytes;
+    if (c->stats.memory[heap] > c->stats.peak[heap])
+      c->stats.peak[heap] = c->stats.memory[heap];
+    c->stats.bo_count++;
+  }
+  pthread_mutex_unlock(&client_lock);
+
+  if (ret == -2) {
+    os_prim_log("RMAPI: pid %d is over its %s quota (%llu + %llu > %llu bytes)\n",
+                client_pid(pid), client_heap_name[heap],
+                (unsigned long long)used, (unsigned long long)bytes,
+                (unsigned long long)quota);
+    ret = -1;
+  }
+  return ret;
+}
+
+// The residency manager moved one of pid's buffers to another heap. That was
+// the driver's call, not the client's: no quota check, and it never fails.
+void rmapi_client_move(int32_t pid, uint32_t from, uint32_t to, uint64_t bytes) {
+  if (from >= RMAPI_CLIENT_HEAP_COUNT || to >= RMAPI_CLIENT_HEAP_COUNT ||
+      from == to)
+    return;
+  pthread_mutex_lock(&client_lock);
+  struct rmapi_client *c = client_find_locked(client_pid(pid), 0);
+  if (c) {
+    c->stats.memory[from] -= bytes < c->stats.memory[from] ? bytes
+                                                           : c->stats.memory[from];
+    c->stats.memory[to] += bytes;
+    if (c->stats.memory[to] > c->stats.peak[to])
+      c->stats.peak[to] = c->stats.memory[to];
+  }
+  pthread_mutex_unlock(&client_lock);
+}
+
+void rmapi_client_uncharge(int32_t pid, uint32_t heap, uint64_t bytes) {
+  if (heap >= RMAPI_CLIENT_HEAP_COUNT)
+    return;
+  pthread_mutex_lock(&client_lock);
+  struct rmapi_client *c = client_find_locked(client_pid(pid), 0);
+  if (c) {
+    c->stats.memory[heap] -= bytes < c->stats.memory[heap] ? bytes
+                                                           : c->stats.memory[heap];
+    if (c->stats.bo_count)
+      c->stats.bo_count--;
+    client_drop_if_idle_locked(c);
+  }
+  pthread_mutex_unlock(&client_lock);
+}
+
+void rmapi_client_account_submit(int32_t pid, uint32_t engine,
+                                 uint64_t busy_ns) {
+  if (engine >= RMAPI_CLIENT_ENGINE_COUNT)
+    return;
+  pthread_mutex_lock(&client_lock);
+  struct rmapi_client *c = client_find_locked(client_pid(pid), 1);
+  if (c) {
+    c->stats.submissions++;
+    c->stats.engine_ns[engine] += busy_ns;
+  }
+  pthread_mutex_unlock(&client_lock);
+}
+
+// Work finished later than it was submitted: add the time, not the count
+void rmapi_client_account_busy(int32_t pid, uint32_t engine, uint64_t busy_ns) {
+  if (engine >= RMAPI_CLIENT_ENGINE_COUNT)
+    return;
+  pthread_mutex_lock(&client_lock);
+  struct rmapi_client *c = client_find_locked(client_pid(pid), 0);
+  if (c)
+    c->stats.engine_ns[engine] += busy_ns;
+  pthread_mutex_unlock(&client_lock);
+}
+
+int rmapi_client_set_quota(int32_t pid, uint32_t heap, uint64_t bytes) {
+  if (heap >= RMAPI_CLIENT_HEAP_COUNT)
+    return -1;
+  pthread_mutex_lock(&client_lock);
+  struct rmapi_client *c = client_find_locked(client_pid(pid), 1);
+  if (c)
+    c->stats.quota[heap] = bytes;
+  pthread_mutex_unlock(&client_lock);
+  if (!c)
+    return -1;
+  os_prim_log("RMAPI: pid %d %s quota set to %llu bytes%s\n", client_pid(pid),
+              client_heap_name[heap], (unsigned long long)bytes,
+              bytes ? "" : " (unlimited)");
+  return 0;
+}
+
+int rmapi_client_get_stats(int32_t pid, struct rmapi_client_stats *out) {
+  if (!out)
+    return -1;
+  pid = client_pid(pid);
+  pthread_mutex_lock(&client_lock);
+  struct rmapi_client *c = client_find_locked(pid, 0);
+  if (c)
+    *out = c->stats;
+  pthread_mutex_unlock(&client_lock);
+  if (!c)
+    return -1;
+  // Sharing is a property of the buffers, so ask the PRIME desk right now
+  out->shared[RMAPI_CLIENT_HEAP_VRAM] =
+      rmapi_prime_shared_bytes(pid, RMAPI_CLIENT_HEAP_VRAM);
+  out->shared[RMAPI_CLIENT_HEAP_GTT] =
+      rmapi_prime_shared_bytes(pid, RMAPI_CLIENT_HEAP_GTT);
+  return 0;
+}
+
+// Everybody on the books, for "who ate all the VRAM?". Returns how many exist.
+int rmapi_client_list(struct rmapi_client_stats *out, uint32_t max) {
+  int count = 0;
+  pthread_mutex_lock(&client_lock);
+  for (struct rmapi_client *c = client_list; c; c = c->next) {
+    if (out && (uint32_t)count < max)
+      out[count] = c->stats;
+    count++;
+  }
+  pthread_mutex_unlock(&client_lock);
+
+  for (int i = 0; out && i < count && (uint32_t)i < max; i++) {
+    out[i].shared[RMAPI_CLIENT_HEAP_VRAM] =
+        rmapi_prime_shared_bytes(out[i].pid, RMAPI_CLIENT_HEAP_VRAM);
+    out[i].shared[RMAPI_CLIENT_HEAP_GTT] =
+        rmapi_prime_shared_bytes(out[i].pid, RMAPI_CLIENT_HEAP_GTT);
+  }
+  return count;
+}
+
+// Same text the kernel prints in fdinfo (drm-usage-stats.rst), for logs and tools
+int rmapi_client_format_fdinfo(const struct rmapi_client_stats *s, char *buf,
+                               size_t len) {
+  if (!s || !buf || len == 0)
+    return -1;
+  size_t pos = 0;
+#define FDINFO(...)                                                            \
+  do {                                                                         \
+    int n = snprintf(buf + pos, len - pos, __VA_ARGS__);                       \
+    if (n < 0 || (size_t)n >= len - pos)                                       \
+      return -1;                                                               \
+    pos += (size_t)n;                                                          \
+  } while (0)
+
+  FDINFO("drm-driver:\tamdgpu\n");
+  FDINFO("drm-client-id:\t%d\n", s->pid);
+  for (int h = 0; h < RMAPI_CLIENT_HEAP_COUNT; h++)
+    FDINFO("drm-memory-%s:\t%llu KiB\n", client_heap_name[h],
+           (unsigned long long)(s->memory[h] / 1024));
+  for (int h = 0; h < RMAPI_CLIENT_HEAP_COUNT; h++)
+    FDINFO("drm-shared-%s:\t%llu KiB\n", client_heap_name[h],
+           (unsigned long long)(s->shared[h] / 1024));
+  for (int h = 0; h < RMAPI_CLIENT_HEAP_COUNT; h++)
+    FDINFO("amd-peak-%s:\t%llu KiB\n", client_heap_name[h],
+           (unsigned long long)(s->peak[h] / 1024));
+  FDINFO("amd-bo-count:\t%u\n", s->bo_count);
+  FDINFO("amd-submissions:\t%llu\n", (unsigned long long)s->submissions);
+  for (int e = 0; e < RMAPI_CLIENT_ENGINE_COUNT; e++) {
+    if (!s->engine_ns[e])
+      continue;
+    FDINFO("drm-engine-%s:\t%llu ns\n", client_engine_name[e],
+           (unsigned long long)s->engine_ns[e]);
+  }
+#undef FDINFO
+  return (int)pos;
+}
+
+uint64_t rmapi_client_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
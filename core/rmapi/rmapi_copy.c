@@ -0,0 +1,220 @@
+#include "rmapi.h"
+#include "../../drivers/amdgpu/sdma_builder.h"
+#include "../../os/os_interface.h"
+#include <pthread.h>
+#include <string.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+#define os_prim_alloc_ex os_get_interface()->alloc_ex
+
+/*
+ * Yo! This is the Copy Manager - the moving company for buffers.
+ * Uploads, blits and clears used to be CPU memcpy, or a trip through the
+ * GFX queue where they sat between draws and made frames stutter. Now you
+ * record them into a batch and flush: one SDMA stream, one scheduler job on
+ * the DMA engine, however many copies you put in.
+ *
+ *   - Copies that continue the last one (streaming a file into a staging
+ *     buffer 4K at a time) don't add packets, the last packet just grows.
+ *   - The batch remembers every BO it touched, so the scheduler orders it
+ *     against draws using the same BOs (implicit sync) with no extra work.
+ *   - Everything is bounds-checked against the BOs when you record it.
+ *
+ * In simulation the CPU plays the SDMA engine (hal_sdma.c).
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define COPY_INITIAL_DW 256
+#define COPY_INITIAL_BOS 8
+
+struct rmapi_copy_batch {
+  struct OBJGPU *gpu;
+  int32_t pid;
+  struct sdma_builder sb;         // Over dw[], grown as needed
+  uint32_t *dw;
+  struct amdgpu_buffer **bos;     // Deduplicated, for implicit sync
+  uint32_t bo_count, bo_max;
+};
+
+static struct rmapi_copy_stats copy_stats;
+static pthread_mutex_t copy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct rmapi_copy_batch *rmapi_copy_begin(struct OBJGPU *gpu, int32_t pid) {
+  struct rmapi_copy_batch *b = os_prim_alloc(sizeof(*b));
+  if (!b)
+    return NULL;
+  memset(b, 0, sizeof(*b));
+  b->gpu = gpu;
+  b->pid = pid;
+  b->dw = os_prim_alloc(COPY_INITIAL_DW * 4);
+  b->bos = os_prim_alloc(COPY_INITIAL_BOS * sizeof(*b->bos));
+  if (!b->dw || !b->bos) {
+    rmapi_copy_end(b);
+    return NULL;
+  }
+  b->bo_max = COPY_INITIAL_BOS;
+  sdma_builder_init(&b->sb, b->dw, COPY_INITIAL_DW);
+  return b;
+}
+
+void rmapi_copy_end(struct rmapi_copy_batch *b) {
+  if (!b)
+    return;
+  os_prim_free(b->dw);
+  os_prim_free(b->bos);
+  os_prim_free(b);
+}
+
+// Make room for ndw more dwords. The builder keeps its place (and the copy
+// it may still grow), it just points at the bigger buffer.
+static int copy_reserve(struct rmapi_copy_batch *b, uint64_t ndw) {
+  if (b->sb.max_dw - b->sb.cdw >= ndw)
+    return 0;
+  uint64_t want = b->sb.max_dw;
+  while (want - b->sb.cdw < ndw)
+    want *= 2;
+  if (want > UINT32_MAX / 4)
+    return -1;
+  uint32_t *dw = os_prim_alloc((size_t)want * 4);
+  if (!dw)
+    return -1;
+  memcpy(dw, b->dw, (size_t)b->sb.cdw * 4);
+  os_prim_free(b->dw);
+  b->dw = dw;
+  b->sb.buf = dw;
+  b->sb.max_dw = (uint32_t)want;
+  return 0;
+}
+
+static int copy_use_bo(struct rmapi_copy_batch *b, struct amdgpu_buffer *bo) {
+  for (uint32_t i = 0; i < b->bo_count; i++)
+    if (b->bos[i] == bo)
+      return 0;
+  if (b->bo_count == b->bo_max) {
+    struct amdgpu_buffer **bos = os_prim_alloc(b->bo_max * 2 * sizeof(*bos));
+    if (!bos)
+      return -1;
+    memcpy(bos, b->bos, b->bo_count * sizeof(*bos));
+    os_prim_free(b->bos);
+    b->bos = bos;
+    b->bo_max *= 2;
+  }
+  b->bos[b->bo_count++] = bo;
+  return 0;
+}
+
+static bool copy_in_bo(const struct amdgpu_buffer *bo, uint64_t offset,
+                       uint64_t size) {
+  return bo && bo->gpu_addr && offset <= bo->size && size <= bo->size - offset;
+}
+
+static void copy_account(uint64_t bytes, bool merged) {
+  pthread_mutex_lock(&copy_lock);
+  copy_stats.ops++;
+  copy_stats.bytes += bytes;
+  if (merged)
+    copy_stats.merged++;
+  pthread_mutex_unlock(&copy_lock);
+}
+
+int rmapi_copy_buffer(struct rmapi_copy_batch *b, struct amdgpu_buffer *dst,
+                      uint64_t dst_offset, struct amdgpu_buffer *src,
+                      uint64_t src_offset, uint64_t size) {
+  if (!b || !size || !copy_in_bo(dst, dst_offset, size) ||
+      !copy_in_bo(src, src_offset, size))
+    return -1;
+  uint64_t packets = (size + SDMA_COPY_MAX_BYTES - 1) / SDMA_COPY_MAX_BYTES;
+  if (copy_reserve(b, packets * SDMA_COPY_LINEAR_DW) != 0 ||
+      copy_use_bo(b, dst) != 0 || copy_use_bo(b, src) != 0)
+    return -1;
+
+  uint32_t before = b->sb.cdw;
+  sdma_copy_linear(&b->sb, dst->gpu_addr + dst_offset, src->gpu_addr + src_offset,
+                   size);
+  copy_account(size, b->sb.cdw == before);
+  return sdma_builder_ok(&b->sb) ? 0 : -1;
+}
+
+// Last byte of a box + 1, counted from the surface start
+static uint64_t copy_rect_end(uint32_t x, uint32_t y, uint32_t pitch,
+                              const struct rmapi_copy_rect *r) {
+  return ((uint64_t)(y + r->height - 1) * pitch + x + r->width) * r->bpp;
+}
+
+int rmapi_copy_rect(struct rmapi_copy_batch *b, struct amdgpu_buffer *dst,
+                    struct amdgpu_buffer *src, const struct rmapi_copy_rect *r) {
+  if (!b || !r || !r->width || !r->height ||
+      (uint64_t)r->dst_x + r->width > r->dst_pitch ||
+      (uint64_t)r->src_x + r->width > r->src_pitch ||
+      !copy_in_bo(dst, r->dst_offset, copy_rect_end(r->dst_x, r->dst_y, r->dst_pitch, r)) ||
+      !copy_in_bo(src, r->src_offset, copy_rect_end(r->src_x, r->src_y, r->src_pitch, r)))
+    return -1;
+  if (copy_reserve(b, SDMA_COPY_SUBWIN_DW) != 0 || copy_use_bo(b, dst) != 0 ||
+      copy_use_bo(b, src) != 0)
+    return -1;
+
+  struct sdma_surface d = {dst->gpu_addr + r->dst_offset, r->dst_pitch, 0,
+                           r->dst_x, r->dst_y, 0};
+  struct sdma_surface s = {src->gpu_addr + r->src_offset, r->src_pitch, 0,
+                           r->src_x, r->src_y, 0};
+  if (!sdma_copy_sub_window(&b->sb, &d, &s, r->bpp, r->width, r->height, 1))
+    return -1; // Too big for one packet (or a bpp it can't do)
+  copy_account((uint64_t)r->width * r->height * r->bpp, false);
+  return 0;
+}
+
+int rmapi_copy_fill(struct rmapi_copy_batch *b, struct amdgpu_buffer *dst,
+                    uint64_t dst_offset, uint32_t value, uint64_t size) {
+  if (!b || !size || (dst_offset | size) & 3 || !copy_in_bo(dst, dst_offset, size))
+    return -1;
+  uint64_t packets = (size + SDMA_FILL_MAX_BYTES - 1) / SDMA_FILL_MAX_BYTES;
+  if (copy_reserve(b, packets * SDMA_FILL_DW) != 0 || copy_use_bo(b, dst) != 0)
+    return -1;
+
+  sdma_fill(&b->sb, dst->gpu_addr + dst_offset, value, size);
+  copy_account(size, false);
+  return sdma_builder_ok(&b->sb) ? 0 : -1;
+}
+
+// Send everything recorded so far as one DMA job. The batch is empty (and
+// reusable) afterwards. Nothing recorded and nothing to signal = nothing
+// sent, *seq = 0.
+int rmapi_copy_flush(struct rmapi_copy_batch *b,
+                     const struct rmapi_syncobj_point *signals,
+                     uint32_t signal_count, uint64_t *seq) {
+  if (!b)
+    return -1;
+  if (seq)
+    *seq = 0;
+  if (!b->sb.cdw && !signal_count)
+    return 0;
+
+  // An empty job still gets its fence, so signals wait for earlier copies
+  struct amdgpu_command_buffer cb = {b->gpu, b->dw, (size_t)b->sb.cdw * 4,
+                                     b->bos, b->bo_count};
+  int ret = rmapi_sched_submit(b->pid, RMAPI_CLIENT_ENGINE_DMA, &cb, NULL, 0,
+                               signals, signal_count, seq);
+  if (ret == 0) {
+    pthread_mutex_lock(&copy_lock);
+    copy_stats.batches++;
+    pthread_mutex_unlock(&copy_lock);
+  } else {
+    os_prim_log("RMAPI Copy: Batch of %u dwords refused by the scheduler\n",
+                b->sb.cdw);
+  }
+  sdma_builder_reset(&b->sb);
+  b->bo_count = 0;
+  return ret;
+}
+
+void rmapi_copy_get_stats(struct rmapi_copy_stats *out) {
+  if (!out)
+    return;
+  pthread_mutex_lock(&copy_lock);
+  *out = copy_stats;
+  pthread_mutex_unlock(&copy_lock);
+}
@@ -0,0 +1,567 @@
+#define _GNU_SOURCE
+#include "rmapi.h"
+#include "../../os/os_interface.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the PRIME desk - buffer sharing between apps.
+ * A game renders into a buffer, the compositor shows it. Without this the
+ * compositor had to read the whole frame back. Now they just pass an fd.
+ *
+ * - Real DRM: the fd is a kernel dma-buf, we just pass it through.
+ * - Simulation / MMIO: the buffer lives in a memfd that we own. Every app
+ *   that imports it gets the same pages and bumps a reference count. The
+ *   buffer dies when the last app lets go (or disconnects). The memfd is
+ *   sealed at its size: we map it too, and an importer shrinking it would
+ *   hit us with SIGBUS.
+ *
+ * Implicit sync: the writer attaches a fence before rendering and signals
+ * it when done; readers wait on it before touching the pages. Only apps
+ * holding the buffer get a say, and a writer that lets go (or dies) without
+ * signaling counts as done so nobody waits on it forever.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+// One app's grip on a shared buffer
+struct rmapi_prime_ref {
+  int32_t pid;
+  int count;
+  uint64_t fence_seq;          // Last fence this app attached
+  struct rmapi_prime_ref *next;
+};
+
+struct rmapi_prime_bo {
+  uint32_t handle;             // RESSERV name tag
+  struct RsResource *res;
+  struct amdgpu_buffer buf;    // cpu_addr = our view of the pages
+  int fd;                      // dma-buf (DRM) or memfd (everything else)
+  bool kernel;                 // buf is a real GEM object
+  dev_t st_dev;                // Identity of fd, so re-imports find us
+  ino_t st_ino;
+  int refcount;
+  struct rmapi_prime_ref *refs;
+  uint32_t heap;               // Where holders are charged: follows residency
+  uint64_t fence_seq;          // Last fence a writer attached
+  uint64_t fence_done;         // Last fence that signaled
+  struct rmapi_prime_bo *next;
+};
+
+static struct rmapi_prime_bo *prime_list = NULL;
+static pthread_mutex_t prime_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prime_fence_cond = PTHREAD_COND_INITIALIZER;
+
+static int prime_make_memfd(uint64_t size) {
+  int fd;
+#ifdef __linux__
+  fd = memfd_create("amdgpu-prime", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+  // No memfd here: an unlinked shm object is the same thing
+  char name[64];
+  snprintf(name, sizeof(name), "/amdgpu-prime-%d-%ld", (int)getpid(),
+           (long)clock());
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd >= 0)
+    shm_unlink(name);
+#endif
+  if (fd < 0)
+    return -1;
+  if (ftruncate(fd, (off_t)size) != 0) {
+    close(fd);
+    return -1;
+  }
+#ifdef F_ADD_SEALS
+  // Nobody we hand it to gets to resize it under our mapping
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+    close(fd);
+    return -1;
+  }
+#endif
+  return fd;
+}
+
+// A memfd somebody else made: we only map it if it can't shrink under us
+static bool prime_fd_sealed(int fd) {
+#ifdef F_GET_SEALS
+  int seals = fcntl(fd, F_GET_SEALS);
+  return seals >= 0 && (seals & F_SEAL_SHRINK);
+#else
+  (void)fd;
+  return true;
+#endif
+}
+
+static struct rmapi_prime_bo *prime_find_locked(uint32_t handle) {
+  for (struct rmapi_prime_bo *bo = prime_list; bo; bo = bo->next)
+    if (bo->handle == handle)
+      return bo;
+  return NULL;
+}
+
+static struct rmapi_prime_ref *prime_ref_find_locked(struct rmapi_prime_bo *bo,
+                                                     int32_t pid) {
+  for (struct rmapi_prime_ref *r = bo ? bo->refs : NULL; r; r = r->next)
+    if (r->pid == pid)
+      return r;
+  return NULL;
+}
+
+// The first reference from a client goes on its tab (and may hit its quota)
+static int prime_ref_locked(struct rmapi_prime_bo *bo, int32_t pid) {
+  struct rmapi_prime_ref *r = prime_ref_find_locked(bo, pid);
+  if (r) {
+    bo->refcount++;
+    r->count++;
+    return 0;
+  }
+  // Every reference belongs to somebody, or nobody could ever drop it
+  r = os_prim_alloc(sizeof(*r));
+  if (!r)
+    return -1;
+  if (rmapi_client_charge(pid, bo->heap, bo->buf.size) != 0) {
+    os_prim_free(r);
+    return -1;
+  }
+  bo->refcount++;
+  r->pid = pid;
+  r->count = 1;
+  r->next = bo->refs;
+  bo->refs = r;
+  return 0;
+}
+
+static int prime_register(struct rmapi_prime_bo *bo, int32_t pid) {
+  struct stat st;
+  if (fstat(bo->fd, &st) == 0) {
+    bo->st_dev = st.st_dev;
+    bo->st_ino = st.st_ino;
+  }
+  bo->handle = rmapi_handle_alloc();
+  bo->res = rs_resource_create(bo->handle, NULL);
+  if (!bo->res)
+    return -1;
+  bo->res->data = bo;
+
+  pthread_mutex_lock(&prime_lock);
+  if (prime_ref_locked(bo, pid) != 0) {
+    pthread_mutex_unlock(&prime_lock);
+    return -1;
+  }
+  bo->next = prime_list;
+  prime_list = bo;
+  pthread_mutex_unlock(&prime_lock);
+  return 0;
+}
+
+// The residency manager moved it: every holder's charge moves along, so
+// fdinfo shows bytes where they live. Runs under the residency lock (taken
+// before prime_lock, never after).
+static void prime_residency_moved(void *priv, uint32_t domain) {
+  struct rmapi_prime_bo *bo = priv;
+  uint32_t heap = domain == AMDGPU_DOMAIN_GTT ? RMAPI_CLIENT_HEAP_GTT
+                                              : RMAPI_CLIENT_HEAP_VRAM;
+  pthread_mutex_lock(&prime_lock);
+  if (heap != bo->heap) {
+    for (struct rmapi_prime_ref *r = bo->refs; r; r = r->next)
+      rmapi_client_move(r->pid, bo->heap, heap, bo->buf.size);
+    bo->heap = heap;
+  }
+  pthread_mutex_unlock(&prime_lock);
+}
+
+static void prime_destroy(struct OBJGPU *gpu, struct rmapi_prime_bo *bo) {
+  if (bo->kernel && gpu) {
+    amdgpu_buffer_free_hal(gpu, &bo->buf);
+  } else if (bo->buf.cpu_addr) {
+    amdgpu_residency_untrack(gpu, &bo->buf);
+    munmap(bo->buf.cpu_addr, bo->buf.size);
+  }
+  if (bo->fd >= 0)
+    close(bo->fd);
+  while (bo->refs) {
+    struct rmapi_prime_ref *r = bo->refs;
+    bo->refs = r->next;
+    os_prim_free(r);
+  }
+  if (bo->res)
+    rs_resource_destroy(bo->res);
+  os_prim_free(bo);
+}
+
+// 1. "I want a buffer I can share later"
+int rmapi_prime_create(struct OBJGPU *gpu, int32_t pid, uint64_t size,
+                       uint32_t *handle, uint64_t *gpu_addr) {
+  if (!gpu)
+    gpu = rmapi_get_gpu();
+  if (!gpu || !handle || size == 0)
+    return -1;
+  os_trace_scope(OS_TRACE_RMAPI, "rmapi_prime_create");
+
+  struct rmapi_prime_bo *bo = os_prim_alloc(sizeof(*bo));
+  if (!bo)
+    return -1;
+  memset(bo, 0, sizeof(*bo));
+  bo->fd = -1;
+
+  if (amdgpu_hal_get_mode() == AMDGPU_HAL_MODE_DRM) {
+    // Let the kernel own it, we keep a dma-buf around for exports
+    if (amdgpu_buffer_alloc_hal(gpu, size, &bo->buf) != 0 ||
+        amdgpu_buffer_export_dmabuf_hal(gpu, &bo->buf, &bo->fd) != 0) {
+      amdgpu_buffer_free_hal(gpu, &bo->buf);
+      os_prim_free(bo);
+      return -1;
+    }
+    bo->kernel = true;
+  } else {
+    bo->fd = prime_make_memfd(size);
+    if (bo->fd < 0) {
+      os_prim_free(bo);
+      return -1;
+    }
+    bo->buf.cpu_addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            bo->fd, 0);
+    if (bo->buf.cpu_addr == MAP_FAILED) {
+      close(bo->fd);
+      os_prim_free(bo);
+      return -1;
+    }
+    bo->buf.size = size;
+    bo->buf.gpu_addr = (uint64_t)(uintptr_t)bo->buf.cpu_addr;
+    // Competes for VRAM like the rest
+    amdgpu_residency_track_cb(gpu, &bo->buf, prime_residency_moved, bo);
+  }
+
+  if (prime_register(bo, pid) != 0) {
+    prime_destroy(gpu, bo);
+    return -1;
+  }
+
+  if (!bo->kernel)
+    bo->buf.handle = bo->handle; // Kernel BOs keep their GEM handle
+  *handle = bo->handle;
+  if (gpu_addr)
+    *gpu_addr = bo->buf.gpu_addr;
+  os_prim_log("RMAPI: Shareable buffer 0x%x ready (%llu bytes, %s)\n",
+              bo->handle, (unsigned long long)size,
+              bo->kernel ? "dma-buf" : "memfd");
+  return 0;
+}
+
+// 2. "Give me an fd for this buffer" - caller owns the returned fd. Only
+// somebody holding a reference gets to hand the pages out.
+int rmapi_prime_export(struct OBJGPU *gpu, int32_t pid, uint32_t handle,
+                       int *fd) {
+  if (!gpu)
+    gpu = rmapi_get_gpu();
+  if (!gpu || !fd)
+    return -1;
+
+  pthread_mutex_lock(&prime_lock);
+  struct rmapi_prime_bo *bo = prime_find_locked(handle);
+  bool held = prime_ref_find_locked(bo, pid) != NULL;
+  *fd = held ? fcntl(bo->fd, F_DUPFD_CLOEXEC, 0) : -1;
+  pthread_mutex_unlock(&prime_lock);
+
+  if (*fd < 0) {
+    os_prim_log("RMAPI: Buffer 0x%x can't be shared by pid %d\n", handle, pid);
+    return -1;
+  }
+  return 0;
+}
+
+// Which of pid's buffers lives at gpu_addr? For clients that only kept the
+// address ALLOC_MEMORY gave them.
+int rmapi_prime_find_addr(int32_t pid, uint64_t gpu_addr, uint32_t *handle) {
+  int ret = -1;
+  pthread_mutex_lock(&prime_lock);
+  for (struct rmapi_prime_bo *bo = prime_list; bo; bo = bo->next) {
+    if (bo->buf.gpu_addr == gpu_addr && prime_ref_find_locked(bo, pid)) {
+      *handle = bo->handle;
+      ret = 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&prime_lock);
+  return ret;
+}
+
+// 3. "Here's an fd someone gave me, make it a buffer". We keep our own dup.
+int rmapi_prime_import(struct OBJGPU *gpu, int32_t pid, int fd,
+                       uint32_t *handle, uint64_t *gpu_addr, uint64_t *size) {
+  if (!gpu)
+    gpu = rmapi_get_gpu();
+  if (!gpu || fd < 0 || !handle)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return -1;
+
+  // Already know these pages? Then it's just one more reference.
+  pthread_mutex_lock(&prime_lock);
+  for (struct rmapi_prime_bo *bo = prime_list; bo; bo = bo->next) {
+    if (bo->st_dev == st.st_dev && bo->st_ino == st.st_ino) {
+      if (prime_ref_locked(bo, pid) != 0) {
+        pthread_mutex_unlock(&prime_lock);
+        return -1;
+      }
+      *handle = bo->handle;
+      if (gpu_addr)
+        *gpu_addr = bo->buf.gpu_addr;
+      if (size)
+        *size = bo->buf.size;
+      pthread_mutex_unlock(&prime_lock);
+      return 0;
+    }
+  }
+  pthread_mutex_unlock(&prime_lock);
+
+  struct rmapi_prime_bo *bo = os_prim_alloc(sizeof(*bo));
+  if (!bo)
+    return -1;
+  memset(bo, 0, sizeof(*bo));
+  bo->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (bo->fd < 0) {
+    os_prim_free(bo);
+    return -1;
+  }
+
+  // dma-bufs report their size through lseek, memfds through fstat
+  off_t len = st.st_size > 0 ? st.st_size : lseek(fd, 0, SEEK_END);
+  if (len <= 0) {
+    close(bo->fd);
+    os_prim_free(bo);
+    return -1;
+  }
+
+  int ret;
+  if (amdgpu_hal_get_mode() == AMDGPU_HAL_MODE_DRM) {
+    ret = amdgpu_buffer_import_dmabuf_hal(gpu, bo->fd, (size_t)len, &bo->buf);
+    bo->kernel = ret == 0;
+  } else if (!prime_fd_sealed(bo->fd)) {
+    os_prim_log("RMAPI: Shared fd can still shrink, not mapping it\n");
+    ret = -1;
+  } else {
+    bo->buf.cpu_addr = mmap(NULL, (size_t)len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, bo->fd, 0);
+    ret = bo->buf.cpu_addr == MAP_FAILED ? -1 : 0;
+    if (ret == 0) {
+      bo->buf.size = (size_t)len;
+      bo->buf.gpu_addr = (uint64_t)(uintptr_t)bo->buf.cpu_addr;
+      amdgpu_residency_track_cb(gpu, &bo->buf, prime_residency_moved, bo);
+    } else {
+      bo->buf.cpu_addr = NULL;
+    }
+  }
+  if (ret != 0 || prime_register(bo, pid) != 0) {
+    os_prim_log("RMAPI: Couldn't import shared buffer (errno %d)\n", errno);
+    prime_destroy(gpu, bo);
+    return -1;
+  }
+
+  if (!bo->kernel)
+    bo->buf.handle = bo->handle;
+  *handle = bo->handle;
+  if (gpu_addr)
+    *gpu_addr = bo->buf.gpu_addr;
+  if (size)
+    *size = bo->buf.size;
+  return 0;
+}
+
+// 4. "I'm done with it" - the last one out turns off the lights. A pid
+// can only drop references it actually holds.
+int rmapi_prime_unref(struct OBJGPU *gpu, int32_t pid, uint32_t handle) {
+  if (!gpu)
+    gpu = rmapi_get_gpu(); // Only kernel-backed buffers need it, to free them
+  os_trace_scope(OS_TRACE_RMAPI, "rmapi_prime_unref");
+
+  pthread_mutex_lock(&prime_lock);
+  struct rmapi_prime_bo *bo = prime_find_locked(handle);
+  struct rmapi_prime_ref **rp = bo ? &bo->refs : NULL;
+  while (rp && *rp && (*rp)->pid != pid)
+    rp = &(*rp)->next;
+  if (!rp || !*rp) {
+    pthread_mutex_unlock(&prime_lock);
+    return -1;
+  }
+  if (--(*rp)->count == 0) {
+    struct rmapi_prime_ref *dead = *rp;
+    if (dead->fence_seq > bo->fence_done) {
+      // It won't be around to signal, don't leave the readers hanging
+      bo->fence_done = dead->fence_seq;
+      pthread_cond_broadcast(&prime_fence_cond);
+    }
+    *rp = dead->next;
+    os_prim_free(dead);
+    rmapi_client_uncharge(pid, bo->heap, bo->buf.size);
+  }
+  bool last = --bo->refcount == 0;
+  if (last) {
+    for (struct rmapi_prime_bo **pp = &prime_list; *pp; pp = &(*pp)->next) {
+      if (*pp == bo) {
+        *pp = bo->next;
+        break;
+      }
+    }
+    // Anybody still waiting on this buffer would wait forever
+    pthread_cond_broadcast(&prime_fence_cond);
+  }
+  pthread_mutex_unlock(&prime_lock);
+
+  if (last)
+    prime_destroy(gpu, bo);
+  return 0;
+}
+
+// App went away: drop every reference it was holding
+void rmapi_prime_release_pid(struct OBJGPU *gpu, int32_t pid) {
+  for (;;) {
+    uint32_t handle = 0;
+    pthread_mutex_lock(&prime_lock);
+    for (struct rmapi_prime_bo *bo = prime_list; bo && !handle; bo = bo->next)
+      for (struct rmapi_prime_ref *r = bo->refs; r; r = r->next)
+        if (r->pid == pid) {
+          handle = bo->handle;
+          break;
+        }
+    pthread_mutex_unlock(&prime_lock);
+    if (!handle || rmapi_prime_unref(gpu, pid, handle) != 0)
+      return;
+  }
+}
+
+int rmapi_prime_get(uint32_t handle, struct amdgpu_buffer *buf) {
+  pthread_mutex_lock(&prime_lock);
+  struct rmapi_prime_bo *bo = prime_find_locked(handle);
+  if (bo)
+    *buf = bo->buf;
+  pthread_mutex_unlock(&prime_lock);
+  return bo ? 0 : -1;
+}
+
+// Another reference for pid on a buffer it already holds, for objects that
+// keep the buffer around (BO lists). The returned buffer stays where it is
+// until the matching rmapi_prime_unref; it may still move (see generation).
+struct amdgpu_buffer *rmapi_prime_hold(int32_t pid, uint32_t handle) {
+  struct amdgpu_buffer *buf = NULL;
+  pthread_mutex_lock(&prime_lock);
+  struct rmapi_prime_bo *bo = prime_find_locked(handle);
+  struct rmapi_prime_ref *r = prime_ref_find_locked(bo, pid);
+  if (r) {
+    r->count++;
+    bo->refcount++;
+    buf = &bo->buf;
+  }
+  pthread_mutex_unlock(&prime_lock);
+  return buf;
+}
+
+// Handles of the buffers pid holds, up to max of them. Returns how many it
+// holds, which may be more than max.
+uint32_t rmapi_prime_list_pid(int32_t pid, uint32_t *handles, uint32_t max) {
+  uint32_t n = 0;
+  pthread_mutex_lock(&prime_lock);
+  for (struct rmapi_prime_bo *bo = prime_list; bo; bo = bo->next) {
+    for (struct rmapi_prime_ref *r = bo->refs; r; r = r->next) {
+      if (r->pid != pid)
+        continue;
+      if (n < max)
+        handles[n] = bo->handle;
+      n++;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&prime_lock);
+  return n;
+}
+
+// Bytes pid holds in heap in buffers some other client holds too (drm-shared-*)
+uint64_t rmapi_prime_shared_bytes(int32_t pid, uint32_t heap) {
+  uint64_t bytes = 0;
+  pthread_mutex_lock(&prime_lock);
+  for (struct rmapi_prime_bo *bo = prime_list; bo; bo = bo->next) {
+    bool mine = false, others = false;
+    for (struct rmapi_prime_ref *r = bo->refs; r; r = r->next) {
+      if ((r->pid ? r->pid : (int32_t)getpid()) == pid)
+        mine = true;
+      else
+        others = true;
+    }
+    if (mine && others && bo->heap == heap)
+      bytes += bo->buf.size;
+  }
+  pthread_mutex_unlock(&prime_lock);
+  return bytes;
+}
+
+/* --- Implicit sync: one "exclusive" write fence per shared buffer --- */
+
+// Writer: "I'm about to render into this". Returns the fence to signal later.
+int rmapi_prime_fence_attach(int32_t pid, uint32_t handle, uint64_t *seq) {
+  pthread_mutex_lock(&prime_lock);
+  struct rmapi_prime_bo *bo = prime_find_locked(handle);
+  struct rmapi_prime_ref *r = prime_ref_find_locked(bo, pid);
+  if (r)
+    *seq = r->fence_seq = ++bo->fence_seq;
+  pthread_mutex_unlock(&prime_lock);
+  return r ? 0 : -1;
+}
+
+// Writer: "Done rendering"
+int rmapi_prime_fence_signal(int32_t pid, uint32_t handle, uint64_t seq) {
+  pthread_mutex_lock(&prime_lock);
+  struct rmapi_prime_bo *bo = prime_find_locked(handle);
+  bool held = prime_ref_find_locked(bo, pid) != NULL;
+  if (held && seq > bo->fence_done && seq <= bo->fence_seq) {
+    bo->fence_done = seq;
+    pthread_cond_broadcast(&prime_fence_cond);
+  }
+  pthread_mutex_unlock(&prime_lock);
+  return held ? 0 : -1;
+}
+
+// Reader: wait until the last attached write finished (0 = ready, 1 = timed out)
+int rmapi_prime_fence_wait(int32_t pid, uint32_t handle, uint64_t timeout_ns) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += (time_t)(timeout_ns / 1000000000ull);
+  deadline.tv_nsec += (long)(timeout_ns % 1000000000ull);
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  int ret = 0;
+  pthread_mutex_lock(&prime_lock);
+  struct rmapi_prime_bo *bo = prime_find_locked(handle);
+  if (!prime_ref_find_locked(bo, pid)) {
+    ret = -1;
+  } else {
+    uint64_t want = bo->fence_seq;
+    // Look the buffer up again after every wake up, it may be gone by then
+    while (bo && bo->fence_done < want) {
+      if (pthread_cond_timedwait(&prime_fence_cond, &prime_lock, &deadline) ==
+          ETIMEDOUT) {
+        ret = 1;
+        break;
+      }
+      bo = prime_find_locked(handle);
+    }
+  }
+  pthread_mutex_unlock(&prime_lock);
+  return ret;
+}
@@ -0,0 +1,161 @@
+#include "rmapi.h"
+#include "../hal/hal.h"
+#include "../../os/os_interface.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+
+/*
+ * Yo! This is Ring Recovery - what happens after the watchdog barks.
+ * It used to be one answer for everything: reinit the whole device. One
+ * client's shader loops forever on GFX and every app on every ring loses
+ * its work and waits for the full reset, display included.
+ *
+ * Now it goes up a ladder, like amdgpu's soft recovery / per-queue reset /
+ * mode reset, and only climbs when the step below didn't stick:
+ *   1. QUEUE: only the hung ring. The guilty job (the one its fence is
+ *      stuck on) fails, whatever its client still has queued is cancelled,
+ *      and the innocent jobs that were behind it go out again.
+ *   2. IP: the ring's IP block goes through hw_fini/hw_init, the rest of
+ *      the chip keeps running. Blocks we can't reset alone go straight up.
+ *   3. FULL: amdgpu_gpu_recover, the old answer.
+ * "Didn't stick" = the ring hangs again before it got past the jobs that
+ * were resubmitted last time, or the backend couldn't take the jobs back
+ * (the guilty one is still on the ring): then it climbs right away. Getting
+ * past them puts the ring back at the bottom of the ladder.
+ *
+ * Every tier keeps its count and how long the ring was down (from the
+ * moment the hang was reported until the ring had its work back).
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+struct recovery_ring {
+  uint64_t reset_last;  // Last seq on the ring when it was last reset
+  uint32_t last_tier;   // Tier used for it
+};
+
+static struct recovery_ring recovery_rings[RMAPI_SCHED_RING_COUNT];
+static struct rmapi_recovery_stats recovery_stats;
+static pthread_mutex_t recovery_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *recovery_tier_names[RMAPI_RECOVERY_TIER_COUNT] = {
+    "queue", "IP block", "full"};
+
+static uint64_t recovery_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Which IP block runs the ring (NULL = none we can reset on its own)
+static const char *recovery_ring_block(uint32_t ring) {
+  switch (ring) {
+  case RMAPI_CLIENT_ENGINE_GFX:
+  case RMAPI_CLIENT_ENGINE_COMPUTE:
+  case RMAPI_CLIENT_ENGINE_GFX_HIGH:
+    return "r600_gfx";
+  default:
+    return NULL; // SDMA has no block of its own in the handler
+  }
+}
+
+// The ring stopped at stuck_seq with last_seq on it. Returns the tier used,
+// -1 if even a full reset failed.
+int rmapi_recovery_ring_hang(struct OBJGPU *gpu, uint32_t ring,
+                             uint64_t stuck_seq, uint64_t last_seq) {
+  if (ring >= RMAPI_SCHED_RING_COUNT)
+    return -1;
+  uint64_t start = recovery_now_ns();
+
+  pthread_mutex_lock(&recovery_lock);
+  struct recovery_ring *r = &recovery_rings[ring];
+  uint32_t tier = RMAPI_RECOVERY_TIER_QUEUE;
+  if (r->reset_last && stuck_seq <= r->reset_last)
+    tier = r->last_tier + 1 < RMAPI_RECOVERY_TIER_COUNT
+               ? r->last_tier + 1
+               : RMAPI_RECOVERY_TIER_FULL;
+  pthread_mutex_unlock(&recovery_lock);
+
+  if (gpu) {
+    amdgpu_lock_gpu(gpu);
+    gpu->hang_detected = 1;
+    amdgpu_unlock_gpu(gpu);
+  }
+
+  int ret = 0;
+  struct rmapi_sched_reset res = {-1, 0, 0};
+  for (;;) {
+    if (tier == RMAPI_RECOVERY_TIER_IP) {
+      const char *block = recovery_ring_block(ring);
+      if (!block || !gpu || amdgpu_ip_block_reset(gpu, block) != 0)
+        tier = RMAPI_RECOVERY_TIER_FULL;
+    }
+    if (tier == RMAPI_RECOVERY_TIER_FULL && gpu) {
+      amdgpu_lock_gpu(gpu);
+      gpu->state = AMD_GPU_STATE_HUNG;
+      amdgpu_unlock_gpu(gpu);
+      ret = amdgpu_gpu_recover(gpu);
+    }
+    os_prim_log("RMAPI Recovery: Ring %u hung on job %llu, %s reset\n", ring,
+                (unsigned long long)stuck_seq, recovery_tier_names[tier]);
+
+    if (ret != 0) { // The chip didn't come back: nothing on that ring will finish
+      rmapi_sched_fence_done(ring, last_seq, -1);
+      break;
+    }
+    if (rmapi_sched_reset_ring(ring, stuck_seq, &res) == 0 ||
+        rmapi_sched_fence_wait(ring, stuck_seq, 0) != 1)
+      break; // Reset, or it moved on by itself after all
+    // The backend still has the guilty job on the ring
+    if (tier == RMAPI_RECOVERY_TIER_FULL) {
+      rmapi_sched_fence_done(ring, last_seq, -1);
+      break;
+    }
+    tier++;
+  }
+  if (gpu && tier != RMAPI_RECOVERY_TIER_FULL) {
+    amdgpu_lock_gpu(gpu);
+    gpu->hang_detected = 0;
+    amdgpu_unlock_gpu(gpu);
+  }
+  uint64_t took = recovery_now_ns() - start;
+
+  pthread_mutex_lock(&recovery_lock);
+  r->reset_last = last_seq;
+  r->last_tier = tier;
+  struct rmapi_recovery_tier_stats *ts = &recovery_stats.tiers[tier];
+  ts->count++;
+  ts->downtime_ns += took;
+  if (took > ts->downtime_max_ns)
+    ts->downtime_max_ns = took;
+  if (res.guilty_pid != -1)
+    recovery_stats.guilty_jobs++;
+  recovery_stats.resubmitted += res.resubmitted;
+  recovery_stats.cancelled += res.cancelled;
+  pthread_mutex_unlock(&recovery_lock);
+
+  if (res.guilty_pid != -1)
+    os_prim_log("RMAPI Recovery: Guilty pid %d, %u resubmitted, %u cancelled\n",
+                res.guilty_pid, res.resubmitted, res.cancelled);
+  return ret == 0 ? (int)tier : -1;
+}
+
+void rmapi_recovery_get_stats(struct rmapi_recovery_stats *out) {
+  if (!out)
+    return;
+  pthread_mutex_lock(&recovery_lock);
+  *out = recovery_stats;
+  pthread_mutex_unlock(&recovery_lock);
+}
+
+// Forget the ladder positions and the numbers (rmapi_init / tests)
+void rmapi_recovery_reset(void) {
+  pthread_mutex_lock(&recovery_lock);
+  memset(recovery_rings, 0, sizeof(recovery_rings));
+  memset(&recovery_stats, 0, sizeof(recovery_stats));
+  pthread_mutex_unlock(&recovery_lock);
+}
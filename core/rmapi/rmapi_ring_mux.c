@@ -0,0 +1,384 @@
+#include "rmapi.h"
+#include "../../drivers/amdgpu/pm4_builder.h"
+#include "../../os/os_interface.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the Ring Mux - two lanes onto one GFX ring.
+ * There's one GFX engine. A compute tenant drops a batch with a hundred
+ * IBs on it, and the compositor's frame, submitted a moment later, waits
+ * behind every single one of them and misses vblank.
+ *
+ * So there are two software rings in front of the hardware one:
+ *   - GFX (normal): everybody.
+ *   - GFX_HIGH: the compositor and friends (the server only lets its own
+ *     user or root in, like DRM's HIGH context priority).
+ * Each has its own fence timeline, so the scheduler sees two engines and
+ * a high job finishing first doesn't "finish" the normal ones before it.
+ *
+ * One worker feeds the hardware ring. High jobs go whole, as soon as they
+ * show up. Normal jobs go in chunks that end at IB boundaries (after an
+ * INDIRECT_BUFFER packet): the CP can stop there without losing anything.
+ * If high work arrived while a chunk ran, the normal job is preempted: the
+ * high jobs go first and the rest of the normal job is resubmitted from
+ * where it stopped. The high jobs left their own register state behind, so
+ * the rest goes out behind a preamble: every state packet the job (and the
+ * IBs it called) sent before it stopped, in order, so the last value wins
+ * like it did the first time. In simulation that's all done here. On real hardware
+ * (mux_ops.chunked = false) jobs go whole and only the order changes; mid-IB
+ * preemption would be the CP's own business.
+ *
+ * A ring reset takes the jobs from the stuck one on back to the scheduler,
+ * which resubmits the innocent ones itself: rmapi_ring_mux_cancel drops our
+ * copies first, so nothing runs twice.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define MUX_LOW 0
+#define MUX_HIGH 1
+#define MUX_MAX_IB_DEPTH 4 // Same as the validator lets through
+
+struct mux_job {
+  int32_t pid;
+  uint32_t engine;  // RMAPI_CLIENT_ENGINE_GFX or _GFX_HIGH
+  uint64_t seq;
+  uint32_t *dw;     // Our copy: the scheduler frees its own when run_job returns
+  uint32_t ndw;
+  uint32_t offset;  // Dwords already on the ring (resume point)
+  bool preempted;   // High work ran since: resume behind a state preamble
+  bool cancelled;   // Reset while on the ring: drop it when it comes back
+  uint64_t queued_ns;
+  struct mux_job *next;
+};
+
+struct mux_ring {
+  struct mux_job *head, *tail;
+};
+
+static struct mux_ring mux_rings[2];
+static struct rmapi_ring_mux_ops mux_ops;
+static struct rmapi_ring_mux_stats mux_stats;
+static pthread_t mux_thread;
+static bool mux_running = false;
+static bool mux_busy = false; // Worker is running a chunk or reporting a fence
+static struct mux_job *mux_current; // The job whose chunk is on the ring
+static pthread_mutex_t mux_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mux_cond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t mux_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// How far from 'from' the next preemption point is: just past the next
+// INDIRECT_BUFFER, or the end of the stream if there's none left
+static uint32_t mux_chunk_end(const uint32_t *dw, uint32_t ndw, uint32_t from) {
+  for (uint32_t i = from; i < ndw;) {
+    uint32_t h = dw[i];
+    if (CP_PACKET_GET_TYPE(h) != PACKET_TYPE3 ||
+        (h & ~2u) == (uint32_t)PM4_NOP_DWORD) {
+      i++; // Filler, or something the validator would have refused anyway
+      continue;
+    }
+    uint32_t next = i + 2 + CP_PACKET_GET_COUNT(h);
+    if (next > ndw || next < i)
+      return ndw;
+    if (CP_PACKET3_GET_OPCODE(h) == PACKET3_INDIRECT_BUFFER &&
+        !(dw[i + 3] & PM4_IB_CHAIN))
+      return next;
+    i = next;
+  }
+  return ndw;
+}
+
+// Packets that only set state. Replaying them puts the CP back where the job
+// had it.
+static bool mux_state_op(uint32_t op) {
+  switch (op) {
+  case PACKET3_CONTEXT_CONTROL:
+  case PACKET3_CLEAR_STATE:
+  case PACKET3_SET_BASE:
+  case PACKET3_INDEX_BASE:
+  case PACKET3_INDEX_BUFFER_SIZE:
+  case PACKET3_INDEX_TYPE:
+  case PACKET3_NUM_INSTANCES:
+  case PACKET3_LOAD_UCONFIG_REG:
+  case PACKET3_LOAD_SH_REG:
+  case PACKET3_LOAD_CONFIG_REG:
+  case PACKET3_LOAD_CONTEXT_REG:
+  case PACKET3_LOAD_SH_REG_INDEX:
+  case PACKET3_LOAD_CONTEXT_REG_INDEX:
+  case PACKET3_SET_CONFIG_REG:
+  case PACKET3_SET_CONTEXT_REG:
+  case PACKET3_SET_CONTEXT_REG_INDEX:
+  case PACKET3_SET_SH_REG:
+  case PACKET3_SET_SH_REG_INDEX:
+  case PACKET3_SET_UCONFIG_REG:
+  case PACKET3_SET_UCONFIG_REG_INDEX:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// The state packets in dw[from, to) and the IBs it calls, copied to out in
+// the order the CP saw them (out NULL: just count). Returns the dwords.
+static uint32_t mux_collect_state(const uint32_t *dw, uint32_t from,
+                                  uint32_t to, uint32_t depth, uint32_t *out) {
+  uint32_t n = 0;
+  for (uint32_t i = from; i < to;) {
+    uint32_t h = dw[i];
+    if (CP_PACKET_GET_TYPE(h) != PACKET_TYPE3 ||
+        (h & ~2u) == (uint32_t)PM4_NOP_DWORD) {
+      i++;
+      continue;
+    }
+    uint32_t next = i + 2 + CP_PACKET_GET_COUNT(h);
+    if (next > to || next < i)
+      break;
+    uint32_t op = CP_PACKET3_GET_OPCODE(h);
+    if (mux_state_op(op)) {
+      if (out)
+        memcpy(out + n, dw + i, (size_t)(next - i) * 4);
+      n += next - i;
+    } else if (op == PACKET3_INDIRECT_BUFFER && next - i >= 4 &&
+               depth < MUX_MAX_IB_DEPTH) {
+      // Chunked means simulation: the IB is in our address space
+      const uint32_t *ib = (const uint32_t *)(uintptr_t)(
+          ((uint64_t)(dw[i + 2] & 0xFFFF) << 32) | dw[i + 1]);
+      if (ib)
+        n += mux_collect_state(ib, 0, dw[i + 3] & PM4_IB_SIZE_MASK, depth + 1,
+                               out ? out + n : NULL);
+    }
+    i = next;
+  }
+  return n;
+}
+
+static void mux_job_free(struct mux_job *j) {
+  os_prim_free(j->dw);
+  os_prim_free(j);
+}
+
+static void *mux_main(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&mux_lock);
+  while (mux_running) {
+    struct mux_ring *r = mux_rings[MUX_HIGH].head ? &mux_rings[MUX_HIGH]
+                                                  : &mux_rings[MUX_LOW];
+    struct mux_job *j = r->head;
+    if (!j) {
+      pthread_cond_wait(&mux_cond, &mux_lock);
+      continue;
+    }
+    bool high = r == &mux_rings[MUX_HIGH];
+    if (high) {
+      r->head = j->next;
+      if (!r->head)
+        r->tail = NULL;
+      uint64_t waited = mux_now_ns() - j->queued_ns;
+      if (waited > mux_stats.high_wait_max_ns)
+        mux_stats.high_wait_max_ns = waited;
+    }
+    // A normal job stays at the head of its ring until its last chunk is in
+
+    uint32_t end = high || !mux_ops.chunked
+                       ? j->ndw
+                       : mux_chunk_end(j->dw, j->ndw, j->offset);
+    if (j->offset && !high)
+      mux_stats.resubmitted_dw += end - j->offset;
+    bool resume = j->preempted;
+    j->preempted = false;
+    mux_stats.chunks++;
+    mux_busy = true;
+    mux_current = j;
+    struct rmapi_ring_mux_ops ops = mux_ops;
+    pthread_mutex_unlock(&mux_lock);
+
+    const uint32_t *run_dw = j->dw + j->offset;
+    uint32_t run_ndw = end - j->offset, preamble = 0;
+    uint32_t *resumed = NULL;
+    int ret = 0;
+    if (resume) {
+      preamble = mux_collect_state(j->dw, 0, j->offset, 0, NULL);
+      resumed = os_prim_alloc(((size_t)preamble + run_ndw) * 4 + 4);
+      if (resumed) {
+        mux_collect_state(j->dw, 0, j->offset, 0, resumed);
+        memcpy(resumed + preamble, run_dw, (size_t)run_ndw * 4);
+        run_dw = resumed;
+        run_ndw += preamble;
+      } else {
+        ret = -1; // Without its state the rest would draw garbage
+      }
+    }
+    if (ret == 0 && ops.run)
+      ret = ops.run(ops.priv, j->pid, run_dw, run_ndw);
+    os_prim_free(resumed);
+
+    pthread_mutex_lock(&mux_lock);
+    mux_current = NULL;
+    mux_stats.preamble_dw += preamble;
+    j->offset = end;
+    bool finished = high || ret != 0 || end == j->ndw || j->cancelled;
+    if (!finished && mux_rings[MUX_HIGH].head) {
+      mux_stats.preemptions++; // Next pass picks the high ring, we resume later
+      j->preempted = true;
+      os_log_debug(OS_LOG_RMAPI, "RMAPI Mux: Job %llu preempted at dword %u of %u\n",
+                   (unsigned long long)j->seq, end, j->ndw);
+    }
+    if (finished) {
+      if (!high) {
+        r->head = j->next;
+        if (!r->head)
+          r->tail = NULL;
+      }
+      bool cancelled = j->cancelled; // Its fence is the scheduler's now
+      if (!cancelled)
+        mux_stats.jobs[high ? MUX_HIGH : MUX_LOW]++;
+      pthread_mutex_unlock(&mux_lock);
+      // Completion runs the scheduler, which may submit to us again
+      if (!cancelled)
+        rmapi_sched_fence_done(j->engine, j->seq, ret);
+      mux_job_free(j);
+      pthread_mutex_lock(&mux_lock);
+    }
+    mux_busy = false;
+    pthread_cond_broadcast(&mux_cond); // rmapi_ring_mux_fini may be waiting
+  }
+  pthread_mutex_unlock(&mux_lock);
+  return NULL;
+}
+
+int rmapi_ring_mux_init(const struct rmapi_ring_mux_ops *ops) {
+  pthread_mutex_lock(&mux_lock);
+  if (mux_running) {
+    pthread_mutex_unlock(&mux_lock);
+    return -1;
+  }
+  mux_ops = ops ? *ops : (struct rmapi_ring_mux_ops){NULL, NULL, false};
+  memset(&mux_stats, 0, sizeof(mux_stats));
+  mux_running = true;
+  if (pthread_create(&mux_thread, NULL, mux_main, NULL) != 0) {
+    mux_running = false;
+    pthread_mutex_unlock(&mux_lock);
+    return -1;
+  }
+  pthread_mutex_unlock(&mux_lock);
+  return 0;
+}
+
+bool rmapi_ring_mux_active(void) {
+  pthread_mutex_lock(&mux_lock);
+  bool running = mux_running;
+  pthread_mutex_unlock(&mux_lock);
+  return running;
+}
+
+// A job the scheduler released onto GFX or GFX_HIGH. The stream is copied,
+// completion comes later through rmapi_sched_fence_done.
+int rmapi_ring_mux_submit(int32_t pid, uint32_t engine,
+                          const struct amdgpu_command_buffer *cb,
+                          uint64_t seq) {
+  if ((engine != RMAPI_CLIENT_ENGINE_GFX &&
+       engine != RMAPI_CLIENT_ENGINE_GFX_HIGH) ||
+      !cb || cb->size % 4 || (cb->size && !cb->cmds))
+    return -1;
+  struct mux_job *j = os_prim_alloc(sizeof(*j));
+  if (!j)
+    return -1;
+  memset(j, 0, sizeof(*j));
+  j->dw = os_prim_alloc(cb->size ? cb->size : 4);
+  if (!j->dw) {
+    os_prim_free(j);
+    return -1;
+  }
+  memcpy(j->dw, cb->cmds, cb->size);
+  j->pid = pid;
+  j->engine = engine;
+  j->seq = seq;
+  j->ndw = (uint32_t)(cb->size / 4);
+  j->queued_ns = mux_now_ns();
+
+  pthread_mutex_lock(&mux_lock);
+  if (!mux_running) {
+    pthread_mutex_unlock(&mux_lock);
+    mux_job_free(j);
+    return -1;
+  }
+  struct mux_ring *r =
+      &mux_rings[engine == RMAPI_CLIENT_ENGINE_GFX_HIGH ? MUX_HIGH : MUX_LOW];
+  if (r->tail)
+    r->tail->next = j;
+  else
+    r->head = j;
+  r->tail = j;
+  pthread_cond_broadcast(&mux_cond);
+  pthread_mutex_unlock(&mux_lock);
+  return 0;
+}
+
+// A ring reset took engine's jobs from from_seq on back: drop our copies,
+// without their fences. -1 if one of them is on the ring right now. It's
+// dropped when it comes back, but only a reset of the ring itself stops it.
+int rmapi_ring_mux_cancel(uint32_t engine, uint64_t from_seq) {
+  int ret = 0;
+  pthread_mutex_lock(&mux_lock);
+  struct mux_job *cur = mux_current;
+  if (cur && cur->engine == engine && cur->seq >= from_seq) {
+    if (!cur->cancelled)
+      mux_stats.cancelled++;
+    cur->cancelled = true;
+    ret = -1;
+  }
+  for (int r = 0; r < 2; r++) {
+    struct mux_job **pp = &mux_rings[r].head, *prev = NULL;
+    while (*pp) {
+      struct mux_job *j = *pp;
+      if (j == cur || j->engine != engine || j->seq < from_seq) {
+        prev = j; // The worker unlinks the one it's running itself
+        pp = &j->next;
+        continue;
+      }
+      *pp = j->next;
+      if (mux_rings[r].tail == j)
+        mux_rings[r].tail = prev;
+      mux_stats.cancelled++;
+      mux_job_free(j);
+    }
+  }
+  pthread_cond_broadcast(&mux_cond); // rmapi_ring_mux_fini may be waiting
+  pthread_mutex_unlock(&mux_lock);
+  return ret;
+}
+
+void rmapi_ring_mux_get_stats(struct rmapi_ring_mux_stats *out) {
+  if (!out)
+    return;
+  pthread_mutex_lock(&mux_lock);
+  *out = mux_stats;
+  pthread_mutex_unlock(&mux_lock);
+}
+
+// Let the queued work drain, then stop the worker
+void rmapi_ring_mux_fini(void) {
+  pthread_mutex_lock(&mux_lock);
+  if (!mux_running) {
+    pthread_mutex_unlock(&mux_lock);
+    return;
+  }
+  while (mux_busy || mux_rings[MUX_LOW].head || mux_rings[MUX_HIGH].head)
+    pthread_cond_wait(&mux_cond, &mux_lock);
+  mux_running = false;
+  pthread_cond_broadcast(&mux_cond);
+  pthread_mutex_unlock(&mux_lock);
+  pthread_join(mux_thread, NULL);
+}
@@ -0,0 +1,797 @@
+#include "rmapi.h"
+#include "../../drivers/amdgpu/pm4_builder.h"
+#include "../../drivers/amdgpu/sdma_builder.h"
+#include "../../os/os_interface.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+#define os_prim_alloc_ex os_get_interface()->alloc_ex
+
+/*
+ * Yo! This is the Scheduler - the dispatcher between clients and the rings.
+ * Before, a submission went straight to the GPU, and if your draw needed
+ * the upload you did on the DMA engine, *you* had to block on a fence
+ * first. Now jobs carry what they wait for and the server sorts it out:
+ *
+ *   - Fences: every engine counts its jobs (seq 1, 2, 3...). "GFX waits for
+ *     DMA seq 7" is a dependency. Waiting for your own engine is free, the
+ *     ring runs in order anyway.
+ *   - Syncobj points (rmapi_syncobj.c), possibly not even promised yet.
+ *   - Implicit: two jobs touching the same BO run in submission order.
+ *
+ * GFX_HIGH is a ring of its own here (own seqs, own fence slot), even though
+ * it ends up on the GFX engine through the ring mux.
+ *
+ * Jobs sit in a per-engine FIFO until their inputs are ready. If the only
+ * thing missing is work already on another ring of this GPU, we don't hold
+ * it on the CPU at all: the job goes out with a WAIT_REG_MEM (SDMA:
+ * POLL_REGMEM) on that engine's fence and the CP does the waiting.
+ *
+ * Every stream ends with a fence write (RELEASE_MEM / SDMA FENCE) for its
+ * seq, and the backend reports completion with rmapi_sched_fence_done.
+ * The fence slots are a HAL buffer, so the packets carry a VA the CP really
+ * has. If there's no such VA (DRM mode: the kernel fences jobs itself) no
+ * fence or wait packets are emitted at all, and every dependency is held on
+ * the CPU instead.
+ *
+ * A client gets RMAPI_SCHED_MAX_CLIENT_JOBS jobs queued or on a ring at
+ * once; beyond that submits fail until some retire.
+ * That's when signal points fire and the next jobs get a look. The ring
+ * watchdog (hal_watchdog.c) hears about both ends, so a ring whose fence
+ * stops moving gets noticed.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define SCHED_WAIT_DW 7    // WAIT_REG_MEM (POLL_REGMEM is 6)
+#define SCHED_FENCE_DW 8   // RELEASE_MEM (SDMA FENCE is 4)
+#define SCHED_BO_BUCKETS 256
+
+struct sched_job {
+  uintptr_t id;                    // For syncobj callbacks: jobs may be gone by then
+  int32_t pid;
+  uint32_t engine;
+  uint64_t seq;
+  void *cmds;                      // Our copy of the client's stream
+  size_t size;
+  uint32_t *stream;                // What actually went to the ring
+  size_t stream_size;
+  uint64_t wait_seq[RMAPI_SCHED_RING_COUNT]; // Fences it needs (0 = none)
+  struct rmapi_syncobj_point *signals;
+  uint32_t signal_count;
+  struct rmapi_sched_hold *holds;  // Released with the job
+  uint32_t hold_count;
+  struct amdgpu_buffer **bos;      // All it may touch (kept alive by holds)
+  uint32_t bo_count;
+  int syncobj_state;               // 0 = waiting on points, 1 = done, -1 = one was destroyed
+  bool cancelled;                  // Runs as an empty stream, only its fence
+  bool held;                       // Already counted as held on the CPU
+  uint64_t ring_ns;                // Went onto the ring while tracing (0 = not traced)
+  struct sched_job *next;
+};
+
+// Last job that touched a BO (by GPU address, so copies of the buffer match)
+struct sched_bo_use {
+  uint64_t key;
+  uint32_t engine;
+  uint64_t seq;
+  struct sched_bo_use *next;
+};
+
+struct sched_engine {
+  struct sched_job *pending, *pending_tail; // Not on the ring yet, in seq order
+  struct sched_job *inflight, *inflight_tail; // On the ring, waiting for the fence
+  uint64_t submitted;              // Last seq handed out
+  uint64_t released;               // Last seq put on the ring
+  uint64_t done;                   // Last seq the fence says finished
+  uint64_t busy_until_ns;          // Trace: when the last traced job finished
+};
+
+static struct sched_engine sched_engines[RMAPI_SCHED_RING_COUNT];
+static struct sched_bo_use *sched_bo_uses[SCHED_BO_BUCKETS];
+static volatile uint64_t *sched_fence_cpu; // One fence slot per engine
+static uint64_t sched_fence_va;            // Where the CP sees them (0 = it can't)
+static struct amdgpu_buffer sched_fence_bo; // The slots, as jobs' buffer lists see them
+static struct OBJGPU *sched_fence_gpu_dev;
+static struct rmapi_sched_ops sched_ops;
+static struct rmapi_sched_stats sched_stats;
+static uintptr_t sched_next_id = 1;
+static bool sched_running, sched_rescan;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_cond = PTHREAD_COND_INITIALIZER;
+
+// Trace names: one GPU track and one fill counter per ring
+static const char *const sched_track_names[RMAPI_SCHED_RING_COUNT] = {
+    "GPU gfx", "GPU compute", "GPU dma", "GPU gfx high",
+};
+static const char *const sched_fill_names[RMAPI_SCHED_RING_COUNT] = {
+    "gfx ring jobs", "compute ring jobs", "dma ring jobs", "gfx high ring jobs",
+};
+
+static uint64_t sched_fence_gpu(uint32_t engine) {
+  return sched_fence_va + engine * sizeof(uint64_t);
+}
+
+static int sched_init_locked(void) {
+  if (sched_fence_cpu)
+    return 0;
+  size_t size = RMAPI_SCHED_RING_COUNT * sizeof(uint64_t);
+  struct OBJGPU *gpu = rmapi_get_gpu();
+  if (gpu && amdgpu_buffer_alloc_hal(gpu, size, &sched_fence_bo) == 0) {
+    sched_fence_gpu_dev = gpu;
+    sched_fence_cpu = sched_fence_bo.cpu_addr;
+    sched_fence_va = sched_fence_bo.gpu_addr; // 0 in DRM mode: not in any VM of ours
+  } else {
+    sched_fence_cpu = os_prim_alloc_ex(size, 64, OS_ALLOC_USAGE_RING, 0);
+    // No device (tests): only the simulated CP reads host memory
+    if (sched_fence_cpu && amdgpu_hal_get_mode() == AMDGPU_HAL_MODE_SIM)
+      sched_fence_va = (uint64_t)(uintptr_t)sched_fence_cpu;
+    memset(&sched_fence_bo, 0, sizeof(sched_fence_bo));
+    sched_fence_bo.cpu_addr = (void *)sched_fence_cpu;
+    sched_fence_bo.gpu_addr = sched_fence_va;
+    sched_fence_bo.size = size;
+  }
+  if (!sched_fence_cpu)
+    return -1;
+  for (uint32_t e = 0; e < RMAPI_SCHED_RING_COUNT; e++) {
+    sched_fence_cpu[e] = sched_engines[e].done;
+    os_trace_name_track(e, sched_track_names[e]);
+  }
+  return 0;
+}
+
+void rmapi_sched_set_ops(const struct rmapi_sched_ops *ops) {
+  pthread_mutex_lock(&sched_lock);
+  if (ops)
+    sched_ops = *ops;
+  else
+    memset(&sched_ops, 0, sizeof(sched_ops));
+  pthread_mutex_unlock(&sched_lock);
+}
+
+/* --- Implicit sync through shared BOs --- */
+
+static uint64_t sched_bo_key(const struct amdgpu_buffer *bo) {
+  return bo->gpu_addr ? bo->gpu_addr : ((uint64_t)1 << 63) | bo->handle;
+}
+
+// Note that this job uses bo, and make it wait for whoever used it last
+static void sched_bo_use_locked(struct sched_job *j,
+                                const struct amdgpu_buffer *bo) {
+  uint64_t key = sched_bo_key(bo);
+  struct sched_bo_use **pp = &sched_bo_uses[(key >> 12) % SCHED_BO_BUCKETS];
+  struct sched_bo_use *use = NULL;
+
+  while (*pp) {
+    struct sched_bo_use *u = *pp;
+    if (u->key == key) {
+      use = u;
+      pp = &u->next;
+    } else if (sched_engines[u->engine].done >= u->seq) {
+      *pp = u->next; // Finished and not ours: nobody needs to remember it
+      os_prim_free(u);
+    } else {
+      pp = &u->next;
+    }
+  }
+
+  if (use) {
+    // No read/write flags in a CS, so every use orders like a write
+    if (use->engine != j->engine && sched_engines[use->engine].done < use->seq &&
+        j->wait_seq[use->engine] < use->seq) {
+      j->wait_seq[use->engine] = use->seq;
+      sched_stats.implicit++;
+    }
+  } else {
+    use = os_prim_alloc(sizeof(*use));
+    if (!use)
+      return; // Only costs us the ordering against the next user
+    use->key = key;
+    use->next = sched_bo_uses[(key >> 12) % SCHED_BO_BUCKETS];
+    sched_bo_uses[(key >> 12) % SCHED_BO_BUCKETS] = use;
+  }
+  use->engine = j->engine;
+  use->seq = j->seq;
+}
+
+/* --- Building what goes on the ring --- */
+
+static void sched_emit_wait(uint32_t *dw, uint32_t *ndw, uint32_t engine,
+                            uint32_t on, uint64_t seq) {
+  uint64_t addr = sched_fence_gpu(on);
+  if (engine == RMAPI_CLIENT_ENGINE_DMA) {
+    struct sdma_builder sb;
+    sdma_builder_init(&sb, dw + *ndw, SCHED_WAIT_DW);
+    sdma_poll_mem(&sb, addr, (uint32_t)seq, 0xFFFFFFFF, PM4_WAIT_GE);
+    *ndw += sb.cdw;
+    return;
+  }
+  struct pm4_builder b;
+  pm4_builder_init(&b, dw + *ndw, SCHED_WAIT_DW,
+                   engine == RMAPI_CLIENT_ENGINE_COMPUTE);
+  pm4_wait_reg_mem(&b, PM4_SPACE_MEM, PM4_WAIT_GE, addr, (uint32_t)seq,
+                   0xFFFFFFFF, 4);
+  *ndw += b.cdw;
+}
+
+static void sched_emit_fence(uint32_t *dw, uint32_t *ndw, uint32_t engine,
+                             uint64_t seq) {
+  uint64_t addr = sched_fence_gpu(engine);
+  if (engine == RMAPI_CLIENT_ENGINE_DMA) {
+    struct sdma_builder sb;
+    sdma_builder_init(&sb, dw + *ndw, SCHED_FENCE_DW);
+    sdma_fence(&sb, addr, (uint32_t)seq); // POLL_REGMEM only compares 32 bits anyway
+    *ndw += sb.cdw;
+    return;
+  }
+  struct pm4_builder b;
+  pm4_builder_init(&b, dw + *ndw, SCHED_FENCE_DW,
+                   engine == RMAPI_CLIENT_ENGINE_COMPUTE);
+  pm4_release_mem(&b, PM4_EVENT_CACHE_FLUSH_AND_INV_TS, 0, addr, seq,
+                  PM4_DATA_SEL_64, PM4_INT_SEL_ON_CONFIRM);
+  *ndw += b.cdw;
+}
+
+// 1 = can go now (hw_mask: engines the CP has to wait for), 0 = hold it
+static int sched_ready_locked(struct sched_job *j, uint32_t *hw_mask) {
+  *hw_mask = 0;
+  if (j->cancelled)
+    return 1;
+  // The CP needs a fence to poll, and a ring that doesn't block us meanwhile
+  bool cp_waits = sched_fence_va != 0 &&
+                  !(sched_ops.sync_engines & (1u << j->engine));
+  if (j->syncobj_state < 0) {
+    os_prim_log("RMAPI Sched: Job %u:%llu lost a syncobj it waited on, dropped\n",
+                j->engine, (unsigned long long)j->seq);
+    j->cancelled = true;
+    sched_stats.cancelled++;
+    return 1;
+  }
+  if (j->syncobj_state == 0)
+    return 0;
+
+  for (uint32_t e = 0; e < RMAPI_SCHED_RING_COUNT; e++) {
+    uint64_t s = j->wait_seq[e];
+    if (!s || e == j->engine || sched_engines[e].done >= s)
+      continue;
+    // Already on a ring: the CP can wait for it. Not if that's the ring this
+    // job goes to as well (GFX / GFX_HIGH): the mux may put us in front of it.
+    if (cp_waits && sched_engines[e].released >= s &&
+        RMAPI_ENGINE_CLASS(e) != RMAPI_ENGINE_CLASS(j->engine)) {
+      *hw_mask |= 1u << e;
+      continue;
+    }
+    return 0;
+  }
+  return 1;
+}
+
+// Put together waits + client stream + fence. NULL if out of memory.
+static uint32_t *sched_build_locked(struct sched_job *j, uint32_t hw_mask,
+                                    size_t *bytes) {
+  uint32_t max = RMAPI_SCHED_RING_COUNT * SCHED_WAIT_DW + SCHED_FENCE_DW;
+  size_t cmd_bytes = j->cancelled ? 0 : j->size;
+  uint32_t *dw = os_prim_alloc(max * 4 + cmd_bytes);
+  if (!dw)
+    return NULL;
+
+  uint32_t ndw = 0;
+  for (uint32_t e = 0; e < RMAPI_SCHED_RING_COUNT; e++) {
+    if (hw_mask & (1u << e)) {
+      sched_emit_wait(dw, &ndw, j->engine, e, j->wait_seq[e]);
+      sched_stats.hw_waits++;
+    }
+  }
+  if (cmd_bytes)
+    memcpy(dw + ndw, j->cmds, cmd_bytes);
+  ndw += (uint32_t)(cmd_bytes / 4);
+  if (sched_fence_va)
+    sched_emit_fence(dw, &ndw, j->engine, j->seq);
+  *bytes = (size_t)ndw * 4;
+  return dw;
+}
+
+static void sched_job_free(struct sched_job *j) {
+  for (uint32_t i = 0; i < j->hold_count; i++)
+    j->holds[i].release(j->holds[i].data);
+  os_prim_free(j->holds);
+  os_prim_free(j->bos);
+  os_prim_free(j->cmds);
+  os_prim_free(j->stream);
+  os_prim_free(j->signals);
+  os_prim_free(j);
+}
+
+// Hand every job whose inputs are ready to its ring, in seq order per engine.
+// Re-entrant: a backend that completes right away calls back in here, and we
+// just go around once more instead of recursing.
+void rmapi_sched_kick(void) {
+  pthread_mutex_lock(&sched_lock);
+  if (sched_running) {
+    sched_rescan = true;
+    pthread_mutex_unlock(&sched_lock);
+    return;
+  }
+  sched_running = true;
+
+  do {
+    sched_rescan = false;
+    for (uint32_t e = 0; e < RMAPI_SCHED_RING_COUNT; e++) {
+      struct sched_engine *eng = &sched_engines[e];
+      struct sched_job *j;
+      while ((j = eng->pending) != NULL) {
+        uint32_t hw_mask;
+        if (!sched_ready_locked(j, &hw_mask)) {
+          if (!j->held) {
+            j->held = true;
+            sched_stats.cpu_held++;
+          }
+          break;
+        }
+
+        size_t bytes = 0;
+        j->stream = sched_build_locked(j, hw_mask, &bytes);
+        j->stream_size = bytes;
+        eng->pending = j->next;
+        if (!eng->pending)
+          eng->pending_tail = NULL;
+        j->next = NULL;
+        if (eng->inflight_tail)
+          eng->inflight_tail->next = j;
+        else
+          eng->inflight = j;
+        eng->inflight_tail = j;
+        eng->released = j->seq;
+        sched_stats.pending--;
+        amdgpu_watchdog_arm(e, j->seq); // On the clock until its fence moves
+        if (os_trace_enabled()) {
+          j->ring_ns = os_trace_now_ns();
+          os_trace_counter(OS_TRACE_RING, sched_fill_names[e], eng->released - eng->done);
+        }
+
+        struct rmapi_sched_ops ops = sched_ops;
+        int32_t pid = j->pid;
+        uint64_t seq = j->seq;
+        struct amdgpu_command_buffer cb = {NULL, j->stream, bytes, j->bos,
+                                           j->bo_count};
+        pthread_mutex_unlock(&sched_lock);
+
+        int ret = -1;
+        os_trace_begin(OS_TRACE_RING, "run_job", "seq", seq);
+        if (!cb.cmds)
+          os_prim_log("RMAPI Sched: Out of memory building job %u:%llu\n", e,
+                      (unsigned long long)seq);
+        else if (ops.run_job)
+          ret = ops.run_job(ops.priv, pid, e, &cb, seq);
+        else
+          ret = rmapi_sched_fence_done(e, seq, 0); // Nothing behind the ring
+        if (ret != 0)
+          rmapi_sched_fence_done(e, seq, -1);
+        os_trace_end(OS_TRACE_RING, "run_job");
+
+        pthread_mutex_lock(&sched_lock);
+        sched_rescan = true; // Engines already walked may now wait in hardware
+      }
+    }
+  } while (sched_rescan);
+
+  sched_running = false;
+  pthread_mutex_unlock(&sched_lock);
+}
+
+// Jobs of pid not retired yet (queued or on a ring)
+static uint32_t sched_client_jobs_locked(int32_t pid) {
+  uint32_t n = 0;
+  for (uint32_t e = 0; e < RMAPI_SCHED_RING_COUNT; e++) {
+    struct sched_job *lists[2] = {sched_engines[e].pending, sched_engines[e].inflight};
+    for (int l = 0; l < 2; l++)
+      for (struct sched_job *j = lists[l]; j; j = j->next)
+        n += j->pid == pid;
+  }
+  return n;
+}
+
+static void sched_syncobj_ready(void *data, int status) {
+  uintptr_t id = (uintptr_t)data;
+  pthread_mutex_lock(&sched_lock);
+  for (uint32_t e = 0; e < RMAPI_SCHED_RING_COUNT; e++)
+    for (struct sched_job *j = sched_engines[e].pending; j; j = j->next)
+      if (j->id == id)
+        j->syncobj_state = status < 0 ? -1 : 1;
+  pthread_mutex_unlock(&sched_lock);
+  rmapi_sched_kick();
+}
+
+// "Run this on engine X once deps are done, then signal these points".
+// Returns right away with the job's fence seq; 0 means accepted, not run.
+int rmapi_sched_submit(int32_t pid, uint32_t engine,
+                       const struct amdgpu_command_buffer *cb,
+                       const struct rmapi_sched_dep *deps, uint32_t dep_count,
+                       const struct rmapi_syncobj_point *signals,
+                       uint32_t signal_count, uint64_t *seq) {
+  return rmapi_sched_submit_held(pid, engine, cb, deps, dep_count, signals,
+                                 signal_count, NULL, 0, seq);
+}
+
+// Same, and the job owns holds from here on (the caller keeps them on -1)
+int rmapi_sched_submit_held(int32_t pid, uint32_t engine,
+                            const struct amdgpu_command_buffer *cb,
+                            const struct rmapi_sched_dep *deps,
+                            uint32_t dep_count,
+                            const struct rmapi_syncobj_point *signals,
+                            uint32_t signal_count,
+                            const struct rmapi_sched_hold *holds,
+                            uint32_t hold_count, uint64_t *seq) {
+  if (engine >= RMAPI_SCHED_RING_COUNT || !cb || (cb->size && !cb->cmds) ||
+      cb->size % 4 || (dep_count && !deps) || (signal_count && !signals) ||
+      (hold_count && !holds))
+    return -1;
+  os_trace_scope(OS_TRACE_RMAPI, "rmapi_sched_submit");
+
+  struct sched_job *j = os_prim_alloc(sizeof(*j));
+  if (!j)
+    return -1;
+  memset(j, 0, sizeof(*j));
+  j->pid = pid;
+  j->engine = engine;
+  j->size = cb->size;
+  j->signal_count = signal_count;
+  j->syncobj_state = 1;
+
+  // The caller's buffers are gone by the time a held job runs
+  j->cmds = cb->size ? os_prim_alloc(cb->size) : NULL;
+  j->signals = signal_count ? os_prim_alloc(signal_count * sizeof(*signals)) : NULL;
+  j->holds = hold_count ? os_prim_alloc(hold_count * sizeof(*holds)) : NULL;
+  uint32_t max_bos = cb->bo_count + 1; // + the fence slots
+  for (uint32_t i = 0; i < hold_count; i++)
+    max_bos += holds[i].bo_count;
+  j->bos = os_prim_alloc(max_bos * sizeof(*j->bos));
+  struct rmapi_syncobj_point *pts =
+      dep_count ? os_prim_alloc(dep_count * sizeof(*pts)) : NULL;
+  if ((cb->size && !j->cmds) || (signal_count && !j->signals) ||
+      (hold_count && !j->holds) || !j->bos || (dep_count && !pts)) {
+    os_prim_free(pts);
+    sched_job_free(j);
+    return -1;
+  }
+  if (cb->size)
+    memcpy(j->cmds, cb->cmds, cb->size);
+  if (signal_count)
+    memcpy(j->signals, signals, signal_count * sizeof(*signals));
+  if (hold_count)
+    memcpy(j->holds, holds, hold_count * sizeof(*holds));
+  for (uint32_t i = 0; i < cb->bo_count; i++)
+    if (cb->bo_list && cb->bo_list[i])
+      j->bos[j->bo_count++] = cb->bo_list[i];
+  for (uint32_t i = 0; i < hold_count; i++)
+    for (uint32_t b = 0; b < holds[i].bo_count; b++)
+      if (holds[i].bos && holds[i].bos[b])
+        j->bos[j->bo_count++] = holds[i].bos[b];
+
+  pthread_mutex_lock(&sched_lock);
+  if (sched_init_locked() != 0) {
+    pthread_mutex_unlock(&sched_lock);
+    os_prim_free(pts);
+    sched_job_free(j);
+    return -1;
+  }
+  // Submits come back before the work runs: without a cap, one client
+  // could queue up the server's memory
+  if (pid && sched_client_jobs_locked(pid) >= RMAPI_SCHED_MAX_CLIENT_JOBS) {
+    sched_stats.refused++;
+    pthread_mutex_unlock(&sched_lock);
+    os_prim_log("RMAPI Sched: pid %d has %u jobs queued already, refused\n",
+                pid, RMAPI_SCHED_MAX_CLIENT_JOBS);
+    os_prim_free(pts);
+    sched_job_free(j);
+    return -1;
+  }
+
+  uint32_t npts = 0;
+  for (uint32_t i = 0; i < dep_count; i++) {
+    const struct rmapi_sched_dep *d = &deps[i];
+    if (d->type == RMAPI_SCHED_DEP_SYNCOBJ) {
+      pts[npts].handle = d->id;
+      pts[npts].pad = 0;
+      pts[npts++].point = d->value;
+    } else if (d->type == RMAPI_SCHED_DEP_FENCE &&
+               d->id < RMAPI_SCHED_RING_COUNT &&
+               d->value <= sched_engines[d->id].submitted) {
+      // One engine finishes in order: only its highest seq matters
+      if (j->wait_seq[d->id] < d->value)
+        j->wait_seq[d->id] = d->value;
+    } else {
+      os_prim_log("RMAPI Sched: Bad dependency (type %u, id %u, value %llu)\n",
+                  d->type, d->id, (unsigned long long)d->value);
+      pthread_mutex_unlock(&sched_lock);
+      os_prim_free(pts);
+      sched_job_free(j);
+      return -1;
+    }
+  }
+
+  struct sched_engine *eng = &sched_engines[engine];
+  if (sched_fence_va)
+    j->bos[j->bo_count++] = &sched_fence_bo;
+  j->hold_count = hold_count; // Accepted: ours to release from now on
+  j->id = sched_next_id++;
+  j->seq = ++eng->submitted;
+  for (uint32_t i = 0; i < cb->bo_count; i++)
+    if (cb->bo_list && cb->bo_list[i])
+      sched_bo_use_locked(j, cb->bo_list[i]);
+  if (npts)
+    j->syncobj_state = 0;
+
+  if (eng->pending_tail)
+    eng->pending_tail->next = j;
+  else
+    eng->pending = j;
+  eng->pending_tail = j;
+  sched_stats.jobs++;
+  sched_stats.pending++;
+  uintptr_t id = j->id;
+  if (seq)
+    *seq = j->seq;
+  os_trace_flow_start(OS_TRACE_FLOW_JOB(engine, j->seq)); // Lands on the GPU track
+  pthread_mutex_unlock(&sched_lock);
+
+  // May call back right away if the points are done already
+  if (npts && rmapi_syncobj_when(pts, npts, sched_syncobj_ready,
+                                 (void *)id) != 0)
+    sched_syncobj_ready((void *)id, -1); // Unknown syncobj
+  os_prim_free(pts);
+
+  rmapi_sched_kick();
+  return 0;
+}
+
+// The backend says engine's fence reached seq (error != 0: that job failed)
+int rmapi_sched_fence_done(uint32_t engine, uint64_t seq, int error) {
+  if (engine >= RMAPI_SCHED_RING_COUNT)
+    return -1;
+
+  struct sched_job *done = NULL, **tail = &done;
+  pthread_mutex_lock(&sched_lock);
+  struct sched_engine *eng = &sched_engines[engine];
+  if (seq > eng->released) {
+    pthread_mutex_unlock(&sched_lock);
+    return -1;
+  }
+  if (seq > eng->done) {
+    eng->done = seq;
+    if (sched_fence_cpu)
+      sched_fence_cpu[engine] = seq; // What the CP would have written
+    amdgpu_watchdog_signal(engine, seq);
+  }
+  uint64_t now_ns = os_trace_enabled() ? os_trace_now_ns() : 0;
+  while (eng->inflight && eng->inflight->seq <= eng->done) {
+    struct sched_job *j = eng->inflight;
+    if (j->ring_ns && now_ns) {
+      // The ring runs in order: a job starts once it's there and the one
+      // before it is done. The fence tells us when it finished.
+      uint64_t start = j->ring_ns > eng->busy_until_ns ? j->ring_ns : eng->busy_until_ns;
+      os_trace_gpu_slice(engine, error && j->seq == seq ? "failed job" : "job", start,
+                         now_ns, j->seq, OS_TRACE_FLOW_JOB(engine, j->seq));
+      eng->busy_until_ns = now_ns;
+    }
+    eng->inflight = j->next;
+    j->next = NULL;
+    *tail = j;
+    tail = &j->next;
+  }
+  if (!eng->inflight)
+    eng->inflight_tail = NULL;
+  os_trace_counter(OS_TRACE_RING, sched_fill_names[engine], eng->released - eng->done);
+  pthread_cond_broadcast(&sched_cond);
+  pthread_mutex_unlock(&sched_lock);
+
+  while (done) {
+    struct sched_job *j = done;
+    done = j->next;
+    if (error && j->seq == seq)
+      os_prim_log("RMAPI Sched: Job %u:%llu (pid %d) failed\n", engine,
+                  (unsigned long long)seq, j->pid);
+    // Signal even on failure, or everybody downstream waits forever
+    for (uint32_t i = 0; i < j->signal_count; i++)
+      rmapi_syncobj_signal(0, j->signals[i].handle, j->signals[i].point);
+    sched_job_free(j);
+  }
+
+  rmapi_sched_kick();
+  return 0;
+}
+
+// The ring was reset with the job at stuck_seq on it (amdgpu_job.c's
+// guilty job). That one fails, whatever its client still has queued is
+// cancelled, and the innocent jobs behind it on the ring go out again.
+int rmapi_sched_reset_ring(uint32_t engine, uint64_t stuck_seq,
+                           struct rmapi_sched_reset *out) {
+  if (engine >= RMAPI_SCHED_RING_COUNT)
+    return -1;
+  struct rmapi_sched_reset res = {-1, 0, 0};
+  struct sched_rerun {
+    int32_t pid;
+    uint64_t seq;
+    void *stream;
+    size_t size;
+    struct amdgpu_buffer **bos; // The job's: it's on the ring until rerun
+    uint32_t bo_count;
+  } *rerun = NULL;
+
+  pthread_mutex_lock(&sched_lock);
+  struct sched_engine *eng = &sched_engines[engine];
+  if (stuck_seq <= eng->done || stuck_seq > eng->released) {
+    pthread_mutex_unlock(&sched_lock);
+    return -1; // It moved on by itself after all
+  }
+  // The backend's copies go first, or the innocent jobs would run twice
+  if (sched_ops.cancel_jobs &&
+      sched_ops.cancel_jobs(sched_ops.priv, engine, stuck_seq) != 0) {
+    pthread_mutex_unlock(&sched_lock);
+    os_prim_log("RMAPI Sched: Job %u:%llu is still running, can't reset the queue\n",
+                engine, (unsigned long long)stuck_seq);
+    return -1;
+  }
+  uint32_t count = 0;
+  for (struct sched_job *j = eng->inflight; j; j = j->next) {
+    if (j->seq == stuck_seq)
+      res.guilty_pid = j->pid;
+    else if (j->seq > stuck_seq)
+      count++;
+  }
+  rerun = count ? os_prim_alloc(count * sizeof(*rerun)) : NULL;
+  for (struct sched_job *j = eng->inflight; rerun && j; j = j->next) {
+    if (j->seq <= stuck_seq)
+      continue;
+    struct sched_rerun *r = &rerun[res.resubmitted];
+    r->pid = j->pid;
+    r->seq = j->seq;
+    r->bos = j->bos;
+    r->bo_count = j->bo_count;
+    r->size = j->stream_size;
+    r->stream = os_prim_alloc(r->size ? r->size : 4);
+    if (!r->stream)
+      break;
+    memcpy(r->stream, j->stream, r->size);
+    res.resubmitted++;
+  }
+  for (uint32_t e = 0; res.guilty_pid != -1 && e < RMAPI_SCHED_RING_COUNT; e++)
+    for (struct sched_job *j = sched_engines[e].pending; j; j = j->next)
+      if (j->pid == res.guilty_pid && !j->cancelled) {
+        j->cancelled = true;
+        sched_stats.cancelled++;
+        res.cancelled++;
+      }
+  struct rmapi_sched_ops ops = sched_ops;
+  uint64_t released = eng->released;
+  pthread_mutex_unlock(&sched_lock);
+
+  rmapi_sched_fence_done(engine, stuck_seq, -1);
+  for (uint32_t i = 0; i < res.resubmitted; i++) {
+    struct amdgpu_command_buffer cb = {NULL, rerun[i].stream, rerun[i].size,
+                                       rerun[i].bos, rerun[i].bo_count};
+    int ret = ops.run_job ? ops.run_job(ops.priv, rerun[i].pid, engine, &cb,
+                                        rerun[i].seq)
+                          : rmapi_sched_fence_done(engine, rerun[i].seq, 0);
+    if (ret != 0)
+      rmapi_sched_fence_done(engine, rerun[i].seq, -1);
+    os_prim_free(rerun[i].stream);
+  }
+  // Couldn't keep a copy: those go down with the guilty one
+  if (count && res.resubmitted < count)
+    rmapi_sched_fence_done(engine, released, -1);
+  if (rerun)
+    os_prim_free(rerun);
+  if (res.cancelled)
+    rmapi_sched_kick(); // The guilty client's queue goes out as bare fences
+  if (out)
+    *out = res;
+  return 0;
+}
+
+// 0 = done, 1 = timed out, -1 = no such fence
+int rmapi_sched_fence_wait(uint32_t engine, uint64_t seq, uint64_t timeout_ns) {
+  if (engine >= RMAPI_SCHED_RING_COUNT)
+    return -1;
+
+  struct timespec deadline;
+  bool forever = timeout_ns == RMAPI_SYNCOBJ_WAIT_FOREVER;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  if (!forever) {
+    deadline.tv_sec += (time_t)(timeout_ns / 1000000000ull);
+    deadline.tv_nsec += (long)(timeout_ns % 1000000000ull);
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+
+  int ret = 0;
+  pthread_mutex_lock(&sched_lock);
+  struct sched_engine *eng = &sched_engines[engine];
+  if (seq > eng->submitted) {
+    ret = -1;
+  } else {
+    while (eng->done < seq) {
+      if (timeout_ns == 0) {
+        ret = 1;
+        break;
+      }
+      if (forever) {
+        pthread_cond_wait(&sched_cond, &sched_lock);
+      } else if (pthread_cond_timedwait(&sched_cond, &sched_lock, &deadline) ==
+                 ETIMEDOUT) {
+        ret = 1;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&sched_lock);
+  return ret;
+}
+
+// Client hung up: whatever it still had queued only runs as a bare fence,
+// so the seqs after it (and anybody waiting on its signal points) move on
+void rmapi_sched_release_pid(int32_t pid) {
+  pthread_mutex_lock(&sched_lock);
+  for (uint32_t e = 0; e < RMAPI_SCHED_RING_COUNT; e++) {
+    for (struct sched_job *j = sched_engines[e].pending; j; j = j->next) {
+      if (j->pid == pid && !j->cancelled) {
+        j->cancelled = true;
+        sched_stats.cancelled++;
+      }
+    }
+  }
+  pthread_mutex_unlock(&sched_lock);
+  rmapi_sched_kick();
+}
+
+void rmapi_sched_get_stats(struct rmapi_sched_stats *out) {
+  if (!out)
+    return;
+  pthread_mutex_lock(&sched_lock);
+  *out = sched_stats;
+  pthread_mutex_unlock(&sched_lock);
+}
+
+// Shutdown: nothing runs anymore, forget everything
+void rmapi_sched_fini(void) {
+  pthread_mutex_lock(&sched_lock);
+  for (uint32_t e = 0; e < RMAPI_SCHED_RING_COUNT; e++) {
+    struct sched_engine *eng = &sched_engines[e];
+    struct sched_job *lists[2] = {eng->pending, eng->inflight};
+    for (int l = 0; l < 2; l++) {
+      while (lists[l]) {
+        struct sched_job *j = lists[l];
+        lists[l] = j->next;
+        sched_job_free(j);
+      }
+    }
+    eng->pending = eng->pending_tail = NULL;
+    eng->inflight = eng->inflight_tail = NULL;
+    eng->released = eng->done = eng->submitted;
+  }
+  for (int i = 0; i < SCHED_BO_BUCKETS; i++) {
+    while (sched_bo_uses[i]) {
+      struct sched_bo_use *u = sched_bo_uses[i];
+      sched_bo_uses[i] = u->next;
+      os_prim_free(u);
+    }
+  }
+  if (sched_fence_gpu_dev)
+    amdgpu_buffer_free_hal(sched_fence_gpu_dev, &sched_fence_bo);
+  else if (sched_fence_cpu)
+    os_prim_free((void *)sched_fence_cpu);
+  sched_fence_cpu = NULL;
+  sched_fence_va = 0;
+  sched_fence_gpu_dev = NULL;
+  sched_stats.pending = 0;
+  pthread_cond_broadcast(&sched_cond);
+  pthread_mutex_unlock(&sched_lock);
+}
@@ -1,9 +1,13 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // struct ucred
+#endif
 #include "../os/os_primitives.h"
 #include "../os/os_primitives.h"
 #include "../ipc/ipc_lib.h"
 #include "../ipc/ipc_protocol.h"
 #include "../hal/hal.h"
 #include "rmapi.h"
+#include "../../os/interface/os_log.h"
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
@@ -42,27 +46,105 @@ typedef struct {
   // Saving some info here so we don't have to ask the GPU every time
   struct amdgpu_gpu_info cached_info;
   int info_cached;
+  pid_t client_pid; // Who is on the other end (0 if the OS won't tell us)
+  uid_t client_uid; // ...and as which user
 } rmapi_server_t;
 
+// Knobs that affect other tenants (quotas, their stats, the high priority
+// ring) are for root and the user the server runs as
+static bool server_privileged(rmapi_server_t *server) {
+#ifdef SO_PEERCRED
+  if (!server->client_pid ||
+      (server->client_uid != 0 && server->client_uid != getuid())) {
+    os_prim_log("RMAPI Server: uid %d may not do that\n",
+                (int)server->client_uid);
+    return false;
+  }
+#endif
+  (void)server;
+  return true;
+}
+
+// Every answer goes through here, so a capture sees it too (and a trace
+// gets the arrow back to the client's call)
+static int server_reply(rmapi_server_t *server, ipc_message_t *reply) {
+  rmapi_capture_message(RMAPI_CAPTURE_REPLY, server->client_pid, reply->type,
+                        reply->id, reply->data, reply->data_size);
+  os_trace_flow_start(OS_TRACE_FLOW_REPLY(server->client_pid, reply->id));
+  return ipc_send_message(&server->conn, reply);
+}
+
+// Shared by IPC_REQ_SYNCOBJ_WAIT and IPC_REQ_VK_WAIT_FOR_FENCES (fences: every
+// point is 1, whatever the client put there). Blocks only this client's thread.
+// Every syncobj named here is this client's, or was shared with it
+static bool server_syncobjs_allowed(rmapi_server_t *server,
+                                    const struct rmapi_syncobj_point *pts,
+                                    uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (rmapi_syncobj_query(server->client_pid, pts[i].handle, NULL) != 0) {
+      os_prim_log("RMAPI Server: pid %d may not use syncobj %u\n",
+                  server->client_pid, pts[i].handle);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void server_syncobj_wait(rmapi_server_t *server, ipc_message_t *msg,
+                                uint32_t reply, int fences) {
+  struct ipc_syncobj_reply rep = {-1, 0, 0};
+  struct ipc_syncobj_wait *w = msg->data;
+  if (w && msg->data_size >= sizeof(*w) &&
+      w->count <= (msg->data_size - sizeof(*w)) /
+                      sizeof(struct rmapi_syncobj_point)) {
+    struct rmapi_syncobj_point *pts = (struct rmapi_syncobj_point *)(w + 1);
+    for (uint32_t i = 0; fences && i < w->count; i++)
+      pts[i].point = 1;
+    if (server_syncobjs_allowed(server, pts, w->count))
+      rep.result = rmapi_syncobj_wait(pts, w->count, w->flags, w->timeout_ns,
+                                      &rep.handle);
+  }
+  server_reply(server, &(ipc_message_t){reply, msg->id, sizeof(rep), &rep});
+}
+
 // This function handles a single client (an app).
 // Since it uses threads, multiple apps can talk to the DJ at once!
 void *handle_client(void *arg) {
   rmapi_server_t *server = (rmapi_server_t *)arg;
   ipc_message_t msg;
 
+  rmapi_capture_message(RMAPI_CAPTURE_CLIENT, server->client_pid, 1, 0, NULL,
+                        0);
+
   // Keep listening as long as the app is talking
   while (ipc_recv_message(&server->conn, &msg) > 0) {
+    if (rmapi_capture_active()) {
+      // What the commands point at has to be in the trace before them
+      if (msg.type == IPC_REQ_SUBMIT_COMMAND ||
+          msg.type == IPC_REQ_SUBMIT_COMMAND_DEPS)
+        rmapi_capture_bos(server->client_pid);
+      rmapi_capture_message(RMAPI_CAPTURE_REQUEST, server->client_pid, msg.type,
+                            msg.id, msg.data, msg.data_size);
+    }
+    // One span per request, the client's call points at it
+    const char *span = os_trace_enabled() ? ipc_message_name(msg.type) : NULL;
+    if (span) {
+      os_trace_begin(OS_TRACE_IPC, span, "type", msg.type);
+      os_trace_flow_end(OS_TRACE_FLOW_REQUEST(server->client_pid, msg.id));
+    }
     switch (msg.type) {
     case IPC_REQ_ALLOC_MEMORY: { // REQUEST: I need GPU memory!
       size_t size = *(size_t *)msg.data;
-      uint64_t addr;
-      int ret =
-          rmapi_alloc_memory(NULL, size, &addr); // Asking the HAL for space
-
-      // Sending the address back to the app
-      ipc_send_message(
-          &server->conn,
-          &(ipc_message_t){IPC_REP_ALLOC_MEMORY, msg.id, sizeof(addr), &addr});
+      struct ipc_alloc_reply rep = {0, 0, 0};
+      // Shareable from day one, so PRIME export is just handing out an fd
+      if (rmapi_prime_create(NULL, server->client_pid, size, &rep.handle,
+                             &rep.gpu_addr) == 0 &&
+          rep.gpu_addr == 0)
+        rep.gpu_addr = rep.handle; // Kernel BOs have no address until mapped
+
+      // Sending the address (and the handle) back to the app
+      server_reply(server, &(ipc_message_t){IPC_REP_ALLOC_MEMORY, msg.id,
+                                            sizeof(rep), &rep});
       break;
     }
     case IPC_REQ_GET_GPU_INFO: { // REQUEST: Who is the GPU?
@@ -70,28 +152,361 @@ void *handle_client(void *arg) {
       rmapi_get_gpu_info(NULL, &info);
 
       // Sending the GPU name and specs back!
-      ipc_send_message(
-          &server->conn,
-          &(ipc_message_t){IPC_REP_GET_GPU_INFO, msg.id, sizeof(info), &info});
+      server_reply(server, &(ipc_message_t){IPC_REP_GET_GPU_INFO, msg.id,
+                                            sizeof(info), &info});
       break;
     }
     case IPC_REQ_FREE_MEMORY: { // REQUEST: I'm done with this memory
+      // Clients know their buffers by the address or by the handle
       uint64_t addr = *(uint64_t *)msg.data;
-      (void)addr;
-      int success = 0;
-      ipc_send_message(&server->conn,
-                       &(ipc_message_t){IPC_REP_FREE_MEMORY, msg.id,
-                                        sizeof(success), &success});
+      uint32_t handle = (uint32_t)addr;
+      int success = -1;
+      if (rmapi_prime_find_addr(server->client_pid, addr, &handle) == 0 ||
+          addr == handle)
+        success = rmapi_prime_unref(NULL, server->client_pid, handle);
+      server_reply(server, &(ipc_message_t){IPC_REP_FREE_MEMORY, msg.id,
+                                            sizeof(success), &success});
       break;
     }
     case IPC_REQ_SUBMIT_COMMAND: { // REQUEST: Draw this!
-      struct amdgpu_command_buffer cb = {NULL, msg.data, msg.data_size};
-      int ret = rmapi_submit_command(NULL, &cb);
+      struct amdgpu_command_buffer cb = {.cmds = msg.data,
+                                         .size = msg.data_size};
+      // Other tenants share this GPU: nothing unchecked gets through, and
+      // the job runs our copies of its IBs, not the client's
+      struct rmapi_cs_shadow *shadow = NULL;
+      int ret = rmapi_cs_validate_shadow(server->client_pid,
+                                         RMAPI_CLIENT_ENGINE_GFX, cb.cmds,
+                                         cb.size, cb.bo_list, cb.bo_count,
+                                         &shadow);
+      // Queued behind this client's earlier work (and whatever it waits for).
+      // 0 means queued, not done; -1 if it has too many jobs out already.
+      if (ret == 0) {
+        struct rmapi_sched_hold hold = rmapi_cs_shadow_hold(shadow);
+        ret = rmapi_sched_submit_held(server->client_pid,
+                                      RMAPI_CLIENT_ENGINE_GFX, &cb, NULL, 0,
+                                      NULL, 0, &hold, shadow ? 1 : 0, NULL);
+        if (ret != 0)
+          rmapi_cs_shadow_release(shadow);
+      }
 
       // Tell the app if it worked
-      ipc_send_message(
-          &server->conn,
-          &(ipc_message_t){IPC_REP_SUBMIT_COMMAND, msg.id, sizeof(ret), &ret});
+      server_reply(server, &(ipc_message_t){IPC_REP_SUBMIT_COMMAND, msg.id,
+                                            sizeof(ret), &ret});
+      break;
+    }
+    case IPC_REQ_IMPORT_USERPTR: { // REQUEST: Use my pages, don't copy them!
+      struct ipc_userptr_reply rep = {-1, 0, 0};
+      struct ipc_userptr_request *req = msg.data;
+      int memfd = -1;
+      if (req && msg.data_size >= sizeof(*req)) {
+        if (req->flags & IPC_USERPTR_FLAG_MEMFD)
+          memfd = ipc_recv_fd(&server->conn);
+        // Only the socket peer may lend its own pages, and only if the OS
+        // told us who it is (pid 0 would mean "the server's own memory")
+        if (!server->client_pid || req->pid != server->client_pid) {
+          os_prim_log("RMAPI Server: pid %d tried to import pid %d's memory!\n",
+                      server->client_pid, req->pid);
+        } else if (!(req->flags & IPC_USERPTR_FLAG_MEMFD) || memfd >= 0) {
+          rep.result = rmapi_import_userptr(
+              NULL, req->pid, req->addr, req->size,
+              req->flags & ~IPC_USERPTR_FLAG_MEMFD, memfd, req->fd_offset,
+              &rep.handle, &rep.gpu_addr);
+          memfd = rep.result == 0 ? -1 : memfd; // RMAPI owns it now
+        }
+      }
+      if (memfd >= 0)
+        close(memfd);
+      server_reply(server, &(ipc_message_t){IPC_REP_IMPORT_USERPTR, msg.id,
+                                            sizeof(rep), &rep});
+      break;
+    }
+    case IPC_REQ_RELEASE_USERPTR: { // REQUEST: Give my pages back
+      int ret = -1;
+      if (server->client_pid && msg.data && msg.data_size >= sizeof(uint32_t))
+        ret = rmapi_release_userptr(NULL, server->client_pid,
+                                    *(uint32_t *)msg.data);
+      server_reply(server, &(ipc_message_t){IPC_REP_RELEASE_USERPTR, msg.id,
+                                            sizeof(ret), &ret});
+      break;
+    }
+    case IPC_REQ_INVALIDATE_USERPTR: { // REQUEST: I'm unmapping this, hands off!
+      int ret = -1;
+      struct ipc_userptr_invalidate *inv = msg.data;
+      if (inv && msg.data_size >= sizeof(*inv))
+        ret = rmapi_invalidate_userptr(NULL, server->client_pid, inv->addr,
+                                       inv->size);
+      server_reply(server, &(ipc_message_t){IPC_REP_INVALIDATE_USERPTR, msg.id,
+                                            sizeof(ret), &ret});
+      break;
+    }
+    case IPC_REQ_PRIME_EXPORT: { // REQUEST: Give me an fd so I can share this
+      int ret = -1;
+      int fd = -1;
+      if (msg.data && msg.data_size >= sizeof(uint32_t))
+        ret = rmapi_prime_export(NULL, server->client_pid,
+                                 *(uint32_t *)msg.data, &fd);
+      server_reply(server, &(ipc_message_t){IPC_REP_PRIME_EXPORT, msg.id,
+                                            sizeof(ret), &ret});
+      if (ret == 0) {
+        ipc_send_fd(&server->conn, fd);
+        close(fd);
+      }
+      break;
+    }
+    case IPC_REQ_PRIME_IMPORT: { // REQUEST: Somebody shared this fd with me
+      struct ipc_prime_import_reply rep = {-1, 0, 0, 0};
+      int fd = ipc_recv_fd(&server->conn);
+      if (fd >= 0) {
+        rep.result = rmapi_prime_import(NULL, server->client_pid, fd,
+                                        &rep.handle, &rep.gpu_addr, &rep.size);
+        close(fd); // RMAPI keeps its own copy
+      }
+      server_reply(server, &(ipc_message_t){IPC_REP_PRIME_IMPORT, msg.id,
+                                            sizeof(rep), &rep});
+      break;
+    }
+    case IPC_REQ_PRIME_FENCE: { // REQUEST: Implicit sync on a shared buffer
+      struct ipc_prime_fence_reply rep = {-1, 0, 0};
+      struct ipc_prime_fence *f = msg.data;
+      if (f && msg.data_size >= sizeof(*f)) {
+        switch (f->op) {
+        case IPC_PRIME_FENCE_ATTACH:
+          rep.result = rmapi_prime_fence_attach(server->client_pid, f->handle,
+                                                &rep.seq);
+          break;
+        case IPC_PRIME_FENCE_SIGNAL:
+          rep.result = rmapi_prime_fence_signal(server->client_pid, f->handle,
+                                                f->seq);
+          break;
+        case IPC_PRIME_FENCE_WAIT:
+          rep.result = rmapi_prime_fence_wait(server->client_pid, f->handle,
+                                              f->timeout_ns);
+          break;
+        }
+      }
+      server_reply(server, &(ipc_message_t){IPC_REP_PRIME_FENCE, msg.id,
+                                            sizeof(rep), &rep});
+      break;
+    }
+    case IPC_REQ_GET_RESIDENCY_STATS: { // REQUEST: How crowded is VRAM?
+      struct amdgpu_residency_stats stats;
+      memset(&stats, 0, sizeof(stats));
+      rmapi_get_residency_stats(NULL, &stats);
+      server_reply(server, &(ipc_message_t){IPC_REP_GET_RESIDENCY_STATS, msg.id,
+                                            sizeof(stats), &stats});
+      break;
+    }
+    case IPC_REQ_GET_CLIENT_STATS: { // REQUEST: Who is eating the GPU?
+      int32_t pid = 0;
+      if (msg.data && msg.data_size >= sizeof(pid))
+        pid = *(int32_t *)msg.data;
+      struct rmapi_client_stats *list = NULL;
+      int count = 0;
+      // Your own numbers are yours, anybody else's are privileged
+      bool own = server->client_pid && (pid == 0 || pid == server->client_pid);
+      if (own || server_privileged(server)) {
+        if (pid == IPC_CLIENT_STATS_ALL) {
+          count = rmapi_client_list(NULL, 0);
+          list = count > 0 ? calloc((size_t)count, sizeof(*list)) : NULL;
+          int got = list ? rmapi_client_list(list, (uint32_t)count) : 0;
+          count = got < count ? got : count; // Somebody may have left meanwhile
+        } else {
+          list = calloc(1, sizeof(*list));
+          if (list && rmapi_client_get_stats(pid ? pid : server->client_pid,
+                                             list) == 0)
+            count = 1;
+        }
+      }
+      server_reply(server, &(ipc_message_t){IPC_REP_GET_CLIENT_STATS, msg.id,
+                                            count * sizeof(*list), list});
+      free(list);
+      break;
+    }
+    case IPC_REQ_SET_CLIENT_QUOTA: { // REQUEST: Put a cap on this client
+      int ret = -1;
+      struct ipc_client_quota *q = msg.data;
+      if (q && msg.data_size >= sizeof(*q) && server_privileged(server))
+        ret = rmapi_client_set_quota(q->pid ? q->pid : server->client_pid,
+                                     q->heap, q->bytes);
+      server_reply(server, &(ipc_message_t){IPC_REP_SET_CLIENT_QUOTA, msg.id,
+                                            sizeof(ret), &ret});
+      break;
+    }
+    case IPC_REQ_SYNCOBJ: { // REQUEST: Traffic light duty
+      struct ipc_syncobj_reply rep = {-1, 0, 0};
+      struct ipc_syncobj *s = msg.data;
+      int fd = -1;
+      if (s && msg.data_size >= sizeof(*s)) {
+        rep.handle = s->handle;
+        switch (s->op) {
+        case IPC_SYNCOBJ_CREATE:
+          rep.result = rmapi_syncobj_create(rmapi_get_gpu(), server->client_pid,
+                                            s->point, &rep.handle);
+          break;
+        case IPC_SYNCOBJ_DESTROY:
+          rep.result = rmapi_syncobj_destroy(server->client_pid, s->handle);
+          break;
+        case IPC_SYNCOBJ_SIGNAL:
+          rep.result = rmapi_syncobj_signal(server->client_pid, s->handle,
+                                            s->point);
+          break;
+        case IPC_SYNCOBJ_RESET:
+          rep.result = rmapi_syncobj_reset(server->client_pid, s->handle);
+          break;
+        case IPC_SYNCOBJ_QUERY:
+          rep.result = rmapi_syncobj_query(server->client_pid, s->handle,
+                                           &rep.point);
+          break;
+        case IPC_SYNCOBJ_EXPORT_EVENTFD:
+          rep.result = rmapi_syncobj_export_eventfd(server->client_pid,
+                                                    s->handle, s->point, &fd);
+          break;
+        case IPC_SYNCOBJ_EXPORT_SYNC_FILE:
+          rep.result = rmapi_syncobj_export_sync_file(server->client_pid,
+                                                      s->handle, s->point, &fd);
+          break;
+        case IPC_SYNCOBJ_SHARE:
+          rep.result = s->point <= INT32_MAX
+                           ? rmapi_syncobj_share(server->client_pid, s->handle,
+                                                 (int32_t)s->point)
+                           : -1;
+          break;
+        }
+      }
+      server_reply(server, &(ipc_message_t){IPC_REP_SYNCOBJ, msg.id,
+                                            sizeof(rep), &rep});
+      if (fd >= 0) {
+        ipc_send_fd(&server->conn, fd);
+        close(fd);
+      }
+      break;
+    }
+    case IPC_REQ_SYNCOBJ_WAIT: { // REQUEST: Tell me when these are done
+      server_syncobj_wait(server, &msg, IPC_REP_SYNCOBJ_WAIT, 0);
+      break;
+    }
+    case IPC_REQ_SUBMIT_COMMAND_DEPS: { // REQUEST: Draw this, but after that
+      struct ipc_submit_reply rep = {-1, 0, 0};
+      struct ipc_submit_deps *d = msg.data;
+      if (d && msg.data_size >= sizeof(*d) &&
+          (uint64_t)d->dep_count * sizeof(struct rmapi_sched_dep) +
+                  (uint64_t)d->signal_count * sizeof(struct rmapi_syncobj_point) <=
+              msg.data_size - sizeof(*d)) {
+        struct rmapi_sched_dep *deps = (struct rmapi_sched_dep *)(d + 1);
+        struct rmapi_syncobj_point *signals =
+            (struct rmapi_syncobj_point *)(deps + d->dep_count);
+        char *cmds = (char *)(signals + d->signal_count);
+        struct amdgpu_command_buffer cb = {NULL, cmds,
+                                           msg.data_size - (cmds - (char *)msg.data),
+                                           NULL, 0};
+        rep.engine = d->engine;
+        struct rmapi_bo_list *list = NULL;
+        // Jumping the GFX queue is for the compositor, not for everybody
+        bool allowed = d->engine != RMAPI_CLIENT_ENGINE_GFX_HIGH ||
+                       server_privileged(server);
+        // The job signals (and waits) for the client: same rules as doing it
+        for (uint32_t i = 0; allowed && i < d->dep_count; i++) {
+          struct rmapi_syncobj_point pt = {deps[i].id, 0, deps[i].value};
+          allowed = deps[i].type != RMAPI_SCHED_DEP_SYNCOBJ ||
+                    server_syncobjs_allowed(server, &pt, 1);
+        }
+        allowed = allowed &&
+                  server_syncobjs_allowed(server, signals, d->signal_count);
+        // The list's buffers stay put until the job is queued, the job
+        // keeps its own references until it retires
+        if (allowed && d->bo_list) {
+          list = rmapi_bo_list_acquire(server->client_pid, d->bo_list, &cb);
+          allowed = list != NULL;
+        }
+        struct rmapi_cs_shadow *shadow = NULL;
+        if (allowed)
+          rep.result = rmapi_cs_validate_shadow(server->client_pid, d->engine,
+                                                cb.cmds, cb.size, cb.bo_list,
+                                                cb.bo_count, &shadow);
+        struct rmapi_sched_hold holds[2];
+        uint32_t nholds = 0;
+        if (rep.result == 0 && shadow)
+          holds[nholds++] = rmapi_cs_shadow_hold(shadow);
+        if (rep.result == 0 && list &&
+            (rep.result = rmapi_bo_list_hold(list, &cb, &holds[nholds])) == 0)
+          nholds++;
+        if (rep.result == 0)
+          rep.result = rmapi_sched_submit_held(
+              server->client_pid, d->engine, &cb, deps, d->dep_count, signals,
+              d->signal_count, holds, nholds, &rep.seq);
+        if (rep.result != 0)
+          for (uint32_t i = 0; i < nholds; i++)
+            holds[i].release(holds[i].data);
+        rmapi_bo_list_put(list);
+      }
+      server_reply(server, &(ipc_message_t){IPC_REP_SUBMIT_COMMAND_DEPS, msg.id,
+                                            sizeof(rep), &rep});
+      break;
+    }
+    case IPC_REQ_WAIT_FENCE: { // REQUEST: Is my job done yet?
+      int ret = -1;
+      struct ipc_fence_wait *w = msg.data;
+      if (w && msg.data_size >= sizeof(*w))
+        ret = rmapi_sched_fence_wait(w->engine, w->seq, w->timeout_ns);
+      server_reply(server, &(ipc_message_t){IPC_REP_WAIT_FENCE, msg.id,
+                                            sizeof(ret), &ret});
+      break;
+    }
+    case IPC_REQ_USERQ: { // REQUEST: Give me my own queue, I'll ring you
+      struct ipc_userq_reply rep = {-1, 0, 0, 0, 0, 0, 0};
+      struct ipc_userq *u = msg.data;
+      int fd = -1;
+      if (u && msg.data_size >= sizeof(*u)) {
+        if (u->op == IPC_USERQ_CREATE) {
+          struct rmapi_userq_info info;
+          rep.result = rmapi_userq_create(NULL, server->client_pid, u->engine,
+                                          u->ring_bytes, u->bo_list, &info, &fd);
+          if (rep.result == 0) {
+            rep.id = info.id;
+            rep.syncobj = info.syncobj;
+            rep.ring_dw = info.ring_dw;
+            rep.doorbell_offset = info.doorbell_offset;
+            rep.size = info.size;
+          }
+        } else if (u->op == IPC_USERQ_DESTROY) {
+          rep.result = rmapi_userq_destroy(server->client_pid, u->id);
+        }
+      }
+      server_reply(server, &(ipc_message_t){IPC_REP_USERQ, msg.id, sizeof(rep),
+                                            &rep});
+      if (fd >= 0) {
+        ipc_send_fd(&server->conn, fd);
+        close(fd);
+      }
+      break;
+    }
+    case IPC_REQ_BO_LIST: { // REQUEST: These are the buffers I draw with
+      struct ipc_bo_list_reply rep = {-1, 0};
+      struct ipc_bo_list *b = msg.data;
+      if (b && msg.data_size >= sizeof(*b) &&
+          (uint64_t)b->count * sizeof(struct rmapi_bo_list_entry) +
+                  (uint64_t)b->remove_count * sizeof(uint32_t) <=
+              msg.data_size - sizeof(*b)) {
+        struct rmapi_bo_list_entry *entries =
+            (struct rmapi_bo_list_entry *)(b + 1);
+        uint32_t *remove = (uint32_t *)(entries + b->count);
+        switch (b->op) {
+        case IPC_BO_LIST_CREATE:
+          rep.result = rmapi_bo_list_create(server->client_pid, entries,
+                                            b->count, &rep.handle);
+          break;
+        case IPC_BO_LIST_UPDATE:
+          rep.result = rmapi_bo_list_update(server->client_pid, b->handle,
+                                            entries, b->count, remove,
+                                            b->remove_count);
+          break;
+        case IPC_BO_LIST_DESTROY:
+          rep.result = rmapi_bo_list_destroy(server->client_pid, b->handle);
+          break;
+        }
+      }
+      server_reply(server, &(ipc_message_t){IPC_REP_BO_LIST, msg.id,
+                                            sizeof(rep), &rep});
       break;
     }
     // case IPC_REQ_SET_DISPLAY_MODE: { // REQUEST: Set video mode! - disabled
@@ -111,29 +526,28 @@ void *handle_client(void *arg) {
     //   break;
     // }
     case IPC_REQ_VK_CREATE_INSTANCE: {
-      os_prim_log("RMAPI Server: VK_CREATE_INSTANCE received\n");
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: VK_CREATE_INSTANCE received\n");
       void *instance = (void *)0xCAFEBABE; // Dummy handle
-      os_prim_log("RMAPI Server: Returning instance handle %p\n", instance);
-      ipc_send_message(&server->conn,
-                       &(ipc_message_t){IPC_REP_VK_CREATE_INSTANCE, msg.id,
-                                        sizeof(instance), &instance});
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: Returning instance handle %p\n", instance);
+      server_reply(server, &(ipc_message_t){IPC_REP_VK_CREATE_INSTANCE, msg.id,
+                                            sizeof(instance), &instance});
       break;
     }
     case IPC_REQ_VK_ENUMERATE_PHYSICAL_DEVICES: {
-      os_prim_log("RMAPI Server: VK_ENUMERATE_PHYSICAL_DEVICES received\n");
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: VK_ENUMERATE_PHYSICAL_DEVICES received\n");
       // Pack count + device list in response
       struct {
         uint32_t count;
         void *device;
       } response = {1, (void *)global_gpu};
-      os_prim_log("RMAPI Server: Returning %u device(s)\n", response.count);
-      ipc_send_message(&server->conn,
-                       &(ipc_message_t){IPC_REP_VK_ENUMERATE_PHYSICAL_DEVICES,
-                                        msg.id, sizeof(response), &response});
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: Returning %u device(s)\n", response.count);
+      server_reply(server, &(ipc_message_t){IPC_REP_VK_ENUMERATE_PHYSICAL_DEVICES,
+                                            msg.id, sizeof(response),
+                                            &response});
       break;
     }
     case IPC_REQ_VK_CREATE_DEVICE: {
-      os_prim_log("RMAPI Server: VK_CREATE_DEVICE received\n");
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: VK_CREATE_DEVICE received\n");
       // Parse packed arguments
       struct {
         void *phys_dev;
@@ -141,14 +555,13 @@ void *handle_client(void *arg) {
       } *args = msg.data;
       (void)args;
       void *device = (void *)0xDEADBEEF; // Dummy
-      os_prim_log("RMAPI Server: Returning device handle %p\n", device);
-      ipc_send_message(&server->conn,
-                       &(ipc_message_t){IPC_REP_VK_CREATE_DEVICE, msg.id,
-                                        sizeof(device), &device});
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: Returning device handle %p\n", device);
+      server_reply(server, &(ipc_message_t){IPC_REP_VK_CREATE_DEVICE, msg.id,
+                                            sizeof(device), &device});
       break;
     }
     case IPC_REQ_VK_ALLOC_MEMORY: {
-      os_prim_log("RMAPI Server: VK_ALLOC_MEMORY received\n");
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: VK_ALLOC_MEMORY received\n");
       struct {
         void *device;
         void *alloc_info;
@@ -156,41 +569,38 @@ void *handle_client(void *arg) {
       (void)args;
       // TODO: Call real rmapi_alloc_memory
       void *memory = (void *)0xBEEFBEEF; // Dummy
-      os_prim_log("RMAPI Server: Returning memory handle %p\n", memory);
-      ipc_send_message(&server->conn,
-                       &(ipc_message_t){IPC_REP_VK_ALLOC_MEMORY, msg.id,
-                                        sizeof(memory), &memory});
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: Returning memory handle %p\n", memory);
+      server_reply(server, &(ipc_message_t){IPC_REP_VK_ALLOC_MEMORY, msg.id,
+                                            sizeof(memory), &memory});
       break;
     }
     case IPC_REQ_VK_FREE_MEMORY: {
-      os_prim_log("RMAPI Server: VK_FREE_MEMORY received\n");
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: VK_FREE_MEMORY received\n");
       struct {
         void *device;
         void *memory;
       } *args = msg.data;
       (void)args;
       int ret = 0; // Success
-      ipc_send_message(
-          &server->conn,
-          &(ipc_message_t){IPC_REP_VK_FREE_MEMORY, msg.id, sizeof(ret), &ret});
+      server_reply(server, &(ipc_message_t){IPC_REP_VK_FREE_MEMORY, msg.id,
+                                            sizeof(ret), &ret});
       break;
     }
     case IPC_REQ_VK_CREATE_COMMAND_POOL: {
-      os_prim_log("RMAPI Server: VK_CREATE_COMMAND_POOL received\n");
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: VK_CREATE_COMMAND_POOL received\n");
       struct {
         void *device;
         void *create_info;
       } *args = msg.data;
       (void)args;
       void *pool = (void *)0xFACEBEEF; // Dummy
-      os_prim_log("RMAPI Server: Returning pool handle %p\n", pool);
-      ipc_send_message(&server->conn,
-                       &(ipc_message_t){IPC_REP_VK_CREATE_COMMAND_POOL, msg.id,
-                                        sizeof(pool), &pool});
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: Returning pool handle %p\n", pool);
+      server_reply(server, &(ipc_message_t){IPC_REP_VK_CREATE_COMMAND_POOL,
+                                            msg.id, sizeof(pool), &pool});
       break;
     }
     case IPC_REQ_VK_SUBMIT_QUEUE: {
-      os_prim_log("RMAPI Server: VK_SUBMIT_QUEUE received\n");
+      os_log_trace(OS_LOG_RMAPI, "RMAPI Server: VK_SUBMIT_QUEUE received\n");
       struct {
         void *queue;
         uint32_t count;
@@ -199,12 +609,68 @@ void *handle_client(void *arg) {
       } *args = msg.data;
       (void)args;
       int ret = 0; // Success
-      ipc_send_message(
-          &server->conn,
-          &(ipc_message_t){IPC_REP_VK_SUBMIT_QUEUE, msg.id, sizeof(ret), &ret});
+      server_reply(server, &(ipc_message_t){IPC_REP_VK_SUBMIT_QUEUE, msg.id,
+                                            sizeof(ret), &ret});
+      break;
+    }
+    case IPC_REQ_VK_CREATE_FENCE:
+    case IPC_REQ_VK_CREATE_SEMAPHORE: {
+      // Fences are 0/1 timelines, semaphores start wherever they're told
+      uint64_t initial = 0;
+      if (msg.type == IPC_REQ_VK_CREATE_FENCE && msg.data &&
+          msg.data_size >= sizeof(uint32_t))
+        initial = (*(uint32_t *)msg.data & 1) ? 1 : 0;
+      else if (msg.type == IPC_REQ_VK_CREATE_SEMAPHORE && msg.data &&
+               msg.data_size >= sizeof(uint64_t))
+        initial = *(uint64_t *)msg.data;
+      struct ipc_syncobj_reply rep = {-1, 0, initial};
+      rep.result = rmapi_syncobj_create(rmapi_get_gpu(), server->client_pid,
+                                        initial, &rep.handle);
+      server_reply(server, &(ipc_message_t){msg.type == IPC_REQ_VK_CREATE_FENCE
+                                                ? IPC_REP_VK_CREATE_FENCE
+                                                : IPC_REP_VK_CREATE_SEMAPHORE,
+                                            msg.id, sizeof(rep), &rep});
+      break;
+    }
+    case IPC_REQ_VK_DESTROY_FENCE:
+    case IPC_REQ_VK_DESTROY_SEMAPHORE: {
+      int ret = -1;
+      if (msg.data && msg.data_size >= sizeof(uint32_t))
+        ret = rmapi_syncobj_destroy(server->client_pid, *(uint32_t *)msg.data);
+      server_reply(server, &(ipc_message_t){msg.type == IPC_REQ_VK_DESTROY_FENCE
+                                                ? IPC_REP_VK_DESTROY_FENCE
+                                                : IPC_REP_VK_DESTROY_SEMAPHORE,
+                                            msg.id, sizeof(ret), &ret});
       break;
     }
+    case IPC_REQ_VK_GET_FENCE_STATUS: {
+      int ret = -1;
+      uint64_t payload = 0;
+      if (msg.data && msg.data_size >= sizeof(uint32_t) &&
+          rmapi_syncobj_query(server->client_pid, *(uint32_t *)msg.data,
+                              &payload) == 0)
+        ret = payload ? 0 : 1;
+      server_reply(server, &(ipc_message_t){IPC_REP_VK_GET_FENCE_STATUS, msg.id,
+                                            sizeof(ret), &ret});
+      break;
     }
+    case IPC_REQ_VK_RESET_FENCES: {
+      int ret = 0;
+      uint32_t *handles = msg.data;
+      for (size_t i = 0; handles && i < msg.data_size / sizeof(uint32_t); i++)
+        if (rmapi_syncobj_reset(server->client_pid, handles[i]) != 0)
+          ret = -1;
+      server_reply(server, &(ipc_message_t){IPC_REP_VK_RESET_FENCES, msg.id,
+                                            sizeof(ret), &ret});
+      break;
+    }
+    case IPC_REQ_VK_WAIT_FOR_FENCES: {
+      server_syncobj_wait(server, &msg, IPC_REP_VK_WAIT_FOR_FENCES, 1);
+      break;
+    }
+    }
+    if (span)
+      os_trace_end(OS_TRACE_IPC, span);
 
     // --- Critical Fix: Free the message data after handling it ---
     if (msg.data) {
@@ -213,7 +679,27 @@ void *handle_client(void *arg) {
     }
   }
 
-  // App disconnected or crashed. The DJ hangs up.
+  // App disconnected or crashed. Whatever it lent us is gone too.
+  if (server->client_pid) {
+    struct rmapi_client_stats stats;
+    char fdinfo[1024];
+    if (rmapi_client_get_stats(server->client_pid, &stats) == 0 &&
+        rmapi_client_format_fdinfo(&stats, fdinfo, sizeof(fdinfo)) > 0)
+      os_prim_log("RMAPI Server: pid %d hung up, final usage:\n%s",
+                  server->client_pid, fdinfo);
+    rmapi_bo_list_release_pid(server->client_pid); // Holds buffers too
+    rmapi_release_userptr_pid(NULL, server->client_pid);
+    rmapi_prime_release_pid(NULL, server->client_pid);
+    rmapi_userq_release_pid(server->client_pid);
+    rmapi_sched_release_pid(server->client_pid);
+    rmapi_syncobj_release_pid(server->client_pid);
+    rmapi_client_close(server->client_pid);
+  }
+
+  rmapi_capture_message(RMAPI_CAPTURE_CLIENT, server->client_pid, 0, 0, NULL,
+                        0);
+
+  // The DJ hangs up.
   ipc_close(&server->conn);
   free(server);
   return NULL;
@@ -221,6 +707,21 @@ void *handle_client(void *arg) {
 
 #include <unistd.h>
 
+// SIGUSR2 flips tracing. Every other thread has it blocked, so it never
+// lands in a client's recv() as an EINTR that hangs up on them
+static void *trace_signal_main(void *arg) {
+  sigset_t *set = arg;
+  int sig;
+  while (sigwait(set, &sig) == 0) {
+    // AMDGPU_TRACE's file (or the default), written again at every stop
+    if (os_trace_active())
+      os_trace_stop();
+    else
+      os_trace_start(getenv("AMDGPU_TRACE"), 0);
+  }
+  return NULL;
+}
+
 int main() {
   // --- Safety First! ---
   // Catching crashes and interrupts to prevent hardware leftovers
@@ -228,11 +729,26 @@ int main() {
   signal(SIGSEGV, safe_shutdown);
   signal(SIGTERM, safe_shutdown);
 
+  // Blocked before any thread exists so they all inherit it, then one
+  // thread waits for it
+  static sigset_t trace_set;
+  sigemptyset(&trace_set);
+  sigaddset(&trace_set, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &trace_set, NULL);
+  pthread_t trace_thread;
+  if (pthread_create(&trace_thread, NULL, trace_signal_main, &trace_set) == 0)
+    pthread_detach(trace_thread);
+
   rmapi_server_t server = {0};
 
   // Starting the brain and setting up the specialists
   rmapi_init();
 
+  // Flight recorder for amd_replay, off unless asked for
+  const char *capture = getenv("AMDGPU_CAPTURE");
+  if (capture)
+    rmapi_capture_start(capture);
+
   // Building the "subway station" where apps can connect
   if (ipc_server_init(HIT_SOCKET_PATH, &server.conn) < 0) {
     perror("Aw man, IPC init failed! Maybe the socket is already in use?");
@@ -256,6 +772,16 @@ int main() {
       rmapi_server_t *client_server = malloc(sizeof(rmapi_server_t));
       memset(client_server, 0, sizeof(rmapi_server_t));
       client_server->conn.sock_fd = client_fd;
+#ifdef SO_PEERCRED
+      struct ucred cred;
+      socklen_t cred_len = sizeof(cred);
+      if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0) {
+        client_server->client_pid = cred.pid;
+        client_server->client_uid = cred.uid;
+      }
+#endif
+      if (client_server->client_pid)
+        rmapi_client_open(client_server->client_pid);
 
       // Start a new thread so we don't block other apps!
       pthread_t thread;
@@ -0,0 +1,521 @@
+#define _GNU_SOURCE
+#include "rmapi.h"
+#include "../../os/os_interface.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+#define SYNCOBJ_MAX_SHARED 8 // Clients besides the owner (a compositor, a decoder...)
+
+/*
+ * Yo! These are the Syncobjs - the traffic lights between queues.
+ * Each one is a timeline: a 64-bit counter that only goes up. "Point N is
+ * done" just means the counter reached N. A binary fence is the same thing
+ * with points 0 and 1.
+ *
+ * - Wait-before-signal: you can wait on (or depend on) a point nobody has
+ *   promised yet. It simply isn't done until somebody signals it.
+ * - Waits take many points at once, all of them or any of them, with a timeout.
+ * - Work that depends on points (rmapi_syncobj_when) is parked here and runs
+ *   from the signal that completes it. Nobody has to sit in a CPU wait and
+ *   bounce a message back just to kick the next queue.
+ * - Outside the process: an eventfd that fires when the point is done, or in
+ *   DRM mode a real sync_file from the kernel syncobj we keep in lockstep.
+ * - A syncobj belongs to the client that made it. Other clients only get to
+ *   signal, reset, query or export it once the owner shared it with them.
+ *   pid 0 is the server itself (jobs signaling their points) and may do all.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+// Somebody outside wants a poke when a point is done
+struct syncobj_notify {
+  uint64_t point;
+  int fd; // Our end: eventfd (or write end of a pipe)
+  struct syncobj_notify *next;
+};
+
+struct rmapi_syncobj {
+  uint32_t handle;
+  int32_t pid;                   // Owner, cleaned up when it hangs up
+  int32_t shared[SYNCOBJ_MAX_SHARED]; // Others the owner let in (0 = free slot)
+  uint64_t payload;              // Last point that signaled
+  struct OBJGPU *gpu;            // NULL: no kernel twin
+  uint32_t kernel_handle;        // DRM syncobj mirroring us (0 = none)
+  struct syncobj_notify *notify;
+  struct rmapi_syncobj *next;
+};
+
+// Work parked until its points are done
+struct syncobj_cb {
+  struct rmapi_syncobj_point *waits;
+  uint32_t count;
+  rmapi_syncobj_cb fn;
+  void *data;
+  int status;         // -1 if a syncobj it waited on was destroyed
+  struct syncobj_cb *next;
+};
+
+static struct rmapi_syncobj *syncobj_list = NULL;
+static struct syncobj_cb *syncobj_pending = NULL;
+static uint32_t syncobj_next_handle = 1;
+static pthread_mutex_t syncobj_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t syncobj_cond = PTHREAD_COND_INITIALIZER;
+
+static struct rmapi_syncobj *syncobj_find_locked(uint32_t handle) {
+  for (struct rmapi_syncobj *s = syncobj_list; s; s = s->next)
+    if (s->handle == handle)
+      return s;
+  return NULL;
+}
+
+// Same, but only if pid may use it (pid 0 = anybody may)
+static struct rmapi_syncobj *syncobj_find_for_locked(int32_t pid,
+                                                     uint32_t handle) {
+  struct rmapi_syncobj *s = syncobj_find_locked(handle);
+  if (!s || pid == 0 || s->pid == pid)
+    return s;
+  for (int i = 0; i < SYNCOBJ_MAX_SHARED; i++)
+    if (s->shared[i] == pid)
+      return s;
+  return NULL;
+}
+
+static void syncobj_poke(int fd) {
+  uint64_t one = 1;
+  if (write(fd, &one, sizeof(one)) != sizeof(one))
+    os_prim_log("RMAPI: Syncobj eventfd write failed (errno: %d)\n", errno);
+  close(fd);
+}
+
+// 1 = every point is done, 0 = not yet, -1 = a syncobj went away under us
+static int syncobj_ready_locked(const struct rmapi_syncobj_point *pts,
+                                uint32_t count) {
+  int ready = 1;
+  for (uint32_t i = 0; i < count; i++) {
+    struct rmapi_syncobj *s = syncobj_find_locked(pts[i].handle);
+    if (!s)
+      return -1;
+    if (s->payload < pts[i].point)
+      ready = 0;
+  }
+  return ready;
+}
+
+// Run whatever the last signal (or destroy) unblocked. Callbacks may signal
+// more points themselves, so they run without the lock.
+static void syncobj_run_ready(void) {
+  struct syncobj_cb *run = NULL, **tail = &run;
+
+  pthread_mutex_lock(&syncobj_lock);
+  struct syncobj_cb **pp = &syncobj_pending;
+  while (*pp) {
+    struct syncobj_cb *cb = *pp;
+    int ready = syncobj_ready_locked(cb->waits, cb->count);
+    if (ready == 0) {
+      pp = &cb->next;
+      continue;
+    }
+    *pp = cb->next;
+    cb->next = NULL;
+    cb->status = ready < 0 ? -1 : 0;
+    *tail = cb;
+    tail = &cb->next;
+  }
+  pthread_mutex_unlock(&syncobj_lock);
+
+  while (run) {
+    struct syncobj_cb *cb = run;
+    run = cb->next;
+    cb->fn(cb->data, cb->status);
+    os_prim_free(cb->waits);
+    os_prim_free(cb);
+  }
+}
+
+// 1. "I need a new timeline" (gpu NULL: userland only, no sync_file export)
+int rmapi_syncobj_create(struct OBJGPU *gpu, int32_t pid, uint64_t initial,
+                         uint32_t *handle) {
+  if (!handle)
+    return -1;
+
+  struct rmapi_syncobj *s = os_prim_alloc(sizeof(*s));
+  if (!s)
+    return -1;
+  memset(s, 0, sizeof(*s));
+  s->pid = pid;
+  s->payload = initial;
+
+  if (gpu && amdgpu_hal_get_mode() == AMDGPU_HAL_MODE_DRM) {
+    if (amdgpu_syncobj_create_hal(gpu, &s->kernel_handle) == 0) {
+      s->gpu = gpu;
+      if (initial)
+        amdgpu_syncobj_signal_hal(gpu, s->kernel_handle, initial);
+    }
+  }
+
+  pthread_mutex_lock(&syncobj_lock);
+  s->handle = syncobj_next_handle++;
+  if (syncobj_next_handle == 0)
+    syncobj_next_handle = 1; // 0 stays "no syncobj"
+  s->next = syncobj_list;
+  syncobj_list = s;
+  *handle = s->handle;
+  pthread_mutex_unlock(&syncobj_lock);
+  return 0;
+}
+
+static void syncobj_free(struct rmapi_syncobj *s) {
+  // Pending eventfds never fire: whoever polls them gave up on this syncobj
+  while (s->notify) {
+    struct syncobj_notify *n = s->notify;
+    s->notify = n->next;
+    close(n->fd);
+    os_prim_free(n);
+  }
+  if (s->gpu)
+    amdgpu_syncobj_destroy_hal(s->gpu, s->kernel_handle);
+  os_prim_free(s);
+}
+
+// 2. "Done with it" (pid 0 = anybody may)
+int rmapi_syncobj_destroy(int32_t pid, uint32_t handle) {
+  pthread_mutex_lock(&syncobj_lock);
+  struct rmapi_syncobj **pp = &syncobj_list, *s = NULL;
+  for (; *pp; pp = &(*pp)->next) {
+    if ((*pp)->handle == handle && (pid == 0 || (*pp)->pid == pid)) {
+      s = *pp;
+      *pp = s->next;
+      break;
+    }
+  }
+  if (s)
+    pthread_cond_broadcast(&syncobj_cond); // Waiters on it must find out
+  pthread_mutex_unlock(&syncobj_lock);
+
+  if (!s)
+    return -1;
+  syncobj_free(s);
+  syncobj_run_ready(); // Work that depended on it gets cancelled
+  return 0;
+}
+
+// "Let this client use it too" - owner only (pid 0 = anybody may)
+int rmapi_syncobj_share(int32_t pid, uint32_t handle, int32_t with) {
+  int ret = -1;
+  pthread_mutex_lock(&syncobj_lock);
+  struct rmapi_syncobj *s = syncobj_find_locked(handle);
+  if (s && with > 0 && (pid == 0 || s->pid == pid)) {
+    for (int i = 0; i < SYNCOBJ_MAX_SHARED && ret != 0; i++)
+      if (s->shared[i] == with || s->shared[i] == 0) {
+        s->shared[i] = with;
+        ret = 0;
+      }
+  }
+  pthread_mutex_unlock(&syncobj_lock);
+  return ret;
+}
+
+// Client hung up: its timelines go with it, and it's out of everybody else's
+void rmapi_syncobj_release_pid(int32_t pid) {
+  struct rmapi_syncobj *dead = NULL;
+
+  pthread_mutex_lock(&syncobj_lock);
+  struct rmapi_syncobj **pp = &syncobj_list;
+  while (*pp) {
+    struct rmapi_syncobj *s = *pp;
+    if (s->pid == pid) {
+      *pp = s->next;
+      s->next = dead;
+      dead = s;
+    } else {
+      for (int i = 0; i < SYNCOBJ_MAX_SHARED; i++)
+        if (s->shared[i] == pid)
+          s->shared[i] = 0; // The next process with this pid isn't them
+      pp = &s->next;
+    }
+  }
+  pthread_cond_broadcast(&syncobj_cond);
+  pthread_mutex_unlock(&syncobj_lock);
+
+  if (!dead)
+    return;
+  while (dead) {
+    struct rmapi_syncobj *s = dead;
+    dead = s->next;
+    syncobj_free(s);
+  }
+  syncobj_run_ready();
+}
+
+// 3. "Point N is done". Timelines only move forward.
+int rmapi_syncobj_signal(int32_t pid, uint32_t handle, uint64_t point) {
+  struct syncobj_notify *fire = NULL;
+
+  pthread_mutex_lock(&syncobj_lock);
+  struct rmapi_syncobj *s = syncobj_find_for_locked(pid, handle);
+  if (!s || point < s->payload) {
+    if (s)
+      os_prim_log("RMAPI: Syncobj %u can't go back from %llu to %llu\n",
+                  handle, (unsigned long long)s->payload,
+                  (unsigned long long)point);
+    pthread_mutex_unlock(&syncobj_lock);
+    return -1;
+  }
+  if (point == s->payload) {
+    pthread_mutex_unlock(&syncobj_lock);
+    return 0;
+  }
+
+  s->payload = point;
+  if (s->gpu)
+    amdgpu_syncobj_signal_hal(s->gpu, s->kernel_handle, point);
+
+  struct syncobj_notify **pp = &s->notify;
+  while (*pp) {
+    struct syncobj_notify *n = *pp;
+    if (n->point <= point) {
+      *pp = n->next;
+      n->next = fire;
+      fire = n;
+    } else {
+      pp = &n->next;
+    }
+  }
+  pthread_cond_broadcast(&syncobj_cond);
+  pthread_mutex_unlock(&syncobj_lock);
+
+  while (fire) {
+    struct syncobj_notify *n = fire;
+    fire = n->next;
+    syncobj_poke(n->fd);
+    os_prim_free(n);
+  }
+  syncobj_run_ready();
+  return 0;
+}
+
+// Binary fences get reused (vkResetFences): back to "not signaled"
+int rmapi_syncobj_reset(int32_t pid, uint32_t handle) {
+  pthread_mutex_lock(&syncobj_lock);
+  struct rmapi_syncobj *s = syncobj_find_for_locked(pid, handle);
+  if (s) {
+    s->payload = 0;
+    // Kernel timelines never go back: start the twin over instead
+    if (s->gpu) {
+      amdgpu_syncobj_destroy_hal(s->gpu, s->kernel_handle);
+      if (amdgpu_syncobj_create_hal(s->gpu, &s->kernel_handle) != 0)
+        s->gpu = NULL;
+    }
+  }
+  pthread_mutex_unlock(&syncobj_lock);
+  return s ? 0 : -1;
+}
+
+int rmapi_syncobj_query(int32_t pid, uint32_t handle, uint64_t *payload) {
+  pthread_mutex_lock(&syncobj_lock);
+  struct rmapi_syncobj *s = syncobj_find_for_locked(pid, handle);
+  if (s && payload)
+    *payload = s->payload;
+  pthread_mutex_unlock(&syncobj_lock);
+  return s ? 0 : -1;
+}
+
+// 4. "Wait for these points" - all of them or the first one (0 = done,
+// 1 = timed out, -1 = bad handle). *first gets the index of a done point.
+int rmapi_syncobj_wait(const struct rmapi_syncobj_point *pts, uint32_t count,
+                       uint32_t flags, uint64_t timeout_ns, uint32_t *first) {
+  if (count > 0 && !pts)
+    return -1;
+
+  struct timespec deadline;
+  bool forever = timeout_ns == RMAPI_SYNCOBJ_WAIT_FOREVER;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  if (!forever) {
+    deadline.tv_sec += (time_t)(timeout_ns / 1000000000ull);
+    deadline.tv_nsec += (long)(timeout_ns % 1000000000ull);
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+
+  int ret;
+  pthread_mutex_lock(&syncobj_lock);
+  for (;;) {
+    uint32_t done = 0, first_done = UINT32_MAX;
+    ret = 0;
+    // Look everything up again after every wake up, it may be gone by then
+    for (uint32_t i = 0; i < count; i++) {
+      struct rmapi_syncobj *s = syncobj_find_locked(pts[i].handle);
+      if (!s) {
+        ret = -1;
+        break;
+      }
+      if (s->payload >= pts[i].point) {
+        done++;
+        if (first_done == UINT32_MAX)
+          first_done = i;
+      }
+    }
+    if (ret < 0)
+      break;
+
+    bool all = flags & RMAPI_SYNCOBJ_WAIT_ALL;
+    if (count == 0 || (all ? done == count : done > 0)) {
+      if (first)
+        *first = first_done == UINT32_MAX ? 0 : first_done;
+      break;
+    }
+    if (timeout_ns == 0) {
+      ret = 1;
+      break;
+    }
+    if (forever) {
+      pthread_cond_wait(&syncobj_cond, &syncobj_lock);
+    } else if (pthread_cond_timedwait(&syncobj_cond, &syncobj_lock,
+                                      &deadline) == ETIMEDOUT) {
+      ret = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&syncobj_lock);
+  return ret;
+}
+
+// 5. "Run this once these points are done" - right away if they already are.
+// fn gets status -1 if one of the syncobjs is destroyed first.
+int rmapi_syncobj_when(const struct rmapi_syncobj_point *pts, uint32_t count,
+                       rmapi_syncobj_cb fn, void *data) {
+  if (!fn || (count > 0 && !pts))
+    return -1;
+
+  pthread_mutex_lock(&syncobj_lock);
+  int ready = syncobj_ready_locked(pts, count);
+  if (ready < 0) {
+    pthread_mutex_unlock(&syncobj_lock);
+    return -1;
+  }
+  if (ready) {
+    pthread_mutex_unlock(&syncobj_lock);
+    fn(data, 0);
+    return 0;
+  }
+
+  struct syncobj_cb *cb = os_prim_alloc(sizeof(*cb));
+  struct rmapi_syncobj_point *copy = os_prim_alloc(count * sizeof(*pts));
+  if (!cb || !copy) {
+    pthread_mutex_unlock(&syncobj_lock);
+    if (cb)
+      os_prim_free(cb);
+    if (copy)
+      os_prim_free(copy);
+    return -1;
+  }
+  memcpy(copy, pts, count * sizeof(*pts));
+  cb->waits = copy;
+  cb->count = count;
+  cb->fn = fn;
+  cb->data = data;
+  cb->status = 0;
+  cb->next = NULL;
+
+  // Keep submission order among parked work
+  struct syncobj_cb **pp = &syncobj_pending;
+  while (*pp)
+    pp = &(*pp)->next;
+  *pp = cb;
+  pthread_mutex_unlock(&syncobj_lock);
+  return 0;
+}
+
+// 6. "Poke this fd when point N is done" - caller owns the returned fd.
+// It reads as an eventfd counter (8 bytes) on Linux, a pipe elsewhere.
+int rmapi_syncobj_export_eventfd(int32_t pid, uint32_t handle, uint64_t point,
+                                 int *fd) {
+  if (!fd)
+    return -1;
+
+  int mine, theirs;
+#ifdef __linux__
+  theirs = eventfd(0, EFD_CLOEXEC);
+  mine = theirs >= 0 ? fcntl(theirs, F_DUPFD_CLOEXEC, 0) : -1;
+#else
+  int p[2];
+  if (pipe(p) != 0)
+    return -1;
+  theirs = p[0];
+  mine = p[1];
+  fcntl(theirs, F_SETFD, FD_CLOEXEC);
+  fcntl(mine, F_SETFD, FD_CLOEXEC);
+#endif
+  if (theirs < 0 || mine < 0) {
+    if (theirs >= 0)
+      close(theirs);
+    return -1;
+  }
+
+  struct syncobj_notify *n = os_prim_alloc(sizeof(*n));
+  pthread_mutex_lock(&syncobj_lock);
+  struct rmapi_syncobj *s = syncobj_find_for_locked(pid, handle);
+  bool done = s && s->payload >= point;
+  if (s && !done && n) {
+    n->point = point;
+    n->fd = mine;
+    n->next = s->notify;
+    s->notify = n;
+    n = NULL;
+    mine = -1;
+  }
+  pthread_mutex_unlock(&syncobj_lock);
+
+  if (n)
+    os_prim_free(n);
+  if (!s || (!done && mine >= 0)) { // Unknown handle or out of memory
+    close(mine);
+    close(theirs);
+    return -1;
+  }
+  if (done)
+    syncobj_poke(mine);
+  *fd = theirs;
+  return 0;
+}
+
+// 7. "Give me a sync_file for point N" - DRM mode only, and the point has to
+// be done already (the kernel twin only gets points we signaled)
+int rmapi_syncobj_export_sync_file(int32_t pid, uint32_t handle,
+                                   uint64_t point, int *fd) {
+  if (!fd)
+    return -1;
+
+  pthread_mutex_lock(&syncobj_lock);
+  struct rmapi_syncobj *s = syncobj_find_for_locked(pid, handle);
+  struct OBJGPU *gpu = s ? s->gpu : NULL;
+  uint32_t kernel_handle = s ? s->kernel_handle : 0;
+  bool done = s && s->payload >= point;
+  pthread_mutex_unlock(&syncobj_lock);
+
+  if (!gpu) {
+    os_prim_log("RMAPI: Syncobj %u has no kernel twin, use an eventfd\n",
+                handle);
+    return -1;
+  }
+  if (!done) {
+    os_prim_log("RMAPI: Syncobj %u point %llu isn't signaled yet\n", handle,
+                (unsigned long long)point);
+    return -1;
+  }
+  return amdgpu_syncobj_export_sync_file_hal(gpu, kernel_handle, point, fd);
+}
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+#include "rmapi.h"
+#include "../../os/os_interface.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! This is the Userptr Import desk.
+ * Apps already have their data somewhere (video frames, mmapped files,
+ * network buffers). Instead of copying it into a brand new buffer, they
+ * lend us their pages and we let the GPU use them directly.
+ *
+ * Three ways the pages can reach us:
+ *   1. Same process (drivers/drm_shim): the pointer is just... a pointer.
+ *   2. memfd: the client passes the fd over the socket, we map the same pages.
+ *      It has to be sealed against shrinking, or the client could cut the
+ *      pages out from under our mapping and SIGBUS the server.
+ *   3. Remote range: we read straight out of the client with
+ *      process_vm_readv() - one copy into the consumer, no staging buffer.
+ *
+ * When the client unmaps the range it tells us (IPC_REQ_INVALIDATE_USERPTR),
+ * we drop the pin and every later use fails instead of reading garbage.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+struct rmapi_userptr {
+  struct amdgpu_buffer buf;   // What the HAL pinned for us
+  uint32_t handle;            // RESSERV name tag
+  int32_t owner_pid;          // Who lent us the pages
+  uint64_t client_addr;       // Where the owner sees them
+  uint64_t size;
+  uint32_t flags;             // AMDGPU_USERPTR_FLAG_*
+  int memfd;                  // -1 unless the pages came as a memfd
+  void *map;                  // Our view of the memfd
+  bool remote;                // Only reachable through process_vm_readv
+  bool pinned;                // buf is registered with the HAL
+  bool valid;                 // false once the owner unmapped it
+  bool charged;               // Counted on the owner's tab
+  struct RsResource *res;
+  struct rmapi_userptr *next;
+};
+
+static struct rmapi_userptr *userptr_list = NULL;
+static pthread_mutex_t userptr_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t userptr_generation; // Bumped when any range goes away
+
+static struct rmapi_userptr *userptr_find_locked(uint32_t handle) {
+  struct RsResource *res = rs_resource_lookup(handle);
+  if (!res)
+    return NULL;
+  for (struct rmapi_userptr *up = userptr_list; up; up = up->next)
+    if (up == res->data)
+      return up;
+  return NULL; // Some other kind of resource
+}
+
+// Drop the pin but keep the handle around so later users get a clean error
+static void userptr_unpin_locked(struct OBJGPU *gpu, struct rmapi_userptr *up) {
+  if (up->pinned) {
+    amdgpu_buffer_free_hal(gpu, &up->buf);
+    up->pinned = false;
+  }
+  if (up->map) {
+    munmap(up->map, up->size);
+    up->map = NULL;
+  }
+  if (up->memfd >= 0) {
+    close(up->memfd);
+    up->memfd = -1;
+  }
+  if (up->charged) {
+    rmapi_client_uncharge(up->owner_pid, RMAPI_CLIENT_HEAP_CPU, up->size);
+    up->charged = false;
+  }
+}
+
+// Can we actually reach the client's range? Probe the first and last page.
+static int userptr_probe_remote(pid_t pid, uint64_t addr, uint64_t size) {
+  long page = sysconf(_SC_PAGESIZE);
+  uint8_t byte;
+  uint64_t probes[2] = {addr, addr + size - (uint64_t)page};
+
+  for (int i = 0; i < 2; i++) {
+    struct iovec local = {.iov_base = &byte, .iov_len = 1};
+    struct iovec remote = {.iov_base = (void *)(uintptr_t)probes[i],
+                           .iov_len = 1};
+    if (process_vm_readv(pid, &local, 1, &remote, 1, 0) != 1)
+      return -1;
+  }
+  return 0;
+}
+
+// Is [offset, offset + size) in the memfd and guaranteed to stay there?
+static int userptr_memfd_check(int fd, uint64_t offset, uint64_t size) {
+#ifdef F_GET_SEALS
+  int seals = fcntl(fd, F_GET_SEALS);
+  if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+    os_prim_log("RMAPI: Userptr memfd isn't sealed against shrinking\n");
+    return -1;
+  }
+#endif
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 0 || offset > (uint64_t)st.st_size ||
+      size > (uint64_t)st.st_size - offset) {
+    os_prim_log("RMAPI: Userptr range runs past the end of its memfd\n");
+    return -1;
+  }
+  return 0;
+}
+
+int rmapi_import_userptr(struct OBJGPU *gpu, int32_t pid, uint64_t addr,
+                         uint64_t size, uint32_t flags, int memfd,
+                         uint64_t fd_offset, uint32_t *handle,
+                         uint64_t *gpu_addr) {
+  if (!gpu)
+    gpu = rmapi_get_gpu();
+  if (!gpu || !handle || size == 0)
+    return -1;
+
+  long page = sysconf(_SC_PAGESIZE);
+  if ((addr | size | fd_offset) & (uint64_t)(page - 1)) {
+    os_prim_log("RMAPI: Userptr range must be page aligned, sorry!\n");
+    return -1;
+  }
+
+  // Pinned pages are memory the client holds, quota applies
+  if (rmapi_client_charge(pid, RMAPI_CLIENT_HEAP_CPU, size) != 0)
+    return -1;
+
+  struct rmapi_userptr *up = os_prim_alloc(sizeof(*up));
+  if (!up) {
+    rmapi_client_uncharge(pid, RMAPI_CLIENT_HEAP_CPU, size);
+    return -1;
+  }
+  memset(up, 0, sizeof(*up));
+  up->charged = true;
+  up->owner_pid = pid;
+  up->client_addr = addr;
+  up->size = size;
+  up->flags = flags;
+  up->memfd = -1;
+  up->valid = true;
+
+  void *pages = NULL;
+  if (memfd >= 0) {
+    // 2. The client gave us the fd, map the very same pages on our side
+    int prot = PROT_READ;
+    if (!(flags & AMDGPU_USERPTR_FLAG_READONLY))
+      prot |= PROT_WRITE;
+    if (userptr_memfd_check(memfd, fd_offset, size) != 0) {
+      userptr_unpin_locked(gpu, up);
+      os_prim_free(up);
+      return -1;
+    }
+    up->map = mmap(NULL, size, prot, MAP_SHARED, memfd, (off_t)fd_offset);
+    if (up->map == MAP_FAILED) {
+      os_prim_log("RMAPI: Couldn't map the client's memfd (errno %d)\n", errno);
+      up->map = NULL;
+      userptr_unpin_locked(gpu, up);
+      os_prim_free(up);
+      return -1;
+    }
+    up->memfd = memfd;
+    pages = up->map;
+  } else if (pid == 0 || pid == getpid()) {
+    // 1. Same address space, the pointer works as is
+    pages = (void *)(uintptr_t)addr;
+  } else {
+    // 3. Somebody else's memory, make sure we can reach it before saying yes
+    if (userptr_probe_remote(pid, addr, size) != 0) {
+      os_prim_log("RMAPI: Can't reach pid %d at 0x%llx (errno %d)\n", pid,
+                  (unsigned long long)addr, errno);
+      userptr_unpin_locked(gpu, up);
+      os_prim_free(up);
+      return -1;
+    }
+    up->remote = true;
+  }
+
+  if (pages) {
+    if (amdgpu_buffer_import_userptr_hal(gpu, pages, size, flags, &up->buf) !=
+        0) {
+      up->memfd = -1; // Still the caller's on failure
+      userptr_unpin_locked(gpu, up);
+      os_prim_free(up);
+      return -1;
+    }
+    up->pinned = true;
+  } else {
+    // Nothing to pin locally; the GPU address is the client's own address
+    up->buf.gpu_addr = addr;
+    up->buf.size = size;
+    up->buf.flags = AMDGPU_BUFFER_FLAG_USERPTR;
+  }
+
+  up->handle = rmapi_handle_alloc();
+  up->res = rs_resource_create(up->handle, NULL);
+  if (!up->res) {
+    up->memfd = -1;
+    userptr_unpin_locked(gpu, up);
+    os_prim_free(up);
+    return -1;
+  }
+  up->res->data = up;
+
+  pthread_mutex_lock(&userptr_lock);
+  up->next = userptr_list;
+  userptr_list = up;
+  pthread_mutex_unlock(&userptr_lock);
+
+  *handle = up->handle;
+  if (gpu_addr)
+    *gpu_addr = up->buf.gpu_addr;
+
+  os_prim_log("RMAPI: Imported %llu bytes of userptr memory (handle 0x%x, %s)\n",
+              (unsigned long long)size, up->handle,
+              up->map ? "memfd" : (up->remote ? "remote" : "local"));
+  return 0;
+}
+
+// Only whoever lent the pages can take them back
+int rmapi_release_userptr(struct OBJGPU *gpu, int32_t pid, uint32_t handle) {
+  if (!gpu)
+    gpu = rmapi_get_gpu();
+  if (!gpu)
+    return -1;
+
+  pthread_mutex_lock(&userptr_lock);
+  struct rmapi_userptr *up = userptr_find_locked(handle);
+  if (!up || up->owner_pid != pid) {
+    pthread_mutex_unlock(&userptr_lock);
+    return -1;
+  }
+  for (struct rmapi_userptr **pp = &userptr_list; *pp; pp = &(*pp)->next) {
+    if (*pp == up) {
+      *pp = up->next;
+      break;
+    }
+  }
+  userptr_unpin_locked(gpu, up);
+  __atomic_add_fetch(&userptr_generation, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&userptr_lock);
+
+  rs_resource_destroy(up->res);
+  os_prim_free(up);
+  return 0;
+}
+
+// The owner is about to munmap [addr, addr + size): stop touching those pages
+int rmapi_invalidate_userptr(struct OBJGPU *gpu, int32_t pid, uint64_t addr,
+                             uint64_t size) {
+  if (!gpu)
+    gpu = rmapi_get_gpu();
+  if (!gpu)
+    return -1;
+
+  int hits = 0;
+  pthread_mutex_lock(&userptr_lock);
+  for (struct rmapi_userptr *up = userptr_list; up; up = up->next) {
+    if (up->owner_pid != pid || !up->valid)
+      continue;
+    if (addr >= up->client_addr + up->size || up->client_addr >= addr + size)
+      continue;
+    userptr_unpin_locked(gpu, up);
+    up->valid = false;
+    hits++;
+  }
+  if (hits)
+    __atomic_add_fetch(&userptr_generation, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&userptr_lock);
+
+  if (hits)
+    os_prim_log("RMAPI: Invalidated %d userptr range(s) for pid %d\n", hits,
+                pid);
+  return hits;
+}
+
+// Client went away: nothing it lent us is safe anymore
+void rmapi_release_userptr_pid(struct OBJGPU *gpu, int32_t pid) {
+  for (;;) {
+    uint32_t handle = 0;
+    pthread_mutex_lock(&userptr_lock);
+    for (struct rmapi_userptr *up = userptr_list; up; up = up->next) {
+      if (up->owner_pid == pid) {
+        handle = up->handle;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&userptr_lock);
+    if (!handle || rmapi_release_userptr(gpu, pid, handle) != 0)
+      return;
+  }
+}
+
+// Look up the buffer behind a handle (for submissions). Fails once invalidated.
+int rmapi_userptr_get(uint32_t handle, struct amdgpu_buffer *buf) {
+  int ret = -1;
+  pthread_mutex_lock(&userptr_lock);
+  struct rmapi_userptr *up = userptr_find_locked(handle);
+  if (up && up->valid) {
+    *buf = up->buf;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&userptr_lock);
+  return ret;
+}
+
+// Changes whenever a userptr is released or invalidated: buffers resolved
+// before that have to be looked up again (BO lists)
+uint32_t rmapi_userptr_generation(void) {
+  return __atomic_load_n(&userptr_generation, __ATOMIC_ACQUIRE);
+}
+
+// Copy len bytes at offset out of the userptr range straight into dst
+int rmapi_userptr_read(uint32_t handle, uint64_t offset, void *dst,
+                       size_t len) {
+  int ret = -1;
+  pthread_mutex_lock(&userptr_lock);
+  struct rmapi_userptr *up = userptr_find_locked(handle);
+  if (!up || !up->valid || offset > up->size || len > up->size - offset)
+    goto out;
+
+  if (!up->remote) {
+    memcpy(dst, (uint8_t *)up->buf.cpu_addr + offset, len);
+    ret = 0;
+    goto out;
+  }
+
+  struct iovec local = {.iov_base = dst, .iov_len = len};
+  struct iovec remote = {
+      .iov_base = (void *)(uintptr_t)(up->client_addr + offset),
+      .iov_len = len};
+  ssize_t got = process_vm_readv(up->owner_pid, &local, 1, &remote, 1, 0);
+  if (got == (ssize_t)len) {
+    ret = 0;
+  } else if (got < 0 && (errno == EFAULT || errno == ESRCH)) {
+    // Unmapped (or the owner died) without telling us
+    os_prim_log("RMAPI: Userptr 0x%x vanished under us, invalidating\n",
+                handle);
+    up->valid = false;
+  }
+out:
+  pthread_mutex_unlock(&userptr_lock);
+  return ret;
+}
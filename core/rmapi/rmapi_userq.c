@@ -0,0 +1,632 @@
+#define _GNU_SOURCE
+#include "rmapi.h"
+#include "../../drivers/amdgpu/amdgpu_userq.h"
+#include "../../os/os_interface.h"
+#include "../../src/amd/include/mes_v11_api_def.h"
+#include "../../src/amd/include/v11_structs.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+
+/*
+ * Yo! These are the User Queues - apps talking to the CP without us.
+ * Every IPC submit costs two socket trips and a wakeup. With a user queue
+ * the app gets its own ring, rptr/wptr writeback and doorbell mapped into
+ * its address space, and submitting is a memcpy plus a doorbell write.
+ *
+ * Setting one up looks like it does for MES:
+ * - We fill a real v11 MQD (gfx, compute or SDMA flavor) describing the
+ *   ring, the writeback addresses and the doorbell.
+ * - We hand MES an ADD_QUEUE frame pointing at that MQD. MES loads the MQD
+ *   into a hardware queue slot (HQD) and from then on the doorbell is live.
+ *
+ * No MES here (simulation, or a kernel without user queues), so the
+ * software CP plays it: it takes the same frames, loads HQDs from the same
+ * MQD fields, and a thread watches the doorbells. When one rings it fetches
+ * the packets, runs them past the validator (the app wrote them, after all)
+ * against the BO list the queue was made with and feeds them to the
+ * scheduler. When they retire it writes the fence
+ * back into the queue's control page and signals the queue's syncobj.
+ *
+ * An idle CP thread first spins, then naps a little longer each round, so
+ * a busy queue gets picked up within microseconds and an idle one costs
+ * (almost) nothing. With no queue mapped at all it sleeps until one is.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define USERQ_MIN_RING (4u * 1024)
+#define USERQ_MAX_RING (1u * 1024 * 1024)
+#define USERQ_CP_SPINS 256       // Empty passes before the CP starts napping
+#define USERQ_CP_MAX_NAP_US 200  // Longest nap: worst-case doorbell latency
+#define USERQ_DOORBELL_STRIDE 2  // 64-bit doorbells, in dwords
+
+union userq_mqd {
+  struct v11_gfx_mqd gfx;
+  struct v11_compute_mqd compute;
+  struct v11_sdma_mqd sdma;
+};
+
+// What the CP keeps for a mapped queue, loaded from the MQD
+struct userq_hqd {
+  bool active;
+  uint32_t *ring;
+  uint32_t ring_dw;
+  uint64_t *rptr;     // rptr report address
+  uint64_t *wptr;     // wptr poll address
+  uint64_t *doorbell;
+  uint64_t seen;      // Doorbell value we last acted on
+};
+
+struct rmapi_userq {
+  uint32_t id;
+  int32_t pid;
+  uint32_t engine;
+  uint32_t doorbell_offset; // Global doorbell index, dwords
+  uint32_t syncobj;         // The app's: signaled once the page says so
+  uint32_t retire;          // Ours: the scheduler signals it
+  uint32_t bo_list;         // The app's buffers, what submits may touch
+  void *map;                // Our view of the app's pages
+  size_t size;
+  struct amdgpu_userq_ctrl *ctrl;
+  union userq_mqd *mqd;
+  struct userq_hqd hqd;
+  struct rmapi_userq *next;
+};
+
+static struct rmapi_userq *userq_list = NULL;
+static uint32_t userq_next_id = 1;
+static uint32_t userq_next_doorbell = 0;
+static pthread_mutex_t userq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t userq_cp_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t userq_cp_thread;
+static bool userq_cp_running = false;
+static uint64_t userq_mes_fence = 0; // MES writes api_status fences here
+
+static struct rmapi_userq *userq_find_locked(uint32_t id) {
+  for (struct rmapi_userq *q = userq_list; q; q = q->next)
+    if (q->id == id)
+      return q;
+  return NULL;
+}
+
+static uint32_t userq_log2(uint32_t v) {
+  uint32_t l = 0;
+  while ((1u << l) < v)
+    l++;
+  return l;
+}
+
+static int userq_make_memfd(size_t size) {
+  int fd;
+#ifdef __linux__
+  fd = memfd_create("amdgpu-userq", MFD_CLOEXEC);
+#else
+  char name[64];
+  snprintf(name, sizeof(name), "/amdgpu-userq-%d-%ld", (int)getpid(),
+           (long)clock());
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd >= 0)
+    shm_unlink(name);
+#endif
+  if (fd < 0)
+    return -1;
+  if (ftruncate(fd, (off_t)size) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* --- MQDs: what a queue looks like to MES --- */
+
+// Addresses are what the CP sees. In simulation that's our own mapping.
+static inline uint64_t userq_gpu(const void *p) { return (uint64_t)(uintptr_t)p; }
+
+static void userq_fill_mqd(struct rmapi_userq *q) {
+  uint64_t mqd = userq_gpu(q->mqd);
+  uint64_t ring = userq_gpu((char *)q->map + AMDGPU_USERQ_RING_OFFSET);
+  uint64_t rptr = userq_gpu(&q->ctrl->rptr);
+  uint64_t wptr = userq_gpu(&q->ctrl->wptr);
+  uint32_t size_log2 = userq_log2(q->ctrl->ring_dw);
+
+  memset(q->mqd, 0, sizeof(*q->mqd));
+  switch (q->engine) {
+  case RMAPI_CLIENT_ENGINE_GFX: {
+    struct v11_gfx_mqd *m = &q->mqd->gfx;
+    m->cp_mqd_base_addr = (uint32_t)mqd & 0xFFFFFFFC;
+    m->cp_mqd_base_addr_hi = (uint32_t)(mqd >> 32);
+    m->cp_gfx_hqd_base = (uint32_t)(ring >> 8);
+    m->cp_gfx_hqd_base_hi = (uint32_t)(ring >> 40);
+    m->cp_gfx_hqd_cntl = size_log2 - 1; // RB_BUFSZ
+    m->cp_gfx_hqd_rptr_addr = (uint32_t)rptr & 0xFFFFFFFC;
+    m->cp_gfx_hqd_rptr_addr_hi = (uint32_t)(rptr >> 32);
+    m->cp_rb_wptr_poll_addr_lo = (uint32_t)wptr & 0xFFFFFFFC;
+    m->cp_rb_wptr_poll_addr_hi = (uint32_t)(wptr >> 32);
+    m->cp_rb_doorbell_control = (q->doorbell_offset << 2) | (1u << 30); // EN
+    break;
+  }
+  case RMAPI_CLIENT_ENGINE_COMPUTE: {
+    struct v11_compute_mqd *m = &q->mqd->compute;
+    m->cp_mqd_base_addr_lo = (uint32_t)mqd & 0xFFFFFFFC;
+    m->cp_mqd_base_addr_hi = (uint32_t)(mqd >> 32);
+    m->cp_hqd_pq_base_lo = (uint32_t)(ring >> 8);
+    m->cp_hqd_pq_base_hi = (uint32_t)(ring >> 40);
+    m->cp_hqd_pq_control = size_log2 - 1; // QUEUE_SIZE
+    m->cp_hqd_pq_rptr_report_addr_lo = (uint32_t)rptr & 0xFFFFFFFC;
+    m->cp_hqd_pq_rptr_report_addr_hi = (uint32_t)(rptr >> 32);
+    m->cp_hqd_pq_wptr_poll_addr_lo = (uint32_t)wptr & 0xFFFFFFFC;
+    m->cp_hqd_pq_wptr_poll_addr_hi = (uint32_t)(wptr >> 32);
+    m->cp_hqd_pq_doorbell_control = (q->doorbell_offset << 2) | (1u << 30);
+    break;
+  }
+  default: {
+    struct v11_sdma_mqd *m = &q->mqd->sdma;
+    m->sdmax_rlcx_rb_cntl = (size_log2 << 1) | 1; // RB_SIZE | RB_ENABLE
+    m->sdmax_rlcx_rb_base = (uint32_t)(ring >> 8);
+    m->sdmax_rlcx_rb_base_hi = (uint32_t)(ring >> 40);
+    m->sdmax_rlcx_rb_rptr_addr_lo = (uint32_t)rptr & 0xFFFFFFFC;
+    m->sdmax_rlcx_rb_rptr_addr_hi = (uint32_t)(rptr >> 32);
+    m->sdmax_rlcx_rb_wptr_poll_addr_lo = (uint32_t)wptr & 0xFFFFFFFC;
+    m->sdmax_rlcx_rb_wptr_poll_addr_hi = (uint32_t)(wptr >> 32);
+    m->sdmax_rlcx_doorbell = 1u << 28; // ENABLE
+    m->sdmax_rlcx_doorbell_offset = q->doorbell_offset << 2;
+    break;
+  }
+  }
+}
+
+/* --- Software CP: the MES stand-in --- */
+
+#define USERQ_ADDR(lo, hi) ((void *)(uintptr_t)(((uint64_t)(hi) << 32) | (lo)))
+#define USERQ_RING(lo, hi) \
+  ((uint32_t *)(uintptr_t)(((uint64_t)(hi) << 40) | ((uint64_t)(lo) << 8)))
+
+// Same fields MES would read to bring the queue up
+static void userq_hqd_load(struct rmapi_userq *q, enum MES_QUEUE_TYPE type,
+                           const union userq_mqd *mqd) {
+  struct userq_hqd *h = &q->hqd;
+  uint32_t db;
+  switch (type) {
+  case MES_QUEUE_TYPE_GFX:
+    h->ring = USERQ_RING(mqd->gfx.cp_gfx_hqd_base, mqd->gfx.cp_gfx_hqd_base_hi);
+    h->ring_dw = 1u << ((mqd->gfx.cp_gfx_hqd_cntl & 0x3F) + 1);
+    h->rptr = USERQ_ADDR(mqd->gfx.cp_gfx_hqd_rptr_addr,
+                         mqd->gfx.cp_gfx_hqd_rptr_addr_hi);
+    h->wptr = USERQ_ADDR(mqd->gfx.cp_rb_wptr_poll_addr_lo,
+                         mqd->gfx.cp_rb_wptr_poll_addr_hi);
+    db = (mqd->gfx.cp_rb_doorbell_control >> 2) & 0x3FFFFFF;
+    break;
+  case MES_QUEUE_TYPE_COMPUTE:
+    h->ring = USERQ_RING(mqd->compute.cp_hqd_pq_base_lo,
+                         mqd->compute.cp_hqd_pq_base_hi);
+    h->ring_dw = 1u << ((mqd->compute.cp_hqd_pq_control & 0x3F) + 1);
+    h->rptr = USERQ_ADDR(mqd->compute.cp_hqd_pq_rptr_report_addr_lo,
+                         mqd->compute.cp_hqd_pq_rptr_report_addr_hi);
+    h->wptr = USERQ_ADDR(mqd->compute.cp_hqd_pq_wptr_poll_addr_lo,
+                         mqd->compute.cp_hqd_pq_wptr_poll_addr_hi);
+    db = (mqd->compute.cp_hqd_pq_doorbell_control >> 2) & 0x3FFFFFF;
+    break;
+  default:
+    h->ring = USERQ_RING(mqd->sdma.sdmax_rlcx_rb_base,
+                         mqd->sdma.sdmax_rlcx_rb_base_hi);
+    h->ring_dw = 1u << ((mqd->sdma.sdmax_rlcx_rb_cntl >> 1) & 0x1F);
+    h->rptr = USERQ_ADDR(mqd->sdma.sdmax_rlcx_rb_rptr_addr_lo,
+                         mqd->sdma.sdmax_rlcx_rb_rptr_addr_hi);
+    h->wptr = USERQ_ADDR(mqd->sdma.sdmax_rlcx_rb_wptr_poll_addr_lo,
+                         mqd->sdma.sdmax_rlcx_rb_wptr_poll_addr_hi);
+    db = (mqd->sdma.sdmax_rlcx_doorbell_offset >> 2) & 0x3FFFFFF;
+    break;
+  }
+  // Doorbell index -> slot in the queue's doorbell page
+  h->doorbell = (uint64_t *)((char *)q->map + AMDGPU_USERQ_DOORBELL_OFFSET +
+                             (db % (AMDGPU_USERQ_PAGE / 4)) * 4);
+  h->seen = __atomic_load_n(h->doorbell, __ATOMIC_ACQUIRE);
+  h->active = true;
+}
+
+// One API frame, MES style. Completion goes to api_status like the real one.
+static int userq_mes_submit_locked(const void *frame) {
+  const union MES_API_HEADER *hdr = frame;
+  int ret = -1;
+
+  if (hdr->opcode == MES_SCH_API_ADD_QUEUE) {
+    const union MESAPI__ADD_QUEUE *add = frame;
+    for (struct rmapi_userq *q = userq_list; q; q = q->next) {
+      if (q->doorbell_offset == add->doorbell_offset && !q->hqd.active) {
+        userq_hqd_load(q, add->queue_type,
+                       (const union userq_mqd *)(uintptr_t)add->mqd_addr);
+        ret = 0;
+        break;
+      }
+    }
+    if (ret == 0)
+      *(uint64_t *)(uintptr_t)add->api_status.api_completion_fence_addr =
+          add->api_status.api_completion_fence_value;
+  } else if (hdr->opcode == MES_SCH_API_REMOVE_QUEUE) {
+    const union MESAPI__REMOVE_QUEUE *rm = frame;
+    for (struct rmapi_userq *q = userq_list; q; q = q->next) {
+      if (q->doorbell_offset == rm->doorbell_offset && q->hqd.active) {
+        q->hqd.active = false;
+        ret = 0;
+        break;
+      }
+    }
+    if (ret == 0)
+      *(uint64_t *)(uintptr_t)rm->api_status.api_completion_fence_addr =
+          rm->api_status.api_completion_fence_value;
+  }
+  return ret;
+}
+
+static int userq_map_locked(struct rmapi_userq *q) {
+  union MESAPI__ADD_QUEUE add;
+  memset(&add, 0, sizeof(add));
+  add.header.type = MES_API_TYPE_SCHEDULER;
+  add.header.opcode = MES_SCH_API_ADD_QUEUE;
+  add.header.dwsize = API_FRAME_SIZE_IN_DWORDS;
+  add.process_id = (uint32_t)q->pid;
+  add.gang_global_priority_level = AMD_PRIORITY_LEVEL_NORMAL;
+  add.doorbell_offset = q->doorbell_offset;
+  add.mqd_addr = userq_gpu(q->mqd);
+  add.wptr_addr = userq_gpu(&q->ctrl->wptr);
+  add.h_queue = q->id;
+  add.queue_type = q->engine == RMAPI_CLIENT_ENGINE_GFX ? MES_QUEUE_TYPE_GFX
+                   : q->engine == RMAPI_CLIENT_ENGINE_COMPUTE
+                       ? MES_QUEUE_TYPE_COMPUTE
+                       : MES_QUEUE_TYPE_SDMA;
+  add.api_status.api_completion_fence_addr = userq_gpu(&userq_mes_fence);
+  add.api_status.api_completion_fence_value = ++userq_mes_fence;
+  return userq_mes_submit_locked(&add);
+}
+
+static void userq_unmap_locked(struct rmapi_userq *q) {
+  union MESAPI__REMOVE_QUEUE rm;
+  memset(&rm, 0, sizeof(rm));
+  rm.header.type = MES_API_TYPE_SCHEDULER;
+  rm.header.opcode = MES_SCH_API_REMOVE_QUEUE;
+  rm.header.dwsize = API_FRAME_SIZE_IN_DWORDS;
+  rm.doorbell_offset = q->doorbell_offset;
+  rm.api_status.api_completion_fence_addr = userq_gpu(&userq_mes_fence);
+  rm.api_status.api_completion_fence_value = ++userq_mes_fence;
+  userq_mes_submit_locked(&rm);
+}
+
+static void userq_kill_locked(struct rmapi_userq *q, uint32_t error) {
+  os_prim_log("RMAPI UserQ: Queue %u (pid %d) killed, error %u\n", q->id,
+              (int)q->pid, error);
+  __atomic_store_n(&q->ctrl->error, error, __ATOMIC_RELEASE);
+  userq_unmap_locked(q);
+}
+
+// A submit retired: control page first, then the app's syncobj, so whoever
+// wakes up on the syncobj sees the fence already moved
+static void userq_retired(void *data, int status) {
+  uint32_t id = (uint32_t)(uintptr_t)data;
+  uint32_t syncobj = 0;
+  uint64_t payload = 0;
+  pthread_mutex_lock(&userq_lock);
+  struct rmapi_userq *q = userq_find_locked(id);
+  if (q && status == 0 && rmapi_syncobj_query(0, q->retire, &payload) == 0 &&
+      payload > __atomic_load_n(&q->ctrl->fence, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&q->ctrl->fence, payload, __ATOMIC_RELEASE);
+    syncobj = q->syncobj;
+  }
+  pthread_mutex_unlock(&userq_lock);
+  if (syncobj)
+    rmapi_syncobj_signal(0, syncobj, payload); // May run parked work, no locks held
+}
+
+// Doorbell rang? Copy out what's new and mark it fetched. 1 = got work.
+static int userq_cp_fetch_locked(struct rmapi_userq *q, uint32_t **cmds,
+                                 uint32_t *ndw, uint64_t *end) {
+  struct userq_hqd *h = &q->hqd;
+  uint64_t db = __atomic_load_n(h->doorbell, __ATOMIC_ACQUIRE);
+  if (db == h->seen)
+    return 0;
+  h->seen = db;
+
+  uint64_t wptr = __atomic_load_n(h->wptr, __ATOMIC_ACQUIRE);
+  uint64_t rptr = *h->rptr;
+  if (wptr <= rptr)
+    return 0;
+  if (wptr - rptr > h->ring_dw) {
+    userq_kill_locked(q, AMDGPU_USERQ_ERROR_WPTR);
+    return 0;
+  }
+
+  uint32_t n = (uint32_t)(wptr - rptr);
+  uint32_t *buf = os_prim_alloc((size_t)n * 4);
+  if (!buf)
+    return 0; // Try again on the next doorbell
+  uint32_t pos = (uint32_t)rptr & (h->ring_dw - 1);
+  uint32_t first = h->ring_dw - pos < n ? h->ring_dw - pos : n;
+  memcpy(buf, h->ring + pos, (size_t)first * 4);
+  memcpy(buf + first, h->ring, (size_t)(n - first) * 4);
+  __atomic_store_n(h->rptr, wptr, __ATOMIC_RELEASE); // The app may reuse it
+
+  *cmds = buf;
+  *ndw = n;
+  *end = wptr;
+  return 1;
+}
+
+// Validate and queue one fetched chunk. Called without userq_lock: the
+// scheduler may retire it right here and call userq_retired.
+static void userq_cp_dispatch(uint32_t id, int32_t pid, uint32_t engine,
+                              uint32_t retire, uint32_t bo_list, uint32_t *cmds,
+                              uint32_t ndw, uint64_t end) {
+  uint32_t error = AMDGPU_USERQ_ERROR_NONE;
+  struct rmapi_cs_shadow *shadow = NULL;
+  struct amdgpu_command_buffer cb = {NULL, cmds, (size_t)ndw * 4, NULL, 0};
+  struct rmapi_bo_list *list = NULL;
+  if (bo_list && !(list = rmapi_bo_list_acquire(pid, bo_list, &cb))) {
+    error = AMDGPU_USERQ_ERROR_SUBMIT; // The app destroyed it under us
+  } else if (rmapi_cs_validate_shadow(pid, engine, cmds, (size_t)ndw * 4,
+                                      cb.bo_list, cb.bo_count, &shadow) != 0) {
+    error = AMDGPU_USERQ_ERROR_PACKET;
+  } else {
+    struct rmapi_syncobj_point done = {retire, 0, end};
+    struct rmapi_sched_hold holds[2];
+    uint32_t nholds = 0;
+    if (shadow)
+      holds[nholds++] = rmapi_cs_shadow_hold(shadow);
+    int ret = 0;
+    if (list && (ret = rmapi_bo_list_hold(list, &cb, &holds[nholds])) == 0)
+      nholds++; // The job keeps the buffers, the app may drop them now
+    if (ret != 0 || rmapi_sched_submit_held(pid, engine, &cb, NULL, 0, &done,
+                                            1, holds, nholds, NULL) != 0) {
+      for (uint32_t i = 0; i < nholds; i++)
+        holds[i].release(holds[i].data);
+      error = AMDGPU_USERQ_ERROR_SUBMIT;
+    } else {
+      rmapi_syncobj_when(&done, 1, userq_retired, (void *)(uintptr_t)id);
+    }
+  }
+  rmapi_bo_list_put(list);
+  os_prim_free(cmds);
+
+  if (error) {
+    pthread_mutex_lock(&userq_lock);
+    struct rmapi_userq *q = userq_find_locked(id);
+    if (q && q->hqd.active)
+      userq_kill_locked(q, error);
+    pthread_mutex_unlock(&userq_lock);
+  }
+}
+
+static void *userq_cp_main(void *arg) {
+  (void)arg;
+  uint32_t idle = 0;
+  pthread_mutex_lock(&userq_lock);
+  while (userq_cp_running) {
+    int busy = 0, active = 0;
+    // Take one chunk at a time and let go of the lock to dispatch it, so
+    // queues can come and go (and retire callbacks run) meanwhile
+    for (struct rmapi_userq *q = userq_list; q; q = q->next) {
+      uint32_t *cmds, ndw;
+      uint64_t end;
+      active |= q->hqd.active;
+      if (!q->hqd.active || !userq_cp_fetch_locked(q, &cmds, &ndw, &end))
+        continue;
+      uint32_t id = q->id, engine = q->engine, retire = q->retire;
+      uint32_t bo_list = q->bo_list;
+      int32_t pid = q->pid;
+      pthread_mutex_unlock(&userq_lock);
+      userq_cp_dispatch(id, pid, engine, retire, bo_list, cmds, ndw, end);
+      pthread_mutex_lock(&userq_lock);
+      busy = 1;
+      break; // The list may have changed, start over
+    }
+    if (busy) {
+      idle = 0;
+      continue;
+    }
+    if (!active) {
+      // No doorbell anybody could ring: sleep until a queue gets mapped
+      pthread_cond_wait(&userq_cp_cond, &userq_lock);
+      idle = 0;
+      continue;
+    }
+
+    if (++idle < USERQ_CP_SPINS) {
+      pthread_mutex_unlock(&userq_lock);
+      sched_yield();
+      pthread_mutex_lock(&userq_lock);
+      continue;
+    }
+    // Nap 1, 2, 4... us up to the cap. Creating or destroying a queue
+    // (or shutting down) wakes us early.
+    uint32_t shift = idle - USERQ_CP_SPINS;
+    uint32_t nap_us = shift < 8 ? 1u << shift : USERQ_CP_MAX_NAP_US;
+    if (nap_us > USERQ_CP_MAX_NAP_US)
+      nap_us = USERQ_CP_MAX_NAP_US;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (long)nap_us * 1000;
+    if (ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&userq_cp_cond, &userq_lock, &ts);
+  }
+  pthread_mutex_unlock(&userq_lock);
+  return NULL;
+}
+
+/* --- The desk: creating and tearing down queues --- */
+
+// New queue for pid on engine. Submits are checked against bo_list (pid's,
+// 0 = no buffers at all). *fd is the app's copy of the pages (map
+// info->size bytes of it MAP_SHARED); the caller closes it when done.
+int rmapi_userq_create(struct OBJGPU *gpu, int32_t pid, uint32_t engine,
+                       uint32_t ring_bytes, uint32_t bo_list,
+                       struct rmapi_userq_info *info, int *fd) {
+  (void)gpu;
+  if (engine >= RMAPI_CLIENT_ENGINE_COUNT || !info || !fd)
+    return -1;
+  if (bo_list) {
+    struct amdgpu_command_buffer cb = {NULL, NULL, 0, NULL, 0};
+    struct rmapi_bo_list *l = rmapi_bo_list_acquire(pid, bo_list, &cb);
+    if (!l)
+      return -1; // Not pid's, or not a list
+    rmapi_bo_list_put(l);
+  }
+  if (ring_bytes < USERQ_MIN_RING)
+    ring_bytes = USERQ_MIN_RING;
+  if (ring_bytes > USERQ_MAX_RING)
+    return -1;
+  uint32_t ring_dw = 1u << userq_log2(ring_bytes / 4);
+  size_t size = amdgpu_userq_map_size(ring_dw);
+
+  if (rmapi_client_charge(pid, RMAPI_CLIENT_HEAP_GTT, size) != 0)
+    return -1;
+
+  struct rmapi_userq *q = os_prim_alloc(sizeof(*q));
+  union userq_mqd *mqd = os_prim_alloc(sizeof(*mqd));
+  int memfd = userq_make_memfd(size);
+  void *map = memfd >= 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, memfd, 0)
+                         : MAP_FAILED;
+  uint32_t syncobj = 0, retire = 0;
+  if (!q || !mqd || map == MAP_FAILED ||
+      rmapi_syncobj_create(gpu, pid, 0, &syncobj) != 0 ||
+      rmapi_syncobj_create(gpu, pid, 0, &retire) != 0)
+    goto fail;
+
+  memset(q, 0, sizeof(*q));
+  q->pid = pid;
+  q->engine = engine;
+  q->syncobj = syncobj;
+  q->retire = retire;
+  q->bo_list = bo_list;
+  q->map = map;
+  q->size = size;
+  q->ctrl = map;
+  q->mqd = mqd;
+
+  pthread_mutex_lock(&userq_lock);
+  q->id = userq_next_id++;
+  q->doorbell_offset = userq_next_doorbell;
+  userq_next_doorbell += USERQ_DOORBELL_STRIDE;
+  q->ctrl->magic = AMDGPU_USERQ_MAGIC;
+  q->ctrl->engine = engine;
+  q->ctrl->ring_dw = ring_dw;
+  q->ctrl->doorbell_dw = q->doorbell_offset % (AMDGPU_USERQ_PAGE / 4);
+  userq_fill_mqd(q);
+  q->next = userq_list;
+  userq_list = q;
+
+  if (userq_map_locked(q) != 0) {
+    userq_list = q->next;
+    pthread_mutex_unlock(&userq_lock);
+    goto fail;
+  }
+  if (!userq_cp_running) {
+    userq_cp_running = true;
+    if (pthread_create(&userq_cp_thread, NULL, userq_cp_main, NULL) != 0) {
+      userq_cp_running = false;
+      os_prim_log("RMAPI UserQ: No software CP thread, doorbells won't ring\n");
+    }
+  }
+  pthread_cond_signal(&userq_cp_cond);
+
+  info->id = q->id;
+  info->syncobj = syncobj;
+  info->ring_dw = ring_dw;
+  info->doorbell_offset = q->doorbell_offset;
+  info->size = size;
+  pthread_mutex_unlock(&userq_lock);
+
+  *fd = memfd;
+  os_prim_log("RMAPI UserQ: Queue %u for pid %d on engine %u (%u dwords, doorbell %u)\n",
+              info->id, (int)pid, engine, ring_dw, info->doorbell_offset);
+  return 0;
+
+fail:
+  if (retire)
+    rmapi_syncobj_destroy(pid, retire);
+  if (syncobj)
+    rmapi_syncobj_destroy(pid, syncobj);
+  if (map != MAP_FAILED)
+    munmap(map, size);
+  if (memfd >= 0)
+    close(memfd);
+  os_prim_free(mqd);
+  os_prim_free(q);
+  rmapi_client_uncharge(pid, RMAPI_CLIENT_HEAP_GTT, size);
+  return -1;
+}
+
+static void userq_free(struct rmapi_userq *q) {
+  rmapi_syncobj_destroy(q->pid, q->retire);
+  rmapi_syncobj_destroy(q->pid, q->syncobj);
+  munmap(q->map, q->size);
+  rmapi_client_uncharge(q->pid, RMAPI_CLIENT_HEAP_GTT, q->size);
+  os_prim_free(q->mqd);
+  os_prim_free(q);
+}
+
+int rmapi_userq_destroy(int32_t pid, uint32_t id) {
+  pthread_mutex_lock(&userq_lock);
+  struct rmapi_userq **pp = &userq_list;
+  while (*pp && (*pp)->id != id)
+    pp = &(*pp)->next;
+  struct rmapi_userq *q = *pp;
+  if (!q || q->pid != pid) {
+    pthread_mutex_unlock(&userq_lock);
+    return -1;
+  }
+  if (q->hqd.active)
+    userq_unmap_locked(q);
+  *pp = q->next;
+  pthread_mutex_unlock(&userq_lock);
+
+  // Whatever was fetched already is the scheduler's now and still runs
+  userq_free(q);
+  return 0;
+}
+
+void rmapi_userq_release_pid(int32_t pid) {
+  for (;;) {
+    uint32_t id = 0;
+    pthread_mutex_lock(&userq_lock);
+    for (struct rmapi_userq *q = userq_list; q; q = q->next)
+      if (q->pid == pid)
+        id = q->id;
+    pthread_mutex_unlock(&userq_lock);
+    if (!id || rmapi_userq_destroy(pid, id) != 0)
+      return;
+  }
+}
+
+void rmapi_userq_fini(void) {
+  pthread_mutex_lock(&userq_lock);
+  bool running = userq_cp_running;
+  userq_cp_running = false;
+  pthread_cond_signal(&userq_cp_cond);
+  pthread_mutex_unlock(&userq_lock);
+  if (running)
+    pthread_join(userq_cp_thread, NULL);
+
+  pthread_mutex_lock(&userq_lock);
+  struct rmapi_userq *list = userq_list;
+  userq_list = NULL;
+  pthread_mutex_unlock(&userq_lock);
+  while (list) {
+    struct rmapi_userq *q = list;
+    list = q->next;
+    userq_free(q);
+  }
+}
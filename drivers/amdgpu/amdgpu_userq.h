@@ -0,0 +1,113 @@
+#ifndef AMDGPU_USERQ_H
+#define AMDGPU_USERQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Yo! This is the app's side of a user-mode queue.
+ * The server hands us one fd per queue (IPC_REQ_USERQ). We map it and from
+ * then on submitting is just memory writes: copy packets into the ring,
+ * publish the new wptr, write it to our doorbell. No socket, no syscall.
+ * The CP (or in simulation, the server's software CP) notices the doorbell,
+ * fetches the packets and writes back how far it got.
+ *
+ * What's in the fd:
+ * - Page 0: control page. wptr is ours, rptr / fence / error are the CP's.
+ * - Page 1: our doorbell page, the slot is at ctrl->doorbell_dw.
+ * - Page 2+: the ring, ring_dw dwords (a power of two).
+ *
+ * Pointers (wptr, rptr, fence) count dwords and never wrap, so "fence >= X"
+ * is all it takes to know a submit retired. To sleep instead of spinning,
+ * wait on the queue's syncobj: it gets signaled with the same values.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define AMDGPU_USERQ_PAGE 4096
+#define AMDGPU_USERQ_MAGIC 0x51524855 // "UHRQ"
+#define AMDGPU_USERQ_CTRL_OFFSET 0
+#define AMDGPU_USERQ_DOORBELL_OFFSET AMDGPU_USERQ_PAGE
+#define AMDGPU_USERQ_RING_OFFSET (2 * AMDGPU_USERQ_PAGE)
+
+// Why the CP killed the queue (ctrl->error)
+#define AMDGPU_USERQ_ERROR_NONE 0
+#define AMDGPU_USERQ_ERROR_WPTR 1   // wptr jumped past what the ring holds
+#define AMDGPU_USERQ_ERROR_PACKET 2 // The validator refused what we wrote
+#define AMDGPU_USERQ_ERROR_SUBMIT 3 // The scheduler couldn't take it
+
+struct amdgpu_userq_ctrl {
+  uint32_t magic;
+  uint32_t engine;      // RMAPI_CLIENT_ENGINE_*
+  uint32_t ring_dw;
+  uint32_t doorbell_dw; // Our slot in the doorbell page
+  uint64_t wptr;        // App: everything before this is ready to go
+  uint64_t rptr;        // CP: everything before this has been fetched
+  uint64_t fence;       // CP: everything before this has retired
+  uint32_t error;       // CP: AMDGPU_USERQ_ERROR_*, the queue is dead if set
+  uint32_t pad;
+};
+
+struct amdgpu_userq {
+  struct amdgpu_userq_ctrl *ctrl;
+  uint64_t *doorbell;
+  uint32_t *ring;
+  uint32_t ring_dw;
+};
+
+static inline size_t amdgpu_userq_map_size(uint32_t ring_dw) {
+  return AMDGPU_USERQ_RING_OFFSET + (size_t)ring_dw * 4;
+}
+
+// map = the queue's fd mapped MAP_SHARED, size bytes. -1 if it isn't one.
+static inline int amdgpu_userq_init(struct amdgpu_userq *q, void *map,
+                                    size_t size) {
+  struct amdgpu_userq_ctrl *ctrl = (struct amdgpu_userq_ctrl *)map;
+  if (!map || size < AMDGPU_USERQ_RING_OFFSET ||
+      ctrl->magic != AMDGPU_USERQ_MAGIC || !ctrl->ring_dw ||
+      (ctrl->ring_dw & (ctrl->ring_dw - 1)) ||
+      size < amdgpu_userq_map_size(ctrl->ring_dw) ||
+      ctrl->doorbell_dw > AMDGPU_USERQ_PAGE / 4 - 2 || (ctrl->doorbell_dw & 1))
+    return -1;
+  q->ctrl = ctrl;
+  q->doorbell = (uint64_t *)((char *)map + AMDGPU_USERQ_DOORBELL_OFFSET +
+                             ctrl->doorbell_dw * 4);
+  q->ring = (uint32_t *)((char *)map + AMDGPU_USERQ_RING_OFFSET);
+  q->ring_dw = ctrl->ring_dw;
+  return 0;
+}
+
+static inline uint32_t amdgpu_userq_space(const struct amdgpu_userq *q) {
+  uint64_t rptr = __atomic_load_n(&q->ctrl->rptr, __ATOMIC_ACQUIRE);
+  return q->ring_dw - (uint32_t)(q->ctrl->wptr - rptr);
+}
+
+// Whole packets only: the CP may pick up several submits in one go, but it
+// never splits one. Returns the point to wait for, 0 if there's no room
+// right now (or the queue is dead).
+static inline uint64_t amdgpu_userq_submit(struct amdgpu_userq *q,
+                                           const uint32_t *dw, uint32_t ndw) {
+  uint64_t wptr = q->ctrl->wptr; // Only we write it
+  if (!ndw || ndw > amdgpu_userq_space(q) ||
+      __atomic_load_n(&q->ctrl->error, __ATOMIC_RELAXED))
+    return 0;
+
+  uint32_t pos = (uint32_t)wptr & (q->ring_dw - 1);
+  uint32_t first = q->ring_dw - pos < ndw ? q->ring_dw - pos : ndw;
+  memcpy(q->ring + pos, dw, (size_t)first * 4);
+  memcpy(q->ring, dw + first, (size_t)(ndw - first) * 4);
+
+  wptr += ndw;
+  __atomic_store_n(&q->ctrl->wptr, wptr, __ATOMIC_RELEASE);
+  __atomic_store_n(q->doorbell, wptr, __ATOMIC_RELEASE); // Ding
+  return wptr;
+}
+
+static inline bool amdgpu_userq_done(const struct amdgpu_userq *q,
+                                     uint64_t point) {
+  return __atomic_load_n(&q->ctrl->fence, __ATOMIC_ACQUIRE) >= point;
+}
+
+#endif
@@ -111,8 +111,11 @@ int clock_v10_set_pixel_clock(struct OBJGPU *adev, uint32_t pixel_clock_10khz) {
     os_prim_log("Clock: Setting pixel clock to %u.%u MHz (%u kHz)\n",
                 target_khz / 1000, (target_khz % 1000) / 100, target_khz);
 
-    // Reference clock is typically 100 MHz
+    // Reference clock from the VBIOS dce_info, typically 100 MHz without one
     uint32_t ref_khz = 100000;  // 100 MHz
+    const struct amdgpu_atomfw_info *vbios = amdgpu_atomfw_get(adev);
+    if (vbios && (vbios->tables & AMDGPU_ATOMFW_DCE) && vbios->dce_refclk_10khz)
+        ref_khz = vbios->dce_refclk_10khz * 10;
     
     // Calculate PLL dividers
     uint32_t fbdiv, postdiv;
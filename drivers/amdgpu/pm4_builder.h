@@ -0,0 +1,355 @@
+#ifndef PM4_BUILDER_H
+#define PM4_BUILDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../../src/amd/amdgpu/nvd.h"
+
+/*
+ * Yo! This is the PM4 Builder - how we talk to the Command Processor.
+ * Every packet is written straight into space you already reserved (a ring
+ * reservation or an IB), one dword at a time. No staging structs, no malloc,
+ * no log line per packet.
+ *
+ * Register writes are smart: if you set register N and then N+1 with the
+ * same SET_*_REG type, the second one just grows the first packet instead of
+ * paying for a new header. State setup shrinks a lot this way.
+ *
+ * If you run out of space the builder stops writing and remembers it.
+ * Check pm4_builder_ok() once at the end, not after every packet.
+ *
+ * Registers are dword offsets (the mmXXX values), packet layouts follow the
+ * Navi CP (nvd.h).
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define PM4_NO_RUN 0xFFFFFFFFu
+#define PM4_MAX_COUNT 0x3FFE // Largest count field we let a register run reach
+
+// Single-dword NOP (count 0x3FFF = "just this header" on gfx10 CPs)
+#define PM4_NOP_DWORD PACKET3(PACKET3_NOP, 0x3FFF)
+
+// IBs must be padded to this many dwords before the CP fetches them
+#define PM4_IB_ALIGN_DW 8
+
+// INDIRECT_BUFFER size field, and the bit that makes it a jump (chain)
+#define PM4_IB_SIZE_MASK 0xFFFFFu
+#define PM4_IB_CHAIN (1u << 20)
+
+// Biggest chunk one DMA_DATA can move (26-bit byte count, kept 32B aligned)
+#define PM4_DMA_DATA_MAX_BYTES (((1u << 26) - 1) & ~31u)
+
+// DMA_DATA sources and destinations through L2 (memory, not registers/GDS)
+#define PM4_DMA_DATA_SEL_L2 3
+#define PM4_DMA_DATA_SRC_DATA 2
+
+// WRITE_DATA / WAIT_REG_MEM targets
+#define PM4_DST_REG 0
+#define PM4_DST_MEM 5 // Memory, async (direct)
+#define PM4_SPACE_REG 0
+#define PM4_SPACE_MEM 1
+
+// WAIT_REG_MEM compare functions
+#define PM4_WAIT_ALWAYS 0
+#define PM4_WAIT_LT 1
+#define PM4_WAIT_LE 2
+#define PM4_WAIT_EQ 3
+#define PM4_WAIT_NE 4
+#define PM4_WAIT_GE 5
+#define PM4_WAIT_GT 6
+
+// RELEASE_MEM bits we use
+#define PM4_EVENT_CACHE_FLUSH_AND_INV_TS 0x14 // End-of-pipe timestamp event
+#define PM4_EVENT_INDEX_EOP 5
+#define PM4_DATA_SEL_NONE 0
+#define PM4_DATA_SEL_32 1
+#define PM4_DATA_SEL_64 2
+#define PM4_DATA_SEL_TIMESTAMP 3
+#define PM4_INT_SEL_NONE 0
+#define PM4_INT_SEL_ON_CONFIRM 2
+
+// Draw/dispatch initiators
+#define PM4_DI_SRC_SEL_DMA 0        // Indices come from memory
+#define PM4_DI_SRC_SEL_AUTO_INDEX 2 // 0, 1, 2, ... generated by the VGT
+#define PM4_DISPATCH_INITIATOR_DEFAULT 0x1 // COMPUTE_SHADER_EN
+
+struct pm4_builder {
+  uint32_t *buf;         // Reserved ring / IB space
+  uint32_t cdw;          // Dwords written so far
+  uint32_t max_dw;       // Size of the reservation
+  uint32_t shader_type;  // PACKET3 bit 1: set for compute queues
+  uint32_t run_start;    // Header of the open SET_*_REG run, or PM4_NO_RUN
+  uint32_t run_op;       // Its opcode
+  uint32_t run_next_reg; // Register that would extend it
+  bool overflow;         // Ran out of room at some point
+};
+
+static inline void pm4_builder_init(struct pm4_builder *b, uint32_t *buf,
+                                    uint32_t max_dw, bool compute) {
+  b->buf = buf;
+  b->cdw = 0;
+  b->max_dw = max_dw;
+  b->shader_type = compute ? (1u << 1) : 0;
+  b->run_start = PM4_NO_RUN;
+  b->run_op = 0;
+  b->run_next_reg = 0;
+  b->overflow = false;
+}
+
+static inline void pm4_builder_reset(struct pm4_builder *b) {
+  b->cdw = 0;
+  b->run_start = PM4_NO_RUN;
+  b->overflow = false;
+}
+
+static inline bool pm4_builder_ok(const struct pm4_builder *b) {
+  return !b->overflow;
+}
+
+// Make sure ndw more dwords fit, or flag the overflow and say no
+static inline bool pm4_room(struct pm4_builder *b, uint32_t ndw) {
+  if (b->overflow || b->max_dw - b->cdw < ndw) {
+    b->overflow = true;
+    return false;
+  }
+  return true;
+}
+
+static inline void pm4_emit(struct pm4_builder *b, uint32_t dw) {
+  b->buf[b->cdw++] = dw;
+}
+
+static inline void pm4_header(struct pm4_builder *b, uint32_t op,
+                              uint32_t body_dw) {
+  pm4_emit(b, PACKET3(op, body_dw - 1) | b->shader_type);
+}
+
+/* --- Register writes --- */
+
+// Write n consecutive registers starting at reg, where base is the start of
+// that register space (PACKET3_SET_*_REG_START). Extends the previous packet
+// when it ends right before reg and nothing was emitted in between.
+static inline void pm4_set_reg_seq(struct pm4_builder *b, uint32_t op,
+                                   uint32_t base, uint32_t reg,
+                                   const uint32_t *vals, uint32_t n) {
+  if (n == 0)
+    return;
+  if (b->run_start != PM4_NO_RUN && b->run_op == op &&
+      b->run_next_reg == reg &&
+      CP_PACKET_GET_COUNT(b->buf[b->run_start]) + n <= PM4_MAX_COUNT &&
+      b->run_start + 2 + CP_PACKET_GET_COUNT(b->buf[b->run_start]) == b->cdw) {
+    if (!pm4_room(b, n))
+      return;
+    b->buf[b->run_start] += n << 16; // Same header, bigger count
+  } else {
+    if (!pm4_room(b, 2 + n))
+      return;
+    b->run_start = b->cdw;
+    b->run_op = op;
+    pm4_header(b, op, 1 + n);
+    pm4_emit(b, reg - base);
+  }
+  for (uint32_t i = 0; i < n; i++)
+    pm4_emit(b, vals[i]);
+  b->run_next_reg = reg + n;
+}
+
+static inline void pm4_set_config_reg(struct pm4_builder *b, uint32_t reg,
+                                      uint32_t val) {
+  pm4_set_reg_seq(b, PACKET3_SET_CONFIG_REG, PACKET3_SET_CONFIG_REG_START, reg,
+                  &val, 1);
+}
+
+static inline void pm4_set_sh_reg(struct pm4_builder *b, uint32_t reg,
+                                  uint32_t val) {
+  pm4_set_reg_seq(b, PACKET3_SET_SH_REG, PACKET3_SET_SH_REG_START, reg, &val,
+                  1);
+}
+
+static inline void pm4_set_context_reg(struct pm4_builder *b, uint32_t reg,
+                                       uint32_t val) {
+  pm4_set_reg_seq(b, PACKET3_SET_CONTEXT_REG, PACKET3_SET_CONTEXT_REG_START,
+                  reg, &val, 1);
+}
+
+static inline void pm4_set_uconfig_reg(struct pm4_builder *b, uint32_t reg,
+                                       uint32_t val) {
+  pm4_set_reg_seq(b, PACKET3_SET_UCONFIG_REG, PACKET3_SET_UCONFIG_REG_START,
+                  reg, &val, 1);
+}
+
+/* --- Padding --- */
+
+static inline void pm4_nop(struct pm4_builder *b, uint32_t ndw) {
+  if (!pm4_room(b, ndw))
+    return;
+  while (ndw--)
+    pm4_emit(b, PM4_NOP_DWORD);
+}
+
+// Pad with NOPs until cdw is a multiple of align_dw (a power of two)
+static inline void pm4_pad(struct pm4_builder *b, uint32_t align_dw) {
+  pm4_nop(b, (align_dw - (b->cdw & (align_dw - 1))) & (align_dw - 1));
+}
+
+/* --- Memory and sync --- */
+
+// Write n dwords to memory (dst_sel PM4_DST_MEM) or a register (PM4_DST_REG)
+static inline void pm4_write_data(struct pm4_builder *b, uint32_t dst_sel,
+                                  uint64_t addr, const uint32_t *data,
+                                  uint32_t n, bool confirm) {
+  if (!pm4_room(b, 4 + n))
+    return;
+  pm4_header(b, PACKET3_WRITE_DATA, 3 + n);
+  pm4_emit(b, WRITE_DATA_DST_SEL(dst_sel) | (confirm ? WR_CONFIRM : 0));
+  pm4_emit(b, (uint32_t)addr);
+  pm4_emit(b, (uint32_t)(addr >> 32));
+  for (uint32_t i = 0; i < n; i++)
+    pm4_emit(b, data[i]);
+}
+
+// End-of-pipe write of value to addr (a fence), optionally raising an interrupt
+static inline void pm4_release_mem(struct pm4_builder *b, uint32_t event,
+                                   uint32_t gcr, uint64_t addr, uint64_t value,
+                                   uint32_t data_sel, uint32_t int_sel) {
+  if (!pm4_room(b, 8))
+    return;
+  pm4_header(b, PACKET3_RELEASE_MEM, 7);
+  pm4_emit(b, PACKET3_RELEASE_MEM_EVENT_TYPE(event) |
+                  PACKET3_RELEASE_MEM_EVENT_INDEX(PM4_EVENT_INDEX_EOP) | gcr);
+  pm4_emit(b, PACKET3_RELEASE_MEM_DATA_SEL(data_sel) |
+                  PACKET3_RELEASE_MEM_INT_SEL(int_sel));
+  pm4_emit(b, (uint32_t)addr);
+  pm4_emit(b, (uint32_t)(addr >> 32));
+  pm4_emit(b, (uint32_t)value);
+  pm4_emit(b, (uint32_t)(value >> 32));
+  pm4_emit(b, 0); // Interrupt context id
+}
+
+// Stall the CP until (*addr & mask) <func> ref
+static inline void pm4_wait_reg_mem(struct pm4_builder *b, uint32_t space,
+                                    uint32_t func, uint64_t addr, uint32_t ref,
+                                    uint32_t mask, uint32_t poll_interval) {
+  if (!pm4_room(b, 7))
+    return;
+  pm4_header(b, PACKET3_WAIT_REG_MEM, 6);
+  pm4_emit(b, WAIT_REG_MEM_FUNCTION(func) | WAIT_REG_MEM_MEM_SPACE(space));
+  pm4_emit(b, (uint32_t)addr);
+  pm4_emit(b, (uint32_t)(addr >> 32));
+  pm4_emit(b, ref);
+  pm4_emit(b, mask);
+  pm4_emit(b, poll_interval);
+}
+
+// Jump into an IB of ndw dwords and come back when it ends
+static inline void pm4_indirect_buffer(struct pm4_builder *b, uint64_t addr,
+                                       uint32_t ndw, uint32_t vmid) {
+  if (!pm4_room(b, 4))
+    return;
+  pm4_header(b, PACKET3_INDIRECT_BUFFER, 3);
+  pm4_emit(b, (uint32_t)addr & ~3u);
+  pm4_emit(b, (uint32_t)(addr >> 32) & 0xFFFF);
+  pm4_emit(b, ndw | (vmid << 24) | INDIRECT_BUFFER_VALID);
+}
+
+// Last packet of an IB: carry on in another IB and never come back. The next
+// IB's size usually isn't known yet, so this returns its size dword; put the
+// size in the low bits (PM4_IB_SIZE_MASK) once you know it.
+static inline uint32_t *pm4_chain_ib(struct pm4_builder *b, uint64_t addr,
+                                     uint32_t vmid) {
+  if (!pm4_room(b, 4))
+    return NULL;
+  pm4_header(b, PACKET3_INDIRECT_BUFFER, 3);
+  pm4_emit(b, (uint32_t)addr & ~3u);
+  pm4_emit(b, (uint32_t)(addr >> 32) & 0xFFFF);
+  pm4_emit(b, (vmid << 24) | PM4_IB_CHAIN | INDIRECT_BUFFER_VALID);
+  return &b->buf[b->cdw - 1];
+}
+
+// CP DMA, one packet per chunk. src_sel/dst_sel are PM4_DMA_DATA_SEL_L2 or
+// PM4_DMA_DATA_SRC_DATA (src is then the 32-bit fill value).
+static inline void pm4_dma_data(struct pm4_builder *b, uint32_t src_sel,
+                                uint64_t src, uint64_t dst, uint64_t bytes,
+                                bool cp_sync) {
+  while (bytes) {
+    uint32_t chunk = bytes > PM4_DMA_DATA_MAX_BYTES ? PM4_DMA_DATA_MAX_BYTES
+                                                    : (uint32_t)bytes;
+    bytes -= chunk;
+    if (!pm4_room(b, 7))
+      return;
+    pm4_header(b, PACKET3_DMA_DATA, 6);
+    // Only the last chunk waits, earlier ones can overlap
+    pm4_emit(b, PACKET3_DMA_DATA_SRC_SEL(src_sel) |
+                    PACKET3_DMA_DATA_DST_SEL(PM4_DMA_DATA_SEL_L2) |
+                    (cp_sync && !bytes ? PACKET3_DMA_DATA_CP_SYNC : 0));
+    pm4_emit(b, (uint32_t)src);
+    pm4_emit(b, (uint32_t)(src >> 32));
+    pm4_emit(b, (uint32_t)dst);
+    pm4_emit(b, (uint32_t)(dst >> 32));
+    pm4_emit(b, chunk);
+    if (src_sel != PM4_DMA_DATA_SRC_DATA)
+      src += chunk;
+    dst += chunk;
+  }
+}
+
+static inline void pm4_dma_copy(struct pm4_builder *b, uint64_t dst,
+                                uint64_t src, uint64_t bytes, bool cp_sync) {
+  pm4_dma_data(b, PM4_DMA_DATA_SEL_L2, src, dst, bytes, cp_sync);
+}
+
+static inline void pm4_dma_fill(struct pm4_builder *b, uint64_t dst,
+                                uint32_t value, uint64_t bytes, bool cp_sync) {
+  pm4_dma_data(b, PM4_DMA_DATA_SRC_DATA, value, dst, bytes, cp_sync);
+}
+
+/* --- Draws and dispatches --- */
+
+static inline void pm4_draw_index_auto(struct pm4_builder *b, uint32_t count,
+                                       uint32_t initiator) {
+  if (!pm4_room(b, 3))
+    return;
+  pm4_header(b, PACKET3_DRAW_INDEX_AUTO, 2);
+  pm4_emit(b, count);
+  pm4_emit(b, initiator);
+}
+
+static inline void pm4_draw_index_2(struct pm4_builder *b, uint32_t max_size,
+                                    uint64_t index_addr, uint32_t count,
+                                    uint32_t initiator) {
+  if (!pm4_room(b, 6))
+    return;
+  pm4_header(b, PACKET3_DRAW_INDEX_2, 5);
+  pm4_emit(b, max_size);
+  pm4_emit(b, (uint32_t)index_addr);
+  pm4_emit(b, (uint32_t)(index_addr >> 32));
+  pm4_emit(b, count);
+  pm4_emit(b, initiator);
+}
+
+static inline void pm4_dispatch_direct(struct pm4_builder *b, uint32_t x,
+                                       uint32_t y, uint32_t z,
+                                       uint32_t initiator) {
+  if (!pm4_room(b, 5))
+    return;
+  pm4_header(b, PACKET3_DISPATCH_DIRECT, 4);
+  pm4_emit(b, x);
+  pm4_emit(b, y);
+  pm4_emit(b, z);
+  pm4_emit(b, initiator);
+}
+
+// Group counts come from memory at offset (relative to the dispatch base set
+// with SET_BASE)
+static inline void pm4_dispatch_indirect(struct pm4_builder *b,
+                                         uint32_t offset, uint32_t initiator) {
+  if (!pm4_room(b, 3))
+    return;
+  pm4_header(b, PACKET3_DISPATCH_INDIRECT, 2);
+  pm4_emit(b, offset);
+  pm4_emit(b, initiator);
+}
+
+#endif
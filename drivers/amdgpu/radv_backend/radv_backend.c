@@ -10,6 +10,9 @@
 #include "radv_backend.h"
 #include "../../core/rmapi/rmapi.h"
 #include "../../core/hal/hal.h"
+#include "../../interface/ib_pool.h"
+#include "../../../os/os_interface.h"
+#include "../../../os/interface/os_log.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -67,38 +70,42 @@ static gem_buffer_t* gem_allocate(size_t size, uint32_t flags) {
  * COMMAND BUFFER SUBMISSION
  * ============================================================================ */
 
+// The ring only carries IB jumps + fences, the command streams live in the IB pool
+#define RADV_RING_DW 0x4000  // 64KB ring buffer
+
+static gpu_ring_t g_gfx_ring;
+static ib_pool_t g_ib_pool;
+
 typedef struct {
-    uint64_t ring_buffer_va;
-    size_t ring_buffer_size;
-    uint32_t write_index;
-    uint32_t read_index;
-} command_ring_t;
-
-static command_ring_t g_cmd_ring = {
-    .ring_buffer_va = 0,
-    .ring_buffer_size = 0x10000,  // 64KB ring buffer
-    .write_index = 0,
-    .read_index = 0,
-};
+    ib_stream_t ib;
+    bool recording;
+} radv_cmd_buffer_t;
+
+// Ring or IB pool full: wait for the oldest submission. Nothing runs the ring
+// in simulation, so waiting for it means retiring it right here. false if
+// nothing is in flight, i.e. waiting won't help.
+static bool radv_retire_oldest(void) {
+    uint64_t done = ib_pool_reclaim(&g_ib_pool);
+    if (done >= g_ib_pool.fence_emitted) {
+        return false;
+    }
+    ib_pool_sim_retire(&g_ib_pool, done + 1);
+    return true;
+}
 
-static int submit_command_buffer_to_ring(VkCommandBuffer cmd_buffer,
-                                         const uint8_t *cmd_data,
-                                         size_t cmd_size) {
-    if (!cmd_buffer || !cmd_data || cmd_size == 0) {
+static int submit_command_buffer_to_ring(radv_cmd_buffer_t *cmd, uint64_t *fence) {
+    if (!cmd || !cmd->ib.first) {
         return -1;
     }
-    
-    // Check ring space (simple check)
-    if (g_cmd_ring.write_index + cmd_size > g_cmd_ring.ring_buffer_size) {
-        fprintf(stderr, "[RADV] Ring buffer full, wrapping\n");
-        g_cmd_ring.write_index = 0;
+
+    // A dropped (overflowed) stream is gone, anything else waits for room
+    while (ib_submit(&cmd->ib, fence) != 0) {
+        if (!cmd->ib.first || !radv_retire_oldest())
+            return -1;
     }
-    
-    fprintf(stderr, "[RADV] Submitted %zu bytes to command ring at offset %u\n",
-            cmd_size, g_cmd_ring.write_index);
-    
-    g_cmd_ring.write_index += (cmd_size + 3) & ~3;  // Align to 4 bytes
-    
+
+    os_log_trace(OS_LOG_GFX, "[RADV] Submitted IB (fence=%llu, ring wptr=%u)\n",
+                 (unsigned long long)*fence, ring_get_wptr(&g_gfx_ring));
     return 0;
 }
 
@@ -110,8 +117,6 @@ static struct {
     int initialized;
     struct OBJGPU *gpu;
     uint32_t device_count;
-    void *cmdbuf_data;  // Command buffer data storage
-    size_t cmdbuf_size;
 } g_radv_state = {0};
 
 /* ============================================================================
@@ -133,20 +138,28 @@ VkResult radv_init(void) {
     // This is simulated mode after all
     g_radv_state.gpu = NULL;  // Will be handled by RMAPI server
     
-    // Initialize command ring buffer
-    gem_buffer_t *ring = gem_allocate(g_cmd_ring.ring_buffer_size, 0);
+    // Initialize command ring buffer and the IB pool that feeds it
+    gem_buffer_t *ring = gem_allocate(RADV_RING_DW * sizeof(uint32_t), 0);
     if (!ring) {
         fprintf(stderr, "[RADV] Failed to allocate command ring\n");
         return VK_ERROR_OUT_OF_DEVICE_MEMORY;
     }
-    g_cmd_ring.ring_buffer_va = ring->address;
+    ring_init(&g_gfx_ring, 0, RING_TYPE_GFX, 0, ring->address, RADV_RING_DW);
+    g_gfx_ring.ring_buffer = os_get_interface()->alloc_ex(RADV_RING_DW * sizeof(uint32_t), 4096,
+                                                          OS_ALLOC_USAGE_RING, 0);
+    if (!g_gfx_ring.ring_buffer || ib_pool_init(&g_ib_pool, &g_gfx_ring, 0) != 0) {
+        fprintf(stderr, "[RADV] Failed to set up command ring / IB pool\n");
+        os_get_interface()->free(g_gfx_ring.ring_buffer);
+        g_gfx_ring.ring_buffer = NULL;
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
     
     g_radv_state.device_count = 1;  // Assume single GPU for now
     g_radv_state.initialized = 1;
     
     fprintf(stderr, "[RADV] Backend initialized successfully\n");
     fprintf(stderr, "[RADV] Command ring allocated at 0x%lx (%zu bytes)\n",
-            g_cmd_ring.ring_buffer_va, g_cmd_ring.ring_buffer_size);
+            g_gfx_ring.ring_gpu_addr, (size_t)RADV_RING_DW * sizeof(uint32_t));
     return VK_SUCCESS;
 }
 
@@ -304,59 +317,103 @@ VkResult radv_allocate_command_buffer(VkDevice device,
         return VK_ERROR_DEVICE_LOST;
     }
     
-    // Allocate command buffer structure
-    VkCommandBuffer cb = (VkCommandBuffer)malloc(64);  // Dummy allocation
-    if (!cb) {
+    // Allocate command buffer structure (its IB chunks come from the pool on begin)
+    radv_cmd_buffer_t *cmd = calloc(1, sizeof(*cmd));
+    if (!cmd) {
         return VK_ERROR_OUT_OF_DEVICE_MEMORY;
     }
     
-    *cmd_buffer = cb;
+    *cmd_buffer = (VkCommandBuffer)(uintptr_t)cmd;
     
     fprintf(stderr, "[RADV] Allocated command buffer\n");
     return VK_SUCCESS;
 }
 
+void radv_free_command_buffer(VkDevice device, VkCommandBuffer cmd_buffer) {
+    (void)device;
+    radv_cmd_buffer_t *cmd = (radv_cmd_buffer_t *)(uintptr_t)cmd_buffer;
+    if (!cmd) {
+        return;
+    }
+    if (g_radv_state.initialized) {
+        ib_discard(&cmd->ib); // Still in flight? The pool holds on to it
+    }
+    free(cmd);
+}
+
 VkResult radv_begin_command_buffer(VkCommandBuffer cmd_buffer) {
-    if (!cmd_buffer) {
+    radv_cmd_buffer_t *cmd = (radv_cmd_buffer_t *)(uintptr_t)cmd_buffer;
+    if (!cmd || !g_radv_state.initialized) {
         return VK_ERROR_DEVICE_LOST;
     }
     
-    fprintf(stderr, "[RADV] Command buffer recording started\n");
+    // Re-recording resets it: the old IBs go back once the GPU is done
+    if (cmd->ib.first) {
+        ib_discard(&cmd->ib);
+    }
+    while (ib_begin(&g_ib_pool, &cmd->ib) != 0) {
+        if (!radv_retire_oldest()) {
+            return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+        }
+    }
+    cmd->recording = true;
+    
+    os_log_trace(OS_LOG_GFX, "[RADV] Command buffer recording started\n");
     return VK_SUCCESS;
 }
 
+struct pm4_builder *radv_cmd_buffer_cs(VkCommandBuffer cmd_buffer, uint32_t num_dw) {
+    radv_cmd_buffer_t *cmd = (radv_cmd_buffer_t *)(uintptr_t)cmd_buffer;
+    if (!cmd || !cmd->recording) {
+        return NULL;
+    }
+    struct pm4_builder *cs = ib_reserve(&cmd->ib, num_dw);
+    // Chaining may need a chunk that's still in flight
+    while (!cs && pm4_builder_ok(&cmd->ib.cs) &&
+           num_dw <= IB_CHUNK_DW - IB_CHAIN_RESERVE_DW && radv_retire_oldest()) {
+        cs = ib_reserve(&cmd->ib, num_dw);
+    }
+    return cs;
+}
+
 VkResult radv_end_command_buffer(VkCommandBuffer cmd_buffer) {
-    if (!cmd_buffer) {
+    radv_cmd_buffer_t *cmd = (radv_cmd_buffer_t *)(uintptr_t)cmd_buffer;
+    if (!cmd || !cmd->recording) {
         return VK_ERROR_DEVICE_LOST;
     }
     
-    fprintf(stderr, "[RADV] Command buffer recording ended\n");
+    cmd->recording = false;
+    os_log_trace(OS_LOG_GFX, "[RADV] Command buffer recording ended\n");
     return VK_SUCCESS;
 }
 
 VkResult radv_queue_submit(VkQueue queue, VkCommandBuffer cmd_buffer) {
     (void)queue;
-    if (!cmd_buffer) {
+    radv_cmd_buffer_t *cmd = (radv_cmd_buffer_t *)(uintptr_t)cmd_buffer;
+    if (!cmd || cmd->recording) {
         return VK_ERROR_DEVICE_LOST;
     }
     
-    // For simulation: use the command buffer data stored in global state
-    int ret = submit_command_buffer_to_ring(cmd_buffer,
-                                            (const uint8_t *)g_radv_state.cmdbuf_data,
-                                            g_radv_state.cmdbuf_size);
+    // Only the IB jump and the fence go on the ring, not the commands themselves
+    uint64_t fence = 0;
+    int ret = submit_command_buffer_to_ring(cmd, &fence);
     if (ret < 0) {
         fprintf(stderr, "[RADV] Failed to submit command buffer to ring\n");
         return VK_ERROR_DEVICE_LOST;
     }
     
     // Real hardware: drmIoctl(drm_fd, DRM_IOCTL_AMDGPU_CS, &cs_args);
-    fprintf(stderr, "[RADV] Command buffer submitted to hardware queue\n");
+    os_log_trace(OS_LOG_GFX, "[RADV] Command buffer submitted to hardware queue\n");
     return VK_SUCCESS;
 }
 
 VkResult radv_device_wait_idle(VkDevice device) {
     (void)device;
     fprintf(stderr, "[RADV] Waiting for device idle\n");
+    if (g_radv_state.initialized) {
+        // Simulated mode: nothing runs the ring, so retire everything here
+        ib_pool_sim_complete(&g_ib_pool);
+    }
     return VK_SUCCESS;
 }
 
@@ -365,6 +422,11 @@ void radv_fini(void) {
         return;
     }
     
+    ib_pool_fini(&g_ib_pool);
+    os_get_interface()->free(g_gfx_ring.ring_buffer);
+    ring_fini(&g_gfx_ring);
+    g_gfx_ring.ring_buffer = NULL;
+    
     rmapi_fini();
     g_radv_state.initialized = 0;
     
@@ -153,17 +153,30 @@ VkResult radv_allocate_command_buffer(VkDevice device,
                                       VkCommandBuffer *cmd_buffer);
 
 /**
- * Begin command buffer recording
+ * Free command buffer (its IBs go back once the GPU is done with them)
+ */
+void radv_free_command_buffer(VkDevice device, VkCommandBuffer cmd_buffer);
+
+/**
+ * Begin command buffer recording (resets whatever was recorded before)
  */
 VkResult radv_begin_command_buffer(VkCommandBuffer cmd_buffer);
 
+/**
+ * Get a PM4 builder with room for num_dw more dwords in the command buffer's
+ * IB (chains into a new IB chunk when the current one is full)
+ */
+struct pm4_builder;
+struct pm4_builder *radv_cmd_buffer_cs(VkCommandBuffer cmd_buffer, uint32_t num_dw);
+
 /**
  * End command buffer recording
  */
 VkResult radv_end_command_buffer(VkCommandBuffer cmd_buffer);
 
 /**
- * Submit command buffer to queue
+ * Submit command buffer to queue. It stays recorded: submit it again as
+ * often as you like until the next begin or free.
  */
 VkResult radv_queue_submit(VkQueue queue, VkCommandBuffer cmd_buffer);
 
@@ -0,0 +1,266 @@
+#ifndef SDMA_BUILDER_H
+#define SDMA_BUILDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../../src/amd/amdgpu/navi10_sdma_pkt_open.h"
+
+/*
+ * Yo! This is the SDMA Builder - packets for the copy engine.
+ * Same deal as the PM4 builder: write straight into space you reserved,
+ * run out and it stops and remembers, check sdma_builder_ok() at the end.
+ *
+ * Big copies and fills are split into as many packets as the count field
+ * needs. Linear copies that pick up exactly where the last one ended (both
+ * source and destination) just grow that packet instead of adding one, so
+ * a pile of small uploads into one staging buffer costs a single packet.
+ *
+ * Packet layouts follow the Navi SDMA (navi10_sdma_pkt_open.h).
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define SDMA_NO_COPY 0xFFFFFFFFu
+#define SDMA_COPY_MAX_BYTES (SDMA_PKT_COPY_LINEAR_COUNT_count_mask + 1u)
+#define SDMA_FILL_MAX_BYTES ((SDMA_PKT_CONSTANT_FILL_COUNT_count_mask + 1u) & ~3u)
+#define SDMA_NOP_MAX_COUNT SDMA_PKT_NOP_HEADER_count_mask
+#define SDMA_SUBWIN_MAX_DIM (SDMA_PKT_COPY_LINEAR_SUBWIN_DW_11_rect_x_mask + 1u)
+#define SDMA_SUBWIN_MAX_PITCH (SDMA_PKT_COPY_LINEAR_SUBWIN_DW_4_src_pitch_mask + 1u)
+
+#define SDMA_COPY_LINEAR_DW 7
+#define SDMA_COPY_SUBWIN_DW 13
+#define SDMA_FILL_DW 5
+#define SDMA_FENCE_DW 4
+#define SDMA_TRAP_DW 2
+#define SDMA_POLL_DW 6
+
+struct sdma_builder {
+  uint32_t *buf;     // Reserved ring / IB space
+  uint32_t cdw;      // Dwords written so far
+  uint32_t max_dw;   // Size of the reservation
+  uint32_t last_copy; // Where the last linear copy starts, or SDMA_NO_COPY
+  bool overflow;     // Ran out of room at some point
+};
+
+// One side of a sub-window copy: a box inside a linear 3D surface
+struct sdma_surface {
+  uint64_t addr;        // Start of the surface
+  uint32_t pitch;       // Elements per row
+  uint32_t slice_pitch; // Elements per slice (0 = pitch * rows, for 2D)
+  uint32_t x, y, z;     // Box origin, in elements
+};
+
+static inline void sdma_builder_init(struct sdma_builder *b, uint32_t *buf,
+                                     uint32_t max_dw) {
+  b->buf = buf;
+  b->cdw = 0;
+  b->max_dw = max_dw;
+  b->last_copy = SDMA_NO_COPY;
+  b->overflow = false;
+}
+
+static inline void sdma_builder_reset(struct sdma_builder *b) {
+  b->cdw = 0;
+  b->last_copy = SDMA_NO_COPY;
+  b->overflow = false;
+}
+
+static inline bool sdma_builder_ok(const struct sdma_builder *b) {
+  return !b->overflow;
+}
+
+// Make sure ndw more dwords fit, or flag the overflow and say no. Anything
+// emitted after this ends a linear copy run.
+static inline bool sdma_room(struct sdma_builder *b, uint32_t ndw) {
+  if (b->overflow || b->max_dw - b->cdw < ndw) {
+    b->overflow = true;
+    return false;
+  }
+  b->last_copy = SDMA_NO_COPY;
+  return true;
+}
+
+static inline void sdma_emit(struct sdma_builder *b, uint32_t dw) {
+  b->buf[b->cdw++] = dw;
+}
+
+static inline uint64_t sdma_packet_addr(const uint32_t *lo) {
+  return ((uint64_t)lo[1] << 32) | lo[0];
+}
+
+/* --- Filler --- */
+
+static inline void sdma_nop(struct sdma_builder *b, uint32_t ndw) {
+  while (ndw) {
+    uint32_t n = ndw - 1 > SDMA_NOP_MAX_COUNT ? SDMA_NOP_MAX_COUNT : ndw - 1;
+    if (!sdma_room(b, n + 1))
+      return;
+    sdma_emit(b, SDMA_PKT_NOP_HEADER_OP(SDMA_OP_NOP) |
+                     SDMA_PKT_NOP_HEADER_COUNT(n));
+    for (uint32_t i = 0; i < n; i++)
+      sdma_emit(b, 0);
+    ndw -= n + 1;
+  }
+}
+
+// Pad to a multiple of align_dw (the SDMA fetches rings and IBs in 8 dwords)
+static inline void sdma_pad(struct sdma_builder *b, uint32_t align_dw) {
+  uint32_t rem = b->cdw % align_dw;
+  if (rem)
+    sdma_nop(b, align_dw - rem);
+}
+
+/* --- Copies and fills --- */
+
+static inline void sdma_copy_linear(struct sdma_builder *b, uint64_t dst,
+                                    uint64_t src, uint64_t bytes) {
+  // Continues the previous copy on both ends? Grow it.
+  if (bytes && b->last_copy != SDMA_NO_COPY && !b->overflow) {
+    uint32_t *p = b->buf + b->last_copy;
+    uint64_t have = (uint64_t)(p[1] & SDMA_PKT_COPY_LINEAR_COUNT_count_mask) + 1;
+    if (sdma_packet_addr(p + 3) + have == src &&
+        sdma_packet_addr(p + 5) + have == dst) {
+      uint64_t grow = SDMA_COPY_MAX_BYTES - have;
+      if (grow > bytes)
+        grow = bytes;
+      p[1] = SDMA_PKT_COPY_LINEAR_COUNT_COUNT((uint32_t)(have + grow - 1));
+      src += grow;
+      dst += grow;
+      bytes -= grow;
+    }
+  }
+
+  while (bytes) {
+    uint32_t chunk = bytes > SDMA_COPY_MAX_BYTES ? SDMA_COPY_MAX_BYTES
+                                                 : (uint32_t)bytes;
+    if (!sdma_room(b, SDMA_COPY_LINEAR_DW))
+      return;
+    uint32_t start = b->cdw;
+    sdma_emit(b, SDMA_PKT_COPY_LINEAR_HEADER_OP(SDMA_OP_COPY) |
+                     SDMA_PKT_COPY_LINEAR_HEADER_SUB_OP(SDMA_SUBOP_COPY_LINEAR));
+    sdma_emit(b, SDMA_PKT_COPY_LINEAR_COUNT_COUNT(chunk - 1));
+    sdma_emit(b, 0); // Swap modes
+    sdma_emit(b, (uint32_t)src);
+    sdma_emit(b, (uint32_t)(src >> 32));
+    sdma_emit(b, (uint32_t)dst);
+    sdma_emit(b, (uint32_t)(dst >> 32));
+    b->last_copy = start;
+    src += chunk;
+    dst += chunk;
+    bytes -= chunk;
+  }
+}
+
+// Does a surface's box origin / pitches fit the sub-window fields?
+static inline bool sdma_surface_fits(const struct sdma_surface *s,
+                                     uint32_t slice) {
+  return s->pitch && s->pitch <= SDMA_SUBWIN_MAX_PITCH && slice &&
+         slice <= SDMA_PKT_COPY_LINEAR_SUBWIN_DW_5_src_slice_pitch_mask + 1u &&
+         s->x <= SDMA_PKT_COPY_LINEAR_SUBWIN_DW_3_src_x_mask &&
+         s->y <= SDMA_PKT_COPY_LINEAR_SUBWIN_DW_3_src_y_mask &&
+         s->z <= SDMA_PKT_COPY_LINEAR_SUBWIN_DW_4_src_z_mask;
+}
+
+// Copy a width x height x depth box of elements (bpp = 1, 2, 4, 8 or 16
+// bytes) between two linear surfaces. false if it doesn't fit one packet.
+static inline bool sdma_copy_sub_window(struct sdma_builder *b,
+                                        const struct sdma_surface *dst,
+                                        const struct sdma_surface *src,
+                                        uint32_t bpp, uint32_t width,
+                                        uint32_t height, uint32_t depth) {
+  uint32_t log2_bpp = bpp == 1 ? 0 : bpp == 2 ? 1 : bpp == 4 ? 2 : bpp == 8 ? 3
+                      : bpp == 16 ? 4 : 5;
+  uint64_t src_slice = src->slice_pitch ? src->slice_pitch
+                                        : (uint64_t)src->pitch * (src->y + height);
+  uint64_t dst_slice = dst->slice_pitch ? dst->slice_pitch
+                                        : (uint64_t)dst->pitch * (dst->y + height);
+  if (log2_bpp > 4 || !width || !height || !depth ||
+      width > SDMA_SUBWIN_MAX_DIM || height > SDMA_SUBWIN_MAX_DIM ||
+      depth > SDMA_PKT_COPY_LINEAR_SUBWIN_DW_12_rect_z_mask + 1u ||
+      src_slice > UINT32_MAX || dst_slice > UINT32_MAX ||
+      !sdma_surface_fits(src, (uint32_t)src_slice) ||
+      !sdma_surface_fits(dst, (uint32_t)dst_slice))
+    return false;
+  if (!sdma_room(b, SDMA_COPY_SUBWIN_DW))
+    return false;
+  sdma_emit(b, SDMA_PKT_COPY_LINEAR_SUBWIN_HEADER_OP(SDMA_OP_COPY) |
+                   SDMA_PKT_COPY_LINEAR_SUBWIN_HEADER_SUB_OP(SDMA_SUBOP_COPY_LINEAR_SUB_WIND) |
+                   SDMA_PKT_COPY_LINEAR_SUBWIN_HEADER_ELEMENTSIZE(log2_bpp));
+  sdma_emit(b, (uint32_t)src->addr);
+  sdma_emit(b, (uint32_t)(src->addr >> 32));
+  sdma_emit(b, SDMA_PKT_COPY_LINEAR_SUBWIN_DW_3_SRC_X(src->x) |
+                   SDMA_PKT_COPY_LINEAR_SUBWIN_DW_3_SRC_Y(src->y));
+  sdma_emit(b, SDMA_PKT_COPY_LINEAR_SUBWIN_DW_4_SRC_Z(src->z) |
+                   SDMA_PKT_COPY_LINEAR_SUBWIN_DW_4_SRC_PITCH(src->pitch - 1));
+  sdma_emit(b, SDMA_PKT_COPY_LINEAR_SUBWIN_DW_5_SRC_SLICE_PITCH((uint32_t)src_slice - 1));
+  sdma_emit(b, (uint32_t)dst->addr);
+  sdma_emit(b, (uint32_t)(dst->addr >> 32));
+  sdma_emit(b, SDMA_PKT_COPY_LINEAR_SUBWIN_DW_8_DST_X(dst->x) |
+                   SDMA_PKT_COPY_LINEAR_SUBWIN_DW_8_DST_Y(dst->y));
+  sdma_emit(b, SDMA_PKT_COPY_LINEAR_SUBWIN_DW_9_DST_Z(dst->z) |
+                   SDMA_PKT_COPY_LINEAR_SUBWIN_DW_9_DST_PITCH(dst->pitch - 1));
+  sdma_emit(b, SDMA_PKT_COPY_LINEAR_SUBWIN_DW_10_DST_SLICE_PITCH((uint32_t)dst_slice - 1));
+  sdma_emit(b, SDMA_PKT_COPY_LINEAR_SUBWIN_DW_11_RECT_X(width - 1) |
+                   SDMA_PKT_COPY_LINEAR_SUBWIN_DW_11_RECT_Y(height - 1));
+  sdma_emit(b, SDMA_PKT_COPY_LINEAR_SUBWIN_DW_12_RECT_Z(depth - 1));
+  return true;
+}
+
+// Fill with a 32-bit pattern. dst and bytes should be dword aligned.
+static inline void sdma_fill(struct sdma_builder *b, uint64_t dst,
+                             uint32_t value, uint64_t bytes) {
+  while (bytes) {
+    uint32_t chunk = bytes > SDMA_FILL_MAX_BYTES ? SDMA_FILL_MAX_BYTES
+                                                 : (uint32_t)bytes;
+    if (!sdma_room(b, SDMA_FILL_DW))
+      return;
+    sdma_emit(b, SDMA_PKT_CONSTANT_FILL_HEADER_OP(SDMA_OP_CONST_FILL) |
+                     SDMA_PKT_CONSTANT_FILL_HEADER_FILLSIZE(2)); // Dwords
+    sdma_emit(b, (uint32_t)dst);
+    sdma_emit(b, (uint32_t)(dst >> 32));
+    sdma_emit(b, value);
+    sdma_emit(b, SDMA_PKT_CONSTANT_FILL_COUNT_COUNT(chunk - 1));
+    dst += chunk;
+    bytes -= chunk;
+  }
+}
+
+/* --- Sync --- */
+
+// Write value to addr once everything before it is done
+static inline void sdma_fence(struct sdma_builder *b, uint64_t addr,
+                              uint32_t value) {
+  if (!sdma_room(b, SDMA_FENCE_DW))
+    return;
+  sdma_emit(b, SDMA_PKT_FENCE_HEADER_OP(SDMA_OP_FENCE));
+  sdma_emit(b, (uint32_t)addr);
+  sdma_emit(b, (uint32_t)(addr >> 32));
+  sdma_emit(b, value);
+}
+
+// Raise an interrupt carrying int_context
+static inline void sdma_trap(struct sdma_builder *b, uint32_t int_context) {
+  if (!sdma_room(b, SDMA_TRAP_DW))
+    return;
+  sdma_emit(b, SDMA_PKT_TRAP_HEADER_OP(SDMA_OP_TRAP));
+  sdma_emit(b, SDMA_PKT_TRAP_INT_CONTEXT_INT_CONTEXT(int_context));
+}
+
+// Stall until (*addr & mask) <func> ref, func is one of PM4_WAIT_*
+static inline void sdma_poll_mem(struct sdma_builder *b, uint64_t addr,
+                                 uint32_t ref, uint32_t mask, uint32_t func) {
+  if (!sdma_room(b, SDMA_POLL_DW))
+    return;
+  sdma_emit(b, SDMA_PKT_POLL_REGMEM_HEADER_OP(SDMA_OP_POLL_REGMEM) |
+                   SDMA_PKT_POLL_REGMEM_HEADER_FUNC(func) |
+                   SDMA_PKT_POLL_REGMEM_HEADER_MEM_POLL(1));
+  sdma_emit(b, (uint32_t)addr);
+  sdma_emit(b, (uint32_t)(addr >> 32));
+  sdma_emit(b, ref);
+  sdma_emit(b, mask);
+  sdma_emit(b, SDMA_PKT_POLL_REGMEM_DW5_INTERVAL(10) |
+                   SDMA_PKT_POLL_REGMEM_DW5_RETRY_COUNT(0xFFF));
+}
+
+#endif
@@ -5,6 +5,7 @@
  */
 
 #include "device_manager.h"
+#include "../../os/interface/os_log.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -26,7 +27,7 @@ int device_manager_init(void)
 {
     memset(devices, 0, sizeof(devices));
     num_devices = 0;
-    printf("[Device Manager] Initialized\n");
+    os_log_info(OS_LOG_SHIM, "[Device Manager] Initialized\n");
     return 0;
 }
 
@@ -37,7 +38,7 @@ void device_manager_fini(void)
         // TODO: cleanup device if needed
     }
     num_devices = 0;
-    printf("[Device Manager] Finalized\n");
+    os_log_info(OS_LOG_SHIM, "[Device Manager] Finalized\n");
 }
 
 /* Get or create device from FD */
@@ -50,7 +51,7 @@ rmapi_device *device_manager_get(int fd)
     }
 
     if (num_devices >= MAX_DEVICES) {
-        printf("[Device Manager] Max devices reached\n");
+        os_log_error(OS_LOG_SHIM, "[Device Manager] Max devices reached\n");
         return NULL;
     }
 
@@ -58,7 +59,7 @@ rmapi_device *device_manager_get(int fd)
     devices[num_devices].fd = fd;
     devices[num_devices].dev = (rmapi_device *)malloc(sizeof(rmapi_device));
     if (!devices[num_devices].dev) {
-        printf("[Device Manager] Failed to allocate device\n");
+        os_log_error(OS_LOG_SHIM, "[Device Manager] Failed to allocate device\n");
         return NULL;
     }
 
@@ -66,7 +67,7 @@ rmapi_device *device_manager_get(int fd)
     // For now, stub
     memset(devices[num_devices].dev, 0, sizeof(rmapi_device));
 
-    printf("[Device Manager] Created device for fd=%d\n", fd);
+    os_log_debug(OS_LOG_SHIM, "[Device Manager] Created device for fd=%d\n", fd);
     return devices[num_devices++].dev;
 }
 
@@ -125,7 +126,7 @@ int device_manager_remove(int fd)
                 devices[j] = devices[j + 1];
             }
             num_devices--;
-            printf("[Device Manager] Removed device for fd=%d\n", fd);
+            os_log_debug(OS_LOG_SHIM, "[Device Manager] Removed device for fd=%d\n", fd);
             return 0;
         }
     }
@@ -5,6 +5,7 @@
  */
 
 #include <dlfcn.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -12,6 +13,7 @@
 #include <stdbool.h>
 #include "drm_to_rmapi.h"
 #include "device_manager.h"
+#include "../../os/interface/os_log.h"
 
 // Stub types for libdrm_amdgpu
 typedef void *amdgpu_device_handle;
@@ -50,13 +52,13 @@ static int (*orig_amdgpu_device_initialize)(int fd, uint32_t *major, uint32_t *m
 __attribute__((constructor))
 static void init_shim(void)
 {
-    printf("[DRM Shim] Initializing...\n");
+    os_log_info(OS_LOG_SHIM, "[DRM Shim] Initializing...\n");
     device_manager_init();
 
     // Load original libdrm_amdgpu
     orig_lib = dlopen("libdrm_amdgpu.so.1", RTLD_LAZY);
     if (!orig_lib) {
-        fprintf(stderr, "[DRM Shim] Failed to load original libdrm_amdgpu: %s\n", dlerror());
+        os_log_error(OS_LOG_SHIM, "[DRM Shim] Failed to load original libdrm_amdgpu: %s\n", dlerror());
     }
 
     // Get function pointers
@@ -66,7 +68,7 @@ static void init_shim(void)
 __attribute__((destructor))
 static void fini_shim(void)
 {
-    printf("[DRM Shim] Finalizing...\n");
+    os_log_info(OS_LOG_SHIM, "[DRM Shim] Finalizing...\n");
     device_manager_fini();
     if (orig_lib) {
         dlclose(orig_lib);
@@ -77,7 +79,7 @@ static void fini_shim(void)
 
 int amdgpu_device_initialize(int fd, uint32_t *major, uint32_t *minor, amdgpu_device_handle *dev)
 {
-    printf("[DRM Shim] amdgpu_device_initialize(fd=%d)\n", fd);
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_device_initialize(fd=%d)\n", fd);
 
     // Get or create RMAPI device
     rmapi_device *rmapi_dev = device_manager_get(fd);
@@ -96,14 +98,14 @@ int amdgpu_device_initialize(int fd, uint32_t *major, uint32_t *minor, amdgpu_de
 
 int amdgpu_device_deinitialize(amdgpu_device_handle dev)
 {
-    printf("[DRM Shim] amdgpu_device_deinitialize(dev=%p)\n", dev);
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_device_deinitialize(dev=%p)\n", dev);
     int fd = (int)dev;
     return device_manager_remove(fd);
 }
 
 int amdgpu_bo_alloc(amdgpu_device_handle dev, struct amdgpu_bo_alloc_request *alloc_buffer, uint32_t *buf_handle)
 {
-    printf("[DRM Shim] amdgpu_bo_alloc(dev=%p, size=%llu)\n", dev, alloc_buffer->alloc_size);
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_bo_alloc(dev=%p, size=%" PRIu64 ")\n", dev, alloc_buffer->alloc_size);
     int fd = (int)dev;
     uint64_t va;
     return drm_alloc_to_rmapi(fd, alloc_buffer->alloc_size, buf_handle, &va);
@@ -111,28 +113,67 @@ int amdgpu_bo_alloc(amdgpu_device_handle dev, struct amdgpu_bo_alloc_request *al
 
 int amdgpu_bo_free(amdgpu_device_handle dev, uint32_t buf_handle)
 {
-    printf("[DRM Shim] amdgpu_bo_free(dev=%p, handle=%u)\n", dev, buf_handle);
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_bo_free(dev=%p, handle=%u)\n", dev, buf_handle);
     int fd = (int)dev;
     return drm_free_to_rmapi(fd, buf_handle);
 }
 
+int amdgpu_create_bo_from_user_mem(amdgpu_device_handle dev, void *cpu, uint64_t size, uint32_t *buf_handle)
+{
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_create_bo_from_user_mem(dev=%p, cpu=%p, size=%lu)\n", dev, cpu, size);
+    int fd = (int)(intptr_t)dev;
+    uint64_t va;
+    return drm_userptr_to_rmapi(fd, cpu, size, AMDGPU_USERPTR_FLAG_VALIDATE | AMDGPU_USERPTR_FLAG_REGISTER, buf_handle, &va);
+}
+
+/* Same values as libdrm's enum amdgpu_bo_handle_type */
+#define AMDGPU_BO_HANDLE_TYPE_GEM_FLINK_NAME 0
+#define AMDGPU_BO_HANDLE_TYPE_KMS 1
+#define AMDGPU_BO_HANDLE_TYPE_DMA_BUF_FD 2
+
+int amdgpu_bo_export(amdgpu_device_handle dev, uint32_t buf_handle, uint32_t type, uint32_t *shared_handle)
+{
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_bo_export(dev=%p, handle=%u, type=%u)\n", dev, buf_handle, type);
+    int fd = (int)(intptr_t)dev;
+    if (type == AMDGPU_BO_HANDLE_TYPE_KMS) {
+        *shared_handle = buf_handle;
+        return 0;
+    }
+    if (type != AMDGPU_BO_HANDLE_TYPE_DMA_BUF_FD)
+        return -1;  // No flink names here, they're insecure anyway
+    int prime_fd;
+    if (drm_prime_export_to_rmapi(fd, buf_handle, &prime_fd) != 0)
+        return -1;
+    *shared_handle = (uint32_t)prime_fd;
+    return 0;
+}
+
+int amdgpu_bo_import(amdgpu_device_handle dev, uint32_t type, uint32_t shared_handle, uint32_t *buf_handle, uint64_t *alloc_size)
+{
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_bo_import(dev=%p, type=%u, shared=%u)\n", dev, type, shared_handle);
+    int fd = (int)(intptr_t)dev;
+    if (type != AMDGPU_BO_HANDLE_TYPE_DMA_BUF_FD)
+        return -1;
+    return drm_prime_import_to_rmapi(fd, (int)shared_handle, buf_handle, alloc_size);
+}
+
 int amdgpu_bo_cpu_map(amdgpu_device_handle dev, uint32_t buf_handle, void **cpu)
 {
-    printf("[DRM Shim] amdgpu_bo_cpu_map(dev=%p, handle=%u)\n", dev, buf_handle);
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_bo_cpu_map(dev=%p, handle=%u)\n", dev, buf_handle);
     int fd = (int)dev;
     return drm_map_to_rmapi(fd, buf_handle, 0, 0, cpu);  // offset=0, size=0 for full map
 }
 
 int amdgpu_bo_cpu_unmap(amdgpu_device_handle dev, uint32_t buf_handle)
 {
-    printf("[DRM Shim] amdgpu_bo_cpu_unmap(dev=%p, handle=%u)\n", dev, buf_handle);
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_bo_cpu_unmap(dev=%p, handle=%u)\n", dev, buf_handle);
     int fd = (int)dev;
     return drm_unmap_to_rmapi(fd, buf_handle, NULL);
 }
 
 int amdgpu_cs_submit(amdgpu_context_handle ctx, uint32_t bo_list_handle, uint32_t num_chunks, struct drm_amdgpu_cs_chunk *chunks, uint64_t *seq_no)
 {
-    printf("[DRM Shim] amdgpu_cs_submit(ctx=%p, num_chunks=%u)\n", ctx, num_chunks);
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_cs_submit(ctx=%p, num_chunks=%u)\n", ctx, num_chunks);
 
     // TODO: Extract command buffer from chunks
     // For stub, assume first chunk is IB
@@ -150,7 +191,7 @@ int amdgpu_cs_submit(amdgpu_context_handle ctx, uint32_t bo_list_handle, uint32_
 
 int amdgpu_cs_wait_fences(amdgpu_context_handle ctx, uint32_t fence_count, uint32_t *handles, bool wait_all, uint64_t timeout_ns, uint32_t *status __attribute__((unused)), uint64_t *first __attribute__((unused)))
 {
-    printf("[DRM Shim] amdgpu_cs_wait_fences(ctx=%p, fence_count=%u)\n", ctx, fence_count);
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_cs_wait_fences(ctx=%p, fence_count=%u)\n", ctx, fence_count);
 
     int fd = 0;  // TODO: get fd from ctx
     return drm_cs_wait_to_rmapi(fd, timeout_ns);
@@ -158,7 +199,7 @@ int amdgpu_cs_wait_fences(amdgpu_context_handle ctx, uint32_t fence_count, uint3
 
 int amdgpu_query_gpu_info(amdgpu_device_handle dev, struct drm_amdgpu_info *info)
 {
-    printf("[DRM Shim] amdgpu_query_gpu_info(dev=%p)\n", dev);
+    os_log_debug(OS_LOG_SHIM, "[DRM Shim] amdgpu_query_gpu_info(dev=%p)\n", dev);
     int fd = (int)dev;
     return drm_query_gpu_info_to_rmapi(fd, info, sizeof(*info));
 }
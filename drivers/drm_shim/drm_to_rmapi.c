@@ -8,6 +8,7 @@
 #include "device_manager.h"
 #include "../../core/hal/hal.h"
 #include "../../core/rmapi/rmapi.h"
+#include "../../os/interface/os_log.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -30,24 +31,23 @@ int drm_alloc_to_rmapi(int drm_fd, uint64_t size,
     rmapi_device *dev = drm_fd_to_rmapi_device(drm_fd);
     if (!dev) return -1;
     
-    printf("[DRM→RMAPI] Allocate: size=%lu\n", size);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] Allocate: size=%lu\n", size);
     
     /* Allocate via RMAPI GPU object */
     struct OBJGPU *gpu = (struct OBJGPU *)device_manager_get_gpu(dev);
     if (!gpu) return -1;
     
-    /* Allocate GPU memory via RMAPI */
+    /* Allocate GPU memory via RMAPI (shareable, so PRIME export just works) */
     uint64_t gpu_addr;
-    int ret = rmapi_alloc_memory(gpu, size, &gpu_addr);
+    int ret = rmapi_prime_create(gpu, 0, size, handle, &gpu_addr);
     if (ret != 0) {
-        printf("[DRM→RMAPI] RMAPI alloc failed: %d\n", ret);
+        os_log_error(OS_LOG_SHIM, "[DRM→RMAPI] RMAPI alloc failed: %d\n", ret);
         return -1;
     }
 
-    *handle = (uint32_t)gpu_addr;  // Simple mapping for stub
     *va = gpu_addr;
     
-    printf("[DRM→RMAPI] ✓ handle=%u va=%lx\n", *handle, *va);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] ✓ handle=%u va=%lx\n", *handle, *va);
     return 0;
 }
 
@@ -60,7 +60,15 @@ int drm_free_to_rmapi(int drm_fd, uint32_t handle)
     struct OBJGPU *gpu = (struct OBJGPU *)device_manager_get_gpu(dev);
     if (!gpu) return -1;
 
-    printf("[DRM→RMAPI] Free: handle=%u\n", handle);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] Free: handle=%u\n", handle);
+
+    /* Userptr handles only give the pages back, never free them */
+    if (handle && rmapi_release_userptr(gpu, 0, handle) == 0)
+        return 0;
+
+    /* Shared buffers go away when the last importer lets go */
+    if (handle && rmapi_prime_unref(gpu, 0, handle) == 0)
+        return 0;
 
     if (handle) {
         uint64_t addr = (uint64_t)handle;  // Reverse mapping
@@ -70,6 +78,66 @@ int drm_free_to_rmapi(int drm_fd, uint32_t handle)
     return 0;
 }
 
+/* Userptr import via RMAPI */
+int drm_userptr_to_rmapi(int drm_fd, void *cpu, uint64_t size,
+                         uint32_t flags, uint32_t *handle, uint64_t *va)
+{
+    rmapi_device *dev = drm_fd_to_rmapi_device(drm_fd);
+    if (!dev || !handle || !va) return -1;
+
+    struct OBJGPU *gpu = (struct OBJGPU *)device_manager_get_gpu(dev);
+    if (!gpu) return -1;
+
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] Userptr: cpu=%p size=%lu flags=0x%x\n", cpu, size, flags);
+
+    /* Same process, so pid 0 = "the pointer is ours" */
+    int ret = rmapi_import_userptr(gpu, 0, (uint64_t)(uintptr_t)cpu, size,
+                                   flags, -1, 0, handle, va);
+    if (ret != 0) {
+        os_log_error(OS_LOG_SHIM, "[DRM→RMAPI] RMAPI userptr import failed: %d\n", ret);
+        return -1;
+    }
+
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] ✓ handle=%u va=%lx\n", *handle, *va);
+    return 0;
+}
+
+/* PRIME export: the fd belongs to the caller */
+int drm_prime_export_to_rmapi(int drm_fd, uint32_t handle, int *prime_fd)
+{
+    rmapi_device *dev = drm_fd_to_rmapi_device(drm_fd);
+    if (!dev || !prime_fd) return -1;
+
+    struct OBJGPU *gpu = (struct OBJGPU *)device_manager_get_gpu(dev);
+    if (!gpu) return -1;
+
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] PRIME export: handle=%u\n", handle);
+    if (rmapi_prime_export(gpu, 0, handle, prime_fd) == 0)
+        return 0;
+
+    /* A plain GEM handle on our own DRM fd: the kernel can still export it */
+    if (amdgpu_hal_get_mode() != AMDGPU_HAL_MODE_DRM)
+        return -1;
+    struct amdgpu_buffer raw = {.handle = handle};
+    return amdgpu_buffer_export_dmabuf_hal(gpu, &raw, prime_fd);
+}
+
+/* PRIME import: same fd twice gives the same handle */
+int drm_prime_import_to_rmapi(int drm_fd, int prime_fd, uint32_t *handle,
+                              uint64_t *size)
+{
+    rmapi_device *dev = drm_fd_to_rmapi_device(drm_fd);
+    if (!dev || !handle) return -1;
+
+    struct OBJGPU *gpu = (struct OBJGPU *)device_manager_get_gpu(dev);
+    if (!gpu) return -1;
+
+    uint64_t va;
+    int ret = rmapi_prime_import(gpu, 0, prime_fd, handle, &va, size);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] PRIME import: fd=%d -> handle=%u (%d)\n", prime_fd, *handle, ret);
+    return ret;
+}
+
 /* CPU mapping */
 int drm_map_to_rmapi(int drm_fd, uint32_t handle, 
                      uint64_t offset, uint64_t size, void **ptr)
@@ -77,20 +145,29 @@ int drm_map_to_rmapi(int drm_fd, uint32_t handle,
     rmapi_device *dev = drm_fd_to_rmapi_device(drm_fd);
     if (!dev || !ptr) return -1;
     
-    printf("[DRM→RMAPI] Map: handle=%u offset=%lx size=%lx\n", 
-           handle, offset, size);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] Map: handle=%u offset=%lx size=%lx\n",
+                 handle, offset, size);
     
+    /* Userptr: the app's own pages are the mapping */
+    struct amdgpu_buffer up;
+    if ((rmapi_userptr_get(handle, &up) == 0 ||
+         rmapi_prime_get(handle, &up) == 0) && up.cpu_addr) {
+        *ptr = (uint8_t *)up.cpu_addr + offset;
+        os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] ✓ ptr=%p (userptr)\n", *ptr);
+        return 0;
+    }
+
     /* For stub implementation: just return pointer to handle + offset */
     *ptr = (void *)((uintptr_t)handle + offset);
     
-    printf("[DRM→RMAPI] ✓ ptr=%p\n", *ptr);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] ✓ ptr=%p\n", *ptr);
     return 0;
 }
 
 /* CPU unmapping */
 int drm_unmap_to_rmapi(int drm_fd __attribute__((unused)), uint32_t handle, void *ptr)
 {
-    printf("[DRM→RMAPI] Unmap: handle=%u ptr=%p\n", handle, ptr);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] Unmap: handle=%u ptr=%p\n", handle, ptr);
     return 0;
 }
 
@@ -101,8 +178,8 @@ int drm_va_op_to_rmapi(int drm_fd, uint32_t handle,
     rmapi_device *dev = drm_fd_to_rmapi_device(drm_fd);
     if (!dev) return -1;
     
-    printf("[DRM→RMAPI] VA Op: handle=%u offset=%lx size=%lx va=%lx\n", 
-           handle, offset, size, va);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] VA Op: handle=%u offset=%lx size=%lx va=%lx\n",
+                 handle, offset, size, va);
     
     /* Would set up GPU page table entry via hal_va_op() */
     
@@ -116,7 +193,7 @@ int drm_cs_submit_to_rmapi(int drm_fd, void *cmd_buffer,
     rmapi_device *dev = drm_fd_to_rmapi_device(drm_fd);
     if (!dev || !cmd_buffer) return -1;
     
-    printf("[DRM→RMAPI] CS Submit: cmd_size=%u flags=%x\n", cmd_size, flags);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] CS Submit: cmd_size=%u flags=%x\n", cmd_size, flags);
     
     /* Submit command buffer to GPU via RMAPI */
     struct OBJGPU *gpu = (struct OBJGPU *)device_manager_get_gpu(dev);
@@ -138,7 +215,7 @@ int drm_cs_wait_to_rmapi(int drm_fd, uint64_t timeout_ns)
     rmapi_device *dev = drm_fd_to_rmapi_device(drm_fd);
     if (!dev) return -1;
     
-    printf("[DRM→RMAPI] CS Wait: timeout=%lu ns\n", timeout_ns);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] CS Wait: timeout=%lu ns\n", timeout_ns);
     
     /* Would wait for GPU completion via hal_wait() */
     
@@ -154,7 +231,7 @@ int drm_read_reg_to_rmapi(int drm_fd, uint32_t reg, uint32_t *val)
     struct OBJGPU *gpu = (struct OBJGPU *)device_manager_get_gpu(dev);
     if (!gpu) return -1;
 
-    printf("[DRM→RMAPI] Read reg: 0x%x\n", reg);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] Read reg: 0x%x\n", reg);
 
     /* Direct MMIO access */
     if (gpu->mmio_base && reg < gpu->mmio_size) {
@@ -175,7 +252,7 @@ int drm_write_reg_to_rmapi(int drm_fd, uint32_t reg, uint32_t val)
     struct OBJGPU *gpu = (struct OBJGPU *)device_manager_get_gpu(dev);
     if (!gpu) return -1;
 
-    printf("[DRM→RMAPI] Write reg: 0x%x = 0x%x\n", reg, val);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] Write reg: 0x%x = 0x%x\n", reg, val);
 
     /* Direct MMIO access */
     if (gpu->mmio_base && reg < gpu->mmio_size) {
@@ -195,7 +272,7 @@ int drm_query_gpu_info_to_rmapi(int drm_fd, void *info_out,
     struct OBJGPU *gpu = (struct OBJGPU *)device_manager_get_gpu(dev);
     if (!gpu) return -1;
 
-    printf("[DRM→RMAPI] Query GPU Info: size=%zu\n", info_size);
+    os_log_debug(OS_LOG_SHIM, "[DRM→RMAPI] Query GPU Info: size=%zu\n", info_size);
 
     /* Populate with GPU info */
     if (info_size >= sizeof(struct amdgpu_gpu_info)) {
@@ -28,6 +28,15 @@ int drm_alloc_to_rmapi(int drm_fd, uint64_t size,
                        uint32_t *handle, uint64_t *va);
 int drm_free_to_rmapi(int drm_fd, uint32_t handle);
 
+/* Userptr: wrap memory the app already owns (no copy) */
+int drm_userptr_to_rmapi(int drm_fd, void *cpu, uint64_t size,
+                         uint32_t flags, uint32_t *handle, uint64_t *va);
+
+/* PRIME: share buffers between processes as fds */
+int drm_prime_export_to_rmapi(int drm_fd, uint32_t handle, int *prime_fd);
+int drm_prime_import_to_rmapi(int drm_fd, int prime_fd, uint32_t *handle,
+                              uint64_t *size);
+
 int drm_map_to_rmapi(int drm_fd, uint32_t handle, 
                      uint64_t offset, uint64_t size, void **ptr);
 int drm_unmap_to_rmapi(int drm_fd, uint32_t handle, void *ptr);
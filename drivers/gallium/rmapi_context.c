@@ -11,6 +11,41 @@
 #include "rmapi_context.h"
 #include "rmapi_screen.h"
 #include "../../core/hal/hal.h"
+#include "../../core/rmapi/rmapi.h"
+
+/* Uconfig draw state (same dword offsets from GFX7 through GFX10) */
+#define mmVGT_PRIMITIVE_TYPE 0xC242
+#define mmVGT_INDEX_TYPE     0xC243
+#define mmVGT_NUM_INSTANCES  0xC24D
+
+/* Context reg, added to every index the VGT hands out - DMA'd or auto */
+#define mmVGT_INDX_OFFSET    0xA102
+#define RMAPI_INDX_OFFSET_UNKNOWN 0xFFFFFFFFu
+
+/* pipe_prim_type -> VGT DI_PT_* */
+static const uint32_t rmapi_prim_to_vgt[] = {
+    [PIPE_PRIM_POINTS] = 1,
+    [PIPE_PRIM_LINES] = 2,
+    [PIPE_PRIM_LINE_STRIP] = 3,
+    [PIPE_PRIM_TRIANGLES] = 4,
+    [PIPE_PRIM_TRIANGLE_FAN] = 5,
+    [PIPE_PRIM_TRIANGLE_STRIP] = 6,
+};
+
+/* Send whatever is in the command stream to the GPU and start over */
+static void
+rmapi_flush_cs(struct rmapi_context *ctx)
+{
+    if (ctx->cs.cdw == 0)
+        return;
+
+    struct amdgpu_command_buffer cb = {0};
+    cb.cmds = ctx->cs_buf;
+    cb.size = ctx->cs.cdw * sizeof(uint32_t);
+    rmapi_submit_command(NULL, &cb);
+    pm4_builder_reset(&ctx->cs);
+    ctx->indx_offset = RMAPI_INDX_OFFSET_UNKNOWN; /* Next IB starts clean */
+}
 
 /* Clear */
 static void
@@ -111,10 +146,40 @@ rmapi_draw_vbo(struct pipe_context *pctx, const struct pipe_draw_info *info)
     debug_printf("RMAPI: DrawVBO mode=%u count=%u start=%u\n",
                  info->mode, info->count, info->start);
     
-    /* Submit draw command to GPU via HAL */
-    if (screen->hal_handle) {
-        hal_t *hal = (hal_t *)screen->hal_handle;
-        /* hal_draw_arrays(hal, info->mode, info->start, info->count); */
+    (void)screen;
+    if (info->mode >= sizeof(rmapi_prim_to_vgt) / sizeof(rmapi_prim_to_vgt[0]) ||
+        !rmapi_prim_to_vgt[info->mode])
+        return; /* Not a primitive the VGT knows */
+
+    /* Worst case: 3 register runs + the draw packet */
+    if (ctx->cs.max_dw - ctx->cs.cdw < 20)
+        rmapi_flush_cs(ctx);
+
+    bool indexed = info->indexed && ctx->index_buffer;
+    uint32_t index_type = ctx->index_size == 4 ? 1 : 0;
+
+    /* Auto-index draws count from 0: the offset makes that start. Indexed
+     * draws read from start already and get the bias added instead. */
+    uint32_t indx_offset = indexed ? (uint32_t)info->index_bias : info->start;
+    if (indx_offset != ctx->indx_offset) {
+        pm4_set_context_reg(&ctx->cs, mmVGT_INDX_OFFSET, indx_offset);
+        ctx->indx_offset = indx_offset;
+    }
+
+    /* PRIMITIVE_TYPE and INDEX_TYPE are neighbours: one packet for both */
+    pm4_set_uconfig_reg(&ctx->cs, mmVGT_PRIMITIVE_TYPE, rmapi_prim_to_vgt[info->mode]);
+    if (indexed)
+        pm4_set_uconfig_reg(&ctx->cs, mmVGT_INDEX_TYPE, index_type);
+    pm4_set_uconfig_reg(&ctx->cs, mmVGT_NUM_INSTANCES,
+                        info->instance_count ? info->instance_count : 1);
+
+    if (indexed) {
+        uint64_t va = rmapi_resource_gpu_addr(ctx->index_buffer) +
+                      (uint64_t)info->start * ctx->index_size;
+        pm4_draw_index_2(&ctx->cs, info->count, va, info->count,
+                         PM4_DI_SRC_SEL_DMA);
+    } else {
+        pm4_draw_index_auto(&ctx->cs, info->count, PM4_DI_SRC_SEL_AUTO_INDEX);
     }
 }
 
@@ -158,6 +223,7 @@ static void
 rmapi_context_destroy(struct pipe_context *pctx)
 {
     struct rmapi_context *ctx = rmapi_context(pctx);
+    rmapi_flush_cs(ctx);
     FREE(ctx);
 }
 
@@ -173,6 +239,8 @@ rmapi_context_create(struct pipe_screen *pscreen)
     
     ctx->screen = screen;
     ctx->base.screen = pscreen;
+    pm4_builder_init(&ctx->cs, ctx->cs_buf, RMAPI_CS_DWORDS, false);
+    ctx->indx_offset = RMAPI_INDX_OFFSET_UNKNOWN;
     ctx->base.destroy = rmapi_context_destroy;
     
     /* Rendering functions */
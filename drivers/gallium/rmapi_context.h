@@ -10,6 +10,10 @@
 
 #include "pipe/p_context.h"
 #include "rmapi_screen.h"
+#include "../amdgpu/pm4_builder.h"
+
+/* Command stream size (dwords) before we have to flush */
+#define RMAPI_CS_DWORDS 4096
 
 struct rmapi_context {
     struct pipe_context base;
@@ -37,12 +41,21 @@ struct rmapi_context {
     
     /* GPU command queue */
     void *cmd_queue;
+
+    /* Packets are built in place here and submitted on flush */
+    uint32_t cs_buf[RMAPI_CS_DWORDS];
+    struct pm4_builder cs;
+    uint32_t indx_offset; /* VGT_INDX_OFFSET this IB last set */
 };
 
 /* Context creation */
 struct pipe_context *
 rmapi_context_create(struct pipe_screen *screen);
 
+/* Resource GPU address (rmapi_resource.c) */
+uint64_t
+rmapi_resource_gpu_addr(struct pipe_resource *resource);
+
 /* Cast helper */
 static inline struct rmapi_context *
 rmapi_context(struct pipe_context *pctx)
@@ -7,6 +7,7 @@
 #include "pipe/p_context.h"
 #include "pipe/p_screen.h"
 #include "util/u_memory.h"
+#include "../../os/os_interface.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -50,8 +51,10 @@ rmapi_resource_create(
     
     resource->size = size;
     
-    /* Allocate resource memory */
-    resource->data = MALLOC(size);
+    /* Allocate resource memory (render targets get huge pages, buffers don't) */
+    resource->data = os_get_interface()->alloc_ex(size, 0,
+        (template->bind & (PIPE_BIND_RENDER_TARGET | PIPE_BIND_SCANOUT)) ?
+            OS_ALLOC_USAGE_FRAMEBUFFER : OS_ALLOC_USAGE_VRAM, 0);
     if (!resource->data) {
         FREE(resource);
         return NULL;
@@ -69,7 +72,7 @@ rmapi_resource_destroy(struct pipe_screen *screen, struct pipe_resource *pt)
     
     if (resource) {
         if (resource->data)
-            FREE(resource->data);
+            os_get_interface()->free(resource->data);
         FREE(resource);
     }
 }
@@ -98,3 +101,12 @@ rmapi_resource_put_transfer(
 {
     /* No-op for RMAPI - resources are directly accessible */
 }
+
+/* Where the GPU sees the resource (same as the CPU pointer in simulation) */
+uint64_t
+rmapi_resource_gpu_addr(struct pipe_resource *resource)
+{
+    struct rmapi_resource *rresource = (struct rmapi_resource *)resource;
+
+    return rresource ? (uint64_t)(uintptr_t)rresource->data : 0;
+}
@@ -0,0 +1,278 @@
+#include "ib_pool.h"
+#include "../../os/os_interface.h"
+#include <string.h>
+
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc os_get_interface()->alloc
+#define os_prim_free os_get_interface()->free
+#define os_prim_alloc_ex os_get_interface()->alloc_ex
+
+/*
+ * Yo! This is the IB Pool - so the ring stops being a copy machine.
+ * Command streams get written once, into 16KB IB chunks carved out of big
+ * slabs, and the ring only gets a 4-dword INDIRECT_BUFFER pointing at them
+ * plus a RELEASE_MEM fence. Same deal as amdgpu_ib.c + the SA allocator.
+ *
+ * Long streams don't need one huge buffer: when a chunk fills up we end it
+ * with a chained INDIRECT_BUFFER into a fresh chunk (its size gets patched
+ * in once we know it). The CP just keeps going.
+ *
+ * A stream keeps its chunks across submits (Vulkan command buffers get
+ * submitted again without being re-recorded), every submit stamps them with
+ * its fence. Since one ring retires in order, the last fence covers all the
+ * earlier ones. A discarded stream goes on the free list if that fence has
+ * signaled, or on the busy list (sorted by fence) until it does: reclaim
+ * pops from the head. The same fence tells us how far the CP read the ring,
+ * so reclaim moves rptr up to where that submission ended.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+struct ib_slab {
+    void *mem;
+    struct ib_chunk chunks[IB_SLAB_CHUNKS];
+};
+
+#define IB_SLAB_BYTES ((size_t)IB_CHUNK_DW * 4 * IB_SLAB_CHUNKS)
+
+int ib_pool_init(ib_pool_t *pool, gpu_ring_t *ring, uint32_t vmid) {
+    if (!pool || !ring) return -1;
+    if (ring->ring_type == RING_TYPE_SDMA) {
+        os_prim_log("IB: SDMA rings don't take PM4 IBs\n");
+        return -1;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    pool->ring = ring;
+    pool->vmid = vmid;
+
+    // Every submission takes IB_SUBMIT_RING_DW, so this many fit in flight
+    pool->fence_slots = ring->ring_size / IB_SUBMIT_RING_DW + 1;
+    pool->fence_wptr = os_prim_alloc(pool->fence_slots * sizeof(uint32_t));
+    if (!pool->fence_wptr) return -1;
+
+    // The CP writes fences here, so keep it with the ring
+    pool->fence_cpu = os_prim_alloc_ex(sizeof(uint64_t), 64, OS_ALLOC_USAGE_RING, 0);
+    if (!pool->fence_cpu) {
+        os_prim_free(pool->fence_wptr);
+        pool->fence_wptr = NULL;
+        return -1;
+    }
+    *pool->fence_cpu = 0;
+    pool->fence_gpu = (uint64_t)(uintptr_t)pool->fence_cpu; // In userland, same address
+    return 0;
+}
+
+void ib_pool_fini(ib_pool_t *pool) {
+    if (!pool) return;
+    for (uint32_t i = 0; i < pool->slab_count; i++) {
+        os_prim_free(pool->slabs[i]->mem);
+        os_prim_free(pool->slabs[i]);
+    }
+    if (pool->fence_cpu)
+        os_prim_free((void *)pool->fence_cpu);
+    os_prim_free(pool->fence_wptr);
+    memset(pool, 0, sizeof(*pool));
+}
+
+// Carve another slab into chunks and put them all on the free list
+static int ib_pool_grow(ib_pool_t *pool) {
+    if (pool->slab_count >= IB_POOL_MAX_SLABS) return -1;
+
+    struct ib_slab *slab = os_prim_alloc(sizeof(*slab));
+    if (!slab) return -1;
+    slab->mem = os_prim_alloc_ex(IB_SLAB_BYTES, 4096, OS_ALLOC_USAGE_RING, 0);
+    if (!slab->mem) {
+        os_prim_free(slab);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < IB_SLAB_CHUNKS; i++) {
+        struct ib_chunk *c = &slab->chunks[i];
+        c->cpu = (uint32_t *)slab->mem + (size_t)i * IB_CHUNK_DW;
+        c->gpu = (uint64_t)(uintptr_t)c->cpu;
+        c->fence = 0;
+        c->next = pool->free_list;
+        pool->free_list = c;
+    }
+    pool->free_count += IB_SLAB_CHUNKS;
+    pool->slabs[pool->slab_count++] = slab;
+    return 0;
+}
+
+uint64_t ib_pool_reclaim(ib_pool_t *pool) {
+    if (!pool || !pool->fence_cpu) return 0;
+
+    uint64_t done = *pool->fence_cpu;
+    while (pool->busy_head && pool->busy_head->fence <= done) {
+        struct ib_chunk *c = pool->busy_head;
+        pool->busy_head = c->next;
+        c->next = pool->free_list;
+        pool->free_list = c;
+        pool->free_count++;
+    }
+
+    // The CP is past everything up to "done" on the ring too
+    if (done > pool->fence_retired && done <= pool->fence_emitted) {
+        pool->ring->rptr = pool->fence_wptr[done % pool->fence_slots];
+        pool->fence_retired = done;
+    }
+    return done;
+}
+
+void ib_pool_sim_retire(ib_pool_t *pool, uint64_t fence) {
+    if (!pool || !pool->fence_cpu) return;
+    if (fence > pool->fence_emitted) fence = pool->fence_emitted;
+    if (fence > *pool->fence_cpu) *pool->fence_cpu = fence;
+    ib_pool_reclaim(pool);
+}
+
+void ib_pool_sim_complete(ib_pool_t *pool) {
+    if (!pool || !pool->fence_cpu) return;
+    ib_pool_sim_retire(pool, pool->fence_emitted);
+    pool->ring->rptr = pool->ring->wptr; // Whatever else was on the ring too
+}
+
+static struct ib_chunk *ib_chunk_get(ib_pool_t *pool) {
+    if (!pool->free_list) ib_pool_reclaim(pool);
+    if (!pool->free_list && ib_pool_grow(pool) != 0) {
+        os_prim_log("IB: Pool exhausted (%u slabs, GPU hasn't caught up)\n",
+                    pool->slab_count);
+        return NULL;
+    }
+
+    struct ib_chunk *c = pool->free_list;
+    pool->free_list = c->next;
+    pool->free_count--;
+    c->fence = 0;
+    c->next = NULL;
+    return c;
+}
+
+static void ib_chunk_put_list(ib_pool_t *pool, struct ib_chunk *c) {
+    while (c) {
+        struct ib_chunk *next = c->next;
+        c->next = pool->free_list;
+        pool->free_list = c;
+        pool->free_count++;
+        c = next;
+    }
+}
+
+static void ib_start_chunk(ib_stream_t *ib, struct ib_chunk *c) {
+    bool compute = ib->pool->ring->ring_type == RING_TYPE_COMPUTE;
+    // Keep room at the end for padding and the chain packet
+    pm4_builder_init(&ib->cs, c->cpu, IB_CHUNK_DW - IB_CHAIN_RESERVE_DW, compute);
+}
+
+// The current chunk is done at ndw dwords: tell whoever jumps into it
+static void ib_chunk_sized(ib_stream_t *ib, uint32_t ndw) {
+    if (ib->chain_size)
+        *ib->chain_size = (*ib->chain_size & ~PM4_IB_SIZE_MASK) | ndw;
+    else
+        ib->first_ndw = ndw;
+}
+
+int ib_begin(ib_pool_t *pool, ib_stream_t *ib) {
+    if (!pool || !ib) return -1;
+
+    memset(ib, 0, sizeof(*ib));
+    ib->pool = pool;
+    ib->first = ib->cur = ib_chunk_get(pool);
+    if (!ib->first) return -1;
+    ib_start_chunk(ib, ib->first);
+    return 0;
+}
+
+// End the current chunk with a jump into a new one
+static int ib_chain(ib_stream_t *ib) {
+    struct ib_chunk *next = ib_chunk_get(ib->pool);
+    if (!next) return -1;
+
+    struct pm4_builder *cs = &ib->cs;
+    cs->max_dw = IB_CHUNK_DW; // Now we may use the reserve
+    // Pad so the chain packet is the last thing in an aligned IB
+    pm4_nop(cs, (PM4_IB_ALIGN_DW - ((cs->cdw + 4) & (PM4_IB_ALIGN_DW - 1))) &
+                    (PM4_IB_ALIGN_DW - 1));
+    uint32_t *size = pm4_chain_ib(cs, next->gpu, ib->pool->vmid);
+    if (!size) {
+        ib_chunk_put_list(ib->pool, next);
+        return -1;
+    }
+
+    ib_chunk_sized(ib, cs->cdw);
+    ib->chain_size = size;
+    ib->cur->next = next;
+    ib->cur = next;
+    ib_start_chunk(ib, next);
+    return 0;
+}
+
+struct pm4_builder *ib_reserve(ib_stream_t *ib, uint32_t num_dw) {
+    if (!ib || !ib->cur || ib->closed || num_dw > IB_CHUNK_DW - IB_CHAIN_RESERVE_DW)
+        return NULL;
+    if (!pm4_builder_ok(&ib->cs))
+        return NULL;
+    if (ib->cs.max_dw - ib->cs.cdw < num_dw && ib_chain(ib) != 0)
+        return NULL;
+    return &ib->cs;
+}
+
+void ib_discard(ib_stream_t *ib) {
+    if (!ib || !ib->pool || !ib->first) return;
+    ib_pool_t *pool = ib->pool;
+
+    // The whole chain went out together, so it shares one fence
+    uint64_t fence = ib->first->fence;
+    if (fence <= *pool->fence_cpu) {
+        ib_chunk_put_list(pool, ib->first);
+    } else {
+        struct ib_chunk **pp = &pool->busy_head;
+        while (*pp && (*pp)->fence <= fence)
+            pp = &(*pp)->next;
+        ib->cur->next = *pp;
+        *pp = ib->first;
+    }
+    ib->first = ib->cur = NULL;
+    ib->chain_size = NULL;
+}
+
+int ib_submit(ib_stream_t *ib, uint64_t *fence_out) {
+    if (!ib || !ib->first) return -1;
+    if (!ib->closed && !pm4_builder_ok(&ib->cs)) {
+        os_prim_log("IB: Stream overflowed a chunk (wrote past ib_reserve), dropped\n");
+        ib_discard(ib);
+        return -1;
+    }
+
+    ib_pool_t *pool = ib->pool;
+    uint32_t *dst = ring_reserve(pool->ring, IB_SUBMIT_RING_DW);
+    if (!dst) return -1; // Ring full: stream is kept, try again later
+
+    // First time out: close the last chunk, aligned and never empty
+    if (!ib->closed) {
+        ib->cs.max_dw = IB_CHUNK_DW;
+        if (ib->cs.cdw == 0)
+            pm4_nop(&ib->cs, PM4_IB_ALIGN_DW);
+        pm4_pad(&ib->cs, PM4_IB_ALIGN_DW);
+        ib_chunk_sized(ib, ib->cs.cdw);
+        ib->closed = true;
+    }
+
+    struct pm4_builder rb;
+    pm4_builder_init(&rb, dst, IB_SUBMIT_RING_DW, pool->ring->ring_type == RING_TYPE_COMPUTE);
+    uint64_t fence = ++pool->fence_emitted;
+    pm4_indirect_buffer(&rb, ib->first->gpu, ib->first_ndw, pool->vmid);
+    pm4_release_mem(&rb, PM4_EVENT_CACHE_FLUSH_AND_INV_TS, 0, pool->fence_gpu,
+                    fence, PM4_DATA_SEL_64, PM4_INT_SEL_ON_CONFIRM);
+    ring_commit(pool->ring, rb.cdw);
+    pool->fence_wptr[fence % pool->fence_slots] = pool->ring->wptr;
+
+    // Chunks are the GPU's until this fence shows up
+    for (struct ib_chunk *c = ib->first; c; c = c->next)
+        c->fence = fence;
+
+    if (fence_out) *fence_out = fence;
+    return 0;
+}
@@ -0,0 +1,83 @@
+// IB Pool - Indirect Buffer sub-allocation, chaining and submission
+
+#ifndef IB_POOL_H
+#define IB_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ring_mgmt.h"
+#include "../amdgpu/pm4_builder.h"
+
+// One IB chunk is 16KB; a slab of backing memory holds 16 of them
+#define IB_CHUNK_DW 4096
+#define IB_SLAB_CHUNKS 16
+#define IB_POOL_MAX_SLABS 16
+
+// Room kept at the end of every chunk for padding + the chain packet
+#define IB_CHAIN_RESERVE_DW (4 + PM4_IB_ALIGN_DW - 1)
+
+// Ring dwords per submission: INDIRECT_BUFFER + RELEASE_MEM fence
+#define IB_SUBMIT_RING_DW 12
+
+struct ib_chunk {
+    uint32_t *cpu;          // CPU mapping
+    uint64_t gpu;           // GPU VA the CP fetches from
+    uint64_t fence;         // Last submission that used it (one ring retires in order)
+    struct ib_chunk *next;  // Free list, busy list or stream chain
+};
+
+struct ib_slab;
+
+typedef struct ib_pool {
+    gpu_ring_t *ring;                 // The ring these IBs run on
+    uint32_t vmid;
+    struct ib_slab *slabs[IB_POOL_MAX_SLABS];
+    uint32_t slab_count;
+    struct ib_chunk *free_list;       // Idle chunks
+    struct ib_chunk *busy_head;       // Discarded but still in flight, oldest fence first
+    uint32_t free_count;
+    volatile uint64_t *fence_cpu;     // RELEASE_MEM writes the last done fence here
+    uint64_t fence_gpu;
+    uint64_t fence_emitted;
+    uint64_t fence_retired;           // Last fence the ring's rptr was moved past
+    uint32_t *fence_wptr;             // Ring wptr after each fence, fence % fence_slots
+    uint32_t fence_slots;
+} ib_pool_t;
+
+typedef struct ib_stream {
+    ib_pool_t *pool;
+    struct pm4_builder cs;            // Writes into the current chunk
+    struct ib_chunk *first;           // Chunk the ring jumps to
+    struct ib_chunk *cur;             // Chunk being written (end of the chain)
+    uint32_t first_ndw;               // Size of the first chunk, once known
+    uint32_t *chain_size;             // Size dword of the last chain packet
+    bool closed;                      // Submitted once: padded, no more recording
+} ib_stream_t;
+
+// One pool per ring (GFX or compute). Callers serialize access to it.
+int ib_pool_init(ib_pool_t *pool, gpu_ring_t *ring, uint32_t vmid);
+void ib_pool_fini(ib_pool_t *pool);
+
+// Recycle every chunk whose fence has signaled and give its ring space back
+// (rptr moves past it). Returns the last done fence.
+uint64_t ib_pool_reclaim(ib_pool_t *pool);
+
+// No CP behind the ring (simulation): act as if it got through "fence", or
+// through everything
+void ib_pool_sim_retire(ib_pool_t *pool, uint64_t fence);
+void ib_pool_sim_complete(ib_pool_t *pool);
+
+// Record a command stream. ib_reserve hands out a builder with room for
+// num_dw more dwords, chaining into a fresh chunk when the current one is full
+// (a single packet can't be bigger than a chunk). NULL if the pool ran dry.
+// ib_discard hands the chunks back, once the GPU is done with them.
+int ib_begin(ib_pool_t *pool, ib_stream_t *ib);
+struct pm4_builder *ib_reserve(ib_stream_t *ib, uint32_t num_dw);
+void ib_discard(ib_stream_t *ib);
+
+// Put the stream on the ring: only INDIRECT_BUFFER + fence go there, however
+// long the stream is. The stream keeps its chunks, so it can be submitted
+// again as is, until ib_discard.
+int ib_submit(ib_stream_t *ib, uint64_t *fence_out);
+
+#endif // IB_POOL_H
@@ -33,18 +33,40 @@ void ring_fini(gpu_ring_t *ring) {
     }
 }
 
-// Submit commands to ring
-int ring_submit_commands(gpu_ring_t *ring, const uint32_t *cmds, uint32_t num_cmds) {
-    if (!ring || !cmds) return -1;
+// Padding the CP skips over: a type-2 packet for GFX/compute, NOP (0) for SDMA
+#define RING_PAD_GFX 0x80000000
+#define RING_PAD_SDMA 0x00000000
 
-    // Write commands to ring buffer
-    uint32_t *ring_buf = (uint32_t *)ring->ring_buffer;
-    if (!ring_buf) return -1;
+// Dwords we can still write without running over the GPU's read pointer
+static uint32_t ring_free_dw(gpu_ring_t *ring) {
+    return (ring->rptr + ring->ring_size - ring->wptr - 1) % ring->ring_size;
+}
 
-    for (uint32_t i = 0; i < num_cmds; i++) {
-        ring_buf[ring->wptr] = cmds[i];
-        ring->wptr = (ring->wptr + 1) % ring->ring_size;
+// Reserve contiguous space. If it would wrap, pad the tail and start over at 0.
+uint32_t *ring_reserve(gpu_ring_t *ring, uint32_t num_dw) {
+    if (!ring || !ring->ring_buffer || num_dw == 0 || num_dw >= ring->ring_size)
+        return NULL;
+
+    uint32_t *ring_buf = (uint32_t *)ring->ring_buffer;
+    uint32_t tail = ring->ring_size - ring->wptr;
+    uint32_t need = num_dw + (num_dw > tail ? tail : 0);
+    if (need > ring_free_dw(ring))
+        return NULL; // GPU hasn't caught up yet
+
+    if (num_dw > tail) {
+        uint32_t pad = ring->ring_type == RING_TYPE_SDMA ? RING_PAD_SDMA : RING_PAD_GFX;
+        for (uint32_t i = 0; i < tail; i++)
+            ring_buf[ring->wptr + i] = pad;
+        ring->wptr = 0;
     }
+    return &ring_buf[ring->wptr];
+}
+
+// Publish num_dw dwords of the last reservation and kick the GPU
+int ring_commit(gpu_ring_t *ring, uint32_t num_dw) {
+    if (!ring || !ring->ring_buffer) return -1;
+
+    ring->wptr = (ring->wptr + num_dw) % ring->ring_size;
 
     // Update write pointer in hardware
     mmio_write32(0, ring->ring_base + GFX_RING_WPTR, ring->wptr);
@@ -55,6 +77,17 @@ int ring_submit_commands(gpu_ring_t *ring, const uint32_t *cmds, uint32_t num_cm
     return 0;
 }
 
+// Submit commands to ring (for callers that already built them elsewhere)
+int ring_submit_commands(gpu_ring_t *ring, const uint32_t *cmds, uint32_t num_cmds) {
+    if (!ring || !cmds) return -1;
+
+    uint32_t *dst = ring_reserve(ring, num_cmds);
+    if (!dst) return -1;
+
+    memcpy(dst, cmds, num_cmds * sizeof(uint32_t));
+    return ring_commit(ring, num_cmds);
+}
+
 // Wait for ring idle
 int ring_wait_idle(gpu_ring_t *ring, uint32_t timeout_us) {
     if (!ring) return -1;
@@ -33,6 +33,12 @@ void ring_fini(gpu_ring_t *ring);
 // Submit commands to ring
 int ring_submit_commands(gpu_ring_t *ring, const uint32_t *cmds, uint32_t num_cmds);
 
+// Zero-copy submission: reserve num_dw contiguous dwords, write packets
+// straight into them (pm4_builder.h), then commit what you actually used.
+// Returns NULL if the ring is too full. Only one reservation at a time.
+uint32_t *ring_reserve(gpu_ring_t *ring, uint32_t num_dw);
+int ring_commit(gpu_ring_t *ring, uint32_t num_dw);
+
 // Wait for ring idle
 int ring_wait_idle(gpu_ring_t *ring, uint32_t timeout_us);
 
@@ -0,0 +1,172 @@
+/*
+ * Gated Logging
+ *
+ * The slow half of os_log.h: formatting, the sink, rate limit windows and
+ * AMDGPU_LOG parsing. Everything here runs only for messages that already
+ * passed the compile-time and runtime level checks.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define _GNU_SOURCE
+#include "../interface/os_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define OS_LOG_LINE_MAX 512
+
+uint8_t os_log_level[OS_LOG_SUBSYS_COUNT] = {
+    OS_LOG_LEVEL_INFO, OS_LOG_LEVEL_INFO, OS_LOG_LEVEL_INFO,
+    OS_LOG_LEVEL_INFO, OS_LOG_LEVEL_INFO,
+};
+
+static const char *const subsys_names[OS_LOG_SUBSYS_COUNT] = {
+    "core", "hal", "rmapi", "gfx", "shim",
+};
+
+static const char *const level_names[OS_LOG_LEVEL_OFF + 1] = {
+    "trace", "debug", "info", "warn", "error", "off",
+};
+
+static os_log_sink_fn log_sink;
+static struct os_log_stats log_stats;
+
+static void default_sink(enum os_log_subsys subsys, int level,
+                         const char *msg, size_t len) {
+    (void)subsys;
+    fwrite(msg, 1, len, level >= OS_LOG_LEVEL_WARN ? stderr : stdout);
+}
+
+void os_log_vwrite(enum os_log_subsys subsys, int level, const char *fmt, va_list args) {
+    // Async backend running: queue the raw arguments, the writer formats
+    if (os_log_async_record(subsys, level, fmt, args) == 0) {
+        __atomic_fetch_add(&log_stats.emitted, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    char line[OS_LOG_LINE_MAX];
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    if (n < 0)
+        return;
+    size_t len = (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1;
+
+    __atomic_fetch_add(&log_stats.emitted, 1, __ATOMIC_RELAXED);
+    os_log_sink_fn sink = __atomic_load_n(&log_sink, __ATOMIC_ACQUIRE);
+    (sink ? sink : default_sink)(subsys, level, line, len);
+}
+
+void os_log_write(enum os_log_subsys subsys, int level, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    os_log_vwrite(subsys, level, fmt, args);
+    va_end(args);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+bool os_log_ratelimit_ok(struct os_log_ratelimit *rs, enum os_log_subsys subsys, int level) {
+    // Same idea as the kernel's ___ratelimit: whoever loses the trylock
+    // just counts as missed, a log call never waits on another
+    if (__atomic_test_and_set(&rs->busy, __ATOMIC_ACQUIRE)) {
+        __atomic_fetch_add(&rs->missed, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&log_stats.suppressed, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    uint64_t now = now_ns();
+    uint32_t missed = 0;
+    if (rs->window_start_ns == 0 ||
+        now - rs->window_start_ns >= OS_LOG_RATELIMIT_INTERVAL_MS * 1000000ull) {
+        missed = __atomic_exchange_n(&rs->missed, 0, __ATOMIC_RELAXED);
+        rs->window_start_ns = now;
+        rs->printed = 0;
+    }
+
+    bool ok = rs->printed < OS_LOG_RATELIMIT_BURST;
+    if (ok) {
+        rs->printed++;
+    } else {
+        __atomic_fetch_add(&rs->missed, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&log_stats.suppressed, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_clear(&rs->busy, __ATOMIC_RELEASE);
+
+    if (missed)
+        os_log_write(subsys, level, "LOG: %u messages suppressed\n", missed);
+    return ok;
+}
+
+static int parse_level(const char *s, size_t len) {
+    for (int i = 0; i <= OS_LOG_LEVEL_OFF; i++) {
+        if (strlen(level_names[i]) == len && strncasecmp(s, level_names[i], len) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void os_log_init(void) {
+    for (int i = 0; i < OS_LOG_SUBSYS_COUNT; i++)
+        os_log_level[i] = OS_LOG_LEVEL_INFO;
+
+    const char *env = getenv("AMDGPU_LOG");
+    if (!env)
+        return;
+
+    // "level" or "subsys=level", comma separated; junk entries are skipped
+    const char *p = env;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        const char *eq = memchr(p, '=', len);
+        if (!eq) {
+            int lvl = parse_level(p, len);
+            if (lvl >= 0) {
+                for (int i = 0; i < OS_LOG_SUBSYS_COUNT; i++)
+                    os_log_level[i] = (uint8_t)lvl;
+            }
+        } else {
+            size_t name_len = (size_t)(eq - p);
+            int lvl = parse_level(eq + 1, len - name_len - 1);
+            for (int i = 0; i < OS_LOG_SUBSYS_COUNT && lvl >= 0; i++) {
+                if (strlen(subsys_names[i]) == name_len &&
+                    strncasecmp(p, subsys_names[i], name_len) == 0)
+                    os_log_level[i] = (uint8_t)lvl;
+            }
+        }
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+}
+
+__attribute__((constructor))
+static void os_log_load(void) {
+    os_log_init();
+}
+
+void os_log_set_level(enum os_log_subsys subsys, int level) {
+    if ((int)subsys < 0 || subsys >= OS_LOG_SUBSYS_COUNT)
+        return;
+    if (level < OS_LOG_LEVEL_TRACE)
+        level = OS_LOG_LEVEL_TRACE;
+    if (level > OS_LOG_LEVEL_OFF)
+        level = OS_LOG_LEVEL_OFF;
+    os_log_level[subsys] = (uint8_t)level;
+}
+
+void os_log_set_sink(os_log_sink_fn sink) {
+    __atomic_store_n(&log_sink, sink, __ATOMIC_RELEASE);
+}
+
+void os_log_get_stats(struct os_log_stats *out) {
+    if (!out)
+        return;
+    out->emitted = __atomic_load_n(&log_stats.emitted, __ATOMIC_RELAXED);
+    out->suppressed = __atomic_load_n(&log_stats.suppressed, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,807 @@
+/*
+ * Asynchronous Binary Logging
+ *
+ * Every thread that logs gets its own single-producer ring. A log call
+ * stamps the record with the cycle counter, copies the raw arguments (and
+ * the bytes of any %s) behind the format pointer, and bumps its ring's
+ * head - no lock, no formatting, no syscall. One writer thread collects
+ * the rings, puts the records back in time order, formats them and writes
+ * whole batches to an fd opened once at start.
+ *
+ * A full ring drops the record and counts it; the writer prints how many
+ * went missing. Blocking the IPC or submission threads on a slow disk
+ * would be worse than losing a debug line.
+ *
+ * With nothing to write the writer sleeps on a condvar. Only a push that
+ * makes a ring non-empty looks at whether it sleeps (the rest stay lock
+ * free), and the wait has a long timeout for the wakeup that slips through
+ * that check.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define _GNU_SOURCE
+#include "../interface/os_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define LOG_REC_MAX 1024   // One record; messages that don't fit go as truncated text
+#define LOG_STR_MAX 255    // Bytes kept per %s argument
+#define LOG_RING_MIN 4096
+#define LOG_BATCH_BYTES (256u << 10)
+#define LOG_OUT_BYTES (64u << 10)
+
+#define LOG_REC_PAD (1u << 0)  // Filler to the end of the ring, skip it
+#define LOG_REC_TEXT (1u << 1) // Payload is already formatted text
+
+struct log_record {
+    uint32_t size;  // Header and payload, multiple of 8
+    uint8_t subsys;
+    uint8_t level;
+    uint16_t flags;
+    uint64_t stamp; // log_clock() ticks
+    const char *fmt;
+    // Payload: one 8-byte slot per argument; a %s is a length slot followed
+    // by the bytes, NUL-terminated and padded to 8
+};
+
+struct log_ring {
+    uint64_t head __attribute__((aligned(64))); // Written by the owning thread only
+    uint64_t records;                           // Owner counts, stats read
+    uint64_t dropped;
+    uint64_t tail __attribute__((aligned(64))); // Written by the writer only
+    uint64_t dropped_seen;                      // What the writer already reported
+    uint32_t size;
+    bool dead; // Owner exited, free once drained
+    struct log_ring *next;
+    uint8_t buf[] __attribute__((aligned(8)));
+};
+
+static pthread_mutex_t ctl_lock = PTHREAD_MUTEX_INITIALIZER;  // start/stop
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER; // ring_list, writer_alive
+static struct log_ring *ring_list;
+static bool writer_alive;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread struct log_ring *thread_ring;
+
+static int async_running; // Producers check this, nothing else
+static int writer_stop;
+static int writer_sleeping; // Set before the writer's last look at the rings
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t writer_thread;
+static uint32_t ring_size_cfg = OS_LOG_ASYNC_RING_SIZE;
+static enum os_log_async_target out_target;
+static int out_fd = -1;
+
+// Writer-only scratch
+static uint8_t *batch;
+static struct log_record **batch_recs;
+static char *out_buf;
+static size_t out_len;
+
+static uint64_t clock0, ns0; // Stamps are shown relative to start
+static double ns_per_tick = 1.0;
+
+static struct os_log_async_stats astats; // Retired rings plus writer counters
+
+/* ============================================================================
+ * Clock
+ * ============================================================================ */
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// TSC where we have one (a few cycles, no vDSO call), nanoseconds elsewhere
+static uint64_t log_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return mono_ns();
+#endif
+}
+
+// Recalibrated every batch from how far both clocks moved since start
+static void calibrate(void) {
+    uint64_t ticks = log_clock() - clock0;
+    uint64_t ns = mono_ns() - ns0;
+    if (ticks > 0 && ns > 0)
+        ns_per_tick = (double)ns / (double)ticks;
+}
+
+/* ============================================================================
+ * Format specs (shared by the encoder and the writer)
+ * ============================================================================ */
+
+enum { LM_NONE, LM_HH, LM_H, LM_L, LM_LL, LM_Z, LM_J, LM_T, LM_BIG_L };
+
+struct log_spec {
+    const char *end; // One past the conversion character
+    char conv;
+    uint8_t lenmod;
+    bool star_width, star_prec;
+};
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// p is at the '%'. False for what we can't defer: %n, wide chars, %m...
+static bool parse_spec(const char *p, struct log_spec *s) {
+    p++;
+    s->star_width = s->star_prec = false;
+    while (*p && strchr("-+ #0'", *p))
+        p++;
+    if (*p == '*') {
+        s->star_width = true;
+        p++;
+    }
+    while (is_digit(*p))
+        p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            s->star_prec = true;
+            p++;
+        }
+        while (is_digit(*p))
+            p++;
+    }
+
+    s->lenmod = LM_NONE;
+    switch (*p) {
+    case 'h': s->lenmod = p[1] == 'h' ? LM_HH : LM_H; p += p[1] == 'h' ? 2 : 1; break;
+    case 'l': s->lenmod = p[1] == 'l' ? LM_LL : LM_L; p += p[1] == 'l' ? 2 : 1; break;
+    case 'z': s->lenmod = LM_Z; p++; break;
+    case 'j': s->lenmod = LM_J; p++; break;
+    case 't': s->lenmod = LM_T; p++; break;
+    case 'L': s->lenmod = LM_BIG_L; p++; break;
+    default: break;
+    }
+
+    s->conv = *p;
+    if (!*p || !strchr("diouxXcspfFeEgGaA%", *p))
+        return false;
+    if (s->lenmod == LM_BIG_L && !strchr("fFeEgGaA", *p))
+        return false; // L on an integer
+    if (s->lenmod != LM_NONE && (*p == 'c' || *p == 's' || *p == 'p'))
+        return false; // Wide chars and strings
+    s->end = p + 1;
+    return true;
+}
+
+/* ============================================================================
+ * Encoding (caller side)
+ * ============================================================================ */
+
+struct log_enc {
+    uint8_t *buf;
+    size_t pos, cap;
+};
+
+static bool put_slot(struct log_enc *e, uint64_t v) {
+    if (e->pos + 8 > e->cap)
+        return false;
+    memcpy(e->buf + e->pos, &v, 8);
+    e->pos += 8;
+    return true;
+}
+
+static bool put_str(struct log_enc *e, const char *s) {
+    if (!s)
+        s = "(null)"; // What glibc prints
+    size_t n = strnlen(s, LOG_STR_MAX);
+    size_t room = (n + 8) & ~(size_t)7; // Bytes, NUL, padding
+    if (!put_slot(e, n) || e->pos + room > e->cap)
+        return false;
+    memcpy(e->buf + e->pos, s, n);
+    memset(e->buf + e->pos + n, 0, room - n);
+    e->pos += room;
+    return true;
+}
+
+static int64_t get_signed(va_list *ap, uint8_t lm) {
+    switch (lm) {
+    case LM_HH: return (signed char)va_arg(*ap, int);
+    case LM_H: return (short)va_arg(*ap, int);
+    case LM_L: return va_arg(*ap, long);
+    case LM_LL: return va_arg(*ap, long long);
+    case LM_Z: return va_arg(*ap, ssize_t);
+    case LM_J: return va_arg(*ap, intmax_t);
+    case LM_T: return va_arg(*ap, ptrdiff_t);
+    default: return va_arg(*ap, int);
+    }
+}
+
+static uint64_t get_unsigned(va_list *ap, uint8_t lm) {
+    switch (lm) {
+    case LM_HH: return (unsigned char)va_arg(*ap, unsigned int);
+    case LM_H: return (unsigned short)va_arg(*ap, unsigned int);
+    case LM_L: return va_arg(*ap, unsigned long);
+    case LM_LL: return va_arg(*ap, unsigned long long);
+    case LM_Z: return va_arg(*ap, size_t);
+    case LM_J: return va_arg(*ap, uintmax_t);
+    case LM_T: return (uint64_t)va_arg(*ap, ptrdiff_t);
+    default: return va_arg(*ap, unsigned int);
+    }
+}
+
+static bool encode_args(const char *fmt, va_list *ap, struct log_enc *e) {
+    for (const char *p = strchr(fmt, '%'); p; p = strchr(p, '%')) {
+        struct log_spec s;
+        if (!parse_spec(p, &s))
+            return false;
+        p = s.end;
+        if (s.conv == '%')
+            continue;
+        if (s.star_width && !put_slot(e, (uint64_t)(int64_t)va_arg(*ap, int)))
+            return false;
+        if (s.star_prec && !put_slot(e, (uint64_t)(int64_t)va_arg(*ap, int)))
+            return false;
+
+        uint64_t v;
+        switch (s.conv) {
+        case 'd':
+        case 'i':
+            v = (uint64_t)get_signed(ap, s.lenmod);
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            v = get_unsigned(ap, s.lenmod);
+            break;
+        case 'c':
+            v = (uint64_t)(int64_t)va_arg(*ap, int);
+            break;
+        case 'p':
+            v = (uint64_t)(uintptr_t)va_arg(*ap, void *);
+            break;
+        case 's':
+            if (!put_str(e, va_arg(*ap, const char *)))
+                return false;
+            continue;
+        default: {
+            // long double is narrowed; nothing here prints one
+            double d = s.lenmod == LM_BIG_L ? (double)va_arg(*ap, long double)
+                                            : va_arg(*ap, double);
+            memcpy(&v, &d, sizeof(v));
+            break;
+        }
+        }
+        if (!put_slot(e, v))
+            return false;
+    }
+    return true;
+}
+
+/* ============================================================================
+ * Rings
+ * ============================================================================ */
+
+static void ring_free_locked(struct log_ring *r) {
+    struct log_ring **pp = &ring_list;
+    while (*pp && *pp != r)
+        pp = &(*pp)->next;
+    if (*pp)
+        *pp = r->next;
+    astats.records += r->records;
+    astats.dropped += r->dropped;
+    free(r);
+}
+
+static void ring_thread_exit(void *p) {
+    struct log_ring *r = p;
+    pthread_mutex_lock(&ring_lock);
+    if (writer_alive)
+        r->dead = true; // Let the writer print what's left first
+    else
+        ring_free_locked(r);
+    pthread_mutex_unlock(&ring_lock);
+}
+
+static void make_ring_key(void) {
+    pthread_key_create(&ring_key, ring_thread_exit);
+}
+
+static struct log_ring *get_ring(void) {
+    struct log_ring *r = thread_ring;
+    if (__builtin_expect(r != NULL, 1))
+        return r;
+
+    // First record from this thread: the only time it takes a lock
+    pthread_once(&ring_key_once, make_ring_key);
+    uint32_t size = __atomic_load_n(&ring_size_cfg, __ATOMIC_RELAXED);
+    r = calloc(1, sizeof(*r) + size);
+    if (!r)
+        return NULL;
+    r->size = size;
+    pthread_mutex_lock(&ring_lock);
+    r->next = ring_list;
+    ring_list = r;
+    pthread_mutex_unlock(&ring_lock);
+    pthread_setspecific(ring_key, r);
+    thread_ring = r;
+    return r;
+}
+
+static void writer_wake(void) {
+    pthread_mutex_lock(&wake_lock);
+    __atomic_store_n(&writer_sleeping, 0, __ATOMIC_RELAXED);
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+}
+
+static bool ring_push(struct log_ring *r, const struct log_record *rec) {
+    uint64_t head = r->head;
+    uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    bool was_empty = head == tail;
+    uint32_t pos = (uint32_t)(head & (r->size - 1));
+    uint32_t contig = r->size - pos;
+    uint32_t need = rec->size <= contig ? rec->size : contig + rec->size;
+    if (r->size - (head - tail) < need)
+        return false;
+
+    if (rec->size > contig) {
+        // Records never wrap: pad out the end, start over at 0
+        struct log_record *pad = (struct log_record *)(r->buf + pos);
+        pad->size = contig;
+        pad->flags = LOG_REC_PAD;
+        head += contig;
+        pos = 0;
+    }
+    memcpy(r->buf + pos, rec, rec->size);
+    __atomic_store_n(&r->head, head + rec->size, __ATOMIC_RELEASE);
+    if (was_empty) {
+        // Pairs with the writer's: it sees our head or we see it asleep
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&writer_sleeping, __ATOMIC_RELAXED))
+            writer_wake();
+    }
+    return true;
+}
+
+int os_log_async_record(enum os_log_subsys subsys, int level, const char *fmt, va_list args) {
+    if (!__atomic_load_n(&async_running, __ATOMIC_ACQUIRE))
+        return -1;
+    uint64_t stamp = log_clock();
+    struct log_ring *r = get_ring();
+    if (!r)
+        return -1;
+
+    uint64_t scratch[LOG_REC_MAX / 8];
+    struct log_record *rec = (struct log_record *)scratch;
+    struct log_enc e = {(uint8_t *)scratch + sizeof(*rec), 0, LOG_REC_MAX - sizeof(*rec)};
+    va_list ap;
+    va_copy(ap, args);
+    bool deferred = encode_args(fmt, &ap, &e);
+    va_end(ap);
+
+    rec->flags = 0;
+    if (!deferred) {
+        // Something we can't carry raw (or too much of it): format here
+        int n = vsnprintf((char *)e.buf, e.cap, fmt, args);
+        e.pos = n < 0 ? 1 : ((size_t)n < e.cap ? (size_t)n : e.cap - 1) + 1;
+        if (n < 0)
+            e.buf[0] = '\0';
+        rec->flags = LOG_REC_TEXT;
+        __atomic_fetch_add(&astats.text_fallbacks, 1, __ATOMIC_RELAXED);
+    }
+    rec->size = (uint32_t)((sizeof(*rec) + e.pos + 7) & ~(size_t)7);
+    rec->subsys = (uint8_t)subsys;
+    rec->level = (uint8_t)level;
+    rec->stamp = stamp;
+    rec->fmt = fmt;
+
+    if (ring_push(r, rec))
+        __atomic_store_n(&r->records, r->records + 1, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* ============================================================================
+ * Writer
+ * ============================================================================ */
+
+static void out_write(const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(out_fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return; // Nowhere left to complain to
+        }
+        p += n;
+        len -= (size_t)n;
+        __atomic_fetch_add(&astats.bytes, (uint64_t)n, __ATOMIC_RELAXED);
+    }
+}
+
+static void out_flush(void) {
+    if (out_len)
+        out_write(out_buf, out_len);
+    out_len = 0;
+}
+
+// Rebuild one spec with '*' filled in and integer lengths widened to ll
+static size_t format_spec(char *out, size_t room, const char *p,
+                          const struct log_spec *s, const uint8_t **slot) {
+    char spec[48];
+    size_t n = 0;
+    uint64_t v;
+    for (p++; p < s->end - 1 && n < sizeof(spec) - 24; p++) {
+        if (*p == '*') {
+            memcpy(&v, *slot, 8);
+            *slot += 8;
+            n += (size_t)snprintf(spec + n, sizeof(spec) - n, "%d", (int)(int64_t)v);
+        } else if (*p == '.' && p[1] == '*') {
+            memcpy(&v, *slot, 8);
+            if ((int64_t)v >= 0) // A negative precision means none
+                n += (size_t)snprintf(spec + n, sizeof(spec) - n, ".%d", (int)(int64_t)v);
+            *slot += 8;
+            p++;
+        } else if (!strchr("hlzjtL", *p)) {
+            spec[n++] = *p;
+        }
+    }
+
+    char fmt[52];
+    bool is_int = strchr("diouxX", s->conv) != NULL;
+    snprintf(fmt, sizeof(fmt), "%%%.*s%s%c", (int)n, spec, is_int ? "ll" : "", s->conv);
+
+    int w;
+    memcpy(&v, *slot, 8);
+    *slot += 8;
+    switch (s->conv) {
+    case 'd':
+    case 'i':
+        w = snprintf(out, room, fmt, (long long)(int64_t)v);
+        break;
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+        w = snprintf(out, room, fmt, (unsigned long long)v);
+        break;
+    case 'c':
+        w = snprintf(out, room, fmt, (int)(int64_t)v);
+        break;
+    case 'p':
+        w = snprintf(out, room, fmt, (void *)(uintptr_t)v);
+        break;
+    case 's':
+        w = snprintf(out, room, fmt, (const char *)*slot); // v is the length
+        *slot += (v + 8) & ~(uint64_t)7;
+        break;
+    default: {
+        double d;
+        memcpy(&d, &v, sizeof(d));
+        w = snprintf(out, room, fmt, d);
+        break;
+    }
+    }
+    if (w < 0)
+        return 0;
+    return (size_t)w < room ? (size_t)w : room - 1;
+}
+
+static size_t format_message(const struct log_record *rec, char *out, size_t room) {
+    const uint8_t *slot = (const uint8_t *)(rec + 1);
+    if (rec->flags & LOG_REC_TEXT) {
+        size_t n = strnlen((const char *)slot, room - 1);
+        memcpy(out, slot, n);
+        return n;
+    }
+
+    size_t n = 0;
+    const char *p = rec->fmt;
+    while (*p && n < room - 1) {
+        if (*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+        struct log_spec s;
+        parse_spec(p, &s); // The encoder already accepted it
+        if (s.conv == '%')
+            out[n++] = '%';
+        else
+            n += format_spec(out + n, room - n, p, &s, &slot);
+        p = s.end;
+    }
+    return n;
+}
+
+static const int kmsg_prio[OS_LOG_LEVEL_OFF] = {7, 7, 6, 4, 3};
+
+static void emit(const struct log_record *rec) {
+    if (out_target == OS_LOG_ASYNC_KMSG) {
+        // /dev/kmsg takes one message per write and stamps it itself
+        char line[LOG_REC_MAX + 16];
+        int n = snprintf(line, sizeof(line), "<%d>amdgpu: ",
+                         kmsg_prio[rec->level < OS_LOG_LEVEL_OFF ? rec->level : OS_LOG_LEVEL_ERROR]);
+        n += (int)format_message(rec, line + n, sizeof(line) - (size_t)n);
+        out_write(line, (size_t)n);
+        return;
+    }
+
+    if (LOG_OUT_BYTES - out_len < LOG_REC_MAX + 32)
+        out_flush();
+    uint64_t ns = rec->stamp > clock0 ? (uint64_t)((double)(rec->stamp - clock0) * ns_per_tick) : 0;
+    char *out = out_buf + out_len;
+    size_t room = LOG_OUT_BYTES - out_len;
+    size_t n = (size_t)snprintf(out, room, "[%5llu.%06llu] ",
+                                (unsigned long long)(ns / 1000000000ull),
+                                (unsigned long long)(ns % 1000000000ull / 1000));
+    n += format_message(rec, out + n, room - n - 1);
+    if (n == 0 || out[n - 1] != '\n')
+        out[n++] = '\n';
+    out_len += n;
+}
+
+static int stamp_cmp(const void *a, const void *b) {
+    const struct log_record *ra = *(struct log_record *const *)a;
+    const struct log_record *rb = *(struct log_record *const *)b;
+    return ra->stamp < rb->stamp ? -1 : ra->stamp > rb->stamp;
+}
+
+// One round: copy out of every ring, then format and write without the lock
+static size_t writer_pass(void) {
+    size_t used = 0, count = 0, max = LOG_BATCH_BYTES / sizeof(struct log_record);
+    uint64_t new_drops = 0;
+
+    pthread_mutex_lock(&ring_lock);
+    struct log_ring *r = ring_list;
+    while (r) {
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = r->tail;
+        while (tail != head) {
+            const struct log_record *rec = (const void *)(r->buf + (tail & (r->size - 1)));
+            if (!(rec->flags & LOG_REC_PAD)) {
+                if (used + rec->size > LOG_BATCH_BYTES || count == max)
+                    break;
+                memcpy(batch + used, rec, rec->size);
+                batch_recs[count++] = (struct log_record *)(batch + used);
+                used += rec->size;
+            }
+            tail += rec->size;
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+        uint64_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        new_drops += dropped - r->dropped_seen;
+        r->dropped_seen = dropped;
+
+        struct log_ring *next = r->next;
+        if (r->dead && tail == head)
+            ring_free_locked(r);
+        r = next;
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    if (count == 0 && new_drops == 0)
+        return 0;
+
+    calibrate();
+    qsort(batch_recs, count, sizeof(batch_recs[0]), stamp_cmp);
+    for (size_t i = 0; i < count; i++)
+        emit(batch_recs[i]);
+
+    if (new_drops) {
+        uint64_t scratch[16];
+        struct log_record *rec = (struct log_record *)scratch;
+        snprintf((char *)(rec + 1), sizeof(scratch) - sizeof(*rec),
+                 "LOG: %llu messages dropped\n", (unsigned long long)new_drops);
+        rec->flags = LOG_REC_TEXT;
+        rec->level = OS_LOG_LEVEL_WARN;
+        rec->stamp = log_clock();
+        emit(rec);
+    }
+    out_flush();
+    __atomic_fetch_add(&astats.batches, 1, __ATOMIC_RELAXED);
+    return count ? count : 1;
+}
+
+// Nothing to write: sleep until a ring gets a record, stop, or the fallback
+static void writer_idle(void) {
+    __atomic_store_n(&writer_sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (writer_pass() > 0) { // Got one between the pass and the flag
+        __atomic_store_n(&writer_sleeping, 0, __ATOMIC_RELAXED);
+        return;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += OS_LOG_ASYNC_FLUSH_MS / 1000;
+    deadline.tv_nsec += (OS_LOG_ASYNC_FLUSH_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&wake_lock);
+    while (__atomic_load_n(&writer_sleeping, __ATOMIC_RELAXED) &&
+           !__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE) &&
+           pthread_cond_timedwait(&wake_cond, &wake_lock, &deadline) != ETIMEDOUT)
+        ;
+    __atomic_store_n(&writer_sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&wake_lock);
+    __atomic_fetch_add(&astats.wakeups, 1, __ATOMIC_RELAXED);
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE)) {
+        if (writer_pass() == 0)
+            writer_idle();
+    }
+    // Callers that got past the running check just before stop
+    struct timespec grace = {0, 2 * 1000000L};
+    nanosleep(&grace, NULL);
+    while (writer_pass() > 0)
+        ;
+    return NULL;
+}
+
+/* ============================================================================
+ * Control
+ * ============================================================================ */
+
+static void free_buffers(void) {
+    free(batch);
+    free(batch_recs);
+    free(out_buf);
+    batch = NULL;
+    batch_recs = NULL;
+    out_buf = NULL;
+    out_len = 0;
+}
+
+int os_log_async_start(enum os_log_async_target target, const char *path, uint32_t ring_size) {
+    if (ring_size == 0)
+        ring_size = OS_LOG_ASYNC_RING_SIZE;
+    if (ring_size < LOG_RING_MIN || (ring_size & (ring_size - 1)) != 0)
+        return -1;
+
+    pthread_mutex_lock(&ctl_lock);
+    if (__atomic_load_n(&async_running, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_unlock(&ctl_lock);
+        return -1;
+    }
+
+    int fd = -1;
+    switch (target) {
+    case OS_LOG_ASYNC_STDERR:
+        fd = STDERR_FILENO;
+        break;
+    case OS_LOG_ASYNC_FILE:
+        if (path)
+            fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        break;
+    case OS_LOG_ASYNC_KMSG:
+        fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+        break;
+    }
+    batch = malloc(LOG_BATCH_BYTES);
+    batch_recs = malloc(LOG_BATCH_BYTES / sizeof(struct log_record) * sizeof(batch_recs[0]));
+    out_buf = malloc(LOG_OUT_BYTES);
+    if (fd < 0 || !batch || !batch_recs || !out_buf) {
+        if (fd > STDERR_FILENO)
+            close(fd);
+        free_buffers();
+        pthread_mutex_unlock(&ctl_lock);
+        return -1;
+    }
+
+    out_target = target;
+    out_fd = fd;
+    clock0 = log_clock();
+    ns0 = mono_ns();
+    ns_per_tick = 1.0;
+    __atomic_store_n(&ring_size_cfg, ring_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&writer_stop, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&ring_lock);
+    writer_alive = true;
+    pthread_mutex_unlock(&ring_lock);
+    // The writer takes no signals: it may start from a constructor, before
+    // the server gets to block the ones it waits for itself
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(&writer_thread, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        pthread_mutex_lock(&ring_lock);
+        writer_alive = false;
+        pthread_mutex_unlock(&ring_lock);
+        if (fd > STDERR_FILENO)
+            close(fd);
+        out_fd = -1;
+        free_buffers();
+        pthread_mutex_unlock(&ctl_lock);
+        return -1;
+    }
+
+    __atomic_store_n(&async_running, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctl_lock);
+    return 0;
+}
+
+void os_log_async_stop(void) {
+    pthread_mutex_lock(&ctl_lock);
+    if (!__atomic_exchange_n(&async_running, 0, __ATOMIC_ACQ_REL)) {
+        pthread_mutex_unlock(&ctl_lock);
+        return;
+    }
+    __atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+    writer_wake();
+    pthread_join(writer_thread, NULL);
+
+    pthread_mutex_lock(&ring_lock);
+    writer_alive = false;
+    struct log_ring *r = ring_list;
+    while (r) {
+        struct log_ring *next = r->next;
+        if (r->dead)
+            ring_free_locked(r);
+        r = next;
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    if (out_fd > STDERR_FILENO)
+        close(out_fd);
+    out_fd = -1;
+    free_buffers();
+    pthread_mutex_unlock(&ctl_lock);
+}
+
+bool os_log_async_active(void) {
+    return __atomic_load_n(&async_running, __ATOMIC_ACQUIRE) != 0;
+}
+
+void os_log_async_get_stats(struct os_log_async_stats *out) {
+    if (!out)
+        return;
+    pthread_mutex_lock(&ring_lock);
+    *out = astats;
+    out->text_fallbacks = __atomic_load_n(&astats.text_fallbacks, __ATOMIC_RELAXED);
+    out->wakeups = __atomic_load_n(&astats.wakeups, __ATOMIC_RELAXED);
+    for (struct log_ring *r = ring_list; r; r = r->next) {
+        out->records += __atomic_load_n(&r->records, __ATOMIC_RELAXED);
+        out->dropped += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&ring_lock);
+}
+
+__attribute__((constructor))
+static void os_log_async_load(void) {
+    const char *env = getenv("AMDGPU_LOG_ASYNC");
+    if (!env || !*env)
+        return;
+    if (strcmp(env, "stderr") == 0)
+        os_log_async_start(OS_LOG_ASYNC_STDERR, NULL, 0);
+    else if (strcmp(env, "kmsg") == 0)
+        os_log_async_start(OS_LOG_ASYNC_KMSG, NULL, 0);
+    else if (strncmp(env, "file:", 5) == 0)
+        os_log_async_start(OS_LOG_ASYNC_FILE, env + 5, 0);
+}
+
+__attribute__((destructor))
+static void os_log_async_unload(void) {
+    os_log_async_stop();
+}
@@ -82,6 +82,8 @@ void os_prim_unlock(void) {
  * ============================================================================ */
 
 void os_prim_log(const char *fmt, ...) {
+    if (!os_log_enabled(OS_LOG_CORE, OS_LOG_LEVEL_INFO))
+        return;
     va_list args;
     va_start(args, fmt);
     fprintf(stderr, "[AMD-GPU] ");
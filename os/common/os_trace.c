@@ -0,0 +1,294 @@
+/*
+ * Structured Tracing
+ *
+ * The recording and export half of os_trace.h. Recording claims a slot in
+ * one preallocated array and fills it in; the JSON (Chrome's trace event
+ * format, which Perfetto reads too) is only written at os_trace_stop.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#define _GNU_SOURCE
+#include "../interface/os_trace.h"
+#include "../interface/os_log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define TRACE_PATH_MAX 256
+#define TRACE_GPU_TID 0x7fff0000u // GPU tracks, well clear of real tids
+
+struct trace_event {
+    uint64_t ts_ns;
+    uint64_t dur_ns;          // 'X' only
+    uint64_t value;           // Argument, counter value or flow id
+    const char *name;
+    const char *arg_name;
+    uint32_t tid;
+    uint8_t cat;
+    char phase;               // Stored last: 0 = claimed, still being filled
+};
+
+uint8_t os_trace_on;
+
+static const char *const cat_names[OS_TRACE_CAT_COUNT] = {
+    "ipc", "rmapi", "hal", "ring", "gpu",
+};
+
+static struct trace_event *trace_events;
+static uint32_t trace_cap;
+static uint64_t trace_count;   // Slots claimed, may run past trace_cap
+static uint64_t trace_dropped;
+static uint32_t trace_writers; // Recorders between their check and their store
+static FILE *trace_file;
+static char trace_path[TRACE_PATH_MAX];
+static const char *trace_tracks[OS_TRACE_TRACKS];
+static struct os_trace_stats trace_last; // What the last stop wrote
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread uint32_t trace_tid;
+
+uint64_t os_trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t trace_thread_id(void) {
+    if (!trace_tid) {
+#ifdef __linux__
+        trace_tid = (uint32_t)syscall(SYS_gettid);
+#else
+        trace_tid = (uint32_t)(uintptr_t)pthread_self() & 0x3fffffffu;
+#endif
+    }
+    return trace_tid;
+}
+
+void os_trace_record(char phase, enum os_trace_cat cat, const char *name,
+                     const char *arg_name, uint64_t value, uint64_t ts_ns,
+                     uint64_t dur_ns, uint32_t track) {
+    // Announce ourselves before looking at the switch: os_trace_stop turns
+    // it off, then waits for everybody who may have seen it on
+    __atomic_fetch_add(&trace_writers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&os_trace_on, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_sub(&trace_writers, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    uint64_t i = __atomic_fetch_add(&trace_count, 1, __ATOMIC_RELAXED);
+    if (i < trace_cap) {
+        struct trace_event *ev = &trace_events[i];
+        ev->ts_ns = ts_ns ? ts_ns : os_trace_now_ns();
+        ev->dur_ns = dur_ns;
+        ev->value = value;
+        ev->name = name;
+        ev->arg_name = arg_name;
+        ev->tid = cat == OS_TRACE_GPU ? TRACE_GPU_TID + track % OS_TRACE_TRACKS
+                                      : trace_thread_id();
+        ev->cat = (uint8_t)cat;
+        __atomic_store_n(&ev->phase, phase, __ATOMIC_RELEASE);
+    } else {
+        __atomic_fetch_add(&trace_dropped, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&trace_writers, 1, __ATOMIC_RELEASE);
+}
+
+// "%p" becomes the pid, so every process of a session gets its own file
+static void trace_expand_path(const char *path, char *out, size_t size) {
+    size_t n = 0;
+    for (const char *p = path; *p && n + 1 < size; p++) {
+        if (p[0] == '%' && p[1] == 'p') {
+            int w = snprintf(out + n, size - n, "%d", (int)getpid());
+            n = w > 0 && (size_t)w < size - n ? n + (size_t)w : size - 1;
+            p++;
+        } else {
+            out[n++] = *p;
+        }
+    }
+    out[n] = '\0';
+}
+
+int os_trace_start(const char *path, uint32_t max_events) {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file) {
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+    trace_expand_path(path ? path : OS_TRACE_DEFAULT_PATH, trace_path, sizeof(trace_path));
+    uint32_t cap = max_events ? max_events : OS_TRACE_EVENTS;
+
+    // Open now: a bad path should fail here, not after a long session
+    FILE *f = fopen(trace_path, "w");
+    struct trace_event *events = f ? calloc(cap, sizeof(*events)) : NULL;
+    if (!events) {
+        if (f)
+            fclose(f);
+        pthread_mutex_unlock(&trace_lock);
+        os_log_error(OS_LOG_CORE, "Trace: Can't start %s (%s)\n", trace_path,
+                     f ? "out of memory" : strerror(errno));
+        return -1;
+    }
+
+    trace_file = f;
+    trace_events = events;
+    trace_cap = cap;
+    __atomic_store_n(&trace_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&trace_dropped, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&os_trace_on, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&trace_lock);
+    os_log_info(OS_LOG_CORE, "Trace: Recording to %s\n", trace_path);
+    return 0;
+}
+
+static void trace_write_ts(FILE *f, uint64_t ns) {
+    fprintf(f, "%llu.%03llu", (unsigned long long)(ns / 1000),
+            (unsigned long long)(ns % 1000));
+}
+
+static const char *trace_flow_name(uint64_t id) {
+    if (id >> 63)
+        return "job";
+    return (id >> 62) & 1 ? "reply" : "request";
+}
+
+static void trace_write_event(FILE *f, int pid, const struct trace_event *ev) {
+    const char *cat = cat_names[ev->cat < OS_TRACE_CAT_COUNT ? ev->cat : 0];
+    const char *name = ev->name ? ev->name : "";
+
+    fprintf(f, ",\n{\"ph\":\"%c\",\"pid\":%d,\"tid\":%u,\"ts\":", ev->phase, pid, ev->tid);
+    trace_write_ts(f, ev->ts_ns);
+    switch (ev->phase) {
+    case 's':
+    case 'f':
+        // Both ends need the same cat/name/id to pair up
+        fprintf(f, ",\"cat\":\"flow\",\"name\":\"%s\",\"id\":\"0x%llx\"%s}",
+                trace_flow_name(ev->value), (unsigned long long)ev->value,
+                ev->phase == 'f' ? ",\"bp\":\"e\"" : "");
+        break;
+    case 'C':
+        fprintf(f, ",\"cat\":\"%s\",\"name\":\"%s\",\"args\":{\"%s\":%lld}}", cat, name,
+                name, (long long)ev->value);
+        break;
+    case 'X':
+        fprintf(f, ",\"dur\":");
+        trace_write_ts(f, ev->dur_ns);
+        /* fall through */
+    default:
+        fprintf(f, ",\"cat\":\"%s\",\"name\":\"%s\"", cat, name);
+        if (ev->arg_name)
+            fprintf(f, ",\"args\":{\"%s\":%llu}", ev->arg_name,
+                    (unsigned long long)ev->value);
+        fputc('}', f);
+        break;
+    }
+}
+
+static void trace_write_meta(FILE *f, int pid, uint32_t tid, const char *what,
+                             const char *name) {
+    fprintf(f, ",\n{\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"name\":\"%s\",\"args\":{\"name\":\"%s\"}}",
+            pid, tid, what, name);
+}
+
+int os_trace_stop(void) {
+    pthread_mutex_lock(&trace_lock);
+    if (!trace_file) {
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+
+    // Off, then wait out whoever was already past the check
+    __atomic_store_n(&os_trace_on, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&trace_writers, __ATOMIC_ACQUIRE))
+        sched_yield();
+
+    uint64_t claimed = __atomic_load_n(&trace_count, __ATOMIC_RELAXED);
+    uint64_t n = claimed < trace_cap ? claimed : trace_cap;
+    int pid = (int)getpid();
+    FILE *f = trace_file;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+#ifdef __GLIBC__
+    fprintf(f, "{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"process_name\","
+               "\"args\":{\"name\":\"%s\"}}",
+            pid, pid, program_invocation_short_name);
+#else
+    fprintf(f, "{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"process_name\","
+               "\"args\":{\"name\":\"amdgpu\"}}",
+            pid, pid);
+#endif
+    for (uint32_t t = 0; t < OS_TRACE_TRACKS; t++) {
+        const char *name = __atomic_load_n(&trace_tracks[t], __ATOMIC_ACQUIRE);
+        if (name)
+            trace_write_meta(f, pid, TRACE_GPU_TID + t, "thread_name", name);
+    }
+    uint64_t written = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        if (!trace_events[i].phase)
+            continue; // Never happens once the writers are out, but cheap
+        trace_write_event(f, pid, &trace_events[i]);
+        written++;
+    }
+    fprintf(f, "\n]}\n");
+
+    int ret = ferror(f) ? -1 : 0;
+    if (fclose(f) != 0)
+        ret = -1;
+    trace_file = NULL;
+    free(trace_events);
+    trace_events = NULL;
+    trace_cap = 0;
+    trace_last.events = written;
+    trace_last.dropped = __atomic_load_n(&trace_dropped, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace_lock);
+
+    if (ret != 0)
+        os_log_error(OS_LOG_CORE, "Trace: Writing %s failed\n", trace_path);
+    else
+        os_log_info(OS_LOG_CORE, "Trace: %llu events (%llu dropped) in %s\n",
+                    (unsigned long long)trace_last.events,
+                    (unsigned long long)trace_last.dropped, trace_path);
+    return ret;
+}
+
+bool os_trace_active(void) {
+    return __atomic_load_n(&os_trace_on, __ATOMIC_RELAXED) != 0;
+}
+
+void os_trace_name_track(uint32_t track, const char *name) {
+    if (track < OS_TRACE_TRACKS)
+        __atomic_store_n(&trace_tracks[track], name, __ATOMIC_RELEASE);
+}
+
+void os_trace_get_stats(struct os_trace_stats *out) {
+    if (!out)
+        return;
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file) {
+        uint64_t claimed = __atomic_load_n(&trace_count, __ATOMIC_RELAXED);
+        out->events = claimed < trace_cap ? claimed : trace_cap;
+        out->dropped = __atomic_load_n(&trace_dropped, __ATOMIC_RELAXED);
+    } else {
+        *out = trace_last;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+__attribute__((constructor))
+static void os_trace_load(void) {
+    const char *env = getenv("AMDGPU_TRACE");
+    if (env && *env)
+        os_trace_start(env, 0);
+}
+
+__attribute__((destructor))
+static void os_trace_unload(void) {
+    os_trace_stop();
+}
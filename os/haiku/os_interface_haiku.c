@@ -3,6 +3,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* Forward declarations from generic stub */
 extern int os_pci_find_device(uint16_t vendor, uint16_t device, void **handle);
@@ -35,6 +36,19 @@ void haiku_log(const char *fmt, ...) {
     va_end(args);
 }
 
+/* No hugetlb or mbind here: just honor the alignment */
+void *haiku_alloc_ex(size_t size, size_t align, uint32_t usage, uint32_t flags) {
+    (void)usage;
+    void *ptr = NULL;
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+    if (posix_memalign(&ptr, align, size) != 0)
+        return NULL;
+    if (flags & OS_ALLOC_FLAG_PREFAULT)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
 /* Wrapper functions to match interface signatures */
 int haiku_pci_find_device(uint16_t vendor, uint16_t device, os_pci_device *dev) {
     return os_pci_find_device(vendor, device, &dev->handle);
@@ -66,6 +80,7 @@ struct os_interface haiku_os_interface = {
     .display_put_pixel = os_display_put_pixel,
     .alloc = os_prim_alloc,
     .free = os_prim_free,
+    .alloc_ex = haiku_alloc_ex,
     .log = os_prim_log,
     .prim_pci_find_device = os_prim_pci_find_device,
     .prim_pci_get_ids = os_prim_pci_get_ids,
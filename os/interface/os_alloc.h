@@ -0,0 +1,24 @@
+#ifndef OS_ALLOC_H
+#define OS_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// What the memory is for - picks sensible defaults (huge pages, NUMA, prefault)
+enum os_alloc_usage {
+    OS_ALLOC_USAGE_GENERIC = 0,
+    OS_ALLOC_USAGE_VRAM,        // Simulated VRAM / GPU buffers
+    OS_ALLOC_USAGE_FRAMEBUFFER, // Scanout and render targets
+    OS_ALLOC_USAGE_RING,        // Command rings: small, hot, latency critical
+    OS_ALLOC_USAGE_STAGING      // Short-lived upload/readback copies
+};
+
+#define OS_ALLOC_FLAG_PREFAULT (1u << 0)   // Fault every page in now, not on first use
+#define OS_ALLOC_FLAG_HUGE (1u << 1)       // Back with huge pages even below the size cutoff
+#define OS_ALLOC_FLAG_NUMA_LOCAL (1u << 2) // Keep the pages on the caller's NUMA node
+
+// align 0 = default. Always release with os_prim_free, never free() or
+// realloc(): big ones are mmap'd. Plain os_prim_alloc stays malloc.
+void *os_prim_alloc_ex(size_t size, size_t align, uint32_t usage, uint32_t flags);
+
+#endif // OS_ALLOC_H
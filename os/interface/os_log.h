@@ -0,0 +1,141 @@
+#ifndef OS_LOG_H
+#define OS_LOG_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Gated logging for hot paths (per buffer, per packet, per ioctl)
+//
+// Two gates, both in front of the formatting:
+//  - OS_LOG_MIN_LEVEL at compile time. Calls below it are constant-false
+//    and disappear, arguments included. Release builds get INFO.
+//  - os_log_level[subsys] at runtime: one compare against a global that
+//    only changes when AMDGPU_LOG is parsed. Arguments aren't evaluated
+//    unless the message goes out.
+//
+// AMDGPU_LOG="debug" sets every subsystem, "hal=trace,shim=debug" just
+// those (names in os_log_subsys), "off" silences everything.
+
+#define OS_LOG_LEVEL_TRACE 0
+#define OS_LOG_LEVEL_DEBUG 1
+#define OS_LOG_LEVEL_INFO 2
+#define OS_LOG_LEVEL_WARN 3
+#define OS_LOG_LEVEL_ERROR 4
+#define OS_LOG_LEVEL_OFF 5
+
+#ifndef OS_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define OS_LOG_MIN_LEVEL OS_LOG_LEVEL_INFO
+#else
+#define OS_LOG_MIN_LEVEL OS_LOG_LEVEL_TRACE
+#endif
+#endif
+
+enum os_log_subsys {
+    OS_LOG_CORE = 0, // os_prim_log and everything not listed below
+    OS_LOG_HAL,
+    OS_LOG_RMAPI,
+    OS_LOG_GFX,      // Command building: PM4, 2D, SDMA
+    OS_LOG_SHIM,     // DRM shim and its RMAPI translation
+    OS_LOG_SUBSYS_COUNT
+};
+
+// Runtime limits, INFO until AMDGPU_LOG says otherwise
+extern uint8_t os_log_level[OS_LOG_SUBSYS_COUNT];
+
+#define os_log_enabled(subsys, lvl) \
+    ((lvl) >= OS_LOG_MIN_LEVEL && __builtin_expect((lvl) >= os_log_level[subsys], 0))
+
+#define os_log_at(subsys, lvl, ...) \
+    do { \
+        if (os_log_enabled(subsys, lvl)) \
+            os_log_write(subsys, lvl, __VA_ARGS__); \
+    } while (0)
+
+#define os_log_trace(subsys, ...) os_log_at(subsys, OS_LOG_LEVEL_TRACE, __VA_ARGS__)
+#define os_log_debug(subsys, ...) os_log_at(subsys, OS_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define os_log_info(subsys, ...) os_log_at(subsys, OS_LOG_LEVEL_INFO, __VA_ARGS__)
+#define os_log_warn(subsys, ...) os_log_at(subsys, OS_LOG_LEVEL_WARN, __VA_ARGS__)
+#define os_log_error(subsys, ...) os_log_at(subsys, OS_LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// Rate limiting: each call site gets OS_LOG_RATELIMIT_BURST messages per
+// OS_LOG_RATELIMIT_INTERVAL_MS, then a "suppressed" count when the next
+// window opens. For errors a bad client can trigger on every packet.
+#define OS_LOG_RATELIMIT_INTERVAL_MS 5000
+#define OS_LOG_RATELIMIT_BURST 10
+
+struct os_log_ratelimit {
+    uint64_t window_start_ns;
+    uint32_t printed;
+    uint32_t missed;
+    uint8_t busy; // Trylock: a contended call site drops, never waits
+};
+
+#define os_log_ratelimited(subsys, lvl, ...) \
+    do { \
+        static struct os_log_ratelimit os_log_rs_; \
+        if (os_log_enabled(subsys, lvl) && os_log_ratelimit_ok(&os_log_rs_, subsys, lvl)) \
+            os_log_write(subsys, lvl, __VA_ARGS__); \
+    } while (0)
+
+// Where formatted messages go. Default: stdout, WARN and up on stderr
+typedef void (*os_log_sink_fn)(enum os_log_subsys subsys, int level,
+                               const char *msg, size_t len);
+
+struct os_log_stats {
+    uint64_t emitted;    // Passed both gates and the rate limit
+    uint64_t suppressed; // Dropped by a rate limit
+};
+
+void os_log_write(enum os_log_subsys subsys, int level, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+void os_log_vwrite(enum os_log_subsys subsys, int level, const char *fmt, va_list args);
+bool os_log_ratelimit_ok(struct os_log_ratelimit *rs, enum os_log_subsys subsys, int level);
+
+void os_log_init(void); // (Re)reads AMDGPU_LOG, runs on library load
+void os_log_set_level(enum os_log_subsys subsys, int level);
+void os_log_set_sink(os_log_sink_fn sink); // NULL = default
+void os_log_get_stats(struct os_log_stats *out);
+
+// Asynchronous backend
+//
+// While running, a log call doesn't format: it appends a binary record
+// (timestamp, format pointer, raw arguments, copied strings) to its
+// thread's ring and returns. A writer thread merges the rings in time
+// order, formats, and writes in batches to one fd that stays open. A full
+// ring drops the record and counts it; the writer reports the count.
+//
+// Formats must be string constants - the writer reads them later.
+// AMDGPU_LOG_ASYNC="stderr", "kmsg" or "file:<path>" starts it on load.
+
+enum os_log_async_target {
+    OS_LOG_ASYNC_STDERR = 0,
+    OS_LOG_ASYNC_FILE,
+    OS_LOG_ASYNC_KMSG
+};
+
+#define OS_LOG_ASYNC_RING_SIZE (64u << 10) // Per thread, power of two
+#define OS_LOG_ASYNC_FLUSH_MS 500          // Idle writer's fallback flush, in case a wakeup got lost
+
+struct os_log_async_stats {
+    uint64_t records;        // Went through a ring
+    uint64_t dropped;        // Ring full
+    uint64_t text_fallbacks; // Format the encoder can't defer, formatted in place
+    uint64_t batches;
+    uint64_t bytes;          // Written to the target
+    uint64_t wakeups;        // Idle writer woke up (a ring got a record, or the fallback)
+};
+
+// ring_size 0 = OS_LOG_ASYNC_RING_SIZE. path only for OS_LOG_ASYNC_FILE (appended to)
+int os_log_async_start(enum os_log_async_target target, const char *path, uint32_t ring_size);
+void os_log_async_stop(void); // Drains everything and closes the fd
+bool os_log_async_active(void);
+void os_log_async_get_stats(struct os_log_async_stats *out);
+
+// os_log_vwrite's fast path: 0 = taken care of (queued or dropped),
+// -1 = not running, format synchronously
+int os_log_async_record(enum os_log_subsys subsys, int level, const char *fmt, va_list args);
+
+#endif // OS_LOG_H
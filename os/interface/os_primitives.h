@@ -4,12 +4,15 @@
 #include <stdint.h>
 #include <stddef.h>
 
-// Logging
+// Logging (INFO on OS_LOG_CORE; hot paths use the gated macros in os_log.h)
 void os_prim_log(const char *fmt, ...);
+#include "os_log.h"
+#include "os_trace.h"
 
 // Memory management
 void *os_prim_alloc(size_t size);
 void os_prim_free(void *ptr);
+#include "os_alloc.h" // os_prim_alloc_ex and its hints
 
 // PCI primitives
 int os_prim_pci_find_device(uint16_t vendor, uint16_t device, void **handle);
@@ -0,0 +1,126 @@
+#ifndef OS_TRACE_H
+#define OS_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Structured tracing: spans, flows, counters and GPU tracks, exported as
+// Chrome/Perfetto JSON (ui.perfetto.dev, chrome://tracing)
+//
+// Always compiled in, off by default. While off, every call below is one
+// relaxed load and a not-taken branch, arguments not evaluated. Turn it on
+// with os_trace_start() or AMDGPU_TRACE=<file> on load; the server also
+// flips it on SIGUSR2. The file is written at os_trace_stop().
+//
+// Events land in a fixed array claimed with one atomic add, nothing is
+// formatted until the stop. A full array drops events and counts them.
+// Names must be string constants - they're read at the stop.
+//
+// Timestamps are CLOCK_MONOTONIC, so a client's trace and the server's line
+// up: "%p" in the path becomes the pid, and
+//   jq -s '{traceEvents: map(.traceEvents) | add}' a.json b.json
+// merges them. Flows then connect the two sides of every IPC request.
+
+enum os_trace_cat {
+    OS_TRACE_IPC = 0, // Requests, client and server side
+    OS_TRACE_RMAPI,
+    OS_TRACE_HAL,
+    OS_TRACE_RING,    // Scheduler: jobs going onto rings, ring fill
+    OS_TRACE_GPU,     // GPU timeline, from fences
+    OS_TRACE_CAT_COUNT
+};
+
+#define OS_TRACE_EVENTS (1u << 18)           // Default capacity, 48 bytes each
+#define OS_TRACE_DEFAULT_PATH "/tmp/amdgpu-trace-%p.json"
+#define OS_TRACE_TRACKS 16                   // GPU tracks (one per ring)
+
+// Flow ids. The client and the server compute the same one for a request:
+// its pid and msg.id. Replies and ring jobs get id spaces of their own.
+#define OS_TRACE_FLOW_REQUEST(pid, id) (((uint64_t)(uint32_t)(pid) << 32) | (uint32_t)(id))
+#define OS_TRACE_FLOW_REPLY(pid, id) ((1ull << 62) | OS_TRACE_FLOW_REQUEST(pid, id))
+#define OS_TRACE_FLOW_JOB(ring, seq) \
+    ((1ull << 63) | ((uint64_t)(ring) << 48) | ((seq) & 0xFFFFFFFFFFFFull))
+
+extern uint8_t os_trace_on;
+
+#define os_trace_enabled() __builtin_expect(__atomic_load_n(&os_trace_on, __ATOMIC_RELAXED), 0)
+
+// The one recorder behind the macros. ts_ns 0 = now. Events in
+// OS_TRACE_GPU go on GPU track "track", everything else on the calling thread.
+void os_trace_record(char phase, enum os_trace_cat cat, const char *name,
+                     const char *arg_name, uint64_t value, uint64_t ts_ns,
+                     uint64_t dur_ns, uint32_t track);
+
+#define os_trace_at(...) \
+    do { \
+        if (os_trace_enabled()) \
+            os_trace_record(__VA_ARGS__); \
+    } while (0)
+
+// Spans on the calling thread. arg_name may be NULL.
+#define os_trace_begin(cat, name, arg_name, arg) \
+    os_trace_at('B', cat, name, arg_name, arg, 0, 0, 0)
+#define os_trace_end(cat, name) os_trace_at('E', cat, name, NULL, 0, 0, 0, 0)
+
+// Arrows between spans: the start binds to the span open on this thread,
+// the end to the span open where it lands (any thread, any process)
+#define os_trace_flow_start(id) os_trace_at('s', OS_TRACE_IPC, NULL, NULL, id, 0, 0, 0)
+#define os_trace_flow_end(id) os_trace_at('f', OS_TRACE_IPC, NULL, NULL, id, 0, 0, 0)
+
+#define os_trace_counter(cat, name, value) \
+    os_trace_at('C', cat, name, NULL, (uint64_t)(value), 0, 0, 0)
+
+// A finished job on GPU track "track" (os_trace_name_track), with the flow
+// that submitted it landing on it. flow 0 = none.
+#define os_trace_gpu_slice(track, name, start_ns, end_ns, seq, flow) \
+    do { \
+        if (os_trace_enabled()) { \
+            os_trace_record('X', OS_TRACE_GPU, name, "seq", seq, start_ns, \
+                            (end_ns) - (start_ns), track); \
+            if (flow) \
+                os_trace_record('f', OS_TRACE_GPU, NULL, NULL, flow, start_ns, 0, \
+                                track); \
+        } \
+    } while (0)
+
+// A span that ends with the enclosing block, whatever way it's left
+struct os_trace_scope {
+    const char *name;
+    uint8_t cat;
+    bool on; // Begun while tracing: only then does it get its end
+};
+
+static inline struct os_trace_scope os_trace_scope_begin_(enum os_trace_cat cat,
+                                                          const char *name) {
+    struct os_trace_scope s = {name, (uint8_t)cat, false};
+    if (os_trace_enabled()) {
+        os_trace_record('B', cat, name, NULL, 0, 0, 0, 0);
+        s.on = true;
+    }
+    return s;
+}
+
+static inline void os_trace_scope_end_(struct os_trace_scope *s) {
+    if (s->on)
+        os_trace_record('E', (enum os_trace_cat)s->cat, s->name, NULL, 0, 0, 0, 0);
+}
+
+#define os_trace_scope(cat, name) \
+    struct os_trace_scope os_trace_scope_ \
+        __attribute__((cleanup(os_trace_scope_end_))) = os_trace_scope_begin_(cat, name)
+
+struct os_trace_stats {
+    uint64_t events;  // Recorded since the last start
+    uint64_t dropped; // Array full
+};
+
+// path NULL = OS_TRACE_DEFAULT_PATH, max_events 0 = OS_TRACE_EVENTS
+int os_trace_start(const char *path, uint32_t max_events);
+int os_trace_stop(void); // Writes the JSON; -1 if it wasn't running or the write failed
+bool os_trace_active(void);
+void os_trace_name_track(uint32_t track, const char *name);
+uint64_t os_trace_now_ns(void);
+void os_trace_get_stats(struct os_trace_stats *out);
+
+#endif // OS_TRACE_H
@@ -4,6 +4,7 @@
 // Forward declarations of primitives
 void *os_prim_alloc(size_t size);
 void os_prim_free(void *ptr);
+void *os_prim_alloc_ex(size_t size, size_t align, uint32_t usage, uint32_t flags);
 void os_prim_log(const char *fmt, ...);
 int os_prim_pci_find_device(uint16_t vendor, uint16_t device, void **handle);
 void os_prim_pci_get_ids(void *pci_handle, uint16_t *vendor, uint16_t *device);
@@ -65,6 +66,7 @@ struct os_interface linux_os_interface = {
     .display_put_pixel = linux_display_put_pixel,
     .alloc = os_prim_alloc,
     .free = os_prim_free,
+    .alloc_ex = os_prim_alloc_ex,
     .log = os_prim_log,
     .prim_pci_find_device = os_prim_pci_find_device,
     .prim_pci_get_ids = os_prim_pci_get_ids,
@@ -1,25 +1,218 @@
-#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 #include "../interface/os_primitives.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
-// Logging
+// Logging: checked against the core level before va_start, so AMDGPU_LOG=off
+// (or warn) makes it a compare and a return
 void os_prim_log(const char *fmt, ...) {
+    if (!os_log_enabled(OS_LOG_CORE, OS_LOG_LEVEL_INFO))
+        return;
     va_list args;
     va_start(args, fmt);
-    vprintf(fmt, args);
+    os_log_vwrite(OS_LOG_CORE, OS_LOG_LEVEL_INFO, fmt, args);
     va_end(args);
 }
 
 // Memory management
+//
+// os_prim_alloc is plain malloc, whatever the size: callers may realloc it
+// or hand it to free(). Big buffers (simulated VRAM, framebuffers) opt in
+// through os_prim_alloc_ex and get their own mmap so we can ask for huge
+// pages - a 4K-backed 8MB framebuffer burns 2048 TLB entries, a huge-page
+// one burns 4.
+#define OS_ALLOC_PAGE 4096u
+#define OS_ALLOC_HUGE_PAGE (2u << 20)
+#define OS_ALLOC_MMAP_CUTOFF (256u << 10) // Below this malloc is just fine
+#define OS_ALLOC_DEFAULT_ALIGN 64u        // Cache line / AVX-512 friendly
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+// mmap'd regions, so os_prim_free knows which free to call
+struct os_mmap_region {
+    void *addr;
+    size_t len;
+    struct os_mmap_region *next;
+};
+
+#define OS_MMAP_HASH_SIZE 64
+static struct os_mmap_region *mmap_regions[OS_MMAP_HASH_SIZE];
+static pthread_mutex_t mmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned mmap_hash(void *addr) {
+    return (unsigned)(((uintptr_t)addr >> 12) % OS_MMAP_HASH_SIZE);
+}
+
+static int mmap_remember(void *addr, size_t len) {
+    struct os_mmap_region *r = malloc(sizeof(*r));
+    if (!r)
+        return -1;
+    r->addr = addr;
+    r->len = len;
+    pthread_mutex_lock(&mmap_lock);
+    unsigned h = mmap_hash(addr);
+    r->next = mmap_regions[h];
+    mmap_regions[h] = r;
+    pthread_mutex_unlock(&mmap_lock);
+    return 0;
+}
+
+static size_t mmap_forget(void *addr) {
+    size_t len = 0;
+    pthread_mutex_lock(&mmap_lock);
+    struct os_mmap_region **pp = &mmap_regions[mmap_hash(addr)];
+    while (*pp && (*pp)->addr != addr)
+        pp = &(*pp)->next;
+    struct os_mmap_region *r = *pp;
+    if (r) {
+        *pp = r->next;
+        len = r->len;
+    }
+    pthread_mutex_unlock(&mmap_lock);
+    free(r);
+    return len;
+}
+
+// Usage classes pick the defaults, explicit flags add to them
+static uint32_t alloc_usage_flags(uint32_t usage, size_t size) {
+    switch (usage) {
+    case OS_ALLOC_USAGE_VRAM:
+    case OS_ALLOC_USAGE_FRAMEBUFFER:
+        return OS_ALLOC_FLAG_NUMA_LOCAL |
+               (size >= OS_ALLOC_HUGE_PAGE ? OS_ALLOC_FLAG_HUGE : 0);
+    case OS_ALLOC_USAGE_RING:
+        return OS_ALLOC_FLAG_NUMA_LOCAL | OS_ALLOC_FLAG_PREFAULT;
+    case OS_ALLOC_USAGE_STAGING:
+        return 0; // Streamed once, not worth a huge page
+    default:
+        return size >= OS_ALLOC_HUGE_PAGE ? OS_ALLOC_FLAG_HUGE : 0;
+    }
+}
+
+// Prefer the NUMA node the caller is running on (only matters on multi-socket boxes)
+static void alloc_bind_local(void *addr, size_t len) {
+#if defined(SYS_mbind) && defined(SYS_getcpu)
+    static int multi_node = -1;
+    if (multi_node < 0)
+        multi_node = access("/sys/devices/system/node/node1", F_OK) == 0;
+    if (!multi_node)
+        return;
+
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= 64)
+        return;
+    unsigned long mask = 1ul << node;
+    syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, 8 * sizeof(mask) + 1, 0);
+#else
+    (void)addr;
+    (void)len;
+#endif
+}
+
+static void alloc_prefault(void *addr, size_t len) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(addr, len, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    // Older kernels: touch one byte per page ourselves
+    for (size_t off = 0; off < len; off += OS_ALLOC_PAGE)
+        ((volatile char *)addr)[off] = 0;
+}
+
+void *os_prim_alloc_ex(size_t size, size_t align, uint32_t usage, uint32_t flags) {
+    if (size == 0)
+        return NULL;
+    if (align == 0)
+        align = OS_ALLOC_DEFAULT_ALIGN;
+    if (align & (align - 1))
+        return NULL; // Must be a power of two
+    flags |= alloc_usage_flags(usage, size);
+
+    if (size < OS_ALLOC_MMAP_CUTOFF && !(flags & OS_ALLOC_FLAG_HUGE) && align <= OS_ALLOC_PAGE) {
+        void *ptr = NULL;
+        if (posix_memalign(&ptr, align < sizeof(void *) ? sizeof(void *) : align, size) != 0)
+            return NULL;
+        if (flags & OS_ALLOC_FLAG_PREFAULT)
+            memset(ptr, 0, size);
+        return ptr;
+    }
+
+    size_t len = (size + OS_ALLOC_PAGE - 1) & ~(size_t)(OS_ALLOC_PAGE - 1);
+    void *ptr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    // Reserved huge pages first (only there if the admin set up hugetlbfs)
+    if ((flags & OS_ALLOC_FLAG_HUGE) && align <= OS_ALLOC_HUGE_PAGE) {
+        size_t huge_len = (len + OS_ALLOC_HUGE_PAGE - 1) & ~(size_t)(OS_ALLOC_HUGE_PAGE - 1);
+        ptr = mmap(NULL, huge_len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED)
+            len = huge_len;
+    }
+#endif
+
+    if (ptr == MAP_FAILED) {
+        // Regular pages, aligned so transparent huge pages can kick in
+        size_t want = align;
+        if ((flags & OS_ALLOC_FLAG_HUGE) && want < OS_ALLOC_HUGE_PAGE)
+            want = OS_ALLOC_HUGE_PAGE;
+        if (want < OS_ALLOC_PAGE)
+            want = OS_ALLOC_PAGE;
+
+        size_t span = len + want - OS_ALLOC_PAGE;
+        char *raw = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            return NULL;
+        char *aligned = (char *)(((uintptr_t)raw + want - 1) & ~(uintptr_t)(want - 1));
+        if (aligned > raw)
+            munmap(raw, (size_t)(aligned - raw));
+        if (aligned + len < raw + span)
+            munmap(aligned + len, (size_t)(raw + span - (aligned + len)));
+        ptr = aligned;
+
+#ifdef MADV_HUGEPAGE
+        if (flags & OS_ALLOC_FLAG_HUGE)
+            madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+    }
+
+    // Bind before faulting, otherwise the pages already landed somewhere
+    if (flags & OS_ALLOC_FLAG_NUMA_LOCAL)
+        alloc_bind_local(ptr, len);
+    if (flags & OS_ALLOC_FLAG_PREFAULT)
+        alloc_prefault(ptr, len);
+
+    if (mmap_remember(ptr, len) != 0) {
+        munmap(ptr, len);
+        return NULL;
+    }
+    return ptr;
+}
+
 void *os_prim_alloc(size_t size) {
     return malloc(size);
 }
 
 void os_prim_free(void *ptr) {
+    if (!ptr)
+        return;
+    // Only page-aligned pointers can be ours
+    if (((uintptr_t)ptr & (OS_ALLOC_PAGE - 1)) == 0) {
+        size_t len = mmap_forget(ptr);
+        if (len) {
+            munmap(ptr, len);
+            return;
+        }
+    }
     free(ptr);
 }
 
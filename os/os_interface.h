@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "interface/os_alloc.h" // Usage/flag hints for alloc_ex
+#include "interface/os_log.h"   // Gated logging macros
+#include "interface/os_trace.h" // Spans, flows, counters (off by default)
 
 // OS-agnostic PCI device handle
 typedef struct os_pci_device {
@@ -28,6 +31,7 @@ typedef void (*os_display_put_pixel_fn)(int x, int y, uint32_t color);
 // Memory management (primitives)
 typedef void *(*os_alloc_fn)(size_t size);
 typedef void (*os_free_fn)(void *ptr);
+typedef void *(*os_alloc_ex_fn)(size_t size, size_t align, uint32_t usage, uint32_t flags);
 
 // Logging
 typedef void (*os_log_fn)(const char *fmt, ...);
@@ -64,6 +68,7 @@ struct os_interface {
     // Primitives
     os_alloc_fn alloc;
     os_free_fn free;
+    os_alloc_ex_fn alloc_ex; // Hinted allocation (see os_primitives.h), freed with free
     os_log_fn log;
     os_prim_pci_find_device_fn prim_pci_find_device;
     os_prim_pci_get_ids_fn prim_pci_get_ids;
@@ -17,6 +17,7 @@
 #include <stdlib.h> // POSIX malloc/free
 void *os_prim_alloc(size_t size);
 void os_prim_free(void *ptr);
+#include "interface/os_alloc.h" // os_prim_alloc_ex and its hints
 
 // I/O (for PCI, etc.)
 uint32_t os_prim_read32(uintptr_t addr);
@@ -35,8 +36,10 @@ uint32_t os_prim_get_current_pid(void);
 // Time (basic delay)
 void os_prim_delay_us(uint32_t us);
 
-// Logging
+// Logging (INFO on OS_LOG_CORE; hot paths use the gated macros in os_log.h)
 void os_prim_log(const char *fmt, ...);
+#include "interface/os_log.h"
+#include "interface/os_trace.h"
 
 // PCI-like access (abstracted)
 int os_prim_pci_find_device(uint16_t vendor, uint16_t device, void **handle);
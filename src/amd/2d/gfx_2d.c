@@ -5,114 +5,86 @@
  * Developed by: Haiku Imposible Team (HIT)
  */
 
-#include "../hal/hal.h"
-#include "../../os/os_primitives.h"
+#include "gfx_2d.h"
+#include "../../../core/hal/hal.h"
+#include "../../../drivers/amdgpu/pm4_builder.h"
+#include "../../../os/os_primitives.h"
 #include <string.h>
 
-/* ============================================================================
- * 2D Command Packet Structures
- * ============================================================================ */
-
-// RDNA 2D packet format (simplified)
-typedef struct {
-    uint32_t header;              // Packet type and size
-    uint32_t src_base_addr;       // Source surface address
-    uint32_t dst_base_addr;       // Dest surface address
-    uint32_t pitch;               // Pitch in pixels
-    uint32_t src_x;               // Source X coordinate
-    uint32_t src_y;               // Source Y coordinate
-    uint32_t dst_x;               // Dest X coordinate
-    uint32_t dst_y;               // Dest Y coordinate
-    uint32_t width;               // Width in pixels
-    uint32_t height;              // Height in pixels
-    uint32_t rop;                 // Raster operation (0xCC = copy)
-} gfx_2d_blit_t;
-
-// Fill command
-typedef struct {
-    uint32_t header;              // Packet type and size
-    uint32_t dst_base_addr;       // Dest surface address
-    uint32_t pitch;               // Pitch in pixels
-    uint32_t dst_x;               // Dest X coordinate
-    uint32_t dst_y;               // Dest Y coordinate
-    uint32_t width;               // Width in pixels
-    uint32_t height;              // Height in pixels
-    uint32_t fill_color;          // Color to fill (32-bit RGBA)
-} gfx_2d_fill_t;
-
 /* ============================================================================
  * 2D Operations Implementation
  * ============================================================================ */
 
 /*
- * Build a 2D blit packet (copy rectangle)
+ * Copy a rectangle with CP DMA.
+ * Whole-row rectangles are one contiguous copy; otherwise one DMA per row.
+ * Overlapping copies inside one surface go bottom-up so rows aren't clobbered.
  */
-int gfx_2d_build_blit(gfx_2d_blit_t *packet,
+int gfx_2d_emit_blit(struct pm4_builder *b,
                      uint64_t src_addr, uint64_t dst_addr,
                      uint32_t pitch,
                      uint32_t src_x, uint32_t src_y,
                      uint32_t dst_x, uint32_t dst_y,
                      uint32_t width, uint32_t height) {
-    if (!packet) {
+    if (!b || width == 0 || height == 0) {
         return -1;
     }
 
-    memset(packet, 0, sizeof(gfx_2d_blit_t));
+    uint64_t row_bytes = (uint64_t)width * GFX_2D_BYTES_PER_PIXEL;
+    uint64_t pitch_bytes = (uint64_t)pitch * GFX_2D_BYTES_PER_PIXEL;
+    uint64_t src = src_addr + src_y * pitch_bytes + src_x * GFX_2D_BYTES_PER_PIXEL;
+    uint64_t dst = dst_addr + dst_y * pitch_bytes + dst_x * GFX_2D_BYTES_PER_PIXEL;
 
-    // Header: type=BLIT, size=10 dwords
-    packet->header = (1 << 30) | 10;  // Type=1 (blit), size=10
-    
-    packet->src_base_addr = (uint32_t)(src_addr & 0xFFFFFFFF);
-    packet->dst_base_addr = (uint32_t)(dst_addr & 0xFFFFFFFF);
-    packet->pitch = pitch;
-    packet->src_x = src_x;
-    packet->src_y = src_y;
-    packet->dst_x = dst_x;
-    packet->dst_y = dst_y;
-    packet->width = width;
-    packet->height = height;
-    packet->rop = 0xCC;  // ROP_COPY
-
-    os_prim_log("2D: Built BLIT packet: src=0x%llx dst=0x%llx %ux%u @ (%u,%u) -> (%u,%u)\n",
-                src_addr, dst_addr, width, height, src_x, src_y, dst_x, dst_y);
+    if (width == pitch && src_x == 0 && dst_x == 0 &&
+        (src_addr != dst_addr || src_y >= dst_y + height || dst_y >= src_y + height)) {
+        pm4_dma_copy(b, dst, src, row_bytes * height, true);
+        return pm4_builder_ok(b) ? 0 : -1;
+    }
 
-    return 0;
+    bool bottom_up = src_addr == dst_addr && dst_y > src_y;
+    for (uint32_t i = 0; i < height; i++) {
+        uint32_t row = bottom_up ? height - 1 - i : i;
+        pm4_dma_copy(b, dst + row * pitch_bytes, src + row * pitch_bytes,
+                     row_bytes, i == height - 1);
+    }
+
+    return pm4_builder_ok(b) ? 0 : -1;
 }
 
 /*
- * Build a 2D fill packet (rectangle fill)
+ * Fill a rectangle with a 32-bit color using CP DMA's "data" source.
  */
-int gfx_2d_build_fill(gfx_2d_fill_t *packet,
+int gfx_2d_emit_fill(struct pm4_builder *b,
                      uint64_t dst_addr,
                      uint32_t pitch,
                      uint32_t dst_x, uint32_t dst_y,
                      uint32_t width, uint32_t height,
                      uint32_t color) {
-    if (!packet) {
+    if (!b || width == 0 || height == 0) {
         return -1;
     }
 
-    memset(packet, 0, sizeof(gfx_2d_fill_t));
+    uint64_t row_bytes = (uint64_t)width * GFX_2D_BYTES_PER_PIXEL;
+    uint64_t pitch_bytes = (uint64_t)pitch * GFX_2D_BYTES_PER_PIXEL;
+    uint64_t dst = dst_addr + dst_y * pitch_bytes + dst_x * GFX_2D_BYTES_PER_PIXEL;
 
-    // Header: type=FILL, size=8 dwords
-    packet->header = (2 << 30) | 8;  // Type=2 (fill), size=8
-    
-    packet->dst_base_addr = (uint32_t)(dst_addr & 0xFFFFFFFF);
-    packet->pitch = pitch;
-    packet->dst_x = dst_x;
-    packet->dst_y = dst_y;
-    packet->width = width;
-    packet->height = height;
-    packet->fill_color = color;
+    if (width == pitch && dst_x == 0) {
+        pm4_dma_fill(b, dst, color, row_bytes * height, true);
+        return pm4_builder_ok(b) ? 0 : -1;
+    }
 
-    os_prim_log("2D: Built FILL packet: dst=0x%llx color=0x%08x %ux%u @ (%u,%u)\n",
-                dst_addr, color, width, height, dst_x, dst_y);
+    for (uint32_t row = 0; row < height; row++) {
+        pm4_dma_fill(b, dst + row * pitch_bytes, color, row_bytes,
+                     row == height - 1);
+    }
 
-    return 0;
+    return pm4_builder_ok(b) ? 0 : -1;
 }
 
 /*
  * Validate 2D blit parameters
+ * Runs per request, so a client sending bad rectangles in a loop gets
+ * rate-limited errors rather than a log line each time.
  */
 int gfx_2d_validate_blit(uint32_t width, uint32_t height,
                         uint32_t src_pitch, uint32_t dst_pitch,
@@ -120,23 +92,27 @@ int gfx_2d_validate_blit(uint32_t width, uint32_t height,
                         uint32_t dst_x, uint32_t dst_y) {
     // Width and height must be non-zero and reasonable
     if (width == 0 || height == 0) {
-        os_prim_log("2D: ERROR - Invalid blit dimensions: %ux%u\n", width, height);
+        os_log_ratelimited(OS_LOG_GFX, OS_LOG_LEVEL_ERROR,
+                           "2D: ERROR - Invalid blit dimensions: %ux%u\n", width, height);
         return -1;
     }
 
     if (width > 8192 || height > 8192) {
-        os_prim_log("2D: ERROR - Blit too large: %ux%u (max 8192x8192)\n", width, height);
+        os_log_ratelimited(OS_LOG_GFX, OS_LOG_LEVEL_ERROR,
+                           "2D: ERROR - Blit too large: %ux%u (max 8192x8192)\n", width, height);
         return -1;
     }
 
     // Check coordinates don't overflow
     if ((uint32_t)src_x + width > src_pitch) {
-        os_prim_log("2D: ERROR - Source region exceeds pitch\n");
+        os_log_ratelimited(OS_LOG_GFX, OS_LOG_LEVEL_ERROR,
+                           "2D: ERROR - Source region exceeds pitch\n");
         return -1;
     }
 
     if ((uint32_t)dst_x + width > dst_pitch) {
-        os_prim_log("2D: ERROR - Dest region exceeds pitch\n");
+        os_log_ratelimited(OS_LOG_GFX, OS_LOG_LEVEL_ERROR,
+                           "2D: ERROR - Dest region exceeds pitch\n");
         return -1;
     }
 
@@ -151,32 +127,27 @@ int gfx_2d_validate_fill(uint32_t width, uint32_t height,
                         uint32_t dst_x, uint32_t dst_y) {
     // Width and height must be non-zero
     if (width == 0 || height == 0) {
-        os_prim_log("2D: ERROR - Invalid fill dimensions: %ux%u\n", width, height);
+        os_log_ratelimited(OS_LOG_GFX, OS_LOG_LEVEL_ERROR,
+                           "2D: ERROR - Invalid fill dimensions: %ux%u\n", width, height);
         return -1;
     }
 
     if (width > 8192 || height > 8192) {
-        os_prim_log("2D: ERROR - Fill too large: %ux%u (max 8192x8192)\n", width, height);
+        os_log_ratelimited(OS_LOG_GFX, OS_LOG_LEVEL_ERROR,
+                           "2D: ERROR - Fill too large: %ux%u (max 8192x8192)\n", width, height);
         return -1;
     }
 
     // Check coordinates don't overflow
     if ((uint32_t)dst_x + width > pitch) {
-        os_prim_log("2D: ERROR - Fill region exceeds pitch\n");
+        os_log_ratelimited(OS_LOG_GFX, OS_LOG_LEVEL_ERROR,
+                           "2D: ERROR - Fill region exceeds pitch\n");
         return -1;
     }
 
     return 0;
 }
 
-/*
- * Get 2D packet size (in bytes)
- */
-uint32_t gfx_2d_get_packet_size(uint32_t header) {
-    uint32_t dwords = header & 0x3FFF;
-    return dwords * 4;  // Convert dwords to bytes
-}
-
 /*
  * Check if 2D operation completed
  */
@@ -200,6 +171,6 @@ int gfx_2d_wait_idle(struct OBJGPU *adev, uint32_t timeout_ms) {
         os_prim_delay_us(10000);  // 10ms
     }
 
-    os_prim_log("2D: Wait idle timeout\n");
+    os_log_warn(OS_LOG_GFX, "2D: Wait idle timeout\n");
     return -1;
 }
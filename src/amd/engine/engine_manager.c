@@ -5,7 +5,7 @@
  * Developed by: Haiku Imposible Team (HIT)
  */
 
-#include "../../hal/hal.h"
+#include "../../../core/rmapi/rmapi.h"
 #include "../../../os/os_primitives.h"
 #include <string.h>
 
@@ -22,6 +22,7 @@ typedef struct {
     bool in_use;                 // Currently acquired?
     uint64_t last_fence_value;   // Last submitted fence
     uint64_t completed_fence;    // Last completed fence
+    uint64_t submit_ns;          // When the oldest unfinished work went in
     os_prim_lock_t lock;         // Synchronization (if supported)
 } engine_t;
 
@@ -129,6 +130,7 @@ int engine_acquire(uint32_t capabilities, uint32_t max_wait_ms,
             engines[engine_idx].owner_pid = os_prim_get_current_pid();
             engines[engine_idx].last_fence_value = 0;
             engines[engine_idx].completed_fence = 0;
+            engines[engine_idx].submit_ns = 0;
             
             *engine_token = engines[engine_idx].token;
             
@@ -196,14 +198,25 @@ int engine_submit_work(uint32_t engine_token, const void *commands,
                 return -1;
             }
             
-            // Allocate next fence value
-            engines[i].last_fence_value++;
-            *fence_value = engines[i].last_fence_value;
+            // The scheduler orders it behind everything else on GFX; its
+            // seq is our fence
+            struct amdgpu_command_buffer cb = {NULL, (void *)commands,
+                                               command_size, NULL, 0};
+            if (rmapi_sched_submit((int32_t)engines[i].owner_pid,
+                                   RMAPI_CLIENT_ENGINE_GFX, &cb, NULL, 0,
+                                   NULL, 0, fence_value) != 0) {
+                os_prim_log("Engine Manager: ERROR - Scheduler refused the work\n");
+                return -1;
+            }
+            engines[i].last_fence_value = *fence_value;
             
             os_prim_log("Engine Manager: Submitted (fence=0x%llx)\n", *fence_value);
-            
-            // TODO: Actually submit to ring buffer here
-            // For now, just track the fence
+
+            // Put it on the owner's tab; busy time is added once the fence lands
+            if (!engines[i].submit_ns)
+                engines[i].submit_ns = rmapi_client_now_ns();
+            rmapi_client_account_submit((int32_t)engines[i].owner_pid,
+                                        RMAPI_CLIENT_ENGINE_GFX, 0);
             
             return 0;
         }
@@ -240,22 +253,19 @@ int engine_wait_fence(uint32_t engine_token, uint64_t fence_value,
         return -1;
     }
 
-    // Poll for completion
-    int timeout_count = (timeout_ms + 9) / 10;
-    
-    while (timeout_count-- > 0) {
-        // In real implementation, read GPU fence register here
-        // For simulation, just increment completed fence
-        eng->completed_fence = eng->last_fence_value;
-        
-        if (eng->completed_fence >= fence_value) {
-            os_prim_log("Engine Manager: Fence completed ✓\n");
-            return 0;
-        }
-        
-        if (timeout_count > 0) {
-            os_prim_delay_us(10000);  // 10ms polling
+    // The scheduler's fence for GFX is the one that counts
+    if (rmapi_sched_fence_wait(RMAPI_CLIENT_ENGINE_GFX, fence_value,
+                               (uint64_t)timeout_ms * 1000000ull) == 0) {
+        if (fence_value > eng->completed_fence)
+            eng->completed_fence = fence_value;
+        if (eng->submit_ns && eng->completed_fence == eng->last_fence_value) {
+            rmapi_client_account_busy((int32_t)eng->owner_pid,
+                                      RMAPI_CLIENT_ENGINE_GFX,
+                                      rmapi_client_now_ns() - eng->submit_ns);
+            eng->submit_ns = 0;
         }
+        os_prim_log("Engine Manager: Fence completed ✓\n");
+        return 0;
     }
 
     os_prim_log("Engine Manager: Fence timeout\n");
@@ -7,8 +7,14 @@
 
 #include "../../hal/hal.h"
 #include "../../../os/os_primitives.h"
+#include "../../../os/os_interface.h"
 #include <string.h>
 
+// Macros for OS calls
+#define os_prim_log os_get_interface()->log
+#define os_prim_alloc_ex os_get_interface()->alloc_ex
+#define os_prim_free os_get_interface()->free
+
 /* ============================================================================
  * Ring Buffer Structure
  * ============================================================================ */
@@ -47,8 +53,8 @@ int ring_buffer_init(ring_buffer_t *ring, uint32_t size_kb) {
     os_prim_log("Ring: Initializing ring buffer (%uKB = %u dwords)...\n",
                 size_kb, size_dwords);
 
-    // Allocate ring buffer (CPU-visible)
-    ring->cpu_addr = os_prim_alloc(size_bytes);
+    // Allocate ring buffer (CPU-visible, hot: prefaulted and on our NUMA node)
+    ring->cpu_addr = os_prim_alloc_ex(size_bytes, 4096, OS_ALLOC_USAGE_RING, 0);
     if (!ring->cpu_addr) {
         os_prim_log("Ring: ERROR - Failed to allocate %uKB\n", size_kb);
         return -1;
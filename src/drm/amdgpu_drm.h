@@ -29,6 +29,12 @@
 #define AMDGPU_GEM_CREATE_CPU_GTT_USWC (1 << 2)
 #define AMDGPU_GEM_CREATE_VRAM_CLEARED (1 << 3)
 
+// GEM Userptr Flags
+#define AMDGPU_GEM_USERPTR_READONLY (1 << 0)
+#define AMDGPU_GEM_USERPTR_ANONONLY (1 << 1)
+#define AMDGPU_GEM_USERPTR_VALIDATE (1 << 2)
+#define AMDGPU_GEM_USERPTR_REGISTER (1 << 3)
+
 // Memory Domains
 #define AMDGPU_GEM_DOMAIN_CPU 0x1
 #define AMDGPU_GEM_DOMAIN_GTT 0x2
@@ -54,6 +60,13 @@ union drm_amdgpu_gem_create {
   struct drm_amdgpu_gem_create_out out;
 };
 
+struct drm_amdgpu_gem_userptr {
+  uint64_t addr;
+  uint64_t size;
+  uint32_t flags;
+  uint32_t handle; // Out
+};
+
 struct drm_amdgpu_gem_mmap_in {
   uint32_t handle;
 };
@@ -110,6 +110,18 @@ int drmGetVersion(int fd, drm_version_t *ver) {
   return 0;
 }
 
+// Connect to rmapi_server on first use
+static int drm_shim_connect(void) {
+  if (!g_drm_initialized) {
+    if (ipc_client_connect(HIT_SOCKET_PATH, &g_drm_conn) < 0) {
+      fprintf(stderr, "DRM Shim: Failed to connect to rmapi_server\n");
+      return -1;
+    }
+    g_drm_initialized = 1;
+  }
+  return 0;
+}
+
 /*
  * DRM Command Write/Read
  * Core IPC bridge: translates DRM IOCTLs to our IPC protocol
@@ -117,12 +129,8 @@ int drmGetVersion(int fd, drm_version_t *ver) {
 int drmCommandWriteRead(int fd, unsigned long drmCommandIndex, void *data,
                         unsigned long size) {
   // Initialize IPC connection on first use
-  if (!g_drm_initialized) {
-    if (ipc_client_connect(HIT_SOCKET_PATH, &g_drm_conn) < 0) {
-      fprintf(stderr, "DRM Shim: Failed to connect to rmapi_server\n");
-      return -1;
-    }
-    g_drm_initialized = 1;
+  if (drm_shim_connect() < 0) {
+    return -1;
   }
 
   // Map DRM command to IPC message type and marshal data
@@ -147,13 +155,45 @@ int drmCommandWriteRead(int fd, unsigned long drmCommandIndex, void *data,
       return -1;
     }
 
-    // Reply contains the GPU address, use it as handle
-    if (reply.data && reply.data_size >= sizeof(uint64_t)) {
-      uint64_t gpu_addr = *(uint64_t *)reply.data;
-      args->out.handle = (uint32_t)(gpu_addr & 0xFFFFFFFF);
-      free(reply.data);
+    // The server's handle is what PRIME export and GEM close understand
+    int ret = -1;
+    if (reply.data && reply.data_size >= sizeof(struct ipc_alloc_reply)) {
+      struct ipc_alloc_reply *rep = (struct ipc_alloc_reply *)reply.data;
+      args->out.handle = rep->handle;
+      ret = rep->gpu_addr ? 0 : -1;
     }
-    return 0;
+    free(reply.data);
+    return ret;
+  }
+
+  case DRM_AMDGPU_GEM_USERPTR: {
+    // Wrap the app's own pages - the server reads them straight out of
+    // our address space, no staging copy
+    struct drm_amdgpu_gem_userptr *args = (struct drm_amdgpu_gem_userptr *)data;
+    struct ipc_userptr_request req = {args->addr, args->size, 0, args->flags,
+                                      (int32_t)getpid()};
+
+    msg.type = IPC_REQ_IMPORT_USERPTR;
+    msg.data = &req;
+    msg.data_size = sizeof(req);
+
+    if (ipc_send_message(&g_drm_conn, &msg) < 0) {
+      return -1;
+    }
+
+    ipc_message_t reply;
+    if (ipc_recv_message(&g_drm_conn, &reply) <= 0) {
+      return -1;
+    }
+
+    int ret = -1;
+    if (reply.data && reply.data_size >= sizeof(struct ipc_userptr_reply)) {
+      struct ipc_userptr_reply *rep = (struct ipc_userptr_reply *)reply.data;
+      ret = rep->result;
+      args->handle = rep->handle;
+    }
+    free(reply.data);
+    return ret;
   }
 
   case DRM_AMDGPU_GEM_MMAP: {
@@ -292,12 +332,54 @@ void drmClose(int fd) {
  * RADV uses these for buffer allocation
  */
 int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags, int *prime_fd) {
-  // TODO: Implement proper handle→FD mapping
-  *prime_fd = handle; // Placeholder
+  // The server owns the pages (memfd or kernel dma-buf), it hands us an fd
+  if (!prime_fd || drm_shim_connect() < 0)
+    return -1;
+
+  ipc_message_t msg = {IPC_REQ_PRIME_EXPORT, 1, sizeof(handle), &handle};
+  if (ipc_send_message(&g_drm_conn, &msg) < 0)
+    return -1;
+
+  ipc_message_t reply;
+  if (ipc_recv_message(&g_drm_conn, &reply) <= 0)
+    return -1;
+
+  int ret = -1;
+  if (reply.data && reply.data_size >= sizeof(int))
+    ret = *(int *)reply.data;
+  free(reply.data);
+  if (ret != 0)
+    return -1;
+
+  *prime_fd = ipc_recv_fd(&g_drm_conn);
+  if (*prime_fd < 0)
+    return -1;
+  if (!(flags & O_CLOEXEC))
+    fcntl(*prime_fd, F_SETFD, 0);
   return 0;
 }
 
 int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle) {
-  *handle = prime_fd; // Placeholder
-  return 0;
+  if (!handle || prime_fd < 0 || drm_shim_connect() < 0)
+    return -1;
+
+  // Importing something we exported ourselves returns the same handle
+  ipc_message_t msg = {IPC_REQ_PRIME_IMPORT, 1, 0, NULL};
+  if (ipc_send_message(&g_drm_conn, &msg) < 0 ||
+      ipc_send_fd(&g_drm_conn, prime_fd) < 0)
+    return -1;
+
+  ipc_message_t reply;
+  if (ipc_recv_message(&g_drm_conn, &reply) <= 0)
+    return -1;
+
+  int ret = -1;
+  if (reply.data && reply.data_size >= sizeof(struct ipc_prime_import_reply)) {
+    struct ipc_prime_import_reply *rep =
+        (struct ipc_prime_import_reply *)reply.data;
+    ret = rep->result;
+    *handle = rep->handle;
+  }
+  free(reply.data);
+  return ret;
 }
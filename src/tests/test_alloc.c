@@ -0,0 +1,84 @@
+/*
+ * Unit Tests for Hinted Allocations
+ *
+ * Tests core functionality:
+ * - alloc_ex honours alignment for every usage class, small and huge
+ * - Both kinds of memory go back through the one free
+ * - Plain alloc stays malloc at any size, so realloc/free callers work
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../os/os_interface.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ALLOC_BIG (4u << 20)
+
+/* ============================================================================
+ * Test Case: Every usage class, small and big, aligned and writable
+ * ============================================================================ */
+
+TEST_CASE(alloc_ex_usage_and_alignment)
+{
+  struct os_interface *os = os_get_interface();
+  const uint32_t usages[] = {OS_ALLOC_USAGE_GENERIC, OS_ALLOC_USAGE_VRAM,
+                             OS_ALLOC_USAGE_FRAMEBUFFER, OS_ALLOC_USAGE_RING,
+                             OS_ALLOC_USAGE_STAGING};
+  const size_t sizes[] = {64, 4096, 300u << 10, ALLOC_BIG + 12345};
+
+  for (size_t u = 0; u < sizeof(usages) / sizeof(usages[0]); u++) {
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      uint8_t *p = os->alloc_ex(sizes[s], 4096, usages[u], 0);
+      TEST_ASSERT_NOT_NULL(p);
+      TEST_ASSERT_EQUAL_INT(0, (int)((uintptr_t)p & 4095));
+      p[0] = 1;
+      p[sizes[s] - 1] = 2;
+      os->free(p);
+    }
+  }
+
+  // Default alignment is at least a cache line, explicit flags are fine too
+  void *p = os->alloc_ex(100, 0, OS_ALLOC_USAGE_GENERIC,
+                         OS_ALLOC_FLAG_PREFAULT | OS_ALLOC_FLAG_NUMA_LOCAL);
+  TEST_ASSERT_NOT_NULL(p);
+  TEST_ASSERT_EQUAL_INT(0, (int)((uintptr_t)p & 63));
+  os->free(p);
+  os->free(NULL);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Plain alloc is malloc, however big
+ * ============================================================================ */
+
+TEST_CASE(alloc_plain_is_malloc)
+{
+  struct os_interface *os = os_get_interface();
+
+  // Callers that grow or free() these themselves must keep working
+  uint8_t *p = os->alloc(ALLOC_BIG);
+  TEST_ASSERT_NOT_NULL(p);
+  memset(p, 0x3c, ALLOC_BIG);
+  uint8_t *q = realloc(p, 2 * ALLOC_BIG);
+  TEST_ASSERT_NOT_NULL(q);
+  TEST_ASSERT_EQUAL_INT(0x3c, q[ALLOC_BIG - 1]);
+  free(q);
+
+  // And os_prim_free still tells the two kinds apart
+  p = os->alloc(ALLOC_BIG);
+  TEST_ASSERT_NOT_NULL(p);
+  os->free(p);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t alloc_tests[] = {
+    TEST_REGISTER(alloc_ex_usage_and_alignment),
+    TEST_REGISTER(alloc_plain_is_malloc),
+    TEST_REGISTER_END
+};
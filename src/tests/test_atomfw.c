@@ -0,0 +1,263 @@
+/*
+ * Unit Tests for the VBIOS Data Table Reader
+ *
+ * Tests core functionality:
+ * - Firmware, clock, display path and VRAM info come out of an image
+ * - Images that aren't AtomFirmware, or are cut short, are refused
+ * - The cache: cold parse writes it, warm start maps it, a bad or
+ *   foreign one is parsed over
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/hal/hal.h"
+#include "../../src/amd/include/atomfirmware.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ROM_SIZE 0x800
+#define HDR_OFF 0x100
+#define MASTER_OFF 0x180
+#define FW_OFF 0x200
+#define SMU_OFF 0x280
+#define DCE_OFF 0x2C0
+#define DISP_OFF 0x300
+#define VRAM_OFF 0x400
+
+static uint8_t rom[ROM_SIZE];
+
+static void put_table(uint16_t off, void *t, uint16_t size, uint8_t frev, uint8_t crev) {
+  struct atom_common_table_header *h = t;
+  h->structuresize = size;
+  h->format_revision = frev;
+  h->content_revision = crev;
+  memcpy(rom + off, t, size);
+}
+
+// A Navi-ish board: 27 MHz display reference, 2 connectors, 8 GB GDDR6
+static void build_rom(void) {
+  memset(rom, 0, sizeof(rom));
+  rom[0] = 0x55;
+  rom[1] = 0xAA;
+  rom[0x48] = HDR_OFF & 0xFF;
+  rom[0x49] = HDR_OFF >> 8;
+
+  struct atom_rom_header_v2_2 hdr = {0};
+  memcpy(hdr.atom_bios_string, "ATOM", 4);
+  hdr.masterdatatable_offset = MASTER_OFF;
+  put_table(HDR_OFF, &hdr, sizeof(hdr), 2, 2);
+
+  struct atom_master_data_table_v2_1 master = {0};
+  master.listOfdatatables.firmwareinfo = FW_OFF;
+  master.listOfdatatables.smu_info = SMU_OFF;
+  master.listOfdatatables.dce_info = DCE_OFF;
+  master.listOfdatatables.displayobjectinfo = DISP_OFF;
+  master.listOfdatatables.vram_info = VRAM_OFF;
+  put_table(MASTER_OFF, &master, sizeof(master), 2, 1);
+
+  struct atom_firmware_info_v3_1 fw = {0};
+  fw.firmware_revision = 0x00160042;
+  fw.bootup_sclk_in10khz = 180000; // 1800 MHz
+  fw.bootup_mclk_in10khz = 87500;
+  fw.bootup_vddc_mv = 800;
+  put_table(FW_OFF, &fw, sizeof(fw), 3, 1);
+
+  struct atom_smu_info_v3_1 smu = {0};
+  smu.core_refclk_10khz = 10000;
+  put_table(SMU_OFF, &smu, sizeof(smu), 3, 1);
+
+  struct atom_display_controller_info_v4_1 dce = {0};
+  dce.dce_refclk_10khz = 2700;
+  dce.bootup_dispclk_10khz = 60000;
+  put_table(DCE_OFF, &dce, sizeof(dce), 4, 1);
+
+  struct display_object_info_table_v1_4 disp = {0};
+  disp.supporteddevices = ATOM_DISPLAY_DFP1_SUPPORT | ATOM_DISPLAY_DFP2_SUPPORT;
+  disp.number_of_path = 2;
+  disp.display_path[0].display_objid = 0x3113; // DP connector
+  disp.display_path[0].encoderobjid = 0x2121;
+  disp.display_path[0].device_tag = ATOM_DISPLAY_DFP1_SUPPORT;
+  disp.display_path[1].display_objid = 0x310C; // HDMI
+  disp.display_path[1].encoderobjid = 0x2221;
+  disp.display_path[1].extencoderobjid = 0x2301;
+  disp.display_path[1].device_tag = ATOM_DISPLAY_DFP2_SUPPORT;
+  uint16_t disp_size = (uint16_t)(offsetof(struct display_object_info_table_v1_4,
+                                           display_path) +
+                                  2 * sizeof(struct atom_display_object_path_v2));
+  put_table(DISP_OFF, &disp, disp_size, 1, 4);
+
+  static struct atom_vram_info_header_v2_4 vram;
+  memset(&vram, 0, sizeof(vram));
+  vram.vram_module_num = 1;
+  vram.vram_module[0].memory_size = 8192;
+  vram.vram_module[0].max_mem_clk = 175000;
+  vram.vram_module[0].memory_type = ATOM_DGPU_VRAM_TYPE_GDDR6;
+  vram.vram_module[0].channel_num = 8;
+  vram.vram_module[0].channel_width = 4;
+  uint16_t vram_size = (uint16_t)(offsetof(struct atom_vram_info_header_v2_4,
+                                           vram_module) +
+                                  sizeof(struct atom_vram_module_v10));
+  put_table(VRAM_OFF, &vram, vram_size, 2, 4);
+}
+
+/* ============================================================================
+ * Test Case: Every table we read
+ * ============================================================================ */
+
+TEST_CASE(atomfw_parse_tables)
+{
+  struct amdgpu_atomfw_info info;
+  build_rom();
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_atomfw_parse(rom, sizeof(rom), &info));
+  TEST_ASSERT_EQUAL_INT(AMDGPU_ATOMFW_FIRMWARE | AMDGPU_ATOMFW_SMU |
+                            AMDGPU_ATOMFW_DCE | AMDGPU_ATOMFW_DISPLAY |
+                            AMDGPU_ATOMFW_VRAM,
+                        (int)info.tables);
+  TEST_ASSERT_EQUAL_INT(0x00160042, (int)info.firmware_revision);
+  TEST_ASSERT_EQUAL_INT(180000, (int)info.bootup_sclk_10khz);
+  TEST_ASSERT_EQUAL_INT(800, (int)info.bootup_vddc_mv);
+  TEST_ASSERT_EQUAL_INT(10000, (int)info.core_refclk_10khz);
+  TEST_ASSERT_EQUAL_INT(2700, (int)info.dce_refclk_10khz);
+  TEST_ASSERT_EQUAL_INT(60000, (int)info.bootup_dispclk_10khz);
+
+  TEST_ASSERT_EQUAL_INT(2, (int)info.num_paths);
+  TEST_ASSERT_EQUAL_INT(0x3113, (int)info.paths[0].connector_id);
+  TEST_ASSERT_EQUAL_INT(0, (int)info.paths[0].ext_encoder_id);
+  TEST_ASSERT_EQUAL_INT(0x2221, (int)info.paths[1].encoder_id);
+  TEST_ASSERT_EQUAL_INT(0x2301, (int)info.paths[1].ext_encoder_id);
+  TEST_ASSERT_EQUAL_INT(ATOM_DISPLAY_DFP2_SUPPORT, (int)info.paths[1].device_tag);
+
+  TEST_ASSERT_EQUAL_INT(8192, (int)info.vram_size_mb);
+  TEST_ASSERT_EQUAL_INT(ATOM_DGPU_VRAM_TYPE_GDDR6, (int)info.vram_type);
+  TEST_ASSERT_EQUAL_INT(8, (int)info.vram_channels);
+  TEST_ASSERT_EQUAL_INT(1, (int)info.vram_modules);
+
+  // The table says more paths than it has room for: only what fits
+  rom[DISP_OFF + 6] = 5;
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_atomfw_parse(rom, sizeof(rom), &info));
+  TEST_ASSERT_EQUAL_INT(2, (int)info.num_paths);
+
+  // A table revision we don't know is left out, not guessed at
+  rom[VRAM_OFF + 3] = 6;
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_atomfw_parse(rom, sizeof(rom), &info));
+  TEST_ASSERT_FALSE(info.tables & AMDGPU_ATOMFW_VRAM);
+  TEST_ASSERT_EQUAL_INT(0, (int)info.vram_size_mb);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Not an AtomFirmware image
+ * ============================================================================ */
+
+TEST_CASE(atomfw_rejects_bad_images)
+{
+  struct amdgpu_atomfw_info info;
+  build_rom();
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_atomfw_parse(rom, 0x40, &info));
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_atomfw_parse(NULL, sizeof(rom), &info));
+
+  // Cut in the middle of the firmware info: it's dropped, the rest stays
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_atomfw_parse(rom, FW_OFF + 8, &info));
+  TEST_ASSERT_EQUAL_INT(0, (int)info.tables);
+
+  rom[HDR_OFF + 4] = 'X'; // Not "ATOM"
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_atomfw_parse(rom, sizeof(rom), &info));
+  build_rom();
+  rom[HDR_OFF + 2] = 1;   // AtomBIOS ROM header, pre-SoC15
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_atomfw_parse(rom, sizeof(rom), &info));
+  build_rom();
+  rom[1] = 0;
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_atomfw_parse(rom, sizeof(rom), &info));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Cold parse, warm map, bad cache
+ * ============================================================================ */
+
+static int write_file(const char *path, const void *data, size_t size) {
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return -1;
+  size_t n = fwrite(data, size, 1, f);
+  fclose(f);
+  return n == 1 ? 0 : -1;
+}
+
+TEST_CASE(atomfw_cache)
+{
+  char dir[64], vbios[96], cache[160];
+  snprintf(dir, sizeof(dir), "/tmp/amdgpu_test_vbios.%d", (int)getpid());
+  snprintf(vbios, sizeof(vbios), "%s.rom", dir);
+  build_rom();
+  TEST_ASSERT_EQUAL_INT(0, write_file(vbios, rom, sizeof(rom)));
+  setenv("AMDGPU_VBIOS", vbios, 1);
+  setenv("AMDGPU_VBIOS_CACHE", dir, 1);
+
+  struct OBJGPU gpu;
+  memset(&gpu, 0, sizeof(gpu));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_atomfw_load(&gpu));
+  TEST_ASSERT_FALSE(gpu.atomfw->warm);
+  const struct amdgpu_atomfw_info *info = amdgpu_atomfw_get(&gpu);
+  TEST_ASSERT_NOT_NULL(info);
+  TEST_ASSERT_EQUAL_INT(2700, (int)info->dce_refclk_10khz);
+  snprintf(cache, sizeof(cache), "%s/vbios-%016llx.bin", dir,
+           (unsigned long long)info->vbios_key);
+  TEST_ASSERT_EQUAL_INT(0, access(cache, R_OK));
+  uint64_t cold_ns = info->cold_parse_ns;
+
+  // Warm: same answers, straight from the mapping
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_atomfw_load(&gpu));
+  TEST_ASSERT_TRUE(gpu.atomfw->warm);
+  info = amdgpu_atomfw_get(&gpu);
+  TEST_ASSERT_TRUE(info != &gpu.atomfw->parsed);
+  TEST_ASSERT_EQUAL_INT(2700, (int)info->dce_refclk_10khz);
+  TEST_ASSERT_EQUAL_INT(8192, (int)info->vram_size_mb);
+  TEST_ASSERT_TRUE(info->cold_parse_ns == cold_ns);
+  amdgpu_atomfw_fini(&gpu);
+
+  // A flipped bit in the cache: parsed again, and the cache is good after
+  FILE *f = fopen(cache, "r+b");
+  TEST_ASSERT_NOT_NULL(f);
+  fseek(f, 40, SEEK_SET);
+  fputc(0x5A, f);
+  fclose(f);
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_atomfw_load(&gpu));
+  TEST_ASSERT_FALSE(gpu.atomfw->warm);
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_atomfw_load(&gpu));
+  TEST_ASSERT_TRUE(gpu.atomfw->warm);
+
+  // A flashed VBIOS is another key: its own cold parse
+  rom[FW_OFF + 8] ^= 1;
+  TEST_ASSERT_EQUAL_INT(0, write_file(vbios, rom, sizeof(rom)));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_atomfw_load(&gpu));
+  TEST_ASSERT_FALSE(gpu.atomfw->warm);
+  char cache2[160];
+  snprintf(cache2, sizeof(cache2), "%s/vbios-%016llx.bin", dir,
+           (unsigned long long)amdgpu_atomfw_get(&gpu)->vbios_key);
+  amdgpu_atomfw_fini(&gpu);
+  TEST_ASSERT_TRUE(gpu.atomfw == NULL);
+
+  unsetenv("AMDGPU_VBIOS");
+  unsetenv("AMDGPU_VBIOS_CACHE");
+  unlink(cache);
+  unlink(cache2);
+  unlink(vbios);
+  rmdir(dir);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t atomfw_tests[] = {
+    TEST_REGISTER(atomfw_parse_tables),
+    TEST_REGISTER(atomfw_rejects_bad_images),
+    TEST_REGISTER(atomfw_cache),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,181 @@
+/*
+ * Unit Tests for BO Lists
+ *
+ * Tests core functionality:
+ * - Submissions get the list's buffers in priority order
+ * - A second submit with nothing changed is served from the cache
+ * - Only a buffer that moved gets looked at again
+ * - Updates are all or nothing, and listed buffers outlive FREE_MEMORY
+ * - A job's hold keeps them after the list and the client let go
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include <string.h>
+
+/* ============================================================================
+ * Test Case: Acquire orders by priority and caches the answer
+ * ============================================================================ */
+
+TEST_CASE(bo_list_priority_and_cache)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = 5151;
+  uint32_t h[3], list;
+  uint64_t addr[3];
+  for (int i = 0; i < 3; i++)
+    TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, 4096, &h[i],
+                                                &addr[i]));
+
+  struct rmapi_bo_list_entry entries[3] = {
+      {h[0], 2, RMAPI_BO_LIST_READ, 0},
+      {h[1], 9, RMAPI_BO_LIST_WRITE, 0},
+      {h[2], 5, 0, 0},
+  };
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_create(pid, entries, 3, &list));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_bo_list_update(pid + 1, list, NULL, 0,
+                                                 NULL, 0)); // Not theirs
+
+  struct rmapi_bo_list_stats before, after;
+  rmapi_bo_list_get_stats(&before);
+  struct amdgpu_command_buffer cb = {NULL, NULL, 0, NULL, 0};
+  struct rmapi_bo_list *l = rmapi_bo_list_acquire(pid, list, &cb);
+  TEST_ASSERT_NOT_NULL(l);
+  TEST_ASSERT_EQUAL_INT(3, (int)cb.bo_count);
+  TEST_ASSERT_TRUE(cb.bo_list[0]->gpu_addr == addr[1]);
+  TEST_ASSERT_TRUE(cb.bo_list[1]->gpu_addr == addr[2]);
+  TEST_ASSERT_TRUE(cb.bo_list[2]->gpu_addr == addr[0]);
+  struct amdgpu_buffer *moved = cb.bo_list[1];
+  rmapi_bo_list_put(l);
+
+  // Same list again: nothing to look at
+  rmapi_bo_list_get_stats(&after);
+  uint64_t revalidated = after.revalidated;
+  l = rmapi_bo_list_acquire(pid, list, &cb);
+  TEST_ASSERT_NOT_NULL(l);
+  rmapi_bo_list_put(l);
+  rmapi_bo_list_get_stats(&after);
+  TEST_ASSERT_EQUAL_INT(1, (int)(after.cached - before.cached));
+  TEST_ASSERT_TRUE(after.revalidated == revalidated);
+
+  // One buffer got evicted: only that one is revalidated
+  moved->generation++;
+  l = rmapi_bo_list_acquire(pid, list, &cb);
+  TEST_ASSERT_NOT_NULL(l);
+  rmapi_bo_list_put(l);
+  rmapi_bo_list_get_stats(&after);
+  TEST_ASSERT_EQUAL_INT(1, (int)(after.revalidated - revalidated));
+  TEST_ASSERT_EQUAL_INT(3, (int)(after.acquires - before.acquires));
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_destroy(pid, list));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_bo_list_destroy(pid, list));
+  TEST_ASSERT_TRUE(rmapi_bo_list_acquire(pid, list, &cb) == NULL);
+  for (int i = 0; i < 3; i++)
+    TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, pid, h[i]));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Updates are all or nothing, the list keeps its buffers alive
+ * ============================================================================ */
+
+TEST_CASE(bo_list_update_and_lifetime)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = 5152;
+  uint32_t a, b, list;
+  uint64_t addr_a, addr_b;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, 4096, &a,
+                                              &addr_a));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, 4096, &b,
+                                              &addr_b));
+  struct rmapi_bo_list_entry ea = {a, 1, 0, 0};
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_create(pid, &ea, 1, &list));
+
+  // b is fine, 0xdead isn't: neither gets in
+  struct rmapi_bo_list_entry set[2] = {{b, 3, 0, 0}, {0xdead, 0, 0, 0}};
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_bo_list_update(pid, list, set, 2, NULL, 0));
+  struct rmapi_bo_list_entry bad = {b, RMAPI_BO_LIST_MAX_PRIORITY + 1, 0, 0};
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_bo_list_update(pid, list, &bad, 1, NULL, 0));
+  struct amdgpu_command_buffer cb = {NULL, NULL, 0, NULL, 0};
+  struct rmapi_bo_list *l = rmapi_bo_list_acquire(pid, list, &cb);
+  TEST_ASSERT_NOT_NULL(l);
+  TEST_ASSERT_EQUAL_INT(1, (int)cb.bo_count);
+  rmapi_bo_list_put(l);
+
+  // Add b above a, then drop a
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_update(pid, list, set, 1, NULL, 0));
+  l = rmapi_bo_list_acquire(pid, list, &cb);
+  TEST_ASSERT_NOT_NULL(l);
+  TEST_ASSERT_EQUAL_INT(2, (int)cb.bo_count);
+  TEST_ASSERT_TRUE(cb.bo_list[0]->gpu_addr == addr_b);
+  rmapi_bo_list_put(l);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_update(pid, list, NULL, 0, &a, 1));
+  l = rmapi_bo_list_acquire(pid, list, &cb);
+  TEST_ASSERT_NOT_NULL(l);
+  TEST_ASSERT_EQUAL_INT(1, (int)cb.bo_count);
+  TEST_ASSERT_TRUE(cb.bo_list[0]->gpu_addr == addr_b);
+  rmapi_bo_list_put(l);
+
+  // The client frees b: the list still has it
+  struct amdgpu_buffer buf;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, pid, b));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_get(b, &buf));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_destroy(pid, list));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_get(b, &buf));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, pid, a));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: A queued job keeps the buffers it was given
+ * ============================================================================ */
+
+TEST_CASE(bo_list_hold_outlives_list)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = 5153;
+  uint32_t a, list;
+  uint64_t addr_a;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, 4096, &a,
+                                              &addr_a));
+  struct rmapi_bo_list_entry ea = {a, 1, 0, 0};
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_create(pid, &ea, 1, &list));
+
+  struct amdgpu_command_buffer cb = {NULL, NULL, 0, NULL, 0};
+  struct rmapi_sched_hold hold;
+  struct rmapi_bo_list *l = rmapi_bo_list_acquire(pid, list, &cb);
+  TEST_ASSERT_NOT_NULL(l);
+  struct amdgpu_buffer **listed = cb.bo_list;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_hold(l, &cb, &hold));
+  rmapi_bo_list_put(l);
+  TEST_ASSERT_TRUE(cb.bo_list != listed); // The job's own copy
+  TEST_ASSERT_EQUAL_INT(1, (int)cb.bo_count);
+  TEST_ASSERT_TRUE(cb.bo_list[0]->gpu_addr == addr_a);
+  TEST_ASSERT_TRUE(hold.bos == NULL);
+
+  // The app drops everything while the job is still queued
+  struct amdgpu_buffer buf;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_destroy(pid, list));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, pid, a));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_get(a, &buf));
+  TEST_ASSERT_TRUE(cb.bo_list[0]->gpu_addr == addr_a);
+
+  // Fence retired
+  hold.release(hold.data);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_get(a, &buf));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t bo_list_tests[] = {
+    TEST_REGISTER(bo_list_priority_and_cache),
+    TEST_REGISTER(bo_list_update_and_lifetime),
+    TEST_REGISTER(bo_list_hold_outlives_list),
+    TEST_REGISTER_END
+};
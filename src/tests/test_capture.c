@@ -0,0 +1,160 @@
+/*
+ * Unit Tests for Command Stream Capture
+ *
+ * Tests core functionality:
+ * - Trace header and records, 8-byte aligned, read back as written
+ * - BO contents dumped once per BO, without trailing zeros
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include "../../core/ipc/ipc_protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Whole trace file in memory; *len = its size
+static char *read_trace(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  *len = (size_t)ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *buf = malloc(*len ? *len : 1);
+  if (buf && fread(buf, 1, *len, f) != *len) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  return buf;
+}
+
+static int temp_trace(char *path) {
+  strcpy(path, "/tmp/amdgpu-capture-XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return -1;
+  close(fd);
+  return 0;
+}
+
+/* ============================================================================
+ * Records
+ * ============================================================================ */
+
+TEST_CASE(capture_records_roundtrip) {
+  char path[64];
+  TEST_ASSERT_EQUAL_INT(0, temp_trace(path));
+  TEST_ASSERT_FALSE(rmapi_capture_active());
+  TEST_ASSERT_EQUAL_INT(0, rmapi_capture_start(path));
+  TEST_ASSERT_TRUE(rmapi_capture_active());
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_capture_start(path)); // One at a time
+
+  uint8_t odd[5] = {1, 2, 3, 4, 5};
+  int result = 0;
+  rmapi_capture_message(RMAPI_CAPTURE_CLIENT, 77, 1, 0, NULL, 0);
+  rmapi_capture_message(RMAPI_CAPTURE_REQUEST, 77, IPC_REQ_SUBMIT_COMMAND, 9,
+                        odd, sizeof(odd));
+  rmapi_capture_message(RMAPI_CAPTURE_REPLY, 77, IPC_REP_SUBMIT_COMMAND, 9,
+                        &result, sizeof(result));
+  rmapi_capture_stop();
+  TEST_ASSERT_FALSE(rmapi_capture_active());
+  rmapi_capture_message(RMAPI_CAPTURE_CLIENT, 77, 0, 0, NULL, 0); // Dropped
+
+  size_t len;
+  char *trace = read_trace(path, &len);
+  unlink(path);
+  TEST_ASSERT_NOT_NULL(trace);
+  const struct rmapi_capture_header *hdr = (const void *)trace;
+  TEST_ASSERT_EQUAL_INT(RMAPI_CAPTURE_MAGIC, hdr->magic);
+  TEST_ASSERT_EQUAL_INT(RMAPI_CAPTURE_VERSION, hdr->version);
+
+  const struct rmapi_capture_record *rec[3];
+  size_t off = sizeof(*hdr);
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(off + sizeof(struct rmapi_capture_record) <= len);
+    TEST_ASSERT_EQUAL_INT(0, (int)(off % 8));
+    rec[i] = (const void *)(trace + off);
+    off += RMAPI_CAPTURE_RECORD_BYTES(rec[i]);
+  }
+  TEST_ASSERT_TRUE(off == len); // Nothing after the stop
+
+  TEST_ASSERT_EQUAL_INT(RMAPI_CAPTURE_CLIENT, rec[0]->kind);
+  TEST_ASSERT_EQUAL_INT(1, rec[0]->type);
+  TEST_ASSERT_EQUAL_INT(0, rec[0]->size);
+  TEST_ASSERT_EQUAL_INT(RMAPI_CAPTURE_REQUEST, rec[1]->kind);
+  TEST_ASSERT_EQUAL_INT(77, rec[1]->pid);
+  TEST_ASSERT_EQUAL_INT(9, rec[1]->id);
+  TEST_ASSERT_EQUAL_INT((int)sizeof(odd), rec[1]->size);
+  TEST_ASSERT_EQUAL_MEM(odd, rec[1] + 1, sizeof(odd));
+  TEST_ASSERT_EQUAL_INT(RMAPI_CAPTURE_REPLY, rec[2]->kind);
+  TEST_ASSERT_EQUAL_INT(IPC_REP_SUBMIT_COMMAND, rec[2]->type);
+  TEST_ASSERT_TRUE(rec[1]->time_ns <= rec[2]->time_ns);
+
+  free(trace);
+  return 1;
+}
+
+/* ============================================================================
+ * BO contents
+ * ============================================================================ */
+
+TEST_CASE(capture_bo_first_use) {
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = 4242;
+  uint32_t handle, listed = 0;
+  uint64_t addr;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, 8192, &handle,
+                                              &addr));
+  TEST_ASSERT_EQUAL_INT(1, rmapi_prime_list_pid(pid, &listed, 1));
+  TEST_ASSERT_EQUAL_INT(handle, listed);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_list_pid(pid + 1, NULL, 0));
+
+  struct amdgpu_buffer buf;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_get(handle, &buf));
+  memset(buf.cpu_addr, 0xab, 100); // The rest stays zero
+
+  char path[64];
+  TEST_ASSERT_EQUAL_INT(0, temp_trace(path));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_capture_start(path));
+  rmapi_capture_bos(pid);
+  memset(buf.cpu_addr, 0xcd, 100);
+  rmapi_capture_bos(pid); // Already in the trace: first contents stand
+  rmapi_capture_stop();
+
+  size_t len;
+  char *trace = read_trace(path, &len);
+  unlink(path);
+  TEST_ASSERT_NOT_NULL(trace);
+  size_t off = sizeof(struct rmapi_capture_header);
+  const struct rmapi_capture_record *rec = (const void *)(trace + off);
+  TEST_ASSERT_TRUE(off + RMAPI_CAPTURE_RECORD_BYTES(rec) == len);
+  TEST_ASSERT_EQUAL_INT(RMAPI_CAPTURE_BO, rec->kind);
+  TEST_ASSERT_EQUAL_INT(pid, rec->pid);
+  TEST_ASSERT_EQUAL_INT((int)sizeof(struct rmapi_capture_bo) + 100, rec->size);
+
+  const struct rmapi_capture_bo *bo = (const void *)(rec + 1);
+  const uint8_t *data = (const uint8_t *)(bo + 1);
+  TEST_ASSERT_EQUAL_INT(handle, bo->handle);
+  TEST_ASSERT_TRUE(bo->gpu_addr == addr);
+  TEST_ASSERT_TRUE(bo->size == 8192);
+  TEST_ASSERT_TRUE(data[0] == 0xab && data[99] == 0xab);
+
+  free(trace);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, pid, handle));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t capture_tests[] = {
+    TEST_REGISTER(capture_records_roundtrip),
+    TEST_REGISTER(capture_bo_first_use),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,116 @@
+/*
+ * Unit Tests for Per-Client Accounting
+ *
+ * Tests core functionality:
+ * - Charges and uncharges move memory, peak and the BO count
+ * - A quota refuses what doesn't fit, counts the refusal, changes nothing
+ * - Buffers made for a client land on its tab (and hit its quota)
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include <stdio.h>
+#include <string.h>
+
+/* ============================================================================
+ * Test Case: Charging, peaks and the quota wall
+ * ============================================================================ */
+
+TEST_CASE(client_charge_and_quota)
+{
+  const int32_t pid = 9191;
+  struct rmapi_client_stats st;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_client_get_stats(pid, &st)); // Not on the books
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_charge(pid, RMAPI_CLIENT_HEAP_VRAM, 3000));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_charge(pid, RMAPI_CLIENT_HEAP_GTT, 500));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_client_charge(pid, RMAPI_CLIENT_HEAP_COUNT, 1));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_get_stats(pid, &st));
+  TEST_ASSERT_EQUAL_INT(3000, (int)st.memory[RMAPI_CLIENT_HEAP_VRAM]);
+  TEST_ASSERT_EQUAL_INT(500, (int)st.memory[RMAPI_CLIENT_HEAP_GTT]);
+  TEST_ASSERT_EQUAL_INT(2, (int)st.bo_count);
+
+  // 3000 + 2000 > 4096: refused, counted, nothing else changes
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_set_quota(pid, RMAPI_CLIENT_HEAP_VRAM, 4096));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_client_charge(pid, RMAPI_CLIENT_HEAP_VRAM, 2000));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_get_stats(pid, &st));
+  TEST_ASSERT_EQUAL_INT(1, (int)st.quota_hits);
+  TEST_ASSERT_EQUAL_INT(3000, (int)st.memory[RMAPI_CLIENT_HEAP_VRAM]);
+  TEST_ASSERT_EQUAL_INT(2, (int)st.bo_count);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_charge(pid, RMAPI_CLIENT_HEAP_VRAM, 1096));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_charge(pid, RMAPI_CLIENT_HEAP_GTT, 1 << 20)); // Other heap
+
+  // Giving back lowers memory, not the peak
+  rmapi_client_uncharge(pid, RMAPI_CLIENT_HEAP_VRAM, 3000);
+  rmapi_client_uncharge(pid, RMAPI_CLIENT_HEAP_VRAM, 1096);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_get_stats(pid, &st));
+  TEST_ASSERT_EQUAL_INT(0, (int)st.memory[RMAPI_CLIENT_HEAP_VRAM]);
+  TEST_ASSERT_EQUAL_INT(4096, (int)st.peak[RMAPI_CLIENT_HEAP_VRAM]);
+
+  char fdinfo[512];
+  TEST_ASSERT_TRUE(rmapi_client_format_fdinfo(&st, fdinfo, sizeof(fdinfo)) > 0);
+  TEST_ASSERT_TRUE(strstr(fdinfo, "drm-memory-gtt:") != NULL);
+
+  // Nothing held, nobody connected: off the books
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_set_quota(pid, RMAPI_CLIENT_HEAP_VRAM, 0));
+  rmapi_client_uncharge(pid, RMAPI_CLIENT_HEAP_GTT, 500);
+  rmapi_client_uncharge(pid, RMAPI_CLIENT_HEAP_GTT, 1 << 20);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_client_get_stats(pid, &st));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Buffers go on the owner's tab and respect its quota
+ * ============================================================================ */
+
+TEST_CASE(client_quota_refuses_buffers)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = 9292;
+  rmapi_client_open(pid);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_set_quota(pid, RMAPI_CLIENT_HEAP_VRAM, 8192));
+
+  uint32_t h[3];
+  uint64_t addr;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, 4096, &h[0], &addr));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, 4096, &h[1], &addr));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_create(&mock_gpu, pid, 4096, &h[2], &addr));
+
+  struct rmapi_client_stats st;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_get_stats(pid, &st));
+  TEST_ASSERT_EQUAL_INT(8192, (int)st.memory[RMAPI_CLIENT_HEAP_VRAM]);
+  TEST_ASSERT_EQUAL_INT(2, (int)st.bo_count);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.quota_hits);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.connections);
+
+  // Everybody's list has us in it
+  struct rmapi_client_stats all[64];
+  int n = rmapi_client_list(all, 64);
+  bool found = false;
+  for (int i = 0; i < n && i < 64; i++)
+    found |= all[i].pid == pid;
+  TEST_ASSERT_TRUE(found);
+
+  // Freed one: room for another
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, pid, h[0]));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, 4096, &h[2], &addr));
+
+  rmapi_prime_release_pid(&mock_gpu, pid);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_get_stats(pid, &st));
+  TEST_ASSERT_EQUAL_INT(0, (int)st.memory[RMAPI_CLIENT_HEAP_VRAM]);
+  rmapi_client_close(pid);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_client_get_stats(pid, &st));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t client_tests[] = {
+    TEST_REGISTER(client_charge_and_quota),
+    TEST_REGISTER(client_quota_refuses_buffers),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,251 @@
+/*
+ * Unit Tests for the Command Stream Validator
+ *
+ * Tests core functionality:
+ * - Well-formed PM4 streams pass
+ * - Register allow-list, opcode table and packet lengths
+ * - Addresses checked against the BO list
+ * - Chained / nested IBs and the validated-IB cache
+ * - The server's streams run from copies of their IBs
+ * - SDMA streams
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include "../../drivers/amdgpu/pm4_builder.h"
+#include "../../src/amd/amdgpu/navi10_sdma_pkt_open.h"
+#include <string.h>
+
+#define GFX RMAPI_CLIENT_ENGINE_GFX
+
+// One fake BO at a fixed VA, backed by a static array the validator can read
+static uint32_t bo_mem[1024];
+static struct amdgpu_buffer bo = {bo_mem, 0x100000, sizeof(bo_mem), 1, 0, 0};
+static struct amdgpu_buffer *bo_list[] = {&bo};
+
+static int validate(uint32_t engine, const uint32_t *dw, uint32_t ndw) {
+    return rmapi_cs_validate(0, engine, dw, ndw * 4, bo_list, 1);
+}
+
+/* ============================================================================
+ * Test Case: What the PM4 builder emits for a draw gets through
+ * ============================================================================ */
+
+TEST_CASE(cs_valid_draw)
+{
+    uint32_t buf[64];
+    struct pm4_builder b;
+    pm4_builder_init(&b, buf, 64, false);
+
+    pm4_set_context_reg(&b, PACKET3_SET_CONTEXT_REG_START + 0x10, 1);
+    pm4_set_sh_reg(&b, PACKET3_SET_SH_REG_START + 0x40, 2);
+    pm4_set_uconfig_reg(&b, 0xC242, 4); // VGT_PRIMITIVE_TYPE
+    pm4_draw_index_auto(&b, 3, PM4_DI_SRC_SEL_AUTO_INDEX);
+    pm4_release_mem(&b, PM4_EVENT_CACHE_FLUSH_AND_INV_TS, 0, bo.gpu_addr + 8, 1,
+                    PM4_DATA_SEL_64, PM4_INT_SEL_NONE);
+    pm4_pad(&b, PM4_IB_ALIGN_DW);
+
+    TEST_ASSERT_EQUAL_INT(0, validate(GFX, buf, b.cdw));
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: Register writes outside the allow-list, banned opcodes, bad sizes
+ * ============================================================================ */
+
+TEST_CASE(cs_rejects_bad_packets)
+{
+    uint32_t buf[16];
+    struct pm4_builder b;
+
+    pm4_builder_init(&b, buf, 16, false);
+    pm4_set_uconfig_reg(&b, 0xC200, 0xFFFFFFFF); // GRBM_GFX_INDEX: not yours
+    TEST_ASSERT_EQUAL_INT(-1, validate(GFX, buf, b.cdw));
+
+    pm4_builder_init(&b, buf, 16, false);
+    pm4_set_config_reg(&b, PACKET3_SET_CONFIG_REG_START, 0);
+    TEST_ASSERT_EQUAL_INT(-1, validate(GFX, buf, b.cdw));
+
+    uint32_t raw[2] = {PACKET0(0x1000, 0), 0}; // Type-0 register write
+    TEST_ASSERT_EQUAL_INT(-1, validate(GFX, raw, 2));
+
+    pm4_builder_init(&b, buf, 16, false);
+    pm4_draw_index_auto(&b, 3, PM4_DI_SRC_SEL_AUTO_INDEX);
+    TEST_ASSERT_EQUAL_INT(-1, validate(GFX, buf, b.cdw - 1)); // Cut short
+
+    // Right opcode, wrong length
+    uint32_t wrong[4] = {(uint32_t)PACKET3(PACKET3_DRAW_INDEX_AUTO, 2), 3, 2, 0};
+    TEST_ASSERT_EQUAL_INT(-1, validate(GFX, wrong, 4));
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: Memory outside the submission's BOs is off limits
+ * ============================================================================ */
+
+TEST_CASE(cs_rejects_foreign_va)
+{
+    uint32_t buf[16];
+    struct pm4_builder b;
+    uint32_t data = 0xDEAD;
+
+    pm4_builder_init(&b, buf, 16, false);
+    pm4_write_data(&b, PM4_DST_MEM, bo.gpu_addr + sizeof(bo_mem) - 4, &data, 1, false);
+    TEST_ASSERT_EQUAL_INT(0, validate(GFX, buf, b.cdw));
+
+    // One byte over the end of the BO
+    pm4_builder_init(&b, buf, 16, false);
+    pm4_dma_copy(&b, bo.gpu_addr, bo.gpu_addr + 16, sizeof(bo_mem) - 15, true);
+    TEST_ASSERT_EQUAL_INT(-1, validate(GFX, buf, b.cdw));
+
+    // No BO list at all
+    pm4_builder_init(&b, buf, 16, false);
+    pm4_write_data(&b, PM4_DST_MEM, bo.gpu_addr, &data, 1, false);
+    TEST_ASSERT_EQUAL_INT(-1, rmapi_cs_validate(0, GFX, buf, b.cdw * 4, NULL, 0));
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: IBs are followed (nested and chained) and cached once good
+ * ============================================================================ */
+
+TEST_CASE(cs_ib_follow_and_cache)
+{
+    struct pm4_builder ib, chained, top;
+    uint32_t top_buf[8];
+    rmapi_cs_cache_flush();
+
+    // IB at the start of the BO, chaining into a second one at +2KB
+    pm4_builder_init(&chained, bo_mem + 512, 64, false);
+    pm4_draw_index_auto(&chained, 3, PM4_DI_SRC_SEL_AUTO_INDEX);
+    pm4_pad(&chained, PM4_IB_ALIGN_DW);
+
+    pm4_builder_init(&ib, bo_mem, 64, false);
+    pm4_set_context_reg(&ib, PACKET3_SET_CONTEXT_REG_START, 1);
+    uint32_t *size = pm4_chain_ib(&ib, bo.gpu_addr + 2048, 0);
+    *size |= chained.cdw;
+
+    pm4_builder_init(&top, top_buf, 8, false);
+    pm4_indirect_buffer(&top, bo.gpu_addr, ib.cdw, 0);
+
+    struct rmapi_cs_stats before, after;
+    rmapi_cs_get_stats(&before);
+    TEST_ASSERT_EQUAL_INT(0, validate(GFX, top_buf, top.cdw));
+    TEST_ASSERT_EQUAL_INT(0, validate(GFX, top_buf, top.cdw)); // Replay
+    rmapi_cs_get_stats(&after);
+    TEST_ASSERT_EQUAL_INT(2, (int)(after.cache_hits - before.cache_hits));
+
+    // The chained IB changes behind our back: the cache must not hide it
+    bo_mem[512 + 1] = 0;
+    bo_mem[512] = PACKET0(0x1000, 0);
+    TEST_ASSERT_EQUAL_INT(-1, validate(GFX, top_buf, top.cdw));
+
+    // IB pointing outside the BO
+    pm4_builder_init(&top, top_buf, 8, false);
+    pm4_indirect_buffer(&top, bo.gpu_addr + sizeof(bo_mem) - 8, 8, 0);
+    TEST_ASSERT_EQUAL_INT(-1, validate(GFX, top_buf, top.cdw));
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: What the client writes after the check never reaches the CP
+ * ============================================================================ */
+
+static int holds_released;
+
+static void count_release(void *data) {
+    holds_released++;
+    rmapi_cs_shadow_release(data);
+}
+
+TEST_CASE(cs_ib_copies)
+{
+    struct pm4_builder ib, top;
+    uint32_t top_buf[8];
+    rmapi_cs_cache_flush();
+
+    pm4_builder_init(&ib, bo_mem, 64, false);
+    pm4_set_context_reg(&ib, PACKET3_SET_CONTEXT_REG_START, 1);
+    pm4_draw_index_auto(&ib, 3, PM4_DI_SRC_SEL_AUTO_INDEX);
+    pm4_pad(&ib, PM4_IB_ALIGN_DW);
+    uint32_t good[64];
+    memcpy(good, bo_mem, ib.cdw * 4);
+
+    pm4_builder_init(&top, top_buf, 8, false);
+    pm4_indirect_buffer(&top, bo.gpu_addr, ib.cdw, 0);
+
+    struct rmapi_cs_stats before, after;
+    struct rmapi_cs_shadow *shadow = NULL;
+    rmapi_cs_get_stats(&before);
+    TEST_ASSERT_EQUAL_INT(0, rmapi_cs_validate_shadow(0, GFX, top_buf, top.cdw * 4,
+                                                      bo_list, 1, &shadow));
+    TEST_ASSERT_NOT_NULL(shadow);
+    rmapi_cs_get_stats(&after);
+    TEST_ASSERT_EQUAL_INT((int)ib.cdw, (int)(after.dwords_copied - before.dwords_copied));
+
+    // The packet now calls our copy, and the client's BO no longer matters
+    uint64_t va = ((uint64_t)(top_buf[2] & 0xFFFF) << 32) | top_buf[1];
+    TEST_ASSERT_TRUE(va != bo.gpu_addr);
+    bo_mem[0] = PACKET0(0x1000, 0);
+    TEST_ASSERT_EQUAL_MEM(good, (const void *)(uintptr_t)va, ib.cdw * 4);
+
+    // The BO itself changed: walked again, whatever the cache remembers
+    pm4_builder_init(&top, top_buf, 8, false);
+    pm4_indirect_buffer(&top, bo.gpu_addr, ib.cdw, 0);
+    TEST_ASSERT_EQUAL_INT(-1, validate(GFX, top_buf, top.cdw));
+
+    // The job keeps the copies until its fence retires (here: right away)
+    rmapi_sched_set_ops(NULL);
+    struct amdgpu_command_buffer cb = {NULL, top_buf, top.cdw * 4, NULL, 0};
+    struct rmapi_sched_hold hold = {count_release, shadow, NULL, 0};
+    holds_released = 0;
+    TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit_held(0, GFX, &cb, NULL, 0, NULL, 0,
+                                                     &hold, 1, NULL));
+    TEST_ASSERT_EQUAL_INT(1, holds_released);
+
+    memcpy(bo_mem, good, ib.cdw * 4);
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: SDMA streams use their own table
+ * ============================================================================ */
+
+TEST_CASE(cs_sdma)
+{
+    uint32_t copy[8] = {
+        SDMA_PKT_HEADER_OP(SDMA_OP_COPY) | SDMA_PKT_HEADER_SUB_OP(SDMA_SUBOP_COPY_LINEAR),
+        255, 0,
+        (uint32_t)bo.gpu_addr, 0,
+        (uint32_t)bo.gpu_addr + 1024, 0,
+        SDMA_PKT_HEADER_OP(SDMA_OP_NOP)};
+    TEST_ASSERT_EQUAL_INT(0, validate(RMAPI_CLIENT_ENGINE_DMA, copy, 8));
+
+    copy[1] = sizeof(bo_mem); // Runs off the end
+    TEST_ASSERT_EQUAL_INT(-1, validate(RMAPI_CLIENT_ENGINE_DMA, copy, 8));
+
+    uint32_t srbm[3] = {SDMA_PKT_HEADER_OP(SDMA_OP_SRBM_WRITE), 0x1000, 0};
+    TEST_ASSERT_EQUAL_INT(-1, validate(RMAPI_CLIENT_ENGINE_DMA, srbm, 3));
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t cs_validator_tests[] = {
+    TEST_REGISTER(cs_valid_draw),
+    TEST_REGISTER(cs_rejects_bad_packets),
+    TEST_REGISTER(cs_rejects_foreign_va),
+    TEST_REGISTER(cs_ib_follow_and_cache),
+    TEST_REGISTER(cs_ib_copies),
+    TEST_REGISTER(cs_sdma),
+    TEST_REGISTER_END
+};
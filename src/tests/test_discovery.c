@@ -0,0 +1,242 @@
+/*
+ * Unit Tests for the IP Discovery Parser
+ *
+ * Tests core functionality:
+ * - Versions and register bases end up at [hwip][instance]
+ * - Harvested IPs (per-IP bit and harvest table) aren't present
+ * - Bad signatures, checksums and sizes are refused
+ * - v4 tables with 64-bit bases, loading from a file
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/hal/hal.h"
+#include "../../src/amd/include/soc15_hw_ip.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Builds a discovery binary the way the VBIOS lays it out
+struct disc_builder {
+  uint8_t buf[1024];
+  size_t pos;        // End of what's written
+  uint16_t num_ips;
+  uint16_t version;
+  bool base64;
+};
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, (uint16_t)v);
+  put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static uint16_t bytesum(const uint8_t *p, size_t n) {
+  uint16_t s = 0;
+  for (size_t i = 0; i < n; i++)
+    s = (uint16_t)(s + p[i]);
+  return s;
+}
+
+#define IHDR_OFF 64  // After the binary header
+#define DIE_OFF 144  // After the 80-byte IP discovery header
+
+static void disc_begin(struct disc_builder *b, uint16_t version, bool base64) {
+  memset(b, 0, sizeof(*b));
+  b->version = version;
+  b->base64 = base64;
+  b->pos = DIE_OFF + 4;
+}
+
+static void disc_ip(struct disc_builder *b, uint16_t hw_id, uint8_t inst,
+                    uint8_t major, uint8_t minor, uint8_t rev, uint8_t nibbles,
+                    const uint64_t *bases, uint8_t nbase) {
+  uint8_t *p = b->buf + b->pos;
+  put16(p, hw_id);
+  p[2] = inst;
+  p[3] = nbase;
+  p[4] = major;
+  p[5] = minor;
+  p[6] = rev;
+  p[7] = nibbles;
+  p += 8;
+  for (uint8_t i = 0; i < nbase; i++) {
+    put32(p, (uint32_t)bases[i]);
+    if (b->base64)
+      put32(p + 4, (uint32_t)(bases[i] >> 32));
+    p += b->base64 ? 8 : 4;
+  }
+  b->pos = (size_t)(p - b->buf);
+  b->num_ips++;
+}
+
+// Harvest table after the IP table (0 hw_id = none)
+static size_t disc_end(struct disc_builder *b, uint16_t harvest_hw_id) {
+  uint8_t *h = b->buf; // Binary header
+  uint8_t *t = b->buf + IHDR_OFF;
+  put32(t, 0x53445049); // DISCOVERY_TABLE_SIGNATURE
+  put16(t + 4, b->version);
+  put16(t + 6, (uint16_t)(b->pos - IHDR_OFF));
+  put16(t + 12, 1);            // One die
+  put16(t + 16, DIE_OFF);      // die_info[0].die_offset
+  t[78] = b->base64 ? 1 : 0;
+  put16(b->buf + DIE_OFF + 2, b->num_ips);
+  size_t table_end = b->pos;
+
+  if (harvest_hw_id) {
+    uint8_t *ht = b->buf + b->pos;
+    put32(ht, 0x56524148); // HARVEST_TABLE_SIGNATURE
+    put16(ht + 8, harvest_hw_id); // list[0]; list[1] stays 0
+    put16(h + 12 + 2 * 8, (uint16_t)b->pos);
+    b->pos += 8 + 32 * 4;
+  }
+
+  put32(h, 0x28211407); // BINARY_SIGNATURE
+  put16(h + 4, 1);
+  put16(h + 10, (uint16_t)b->pos);
+  put16(h + 12, IHDR_OFF); // table_list[IP_DISCOVERY]
+  put16(h + 14, bytesum(t, table_end - IHDR_OFF));
+  put16(h + 8, bytesum(h + 10, b->pos - 10));
+  return b->pos;
+}
+
+/* ============================================================================
+ * Test Case: A Navi10-like table
+ * ============================================================================ */
+
+TEST_CASE(discovery_parse_table)
+{
+  static struct disc_builder b;
+  static struct amdgpu_ip_discovery d;
+  uint64_t gc[2] = {0x1260, 0xA000}, mmhub[1] = {0x1A000};
+  uint64_t vcn[1] = {0x7800}, dcn[3] = {0x12, 0xC0, 0x34C0};
+  disc_begin(&b, 1, false);
+  disc_ip(&b, GC_HWID, 0, 10, 1, 0, 0, gc, 2);
+  disc_ip(&b, MMHUB_HWID, 0, 2, 0, 0, 0, mmhub, 1);
+  disc_ip(&b, SDMA0_HWID, 0, 5, 0, 0, 0, gc, 2);
+  disc_ip(&b, UVD_HWID, 0, 2, 0, 0x80, 1, vcn, 1); // Harvested
+  disc_ip(&b, DMU_HWID, 0, 2, 0, 0, 0, dcn, 3);
+  disc_ip(&b, 999, 0, 1, 0, 0, 0, NULL, 0);        // Nobody we know
+  size_t size = disc_end(&b, 0);
+
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_discovery_parse(b.buf, size, &d));
+  TEST_ASSERT_EQUAL_INT(6, (int)d.entries);
+  TEST_ASSERT_EQUAL_INT(1, (int)d.harvested);
+
+  struct OBJGPU gpu;
+  memset(&gpu, 0, sizeof(gpu));
+  gpu.discovery = &d;
+  const struct amdgpu_ip_info *ip = amdgpu_discovery_ip(&gpu, AMDGPU_HWIP_GC, 0);
+  TEST_ASSERT_NOT_NULL(ip);
+  TEST_ASSERT_EQUAL_INT(10, ip->major);
+  TEST_ASSERT_EQUAL_INT(1, ip->minor);
+  TEST_ASSERT_NOT_NULL(amdgpu_discovery_ip(&gpu, AMDGPU_HWIP_DCE, 0));
+  TEST_ASSERT_TRUE(amdgpu_discovery_ip(&gpu, AMDGPU_HWIP_VCN, 0) == NULL);
+  TEST_ASSERT_TRUE(d.ip[AMDGPU_HWIP_VCN][0].harvested);
+  TEST_ASSERT_TRUE(amdgpu_discovery_ip(&gpu, AMDGPU_HWIP_GC, 1) == NULL);
+  TEST_ASSERT_TRUE(amdgpu_discovery_ip(&gpu, AMDGPU_HWIP_SDMA1, 0) == NULL);
+
+  uint32_t dw = 0;
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_discovery_reg_offset(&gpu, AMDGPU_HWIP_GC, 0,
+                                                       1, 0x10, &dw));
+  TEST_ASSERT_EQUAL_INT(0xA010, (int)dw);
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_discovery_reg_offset(&gpu, AMDGPU_HWIP_DCE, 0,
+                                                       2, 4, &dw));
+  TEST_ASSERT_EQUAL_INT(0x34C4, (int)dw);
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_discovery_reg_offset(&gpu, AMDGPU_HWIP_GC, 0,
+                                                        2, 0, &dw));
+  gpu.discovery = NULL;
+  TEST_ASSERT_TRUE(amdgpu_discovery_ip(&gpu, AMDGPU_HWIP_GC, 0) == NULL);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Broken tables are refused
+ * ============================================================================ */
+
+TEST_CASE(discovery_rejects_bad_tables)
+{
+  static struct disc_builder b;
+  static struct amdgpu_ip_discovery d;
+  uint64_t gc[2] = {0x1260, 0xA000};
+  disc_begin(&b, 1, false);
+  disc_ip(&b, GC_HWID, 0, 10, 1, 0, 0, gc, 2);
+  size_t size = disc_end(&b, 0);
+
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_discovery_parse(b.buf, size, &d));
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_discovery_parse(b.buf, size - 1, &d));
+  b.buf[DIE_OFF + 8] ^= 1; // A base address bit flips
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_discovery_parse(b.buf, size, &d));
+  b.buf[DIE_OFF + 8] ^= 1;
+  b.buf[0] ^= 0xFF;
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_discovery_parse(b.buf, size, &d));
+
+  // Checksums fine, but the die claims more IPs than there are bytes
+  disc_begin(&b, 1, false);
+  disc_ip(&b, GC_HWID, 0, 10, 1, 0, 0, gc, 2);
+  b.num_ips = 50;
+  size = disc_end(&b, 0);
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_discovery_parse(b.buf, size, &d));
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_discovery_parse(NULL, 0, &d));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: v4 table, 64-bit bases, harvest table, loading from a file
+ * ============================================================================ */
+
+TEST_CASE(discovery_v4_and_file)
+{
+  static struct disc_builder b;
+  static struct amdgpu_ip_discovery d;
+  uint64_t gc[1] = {0x12345678C0001260ull}, sdma[1] = {0x1260};
+  disc_begin(&b, 4, true);
+  disc_ip(&b, GC_HWID, 0, 11, 0, 3, 0x21, gc, 1); // Variant 2, sub-revision 1
+  disc_ip(&b, SDMA0_HWID, 0, 6, 0, 0, 0, sdma, 1);
+  disc_ip(&b, SDMA1_HWID, 0, 6, 0, 0, 0, sdma, 1);
+  size_t size = disc_end(&b, SDMA1_HWID);
+
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_discovery_parse(b.buf, size, &d));
+  TEST_ASSERT_EQUAL_INT(4, (int)d.version);
+  const struct amdgpu_ip_info *gfx = &d.ip[AMDGPU_HWIP_GC][0];
+  TEST_ASSERT_TRUE(gfx->present);
+  TEST_ASSERT_EQUAL_INT(0x1260, (int)gfx->base[0]); // Upper bits cut
+  TEST_ASSERT_EQUAL_INT(2, gfx->variant);
+  TEST_ASSERT_EQUAL_INT(1, gfx->sub_revision);
+  TEST_ASSERT_TRUE(d.ip[AMDGPU_HWIP_SDMA0][0].present);
+  TEST_ASSERT_FALSE(d.ip[AMDGPU_HWIP_SDMA1][0].present);
+  TEST_ASSERT_EQUAL_INT(1, (int)d.harvested);
+
+  const char *path = "/tmp/amdgpu_test_ip_discovery.bin";
+  FILE *f = fopen(path, "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  TEST_ASSERT_EQUAL_INT(1, (int)fwrite(b.buf, size, 1, f));
+  fclose(f);
+  struct OBJGPU gpu;
+  memset(&gpu, 0, sizeof(gpu));
+  setenv("AMDGPU_IP_DISCOVERY", path, 1);
+  int ret = amdgpu_discovery_load(&gpu);
+  unsetenv("AMDGPU_IP_DISCOVERY");
+  remove(path);
+  TEST_ASSERT_EQUAL_INT(0, ret);
+  TEST_ASSERT_NOT_NULL(amdgpu_discovery_ip(&gpu, AMDGPU_HWIP_SDMA0, 0));
+  amdgpu_discovery_fini(&gpu);
+  TEST_ASSERT_TRUE(gpu.discovery == NULL);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t discovery_tests[] = {
+    TEST_REGISTER(discovery_parse_table),
+    TEST_REGISTER(discovery_rejects_bad_tables),
+    TEST_REGISTER(discovery_v4_and_file),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,196 @@
+/*
+ * Unit Tests for the IH Ring
+ *
+ * Tests core functionality:
+ * - IVs decode back to what was raised and reach their [client][src] handler
+ * - A full ring drops IVs, and the ring wraps cleanly
+ * - The simulated device wakes the worker (SDMA TRAP included)
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/hal/hal.h"
+#include "../../drivers/amdgpu/sdma_builder.h"
+#include "../../src/amd/include/ivsrcid/gfx/irqsrcs_gfx_10_1.h"
+#include "../../src/amd/include/ivsrcid/sdma0/irqsrcs_sdma0_5_0.h"
+#include "../../src/amd/include/soc15_ih_clientid.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+static struct amdgpu_iv_entry seen[16];
+static int seen_count;
+static pthread_mutex_t seen_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t seen_cond = PTHREAD_COND_INITIALIZER;
+
+static void record_iv(void *priv, const struct amdgpu_iv_entry *iv) {
+  pthread_mutex_lock(&seen_lock);
+  seen[seen_count++ % 16] = *iv;
+  if (priv)
+    (*(int *)priv)++;
+  pthread_cond_broadcast(&seen_cond);
+  pthread_mutex_unlock(&seen_lock);
+}
+
+// Wait (up to a second) for the worker to have seen count IVs
+static int wait_seen(int count) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += 1;
+  pthread_mutex_lock(&seen_lock);
+  while (seen_count < count &&
+         pthread_cond_timedwait(&seen_cond, &seen_lock, &ts) == 0)
+    ;
+  int got = seen_count;
+  pthread_mutex_unlock(&seen_lock);
+  return got;
+}
+
+/* ============================================================================
+ * Test Case: Decoding and [client][src_id] dispatch
+ * ============================================================================ */
+
+TEST_CASE(ih_dispatch_by_source)
+{
+  int vm_faults = 0, traps = 0;
+  seen_count = 0;
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_init(0, AMDGPU_IH_WAKE_NONE, -1));
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_ih_init(0, AMDGPU_IH_WAKE_NONE, -1));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_register(SOC15_IH_CLIENTID_VMC, 0,
+                                              record_iv, &vm_faults));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_register(SOC15_IH_CLIENTID_SDMA0,
+                                              SDMA0_5_0__SRCID__SDMA_TRAP,
+                                              record_iv, &traps));
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_ih_register(SOC15_IH_CLIENTID_VMC, 0,
+                                               record_iv, NULL)); // Taken
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_ih_register(AMDGPU_IH_MAX_CLIENTS, 0,
+                                               record_iv, NULL));
+
+  struct amdgpu_iv_entry fault = {SOC15_IH_CLIENTID_VMC, 0, 3, 5, 1,
+                                  0xABCD12345678ull, 1, 0x4242, 0,
+                                  {0x1000, 0x2, 0, 0xdeadbeef}};
+  struct amdgpu_iv_entry trap = {0};
+  trap.client_id = SOC15_IH_CLIENTID_SDMA0;
+  trap.src_id = SDMA0_5_0__SRCID__SDMA_TRAP;
+  trap.src_data[0] = 77;
+  struct amdgpu_iv_entry nobody = {0};
+  nobody.client_id = SOC15_IH_CLIENTID_THM;
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_sim_raise(&fault));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_sim_raise(&nobody));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_sim_raise(&trap));
+  TEST_ASSERT_EQUAL_INT(3, (int)amdgpu_ih_process());
+  TEST_ASSERT_EQUAL_INT(0, (int)amdgpu_ih_process());
+
+  TEST_ASSERT_EQUAL_INT(1, vm_faults);
+  TEST_ASSERT_EQUAL_INT(1, traps);
+  TEST_ASSERT_EQUAL_INT(2, seen_count);
+  TEST_ASSERT_EQUAL_INT(3, (int)seen[0].ring_id);
+  TEST_ASSERT_EQUAL_INT(5, (int)seen[0].vmid);
+  TEST_ASSERT_EQUAL_INT(1, (int)seen[0].vmid_src);
+  TEST_ASSERT_TRUE(seen[0].timestamp == fault.timestamp);
+  TEST_ASSERT_EQUAL_INT(1, (int)seen[0].timestamp_src);
+  TEST_ASSERT_EQUAL_INT(0x4242, (int)seen[0].pasid);
+  TEST_ASSERT_EQUAL_MEM(fault.src_data, seen[0].src_data,
+                        sizeof(fault.src_data));
+  TEST_ASSERT_EQUAL_INT(77, (int)seen[1].src_data[0]);
+
+  struct amdgpu_ih_stats st;
+  amdgpu_ih_get_stats(&st);
+  TEST_ASSERT_EQUAL_INT(3, (int)st.entries);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.batches);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.unhandled);
+
+  amdgpu_ih_unregister(SOC15_IH_CLIENTID_VMC, 0);
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_sim_raise(&fault));
+  TEST_ASSERT_EQUAL_INT(1, (int)amdgpu_ih_process());
+  TEST_ASSERT_EQUAL_INT(1, vm_faults);
+  amdgpu_ih_fini();
+  TEST_ASSERT_FALSE(amdgpu_ih_active());
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_ih_sim_raise(&fault));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Overflow and wrap-around
+ * ============================================================================ */
+
+TEST_CASE(ih_overflow_and_wrap)
+{
+  seen_count = 0;
+  // Smallest ring there is: 8 IVs, one slot always free
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_init(1, AMDGPU_IH_WAKE_NONE, -1));
+  uint32_t bytes;
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_get_ring(NULL, &bytes, NULL));
+  TEST_ASSERT_EQUAL_INT(8 * AMDGPU_IH_IV_DW * 4, (int)bytes);
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_register(SOC15_IH_CLIENTID_GRBM_CP,
+                                              GFX_10_1__SRCID__CP_EOP_INTERRUPT,
+                                              record_iv, NULL));
+
+  struct amdgpu_iv_entry eop = {0};
+  eop.client_id = SOC15_IH_CLIENTID_GRBM_CP;
+  eop.src_id = GFX_10_1__SRCID__CP_EOP_INTERRUPT;
+  for (uint32_t i = 0; i < 7; i++) {
+    eop.src_data[0] = i;
+    TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_sim_raise(&eop));
+  }
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_ih_sim_raise(&eop)); // Lost
+  TEST_ASSERT_EQUAL_INT(7, (int)amdgpu_ih_process());
+
+  for (uint32_t i = 7; i < 12; i++) { // Past the end and around
+    eop.src_data[0] = i;
+    TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_sim_raise(&eop));
+  }
+  TEST_ASSERT_EQUAL_INT(5, (int)amdgpu_ih_process());
+  TEST_ASSERT_EQUAL_INT(12, seen_count);
+  for (int i = 0; i < 12; i++)
+    TEST_ASSERT_EQUAL_INT(i, (int)seen[i].src_data[0]);
+
+  struct amdgpu_ih_stats st;
+  amdgpu_ih_get_stats(&st);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.overflows);
+  amdgpu_ih_fini();
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: The simulated device wakes the worker
+ * ============================================================================ */
+
+TEST_CASE(ih_sim_worker_wakes)
+{
+  seen_count = 0;
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_ih_init(0, AMDGPU_IH_WAKE_UIO, -1)); // No fd
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_init(0, AMDGPU_IH_WAKE_SIM, -1));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_ih_register(SOC15_IH_CLIENTID_SDMA0,
+                                              SDMA0_5_0__SRCID__SDMA_TRAP,
+                                              record_iv, NULL));
+
+  // A copy engine stream ending in a TRAP, run by the simulated SDMA
+  uint32_t dw[8];
+  struct sdma_builder b;
+  sdma_builder_init(&b, dw, 8);
+  sdma_nop(&b, 1);
+  sdma_trap(&b, 0x1234);
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_sdma_execute_sim(dw, b.cdw));
+  TEST_ASSERT_EQUAL_INT(1, wait_seen(1));
+  TEST_ASSERT_EQUAL_INT(SOC15_IH_CLIENTID_SDMA0, (int)seen[0].client_id);
+  TEST_ASSERT_EQUAL_INT(0x1234, (int)seen[0].src_data[0]);
+
+  struct amdgpu_ih_stats st;
+  amdgpu_ih_get_stats(&st);
+  TEST_ASSERT_TRUE(st.wakeups >= 1);
+  amdgpu_ih_fini();
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t ih_tests[] = {
+    TEST_REGISTER(ih_dispatch_by_source),
+    TEST_REGISTER(ih_overflow_and_wrap),
+    TEST_REGISTER(ih_sim_worker_wakes),
+    TEST_REGISTER_END
+};
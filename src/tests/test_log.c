@@ -0,0 +1,349 @@
+/*
+ * Unit Tests for Gated Logging
+ *
+ * Tests core functionality:
+ * - Calls below the compile-time level vanish, arguments included
+ * - Per-subsystem runtime levels, set directly or through AMDGPU_LOG
+ * - A rate-limited call site prints its burst, then reports what it dropped
+ * - The async backend writes exactly what printf would, in order per thread,
+ *   and drops (and says so) instead of blocking when a ring fills
+ * - An idle writer sleeps until somebody logs
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+// This file is built as a release build would be: DEBUG and TRACE compile out
+#undef OS_LOG_MIN_LEVEL
+#define OS_LOG_MIN_LEVEL OS_LOG_LEVEL_INFO
+
+#include "test_framework.h"
+#include "../../os/interface/os_log.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+static int sink_count[OS_LOG_SUBSYS_COUNT];
+static char sink_last[256];
+
+static void count_sink(enum os_log_subsys subsys, int level, const char *msg, size_t len) {
+  (void)level;
+  sink_count[subsys]++;
+  size_t n = len < sizeof(sink_last) - 1 ? len : sizeof(sink_last) - 1;
+  memcpy(sink_last, msg, n);
+  sink_last[n] = '\0';
+}
+
+static void sink_reset(void) {
+  memset(sink_count, 0, sizeof(sink_count));
+  sink_last[0] = '\0';
+  os_log_set_sink(count_sink);
+}
+
+static int evaluated;
+
+static int side_effect(void) {
+  return ++evaluated;
+}
+
+/* ============================================================================
+ * Test Case: Compiled out below OS_LOG_MIN_LEVEL
+ * ============================================================================ */
+
+TEST_CASE(log_compiled_out)
+{
+  sink_reset();
+  os_log_set_level(OS_LOG_HAL, OS_LOG_LEVEL_TRACE);
+  evaluated = 0;
+
+  // Runtime says yes, the build says no
+  os_log_debug(OS_LOG_HAL, "debug %d\n", side_effect());
+  os_log_trace(OS_LOG_HAL, "trace %d\n", side_effect());
+  TEST_ASSERT_EQUAL_INT(0, evaluated);
+  TEST_ASSERT_EQUAL_INT(0, sink_count[OS_LOG_HAL]);
+
+  os_log_info(OS_LOG_HAL, "info %d\n", side_effect());
+  TEST_ASSERT_EQUAL_INT(1, evaluated);
+  TEST_ASSERT_EQUAL_INT(1, sink_count[OS_LOG_HAL]);
+  TEST_ASSERT_TRUE(strcmp(sink_last, "info 1\n") == 0);
+
+  os_log_set_sink(NULL);
+  os_log_init();
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Runtime levels per subsystem
+ * ============================================================================ */
+
+TEST_CASE(log_runtime_levels)
+{
+  sink_reset();
+  evaluated = 0;
+
+  // Default INFO everywhere
+  os_log_init();
+  os_log_warn(OS_LOG_SHIM, "warn\n");
+  os_log_info(OS_LOG_GFX, "info\n");
+  TEST_ASSERT_EQUAL_INT(1, sink_count[OS_LOG_SHIM]);
+  TEST_ASSERT_EQUAL_INT(1, sink_count[OS_LOG_GFX]);
+
+  os_log_set_level(OS_LOG_GFX, OS_LOG_LEVEL_ERROR);
+  os_log_warn(OS_LOG_GFX, "warn %d\n", side_effect());
+  TEST_ASSERT_EQUAL_INT(0, evaluated); // Filtered before the arguments
+  TEST_ASSERT_EQUAL_INT(1, sink_count[OS_LOG_GFX]);
+
+  setenv("AMDGPU_LOG", "warn,hal=error,shim=off,bogus=info,rmapi=nonsense", 1);
+  os_log_init();
+  unsetenv("AMDGPU_LOG");
+  TEST_ASSERT_EQUAL_INT(OS_LOG_LEVEL_WARN, os_log_level[OS_LOG_CORE]);
+  TEST_ASSERT_EQUAL_INT(OS_LOG_LEVEL_ERROR, os_log_level[OS_LOG_HAL]);
+  TEST_ASSERT_EQUAL_INT(OS_LOG_LEVEL_OFF, os_log_level[OS_LOG_SHIM]);
+  TEST_ASSERT_EQUAL_INT(OS_LOG_LEVEL_WARN, os_log_level[OS_LOG_RMAPI]);
+  TEST_ASSERT_EQUAL_INT(OS_LOG_LEVEL_WARN, os_log_level[OS_LOG_GFX]);
+
+  os_log_error(OS_LOG_SHIM, "error\n");
+  os_log_info(OS_LOG_CORE, "info\n");
+  os_log_error(OS_LOG_HAL, "error\n");
+  TEST_ASSERT_EQUAL_INT(1, sink_count[OS_LOG_SHIM]);
+  TEST_ASSERT_EQUAL_INT(0, sink_count[OS_LOG_CORE]);
+  TEST_ASSERT_EQUAL_INT(1, sink_count[OS_LOG_HAL]);
+
+  os_log_set_sink(NULL);
+  os_log_init();
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Rate limiting
+ * ============================================================================ */
+
+static void noisy(int i) {
+  os_log_ratelimited(OS_LOG_RMAPI, OS_LOG_LEVEL_ERROR, "bad packet %d\n", i);
+}
+
+TEST_CASE(log_ratelimit)
+{
+  sink_reset();
+  os_log_init();
+  struct os_log_stats before, after;
+  os_log_get_stats(&before);
+
+  for (int i = 0; i < 100; i++)
+    noisy(i);
+  TEST_ASSERT_EQUAL_INT(OS_LOG_RATELIMIT_BURST, sink_count[OS_LOG_RMAPI]);
+  TEST_ASSERT_TRUE(strcmp(sink_last, "bad packet 9\n") == 0);
+
+  os_log_get_stats(&after);
+  TEST_ASSERT_EQUAL_INT(100 - OS_LOG_RATELIMIT_BURST,
+                        (int)(after.suppressed - before.suppressed));
+  TEST_ASSERT_EQUAL_INT(OS_LOG_RATELIMIT_BURST, (int)(after.emitted - before.emitted));
+
+  // Its own counter: another call site still gets its burst
+  os_log_ratelimited(OS_LOG_RMAPI, OS_LOG_LEVEL_ERROR, "other\n");
+  TEST_ASSERT_EQUAL_INT(OS_LOG_RATELIMIT_BURST + 1, sink_count[OS_LOG_RMAPI]);
+
+  // The window reopening reports the drops first
+  struct os_log_ratelimit rs;
+  memset(&rs, 0, sizeof(rs));
+  rs.window_start_ns = 1; // Long ago
+  rs.missed = 7;
+  TEST_ASSERT_TRUE(os_log_ratelimit_ok(&rs, OS_LOG_RMAPI, OS_LOG_LEVEL_ERROR));
+  TEST_ASSERT_TRUE(strcmp(sink_last, "LOG: 7 messages suppressed\n") == 0);
+  TEST_ASSERT_EQUAL_INT(0, (int)rs.missed);
+
+  os_log_set_sink(NULL);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Async backend output
+ * ============================================================================ */
+
+#define ASYNC_PATH "/tmp/amdgpu_test_log_async.log"
+#define ASYNC_THREADS 4
+#define ASYNC_MSGS 200
+#define ASYNC_FMT "t%d #%03d %s|%-6s|%5.2f|%llx|%zu|%c|%hhd|%*d|%.*s|%p|%%\n"
+
+static const char *async_word(int i) {
+  return (i & 1) ? "odd" : NULL; // NULL prints as (null)
+}
+
+#define ASYNC_ARGS(t, i)                                                    \
+  (t), (i), async_word(i), "ab", (i) / 8.0, 0xabcdef00ull + (i),           \
+      (size_t)(i) * 3, 'a' + (i) % 26, (char)(i), 4, (i), 2, "xyz",        \
+      (void *)(uintptr_t)(0x1000 + (i))
+
+static void *async_thread(void *p) {
+  int t = (int)(intptr_t)p;
+  for (int i = 0; i < ASYNC_MSGS; i++)
+    os_log_info(OS_LOG_RMAPI, ASYNC_FMT, ASYNC_ARGS(t, i));
+  return NULL;
+}
+
+// Skips the "[    0.001234] " stamp
+static const char *after_stamp(const char *line) {
+  const char *p = strstr(line, "] ");
+  return p ? p + 2 : line;
+}
+
+TEST_CASE(log_async_output)
+{
+  os_log_init();
+  remove(ASYNC_PATH);
+  struct os_log_async_stats before, after;
+  os_log_async_get_stats(&before);
+  TEST_ASSERT_EQUAL_INT(0, os_log_async_start(OS_LOG_ASYNC_FILE, ASYNC_PATH, 0));
+  TEST_ASSERT_TRUE(os_log_async_active());
+  TEST_ASSERT_EQUAL_INT(-1, os_log_async_start(OS_LOG_ASYNC_STDERR, NULL, 0));
+
+  pthread_t th[ASYNC_THREADS];
+  for (int t = 0; t < ASYNC_THREADS; t++)
+    pthread_create(&th[t], NULL, async_thread, (void *)(intptr_t)t);
+  for (int t = 0; t < ASYNC_THREADS; t++)
+    pthread_join(th[t], NULL);
+  os_log_info(OS_LOG_RMAPI, "wide %ls\n", L"chars"); // Formatted in place
+  os_log_async_stop();
+  TEST_ASSERT_FALSE(os_log_async_active());
+
+  os_log_async_get_stats(&after);
+  TEST_ASSERT_EQUAL_INT(ASYNC_THREADS * ASYNC_MSGS + 1, (int)(after.records - before.records));
+  TEST_ASSERT_EQUAL_INT(0, (int)(after.dropped - before.dropped));
+  TEST_ASSERT_EQUAL_INT(1, (int)(after.text_fallbacks - before.text_fallbacks));
+
+  // Every line matches printf, and each thread's lines are in order
+  FILE *f = fopen(ASYNC_PATH, "r");
+  TEST_ASSERT_NOT_NULL(f);
+  char line[512], want[512];
+  int next[ASYNC_THREADS] = {0}, lines = 0, wide = 0, bad = 0;
+  while (fgets(line, sizeof(line), f)) {
+    const char *msg = after_stamp(line);
+    lines++;
+    if (strcmp(msg, "wide chars\n") == 0) {
+      wide++;
+      continue;
+    }
+    int t = -1;
+    if (sscanf(msg, "t%d", &t) != 1 || t < 0 || t >= ASYNC_THREADS || next[t] >= ASYNC_MSGS) {
+      bad++;
+      continue;
+    }
+    snprintf(want, sizeof(want), ASYNC_FMT, ASYNC_ARGS(t, next[t]));
+    if (strcmp(msg, want) != 0)
+      bad++;
+    next[t]++;
+  }
+  fclose(f);
+  remove(ASYNC_PATH);
+  TEST_ASSERT_EQUAL_INT(0, bad);
+  TEST_ASSERT_EQUAL_INT(1, wide);
+  TEST_ASSERT_EQUAL_INT(ASYNC_THREADS * ASYNC_MSGS + 1, lines);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Async backend drops when a ring is full
+ * ============================================================================ */
+
+#define FLOOD_MSGS 5000
+
+static void *flood_thread(void *p) {
+  const char *pad = p;
+  for (int i = 0; i < FLOOD_MSGS; i++)
+    os_log_info(OS_LOG_RMAPI, "flood %d %s\n", i, pad);
+  return NULL;
+}
+
+TEST_CASE(log_async_drops)
+{
+  static char pad[201];
+  memset(pad, 'x', sizeof(pad) - 1);
+  os_log_init();
+  remove(ASYNC_PATH);
+  struct os_log_async_stats before, after;
+  os_log_async_get_stats(&before);
+  TEST_ASSERT_EQUAL_INT(-1, os_log_async_start(OS_LOG_ASYNC_FILE, ASYNC_PATH, 3000));
+  TEST_ASSERT_EQUAL_INT(0, os_log_async_start(OS_LOG_ASYNC_FILE, ASYNC_PATH, 4096));
+
+  // A fresh thread, so it gets a 4 KB ring: about 16 of these records
+  pthread_t th;
+  pthread_create(&th, NULL, flood_thread, pad);
+  pthread_join(th, NULL);
+  os_log_async_stop();
+
+  os_log_async_get_stats(&after);
+  int records = (int)(after.records - before.records);
+  int dropped = (int)(after.dropped - before.dropped);
+  TEST_ASSERT_EQUAL_INT(FLOOD_MSGS, records + dropped);
+  TEST_ASSERT_TRUE(dropped > 0);
+
+  FILE *f = fopen(ASYNC_PATH, "r");
+  TEST_ASSERT_NOT_NULL(f);
+  char line[512];
+  int flood = 0, reported = 0;
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long long n;
+    const char *msg = after_stamp(line);
+    if (strncmp(msg, "flood ", 6) == 0)
+      flood++;
+    else if (sscanf(msg, "LOG: %llu messages dropped", &n) == 1)
+      reported += (int)n;
+  }
+  fclose(f);
+  remove(ASYNC_PATH);
+  TEST_ASSERT_EQUAL_INT(records, flood);
+  TEST_ASSERT_EQUAL_INT(dropped, reported);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Async writer sleeps while idle, wakes for the next record
+ * ============================================================================ */
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+TEST_CASE(log_async_idle_sleeps)
+{
+  os_log_init();
+  remove(ASYNC_PATH);
+  struct os_log_async_stats before, after;
+  TEST_ASSERT_EQUAL_INT(0, os_log_async_start(OS_LOG_ASYNC_FILE, ASYNC_PATH, 0));
+  os_log_async_get_stats(&before);
+  usleep(100000); // Polling every few ms would be dozens of wakeups
+  os_log_async_get_stats(&after);
+  TEST_ASSERT_TRUE(after.wakeups - before.wakeups <= 1);
+
+  // One record wakes it, long before the fallback flush
+  uint64_t start = now_ms();
+  os_log_info(OS_LOG_RMAPI, "wake up %d\n", 1);
+  do {
+    usleep(1000);
+    os_log_async_get_stats(&after);
+  } while (after.batches == before.batches && now_ms() - start < 5000);
+  TEST_ASSERT_TRUE(after.batches > before.batches);
+  TEST_ASSERT_TRUE(now_ms() - start < OS_LOG_ASYNC_FLUSH_MS / 2);
+  os_log_async_stop();
+  remove(ASYNC_PATH);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t log_tests[] = {
+    TEST_REGISTER(log_compiled_out),
+    TEST_REGISTER(log_runtime_levels),
+    TEST_REGISTER(log_ratelimit),
+    TEST_REGISTER(log_async_output),
+    TEST_REGISTER(log_async_drops),
+    TEST_REGISTER(log_async_idle_sleeps),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,371 @@
+/*
+ * Unit Tests for the PM4 Builder
+ *
+ * Tests core functionality:
+ * - Register write coalescing
+ * - Packet layouts (header counts and payloads)
+ * - Overflow handling
+ * - Ring reservations (zero-copy submission)
+ * - IB pool chaining and recycling, retired fences give ring space back
+ * - A submitted stream goes again as is, its chunks wait for the last fence
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../drivers/amdgpu/pm4_builder.h"
+#include "../../drivers/interface/ring_mgmt.h"
+#include "../../drivers/interface/ib_pool.h"
+#include <string.h>
+
+/* ============================================================================
+ * Test Case: Consecutive registers share one packet
+ * ============================================================================ */
+
+TEST_CASE(pm4_coalesce_consecutive_regs)
+{
+    uint32_t buf[32];
+    struct pm4_builder b;
+    pm4_builder_init(&b, buf, 32, false);
+
+    pm4_set_sh_reg(&b, PACKET3_SET_SH_REG_START + 4, 0x11);
+    pm4_set_sh_reg(&b, PACKET3_SET_SH_REG_START + 5, 0x22);
+    pm4_set_sh_reg(&b, PACKET3_SET_SH_REG_START + 6, 0x33);
+
+    // One header + offset + three values
+    TEST_ASSERT_EQUAL_INT(5, b.cdw);
+    TEST_ASSERT_EQUAL_INT(PACKET3_SET_SH_REG, CP_PACKET3_GET_OPCODE(buf[0]));
+    TEST_ASSERT_EQUAL_INT(3, CP_PACKET_GET_COUNT(buf[0]));
+    TEST_ASSERT_EQUAL_INT(4, buf[1]);
+    TEST_ASSERT_EQUAL_INT(0x33, buf[4]);
+    TEST_ASSERT_TRUE(pm4_builder_ok(&b));
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: Gaps, other register spaces and other packets break the run
+ * ============================================================================ */
+
+TEST_CASE(pm4_coalesce_breaks)
+{
+    uint32_t buf[64];
+    struct pm4_builder b;
+    pm4_builder_init(&b, buf, 64, false);
+
+    pm4_set_context_reg(&b, PACKET3_SET_CONTEXT_REG_START + 1, 1);
+    pm4_set_context_reg(&b, PACKET3_SET_CONTEXT_REG_START + 3, 2); // Gap
+    TEST_ASSERT_EQUAL_INT(6, b.cdw);
+
+    pm4_set_uconfig_reg(&b, PACKET3_SET_UCONFIG_REG_START + 4, 3); // Other space
+    TEST_ASSERT_EQUAL_INT(9, b.cdw);
+
+    pm4_draw_index_auto(&b, 3, PM4_DI_SRC_SEL_AUTO_INDEX);
+    pm4_set_uconfig_reg(&b, PACKET3_SET_UCONFIG_REG_START + 5, 4); // After a draw
+    TEST_ASSERT_EQUAL_INT(15, b.cdw);
+    TEST_ASSERT_EQUAL_INT(PACKET3_SET_UCONFIG_REG, CP_PACKET3_GET_OPCODE(buf[12]));
+    TEST_ASSERT_EQUAL_INT(1, CP_PACKET_GET_COUNT(buf[12]));
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: Compute builders tag packets with the shader type bit
+ * ============================================================================ */
+
+TEST_CASE(pm4_compute_shader_type)
+{
+    uint32_t buf[16];
+    struct pm4_builder b;
+    pm4_builder_init(&b, buf, 16, true);
+
+    pm4_set_sh_reg(&b, PACKET3_SET_SH_REG_START, 7);
+    pm4_dispatch_direct(&b, 4, 2, 1, PM4_DISPATCH_INITIATOR_DEFAULT);
+
+    TEST_ASSERT_EQUAL_INT((uint32_t)PACKET3_COMPUTE(PACKET3_SET_SH_REG, 1), buf[0]);
+    TEST_ASSERT_EQUAL_INT((uint32_t)PACKET3_COMPUTE(PACKET3_DISPATCH_DIRECT, 3), buf[3]);
+    TEST_ASSERT_EQUAL_INT(4, buf[4]);
+    TEST_ASSERT_EQUAL_INT(PM4_DISPATCH_INITIATOR_DEFAULT, buf[7]);
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: RELEASE_MEM / INDIRECT_BUFFER / WAIT_REG_MEM layouts
+ * ============================================================================ */
+
+TEST_CASE(pm4_packet_layouts)
+{
+    uint32_t buf[32];
+    struct pm4_builder b;
+    pm4_builder_init(&b, buf, 32, false);
+
+    pm4_release_mem(&b, PM4_EVENT_CACHE_FLUSH_AND_INV_TS, 0,
+                    0x123456789000ull, 0xAABBCCDD00000001ull, PM4_DATA_SEL_64,
+                    PM4_INT_SEL_ON_CONFIRM);
+    TEST_ASSERT_EQUAL_INT(8, b.cdw);
+    TEST_ASSERT_EQUAL_INT(6, CP_PACKET_GET_COUNT(buf[0]));
+    TEST_ASSERT_EQUAL_INT(0x56789000, buf[3]);
+    TEST_ASSERT_EQUAL_INT(0x1234, buf[4]);
+    TEST_ASSERT_EQUAL_INT(1, buf[5]);
+    TEST_ASSERT_EQUAL_INT(0xAABBCCDD, buf[6]);
+
+    pm4_indirect_buffer(&b, 0x1000ull, 64, 3);
+    TEST_ASSERT_EQUAL_INT(12, b.cdw);
+    TEST_ASSERT_EQUAL_INT(64 | (3 << 24) | INDIRECT_BUFFER_VALID, buf[11]);
+
+    pm4_wait_reg_mem(&b, PM4_SPACE_MEM, PM4_WAIT_GE, 0x2000ull, 5, ~0u, 4);
+    TEST_ASSERT_EQUAL_INT(19, b.cdw);
+    TEST_ASSERT_EQUAL_INT(5, CP_PACKET_GET_COUNT(buf[12]));
+    TEST_ASSERT_EQUAL_INT(WAIT_REG_MEM_FUNCTION(PM4_WAIT_GE) |
+                          WAIT_REG_MEM_MEM_SPACE(PM4_SPACE_MEM), buf[13]);
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: Big DMA_DATA copies are split, only the last one syncs
+ * ============================================================================ */
+
+TEST_CASE(pm4_dma_data_chunks)
+{
+    uint32_t buf[32];
+    struct pm4_builder b;
+    pm4_builder_init(&b, buf, 32, false);
+
+    pm4_dma_copy(&b, 0x100000000ull, 0x200000000ull,
+                 (uint64_t)PM4_DMA_DATA_MAX_BYTES + 64, true);
+
+    TEST_ASSERT_EQUAL_INT(14, b.cdw);
+    TEST_ASSERT_EQUAL_INT(PM4_DMA_DATA_MAX_BYTES, buf[6]);
+    TEST_ASSERT_EQUAL_INT(64, buf[13]);
+    TEST_ASSERT_FALSE(buf[1] & PACKET3_DMA_DATA_CP_SYNC);
+    TEST_ASSERT_TRUE(buf[8] & PACKET3_DMA_DATA_CP_SYNC);
+    // Second chunk starts where the first one ended
+    TEST_ASSERT_EQUAL_INT(PM4_DMA_DATA_MAX_BYTES, buf[9]);
+    TEST_ASSERT_EQUAL_INT(2, buf[10]);
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: Running out of room stops writing and is remembered
+ * ============================================================================ */
+
+TEST_CASE(pm4_overflow)
+{
+    uint32_t buf[8];
+    struct pm4_builder b;
+    memset(buf, 0, sizeof(buf));
+    pm4_builder_init(&b, buf, 4, false);
+
+    pm4_set_config_reg(&b, PACKET3_SET_CONFIG_REG_START, 1);
+    pm4_set_config_reg(&b, PACKET3_SET_CONFIG_REG_START + 1, 2);
+    TEST_ASSERT_TRUE(pm4_builder_ok(&b));
+
+    pm4_release_mem(&b, 0, 0, 0, 0, 0, 0);  // Doesn't fit
+    pm4_set_config_reg(&b, PACKET3_SET_CONFIG_REG_START + 2, 3); // Would fit, still refused
+    TEST_ASSERT_FALSE(pm4_builder_ok(&b));
+    TEST_ASSERT_EQUAL_INT(4, b.cdw);
+    TEST_ASSERT_EQUAL_INT(0, buf[4]);
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: IB padding
+ * ============================================================================ */
+
+TEST_CASE(pm4_pad)
+{
+    uint32_t buf[16];
+    struct pm4_builder b;
+    pm4_builder_init(&b, buf, 16, false);
+
+    pm4_draw_index_auto(&b, 3, PM4_DI_SRC_SEL_AUTO_INDEX);
+    pm4_pad(&b, PM4_IB_ALIGN_DW);
+    TEST_ASSERT_EQUAL_INT(8, b.cdw);
+    TEST_ASSERT_EQUAL_INT((uint32_t)PM4_NOP_DWORD, buf[7]);
+
+    pm4_pad(&b, PM4_IB_ALIGN_DW); // Already aligned
+    TEST_ASSERT_EQUAL_INT(8, b.cdw);
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: Building straight into a ring reservation, including a wrap
+ * ============================================================================ */
+
+TEST_CASE(pm4_ring_reserve)
+{
+    uint32_t ring_mem[16];
+    gpu_ring_t ring;
+    memset(ring_mem, 0, sizeof(ring_mem));
+    ring_init(&ring, 0, RING_TYPE_GFX, 0, 0x1000, 16);
+    ring.ring_buffer = ring_mem;
+
+    ring.wptr = ring.rptr = 12; // 4 dwords left before the end
+    uint32_t *space = ring_reserve(&ring, 6);
+    TEST_ASSERT_EQUAL_PTR(&ring_mem[0], space);
+    TEST_ASSERT_EQUAL_INT(0x80000000, ring_mem[12]); // Tail got padded
+
+    struct pm4_builder b;
+    pm4_builder_init(&b, space, 6, false);
+    pm4_dispatch_indirect(&b, 0, PM4_DISPATCH_INITIATOR_DEFAULT);
+    TEST_ASSERT_EQUAL_INT(0, ring_commit(&ring, b.cdw));
+    TEST_ASSERT_EQUAL_INT(3, ring_get_wptr(&ring));
+    TEST_ASSERT_EQUAL_INT((uint32_t)PACKET3(PACKET3_DISPATCH_INDIRECT, 1), ring_mem[0]);
+
+    // Full ring: the GPU hasn't read anything yet
+    TEST_ASSERT_NULL(ring_reserve(&ring, 12));
+
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: Long streams chain IB -> IB, the ring only gets the jump + fence
+ * ============================================================================ */
+
+TEST_CASE(ib_pool_chaining)
+{
+    uint32_t ring_mem[64];
+    gpu_ring_t ring;
+    ib_pool_t pool;
+    ib_stream_t ib;
+    memset(ring_mem, 0, sizeof(ring_mem));
+    ring_init(&ring, 0, RING_TYPE_GFX, 0, 0x1000, 64);
+    ring.ring_buffer = ring_mem;
+    TEST_ASSERT_EQUAL_INT(0, ib_pool_init(&pool, &ring, 2));
+    TEST_ASSERT_EQUAL_INT(0, ib_begin(&pool, &ib));
+
+    // A bit more than one chunk of 3-dword draws
+    uint32_t draws = (IB_CHUNK_DW - IB_CHAIN_RESERVE_DW) / 3 + 1;
+    for (uint32_t i = 0; i < draws; i++)
+        pm4_draw_index_auto(ib_reserve(&ib, 3), 3, PM4_DI_SRC_SEL_AUTO_INDEX);
+    struct ib_chunk *first = ib.first, *second = ib.cur;
+    TEST_ASSERT_TRUE(first != second);
+
+    uint64_t fence = 0;
+    TEST_ASSERT_EQUAL_INT(0, ib_submit(&ib, &fence));
+    TEST_ASSERT_EQUAL_INT(1, (int)fence);
+    TEST_ASSERT_EQUAL_INT(IB_SUBMIT_RING_DW, ring_get_wptr(&ring));
+
+    // Ring: one INDIRECT_BUFFER to the first chunk, sized and aligned
+    TEST_ASSERT_EQUAL_INT((uint32_t)PACKET3(PACKET3_INDIRECT_BUFFER, 2), ring_mem[0]);
+    uint32_t first_ndw = ring_mem[3] & PM4_IB_SIZE_MASK;
+    TEST_ASSERT_EQUAL_INT(0, first_ndw % PM4_IB_ALIGN_DW);
+    TEST_ASSERT_EQUAL_INT((uint32_t)first->gpu, ring_mem[1]);
+    TEST_ASSERT_EQUAL_INT((uint32_t)PACKET3(PACKET3_RELEASE_MEM, 6), ring_mem[4]);
+
+    // First chunk ends in a chain packet into the second, patched with its size
+    uint32_t *chain = &first->cpu[first_ndw - 4];
+    TEST_ASSERT_EQUAL_INT((uint32_t)PACKET3(PACKET3_INDIRECT_BUFFER, 2), chain[0]);
+    TEST_ASSERT_EQUAL_INT((uint32_t)second->gpu, chain[1]);
+    TEST_ASSERT_TRUE(chain[3] & PM4_IB_CHAIN);
+    TEST_ASSERT_EQUAL_INT(PM4_IB_ALIGN_DW, chain[3] & PM4_IB_SIZE_MASK);
+    TEST_ASSERT_EQUAL_INT(2, (chain[3] >> 24) & 0xF);
+
+    ib_pool_fini(&pool);
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: Chunks come back to the pool only after their fence signals
+ * ============================================================================ */
+
+TEST_CASE(ib_pool_recycle)
+{
+    uint32_t ring_mem[64];
+    gpu_ring_t ring;
+    ib_pool_t pool;
+    ib_stream_t ib;
+    ring_init(&ring, 0, RING_TYPE_COMPUTE, 0, 0x1000, 64);
+    ring.ring_buffer = ring_mem;
+    TEST_ASSERT_EQUAL_INT(0, ib_pool_init(&pool, &ring, 0));
+
+    TEST_ASSERT_EQUAL_INT(0, ib_begin(&pool, &ib));
+    pm4_dispatch_direct(ib_reserve(&ib, 5), 1, 1, 1, PM4_DISPATCH_INITIATOR_DEFAULT);
+    struct ib_chunk *used = ib.first;
+    uint64_t fence = 0;
+    TEST_ASSERT_EQUAL_INT(0, ib_submit(&ib, &fence));
+    TEST_ASSERT_EQUAL_INT((uint32_t)PACKET3_COMPUTE(PACKET3_INDIRECT_BUFFER, 2), ring_mem[0]);
+    TEST_ASSERT_EQUAL_INT(IB_SLAB_CHUNKS - 1, pool.free_count);
+
+    // Signaled, but the stream still owns its chunk
+    TEST_ASSERT_EQUAL_INT(0, ring_get_rptr(&ring));
+    *pool.fence_cpu = fence;
+    TEST_ASSERT_TRUE(ib_pool_reclaim(&pool) == fence);
+    TEST_ASSERT_EQUAL_INT(IB_SUBMIT_RING_DW, ring_get_rptr(&ring)); // Ring space is back
+    TEST_ASSERT_EQUAL_INT(IB_SLAB_CHUNKS - 1, pool.free_count);
+
+    // Done with it: the chunk is free again and gets reused
+    ib_discard(&ib);
+    TEST_ASSERT_EQUAL_INT(IB_SLAB_CHUNKS, pool.free_count);
+    TEST_ASSERT_EQUAL_INT(0, ib_begin(&pool, &ib));
+    TEST_ASSERT_EQUAL_PTR(used, ib.first);
+    ib_discard(&ib);
+
+    ib_pool_fini(&pool);
+    return 1;
+}
+
+/* ============================================================================
+ * Test Case: Submitting the same stream twice, dropping it while in flight
+ * ============================================================================ */
+
+TEST_CASE(ib_pool_resubmit)
+{
+    uint32_t ring_mem[64];
+    gpu_ring_t ring;
+    ib_pool_t pool;
+    ib_stream_t ib;
+    ring_init(&ring, 0, RING_TYPE_GFX, 0, 0x1000, 64);
+    ring.ring_buffer = ring_mem;
+    TEST_ASSERT_EQUAL_INT(0, ib_pool_init(&pool, &ring, 0));
+
+    TEST_ASSERT_EQUAL_INT(0, ib_begin(&pool, &ib));
+    pm4_draw_index_auto(ib_reserve(&ib, 3), 3, PM4_DI_SRC_SEL_AUTO_INDEX);
+    uint64_t f1 = 0, f2 = 0;
+    TEST_ASSERT_EQUAL_INT(0, ib_submit(&ib, &f1));
+    TEST_ASSERT_NULL(ib_reserve(&ib, 3)); // Closed for recording
+    TEST_ASSERT_EQUAL_INT(0, ib_submit(&ib, &f2));
+    TEST_ASSERT_EQUAL_INT(2, (int)f2);
+
+    // Both jumps go to the same chunk, same size: closed (padded) only once
+    uint32_t *second = &ring_mem[IB_SUBMIT_RING_DW];
+    TEST_ASSERT_EQUAL_INT(ring_mem[1], second[1]);
+    TEST_ASSERT_EQUAL_INT(ring_mem[3], second[3]);
+
+    // Dropped after the first one is done: waits for the second
+    *pool.fence_cpu = f1;
+    ib_discard(&ib);
+    TEST_ASSERT_EQUAL_INT(IB_SLAB_CHUNKS - 1, pool.free_count);
+    TEST_ASSERT_TRUE(ib_pool_reclaim(&pool) == f1);
+    TEST_ASSERT_EQUAL_INT(IB_SLAB_CHUNKS - 1, pool.free_count);
+    ib_pool_sim_retire(&pool, f2);
+    TEST_ASSERT_EQUAL_INT(IB_SLAB_CHUNKS, pool.free_count);
+    TEST_ASSERT_EQUAL_INT(2 * IB_SUBMIT_RING_DW, ring_get_rptr(&ring));
+
+    ib_pool_fini(&pool);
+    return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t pm4_builder_tests[] = {
+    TEST_REGISTER(pm4_coalesce_consecutive_regs),
+    TEST_REGISTER(pm4_coalesce_breaks),
+    TEST_REGISTER(pm4_compute_shader_type),
+    TEST_REGISTER(pm4_packet_layouts),
+    TEST_REGISTER(pm4_dma_data_chunks),
+    TEST_REGISTER(pm4_overflow),
+    TEST_REGISTER(pm4_pad),
+    TEST_REGISTER(pm4_ring_reserve),
+    TEST_REGISTER(ib_pool_chaining),
+    TEST_REGISTER(ib_pool_recycle),
+    TEST_REGISTER(ib_pool_resubmit),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,194 @@
+/*
+ * Unit Tests for PRIME Sharing
+ *
+ * Tests core functionality:
+ * - Only a pid holding a reference can export or drop one
+ * - An importer gets the same pages and a reference of its own
+ * - Buffers are found by their full address, never by its low bits
+ * - Shared fds can't be resized under the server's mapping
+ * - Only holders attach, signal or wait on a buffer's fence
+ * - A writer that dies mid-render doesn't leave its readers waiting
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create
+#endif
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* ============================================================================
+ * Test Case: Strangers can't export or unref
+ * ============================================================================ */
+
+TEST_CASE(prime_refs_belong_to_holders)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t owner = 7171, other = 7272;
+  uint32_t h;
+  uint64_t addr;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, owner, 4096, &h, &addr));
+
+  int fd = -1;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_export(&mock_gpu, other, h, &fd));
+  TEST_ASSERT_EQUAL_INT(-1, fd);
+
+  // A stranger's unref must not eat the owner's reference
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_unref(&mock_gpu, other, h));
+  struct amdgpu_buffer buf;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_get(h, &buf));
+
+  // The owner shares it, the other side imports: same buffer, same pages
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_export(&mock_gpu, owner, h, &fd));
+  uint32_t h2;
+  uint64_t addr2, size2;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_import(&mock_gpu, other, fd, &h2, &addr2,
+                                              &size2));
+  close(fd);
+  TEST_ASSERT_EQUAL_INT((int)h, (int)h2);
+  TEST_ASSERT_EQUAL_INT(4096, (int)size2);
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, owner, h));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_unref(&mock_gpu, owner, h)); // Had one
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_get(h, &buf)); // Importer still has it
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, other, h));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_get(h, &buf));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Address lookups are exact and per client
+ * ============================================================================ */
+
+TEST_CASE(prime_find_by_address)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = 7373;
+  uint32_t h, found = 0;
+  uint64_t addr;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, 4096, &h, &addr));
+  TEST_ASSERT_TRUE(addr != 0);
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_find_addr(pid, addr, &found));
+  TEST_ASSERT_EQUAL_INT((int)h, (int)found);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_find_addr(pid + 1, addr, &found));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_find_addr(pid, addr + 4096, &found));
+
+  // The low 32 bits of the address are not a name for the buffer
+  struct amdgpu_buffer buf;
+  if ((uint32_t)addr != h) {
+    TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_get((uint32_t)addr, &buf));
+    TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_unref(&mock_gpu, pid, (uint32_t)addr));
+  }
+
+  rmapi_prime_release_pid(&mock_gpu, pid);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_get(h, &buf));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: An importer can't pull the pages out from under us
+ * ============================================================================ */
+
+TEST_CASE(prime_memfd_sealed)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t owner = 7575, other = 7676;
+  uint32_t h;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, owner, 8192, &h, NULL));
+  int fd = -1;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_export(&mock_gpu, owner, h, &fd));
+
+  // What a hostile importer would do with the fd
+  TEST_ASSERT_TRUE(ftruncate(fd, 0) != 0);
+  TEST_ASSERT_TRUE(ftruncate(fd, 16384) != 0);
+  close(fd);
+
+  // Still all there: touching every page would SIGBUS otherwise
+  struct amdgpu_buffer buf;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_get(h, &buf));
+  memset(buf.cpu_addr, 0x5a, 8192);
+  TEST_ASSERT_EQUAL_INT(0x5a, ((uint8_t *)buf.cpu_addr)[8191]);
+
+  // A memfd that could still shrink doesn't get mapped at all
+  int loose = memfd_create("test_prime", 0);
+  TEST_ASSERT_TRUE(loose >= 0);
+  TEST_ASSERT_EQUAL_INT(0, ftruncate(loose, 4096));
+  uint32_t h2;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_import(&mock_gpu, other, loose, &h2,
+                                               NULL, NULL));
+  close(loose);
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, owner, h));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Implicit sync belongs to the buffer's holders
+ * ============================================================================ */
+
+TEST_CASE(prime_fence_holders_only)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t owner = 7777, other = 7878;
+  uint32_t h;
+  uint64_t seq = 0;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, owner, 4096, &h, NULL));
+
+  // A guessed handle gets a stranger nowhere
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_fence_attach(other, h, &seq));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_fence_attach(owner, h, &seq));
+  TEST_ASSERT_EQUAL_INT(1, (int)seq);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_fence_signal(other, h, seq));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_prime_fence_wait(other, h, 0));
+  TEST_ASSERT_EQUAL_INT(1, rmapi_prime_fence_wait(owner, h, 0)); // Still busy
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_fence_signal(owner, h, seq));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_fence_wait(owner, h, 0));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, owner, h));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: A dead writer's fence completes
+ * ============================================================================ */
+
+TEST_CASE(prime_dead_writer_fence)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t writer = 7979, reader = 8080;
+  uint32_t h, h2;
+  uint64_t seq = 0;
+  int fd = -1;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, writer, 4096, &h, NULL));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_export(&mock_gpu, writer, h, &fd));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_import(&mock_gpu, reader, fd, &h2, NULL,
+                                              NULL));
+  close(fd);
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_fence_attach(writer, h, &seq));
+  TEST_ASSERT_EQUAL_INT(1, rmapi_prime_fence_wait(reader, h, 0));
+
+  // Crashed before signaling: the reader gets to go on
+  rmapi_prime_release_pid(&mock_gpu, writer);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_fence_wait(reader, h, 0));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, reader, h));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t prime_tests[] = {
+    TEST_REGISTER(prime_refs_belong_to_holders),
+    TEST_REGISTER(prime_find_by_address),
+    TEST_REGISTER(prime_memfd_sealed),
+    TEST_REGISTER(prime_fence_holders_only),
+    TEST_REGISTER(prime_dead_writer_fence),
+    TEST_REGISTER_END
+};
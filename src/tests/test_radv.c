@@ -0,0 +1,83 @@
+/*
+ * Unit Tests for the RADV Backend
+ *
+ * Tests core functionality:
+ * - A client that never waits for idle keeps submitting past a full ring
+ *   and a dry IB pool
+ * - A command buffer can be submitted again without re-recording it
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../drivers/amdgpu/radv_backend/radv_backend.h"
+#include "../../drivers/amdgpu/pm4_builder.h"
+#include "../../drivers/interface/ib_pool.h"
+#include <string.h>
+
+// The RADV ring (radv_backend.c), in submissions
+#define RADV_RING_SUBMITS (0x4000 / IB_SUBMIT_RING_DW)
+
+/* ============================================================================
+ * Test Case: Several rings' worth of submits, no wait_idle in between
+ * ============================================================================ */
+
+TEST_CASE(radv_submit_past_ring)
+{
+  TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_init());
+  radv_command_buffer_allocate_info_t info;
+  memset(&info, 0, sizeof(info));
+  VkCommandBuffer cmd;
+  TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_allocate_command_buffer(0, &info, &cmd));
+
+  // Re-recorded every time: old chunks have to come back as well
+  for (int i = 0; i < 3 * RADV_RING_SUBMITS; i++) {
+    TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_begin_command_buffer(cmd));
+    struct pm4_builder *cs = radv_cmd_buffer_cs(cmd, 3);
+    TEST_ASSERT_NOT_NULL(cs);
+    pm4_draw_index_auto(cs, 3, PM4_DI_SRC_SEL_AUTO_INDEX);
+    TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_end_command_buffer(cmd));
+    TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_queue_submit(0, cmd));
+  }
+
+  TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_device_wait_idle(0));
+  radv_free_command_buffer(0, cmd);
+  radv_fini();
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Record once, submit many times
+ * ============================================================================ */
+
+TEST_CASE(radv_resubmit_command_buffer)
+{
+  TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_init());
+  radv_command_buffer_allocate_info_t info;
+  memset(&info, 0, sizeof(info));
+  VkCommandBuffer cmd;
+  TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_allocate_command_buffer(0, &info, &cmd));
+  TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_begin_command_buffer(cmd));
+  pm4_draw_index_auto(radv_cmd_buffer_cs(cmd, 3), 3, PM4_DI_SRC_SEL_AUTO_INDEX);
+  TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_end_command_buffer(cmd));
+
+  // Around the ring twice on the same IB
+  for (int i = 0; i < 2 * RADV_RING_SUBMITS; i++)
+    TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_queue_submit(0, cmd));
+
+  // Freed while in flight: the IB outlives the command buffer
+  radv_free_command_buffer(0, cmd);
+  TEST_ASSERT_EQUAL_INT(VK_SUCCESS, radv_device_wait_idle(0));
+  radv_fini();
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t radv_tests[] = {
+    TEST_REGISTER(radv_submit_past_ring),
+    TEST_REGISTER(radv_resubmit_command_buffer),
+    TEST_REGISTER_END
+};
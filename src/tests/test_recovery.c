@@ -0,0 +1,193 @@
+/*
+ * Unit Tests for Ring Recovery
+ *
+ * Tests core functionality:
+ * - A queue reset fails the guilty job, cancels its client's queue and
+ *   resubmits the innocent jobs behind it
+ * - Hanging again on the resubmitted jobs climbs to an IP block reset,
+ *   then a full one; a ring that got past them starts at the bottom again
+ * - Downtime and counts are kept per tier
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include "../../drivers/amdgpu/pm4_builder.h"
+#include <string.h>
+
+#define COMPUTE RMAPI_CLIENT_ENGINE_COMPUTE
+#define DMA RMAPI_CLIENT_ENGINE_DMA
+
+// A ring that takes jobs and never finishes them by itself
+struct held_job {
+  int32_t pid;
+  uint32_t engine;
+  uint64_t seq;
+};
+
+static struct held_job held[16];
+static int held_count;
+
+static int hold_job(void *priv, int32_t pid, uint32_t engine,
+                    struct amdgpu_command_buffer *cb, uint64_t seq) {
+  (void)priv, (void)cb;
+  struct held_job *h = &held[held_count++ % 16];
+  h->pid = pid;
+  h->engine = engine;
+  h->seq = seq;
+  return 0;
+}
+
+// Just enough of a GPU for the IP tier to find a GFX block to reset
+static int block_resets;
+
+static int mock_hw_init(struct OBJGPU *adev) {
+  (void)adev;
+  block_resets++;
+  return 0;
+}
+
+static struct ip_block_ops mock_gfx_block = {
+    .name = "r600_gfx",
+    .hw_init = mock_hw_init,
+};
+
+static struct ip_block_ops *mock_find_block(struct amd_gpu_handler *handler,
+                                            const char *name) {
+  (void)handler;
+  return strcmp(name, mock_gfx_block.name) == 0 ? &mock_gfx_block : NULL;
+}
+
+static uint32_t nop[2] = {PACKET3(PACKET3_NOP, 0), 0};
+
+/* ============================================================================
+ * Test Case: Queue reset - guilty fails, innocent go again
+ * ============================================================================ */
+
+TEST_CASE(recovery_queue_reset)
+{
+  struct amdgpu_command_buffer cb = {NULL, nop, sizeof(nop), NULL, 0};
+  struct rmapi_sched_ops ops = {hold_job, NULL, 0, NULL};
+  uint32_t never;
+  uint64_t bad, ok1, ok2;
+  rmapi_syncobj_create(NULL, 0, 0, &never);
+  rmapi_sched_set_ops(&ops);
+  rmapi_recovery_reset();
+  held_count = 0;
+
+  rmapi_sched_submit(10, COMPUTE, &cb, NULL, 0, NULL, 0, &bad);
+  rmapi_sched_submit(20, COMPUTE, &cb, NULL, 0, NULL, 0, &ok1);
+  rmapi_sched_submit(21, COMPUTE, &cb, NULL, 0, NULL, 0, &ok2);
+  // More from the guilty client, still waiting to go
+  struct rmapi_sched_dep dep = {RMAPI_SCHED_DEP_SYNCOBJ, never, 1};
+  rmapi_sched_submit(10, DMA, &cb, &dep, 1, NULL, 0, NULL);
+  TEST_ASSERT_EQUAL_INT(3, held_count);
+
+  TEST_ASSERT_EQUAL_INT(RMAPI_RECOVERY_TIER_QUEUE,
+                        rmapi_recovery_ring_hang(NULL, COMPUTE, bad, ok2));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_wait(COMPUTE, bad, 0));
+  TEST_ASSERT_EQUAL_INT(1, rmapi_sched_fence_wait(COMPUTE, ok1, 0));
+
+  // The two innocent ones again, in order, and the cancelled one's fence
+  TEST_ASSERT_EQUAL_INT(6, held_count);
+  int again = 0, fences = 0;
+  for (int i = 3; i < held_count; i++) {
+    if (held[i].engine == DMA && held[i].pid == 10)
+      fences++;
+    else if (held[i].engine == COMPUTE)
+      TEST_ASSERT_TRUE(held[i].seq == (again++ ? ok2 : ok1));
+  }
+  TEST_ASSERT_EQUAL_INT(2, again);
+  TEST_ASSERT_EQUAL_INT(1, fences);
+
+  struct rmapi_recovery_stats st;
+  rmapi_recovery_get_stats(&st);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.tiers[RMAPI_RECOVERY_TIER_QUEUE].count);
+  TEST_ASSERT_EQUAL_INT(0, (int)st.tiers[RMAPI_RECOVERY_TIER_FULL].count);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.guilty_jobs);
+  TEST_ASSERT_EQUAL_INT(2, (int)st.resubmitted);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.cancelled);
+  TEST_ASSERT_TRUE(st.tiers[RMAPI_RECOVERY_TIER_QUEUE].downtime_ns > 0);
+  TEST_ASSERT_TRUE(st.tiers[RMAPI_RECOVERY_TIER_QUEUE].downtime_max_ns ==
+                   st.tiers[RMAPI_RECOVERY_TIER_QUEUE].downtime_ns);
+
+  for (int i = 3; i < held_count; i++)
+    rmapi_sched_fence_done(held[i].engine, held[i].seq, 0);
+  rmapi_sched_set_ops(NULL);
+  rmapi_syncobj_destroy(0, never);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Hanging again climbs the ladder
+ * ============================================================================ */
+
+TEST_CASE(recovery_escalates)
+{
+  struct amdgpu_command_buffer cb = {NULL, nop, sizeof(nop), NULL, 0};
+  struct rmapi_sched_ops ops = {hold_job, NULL, 0, NULL};
+  struct amd_gpu_handler handler = {0};
+  struct OBJGPU mock_gpu = {0};
+  handler.gpu = &mock_gpu;
+  handler.find_ip_block = mock_find_block;
+  mock_gpu.handler = &handler;
+  mock_gpu.state = AMD_GPU_STATE_RUNNING;
+  rmapi_sched_set_ops(&ops);
+  rmapi_recovery_reset();
+  held_count = 0;
+  block_resets = 0;
+
+  uint64_t a, b, c;
+  rmapi_sched_submit(30, COMPUTE, &cb, NULL, 0, NULL, 0, &a);
+  rmapi_sched_submit(31, COMPUTE, &cb, NULL, 0, NULL, 0, &b);
+  rmapi_sched_submit(32, COMPUTE, &cb, NULL, 0, NULL, 0, &c);
+
+  TEST_ASSERT_EQUAL_INT(RMAPI_RECOVERY_TIER_QUEUE,
+                        rmapi_recovery_ring_hang(&mock_gpu, COMPUTE, a, c));
+  TEST_ASSERT_EQUAL_INT(0, block_resets);
+  // Stuck on a resubmitted job: the queue reset didn't do it
+  TEST_ASSERT_EQUAL_INT(RMAPI_RECOVERY_TIER_IP,
+                        rmapi_recovery_ring_hang(&mock_gpu, COMPUTE, b, c));
+  TEST_ASSERT_EQUAL_INT(1, block_resets);
+  TEST_ASSERT_EQUAL_INT(RMAPI_RECOVERY_TIER_FULL,
+                        rmapi_recovery_ring_hang(&mock_gpu, COMPUTE, c, c));
+  TEST_ASSERT_EQUAL_INT(AMD_GPU_STATE_RUNNING, (int)mock_gpu.state);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_wait(COMPUTE, c, 0));
+
+  // New work past the last reset starts at the bottom again
+  uint64_t d;
+  rmapi_sched_submit(33, COMPUTE, &cb, NULL, 0, NULL, 0, &d);
+  TEST_ASSERT_EQUAL_INT(RMAPI_RECOVERY_TIER_QUEUE,
+                        rmapi_recovery_ring_hang(&mock_gpu, COMPUTE, d, d));
+
+  // SDMA has no block to reset alone: its IP tier is a full reset
+  uint64_t e, f;
+  rmapi_sched_submit(34, DMA, &cb, NULL, 0, NULL, 0, &e);
+  rmapi_sched_submit(35, DMA, &cb, NULL, 0, NULL, 0, &f);
+  rmapi_recovery_ring_hang(&mock_gpu, DMA, e, f);
+  TEST_ASSERT_EQUAL_INT(RMAPI_RECOVERY_TIER_FULL,
+                        rmapi_recovery_ring_hang(&mock_gpu, DMA, f, f));
+  TEST_ASSERT_EQUAL_INT(1, block_resets);
+
+  struct rmapi_recovery_stats st;
+  rmapi_recovery_get_stats(&st);
+  TEST_ASSERT_EQUAL_INT(3, (int)st.tiers[RMAPI_RECOVERY_TIER_QUEUE].count);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.tiers[RMAPI_RECOVERY_TIER_IP].count);
+  TEST_ASSERT_EQUAL_INT(2, (int)st.tiers[RMAPI_RECOVERY_TIER_FULL].count);
+  TEST_ASSERT_EQUAL_INT(6, (int)st.guilty_jobs);
+  TEST_ASSERT_EQUAL_INT(0, mock_gpu.hang_detected);
+
+  rmapi_sched_set_ops(NULL);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t recovery_tests[] = {
+    TEST_REGISTER(recovery_queue_reset),
+    TEST_REGISTER(recovery_escalates),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,164 @@
+/*
+ * Unit Tests for VRAM Residency
+ *
+ * Tests core functionality:
+ * - A full VRAM evicts the coldest idle buffer, never a busy one
+ * - Moves keep cpu_addr, gpu_addr and contents where clients left them
+ * - Shareable (PRIME) buffers count against the same budget
+ * - A client's per-heap tab follows its buffers out to GTT and back
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/hal/hal.h"
+#include "../../core/rmapi/rmapi.h"
+#include <string.h>
+
+#define RES_PAGE 4096
+#define RES_DEFAULT_BUDGET (1024ull << 20)
+
+/* ============================================================================
+ * Test Case: Evict the LRU buffer, restore it on use, addresses stay put
+ * ============================================================================ */
+
+TEST_CASE(residency_evict_keeps_addresses)
+{
+  struct OBJGPU mock_gpu = {0};
+  struct amdgpu_residency_stats before, st;
+  amdgpu_residency_get_stats(&mock_gpu, &before);
+  amdgpu_residency_set_budget(&mock_gpu, before.vram_used + 2 * RES_PAGE);
+
+  struct amdgpu_buffer a = {0}, b = {0}, c = {0};
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_buffer_alloc_hal(&mock_gpu, RES_PAGE, &a));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_buffer_alloc_hal(&mock_gpu, RES_PAGE, &b));
+  memset(a.cpu_addr, 0xa5, RES_PAGE);
+  void *a_cpu = a.cpu_addr;
+  uint64_t a_gpu = a.gpu_addr;
+  uint32_t a_gen = a.generation;
+
+  // No room for c: a is the coldest, out it goes - but it doesn't move
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_buffer_alloc_hal(&mock_gpu, RES_PAGE, &c));
+  amdgpu_residency_get_stats(&mock_gpu, &st);
+  TEST_ASSERT_EQUAL_INT(1, (int)(st.evictions - before.evictions));
+  TEST_ASSERT_TRUE(a.cpu_addr == a_cpu && a.gpu_addr == a_gpu);
+  TEST_ASSERT_TRUE(a.generation != a_gen);
+  TEST_ASSERT_EQUAL_INT(0xa5, ((uint8_t *)a.cpu_addr)[RES_PAGE - 1]);
+
+  // A submission needs a again: b (now the coldest) makes way
+  struct amdgpu_buffer *list[1] = {&a};
+  uint64_t fence = amdgpu_residency_validate(&mock_gpu, list, 1);
+  amdgpu_residency_get_stats(&mock_gpu, &st);
+  TEST_ASSERT_EQUAL_INT(1, (int)(st.restores - before.restores));
+  TEST_ASSERT_EQUAL_INT(2, (int)(st.evictions - before.evictions));
+  TEST_ASSERT_TRUE(a.cpu_addr == a_cpu && a.gpu_addr == a_gpu);
+
+  // a is busy until its fence: shrinking the budget can't touch it
+  amdgpu_residency_set_budget(&mock_gpu, before.vram_used);
+  amdgpu_residency_get_stats(&mock_gpu, &st);
+  TEST_ASSERT_EQUAL_INT(3, (int)(st.evictions - before.evictions)); // Only c
+  TEST_ASSERT_TRUE(st.vram_used == before.vram_used + RES_PAGE);
+  amdgpu_residency_fence_signal(&mock_gpu, fence);
+  amdgpu_residency_set_budget(&mock_gpu, before.vram_used);
+  amdgpu_residency_get_stats(&mock_gpu, &st);
+  TEST_ASSERT_TRUE(st.vram_used == before.vram_used);
+
+  amdgpu_buffer_free_hal(&mock_gpu, &a);
+  amdgpu_buffer_free_hal(&mock_gpu, &b);
+  amdgpu_buffer_free_hal(&mock_gpu, &c);
+  amdgpu_residency_set_budget(&mock_gpu, RES_DEFAULT_BUDGET);
+  amdgpu_residency_get_stats(&mock_gpu, &st);
+  TEST_ASSERT_TRUE(st.vram_used == before.vram_used);
+  TEST_ASSERT_TRUE(st.gtt_used == before.gtt_used);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: PRIME buffers are tracked, evicted in place and untracked
+ * ============================================================================ */
+
+TEST_CASE(residency_tracks_prime_buffers)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = 8181;
+  struct amdgpu_residency_stats before, st;
+  amdgpu_residency_get_stats(&mock_gpu, &before);
+
+  uint32_t h1, h2;
+  uint64_t addr1, addr2;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, RES_PAGE, &h1, &addr1));
+  amdgpu_residency_get_stats(&mock_gpu, &st);
+  TEST_ASSERT_TRUE(st.vram_used == before.vram_used + RES_PAGE);
+
+  // Only one of them fits: the older one goes to GTT, same address
+  amdgpu_residency_set_budget(&mock_gpu, st.vram_used);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, RES_PAGE, &h2, &addr2));
+  amdgpu_residency_get_stats(&mock_gpu, &st);
+  TEST_ASSERT_EQUAL_INT(1, (int)(st.evictions - before.evictions));
+  struct amdgpu_buffer buf;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_get(h1, &buf));
+  TEST_ASSERT_TRUE(buf.gpu_addr == addr1);
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, pid, h1));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, pid, h2));
+  amdgpu_residency_set_budget(&mock_gpu, RES_DEFAULT_BUDGET);
+  amdgpu_residency_get_stats(&mock_gpu, &st);
+  TEST_ASSERT_TRUE(st.vram_used == before.vram_used);
+  TEST_ASSERT_TRUE(st.gtt_used == before.gtt_used);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Evictions and restores move the owner's VRAM/GTT charge
+ * ============================================================================ */
+
+TEST_CASE(residency_moves_client_charge)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = 8282;
+  struct amdgpu_residency_stats before;
+  struct rmapi_client_stats cs;
+  amdgpu_residency_get_stats(&mock_gpu, &before);
+
+  uint32_t h;
+  uint64_t addr;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, pid, RES_PAGE, &h, &addr));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_get_stats(pid, &cs));
+  TEST_ASSERT_EQUAL_INT(RES_PAGE, (int)cs.memory[RMAPI_CLIENT_HEAP_VRAM]);
+  TEST_ASSERT_EQUAL_INT(0, (int)cs.memory[RMAPI_CLIENT_HEAP_GTT]);
+
+  // No room left: out to GTT, and the tab says so
+  amdgpu_residency_set_budget(&mock_gpu, before.vram_used);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_get_stats(pid, &cs));
+  TEST_ASSERT_EQUAL_INT(0, (int)cs.memory[RMAPI_CLIENT_HEAP_VRAM]);
+  TEST_ASSERT_EQUAL_INT(RES_PAGE, (int)cs.memory[RMAPI_CLIENT_HEAP_GTT]);
+  TEST_ASSERT_EQUAL_INT(1, (int)cs.bo_count); // Same buffer, new home
+
+  // A submission brings it back
+  amdgpu_residency_set_budget(&mock_gpu, RES_DEFAULT_BUDGET);
+  struct amdgpu_buffer *buf = rmapi_prime_hold(pid, h);
+  TEST_ASSERT_NOT_NULL(buf);
+  uint64_t fence = amdgpu_residency_validate(&mock_gpu, &buf, 1);
+  amdgpu_residency_fence_signal(&mock_gpu, fence);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_client_get_stats(pid, &cs));
+  TEST_ASSERT_EQUAL_INT(RES_PAGE, (int)cs.memory[RMAPI_CLIENT_HEAP_VRAM]);
+  TEST_ASSERT_EQUAL_INT(0, (int)cs.memory[RMAPI_CLIENT_HEAP_GTT]);
+  TEST_ASSERT_EQUAL_INT(RES_PAGE, (int)cs.peak[RMAPI_CLIENT_HEAP_GTT]);
+
+  // Dropped from wherever it lives
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, pid, h));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, pid, h));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_client_get_stats(pid, &cs));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t residency_tests[] = {
+    TEST_REGISTER(residency_evict_keeps_addresses),
+    TEST_REGISTER(residency_tracks_prime_buffers),
+    TEST_REGISTER(residency_moves_client_charge),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,255 @@
+/*
+ * Unit Tests for the GFX Ring Mux
+ *
+ * Tests core functionality:
+ * - A high priority job gets in between the IBs of a long normal job
+ * - The preempted job resumes where it stopped, its state put back first
+ * - GFX_HIGH never waits for GFX in hardware (same ring), only on the CPU
+ * - A ring reset drops the queued copies, so resubmitted jobs run once
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include "../../drivers/amdgpu/pm4_builder.h"
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define GFX RMAPI_CLIENT_ENGINE_GFX
+#define GFX_HIGH RMAPI_CLIENT_ENGINE_GFX_HIGH
+#define SECOND 1000000000ull
+
+// The "hardware ring": writes down every chunk, and can hold the first one
+// until the test lets go
+struct mux_chunk {
+  int32_t pid;
+  uint32_t ndw;
+  uint32_t first;
+};
+
+static struct mux_chunk chunks[16];
+static int chunk_count;
+static bool gate_closed, gate_entered;
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+
+static int gated_run(void *priv, int32_t pid, const uint32_t *dw, uint32_t ndw) {
+  (void)priv;
+  pthread_mutex_lock(&gate_lock);
+  struct mux_chunk *c = &chunks[chunk_count++ % 16];
+  c->pid = pid;
+  c->ndw = ndw;
+  c->first = ndw ? dw[0] : 0;
+  gate_entered = true;
+  pthread_cond_broadcast(&gate_cond);
+  while (gate_closed)
+    pthread_cond_wait(&gate_cond, &gate_lock);
+  pthread_mutex_unlock(&gate_lock);
+  return 0;
+}
+
+static int forward_to_mux(void *priv, int32_t pid, uint32_t engine,
+                          struct amdgpu_command_buffer *cb, uint64_t seq) {
+  (void)priv;
+  return rmapi_ring_mux_submit(pid, engine, cb, seq);
+}
+
+static void gate_set(bool closed) {
+  pthread_mutex_lock(&gate_lock);
+  gate_closed = closed;
+  pthread_cond_broadcast(&gate_cond);
+  pthread_mutex_unlock(&gate_lock);
+}
+
+static void gate_wait_entered(void) {
+  pthread_mutex_lock(&gate_lock);
+  while (!gate_entered)
+    pthread_cond_wait(&gate_cond, &gate_lock);
+  pthread_mutex_unlock(&gate_lock);
+}
+
+/* ============================================================================
+ * Test Case: High priority work preempts a normal job at an IB boundary
+ * ============================================================================ */
+
+TEST_CASE(mux_preempts_at_ib_boundary)
+{
+  struct rmapi_sched_ops sched = {forward_to_mux, NULL, 0, NULL};
+  struct rmapi_ring_mux_ops mux = {gated_run, NULL, true};
+  chunk_count = 0;
+  gate_entered = false;
+  gate_set(true);
+  rmapi_sched_set_ops(&sched);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_ring_mux_init(&mux));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_ring_mux_init(&mux)); // Only one
+
+  // The compute tenant's batch: some state, three IBs (which set some more),
+  // then a NOP
+  uint32_t big[24], ib_target[4] = {PACKET3(PACKET3_SET_SH_REG, 1),
+                                    0x10, 0xABCD, 0};
+  struct pm4_builder b;
+  pm4_builder_init(&b, big, 24, false);
+  pm4_set_context_reg(&b, PACKET3_SET_CONTEXT_REG_START + 0x20, 0x1234);
+  for (int i = 0; i < 3; i++)
+    pm4_indirect_buffer(&b, (uint64_t)(uintptr_t)ib_target, 4, 0);
+  pm4_nop(&b, 2);
+  struct amdgpu_command_buffer batch = {NULL, big, b.cdw * 4, NULL, 0};
+  uint32_t frame_dw[2] = {PACKET3(PACKET3_NOP, 0), 0};
+  struct amdgpu_command_buffer frame = {NULL, frame_dw, sizeof(frame_dw), NULL, 0};
+
+  uint64_t batch_seq, frame_seq;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(1, GFX, &batch, NULL, 0, NULL, 0,
+                                              &batch_seq));
+  gate_wait_entered(); // First IB of the batch is on the ring
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(2, GFX_HIGH, &frame, NULL, 0,
+                                              NULL, 0, &frame_seq));
+  gate_set(false);
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_wait(GFX_HIGH, frame_seq, SECOND));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_wait(GFX, batch_seq, SECOND));
+  rmapi_ring_mux_fini();
+  rmapi_sched_set_ops(NULL);
+  TEST_ASSERT_FALSE(rmapi_ring_mux_active());
+
+  // State + IB 1, then the frame, then the rest of the batch one IB at a
+  // time. The first piece back has the batch's state (its own and IB 1's)
+  // in front, the ones after it run on the same state anyway.
+  TEST_ASSERT_EQUAL_INT(5, chunk_count);
+  TEST_ASSERT_EQUAL_INT(1, chunks[0].pid);
+  TEST_ASSERT_EQUAL_INT(7, (int)chunks[0].ndw);
+  TEST_ASSERT_EQUAL_INT(2, chunks[1].pid);
+  TEST_ASSERT_TRUE(chunks[1].first == frame_dw[0]);
+  for (int i = 2; i < 5; i++)
+    TEST_ASSERT_EQUAL_INT(1, chunks[i].pid);
+  TEST_ASSERT_TRUE(chunks[2].first == big[0]);
+  TEST_ASSERT_EQUAL_INT(3 + 3 + 4, (int)chunks[2].ndw);
+  TEST_ASSERT_EQUAL_INT(4, (int)chunks[3].ndw);
+  TEST_ASSERT_TRUE(chunks[4].first == (uint32_t)PM4_NOP_DWORD); // The tail
+
+  struct rmapi_ring_mux_stats st;
+  rmapi_ring_mux_get_stats(&st);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.jobs[0]);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.jobs[1]);
+  TEST_ASSERT_EQUAL_INT(1, (int)st.preemptions);
+  TEST_ASSERT_TRUE(st.resubmitted_dw > 8);
+  TEST_ASSERT_EQUAL_INT(6, (int)st.preamble_dw);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: GFX_HIGH waiting for GFX is held on the CPU, not the ring
+ * ============================================================================ */
+
+static uint32_t last_engine;
+static uint64_t last_seq;
+static int run_count;
+
+static int hold_job(void *priv, int32_t pid, uint32_t engine,
+                    struct amdgpu_command_buffer *cb, uint64_t seq) {
+  (void)priv, (void)pid, (void)cb;
+  last_engine = engine;
+  last_seq = seq;
+  run_count++;
+  return 0;
+}
+
+TEST_CASE(mux_same_ring_dep_on_cpu)
+{
+  struct rmapi_sched_ops sched = {hold_job, NULL, 0, NULL};
+  rmapi_sched_set_ops(&sched);
+  run_count = 0;
+  struct rmapi_sched_stats before, after;
+  rmapi_sched_get_stats(&before);
+
+  uint32_t nop[2] = {PACKET3(PACKET3_NOP, 0), 0};
+  struct amdgpu_command_buffer cb = {NULL, nop, sizeof(nop), NULL, 0};
+  uint64_t gfx_seq, high_seq;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(0, GFX, &cb, NULL, 0, NULL, 0,
+                                              &gfx_seq));
+  struct rmapi_sched_dep dep = {RMAPI_SCHED_DEP_FENCE, GFX, gfx_seq};
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(0, GFX_HIGH, &cb, &dep, 1, NULL,
+                                              0, &high_seq));
+  // The mux would run it first and the wait would never end: hold it
+  TEST_ASSERT_EQUAL_INT(1, run_count);
+  rmapi_sched_get_stats(&after);
+  TEST_ASSERT_EQUAL_INT(0, (int)(after.hw_waits - before.hw_waits));
+  TEST_ASSERT_EQUAL_INT(1, (int)(after.cpu_held - before.cpu_held));
+
+  rmapi_sched_fence_done(GFX, gfx_seq, 0);
+  TEST_ASSERT_EQUAL_INT(2, run_count);
+  TEST_ASSERT_EQUAL_INT(GFX_HIGH, (int)last_engine);
+  TEST_ASSERT_TRUE(last_seq == high_seq);
+  rmapi_sched_fence_done(GFX_HIGH, high_seq, 0);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_wait(GFX_HIGH, high_seq, 0));
+  rmapi_sched_set_ops(NULL);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: A queue reset takes the mux's copies back
+ * ============================================================================ */
+
+static int cancel_in_mux(void *priv, uint32_t engine, uint64_t from_seq) {
+  (void)priv;
+  return rmapi_ring_mux_cancel(engine, from_seq);
+}
+
+TEST_CASE(mux_reset_cancels_queued)
+{
+  struct rmapi_sched_ops sched = {forward_to_mux, NULL, 0, cancel_in_mux};
+  struct rmapi_ring_mux_ops mux = {gated_run, NULL, true};
+  chunk_count = 0;
+  gate_entered = false;
+  gate_set(true);
+  rmapi_sched_set_ops(&sched);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_ring_mux_init(&mux));
+
+  uint32_t nop[2] = {PACKET3(PACKET3_NOP, 0), 0};
+  struct amdgpu_command_buffer cb = {NULL, nop, sizeof(nop), NULL, 0};
+  uint64_t a, b, c;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(1, GFX, &cb, NULL, 0, NULL, 0, &a));
+  gate_wait_entered(); // a is on the ring, b and c wait in the mux
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(2, GFX, &cb, NULL, 0, NULL, 0, &b));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(3, GFX, &cb, NULL, 0, NULL, 0, &c));
+
+  // a hung, but it's on the ring: the queued copies go, the queue tier
+  // gives up and nothing is resubmitted yet
+  struct rmapi_sched_reset res;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_sched_reset_ring(GFX, a, &res));
+  TEST_ASSERT_EQUAL_INT(1, rmapi_sched_fence_wait(GFX, a, 0));
+  gate_set(false);
+
+  // Off the ring (the bigger reset): now b and c go out again, once
+  int tries = 0;
+  while (rmapi_sched_reset_ring(GFX, a, &res) != 0 && tries++ < 1000)
+    usleep(1000);
+  TEST_ASSERT_EQUAL_INT(1, res.guilty_pid);
+  TEST_ASSERT_EQUAL_INT(2, (int)res.resubmitted);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_wait(GFX, c, SECOND));
+  rmapi_ring_mux_fini();
+  rmapi_sched_set_ops(NULL);
+
+  // a's chunk, then b and c once each
+  TEST_ASSERT_EQUAL_INT(3, chunk_count);
+  TEST_ASSERT_EQUAL_INT(1, chunks[0].pid);
+  TEST_ASSERT_EQUAL_INT(2, chunks[1].pid);
+  TEST_ASSERT_EQUAL_INT(3, chunks[2].pid);
+  struct rmapi_ring_mux_stats st;
+  rmapi_ring_mux_get_stats(&st);
+  TEST_ASSERT_EQUAL_INT(3, (int)st.cancelled);
+  TEST_ASSERT_EQUAL_INT(2, (int)st.jobs[0]);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t ring_mux_tests[] = {
+    TEST_REGISTER(mux_preempts_at_ib_boundary),
+    TEST_REGISTER(mux_same_ring_dep_on_cpu),
+    TEST_REGISTER(mux_reset_cancels_queued),
+    TEST_REGISTER_END
+};
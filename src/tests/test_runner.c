@@ -11,6 +11,30 @@
 
 /* Forward declare test suites */
 extern test_entry_t gmc_v10_tests[];
+extern test_entry_t pm4_builder_tests[];
+extern test_entry_t cs_validator_tests[];
+extern test_entry_t syncobj_tests[];
+extern test_entry_t sched_tests[];
+extern test_entry_t userq_tests[];
+extern test_entry_t sdma_tests[];
+extern test_entry_t capture_tests[];
+extern test_entry_t ring_mux_tests[];
+extern test_entry_t bo_list_tests[];
+extern test_entry_t ih_tests[];
+extern test_entry_t watchdog_tests[];
+extern test_entry_t recovery_tests[];
+extern test_entry_t snapshot_tests[];
+extern test_entry_t discovery_tests[];
+extern test_entry_t atomfw_tests[];
+extern test_entry_t regs_tests[];
+extern test_entry_t log_tests[];
+extern test_entry_t trace_tests[];
+extern test_entry_t userptr_tests[];
+extern test_entry_t prime_tests[];
+extern test_entry_t residency_tests[];
+extern test_entry_t alloc_tests[];
+extern test_entry_t client_tests[];
+extern test_entry_t radv_tests[];
 
 /* ============================================================================
  * Test Suite Registry
@@ -23,6 +47,30 @@ typedef struct {
 
 test_suite_t all_suites[] = {
     {"GMC v10 (Memory Controller)", gmc_v10_tests},
+    {"PM4 Builder (Command Packets)", pm4_builder_tests},
+    {"CS Validator (Command Checks)", cs_validator_tests},
+    {"Syncobjs (Explicit Sync)", syncobj_tests},
+    {"Scheduler (Dependencies)", sched_tests},
+    {"User Queues (Doorbells)", userq_tests},
+    {"SDMA Copy Engine", sdma_tests},
+    {"Capture (Trace Recorder)", capture_tests},
+    {"Ring Mux (GFX Priorities)", ring_mux_tests},
+    {"BO Lists", bo_list_tests},
+    {"IH Ring (Interrupts)", ih_tests},
+    {"Ring Watchdog", watchdog_tests},
+    {"Ring Recovery", recovery_tests},
+    {"Register Snapshots", snapshot_tests},
+    {"IP Discovery", discovery_tests},
+    {"VBIOS Tables", atomfw_tests},
+    {"Register Lock Domains", regs_tests},
+    {"Gated Logging", log_tests},
+    {"Tracing", trace_tests},
+    {"Userptr Import", userptr_tests},
+    {"PRIME Sharing", prime_tests},
+    {"VRAM Residency", residency_tests},
+    {"Hinted Allocations", alloc_tests},
+    {"Client Accounting", client_tests},
+    {"RADV Backend", radv_tests},
     {NULL, NULL}  // Terminator
 };
 
@@ -0,0 +1,246 @@
+/*
+ * Unit Tests for the Dependency-Aware Scheduler
+ *
+ * Tests core functionality:
+ * - Waits on another engine's ring become WAIT_REG_MEM / POLL_REGMEM
+ * - Jobs held on syncobj points keep their engine's order
+ * - Implicit ordering through shared BOs
+ * - Jobs of a client that left run as bare fences
+ * - A client can't queue more than RMAPI_SCHED_MAX_CLIENT_JOBS
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include "../../drivers/amdgpu/pm4_builder.h"
+#include "../../src/amd/amdgpu/navi10_sdma_pkt_open.h"
+#include <string.h>
+
+#define GFX RMAPI_CLIENT_ENGINE_GFX
+#define DMA RMAPI_CLIENT_ENGINE_DMA
+
+// A "ring" that takes jobs and only finishes them when the test says so
+struct ran_job {
+  uint32_t engine;
+  uint64_t seq;
+  uint32_t ndw;
+  uint32_t dw[32];
+};
+
+static struct ran_job ran[16];
+static int ran_count;
+
+static int record_job(void *priv, int32_t pid, uint32_t engine,
+                      struct amdgpu_command_buffer *cb, uint64_t seq) {
+  (void)priv, (void)pid;
+  struct ran_job *r = &ran[ran_count++ % 16];
+  r->engine = engine;
+  r->seq = seq;
+  r->ndw = (uint32_t)(cb->size / 4);
+  memcpy(r->dw, cb->cmds, (r->ndw < 32 ? r->ndw : 32) * 4);
+  return 0;
+}
+
+static void sched_test_begin(void) {
+  struct rmapi_sched_ops ops = {record_job, NULL, 0, NULL};
+  rmapi_sched_set_ops(&ops);
+  ran_count = 0;
+}
+
+static void sched_test_end(void) {
+  for (int i = 0; i < ran_count && i < 16; i++)
+    rmapi_sched_fence_done(ran[i].engine, ran[i].seq, 0);
+  rmapi_sched_set_ops(NULL);
+}
+
+static uint32_t nop[2] = {PACKET3(PACKET3_NOP, 0), 0};
+static uint32_t sdma_nop[1] = {SDMA_PKT_HEADER_OP(SDMA_OP_NOP)};
+
+#define PM4_OPCODE(dw) (((dw) >> 8) & 0xFF)
+
+/* ============================================================================
+ * Test Case: GFX waiting for DMA work already on its ring doesn't block us
+ * ============================================================================ */
+
+TEST_CASE(sched_cross_engine_hw_wait)
+{
+  struct amdgpu_command_buffer up = {NULL, sdma_nop, sizeof(sdma_nop), NULL, 0};
+  struct amdgpu_command_buffer draw = {NULL, nop, sizeof(nop), NULL, 0};
+  struct rmapi_sched_stats before, after;
+  uint64_t up_seq, draw_seq;
+  sched_test_begin();
+  rmapi_sched_get_stats(&before);
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(0, DMA, &up, NULL, 0, NULL, 0, &up_seq));
+  struct rmapi_sched_dep dep = {RMAPI_SCHED_DEP_FENCE, DMA, up_seq};
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(0, GFX, &draw, &dep, 1, NULL, 0, &draw_seq));
+
+  // Both on their rings already; the draw starts by waiting for the upload
+  TEST_ASSERT_EQUAL_INT(2, ran_count);
+  TEST_ASSERT_EQUAL_INT(PACKET3_WAIT_REG_MEM, (int)PM4_OPCODE(ran[1].dw[0]));
+  TEST_ASSERT_TRUE(ran[1].dw[4] == (uint32_t)up_seq);
+  TEST_ASSERT_TRUE(ran[1].dw[7] == nop[0]);
+  // The upload ends with its SDMA fence
+  TEST_ASSERT_TRUE(ran[0].dw[1] == SDMA_PKT_FENCE_HEADER_OP(SDMA_OP_FENCE));
+  TEST_ASSERT_TRUE(ran[0].dw[4] == (uint32_t)up_seq);
+
+  rmapi_sched_get_stats(&after);
+  TEST_ASSERT_EQUAL_INT(1, (int)(after.hw_waits - before.hw_waits));
+  TEST_ASSERT_EQUAL_INT(0, (int)(after.cpu_held - before.cpu_held));
+
+  TEST_ASSERT_EQUAL_INT(1, rmapi_sched_fence_wait(GFX, draw_seq, 0));
+  sched_test_end();
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_wait(GFX, draw_seq, 0));
+
+  // Fences that don't exist yet can't be waited for
+  dep.value = up_seq + 100;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_sched_submit(0, GFX, &draw, &dep, 1, NULL, 0, NULL));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: A job held on a syncobj holds its engine's later jobs too
+ * ============================================================================ */
+
+TEST_CASE(sched_syncobj_order)
+{
+  struct amdgpu_command_buffer cb = {NULL, nop, sizeof(nop), NULL, 0};
+  uint32_t acquire, done;
+  uint64_t first, second, payload = 0;
+  rmapi_syncobj_create(NULL, 0, 0, &acquire);
+  rmapi_syncobj_create(NULL, 0, 0, &done);
+  sched_test_begin();
+
+  struct rmapi_sched_dep dep = {RMAPI_SCHED_DEP_SYNCOBJ, acquire, 1};
+  struct rmapi_syncobj_point sig = {done, 0, 5};
+  rmapi_sched_submit(0, GFX, &cb, &dep, 1, &sig, 1, &first);
+  rmapi_sched_submit(0, GFX, &cb, NULL, 0, NULL, 0, &second);
+  TEST_ASSERT_EQUAL_INT(0, ran_count); // Nothing jumps the queue
+
+  rmapi_syncobj_signal(0, acquire, 1);
+  TEST_ASSERT_EQUAL_INT(2, ran_count);
+  TEST_ASSERT_TRUE(ran[0].seq == first && ran[1].seq == second);
+
+  // Signal points fire once the job's fence does
+  rmapi_syncobj_query(0, done, &payload);
+  TEST_ASSERT_TRUE(payload == 0);
+  rmapi_sched_fence_done(GFX, first, 0);
+  rmapi_syncobj_query(0, done, &payload);
+  TEST_ASSERT_TRUE(payload == 5);
+
+  sched_test_end();
+  rmapi_syncobj_destroy(0, acquire);
+  rmapi_syncobj_destroy(0, done);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Shared BOs order jobs across engines by themselves
+ * ============================================================================ */
+
+TEST_CASE(sched_implicit_bo)
+{
+  static uint32_t mem[64];
+  struct amdgpu_buffer bo = {mem, 0x7700000, sizeof(mem), 7, 0, 0};
+  struct amdgpu_buffer *list[] = {&bo};
+  struct amdgpu_command_buffer up = {NULL, sdma_nop, sizeof(sdma_nop), list, 1};
+  struct amdgpu_command_buffer draw = {NULL, nop, sizeof(nop), list, 1};
+  struct rmapi_sched_stats before, after;
+  uint32_t gate;
+  uint64_t up_seq;
+  rmapi_syncobj_create(NULL, 0, 0, &gate);
+  sched_test_begin();
+  rmapi_sched_get_stats(&before);
+
+  // The upload is stuck behind a syncobj, so the draw can't even be handed
+  // to the CP yet: it waits here, not in a WAIT_REG_MEM on a fence never sent
+  struct rmapi_sched_dep dep = {RMAPI_SCHED_DEP_SYNCOBJ, gate, 1};
+  rmapi_sched_submit(0, DMA, &up, &dep, 1, NULL, 0, &up_seq);
+  rmapi_sched_submit(0, GFX, &draw, NULL, 0, NULL, 0, NULL);
+  TEST_ASSERT_EQUAL_INT(0, ran_count);
+
+  rmapi_syncobj_signal(0, gate, 1);
+  TEST_ASSERT_EQUAL_INT(2, ran_count);
+  TEST_ASSERT_EQUAL_INT(PACKET3_WAIT_REG_MEM, (int)PM4_OPCODE(ran[1].dw[0]));
+  TEST_ASSERT_TRUE(ran[1].dw[4] == (uint32_t)up_seq);
+
+  rmapi_sched_get_stats(&after);
+  TEST_ASSERT_EQUAL_INT(1, (int)(after.implicit - before.implicit));
+  TEST_ASSERT_EQUAL_INT(2, (int)(after.cpu_held - before.cpu_held));
+
+  sched_test_end();
+  rmapi_syncobj_destroy(0, gate);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: A client that left doesn't wedge the engine
+ * ============================================================================ */
+
+TEST_CASE(sched_release_pid)
+{
+  struct amdgpu_command_buffer cb = {NULL, nop, sizeof(nop), NULL, 0};
+  uint32_t never, done;
+  uint64_t payload = 0;
+  rmapi_syncobj_create(NULL, 0, 0, &never);
+  rmapi_syncobj_create(NULL, 0, 0, &done);
+  sched_test_begin();
+
+  struct rmapi_sched_dep dep = {RMAPI_SCHED_DEP_SYNCOBJ, never, 1};
+  struct rmapi_syncobj_point sig = {done, 0, 1};
+  rmapi_sched_submit(4242, GFX, &cb, &dep, 1, &sig, 1, NULL);
+  TEST_ASSERT_EQUAL_INT(0, ran_count);
+
+  rmapi_sched_release_pid(4242);
+  TEST_ASSERT_EQUAL_INT(1, ran_count);
+  TEST_ASSERT_EQUAL_INT(PACKET3_RELEASE_MEM, (int)PM4_OPCODE(ran[0].dw[0])); // Just the fence
+
+  sched_test_end();
+  rmapi_syncobj_query(0, done, &payload);
+  TEST_ASSERT_TRUE(payload == 1);
+  rmapi_syncobj_destroy(0, never);
+  rmapi_syncobj_destroy(0, done);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Submits return before the work runs, so each client gets a cap
+ * ============================================================================ */
+
+TEST_CASE(sched_client_cap)
+{
+  struct amdgpu_command_buffer cb = {NULL, nop, sizeof(nop), NULL, 0};
+  struct rmapi_sched_stats before, after;
+  uint32_t never;
+  rmapi_syncobj_create(NULL, 0, 0, &never);
+  rmapi_sched_set_ops(NULL);
+  rmapi_sched_get_stats(&before);
+
+  struct rmapi_sched_dep dep = {RMAPI_SCHED_DEP_SYNCOBJ, never, 1};
+  for (int i = 0; i < RMAPI_SCHED_MAX_CLIENT_JOBS; i++)
+    TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(4343, GFX, &cb, &dep, 1, NULL, 0, NULL));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_sched_submit(4343, GFX, &cb, NULL, 0, NULL, 0, NULL));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(4344, GFX, &cb, NULL, 0, NULL, 0, NULL));
+  rmapi_sched_get_stats(&after);
+  TEST_ASSERT_EQUAL_INT(1, (int)(after.refused - before.refused));
+
+  // Once they're gone there's room again
+  rmapi_sched_release_pid(4343);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(4343, GFX, &cb, NULL, 0, NULL, 0, NULL));
+  rmapi_syncobj_destroy(0, never);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t sched_tests[] = {
+    TEST_REGISTER(sched_cross_engine_hw_wait),
+    TEST_REGISTER(sched_syncobj_order),
+    TEST_REGISTER(sched_implicit_bo),
+    TEST_REGISTER(sched_release_pid),
+    TEST_REGISTER(sched_client_cap),
+    TEST_REGISTER_END
+};
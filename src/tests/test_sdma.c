@@ -0,0 +1,389 @@
+/*
+ * Unit Tests for the SDMA Copy Path
+ *
+ * Tests core functionality:
+ * - SDMA builder packets, chunking and copy merging
+ * - The simulated engine running copies, fills and sub-windows
+ * - Copy manager batches going through the scheduler to the engine
+ * - The validator checking sub-window copies against their BOs
+ * - Client jobs only touching their own buffers, IB copies and fences
+ * - DMA jobs waiting for other engines in the scheduler, not in a poll
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include "../../drivers/amdgpu/sdma_builder.h"
+#include "../../src/amd/amdgpu/navi10_sdma_pkt_open.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DMA RMAPI_CLIENT_ENGINE_DMA
+#define MB (1024 * 1024)
+
+// A DMA "ring" that is the simulated engine, done before it returns
+static int run_sdma_job(void *priv, int32_t pid, uint32_t engine,
+                        struct amdgpu_command_buffer *cb, uint64_t seq) {
+  (void)priv, (void)pid;
+  int ret = amdgpu_sdma_execute_sim(cb->cmds, (uint32_t)(cb->size / 4));
+  rmapi_sched_fence_done(engine, seq, ret);
+  return 0;
+}
+
+// Same, but the way a client's job runs: only its buffer list is reachable
+static int run_bounded_job(void *priv, int32_t pid, uint32_t engine,
+                           struct amdgpu_command_buffer *cb, uint64_t seq) {
+  (void)priv, (void)pid;
+  int ret = amdgpu_sdma_execute_bounded_sim(cb->cmds, (uint32_t)(cb->size / 4),
+                                            cb->bo_list, cb->bo_count);
+  rmapi_sched_fence_done(engine, seq, ret);
+  return 0;
+}
+
+// A buffer whose GPU address is its CPU address, like simulation hands out
+static struct amdgpu_buffer make_bo(size_t size) {
+  struct amdgpu_buffer bo = {malloc(size), 0, size, 0, 0, 0};
+  bo.gpu_addr = (uint64_t)(uintptr_t)bo.cpu_addr;
+  return bo;
+}
+
+static uint64_t va(const void *p) {
+  return (uint64_t)(uintptr_t)p;
+}
+
+/* ============================================================================
+ * Test Case: Builder packets, chunks and merging
+ * ============================================================================ */
+
+TEST_CASE(sdma_builder_packets)
+{
+  uint32_t buf[64];
+  struct sdma_builder b;
+  sdma_builder_init(&b, buf, 64);
+
+  // Three copies that line up on both ends are one packet
+  sdma_copy_linear(&b, 0x10000, 0x20000, 4096);
+  sdma_copy_linear(&b, 0x11000, 0x21000, 4096);
+  sdma_copy_linear(&b, 0x12000, 0x22000, 100);
+  TEST_ASSERT_EQUAL_INT(SDMA_COPY_LINEAR_DW, (int)b.cdw);
+  TEST_ASSERT_TRUE(buf[1] == 8192 + 100 - 1);
+  TEST_ASSERT_TRUE(buf[3] == 0x20000 && buf[5] == 0x10000);
+
+  // Anything in between ends the run
+  sdma_fence(&b, 0x30000, 5);
+  sdma_copy_linear(&b, 0x12064, 0x22064, 4);
+  TEST_ASSERT_EQUAL_INT(SDMA_COPY_LINEAR_DW * 2 + SDMA_FENCE_DW, (int)b.cdw);
+
+  // More than one packet can count gets split
+  sdma_builder_reset(&b);
+  sdma_copy_linear(&b, 0, 1ull << 32, SDMA_COPY_MAX_BYTES + 16);
+  TEST_ASSERT_EQUAL_INT(SDMA_COPY_LINEAR_DW * 2, (int)b.cdw);
+  TEST_ASSERT_TRUE(buf[8] == 15 && buf[10] == SDMA_COPY_MAX_BYTES && buf[11] == 1);
+
+  // Sub-window: 16x8 box of 4 byte texels
+  sdma_builder_reset(&b);
+  struct sdma_surface dst = {0x40000, 256, 0, 10, 20, 0};
+  struct sdma_surface src = {0x50000, 64, 0, 0, 0, 0};
+  TEST_ASSERT_TRUE(sdma_copy_sub_window(&b, &dst, &src, 4, 16, 8, 1));
+  TEST_ASSERT_EQUAL_INT(SDMA_COPY_SUBWIN_DW, (int)b.cdw);
+  TEST_ASSERT_TRUE(buf[0] >> 29 == 2);                       // log2(4)
+  TEST_ASSERT_TRUE(buf[8] == (10u | 20u << 16));             // dst x, y
+  TEST_ASSERT_TRUE(buf[9] >> 13 == 255);                     // dst pitch - 1
+  TEST_ASSERT_TRUE(buf[11] == (15u | 7u << 16));             // rect
+  TEST_ASSERT_FALSE(sdma_copy_sub_window(&b, &dst, &src, 3, 16, 8, 1));
+
+  // Running out of room is sticky
+  sdma_builder_init(&b, buf, 6);
+  sdma_fill(&b, 0x1000, 0, 64);
+  TEST_ASSERT_TRUE(sdma_builder_ok(&b));
+  sdma_trap(&b, 0);
+  TEST_ASSERT_FALSE(sdma_builder_ok(&b));
+  TEST_ASSERT_EQUAL_INT(SDMA_FILL_DW, (int)b.cdw);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: The simulated engine copies, fills and fences
+ * ============================================================================ */
+
+TEST_CASE(sdma_execute_sim)
+{
+  setenv("AMDGPU_SDMA_THREADS", "2", 0); // Make sure the split path runs
+  size_t big = 3 * MB + 13;
+  uint8_t *src = malloc(big), *dst = malloc(big + 64);
+  uint32_t *fill = malloc(2 * MB + 64);
+  uint32_t tex[32 * 32], win[8 * 4], fence = 0, stream[64];
+  for (size_t i = 0; i < big; i++)
+    src[i] = (uint8_t)(i * 7 + (i >> 12));
+  for (int i = 0; i < 32 * 32; i++)
+    tex[i] = (uint32_t)i;
+  memset(win, 0, sizeof(win));
+  struct amdgpu_sdma_stats before, after;
+  amdgpu_sdma_get_stats(&before);
+
+  struct sdma_builder b;
+  sdma_builder_init(&b, stream, 64);
+  sdma_copy_linear(&b, va(dst + 3), va(src), big); // Unaligned, goes to the pool
+  sdma_fill(&b, va(fill), 0xA5C3E1F0, 2 * MB + 12);
+  struct sdma_surface d = {va(win), 8, 0, 0, 0, 0};
+  struct sdma_surface s = {va(tex), 32, 0, 5, 9, 0};
+  TEST_ASSERT_TRUE(sdma_copy_sub_window(&b, &d, &s, 4, 8, 4, 1));
+  sdma_fence(&b, va(&fence), 77);
+  sdma_trap(&b, 1);
+  sdma_pad(&b, 8);
+  TEST_ASSERT_TRUE(sdma_builder_ok(&b));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_sdma_execute_sim(stream, b.cdw));
+
+  TEST_ASSERT_TRUE(memcmp(dst + 3, src, big) == 0);
+  TEST_ASSERT_TRUE(fill[0] == 0xA5C3E1F0 && fill[MB / 4] == 0xA5C3E1F0 &&
+                   fill[(2 * MB + 8) / 4] == 0xA5C3E1F0);
+  for (int y = 0; y < 4; y++)
+    for (int x = 0; x < 8; x++)
+      TEST_ASSERT_TRUE(win[y * 8 + x] == (uint32_t)((9 + y) * 32 + 5 + x));
+  TEST_ASSERT_TRUE(fence == 77);
+
+  amdgpu_sdma_get_stats(&after);
+  TEST_ASSERT_TRUE(after.bytes_copied - before.bytes_copied == big + sizeof(win));
+  TEST_ASSERT_TRUE(after.bytes_filled - before.bytes_filled == 2 * MB + 12);
+  TEST_ASSERT_TRUE(after.split - before.split == 2);
+
+  // Something the engine doesn't know stops the stream
+  uint32_t bad[2] = {0xEE, 0};
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_sdma_execute_sim(bad, 2));
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_sdma_execute_sim(stream, 3)); // Cut short
+
+  free(src);
+  free(dst);
+  free(fill);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Many small copies, one batch, one job
+ * ============================================================================ */
+
+TEST_CASE(sdma_copy_batch)
+{
+  struct amdgpu_buffer staging = make_bo(256 * 1024), vram = make_bo(512 * 1024);
+  struct amdgpu_buffer img = make_bo(64 * 64 * 4);
+  uint8_t *sp = staging.cpu_addr, *vp = vram.cpu_addr;
+  uint32_t *ip = img.cpu_addr;
+  for (size_t i = 0; i < staging.size; i++)
+    sp[i] = (uint8_t)(i ^ (i >> 8));
+  memset(vp, 0, vram.size);
+  struct rmapi_sched_ops ops = {run_sdma_job, NULL, 1u << DMA, NULL};
+  struct rmapi_copy_stats before, after;
+  rmapi_sched_set_ops(&ops);
+  rmapi_copy_get_stats(&before);
+
+  struct rmapi_copy_batch *b = rmapi_copy_begin(NULL, 0);
+  TEST_ASSERT_NOT_NULL(b);
+  // Streaming an upload 4K at a time: 64 calls, one packet
+  for (int i = 0; i < 64; i++)
+    TEST_ASSERT_EQUAL_INT(0, rmapi_copy_buffer(b, &vram, 4096 + i * 4096,
+                                               &staging, i * 4096, 4096));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_copy_fill(b, &img, 0, 0x11223344, img.size));
+  struct rmapi_copy_rect r = {0, 4096, 64, 16, 3, 2, 0, 0, 16, 16, 4};
+  TEST_ASSERT_EQUAL_INT(0, rmapi_copy_rect(b, &img, &vram, &r));
+
+  // Out of bounds or misaligned never gets recorded
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_copy_buffer(b, &vram, vram.size - 8, &staging, 0, 16));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_copy_fill(b, &img, 2, 0, 8));
+  struct rmapi_copy_rect wide = r;
+  wide.dst_x = 60;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_copy_rect(b, &img, &vram, &wide));
+
+  uint32_t done;
+  uint64_t seq, payload = 0;
+  rmapi_syncobj_create(NULL, 0, 0, &done);
+  struct rmapi_syncobj_point sig = {done, 0, 1};
+  TEST_ASSERT_EQUAL_INT(0, rmapi_copy_flush(b, &sig, 1, &seq));
+  TEST_ASSERT_TRUE(seq != 0);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_wait(DMA, seq, 0));
+  rmapi_syncobj_query(0, done, &payload);
+  TEST_ASSERT_TRUE(payload == 1);
+
+  TEST_ASSERT_TRUE(memcmp(vp + 4096, sp, 256 * 1024) == 0);
+  TEST_ASSERT_TRUE(vp[4095] == 0);
+  // The rect landed at (3, 2) on top of the fill, from what was just uploaded
+  const uint32_t *rows = (const uint32_t *)(vp + 4096);
+  TEST_ASSERT_TRUE(ip[0] == 0x11223344 && ip[2 * 64 + 2] == 0x11223344);
+  TEST_ASSERT_TRUE(ip[2 * 64 + 3] == rows[0] && ip[17 * 64 + 18] == rows[15 * 16 + 15]);
+
+  rmapi_copy_get_stats(&after);
+  TEST_ASSERT_TRUE(after.merged - before.merged == 63);
+  TEST_ASSERT_TRUE(after.ops - before.ops == 66);
+  TEST_ASSERT_TRUE(after.batches - before.batches == 1);
+
+  // Empty and reusable afterwards
+  TEST_ASSERT_EQUAL_INT(0, rmapi_copy_flush(b, NULL, 0, &seq));
+  TEST_ASSERT_TRUE(seq == 0);
+
+  rmapi_copy_end(b);
+  rmapi_sched_set_ops(NULL);
+  rmapi_syncobj_destroy(0, done);
+  free(staging.cpu_addr);
+  free(vram.cpu_addr);
+  free(img.cpu_addr);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: The validator follows sub-windows to their last byte
+ * ============================================================================ */
+
+TEST_CASE(sdma_validate_sub_window)
+{
+  struct amdgpu_buffer src = make_bo(64 * 64 * 4), dst = make_bo(32 * 32 * 4);
+  struct amdgpu_buffer *list[] = {&src, &dst};
+  uint32_t buf[16];
+  struct sdma_builder b;
+
+  // Fits exactly: last row of dst ends on its last byte
+  sdma_builder_init(&b, buf, 16);
+  struct sdma_surface d = {dst.gpu_addr, 32, 0, 16, 24, 0};
+  struct sdma_surface s = {src.gpu_addr, 64, 0, 0, 0, 0};
+  sdma_copy_sub_window(&b, &d, &s, 4, 16, 8, 1);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_cs_validate(0, DMA, buf, b.cdw * 4, list, 2));
+
+  // One more row runs off the end of dst
+  sdma_builder_reset(&b);
+  sdma_copy_sub_window(&b, &d, &s, 4, 16, 9, 1);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_cs_validate(0, DMA, buf, b.cdw * 4, list, 2));
+
+  free(src.cpu_addr);
+  free(dst.cpu_addr);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: A client's job gets its buffers, its IB copies and the fences
+ * ============================================================================ */
+
+static uint32_t sdma_indirect(uint32_t *p, uint64_t va, uint32_t ndw) {
+  p[0] = SDMA_PKT_HEADER_OP(SDMA_OP_INDIRECT);
+  p[1] = (uint32_t)va;
+  p[2] = (uint32_t)(va >> 32);
+  p[3] = ndw;
+  p[4] = p[5] = 0;
+  return 6;
+}
+
+TEST_CASE(sdma_bounded_client_job)
+{
+  struct amdgpu_buffer bo = make_bo(4096), ib = make_bo(256), other = make_bo(64);
+  struct amdgpu_buffer *list[] = {&bo, &ib};
+  uint32_t stream[32];
+  struct sdma_builder b;
+  struct amdgpu_sdma_stats before, after;
+  memset(bo.cpu_addr, 0, bo.size);
+  amdgpu_sdma_get_stats(&before);
+
+  // Fill from an IB, fence after it
+  sdma_builder_init(&b, ib.cpu_addr, 64);
+  sdma_fill(&b, bo.gpu_addr, 0x5A5A5A5A, 64);
+  uint32_t ib_dw = b.cdw, n = sdma_indirect(stream, ib.gpu_addr, ib_dw);
+  sdma_builder_init(&b, stream + n, 32 - n);
+  sdma_fence(&b, bo.gpu_addr + 1024, 9);
+  n += b.cdw;
+
+  struct rmapi_cs_shadow *shadow = NULL;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_cs_validate_shadow(77, DMA, stream, n * 4,
+                                                    list, 2, &shadow));
+  TEST_ASSERT_NOT_NULL(shadow);
+  ((uint32_t *)ib.cpu_addr)[3] = 0x11111111; // Too late, the job has a copy
+
+  struct rmapi_sched_ops ops = {run_bounded_job, NULL, 1u << DMA, NULL};
+  rmapi_sched_set_ops(&ops);
+  struct amdgpu_command_buffer cb = {NULL, stream, n * 4, list, 1}; // No IB BO
+  struct rmapi_sched_hold hold = rmapi_cs_shadow_hold(shadow);
+  uint64_t seq = 0;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit_held(77, DMA, &cb, NULL, 0, NULL,
+                                                   0, &hold, 1, &seq));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_wait(DMA, seq, 0));
+  const uint32_t *out = bo.cpu_addr;
+  TEST_ASSERT_TRUE(out[0] == 0x5A5A5A5A && out[15] == 0x5A5A5A5A && out[16] == 0);
+  TEST_ASSERT_TRUE(out[256] == 9);
+
+  // Anything else stops the stream before it touches a byte
+  sdma_builder_init(&b, stream, 32);
+  sdma_fill(&b, other.gpu_addr, 0xDEAD, 4);
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_sdma_execute_bounded_sim(stream, b.cdw, list, 2));
+  n = sdma_indirect(stream, other.gpu_addr, 4);
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_sdma_execute_bounded_sim(stream, n, list, 2));
+  sdma_builder_init(&b, stream, 32);
+  sdma_copy_linear(&b, bo.gpu_addr + 4000, ib.gpu_addr, 128); // Runs off bo
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_sdma_execute_bounded_sim(stream, b.cdw, list, 2));
+  amdgpu_sdma_get_stats(&after);
+  TEST_ASSERT_TRUE(after.faults - before.faults == 3);
+
+  rmapi_sched_set_ops(NULL);
+  free(bo.cpu_addr);
+  free(ib.cpu_addr);
+  free(other.cpu_addr);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: DMA waits for GFX in the scheduler, not in a poll
+ * ============================================================================ */
+
+static uint64_t gfx_parked;
+static uint32_t dma_ran;
+
+static int park_gfx_job(void *priv, int32_t pid, uint32_t engine,
+                        struct amdgpu_command_buffer *cb, uint64_t seq) {
+  if (engine != DMA) {
+    gfx_parked = seq; // On the "ring", done whenever the test says
+    return 0;
+  }
+  dma_ran++;
+  return run_bounded_job(priv, pid, engine, cb, seq);
+}
+
+TEST_CASE(sdma_waits_in_scheduler)
+{
+  struct rmapi_sched_ops ops = {park_gfx_job, NULL, 1u << DMA, NULL};
+  struct rmapi_sched_stats before, after;
+  rmapi_sched_set_ops(&ops);
+  rmapi_sched_get_stats(&before);
+  dma_ran = 0;
+
+  uint32_t nop = 0;
+  struct amdgpu_command_buffer cb = {NULL, &nop, 4, NULL, 0};
+  uint64_t gfx = 0, dma = 0;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(0, RMAPI_CLIENT_ENGINE_GFX, &cb,
+                                              NULL, 0, NULL, 0, &gfx));
+  TEST_ASSERT_TRUE(gfx_parked == gfx);
+
+  uint32_t sdma_nop = SDMA_PKT_HEADER_OP(SDMA_OP_NOP);
+  struct amdgpu_command_buffer dcb = {NULL, &sdma_nop, 4, NULL, 0};
+  struct rmapi_sched_dep dep = {RMAPI_SCHED_DEP_FENCE, RMAPI_CLIENT_ENGINE_GFX, gfx};
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(0, DMA, &dcb, &dep, 1, NULL, 0, &dma));
+  TEST_ASSERT_EQUAL_INT(0, (int)dma_ran); // Held here, not polling on the ring
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_done(RMAPI_CLIENT_ENGINE_GFX, gfx, 0));
+  TEST_ASSERT_EQUAL_INT(1, (int)dma_ran);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_fence_wait(DMA, dma, 0));
+  rmapi_sched_get_stats(&after);
+  TEST_ASSERT_TRUE(after.hw_waits == before.hw_waits);
+  TEST_ASSERT_TRUE(after.cpu_held - before.cpu_held == 1);
+
+  rmapi_sched_set_ops(NULL);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t sdma_tests[] = {
+    TEST_REGISTER(sdma_builder_packets),
+    TEST_REGISTER(sdma_execute_sim),
+    TEST_REGISTER(sdma_copy_batch),
+    TEST_REGISTER(sdma_validate_sub_window),
+    TEST_REGISTER(sdma_bounded_client_job),
+    TEST_REGISTER(sdma_waits_in_scheduler),
+    TEST_REGISTER_END
+};
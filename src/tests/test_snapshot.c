@@ -0,0 +1,204 @@
+/*
+ * Unit Tests for Register Snapshots
+ *
+ * Tests core functionality:
+ * - The shadow keeps any register we wrote, packed into runs
+ * - Blobs (MQDs, ring pointers) travel with the registers
+ * - Resume puts back what power loss took and skips what survived
+ * - Recovery brings runtime values back on top of a fresh init
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/hal/hal.h"
+#include <string.h>
+
+static uint32_t fake_mmio[0x4000]; // 64 KB of "registers"
+
+static void mock_gpu_init(struct OBJGPU *gpu) {
+  memset(gpu, 0, sizeof(*gpu));
+  memset(fake_mmio, 0, sizeof(fake_mmio));
+  gpu->mmio_base = (uintptr_t)fake_mmio;
+  gpu->mmio_size = sizeof(fake_mmio);
+  gpu->state = AMD_GPU_STATE_RUNNING;
+}
+
+#define REG(off) fake_mmio[(off) / 4]
+
+// Block A programs four golden registers, block B one more
+static int a_inits, b_inits, b_resumes;
+
+static int a_hw_init(struct OBJGPU *adev) {
+  a_inits++;
+  for (uint32_t i = 0; i < 4; i++)
+    amdgpu_write_reg_locked(adev, 0x400 + i * 4, 0xA0 + i);
+  return 0;
+}
+
+static int b_hw_init(struct OBJGPU *adev) {
+  b_inits++;
+  amdgpu_write_reg_locked(adev, 0x9000, 1);
+  return 0;
+}
+
+static int b_resume(struct OBJGPU *adev) {
+  (void)adev;
+  b_resumes++;
+  return 0;
+}
+
+static struct ip_block_ops block_a = {.name = "snap_a", .hw_init = a_hw_init};
+static struct ip_block_ops block_b = {.name = "snap_b", .hw_init = b_hw_init,
+                                      .resume = b_resume};
+
+static struct amd_gpu_handler *mock_handler(struct OBJGPU *gpu) {
+  a_inits = b_inits = b_resumes = 0;
+  struct amd_gpu_handler *h = amd_gpu_handler_create(gpu);
+  if (!h)
+    return NULL;
+  h->register_ip_block(h, &block_a);
+  h->register_ip_block(h, &block_b);
+  if (h->init_hardware(h) != 0) {
+    amd_gpu_handler_destroy(h);
+    return NULL;
+  }
+  return h;
+}
+
+/* ============================================================================
+ * Test Case: Sparse shadow, packed snapshot, blobs
+ * ============================================================================ */
+
+TEST_CASE(snapshot_sparse_roundtrip)
+{
+  struct OBJGPU gpu;
+  mock_gpu_init(&gpu);
+  amdgpu_write_reg_locked(&gpu, 0x10, 1);
+  amdgpu_write_reg_locked(&gpu, 0x14, 2);
+  amdgpu_write_reg_locked(&gpu, 0x18, 3);
+  amdgpu_write_reg_locked(&gpu, 0x8000, 4);
+  amdgpu_write_reg_locked(&gpu, 0xFFFC, 5); // Way past the old 4 KB
+  amdgpu_write_reg_locked(&gpu, 0x14, 6);   // Same register again
+  TEST_ASSERT_EQUAL_INT(5, (int)gpu.shadow.count);
+
+  struct amdgpu_snapshot snap = {0};
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_snapshot_capture(&gpu, &snap, -1));
+  TEST_ASSERT_EQUAL_INT(5, (int)snap.regs);
+  TEST_ASSERT_EQUAL_INT(3, (int)snap.runs);
+  TEST_ASSERT_TRUE(snap.size < 5 * 8); // Smaller than offset/value pairs
+
+  // An MQD rides along
+  uint32_t mqd[4] = {0x11, 0x22, 0x33, 0x44}, got_size = 0;
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_snapshot_add_blob(&snap, 7, mqd, sizeof(mqd)));
+  const uint32_t *back = amdgpu_snapshot_find_blob(&snap, 7, &got_size);
+  TEST_ASSERT_NOT_NULL(back);
+  TEST_ASSERT_EQUAL_INT((int)sizeof(mqd), (int)got_size);
+  TEST_ASSERT_EQUAL_MEM(mqd, back, sizeof(mqd));
+  TEST_ASSERT_TRUE(amdgpu_snapshot_find_blob(&snap, 8, NULL) == NULL);
+
+  memset(fake_mmio, 0, sizeof(fake_mmio));
+  uint32_t skipped = 99;
+  struct amdgpu_reg_lock_stats before, after;
+  amdgpu_reg_get_stats(&gpu, AMDGPU_REG_DOMAIN_MISC, &before);
+  TEST_ASSERT_EQUAL_INT(5, amdgpu_snapshot_restore(&gpu, &snap, &skipped));
+  TEST_ASSERT_EQUAL_INT(0, (int)skipped);
+  amdgpu_reg_get_stats(&gpu, AMDGPU_REG_DOMAIN_MISC, &after);
+  TEST_ASSERT_TRUE(after.acquires > before.acquires); // Under the domain lock
+  TEST_ASSERT_EQUAL_INT(1, (int)REG(0x10));
+  TEST_ASSERT_EQUAL_INT(6, (int)REG(0x14));
+  TEST_ASSERT_EQUAL_INT(3, (int)REG(0x18));
+  TEST_ASSERT_EQUAL_INT(4, (int)REG(0x8000));
+  TEST_ASSERT_EQUAL_INT(5, (int)REG(0xFFFC));
+
+  // Cut short: refused instead of read past the end
+  struct amdgpu_snapshot cut = snap;
+  cut.size -= 3;
+  TEST_ASSERT_TRUE(amdgpu_snapshot_find_blob(&cut, 7, NULL) == NULL);
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_snapshot_restore(&gpu, &cut, NULL));
+
+  amdgpu_snapshot_free(&snap);
+  TEST_ASSERT_TRUE(snap.data == NULL && snap.size == 0);
+  amdgpu_hal_shadow_fini(&gpu);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Suspend/resume without running init again
+ * ============================================================================ */
+
+TEST_CASE(snapshot_suspend_resume)
+{
+  struct OBJGPU gpu;
+  mock_gpu_init(&gpu);
+  struct amd_gpu_handler *h = mock_handler(&gpu);
+  TEST_ASSERT_NOT_NULL(h);
+  amdgpu_write_reg_locked(&gpu, 0x404, 0x55); // Runtime change to a golden one
+  amdgpu_write_reg_locked(&gpu, 0x20, 7);     // Outside any block
+
+  TEST_ASSERT_EQUAL_INT(0, ip_blocks_suspend(&gpu));
+  TEST_ASSERT_EQUAL_INT(6, (int)gpu.suspend_state.regs);
+
+  // Power loss takes some of it: block B's register and the runtime ones
+  REG(0x9000) = 0;
+  REG(0x404) = 0;
+  REG(0x20) = 0;
+  struct amdgpu_snapshot probe = {0};
+  probe.data = gpu.suspend_state.data;
+  probe.size = gpu.suspend_state.size;
+  uint32_t skipped = 0;
+  TEST_ASSERT_EQUAL_INT(3, amdgpu_snapshot_restore(&gpu, &probe, &skipped));
+  TEST_ASSERT_EQUAL_INT(3, (int)skipped); // Golden 0x400/0x408/0x40C survived
+
+  REG(0x9000) = 0;
+  TEST_ASSERT_EQUAL_INT(0, ip_blocks_resume(&gpu));
+  TEST_ASSERT_EQUAL_INT(1, (int)REG(0x9000));
+  TEST_ASSERT_EQUAL_INT(0x55, (int)REG(0x404));
+  TEST_ASSERT_EQUAL_INT(7, (int)REG(0x20));
+  TEST_ASSERT_EQUAL_INT(0xA2, (int)REG(0x408));
+  TEST_ASSERT_EQUAL_INT(1, a_inits); // No second init
+  TEST_ASSERT_EQUAL_INT(1, b_inits);
+  TEST_ASSERT_EQUAL_INT(1, b_resumes);
+  TEST_ASSERT_TRUE(gpu.suspend_state.data == NULL);
+
+  amd_gpu_handler_destroy(h);
+  amdgpu_hal_shadow_fini(&gpu);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Recovery restores runtime state over a fresh init
+ * ============================================================================ */
+
+TEST_CASE(snapshot_recovery_restores)
+{
+  struct OBJGPU gpu;
+  mock_gpu_init(&gpu);
+  struct amd_gpu_handler *h = mock_handler(&gpu);
+  TEST_ASSERT_NOT_NULL(h);
+  amdgpu_write_reg_locked(&gpu, 0x404, 0x55);
+  amdgpu_write_reg_locked(&gpu, 0x3000, 9);
+
+  memset(fake_mmio, 0, sizeof(fake_mmio)); // The reset wipes everything
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_gpu_recover(&gpu));
+  TEST_ASSERT_EQUAL_INT(2, a_inits);
+  TEST_ASSERT_EQUAL_INT(0x55, (int)REG(0x404)); // Init wrote 0xA1, then us
+  TEST_ASSERT_EQUAL_INT(9, (int)REG(0x3000));
+  TEST_ASSERT_EQUAL_INT(0xA0, (int)REG(0x400));
+  TEST_ASSERT_EQUAL_INT(AMD_GPU_STATE_RUNNING, (int)gpu.state);
+
+  amd_gpu_handler_destroy(h);
+  amdgpu_hal_shadow_fini(&gpu);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t snapshot_tests[] = {
+    TEST_REGISTER(snapshot_sparse_roundtrip),
+    TEST_REGISTER(snapshot_suspend_resume),
+    TEST_REGISTER(snapshot_recovery_restores),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,237 @@
+/*
+ * Unit Tests for Timeline Syncobjs
+ *
+ * Tests core functionality:
+ * - Timeline payloads only move forward
+ * - Wait-before-signal, wait-all / wait-any and timeouts
+ * - eventfd export
+ * - Work parked on points runs from the signal that completes it
+ * - Other clients need the owner to share a syncobj before they touch it
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MS 1000000ull
+
+struct late_signal {
+  uint32_t handle;
+  uint64_t point;
+};
+
+static void *signal_later(void *arg) {
+  struct late_signal *s = arg;
+  usleep(20000);
+  rmapi_syncobj_signal(0, s->handle, s->point);
+  return NULL;
+}
+
+/* ============================================================================
+ * Test Case: Payload goes up, never down; waits may come before the signal
+ * ============================================================================ */
+
+TEST_CASE(syncobj_timeline)
+{
+  uint32_t h;
+  uint64_t v = 0;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_create(NULL, 0, 5, &h));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_query(0, h, &v));
+  TEST_ASSERT_TRUE(v == 5);
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_signal(0, h, 8));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_signal(0, h, 7)); // Backwards
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_signal(0, h, 8));  // Same point again is fine
+
+  // Nobody promised point 10 yet: the wait just sits there until it shows up
+  struct late_signal late = {h, 10};
+  struct rmapi_syncobj_point p = {h, 0, 10};
+  pthread_t t;
+  pthread_create(&t, NULL, signal_later, &late);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_wait(&p, 1, RMAPI_SYNCOBJ_WAIT_ALL,
+                                              RMAPI_SYNCOBJ_WAIT_FOREVER, NULL));
+  pthread_join(t, NULL);
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_destroy(0, h));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_query(0, h, &v));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Wait-all vs wait-any, and timeouts
+ * ============================================================================ */
+
+TEST_CASE(syncobj_wait_any_all)
+{
+  uint32_t a, b, first = 99;
+  rmapi_syncobj_create(NULL, 0, 0, &a);
+  rmapi_syncobj_create(NULL, 0, 0, &b);
+  struct rmapi_syncobj_point pts[2] = {{a, 0, 1}, {b, 0, 3}};
+
+  TEST_ASSERT_EQUAL_INT(1, rmapi_syncobj_wait(pts, 2, 0, 0, &first)); // Poll
+  rmapi_syncobj_signal(0, b, 3);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_wait(pts, 2, 0, 0, &first));
+  TEST_ASSERT_EQUAL_INT(1, (int)first);
+  TEST_ASSERT_EQUAL_INT(1, rmapi_syncobj_wait(pts, 2, RMAPI_SYNCOBJ_WAIT_ALL,
+                                              5 * MS, NULL));
+
+  struct late_signal late = {a, 1};
+  pthread_t t;
+  pthread_create(&t, NULL, signal_later, &late);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_wait(pts, 2, RMAPI_SYNCOBJ_WAIT_ALL,
+                                              2000 * MS, NULL));
+  pthread_join(t, NULL);
+
+  // Binary fence reuse
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_reset(0, a));
+  TEST_ASSERT_EQUAL_INT(1, rmapi_syncobj_wait(pts, 1, 0, 0, NULL));
+
+  rmapi_syncobj_destroy(0, a);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_wait(pts, 2, 0, 0, NULL));
+  rmapi_syncobj_destroy(0, b);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: eventfd export fires once the point is done
+ * ============================================================================ */
+
+TEST_CASE(syncobj_eventfd)
+{
+  uint32_t h;
+  int fd = -1, done_fd = -1;
+  uint64_t val = 0;
+  rmapi_syncobj_create(NULL, 0, 2, &h);
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_export_eventfd(0, h, 4, &fd));
+  struct pollfd pfd = {fd, POLLIN, 0};
+  TEST_ASSERT_EQUAL_INT(0, poll(&pfd, 1, 0));
+
+  rmapi_syncobj_signal(0, h, 3); // Not far enough
+  TEST_ASSERT_EQUAL_INT(0, poll(&pfd, 1, 0));
+  rmapi_syncobj_signal(0, h, 4);
+  TEST_ASSERT_EQUAL_INT(1, poll(&pfd, 1, 0));
+  TEST_ASSERT_EQUAL_INT((int)sizeof(val), (int)read(fd, &val, sizeof(val)));
+  TEST_ASSERT_TRUE(val == 1);
+  close(fd);
+
+  // Already done: ready right away
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_export_eventfd(0, h, 1, &done_fd));
+  pfd.fd = done_fd;
+  TEST_ASSERT_EQUAL_INT(1, poll(&pfd, 1, 0));
+  close(done_fd);
+
+  // No kernel twin without DRM
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_export_sync_file(0, h, 1, &fd));
+  rmapi_syncobj_destroy(0, h);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Parked work runs in order from the signal that unblocks it
+ * ============================================================================ */
+
+static int run_order[4];
+static int run_count;
+static int run_status;
+
+struct chained {
+  int id;
+  uint32_t signal; // Signal point 1 here once we ran (0 = nothing)
+};
+
+static void record_run(void *data, int status) {
+  struct chained *c = data;
+  run_order[run_count++] = c->id;
+  run_status = status;
+  if (c->signal)
+    rmapi_syncobj_signal(0, c->signal, 1);
+}
+
+TEST_CASE(syncobj_when)
+{
+  uint32_t gfx, dma, gone;
+  rmapi_syncobj_create(NULL, 0, 0, &gfx);
+  rmapi_syncobj_create(NULL, 0, 0, &dma);
+  rmapi_syncobj_create(NULL, 0, 0, &gone);
+  run_count = 0;
+
+  // "copy" waits for gfx:1 and signals dma:1, "present" waits for dma:1
+  struct chained copy = {1, dma}, present = {2, 0}, orphan = {3, 0};
+  struct rmapi_syncobj_point wait_gfx = {gfx, 0, 1}, wait_dma = {dma, 0, 1};
+  struct rmapi_syncobj_point wait_gone = {gone, 0, 1};
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_when(&wait_dma, 1, record_run, &present));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_when(&wait_gfx, 1, record_run, &copy));
+  TEST_ASSERT_EQUAL_INT(0, run_count);
+
+  rmapi_syncobj_signal(0, gfx, 1);
+  TEST_ASSERT_EQUAL_INT(2, run_count);
+  TEST_ASSERT_EQUAL_INT(1, run_order[0]);
+  TEST_ASSERT_EQUAL_INT(2, run_order[1]);
+  TEST_ASSERT_EQUAL_INT(0, run_status);
+
+  // Already done: runs on the spot
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_when(&wait_gfx, 1, record_run, &present));
+  TEST_ASSERT_EQUAL_INT(3, run_count);
+
+  // Its syncobj dies first: it still runs, but hears about it
+  rmapi_syncobj_when(&wait_gone, 1, record_run, &orphan);
+  rmapi_syncobj_destroy(0, gone);
+  TEST_ASSERT_EQUAL_INT(4, run_count);
+  TEST_ASSERT_EQUAL_INT(-1, run_status);
+
+  rmapi_syncobj_destroy(0, gfx);
+  rmapi_syncobj_destroy(0, dma);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Only the owner, and whoever it shared with
+ * ============================================================================ */
+
+TEST_CASE(syncobj_ownership)
+{
+  uint32_t h;
+  uint64_t v = 0;
+  int fd = -1;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_create(NULL, 100, 0, &h));
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_signal(100, h, 1));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_signal(200, h, 2));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_reset(200, h));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_query(200, h, &v));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_export_eventfd(200, h, 1, &fd));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_share(200, h, 200)); // Not theirs to give
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_share(100, h, 200));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_signal(200, h, 2));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_query(200, h, &v));
+  TEST_ASSERT_TRUE(v == 2);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_destroy(200, h)); // Still only the owner
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_query(300, h, &v));
+
+  // Gone is gone: a new process with that pid starts from nothing
+  rmapi_syncobj_release_pid(200);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_syncobj_query(200, h, &v));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_query(0, h, &v)); // The server always may
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_syncobj_destroy(100, h));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t syncobj_tests[] = {
+    TEST_REGISTER(syncobj_timeline),
+    TEST_REGISTER(syncobj_wait_any_all),
+    TEST_REGISTER(syncobj_eventfd),
+    TEST_REGISTER(syncobj_when),
+    TEST_REGISTER(syncobj_ownership),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,227 @@
+/*
+ * Unit Tests for Structured Tracing
+ *
+ * Tests core functionality:
+ * - Off until started; the JSON has matched spans, flows, counters and
+ *   named GPU tracks
+ * - A client's IPC call and a scheduler job come out with the flows that
+ *   tie them to the other side
+ * - A full event array drops and counts instead of growing
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/ipc/ipc_lib.h"
+#include "../../core/ipc/ipc_protocol.h"
+#include "../../core/rmapi/rmapi.h"
+#include "../../os/interface/os_trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TRACE_PATH "/tmp/amdgpu_test_trace_%p.json"
+#define TRACE_GPU_TID 0x7fff0000u
+
+static char *trace_read(void) {
+  char path[128];
+  snprintf(path, sizeof(path), "/tmp/amdgpu_test_trace_%d.json", (int)getpid());
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *buf = malloc((size_t)size + 1);
+  if (buf) {
+    buf[fread(buf, 1, (size_t)size, f)] = '\0';
+  }
+  fclose(f);
+  unlink(path);
+  return buf;
+}
+
+static int count_of(const char *s, const char *what) {
+  int n = 0;
+  for (const char *p = strstr(s, what); p; p = strstr(p + 1, what))
+    n++;
+  return n;
+}
+
+/* ============================================================================
+ * Test Case: Off by default, then one of everything
+ * ============================================================================ */
+
+static void traced_helper(void) {
+  os_trace_scope(OS_TRACE_HAL, "helper");
+  os_trace_counter(OS_TRACE_HAL, "vram_used", 4096);
+}
+
+TEST_CASE(trace_export_json)
+{
+  TEST_ASSERT_TRUE(!os_trace_active());
+  TEST_ASSERT_EQUAL_INT(-1, os_trace_stop());
+  os_trace_begin(OS_TRACE_RMAPI, "ignored", NULL, 0); // Off: nothing happens
+
+  TEST_ASSERT_EQUAL_INT(0, os_trace_start(TRACE_PATH, 0));
+  TEST_ASSERT_TRUE(os_trace_active());
+  TEST_ASSERT_EQUAL_INT(-1, os_trace_start(TRACE_PATH, 0)); // Already running
+
+  os_trace_name_track(15, "GPU test");
+  os_trace_begin(OS_TRACE_RMAPI, "outer", "type", 7);
+  os_trace_flow_start(OS_TRACE_FLOW_REQUEST(0x1234, 5));
+  traced_helper();
+  os_trace_end(OS_TRACE_RMAPI, "outer");
+  os_trace_gpu_slice(15, "job", 1000000, 1002500, 9, OS_TRACE_FLOW_REQUEST(0x1234, 5));
+
+  struct os_trace_stats st;
+  os_trace_get_stats(&st);
+  TEST_ASSERT_EQUAL_INT(8, (int)st.events);
+  TEST_ASSERT_EQUAL_INT(0, os_trace_stop());
+  TEST_ASSERT_TRUE(!os_trace_active());
+
+  char *json = trace_read();
+  TEST_ASSERT_NOT_NULL(json);
+  TEST_ASSERT_TRUE(strncmp(json, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 38) == 0);
+  TEST_ASSERT_TRUE(strstr(json, "\n]}\n") != NULL);
+  TEST_ASSERT_EQUAL_INT(2, count_of(json, "\"ph\":\"B\""));
+  TEST_ASSERT_EQUAL_INT(2, count_of(json, "\"ph\":\"E\""));
+  TEST_ASSERT_TRUE(strstr(json, "\"name\":\"ignored\"") == NULL);
+  TEST_ASSERT_TRUE(strstr(json, "\"cat\":\"rmapi\",\"name\":\"outer\",\"args\":{\"type\":7}") != NULL);
+  TEST_ASSERT_TRUE(strstr(json, "\"cat\":\"hal\",\"name\":\"helper\"") != NULL);
+  TEST_ASSERT_TRUE(strstr(json, "\"name\":\"vram_used\",\"args\":{\"vram_used\":4096}") != NULL);
+  TEST_ASSERT_EQUAL_INT(2, count_of(json, "\"cat\":\"flow\",\"name\":\"request\",\"id\":\"0x123400000005\""));
+  TEST_ASSERT_TRUE(strstr(json, "\"id\":\"0x123400000005\",\"bp\":\"e\"") != NULL);
+
+  char gpu[160];
+  snprintf(gpu, sizeof(gpu), "\"tid\":%u,\"ts\":1000.000,\"dur\":2.500,\"cat\":\"gpu\","
+           "\"name\":\"job\",\"args\":{\"seq\":9}", TRACE_GPU_TID + 15);
+  TEST_ASSERT_TRUE(strstr(json, gpu) != NULL);
+  snprintf(gpu, sizeof(gpu), "\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"GPU test\"}",
+           TRACE_GPU_TID + 15);
+  TEST_ASSERT_TRUE(strstr(json, gpu) != NULL);
+  free(json);
+  os_trace_name_track(15, NULL);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Both halves of an IPC call, a job from submit to fence
+ * ============================================================================ */
+
+TEST_CASE(trace_ipc_and_ring_flows)
+{
+  int sv[2];
+  TEST_ASSERT_EQUAL_INT(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+  ipc_connection_t client = {sv[0], NULL, 0, -1, 1};
+  ipc_connection_t server = {sv[1], NULL, 0, -1, 0};
+
+  TEST_ASSERT_EQUAL_INT(0, os_trace_start(TRACE_PATH, 0));
+
+  // Client: the request gets its id on the way out, the server echoes it
+  uint64_t size = 4096;
+  ipc_message_t req = {IPC_REQ_ALLOC_MEMORY, 0, sizeof(size), &size};
+  TEST_ASSERT_EQUAL_INT(0, ipc_send_message(&client, &req));
+  uint32_t id = req.id;
+  TEST_ASSERT_TRUE(id != 0);
+
+  ipc_message_t got;
+  TEST_ASSERT_EQUAL_INT(1, ipc_recv_message(&server, &got));
+  TEST_ASSERT_EQUAL_INT((int)id, (int)got.id);
+  free(got.data);
+  ipc_message_t rep = {IPC_REP_ALLOC_MEMORY, got.id, sizeof(size), &size};
+  TEST_ASSERT_EQUAL_INT(0, ipc_send_message(&server, &rep));
+  TEST_ASSERT_EQUAL_INT((int)id, (int)rep.id); // Servers don't renumber
+  TEST_ASSERT_EQUAL_INT(1, ipc_recv_message(&client, &got));
+  free(got.data);
+
+  // A job with no backend finishes on the spot: submit, ring, fence
+  rmapi_sched_set_ops(NULL);
+  uint32_t nop[1] = {0};
+  struct amdgpu_command_buffer cb = {NULL, nop, sizeof(nop), NULL, 0};
+  uint64_t seq = 0;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_sched_submit(0, RMAPI_CLIENT_ENGINE_GFX, &cb,
+                                              NULL, 0, NULL, 0, &seq));
+  TEST_ASSERT_EQUAL_INT(0, os_trace_stop());
+  close(sv[0]);
+  close(sv[1]);
+
+  char *json = trace_read();
+  TEST_ASSERT_NOT_NULL(json);
+  char want[160];
+  snprintf(want, sizeof(want), "\"cat\":\"ipc\",\"name\":\"ALLOC_MEMORY\",\"args\":{\"type\":%d}",
+           IPC_REQ_ALLOC_MEMORY);
+  TEST_ASSERT_TRUE(strstr(json, want) != NULL);
+  TEST_ASSERT_EQUAL_INT(2, count_of(json, "\"cat\":\"ipc\",\"name\":\"ALLOC_MEMORY\"")); // B and E
+  snprintf(want, sizeof(want), "\"name\":\"request\",\"id\":\"0x%llx\"",
+           (unsigned long long)OS_TRACE_FLOW_REQUEST(getpid(), id));
+  TEST_ASSERT_EQUAL_INT(1, count_of(json, want)); // The server half is in rmapi_server
+  snprintf(want, sizeof(want), "\"name\":\"reply\",\"id\":\"0x%llx\",\"bp\":\"e\"",
+           (unsigned long long)OS_TRACE_FLOW_REPLY(getpid(), id));
+  TEST_ASSERT_EQUAL_INT(1, count_of(json, want));
+
+  snprintf(want, sizeof(want), "\"name\":\"job\",\"id\":\"0x%llx\"",
+           (unsigned long long)OS_TRACE_FLOW_JOB(RMAPI_CLIENT_ENGINE_GFX, seq));
+  TEST_ASSERT_EQUAL_INT(2, count_of(json, want)); // Out of submit, into the GPU slice
+  snprintf(want, sizeof(want), "\"tid\":%u,", TRACE_GPU_TID + RMAPI_CLIENT_ENGINE_GFX);
+  TEST_ASSERT_TRUE(strstr(json, want) != NULL);
+  snprintf(want, sizeof(want), "\"name\":\"job\",\"args\":{\"seq\":%llu}",
+           (unsigned long long)seq);
+  TEST_ASSERT_TRUE(strstr(json, want) != NULL);
+  TEST_ASSERT_TRUE(strstr(json, "\"args\":{\"name\":\"GPU gfx\"}") != NULL);
+  TEST_ASSERT_TRUE(strstr(json, "\"args\":{\"gfx ring jobs\":1}") != NULL);
+  TEST_ASSERT_TRUE(strstr(json, "\"args\":{\"gfx ring jobs\":0}") != NULL);
+  free(json);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Several threads into a small array
+ * ============================================================================ */
+
+#define DROP_THREADS 4
+#define DROP_EVENTS 100
+#define DROP_CAP 64
+
+static void *drop_thread(void *arg) {
+  (void)arg;
+  for (int i = 0; i < DROP_EVENTS; i++)
+    os_trace_counter(OS_TRACE_RING, "fill", i);
+  return NULL;
+}
+
+TEST_CASE(trace_full_array_drops)
+{
+  TEST_ASSERT_EQUAL_INT(0, os_trace_start(TRACE_PATH, DROP_CAP));
+  pthread_t t[DROP_THREADS];
+  for (int i = 0; i < DROP_THREADS; i++)
+    pthread_create(&t[i], NULL, drop_thread, NULL);
+  for (int i = 0; i < DROP_THREADS; i++)
+    pthread_join(t[i], NULL);
+  TEST_ASSERT_EQUAL_INT(0, os_trace_stop());
+
+  struct os_trace_stats st;
+  os_trace_get_stats(&st);
+  TEST_ASSERT_EQUAL_INT(DROP_CAP, (int)st.events);
+  TEST_ASSERT_EQUAL_INT(DROP_THREADS * DROP_EVENTS - DROP_CAP, (int)st.dropped);
+
+  char *json = trace_read();
+  TEST_ASSERT_NOT_NULL(json);
+  TEST_ASSERT_EQUAL_INT(DROP_CAP, count_of(json, "\"ph\":\"C\""));
+  free(json);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t trace_tests[] = {
+    TEST_REGISTER(trace_export_json),
+    TEST_REGISTER(trace_ipc_and_ring_flows),
+    TEST_REGISTER(trace_full_array_drops),
+    TEST_REGISTER_END
+};
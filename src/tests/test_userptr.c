@@ -0,0 +1,153 @@
+/*
+ * Unit Tests for Userptr Import
+ *
+ * Tests core functionality:
+ * - Local and memfd imports hand the GPU the very same pages
+ * - A memfd that could shrink, or is too short, is turned away
+ * - Only the pid that lent the pages can release them, and only once
+ * - Invalidation and a disconnecting client leave nothing usable behind
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create
+#endif
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define UP_SIZE 8192
+
+/* ============================================================================
+ * Test Case: Import our own pages, release them as the owner only
+ * ============================================================================ */
+
+TEST_CASE(userptr_release_owner_only)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = (int32_t)getpid(); // Same address space: local path
+  void *pages = mmap(NULL, UP_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  TEST_ASSERT_TRUE(pages != MAP_FAILED);
+  memset(pages, 0x5a, UP_SIZE);
+
+  uint32_t handle = 0;
+  uint64_t gpu_addr = 0;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_import_userptr(&mock_gpu, pid,
+                                                 (uint64_t)(uintptr_t)pages + 1,
+                                                 UP_SIZE, 0, -1, 0, &handle,
+                                                 &gpu_addr)); // Unaligned
+  TEST_ASSERT_EQUAL_INT(0, rmapi_import_userptr(&mock_gpu, pid,
+                                                (uint64_t)(uintptr_t)pages,
+                                                UP_SIZE, 0, -1, 0, &handle,
+                                                &gpu_addr));
+
+  uint8_t got[16];
+  TEST_ASSERT_EQUAL_INT(0, rmapi_userptr_read(handle, UP_SIZE - 16, got, 16));
+  TEST_ASSERT_TRUE(got[0] == 0x5a && got[15] == 0x5a);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_userptr_read(handle, UP_SIZE - 8, got, 16));
+
+  // Somebody else (or an unverified pid 0) can't take them away
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_release_userptr(&mock_gpu, pid + 1, handle));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_release_userptr(&mock_gpu, 0, handle));
+  struct amdgpu_buffer buf;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_userptr_get(handle, &buf));
+
+  TEST_ASSERT_EQUAL_INT(0, rmapi_release_userptr(&mock_gpu, pid, handle));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_release_userptr(&mock_gpu, pid, handle));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_userptr_get(handle, &buf));
+  munmap(pages, UP_SIZE);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: A memfd maps the same pages on our side
+ * ============================================================================ */
+
+TEST_CASE(userptr_memfd_import)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = 6262;
+  int memfd = memfd_create("test_userptr", MFD_ALLOW_SEALING);
+  TEST_ASSERT_TRUE(memfd >= 0);
+  TEST_ASSERT_EQUAL_INT(0, ftruncate(memfd, UP_SIZE));
+  uint8_t *client = mmap(NULL, UP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         memfd, 0);
+  TEST_ASSERT_TRUE(client != MAP_FAILED);
+
+  // Not sealed yet: it could shrink under our mapping
+  uint32_t handle = 0;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_import_userptr(&mock_gpu, pid, 0x7f0000000000ull,
+                                                 UP_SIZE, 0, memfd, 0, &handle,
+                                                 NULL));
+  TEST_ASSERT_EQUAL_INT(0, fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK));
+  // Sealed, but the range runs off its end
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_import_userptr(&mock_gpu, pid, 0x7f0000000000ull,
+                                                 UP_SIZE, 0, memfd, UP_SIZE,
+                                                 &handle, NULL));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_import_userptr(&mock_gpu, pid, 0x7f0000000000ull,
+                                                UP_SIZE, 0, memfd, 0, &handle,
+                                                NULL));
+  TEST_ASSERT_TRUE(ftruncate(memfd, 0) != 0);
+  client[100] = 0xc3; // The client writes, we see it without a copy
+  uint8_t got = 0;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_userptr_read(handle, 100, &got, 1));
+  TEST_ASSERT_EQUAL_INT(0xc3, got);
+
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_release_userptr(&mock_gpu, pid - 1, handle));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_release_userptr(&mock_gpu, pid, handle));
+  munmap(client, UP_SIZE);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Invalidation and disconnect only touch the owner's ranges
+ * ============================================================================ */
+
+TEST_CASE(userptr_invalidate_and_disconnect)
+{
+  struct OBJGPU mock_gpu = {0};
+  const int32_t pid = 6363;
+  int memfd = memfd_create("test_userptr", MFD_ALLOW_SEALING);
+  TEST_ASSERT_TRUE(memfd >= 0);
+  TEST_ASSERT_EQUAL_INT(0, ftruncate(memfd, 2 * UP_SIZE));
+  TEST_ASSERT_EQUAL_INT(0, fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK));
+  int memfd2 = dup(memfd);
+
+  uint32_t a = 0, b = 0;
+  uint64_t base = 0x7f0000100000ull;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_import_userptr(&mock_gpu, pid, base, UP_SIZE,
+                                                0, memfd, 0, &a, NULL));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_import_userptr(&mock_gpu, pid, base + UP_SIZE,
+                                                UP_SIZE, 0, memfd2, UP_SIZE,
+                                                &b, NULL));
+
+  // Somebody else unmapping the same addresses means nothing to us
+  TEST_ASSERT_EQUAL_INT(0, rmapi_invalidate_userptr(&mock_gpu, pid + 1, base,
+                                                    UP_SIZE));
+  TEST_ASSERT_EQUAL_INT(1, rmapi_invalidate_userptr(&mock_gpu, pid, base, 4096));
+  struct amdgpu_buffer buf;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_userptr_get(a, &buf));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_userptr_get(b, &buf));
+
+  // Hung up: both handles go, invalidated or not
+  rmapi_release_userptr_pid(&mock_gpu, pid);
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_release_userptr(&mock_gpu, pid, a));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_release_userptr(&mock_gpu, pid, b));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t userptr_tests[] = {
+    TEST_REGISTER(userptr_release_owner_only),
+    TEST_REGISTER(userptr_memfd_import),
+    TEST_REGISTER(userptr_invalidate_and_disconnect),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,219 @@
+/*
+ * Unit Tests for User-Mode Queues
+ *
+ * Tests core functionality:
+ * - Submitting through the mapped ring + doorbell, no IPC involved
+ * - Wrapping around a small ring
+ * - The software CP killing a queue that wrote something it shouldn't
+ * - Submits may touch the queue's BO list, and die with it
+ * - Ownership and teardown
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/rmapi/rmapi.h"
+#include "../../drivers/amdgpu/amdgpu_userq.h"
+#include "../../drivers/amdgpu/pm4_builder.h"
+#include "../../src/amd/amdgpu/navi10_sdma_pkt_open.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define GFX RMAPI_CLIENT_ENGINE_GFX
+#define DMA RMAPI_CLIENT_ENGINE_DMA
+#define MS 1000000ull
+
+struct test_queue {
+  struct rmapi_userq_info info;
+  struct amdgpu_userq q;
+  void *map;
+};
+
+static int open_queue_with(struct test_queue *t, uint32_t engine,
+                           uint32_t bytes, uint32_t bo_list) {
+  int fd = -1;
+  if (rmapi_userq_create(NULL, 0, engine, bytes, bo_list, &t->info, &fd) != 0)
+    return -1;
+  t->map = mmap(NULL, t->info.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd); // The mapping is all the app needs
+  if (t->map == MAP_FAILED)
+    return -1;
+  return amdgpu_userq_init(&t->q, t->map, t->info.size);
+}
+
+static int open_queue(struct test_queue *t, uint32_t engine, uint32_t bytes) {
+  return open_queue_with(t, engine, bytes, 0);
+}
+
+static uint32_t wait_error(struct test_queue *t) {
+  for (int i = 0; i < 2000 && !__atomic_load_n(&t->q.ctrl->error, __ATOMIC_ACQUIRE); i++)
+    usleep(1000);
+  return t->q.ctrl->error;
+}
+
+static void close_queue(struct test_queue *t) {
+  rmapi_userq_destroy(0, t->info.id);
+  munmap(t->map, t->info.size);
+}
+
+// Sleep on the queue's syncobj rather than spin on the control page
+static int wait_point(struct test_queue *t, uint64_t point) {
+  struct rmapi_syncobj_point p = {t->info.syncobj, 0, point};
+  return rmapi_syncobj_wait(&p, 1, RMAPI_SYNCOBJ_WAIT_ALL, 2000 * MS, NULL);
+}
+
+static uint32_t nop[2] = {PACKET3(PACKET3_NOP, 0), 0};
+
+/* ============================================================================
+ * Test Case: Ring, doorbell, done - and the server never heard from us
+ * ============================================================================ */
+
+TEST_CASE(userq_doorbell_submit)
+{
+  struct test_queue t;
+  TEST_ASSERT_EQUAL_INT(0, open_queue(&t, GFX, 5000));
+  TEST_ASSERT_EQUAL_INT(2048, (int)t.info.ring_dw); // Rounded up
+  TEST_ASSERT_EQUAL_INT(2048, (int)amdgpu_userq_space(&t.q));
+
+  uint64_t point = amdgpu_userq_submit(&t.q, nop, 2);
+  TEST_ASSERT_TRUE(point == 2);
+  TEST_ASSERT_EQUAL_INT(0, wait_point(&t, point));
+  TEST_ASSERT_TRUE(amdgpu_userq_done(&t.q, point));
+  TEST_ASSERT_TRUE(t.q.ctrl->rptr == point); // Fetched, ring space is back
+  TEST_ASSERT_EQUAL_INT(AMDGPU_USERQ_ERROR_NONE, (int)t.q.ctrl->error);
+
+  close_queue(&t);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: A small ring wraps around without losing packets
+ * ============================================================================ */
+
+TEST_CASE(userq_ring_wrap)
+{
+  struct test_queue t;
+  uint32_t batch[300];
+  for (int i = 0; i < 300; i += 2) {
+    batch[i] = nop[0];
+    batch[i + 1] = nop[1];
+  }
+  TEST_ASSERT_EQUAL_INT(0, open_queue(&t, GFX, 4096));
+
+  // 1024 dwords of ring, 3000 dwords of work: wraps twice, and the packet at
+  // the edge gets split across the end
+  uint64_t point = 0;
+  for (int i = 0; i < 10; i++) {
+    point = amdgpu_userq_submit(&t.q, batch, 300);
+    TEST_ASSERT_TRUE(point != 0);
+    TEST_ASSERT_EQUAL_INT(0, wait_point(&t, point));
+  }
+  TEST_ASSERT_TRUE(point == 3000);
+  TEST_ASSERT_TRUE(amdgpu_userq_done(&t.q, 3000));
+
+  // More than the ring holds never goes in
+  uint32_t huge[1026] = {0};
+  TEST_ASSERT_TRUE(amdgpu_userq_submit(&t.q, huge, 1026) == 0);
+
+  close_queue(&t);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Writing memory you don't own kills the queue, not the GPU
+ * ============================================================================ */
+
+TEST_CASE(userq_bad_packet)
+{
+  struct test_queue t;
+  uint32_t buf[16], data = 0xBAD;
+  struct pm4_builder b;
+  TEST_ASSERT_EQUAL_INT(0, open_queue(&t, GFX, 4096));
+
+  pm4_builder_init(&b, buf, 16, false);
+  pm4_write_data(&b, PM4_DST_MEM, 0x100000, &data, 1, false);
+  TEST_ASSERT_TRUE(amdgpu_userq_submit(&t.q, buf, b.cdw) != 0);
+
+  TEST_ASSERT_EQUAL_INT(AMDGPU_USERQ_ERROR_PACKET, (int)wait_error(&t));
+  TEST_ASSERT_TRUE(!amdgpu_userq_done(&t.q, b.cdw));
+  TEST_ASSERT_TRUE(amdgpu_userq_submit(&t.q, nop, 2) == 0); // Dead
+
+  close_queue(&t);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: The queue's BO list is what its packets may write
+ * ============================================================================ */
+
+TEST_CASE(userq_bo_list)
+{
+  struct OBJGPU mock_gpu = {0};
+  struct test_queue t;
+  uint32_t buf[16], data = 0x600D, bo, list;
+  uint64_t addr;
+  struct pm4_builder b;
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_create(&mock_gpu, 0, 4096, &bo, &addr));
+  struct rmapi_bo_list_entry e = {bo, 0, RMAPI_BO_LIST_WRITE, 0};
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_create(0, &e, 1, &list));
+
+  struct rmapi_userq_info info;
+  int fd;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_userq_create(NULL, 0, GFX, 4096, list + 1,
+                                               &info, &fd)); // No such list
+  TEST_ASSERT_EQUAL_INT(0, open_queue_with(&t, GFX, 4096, list));
+
+  pm4_builder_init(&b, buf, 16, false);
+  pm4_write_data(&b, PM4_DST_MEM, addr, &data, 1, false);
+  uint64_t point = amdgpu_userq_submit(&t.q, buf, b.cdw);
+  TEST_ASSERT_TRUE(point != 0);
+  TEST_ASSERT_EQUAL_INT(0, wait_point(&t, point));
+  TEST_ASSERT_EQUAL_INT(AMDGPU_USERQ_ERROR_NONE, (int)t.q.ctrl->error);
+
+  // The list went away: nothing left the queue may touch
+  TEST_ASSERT_EQUAL_INT(0, rmapi_bo_list_destroy(0, list));
+  TEST_ASSERT_TRUE(amdgpu_userq_submit(&t.q, nop, 2) != 0);
+  TEST_ASSERT_EQUAL_INT(AMDGPU_USERQ_ERROR_SUBMIT, (int)wait_error(&t));
+
+  close_queue(&t);
+  TEST_ASSERT_EQUAL_INT(0, rmapi_prime_unref(&mock_gpu, 0, bo));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: SDMA queues, and only the owner tears a queue down
+ * ============================================================================ */
+
+TEST_CASE(userq_sdma_and_owner)
+{
+  struct test_queue t;
+  uint32_t sdma_nop[2] = {SDMA_PKT_HEADER_OP(SDMA_OP_NOP),
+                          SDMA_PKT_HEADER_OP(SDMA_OP_NOP)};
+  TEST_ASSERT_EQUAL_INT(0, open_queue(&t, DMA, 4096));
+
+  uint64_t point = amdgpu_userq_submit(&t.q, sdma_nop, 2);
+  TEST_ASSERT_EQUAL_INT(0, wait_point(&t, point));
+
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_userq_destroy(4242, t.info.id));
+  TEST_ASSERT_EQUAL_INT(0, rmapi_userq_destroy(0, t.info.id));
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_userq_destroy(0, t.info.id));
+  munmap(t.map, t.info.size);
+
+  struct rmapi_userq_info info;
+  int fd;
+  TEST_ASSERT_EQUAL_INT(-1, rmapi_userq_create(NULL, 0, 7, 4096, 0, &info, &fd));
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t userq_tests[] = {
+    TEST_REGISTER(userq_doorbell_submit),
+    TEST_REGISTER(userq_ring_wrap),
+    TEST_REGISTER(userq_bad_packet),
+    TEST_REGISTER(userq_bo_list),
+    TEST_REGISTER(userq_sdma_and_owner),
+    TEST_REGISTER_END
+};
@@ -0,0 +1,135 @@
+/*
+ * Unit Tests for the Ring Watchdog
+ *
+ * Tests core functionality:
+ * - A ring whose fence stops moving is reported within its timeout
+ * - Fence progress keeps a busy ring off the hang list
+ * - Idle rings (and unwatched ones) don't wake the timer at all
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+#include "test_framework.h"
+#include "../../core/hal/hal.h"
+#include <pthread.h>
+#include <time.h>
+
+static int hang_count;
+static uint32_t hang_ring;
+static uint64_t hang_stuck, hang_last;
+static pthread_mutex_t hang_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hang_cond = PTHREAD_COND_INITIALIZER;
+
+static void record_hang(void *priv, uint32_t ring, uint64_t stuck_seq,
+                        uint64_t last_seq) {
+  (void)priv;
+  pthread_mutex_lock(&hang_lock);
+  hang_count++;
+  hang_ring = ring;
+  hang_stuck = stuck_seq;
+  hang_last = last_seq;
+  pthread_cond_broadcast(&hang_cond);
+  pthread_mutex_unlock(&hang_lock);
+}
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(long ms) {
+  struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+}
+
+/* ============================================================================
+ * Test Case: A stuck ring is caught within its timeout
+ * ============================================================================ */
+
+TEST_CASE(watchdog_detects_stuck_ring)
+{
+  hang_count = 0;
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_watchdog_init(record_hang, NULL));
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_watchdog_init(record_hang, NULL));
+  TEST_ASSERT_EQUAL_INT(-1, amdgpu_watchdog_set_timeout(
+                                AMDGPU_WATCHDOG_MAX_RINGS, 30));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_watchdog_set_timeout(2, 30));
+
+  uint64_t start = now_ms();
+  amdgpu_watchdog_arm(2, 1);
+  amdgpu_watchdog_arm(2, 2);
+  amdgpu_watchdog_signal(2, 1); // Job 1 finishes, job 2 never does
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += 2;
+  pthread_mutex_lock(&hang_lock);
+  while (!hang_count &&
+         pthread_cond_timedwait(&hang_cond, &hang_lock, &ts) == 0)
+    ;
+  pthread_mutex_unlock(&hang_lock);
+  uint64_t took = now_ms() - start;
+
+  TEST_ASSERT_EQUAL_INT(1, hang_count);
+  TEST_ASSERT_EQUAL_INT(2, (int)hang_ring);
+  TEST_ASSERT_TRUE(hang_stuck == 2 && hang_last == 2);
+  TEST_ASSERT_TRUE(took >= 30 && took < 1000);
+
+  // Reported once, not every time the timer comes around
+  sleep_ms(80);
+  TEST_ASSERT_EQUAL_INT(1, hang_count);
+  amdgpu_watchdog_signal(2, 2); // Recovery failed the job: ring is idle
+  amdgpu_watchdog_fini();
+  return 1;
+}
+
+/* ============================================================================
+ * Test Case: Progress resets the clock, idle rings sleep
+ * ============================================================================ */
+
+TEST_CASE(watchdog_progress_and_idle)
+{
+  hang_count = 0;
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_watchdog_init(record_hang, NULL));
+  TEST_ASSERT_EQUAL_INT(0, amdgpu_watchdog_set_timeout(0, 200));
+
+  // Four jobs, one finishing every 80 ms: 320 ms busy, never 200 ms stuck
+  for (uint64_t s = 1; s <= 4; s++)
+    amdgpu_watchdog_arm(0, s);
+  for (uint64_t s = 1; s <= 4; s++) {
+    sleep_ms(80);
+    amdgpu_watchdog_signal(0, s);
+  }
+  TEST_ASSERT_EQUAL_INT(0, hang_count);
+
+  // Idle now: the timer thread has nothing to wake up for
+  sleep_ms(250); // Let it get past any deadline it was sleeping towards
+  struct amdgpu_watchdog_stats before, after;
+  amdgpu_watchdog_get_stats(&before);
+  sleep_ms(250);
+  amdgpu_watchdog_get_stats(&after);
+  TEST_ASSERT_TRUE(after.wakeups == before.wakeups);
+  TEST_ASSERT_EQUAL_INT(4, (int)after.arms);
+  TEST_ASSERT_EQUAL_INT(4, (int)after.signals);
+
+  // Rings nobody gave a timeout are never on the clock
+  amdgpu_watchdog_arm(5, 1);
+  sleep_ms(50);
+  amdgpu_watchdog_get_stats(&after);
+  TEST_ASSERT_EQUAL_INT(0, (int)after.hangs);
+  TEST_ASSERT_TRUE(after.wakeups == before.wakeups);
+  amdgpu_watchdog_fini();
+  TEST_ASSERT_EQUAL_INT(0, hang_count);
+  return 1;
+}
+
+/* ============================================================================
+ * Test Registry
+ * ============================================================================ */
+
+test_entry_t watchdog_tests[] = {
+    TEST_REGISTER(watchdog_detects_stuck_ring),
+    TEST_REGISTER(watchdog_progress_and_idle),
+    TEST_REGISTER_END
+};
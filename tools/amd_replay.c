@@ -0,0 +1,707 @@
+#include "../core/rmapi/rmapi.h"
+#include "../core/ipc/ipc_protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Yo! This is amd_replay - the VCR for GPU bug reports.
+ * Point it at a trace the server wrote with AMDGPU_CAPTURE=<file> and it
+ * plays every allocation, upload, submission and wait back through RMAPI,
+ * in this process, on whatever backend you pick:
+ *
+ *   amd_replay [-b sim|drm|mmio] [-t] [-n loops] [-v] trace.bin
+ *
+ *   -b  Backend (AMDGPU_HAL_MODE). Default: whatever the HAL finds.
+ *   -t  Keep the original pacing instead of going as fast as possible.
+ *   -n  Play it this many times (warm caches, averages).
+ *   -v  Print every frame, not just the summary.
+ *
+ * A frame ends wherever a client waited (WAIT_FENCE, SYNCOBJ_WAIT,
+ * VK_WAIT_FOR_FENCES); we print how long each one took here next to how
+ * long it took when captured.
+ *
+ * Every request is played when its reply shows up in the trace, not when it
+ * was sent. A client only gets its reply once the request is done, so by
+ * then whatever a wait was waiting for (another client's signal, say) has
+ * been played too, and one thread is enough.
+ *
+ * New BOs land at new addresses. Command streams are patched by looking for
+ * 64-bit lo/hi dword pairs that fall inside a captured BO and moving them to
+ * the new one. That is a heuristic: addresses packed any other way (shifted
+ * shader addresses, say) are played as captured.
+ *
+ * Developed by: Haiku Imposible Team (HIT)
+ */
+
+struct replay_bo {
+  int32_t pid;
+  uint64_t orig_addr;  // What the server answered (gpu_addr, or the handle)
+  uint32_t orig_handle;
+  uint64_t size;
+  uint32_t handle;     // Ours
+  uint64_t addr;
+  int live;
+};
+
+struct replay_map {   // Captured handle / seq -> ours
+  uint32_t key_hi;    // Engine for fences, MAP_SYNCOBJ / MAP_BO_LIST
+  uint64_t from;
+  uint64_t to;
+};
+
+struct replay_client {
+  int32_t pid;
+  const struct rmapi_capture_record *pending; // Request waiting for its reply
+  uint64_t pending_ns;                        // ...and when it was sent
+};
+
+struct replay_stats {
+  uint64_t requests, submits, waits, bo_uploads, upload_bytes, relocs;
+  uint64_t skipped, diverged;
+  uint64_t *frame_ns, *frame_orig_ns;
+  uint32_t frames, frame_max;
+};
+
+static struct replay_bo *bos;
+static uint32_t bo_count, bo_max;
+static struct replay_map *maps;
+static uint32_t map_count, map_max;
+static struct replay_client clients[64];
+static uint32_t client_count;
+static uint64_t last_seq[RMAPI_SCHED_RING_COUNT];
+static struct replay_stats stats;
+static int verbose;
+
+#define MAP_SYNCOBJ 0xffffffffu
+#define MAP_BO_LIST 0xfffffffeu
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *grow(void *p, uint32_t *max, size_t elem) {
+  uint32_t n = *max ? *max * 2 : 64;
+  void *q = realloc(p, (size_t)n * elem);
+  if (!q) {
+    fprintf(stderr, "amd_replay: out of memory\n");
+    exit(1);
+  }
+  *max = n;
+  return q;
+}
+
+static void map_add(uint32_t key_hi, uint64_t from, uint64_t to) {
+  if (map_count == map_max)
+    maps = grow(maps, &map_max, sizeof(*maps));
+  maps[map_count++] = (struct replay_map){key_hi, from, to};
+}
+
+// Latest mapping wins: handles get reused after a destroy
+static int map_find(uint32_t key_hi, uint64_t from, uint64_t *to) {
+  for (uint32_t i = map_count; i-- > 0;) {
+    if (maps[i].key_hi == key_hi && maps[i].from == from) {
+      *to = maps[i].to;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static uint32_t map_syncobj(uint32_t handle) {
+  uint64_t to;
+  return map_find(MAP_SYNCOBJ, handle, &to) == 0 ? (uint32_t)to : 0;
+}
+
+static uint32_t map_bo_list(uint32_t handle) {
+  uint64_t to;
+  return handle && map_find(MAP_BO_LIST, handle, &to) == 0 ? (uint32_t)to : 0;
+}
+
+// A fence we never saw (its submit wasn't captured): wait for everything
+// on that engine instead, that's never too early.
+static uint64_t map_fence(uint32_t engine, uint64_t seq) {
+  uint64_t to;
+  if (engine >= RMAPI_SCHED_RING_COUNT)
+    return seq;
+  return map_find(engine, seq, &to) == 0 ? to : last_seq[engine];
+}
+
+static struct replay_client *client_get(int32_t pid) {
+  for (uint32_t i = 0; i < client_count; i++)
+    if (clients[i].pid == pid)
+      return &clients[i];
+  if (client_count == sizeof(clients) / sizeof(clients[0]))
+    return NULL;
+  clients[client_count] = (struct replay_client){pid, NULL, 0};
+  return &clients[client_count++];
+}
+
+// Same lookup the server does for FREE_MEMORY: handle, or low 32 address bits
+static struct replay_bo *bo_find(int32_t pid, uint64_t orig) {
+  for (uint32_t i = bo_count; i-- > 0;) {
+    struct replay_bo *bo = &bos[i];
+    if (bo->live && bo->pid == pid &&
+        (bo->orig_addr == orig || (uint32_t)bo->orig_addr == (uint32_t)orig ||
+         (bo->orig_handle && bo->orig_handle == (uint32_t)orig)))
+      return bo;
+  }
+  return NULL;
+}
+
+static struct replay_bo *bo_new(int32_t pid, uint64_t orig_addr, uint64_t size) {
+  uint32_t handle;
+  uint64_t addr;
+  if (rmapi_prime_create(NULL, pid, size, &handle, &addr) != 0)
+    return NULL;
+  if (bo_count == bo_max)
+    bos = grow(bos, &bo_max, sizeof(*bos));
+  struct replay_bo *bo = &bos[bo_count++];
+  *bo = (struct replay_bo){pid, orig_addr, 0, size, handle,
+                           addr ? addr : handle, 1};
+  return bo;
+}
+
+static void bo_upload(const struct rmapi_capture_record *rec) {
+  const struct rmapi_capture_bo *cap = (const void *)(rec + 1);
+  if (rec->size < sizeof(*cap))
+    return;
+  uint64_t len = rec->size - sizeof(*cap);
+  struct replay_bo *bo = bo_find(rec->pid, cap->gpu_addr);
+  if (!bo) // Imported or userptr in the capture: a plain BO will do here
+    bo = bo_new(rec->pid, cap->gpu_addr, cap->size);
+  if (!bo)
+    return;
+  bo->orig_handle = cap->handle;
+
+  struct amdgpu_buffer buf;
+  if (len > bo->size || rmapi_prime_get(bo->handle, &buf) != 0 ||
+      !buf.cpu_addr) {
+    stats.skipped++;
+    return;
+  }
+  memcpy(buf.cpu_addr, cap + 1, len);
+  memset((char *)buf.cpu_addr + len, 0, bo->size - len);
+  stats.bo_uploads++;
+  stats.upload_bytes += len;
+}
+
+// Move captured BO addresses in a command stream to where the BOs are now
+static void relocate(uint32_t *dw, size_t ndw) {
+  for (size_t i = 0; i + 1 < ndw; i++) {
+    uint64_t v = dw[i] | (uint64_t)dw[i + 1] << 32;
+    if (!v)
+      continue;
+    for (uint32_t b = 0; b < bo_count; b++) {
+      struct replay_bo *bo = &bos[b];
+      // Handles (kernel BOs before mapping) are 32-bit, never an address
+      if (!bo->live || bo->orig_addr <= UINT32_MAX || v < bo->orig_addr ||
+          v - bo->orig_addr >= bo->size)
+        continue;
+      uint64_t moved = bo->addr + (v - bo->orig_addr);
+      if (moved != v) {
+        dw[i] = (uint32_t)moved;
+        dw[i + 1] = (uint32_t)(moved >> 32);
+        stats.relocs++;
+      }
+      i++;
+      break;
+    }
+  }
+}
+
+static void release_client(int32_t pid) {
+  rmapi_bo_list_release_pid(pid);
+  rmapi_prime_release_pid(NULL, pid);
+  rmapi_userq_release_pid(pid);
+  rmapi_sched_release_pid(pid);
+  rmapi_syncobj_release_pid(pid);
+  rmapi_client_close(pid);
+  for (uint32_t i = 0; i < bo_count; i++)
+    if (bos[i].pid == pid)
+      bos[i].live = 0;
+}
+
+static int submit(int32_t pid, uint32_t engine, const void *cmds, size_t size,
+                  uint32_t bo_list, const struct rmapi_sched_dep *deps,
+                  uint32_t dep_count, const struct rmapi_syncobj_point *signals,
+                  uint32_t signal_count, uint64_t *seq) {
+  uint32_t *dw = malloc(size ? size : 4);
+  if (!dw)
+    return -1;
+  memcpy(dw, cmds, size);
+  relocate(dw, size / 4);
+  struct amdgpu_command_buffer cb = {NULL, dw, size, NULL, 0};
+  struct rmapi_bo_list *list =
+      bo_list ? rmapi_bo_list_acquire(pid, bo_list, &cb) : NULL;
+  // The server checks every IPC stream, so do we (AMDGPU_CS_VALIDATE works)
+  int ret = bo_list && !list ? -1
+                             : rmapi_cs_validate(pid, engine, cb.cmds, cb.size,
+                                                 cb.bo_list, cb.bo_count);
+  if (ret == 0)
+    ret = rmapi_sched_submit(pid, engine, &cb, deps, dep_count, signals,
+                             signal_count, seq);
+  rmapi_bo_list_put(list);
+  free(dw);
+  stats.submits++;
+  if (ret == 0 && seq && engine < RMAPI_SCHED_RING_COUNT &&
+      *seq > last_seq[engine])
+    last_seq[engine] = *seq;
+  return ret;
+}
+
+static int syncobj_wait(const void *data, uint32_t size, int fences,
+                        uint32_t *first) {
+  const struct ipc_syncobj_wait *w = data;
+  if (size < sizeof(*w) ||
+      w->count > (size - sizeof(*w)) / sizeof(struct rmapi_syncobj_point))
+    return -1;
+  struct rmapi_syncobj_point *pts = malloc((w->count + 1) * sizeof(*pts));
+  if (!pts)
+    return -1;
+  memcpy(pts, w + 1, w->count * sizeof(*pts));
+  for (uint32_t i = 0; i < w->count; i++) {
+    pts[i].handle = map_syncobj(pts[i].handle);
+    if (fences)
+      pts[i].point = 1;
+  }
+  int ret = rmapi_syncobj_wait(pts, w->count, w->flags, w->timeout_ns, first);
+  free(pts);
+  return ret;
+}
+
+static int reply_int(const struct rmapi_capture_record *rep) {
+  return rep->size >= sizeof(int) ? *(const int *)(const void *)(rep + 1) : 0;
+}
+
+// Play req now that its reply rep is here. Returns 1 if it ended a frame.
+static int play(const struct rmapi_capture_record *req,
+                const struct rmapi_capture_record *rep) {
+  const void *data = req + 1;
+  const void *out = rep + 1;
+  int32_t pid = req->pid;
+  int ret = 0, orig = 0, frame = 0;
+  stats.requests++;
+
+  switch (req->type) {
+  case IPC_REQ_ALLOC_MEMORY: {
+    if (req->size < sizeof(size_t) || rep->size < sizeof(uint64_t))
+      break;
+    uint64_t orig_addr = *(const uint64_t *)out;
+    struct replay_bo *bo = bo_new(pid, orig_addr, *(const size_t *)data);
+    ret = bo ? 0 : -1;
+    orig = orig_addr ? 0 : -1;
+    break;
+  }
+  case IPC_REQ_FREE_MEMORY: {
+    if (req->size < sizeof(uint64_t))
+      break;
+    struct replay_bo *bo = bo_find(pid, *(const uint64_t *)data);
+    ret = bo ? rmapi_prime_unref(NULL, pid, bo->handle) : -1;
+    if (bo)
+      bo->live = 0;
+    orig = reply_int(rep);
+    break;
+  }
+  case IPC_REQ_SUBMIT_COMMAND:
+    ret = submit(pid, RMAPI_CLIENT_ENGINE_GFX, data, req->size, 0, NULL, 0,
+                 NULL, 0, NULL);
+    orig = reply_int(rep);
+    break;
+  case IPC_REQ_SUBMIT_COMMAND_DEPS: {
+    const struct ipc_submit_deps *d = data;
+    const struct ipc_submit_reply *r = out;
+    if (req->size < sizeof(*d) || rep->size < sizeof(*r) ||
+        (uint64_t)d->dep_count * sizeof(struct rmapi_sched_dep) +
+                (uint64_t)d->signal_count * sizeof(struct rmapi_syncobj_point) >
+            req->size - sizeof(*d))
+      break;
+    struct rmapi_sched_dep *deps = malloc((d->dep_count + 1) * sizeof(*deps));
+    struct rmapi_syncobj_point *sig =
+        malloc((d->signal_count + 1) * sizeof(*sig));
+    if (!deps || !sig) {
+      free(deps);
+      free(sig);
+      ret = -1;
+      break;
+    }
+    memcpy(deps, d + 1, d->dep_count * sizeof(*deps));
+    const struct rmapi_syncobj_point *in_sig =
+        (const void *)((const struct rmapi_sched_dep *)(d + 1) + d->dep_count);
+    memcpy(sig, in_sig, d->signal_count * sizeof(*sig));
+    for (uint32_t i = 0; i < d->dep_count; i++) {
+      if (deps[i].type == RMAPI_SCHED_DEP_FENCE)
+        deps[i].value = map_fence(deps[i].id, deps[i].value);
+      else
+        deps[i].id = map_syncobj(deps[i].id);
+    }
+    for (uint32_t i = 0; i < d->signal_count; i++)
+      sig[i].handle = map_syncobj(sig[i].handle);
+    const char *cmds = (const char *)(in_sig + d->signal_count);
+    uint64_t seq = 0;
+    ret = submit(pid, d->engine, cmds, req->size - (cmds - (const char *)data),
+                 map_bo_list(d->bo_list), deps, d->dep_count, sig,
+                 d->signal_count, &seq);
+    if (ret == 0 && r->result == 0 && d->engine < RMAPI_SCHED_RING_COUNT)
+      map_add(d->engine, r->seq, seq);
+    orig = r->result;
+    free(deps);
+    free(sig);
+    break;
+  }
+  case IPC_REQ_WAIT_FENCE: {
+    const struct ipc_fence_wait *w = data;
+    if (req->size < sizeof(*w))
+      break;
+    ret = rmapi_sched_fence_wait(w->engine, map_fence(w->engine, w->seq),
+                                 w->timeout_ns);
+    orig = reply_int(rep);
+    stats.waits++;
+    frame = 1;
+    break;
+  }
+  case IPC_REQ_BO_LIST: {
+    const struct ipc_bo_list *b = data;
+    const struct ipc_bo_list_reply *r = out;
+    if (req->size < sizeof(*b) || rep->size < sizeof(*r) ||
+        (uint64_t)b->count * sizeof(struct rmapi_bo_list_entry) +
+                (uint64_t)b->remove_count * sizeof(uint32_t) >
+            req->size - sizeof(*b))
+      break;
+    // Buffers are named like FREE_MEMORY names them: ours now
+    struct rmapi_bo_list_entry *entries =
+        malloc((b->count + 1) * sizeof(*entries));
+    uint32_t *remove = malloc((b->remove_count + 1) * sizeof(*remove));
+    if (!entries || !remove) {
+      free(entries);
+      free(remove);
+      ret = -1;
+      break;
+    }
+    memcpy(entries, b + 1, b->count * sizeof(*entries));
+    memcpy(remove, (const struct rmapi_bo_list_entry *)(b + 1) + b->count,
+           b->remove_count * sizeof(*remove));
+    for (uint32_t i = 0; i < b->count; i++) {
+      struct replay_bo *bo = bo_find(pid, entries[i].bo_handle);
+      entries[i].bo_handle = bo ? bo->handle : 0;
+    }
+    for (uint32_t i = 0; i < b->remove_count; i++) {
+      struct replay_bo *bo = bo_find(pid, remove[i]);
+      remove[i] = bo ? bo->handle : 0;
+    }
+    uint32_t handle = map_bo_list(b->handle);
+    switch (b->op) {
+    case IPC_BO_LIST_CREATE:
+      ret = rmapi_bo_list_create(pid, entries, b->count, &handle);
+      if (ret == 0)
+        map_add(MAP_BO_LIST, r->handle, handle);
+      break;
+    case IPC_BO_LIST_UPDATE:
+      ret = rmapi_bo_list_update(pid, handle, entries, b->count, remove,
+                                 b->remove_count);
+      break;
+    case IPC_BO_LIST_DESTROY:
+      ret = rmapi_bo_list_destroy(pid, handle);
+      break;
+    }
+    orig = r->result;
+    free(entries);
+    free(remove);
+    break;
+  }
+  case IPC_REQ_SYNCOBJ: {
+    const struct ipc_syncobj *s = data;
+    const struct ipc_syncobj_reply *r = out;
+    if (req->size < sizeof(*s) || rep->size < sizeof(*r))
+      break;
+    uint32_t handle = map_syncobj(s->handle);
+    uint64_t point;
+    switch (s->op) {
+    case IPC_SYNCOBJ_CREATE:
+      ret = rmapi_syncobj_create(rmapi_get_gpu(), pid, s->point, &handle);
+      if (ret == 0)
+        map_add(MAP_SYNCOBJ, r->handle, handle);
+      break;
+    case IPC_SYNCOBJ_DESTROY:
+      ret = rmapi_syncobj_destroy(pid, handle);
+      break;
+    case IPC_SYNCOBJ_SIGNAL:
+      ret = rmapi_syncobj_signal(0, handle, s->point);
+      break;
+    case IPC_SYNCOBJ_RESET:
+      ret = rmapi_syncobj_reset(0, handle);
+      break;
+    case IPC_SYNCOBJ_QUERY:
+      ret = rmapi_syncobj_query(0, handle, &point);
+      break;
+    default: // eventfd / sync_file exports: nobody here to hand them to
+      stats.skipped++;
+      ret = r->result;
+      break;
+    }
+    orig = r->result;
+    break;
+  }
+  case IPC_REQ_SYNCOBJ_WAIT:
+  case IPC_REQ_VK_WAIT_FOR_FENCES: {
+    const struct ipc_syncobj_reply *r = out;
+    uint32_t first = 0;
+    ret = syncobj_wait(data, req->size, req->type == IPC_REQ_VK_WAIT_FOR_FENCES,
+                       &first);
+    orig = rep->size >= sizeof(*r) ? r->result : 0;
+    stats.waits++;
+    frame = 1;
+    break;
+  }
+  case IPC_REQ_VK_CREATE_FENCE:
+  case IPC_REQ_VK_CREATE_SEMAPHORE: {
+    const struct ipc_syncobj_reply *r = out;
+    if (rep->size < sizeof(*r))
+      break;
+    uint32_t handle;
+    ret = rmapi_syncobj_create(rmapi_get_gpu(), pid, r->point, &handle);
+    if (ret == 0)
+      map_add(MAP_SYNCOBJ, r->handle, handle);
+    orig = r->result;
+    break;
+  }
+  case IPC_REQ_VK_DESTROY_FENCE:
+  case IPC_REQ_VK_DESTROY_SEMAPHORE:
+    if (req->size >= sizeof(uint32_t))
+      ret = rmapi_syncobj_destroy(pid, map_syncobj(*(const uint32_t *)data));
+    orig = reply_int(rep);
+    break;
+  case IPC_REQ_VK_RESET_FENCES:
+    for (uint32_t i = 0; i < req->size / sizeof(uint32_t); i++)
+      if (rmapi_syncobj_reset(0, map_syncobj(((const uint32_t *)data)[i])) != 0)
+        ret = -1;
+    orig = reply_int(rep);
+    break;
+  default:
+    // Info queries, stats, userptr, PRIME fds, user queues (those submit
+    // through memory, never through us): nothing to play back
+    stats.skipped++;
+    break;
+  }
+  if ((ret == 0) != (orig == 0))
+    stats.diverged++;
+  return frame;
+}
+
+static void frame_done(uint64_t ns, uint64_t orig_ns) {
+  if (stats.frames == stats.frame_max) {
+    uint32_t max = stats.frame_max ? stats.frame_max * 2 : 256;
+    uint64_t *a = realloc(stats.frame_ns, max * sizeof(uint64_t));
+    if (a)
+      stats.frame_ns = a;
+    uint64_t *b = realloc(stats.frame_orig_ns, max * sizeof(uint64_t));
+    if (b)
+      stats.frame_orig_ns = b;
+    if (!a || !b)
+      return; // Stop counting frames, keep playing
+    stats.frame_max = max;
+  }
+  if (verbose)
+    printf("frame %6u: %9.3f ms (captured %9.3f ms)\n", stats.frames,
+           ns / 1e6, orig_ns / 1e6);
+  stats.frame_ns[stats.frames] = ns;
+  stats.frame_orig_ns[stats.frames] = orig_ns;
+  stats.frames++;
+}
+
+// One pass over the trace. Captured times count from first_ns, the first
+// record (the server may have idled a while before anyone connected).
+// Returns the wall time it took.
+static uint64_t replay_once(const char *trace, size_t len, uint64_t first_ns,
+                            int timing) {
+  uint64_t start = now_ns(), last_frame = start, last_frame_orig = first_ns;
+  size_t off = sizeof(struct rmapi_capture_header);
+
+  while (off + sizeof(struct rmapi_capture_record) <= len) {
+    const struct rmapi_capture_record *rec = (const void *)(trace + off);
+    if (rec->size > len - off - sizeof(*rec))
+      break; // Truncated (server died mid-write): play what we have
+    off += RMAPI_CAPTURE_RECORD_BYTES(rec);
+
+    struct replay_client *c = client_get(rec->pid);
+    if (!c)
+      continue;
+    switch (rec->kind) {
+    case RMAPI_CAPTURE_CLIENT:
+      if (rec->type)
+        rmapi_client_open(rec->pid);
+      else
+        release_client(rec->pid);
+      c->pending = NULL;
+      break;
+    case RMAPI_CAPTURE_BO:
+      bo_upload(rec);
+      break;
+    case RMAPI_CAPTURE_REQUEST:
+      c->pending = rec;
+      c->pending_ns = rec->time_ns;
+      break;
+    case RMAPI_CAPTURE_REPLY:
+      if (!c->pending || c->pending->id != rec->id)
+        break;
+      if (timing) {
+        uint64_t due = start + (c->pending_ns - first_ns), now = now_ns();
+        if (due > now) {
+          struct timespec ts = {(time_t)((due - now) / 1000000000ull),
+                                (long)((due - now) % 1000000000ull)};
+          nanosleep(&ts, NULL);
+        }
+      }
+      if (play(c->pending, rec)) {
+        uint64_t now = now_ns();
+        frame_done(now - last_frame, rec->time_ns - last_frame_orig);
+        last_frame = now;
+        last_frame_orig = rec->time_ns;
+      }
+      c->pending = NULL;
+      break;
+    }
+  }
+
+  // Let the GPU finish, then drop whoever was still connected at the end
+  for (uint32_t e = 0; e < RMAPI_SCHED_RING_COUNT; e++)
+    if (last_seq[e])
+      rmapi_sched_fence_wait(e, last_seq[e], 5000000000ull);
+  uint64_t elapsed = now_ns() - start;
+  for (uint32_t i = 0; i < client_count; i++)
+    release_client(clients[i].pid);
+  client_count = 0;
+  bo_count = 0;
+  map_count = 0;
+  return elapsed;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void report(uint64_t total_ns, uint64_t captured_ns, int loops) {
+  printf("amd_replay: %d pass(es), %.3f ms (captured: %.3f ms per pass)\n",
+         loops, total_ns / 1e6, captured_ns / 1e6);
+  printf("  requests %llu, submits %llu, waits %llu, skipped %llu, "
+         "diverged %llu\n",
+         (unsigned long long)stats.requests, (unsigned long long)stats.submits,
+         (unsigned long long)stats.waits, (unsigned long long)stats.skipped,
+         (unsigned long long)stats.diverged);
+  printf("  BO uploads %llu (%llu bytes), addresses relocated %llu\n",
+         (unsigned long long)stats.bo_uploads,
+         (unsigned long long)stats.upload_bytes,
+         (unsigned long long)stats.relocs);
+  if (!stats.frames)
+    return;
+
+  uint64_t sum = 0, orig_sum = 0;
+  for (uint32_t i = 0; i < stats.frames; i++) {
+    sum += stats.frame_ns[i];
+    orig_sum += stats.frame_orig_ns[i];
+  }
+  qsort(stats.frame_ns, stats.frames, sizeof(uint64_t), cmp_u64);
+  uint64_t *f = stats.frame_ns;
+  uint32_t n = stats.frames;
+  printf("  frames %u: avg %.3f ms (captured %.3f), min %.3f, p50 %.3f, "
+         "p99 %.3f, max %.3f\n",
+         n, sum / 1e6 / n, orig_sum / 1e6 / n, f[0] / 1e6, f[n / 2] / 1e6,
+         f[(uint64_t)n * 99 / 100] / 1e6, f[n - 1] / 1e6);
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: amd_replay [-b sim|drm|mmio] [-t] [-n loops] [-v] "
+                  "trace\n");
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL, *backend = NULL;
+  int timing = 0, loops = 1;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-b") && i + 1 < argc)
+      backend = argv[++i];
+    else if (!strcmp(argv[i], "-t"))
+      timing = 1;
+    else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+      loops = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-v"))
+      verbose = 1;
+    else if (argv[i][0] != '-' && !path)
+      path = argv[i];
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (!path || loops < 1) {
+    usage();
+    return 2;
+  }
+
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *trace = len > 0 ? malloc((size_t)len) : NULL;
+  if (!trace || fread(trace, 1, (size_t)len, f) != (size_t)len) {
+    fprintf(stderr, "amd_replay: can't read %s\n", path);
+    fclose(f);
+    free(trace);
+    return 1;
+  }
+  fclose(f);
+
+  const struct rmapi_capture_header *hdr = (const void *)trace;
+  if ((size_t)len < sizeof(*hdr) || hdr->magic != RMAPI_CAPTURE_MAGIC ||
+      hdr->version != RMAPI_CAPTURE_VERSION) {
+    fprintf(stderr, "amd_replay: %s is not a capture (or a newer one)\n", path);
+    free(trace);
+    return 1;
+  }
+
+  if (backend)
+    setenv("AMDGPU_HAL_MODE", backend, 1);
+  if (rmapi_init() != 0) {
+    fprintf(stderr, "amd_replay: RMAPI init failed\n");
+    free(trace);
+    return 1;
+  }
+  printf("amd_replay: %s, captured on HAL mode %u, playing on %d\n", path,
+         hdr->hal_mode, amdgpu_hal_get_mode());
+
+  // Captured length: first to last timestamp in the file
+  uint64_t first_ns = UINT64_MAX, last_ns = 0;
+  for (size_t off = sizeof(*hdr);
+       off + sizeof(struct rmapi_capture_record) <= (size_t)len;) {
+    const struct rmapi_capture_record *rec = (const void *)(trace + off);
+    if (rec->size > (size_t)len - off - sizeof(*rec))
+      break;
+    if (first_ns == UINT64_MAX)
+      first_ns = rec->time_ns;
+    last_ns = rec->time_ns;
+    off += RMAPI_CAPTURE_RECORD_BYTES(rec);
+  }
+  if (first_ns == UINT64_MAX)
+    first_ns = 0;
+
+  uint64_t total = 0;
+  for (int i = 0; i < loops; i++)
+    total += replay_once(trace, (size_t)len, first_ns, timing);
+  report(total, last_ns - first_ns, loops);
+
+  rmapi_fini();
+  free(trace);
+  free(bos);
+  free(maps);
+  free(stats.frame_ns);
+  free(stats.frame_orig_ns);
+  return stats.diverged ? 3 : 0;
+}